@@ -3,9 +3,7 @@
 
 -- Bootstrap: load core module infrastructure (provides load_module, spawn, run_gc)
 local function bootstrap(path)
-    local content = async_read(path)
-    if not content then error("Failed to read: " .. path) end
-    local chunk, err = load(content, "@" .. path)
+    local chunk, err = ez.system.load_embedded(path)
     if not chunk then error("Parse error in " .. path .. ": " .. tostring(err)) end
     local ok, result = pcall(chunk)
     if not ok then error("Execute error in " .. path .. ": " .. tostring(result)) end
@@ -13,6 +11,8 @@ local function bootstrap(path)
 end
 
 bootstrap("$core/modules.lua")
+-- Traces every module load from here on and provides lazy_require()
+bootstrap("$core/module_trace.lua")
 
 -- Hot reload: replace a module from a LittleFS file, bypassing embedded scripts.
 -- Used by the remote tool during development to push changes without reflashing.
@@ -135,6 +135,9 @@ local function boot_sequence()
     local touch_input_ok, touch_input = pcall(require, "ezui.touch_input")
     if touch_input_ok then touch_input.init() end
 
+    -- Frame timing overlay, off unless enabled in Display settings.
+    require("ezui.perf_hud").init()
+
     ez.log("[Boot] Framework loaded")
 
     -- Start background services
@@ -157,29 +160,37 @@ local function boot_sequence()
     local dm_svc = require("services.direct_messages")
     dm_svc.init()
 
+    -- The services below aren't needed to draw the desktop, so they're
+    -- lazy: each loads and initialises on first use, or when the
+    -- prefetch started after ui.start() gets to it (declaration order).
+
     -- Custom packets: P2P extension layer on RAW_CUSTOM. Subscribes
     -- after dm_svc so the DM internals it borrows are ready.
     -- register_demos() installs PING / PONG / GPS\0 handlers; remove
     -- that call to strip the demo subtypes in a production build.
-    local custom = require("services.custom_packets")
-    custom.init()
-    custom.register_demos()
+    lazy_require("services.custom_packets", function(custom)
+        custom.init()
+        custom.register_demos()
+    end)
 
     -- File transfer rides on custom_packets+ACK. Registers its "FILE"
     -- subtype and listens for delivered/undelivered events so the
     -- sender pipeline advances chunk by chunk.
-    local file_transfer = require("services.file_transfer")
-    file_transfer.init()
+    lazy_require("services.file_transfer", function(file_transfer)
+        file_transfer.init()
+    end)
 
-    local ui_sounds = require("services.ui_sounds")
-    ui_sounds.init()
+    -- Preloads the click samples from storage: the slowest init here.
+    lazy_require("services.ui_sounds", function(ui_sounds)
+        ui_sounds.init()
+    end)
 
     -- Notifications service + OTA hookup. The service is just an
     -- in-memory queue; the toast overlay in ezui.screen subscribes to
     -- "notifications/changed" and shows the latest one for a few
     -- seconds. Hooking ota/progress here means a successful OTA push
     -- announces itself wherever the user happens to be.
-    local notifications = require("services.notifications")
+    local notifications = lazy_require("services.notifications")
     ez.bus.subscribe("ota/progress", function(_topic, data)
         if type(data) ~= "table" then return end
         if data.phase == "end" and not data.error then
@@ -207,16 +218,17 @@ local function boot_sequence()
     -- handlers register themselves here; screens opened from the registry
     -- are loaded lazily on first `open()` so unused apps don't pull their
     -- screen module into memory at boot.
-    local apps = require("services.apps")
-    apps.register({
-        id    = "text_editor",
-        label = "Text Editor",
-        exts  = { "md", "txt", "log", "csv", "lua", "json", "ini", "conf" },
-        open  = function(path)
-            local ed = require("screens.tools.text_editor")
-            ed.open(path)
-        end,
-    })
+    lazy_require("services.apps", function(apps)
+        apps.register({
+            id    = "text_editor",
+            label = "Text Editor",
+            exts  = { "md", "txt", "log", "csv", "lua", "json", "ini", "conf" },
+            open  = function(path)
+                local ed = require("screens.tools.text_editor")
+                ed.open(path)
+            end,
+        })
+    end)
 
     -- Engage raw matrix mode. The C3 keyboard controller sometimes
     -- refuses the mode-switch command during the first ~200 ms after
@@ -237,8 +249,9 @@ local function boot_sequence()
 
     -- GPS: start the background clock-sync loop. Respects the user's
     -- "never / at boot / hourly" preference; does nothing if GPS is disabled.
-    local gps_svc = require("services.gps")
-    gps_svc.start_sync_loop()
+    lazy_require("services.gps", function(gps_svc)
+        gps_svc.start_sync_loop()
+    end)
 
     ez.log("[Boot] Services started")
 
@@ -270,12 +283,9 @@ local function boot_sequence()
 
     -- Kick the SNTP client once WiFi is up. Service polls the link
     -- itself so we don't block boot waiting for an association.
-    do
-        local ok, ntp_svc = pcall(require, "services.ntp")
-        if ok and ntp_svc and ntp_svc.kick_after_wifi then
-            ntp_svc.kick_after_wifi()
-        end
-    end
+    lazy_require("services.ntp", function(ntp_svc)
+        if ntp_svc.kick_after_wifi then ntp_svc.kick_after_wifi() end
+    end)
 
     -- Restore the Dev OTA push server if the user left it enabled.
     -- WiFi association takes a few seconds after connect(), so poll
@@ -303,6 +313,7 @@ local function boot_sequence()
     local Desktop = require("screens.desktop")
     local desktop = ui.create_screen(Desktop, {})
     ui.push(desktop)
+    module_trace.mark("desktop")
 
     -- First-run gate: if the user hasn't completed onboarding yet,
     -- push the wizard on top of the desktop. The wizard pops itself
@@ -319,6 +330,7 @@ local function boot_sequence()
     local theme_name = ez.storage.get_pref("theme", "dark")
     if theme_name ~= "dark" and theme_name ~= "light" then theme_name = "dark" end
     ui.start({ theme = theme_name })
+    module_trace.prefetch()
 
     -- After a fresh OTA the new image boots in the "pending verify"
     -- state — the bootloader auto-rolls back if we crash too many
@@ -330,6 +342,8 @@ local function boot_sequence()
         ez.system.set_timer(5000, function() ez.ota.mark_valid() end)
     end
 
+    module_trace.mark("boot")
+    module_trace.log(8)
     ez.log("[Boot] Boot complete")
 end
 
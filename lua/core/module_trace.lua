@@ -0,0 +1,235 @@
+-- Module load tracing and lazy requires for ezOS
+--
+-- Tracing: wraps require() and load_module() so every first-time load
+-- records how long it took, how much Lua heap it left behind and how many
+-- allocations it made. Nested loads are recorded too; `self_us` excludes
+-- time spent in nested loads so the report shows where boot time goes.
+--
+-- Lazy requires: lazy_require(name, on_load) installs a proxy in
+-- package.loaded so require(name) anywhere returns it without loading.
+-- The real module loads on first access (index, assignment, call, pairs)
+-- and on_load(module) runs right after, e.g. to init() a service. After
+-- the desktop is up, prefetch() loads whatever is still pending, one
+-- module per timer tick, so services come up without delaying the first
+-- frame.
+--
+-- With the "boot_eager" pref set, lazy_require() loads and initialises
+-- each module on the spot, as boot did before lazy loading, so the same
+-- build can time the desktop mark both ways.
+--
+-- Proxies suit modules used through their fields (services, helpers).
+-- Don't declare modules whose result is used as a metatable or compared
+-- by identity: a proxy is a different table.
+
+local trace = {
+    entries = {},   -- In load order
+    marks = {},     -- { name, us, modules }
+    max_entries = 256,
+    eager = (tonumber(ez.storage.get_pref("boot_eager", 0)) or 0) ~= 0,
+}
+
+local micros = ez.system.micros
+local alloc_count = ez.system.get_alloc_count
+local lua_memory = ez.system.get_lua_memory
+
+local start_us = micros()
+local stack = {}    -- Open entries, innermost last
+local lazy = {}     -- name -> { proxy, on_load } while not yet loaded
+local lazy_order = {}
+
+local function begin_load(name, kind)
+    local entry = {
+        name = name,
+        kind = kind,
+        depth = #stack,
+        at_us = micros() - start_us,
+        lazy = lazy[name] ~= nil,
+        child_us = 0,
+    }
+    entry.t0 = micros()
+    entry.a0 = alloc_count()
+    entry.m0 = lua_memory()
+    stack[#stack + 1] = entry
+    return entry
+end
+
+local function end_load(entry, ok)
+    entry.us = micros() - entry.t0
+    entry.allocs = alloc_count() - entry.a0
+    entry.bytes = lua_memory() - entry.m0
+    entry.self_us = entry.us - entry.child_us
+    entry.ok = ok
+    entry.t0, entry.a0, entry.m0, entry.child_us = nil, nil, nil, nil
+    stack[#stack] = nil
+    local parent = stack[#stack]
+    if parent then parent.child_us = parent.child_us + entry.us end
+    if #trace.entries < trace.max_entries then
+        trace.entries[#trace.entries + 1] = entry
+    end
+end
+
+-- Traceback taken where the error was raised; loads nest, so an error
+-- that already carries one passes through unchanged.
+local function with_traceback(err)
+    if type(err) == "string" and err:find("\nstack traceback:", 1, true) then
+        return err
+    end
+    return debug.traceback(err, 2)
+end
+
+-- Run fn(...) as a traced load of `name`, re-raising its error.
+local function traced(name, kind, fn, ...)
+    local entry = begin_load(name, kind)
+    local results = table.pack(xpcall(fn, with_traceback, ...))
+    end_load(entry, results[1])
+    if not results[1] then error(results[2], 0) end
+    return table.unpack(results, 2, results.n)
+end
+
+local raw_require = require
+function _G.require(name)
+    if package.loaded[name] ~= nil then return package.loaded[name] end
+    return traced(name, "require", raw_require, name)
+end
+
+local raw_load_module = _G.load_module
+if raw_load_module then
+    function _G.load_module(path, no_gc)
+        return traced(path, "load_module", raw_load_module, path, no_gc)
+    end
+end
+
+-- Record a point on the boot timeline (e.g. "desktop")
+function trace.mark(name)
+    trace.marks[#trace.marks + 1] = {
+        name = name,
+        us = micros() - start_us,
+        modules = #trace.entries,
+    }
+end
+
+-- Summary plus entries sorted by self time (heaviest first).
+function trace.report()
+    local sorted, total_us, bytes, allocs = {}, 0, 0, 0
+    for i, e in ipairs(trace.entries) do
+        sorted[i] = e
+        total_us = total_us + e.self_us
+        bytes = bytes + (e.depth == 0 and e.bytes or 0)
+        allocs = allocs + (e.depth == 0 and e.allocs or 0)
+    end
+    table.sort(sorted, function(a, b) return a.self_us > b.self_us end)
+
+    local pending = {}
+    for _, name in ipairs(lazy_order) do
+        if lazy[name] then pending[#pending + 1] = name end
+    end
+    return {
+        modules = #trace.entries,
+        load_us = total_us,
+        bytes = bytes,
+        allocs = allocs,
+        marks = trace.marks,
+        eager = trace.eager,
+        lazy_pending = pending,
+        entries = sorted,
+    }
+end
+
+-- Log the heaviest `limit` loads and the timeline marks.
+function trace.log(limit)
+    local r = trace.report()
+    ez.log(string.format("[Trace] %d modules, %.1f ms, %d KB, %d allocs%s",
+        r.modules, r.load_us / 1000, r.bytes // 1024, r.allocs,
+        r.eager and " (boot_eager)" or ""))
+    for _, m in ipairs(r.marks) do
+        ez.log(string.format("[Trace]   @%-12s %7.1f ms (%d modules)", m.name, m.us / 1000, m.modules))
+    end
+    for i = 1, math.min(limit or 10, #r.entries) do
+        local e = r.entries[i]
+        ez.log(string.format("[Trace]   %-32s self %6.1f ms, total %6.1f ms, %5d KB, %5d allocs%s",
+            e.name, e.self_us / 1000, e.us / 1000, e.bytes // 1024, e.allocs,
+            e.lazy and " (lazy)" or ""))
+    end
+    if #r.lazy_pending > 0 then
+        ez.log("[Trace]   not loaded: " .. table.concat(r.lazy_pending, ", "))
+    end
+end
+
+-- ---------------------------------------------------------------------------
+-- Lazy requires
+-- ---------------------------------------------------------------------------
+
+local function resolve(name)
+    local decl = lazy[name]
+    if not decl then return package.loaded[name] end
+    if decl.loading then error("lazy module " .. name .. " used while loading", 2) end
+    if package.loaded[name] == decl.proxy then package.loaded[name] = nil end
+
+    -- Stays declared while loading so the trace entry is flagged lazy
+    decl.loading = true
+    local ok, module = pcall(require, name)
+    decl.loading = false
+    lazy[name] = nil
+    if not ok then
+        -- Kept for the proxy: later accesses report this, not a nil index
+        decl.error = module
+        error(module, 0)
+    end
+    -- From now on the proxy forwards straight to the module.
+    local mt = getmetatable(decl.proxy)
+    if type(module) == "table" then
+        mt.__index = module
+        mt.__newindex = module
+    end
+    decl.module = module
+    if decl.on_load then decl.on_load(module) end
+    return module
+end
+
+function _G.lazy_require(name, on_load)
+    if package.loaded[name] ~= nil then
+        local module = package.loaded[name]
+        if on_load and not lazy[name] then on_load(module) end
+        return module
+    end
+
+    local proxy = {}
+    local decl = { proxy = proxy, on_load = on_load }
+    local function real()
+        if decl.error ~= nil then
+            error("lazy module " .. name .. " failed to load: " .. tostring(decl.error), 3)
+        end
+        return decl.module or resolve(name)
+    end
+    setmetatable(proxy, {
+        __index = function(_, k) return real()[k] end,
+        __newindex = function(_, k, v) real()[k] = v end,
+        __call = function(_, ...) return real()(...) end,
+        __pairs = function() return next, real(), nil end,
+        __len = function() return #real() end,
+    })
+    lazy[name] = decl
+    lazy_order[#lazy_order + 1] = name
+    package.loaded[name] = proxy
+    if trace.eager then return resolve(name) end
+    return proxy
+end
+
+-- Load pending lazy modules in the background, one per `interval_ms`.
+function trace.prefetch(interval_ms)
+    interval_ms = interval_ms or 50
+    local i = 0
+    local function step()
+        repeat i = i + 1 until i > #lazy_order or lazy[lazy_order[i]]
+        if i > #lazy_order then return end
+        local ok, err = pcall(resolve, lazy_order[i])
+        if not ok then
+            ez.log("[Lazy] " .. lazy_order[i] .. ": " .. tostring(err))
+        end
+        ez.system.set_timer(interval_ms, step)
+    end
+    ez.system.set_timer(interval_ms, step)
+end
+
+_G.module_trace = trace
+return trace
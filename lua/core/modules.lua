@@ -28,7 +28,9 @@ end
 _G.loaded_modules = {}
 
 -- Load a module using async I/O (must be called from within a coroutine)
--- Uses async_read which yields until the file is loaded
+-- Embedded ($) modules compile straight from flash; other paths use
+-- async_load, which yields while the source and its cached bytecode are
+-- read, then undumps (or compiles, on a cache miss) the chunk
 -- Returns the module result directly (no callback needed)
 -- @param path Path to the module file
 -- @param no_gc Skip GC before/after loading (for batch loading)
@@ -37,16 +39,14 @@ function _G.load_module(path, no_gc)
         run_gc("collect", "pre-load " .. path)
     end
 
-    -- Read file asynchronously - yields here, resumes when file is read
-    -- Note: async_read returns instantly for embedded scripts (no actual I/O)
-    local content = async_read(path)
-
-    if not content then
-        error("Failed to read: " .. path)
+    local chunk, err
+    if path:sub(1, 1) == "$" then
+        chunk, err = ez.system.load_embedded(path)
+    else
+        -- Yields here, resumes with the chunk; reparses only when the
+        -- file has changed
+        chunk, err = async_load(path)
     end
-
-    -- Compile the Lua code
-    local chunk, err = load(content, "@" .. path)
     if not chunk then
         error("Parse error in " .. path .. ": " .. tostring(err))
     end
@@ -73,79 +73,11 @@ function _G.unload_module(path)
     end
 end
 
--- Cooperative-yield scheduler.
---
--- IMPORTANT: this only resumes coroutines that explicitly opted in
--- via wait_ms() below. Coroutines that yield via C-side bindings
--- (ez.http.fetch, async I/O, defer()) are NOT added here -- those
--- have their own resume drivers in C++, and resuming them from this
--- scheduler too would either double-resume (causing
--- "cannot resume dead coroutine" on the C side) or feed nil into a
--- function that was waiting on a real response, corrupting state.
--- Earlier this file did add every suspended coroutine; that broke
--- ez.http.fetch and the OTA upload path among other things.
-local _pending_coros = {}
-
--- Spawn a coroutine and immediately resume it.
--- Use this to run async code (like load_module, manual TCP work, or
--- other multi-step flows) from event handlers.
---   * If `fn` yields via a C-side binding (ez.http.fetch / async
---     I/O / defer), that binding owns the resume.
---   * If `fn` yields via wait_ms() (cooperative sleep), the
---     scheduler below picks it up on the next tick.
--- @param fn Function to run in the coroutine
--- @return The coroutine object
-function _G.spawn(fn)
-    local co = coroutine.create(fn)
-    local ok, err = coroutine.resume(co)
-    if not ok and ez and ez.log then
-        ez.log("[spawn] error: " .. tostring(err))
-    end
-    return co
-end
-
--- Drain cooperatively-yielded coroutines once. Called from the main
--- loop (see ezui/init.lua) every frame. A coroutine that wait_ms()es
--- again is re-queued by the next wait call; a coroutine that finishes
--- or errors is dropped.
-function _G.tick_coroutines()
-    if #_pending_coros == 0 then return end
-    local ready = _pending_coros
-    _pending_coros = {}
-    for _, co in ipairs(ready) do
-        if coroutine.status(co) == "suspended" then
-            local ok, err = coroutine.resume(co)
-            if not ok and ez and ez.log then
-                ez.log("[coro] error: " .. tostring(err))
-            end
-            -- Notice we don't re-queue here -- if the coroutine
-            -- yielded again via wait_ms it will have re-registered
-            -- itself before yielding (see _enqueue_self below).
-        end
-    end
-end
-
--- Internal: register the running coroutine for the next tick. Used
--- by wait_ms() before each yield so the scheduler knows to pick it
--- up. Stays out of the public surface to discourage callers from
--- bypassing wait_ms.
-local function _enqueue_self()
-    local co = coroutine.running()
-    if co then _pending_coros[#_pending_coros + 1] = co end
-end
-
--- Cooperative sleep usable inside a spawn()'d coroutine. Yields the
--- coroutine repeatedly until `ms` milliseconds have elapsed, so the
--- main loop continues to render frames and process input while the
--- caller waits. Replaces ez.system.delay() in async code paths --
--- that one blocks the whole Lua runtime.
-function _G.wait_ms(ms)
-    local deadline = ez.system.millis() + (ms or 0)
-    while ez.system.millis() < deadline do
-        _enqueue_self()
-        coroutine.yield()
-    end
-end
+-- spawn(fn, ...), defer() and wait_ms(ms) are native (src/lua/scheduler.cpp).
+-- The scheduler there owns every coroutine that waits on the firmware:
+-- async I/O, HTTP, defer and wait_ms completions wake the task and it is
+-- resumed from one run queue each frame, so spawning from inside a spawned
+-- coroutine is safe. async_cancel(co) cancels a task and its children.
 
 -- Spawn and push a screen to the ScreenManager
 -- Handles async module loading, error handling, and ScreenManager.push
@@ -12,6 +12,7 @@
 --   async()               - wrap a function to run in a coroutine, return a Promise
 --   await()               - suspend coroutine until Promise resolves (sugar for yield)
 --   await_all()           - run multiple async fns in parallel, wait for all
+--   worker()              - run a module function on the Core 0 Lua worker
 
 local async = {}
 
@@ -60,15 +61,46 @@ end
 -- downloads, parsing) where the status-bar spinner should appear.
 -- Background services with "while true" loops should keep using
 -- plain spawn() so they don't pin the spinner on forever.
+local _tasks = setmetatable({}, { __mode = "k" })
+
 function async.task(fn)
     async.begin()
-    spawn(function()
+    local co
+    co = spawn(function()
         local ok, err = pcall(fn)
-        async.done()
+        if _tasks[co] then
+            _tasks[co] = nil
+            async.done()
+        end
         if not ok then
             ez.log("[async.task] error: " .. tostring(err))
         end
     end)
+    if coroutine.status(co) == "dead" then
+        async.done()
+    else
+        _tasks[co] = true
+    end
+    return co
+end
+
+-- Cancel the task running coroutine `co` and any tasks it spawned,
+-- typically from a screen's on_exit with the coroutine returned by spawn()
+-- or async.task(). None of them is resumed again, and the C++ async ops
+-- (file I/O, crypto, HTTP) they were waiting on are dropped. Returns the
+-- number of ops cancelled.
+function async.cancel(co)
+    local n = async_cancel(co)
+    if _tasks[co] then
+        _tasks[co] = nil
+        async.done()
+    end
+    return n
+end
+
+-- Per-lane AsyncIO queue depth and latency (see async_stats in async.cpp)
+function async.stats()
+    return async_stats()
 end
 
 -- ---------------------------------------------------------------------------
@@ -266,6 +298,28 @@ function async.all(fns)
     return results
 end
 
+-- ---------------------------------------------------------------------------
+-- Background worker (second Lua state on Core 0, see src/lua/worker.h)
+-- ---------------------------------------------------------------------------
+
+-- Run module[fn](...) on the worker. Resolves with fn's first result,
+-- rejects with the worker's error message. Arguments and results are
+-- copied between the states, so only plain data (no functions).
+function async.worker(module, fn, ...)
+    local args = table.pack(...)
+    return async.fn(function()
+        local res = table.pack(ez.worker.call(module, fn, table.unpack(args, 1, args.n)))
+        if not res[1] then error(res[2], 0) end
+        return res[2]
+    end)()
+end
+
+-- Builds without the worker (and the host replay harness) have no
+-- ez.worker table to hang post() on
+if ez.worker then
+    ez.worker.post = async.worker
+end
+
 -- ---------------------------------------------------------------------------
 -- Convenience wrappers for C++ async I/O
 -- These return Promises and can be used from any context.
@@ -93,8 +93,6 @@ end
 local running = false
 local mesh_last = 0
 local mesh_interval = 50
-local gc_last = 0
-local gc_interval = 2000
 
 function ui.start(opts)
     opts = opts or {}
@@ -118,20 +116,9 @@ function ui.start(opts)
             mesh_last = now
         end
 
-        -- Drain any pending coroutines that yielded via
-        -- coroutine.yield() since the last frame. Cooperative async
-        -- (manual HTTP, multi-step flows that wait_ms()) lives here.
-        -- Cheap no-op when nothing is pending.
-        if _G.tick_coroutines then _G.tick_coroutines() end
-
-        -- Screen manager update (input + render)
+        -- Screen manager update (input + render). Incremental GC runs
+        -- from C++ after this returns, within the frame's idle budget.
         screen.update()
-
-        -- Incremental garbage collection
-        if now - gc_last >= gc_interval then
-            run_gc("step", nil, 10)
-            gc_last = now
-        end
     end
 
     ez.log("[ezui] Started")
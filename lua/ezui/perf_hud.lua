@@ -0,0 +1,106 @@
+-- ezui.perf_hud -- on-screen frame timing overlay.
+--
+-- Draws a small panel in the bottom-right corner with the frame rate,
+-- frame p50/p95/max and the busiest phases by p95, read from
+-- ez.system.get_frame_stats(). The stats table is fetched and the text
+-- formatted every REFRESH_MS, not per frame; between refreshes render()
+-- only redraws the cached lines. While enabled it invalidates the screen
+-- on each refresh so the numbers keep moving on an otherwise idle screen.
+--
+-- Off by default; the "Performance overlay" toggle in Display settings
+-- flips it and persists the choice in the "perf_hud" pref.
+
+local theme = require("ezui.theme")
+
+local M = {}
+
+M.enabled = false
+
+local REFRESH_MS = 500
+local TOP_PHASES = 4
+-- Phases worth showing; idle is the loop delay and other is slack.
+local SKIP = { idle = true, other = true }
+
+local _lines = nil
+local _last = 0
+
+local function ms(us)
+    return string.format("%.1f", us / 1000)
+end
+
+local function refresh()
+    local s = ez.system.get_frame_stats()
+    if not s then
+        _lines = { "frame stats unavailable" }
+        return
+    end
+    local f = s.frame
+    _lines = {
+        string.format("%.0f fps  p50 %s p95 %s max %s", s.fps,
+            ms(f.p50), ms(f.p95), ms(f.max)),
+    }
+    local ranked = {}
+    for name, p in pairs(s.phases) do
+        if not SKIP[name] and p.p95 > 0 then
+            ranked[#ranked + 1] = { name = name, p = p }
+        end
+    end
+    table.sort(ranked, function(a, b) return a.p.p95 > b.p.p95 end)
+    for i = 1, math.min(TOP_PHASES, #ranked) do
+        local r = ranked[i]
+        _lines[#_lines + 1] = string.format("%-9s p95 %s max %s",
+            r.name, ms(r.p.p95), ms(r.p.max))
+    end
+end
+
+-- Called once per frame from screen.update(). Cheap unless a refresh
+-- is due.
+function M.update()
+    if not M.enabled then return end
+    local now = ez.system.millis()
+    if _lines and now - _last < REFRESH_MS then return end
+    _last = now
+    refresh()
+    require("ezui.screen").invalidate()
+end
+
+-- Draw the overlay. Called from screen.render() before the mouse
+-- cursor so the cursor stays on top.
+function M.render(d)
+    if not M.enabled or not _lines then return end
+    theme.set_font("tiny")
+    local fh = theme.font_height()
+    local w = 0
+    for _, line in ipairs(_lines) do
+        local lw = theme.text_width(line)
+        if lw > w then w = lw end
+    end
+    w = w + 8
+    local h = #_lines * (fh + 1) + 6
+    local x = theme.SCREEN_W - w - 2
+    local y = theme.SCREEN_H - h - 2
+    d.fill_rect(x, y, w, h, theme.color("BG"))
+    d.draw_rect(x, y, w, h, theme.color("ACCENT"))
+    for i, line in ipairs(_lines) do
+        d.draw_text(x + 4, y + 3 + (i - 1) * (fh + 1), line,
+            i == 1 and theme.color("TEXT") or theme.color("TEXT_MUTED"))
+    end
+end
+
+function M.set_enabled(enabled, persist)
+    M.enabled = enabled and true or false
+    _lines = nil
+    if persist ~= false and ez.storage and ez.storage.set_pref then
+        ez.storage.set_pref("perf_hud", M.enabled and "1" or "0")
+    end
+    require("ezui.screen").invalidate()
+end
+
+-- Restore the saved setting. Called once from boot.lua.
+function M.init()
+    if ez.storage and ez.storage.get_pref then
+        M.enabled = ez.storage.get_pref("perf_hud", "0") == "1"
+    end
+end
+
+return M
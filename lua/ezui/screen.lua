@@ -6,6 +6,11 @@ local node = require("ezui.node")
 local focus = require("ezui.focus")
 local theme = require("ezui.theme")
 local async = require("ezui.async")
+local perf_hud = require("ezui.perf_hud")
+
+-- Attributes main_loop time to the input/logic/render frame phases
+-- (ez.system.get_frame_stats).
+local frame_mark = ez.system.frame_mark
 
 local screen = {}
 
@@ -44,6 +49,9 @@ local _PERSISTENT_FIELDS = {
     scroll     = { "scroll_offset" },
     dropdown   = { "_open", "_cursor", "_scroll" },
     text_input = { "_cursor" },
+    -- Displayed zoom + in-flight transition, so a zoom set_state animates
+    -- from the old level instead of snapping.
+    map_view   = { "_view_zoom", "_zoom_anim" },
 }
 
 local function _persist_state(old, new)
@@ -554,6 +562,9 @@ function screen.render()
     -- Toast on top of everything else so it's visible from any screen.
     screen._draw_toast(d)
 
+    -- Frame timing overlay; no-op unless enabled.
+    perf_hud.render(d)
+
     -- Mouse-mode cursor: rendered last so it floats above every
     -- screen. No-op when the mode is off.
     local ok_ti, touch_input = pcall(require, "ezui.touch_input")
@@ -574,10 +585,13 @@ function screen.update()
     ensure_toast_subscribed()
 
     -- Drain all pending input
+    frame_mark("input")
     while screen.handle_input() do end
 
     -- Refresh global status bar state (throttled internally)
+    frame_mark("logic")
     screen.update_status()
+    perf_hud.update()
 
     -- Call screen's update method if it exists (for polling/animations)
     local inst = screen.peek()
@@ -585,7 +599,9 @@ function screen.update()
         inst:update()
     end
 
+    frame_mark("render")
     screen.render()
+    frame_mark("lua")
 end
 
 return screen
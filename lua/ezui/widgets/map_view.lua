@@ -3,6 +3,11 @@
 -- overlays labels filtered by viewport, and exposes a project(lat, lon) helper
 -- to overlay_fn for pins/GPS dots.
 --
+-- `zoom` may be fractional: tiles are drawn from the nearest archive level and
+-- scaled to fit. Whenever `zoom` changes between frames the widget animates
+-- the displayed zoom toward it, composing the frame from whatever decoded
+-- tiles the archive already holds at either level.
+--
 -- Usage:
 --   require("ezui.widgets.map_view")  -- registers the node type
 --   {
@@ -44,6 +49,21 @@ local DEFAULT_FONT = "small"
 local HALO_OFFSETS = { {0,-1},{-1,0},{1,0},{0,1} }
 local HALO_COUNT   = 4
 
+-- Zoom transition length. Six frames at the screen's 33 ms cadence: long
+-- enough to read as motion, short enough that a held +/- doesn't queue up.
+local ZOOM_ANIM_MS = 180
+-- Jumps larger than this snap instead of animating; at 4x+ scale the
+-- intermediate frames are mostly fallback blur and cost more tiles per frame.
+local ZOOM_ANIM_MAX_DELTA = 2
+
+-- Lazy screen reference for animation frames (same pattern as ezui.widgets:
+-- ezui.screen pulls in node/theme/focus, so requiring it at load is circular).
+local _screen
+local function invalidate()
+    if not _screen then _screen = require("ezui.screen") end
+    _screen.invalidate()
+end
+
 local function clamp(v, lo, hi)
     if v < lo then return lo end
     if v > hi then return hi end
@@ -51,31 +71,117 @@ local function clamp(v, lo, hi)
 end
 
 -- Convert a lat/lon + zoom into screen pixel coords relative to the widget's
--- (x, y) top-left. Returns nil if no archive is attached (defensive for first
--- frame during async setup).
-local function make_projector(n, x, y, w, h)
+-- (x, y) top-left. `vz` is the (possibly fractional) zoom being displayed;
+-- one unit of tile space at that zoom spans TILE_SIZE screen pixels.
+local function make_projector(n, x, y, w, h, vz)
+    vz = vz or n.zoom or 0
     local cx_tile, cy_tile = map_archive.lat_lon_to_tile(
-        n.center_lat or 0, n.center_lon or 0, n.zoom or 0)
+        n.center_lat or 0, n.center_lon or 0, vz)
     local origin_tile_x = cx_tile - w / (2 * TILE_SIZE)
     local origin_tile_y = cy_tile - h / (2 * TILE_SIZE)
     return function(lat, lon)
-        local tx, ty = map_archive.lat_lon_to_tile(lat, lon, n.zoom or 0)
+        local tx, ty = map_archive.lat_lon_to_tile(lat, lon, vz)
         return x + (tx - origin_tile_x) * TILE_SIZE,
                y + (ty - origin_tile_y) * TILE_SIZE
     end, origin_tile_x, origin_tile_y
 end
 
+local function ease_out(t)
+    local u = 1 - t
+    return 1 - u * u * u
+end
+
+-- Zoom to display this frame. Tracks the last drawn zoom on the node (the
+-- screen carries it across rebuilds) and eases it toward n.zoom. Returns
+-- (view_zoom, animating).
+local function view_zoom(n, target)
+    local vz = n._view_zoom
+    if not vz or vz == target or math.abs(target - vz) > ZOOM_ANIM_MAX_DELTA then
+        n._view_zoom = target
+        n._zoom_anim = nil
+        return target, false
+    end
+    local now = ez.system.millis()
+    local a = n._zoom_anim
+    if not a or a.to ~= target then
+        -- Retarget from wherever we are, so a second keypress mid-animation
+        -- continues smoothly instead of jumping back to the previous level.
+        a = { from = vz, to = target, t0 = now }
+        n._zoom_anim = a
+    end
+    local t = (now - a.t0) / ZOOM_ANIM_MS
+    if t >= 1 then
+        n._view_zoom = target
+        n._zoom_anim = nil
+        return target, false
+    end
+    vz = a.from + (a.to - a.from) * ease_out(t)
+    n._view_zoom = vz
+    return vz, true
+end
+
+-- Draw one archive tile into the screen rect (sx, sy, sw, sh). Unscaled tiles
+-- take the whole-tile fast path; everything else goes through the nearest-
+-- neighbour scaler. Misses fall back to cached children (zooming out) and
+-- then to the nearest cached ancestor (zooming in / cold pans).
+local function draw_tile(d, arc, palette, z, tile_x, tile_y, sx, sy, sw, sh)
+    local data = arc:get_tile(z, tile_x, tile_y)
+    if data and data ~= "pending" then
+        if sw == TILE_SIZE and sh == TILE_SIZE then
+            d.draw_indexed_bitmap(sx, sy, TILE_SIZE, TILE_SIZE, data, palette)
+        else
+            d.draw_indexed_bitmap_scaled(sx, sy, sw, sh, data, palette,
+                0, 0, TILE_SIZE, TILE_SIZE)
+        end
+        return
+    end
+
+    -- Pending or missing. The archive's on_tile_loaded hook invalidates the
+    -- screen when the real tile lands in cache.
+    local kids = arc:get_child_fallback(z, tile_x, tile_y)
+    local complete = kids and kids[1] and kids[2] and kids[3] and kids[4]
+    if not complete then
+        local parent_data, psx, psy, psw, psh = arc:get_parent_fallback(z, tile_x, tile_y)
+        if parent_data then
+            d.draw_indexed_bitmap_scaled(sx, sy, sw, sh,
+                parent_data, palette, psx, psy, psw, psh)
+            return
+        end
+    end
+    if kids then
+        -- Children at z+1 are each a quarter of this tile: a 2:1 downscale.
+        local hw = sw // 2
+        local hh = sh // 2
+        for i = 1, 4 do
+            local child = kids[i]
+            if child then
+                local right  = (i == 2 or i == 4)
+                local bottom = (i >= 3)
+                local qx = right  and sx + hw or sx
+                local qy = bottom and sy + hh or sy
+                local qw = right  and sw - hw or hw
+                local qh = bottom and sh - hh or hh
+                d.draw_indexed_bitmap_scaled(qx, qy, qw, qh, child, palette,
+                    0, 0, TILE_SIZE, TILE_SIZE)
+            end
+        end
+    end
+end
+
 -- Apply a screen-pixel pan. Recomputes center_lat/lon via projection so later
 -- frames pick up the new viewport.
 local function pan_by_pixels(n, dx, dy)
-    local tiles = 2 ^ (n.zoom or 0)
+    -- Pan in the displayed zoom's pixel space so a step mid-animation moves
+    -- the same on-screen distance as one at rest.
+    local vz = n._view_zoom or n.zoom or 0
+    local tiles = 2 ^ vz
     local dx_tiles = dx / TILE_SIZE
     local dy_tiles = dy / TILE_SIZE
     local cx_tile, cy_tile = map_archive.lat_lon_to_tile(
-        n.center_lat or 0, n.center_lon or 0, n.zoom or 0)
+        n.center_lat or 0, n.center_lon or 0, vz)
     local new_x = clamp(cx_tile + dx_tiles, 0, tiles)
     local new_y = clamp(cy_tile + dy_tiles, 0, tiles)
-    local lat, lon = map_archive.tile_to_lat_lon(new_x, new_y, n.zoom or 0)
+    local lat, lon = map_archive.tile_to_lat_lon(new_x, new_y, vz)
     n.center_lat = lat
     n.center_lon = lon
     if n.on_move then n.on_move(lat, lon, n.zoom or 0) end
@@ -121,49 +227,50 @@ node.register("map_view", {
         -- Background wipe uses palette index 1 (land) so borders blend.
         d.fill_rect(x, y, w, h, palette[1])
 
-        local z = n.zoom or arc.header.min_zoom
-        local project, origin_tile_x, origin_tile_y = make_projector(n, x, y, w, h)
-
-        -- Visible tile range. We nudge outward by 1 tile to cover partial tiles
-        -- at the edges without extra arithmetic.
-        local start_tx = math.floor(origin_tile_x)
-        local start_ty = math.floor(origin_tile_y)
-        local tiles_x = math.ceil(w / TILE_SIZE) + 1
-        local tiles_y = math.ceil(h / TILE_SIZE) + 1
+        local zmin = arc.header.min_zoom
+        local zmax = arc.header.max_zoom
+        local target = n.zoom or zmin
+        local vz, animating = view_zoom(n, target)
+        local project, origin_tile_x, origin_tile_y = make_projector(n, x, y, w, h, vz)
+
+        -- Source level: the archive level nearest the target zoom. During an
+        -- animation this is already the destination level, so its tiles start
+        -- loading on the first frame while cached tiles from the level we're
+        -- leaving stand in through the child/parent fallbacks.
+        local z = clamp(math.floor(target + 0.5), zmin, zmax)
+        -- k: view-zoom tile units covered by one source tile. 1 at rest on an
+        -- integer zoom, in (0.5, 2) while animating a single step.
+        local k = 2 ^ (vz - z)
         local max_tile = (1 << z) - 1
 
-        for ty = 0, tiles_y - 1 do
-            for tx = 0, tiles_x - 1 do
-                local tile_x = start_tx + tx
-                local tile_y = start_ty + ty
-                if tile_x >= 0 and tile_x <= max_tile and tile_y >= 0 and tile_y <= max_tile then
-                    local screen_x = x + math.floor((tile_x - origin_tile_x) * TILE_SIZE)
-                    local screen_y = y + math.floor((tile_y - origin_tile_y) * TILE_SIZE)
-
-                    local data = arc:get_tile(z, tile_x, tile_y)
-                    if type(data) == "string" and data ~= "pending" then
-                        d.draw_indexed_bitmap(screen_x, screen_y, TILE_SIZE, TILE_SIZE, data, palette)
-                    else
-                        -- Pending or missing: try a cached ancestor as a blurry
-                        -- placeholder so the user sees movement. The archive's
-                        -- on_tile_loaded hook will invalidate the screen when
-                        -- the real tile lands in cache.
-                        local parent_data, sx, sy, sw, sh = arc:get_parent_fallback(z, tile_x, tile_y)
-                        if parent_data then
-                            d.draw_indexed_bitmap_scaled(
-                                screen_x, screen_y, TILE_SIZE, TILE_SIZE,
-                                parent_data, palette, sx, sy, sw, sh)
-                        end
-                    end
-                end
+        local start_tx = math.max(0, math.floor(origin_tile_x / k))
+        local start_ty = math.max(0, math.floor(origin_tile_y / k))
+        local end_tx = math.min(max_tile, math.floor((origin_tile_x + w / TILE_SIZE) / k))
+        local end_ty = math.min(max_tile, math.floor((origin_tile_y + h / TILE_SIZE) / k))
+
+        for tile_y = start_ty, end_ty do
+            -- Edges are floored independently so neighbouring tiles share a
+            -- seam exactly, whatever the scale.
+            local sy0 = y + math.floor((tile_y * k - origin_tile_y) * TILE_SIZE)
+            local sy1 = y + math.floor(((tile_y + 1) * k - origin_tile_y) * TILE_SIZE)
+            for tile_x = start_tx, end_tx do
+                local sx0 = x + math.floor((tile_x * k - origin_tile_x) * TILE_SIZE)
+                local sx1 = x + math.floor(((tile_x + 1) * k - origin_tile_x) * TILE_SIZE)
+                draw_tile(d, arc, palette, z, tile_x, tile_y,
+                    sx0, sy0, sx1 - sx0, sy1 - sy0)
             end
         end
 
+        -- Keep frames coming until the zoom settles. Labels are skipped while
+        -- animating: re-sorting and halo-drawing them every frame is the
+        -- dominant cost and they'd be mispositioned mid-scale anyway.
+        if animating then invalidate() end
+
         -- Label overlay: filter by current viewport bounds.
-        if n.show_labels ~= false then
-            local tl_lat, tl_lon = map_archive.tile_to_lat_lon(origin_tile_x, origin_tile_y, z)
+        if n.show_labels ~= false and not animating then
+            local tl_lat, tl_lon = map_archive.tile_to_lat_lon(origin_tile_x, origin_tile_y, vz)
             local br_lat, br_lon = map_archive.tile_to_lat_lon(
-                origin_tile_x + w / TILE_SIZE, origin_tile_y + h / TILE_SIZE, z)
+                origin_tile_x + w / TILE_SIZE, origin_tile_y + h / TILE_SIZE, vz)
             local min_lat = math.min(tl_lat, br_lat)
             local max_lat = math.max(tl_lat, br_lat)
             local min_lon = math.min(tl_lon, br_lon)
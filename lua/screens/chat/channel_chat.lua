@@ -32,6 +32,16 @@ function ChannelChat:build(state)
             })
         )
     else
+        -- Older history stays in the message store until asked for
+        if channels_svc.has_older(channel) then
+            content_items[#content_items + 1] = ui.list_item({
+                title = "Load earlier messages",
+                on_press = function()
+                    channels_svc.load_older(channel)
+                    self:set_state({})
+                end,
+            })
+        end
         for _, msg in ipairs(msgs) do
             content_items[#content_items + 1] = {
                 type = "chat_bubble",
@@ -139,6 +139,16 @@ function DMConversation:build(state)
             })
         )
     else
+        -- Older history stays in the message store until asked for
+        if dm_svc.has_older(key) then
+            content_items[#content_items + 1] = ui.list_item({
+                title = "Load earlier messages",
+                on_press = function()
+                    dm_svc.load_older(key)
+                    self:set_state({})
+                end,
+            })
+        end
         for i, msg in ipairs(msgs) do
             content_items[#content_items + 1] = {
                 type = "chat_bubble",
@@ -1,4 +1,5 @@
--- Display sub-settings: backlight, keyboard backlight, accent colour.
+-- Display sub-settings: backlight, keyboard backlight, accent colour,
+-- touch mode and the performance overlay.
 
 local ui        = require("ezui")
 local theme     = require("ezui.theme")
@@ -168,6 +169,24 @@ function Display:build(state)
         )
     end
 
+    local perf_hud = require("ezui.perf_hud")
+    content[#content + 1] = ui.padding({ 12, 8, 4, 8 },
+        ui.text_widget("Developer", { color = "ACCENT", font = "small_aa" })
+    )
+    content[#content + 1] = ui.padding({ 2, 6, 2, 6 },
+        ui.toggle("Performance overlay", perf_hud.enabled, {
+            on_change = function(on)
+                perf_hud.set_enabled(on)
+            end,
+        })
+    )
+    content[#content + 1] = ui.padding({ 2, 8, 8, 8 },
+        ui.text_widget(
+            "Shows frame rate and the slowest frame phases (p95, ms) "
+            .. "in the bottom-right corner.",
+            { wrap = true, color = "TEXT_MUTED", font = "small_aa" })
+    )
+
     return ui.vbox({ gap = 0, bg = "BG" }, {
         ui.title_bar("Display", { back = true }),
         ui.scroll({ grow = 1 }, ui.vbox({ gap = 0 }, content)),
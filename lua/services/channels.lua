@@ -1,15 +1,21 @@
 -- Channel message service
 -- Manages joined channels, handles decryption, message storage, and persistence.
 
+local history_store = require("services.message_store")
+
 local channels = {}
 
 -- Constants
+-- Messages kept in RAM per channel. The full history lives in the
+-- message store; older pages come in through channels.load_older().
 local MAX_HISTORY = 50
 local PREF_KEY = "joined_channels"  -- Preferences key for persistence
 
 -- State
 local joined = {}       -- { [name] = { key=str, hash=int, hidden=bool, password=str|nil } }
-local history = {}      -- { [name] = { messages... } }
+local history = {}      -- { [name] = { newest messages... } }
+local window_size = {}  -- { [name] = messages kept in RAM, when above MAX_HISTORY }
+local has_older = {}    -- { [name] = true } when the store holds older messages
 local unread = {}       -- { [name] = count }
 local initialized = false
 
@@ -27,6 +33,34 @@ local function resolve_sender(sender_hash)
     return nil
 end
 
+local function conv_key(channel_name)
+    return "ch:" .. channel_name
+end
+
+-- The fields that go to the store (everything but the id)
+local function record_of(msg)
+    return {
+        channel = msg.channel,
+        sender_hash = msg.sender_hash,
+        sender_name = msg.sender_name,
+        text = msg.text,
+        timestamp = msg.timestamp,
+        rssi = msg.rssi,
+        snr = msg.snr,
+        is_self = msg.is_self,
+        count = msg.count,
+    }
+end
+
+-- Bring a channel's newest messages into RAM the first time it's joined
+-- or loaded this boot.
+local function load_window(channel_name)
+    if history[channel_name] then return end
+    local msgs, more = history_store.load(conv_key(channel_name), MAX_HISTORY)
+    history[channel_name] = msgs
+    has_older[channel_name] = more or nil
+end
+
 -- Store a decoded message into history, grouping consecutive duplicates
 local function store_message(channel_name, msg)
     if not history[channel_name] then
@@ -40,13 +74,16 @@ local function store_message(channel_name, msg)
         last.count = (last.count or 1) + 1
         last.rssi = msg.rssi
         last.timestamp = msg.timestamp
+        history_store.update(conv_key(channel_name), record_of(last), last)
         return
     end
 
     msg.count = 1
+    history_store.append(conv_key(channel_name), record_of(msg), msg)
     h[#h + 1] = msg
-    while #h > MAX_HISTORY do
+    while #h > (window_size[channel_name] or MAX_HISTORY) do
         table.remove(h, 1)
+        has_older[channel_name] = true
     end
 end
 
@@ -90,7 +127,7 @@ local function load_channels()
                 password = password,
                 hidden = hidden_str == "1",
             }
-            if not history[name] then history[name] = {} end
+            load_window(name)
             if not unread[name] then unread[name] = 0 end
         elseif name == "#Public" then
             -- Restore hidden state for Public
@@ -122,7 +159,7 @@ function channels.join(name, password)
         password = password,
         hidden = false,
     }
-    if not history[name] then history[name] = {} end
+    load_window(name)
     if not unread[name] then unread[name] = 0 end
 
     if name ~= "#Public" then
@@ -139,7 +176,10 @@ function channels.leave(name)
     if name == "#Public" then return false end
     joined[name] = nil
     history[name] = nil
+    window_size[name] = nil
+    has_older[name] = nil
     unread[name] = nil
+    history_store.clear(conv_key(name))
     save_channels()
     ez.bus.post("channel/list_changed", name)
     return true
@@ -169,6 +209,24 @@ function channels.get_history(name)
     return history[name] or {}
 end
 
+-- Older messages from the store, prepended to the in-RAM history.
+-- Returns how many were added; has_older() says whether to offer more.
+function channels.load_older(name, n)
+    local h = history[name]
+    if not h or not has_older[name] or not (h[1] and h[1].id) then return 0 end
+    local msgs, more = history_store.load(conv_key(name), n or MAX_HISTORY, h[1].id)
+    for i = #msgs, 1, -1 do
+        table.insert(h, 1, msgs[i])
+    end
+    has_older[name] = more or nil
+    window_size[name] = math.max(#h, MAX_HISTORY)
+    return #msgs
+end
+
+function channels.has_older(name)
+    return has_older[name] == true
+end
+
 -- Get unread count for a channel
 function channels.get_unread(name)
     return unread[name] or 0
@@ -221,6 +279,8 @@ function channels.init()
     if initialized then return end
     initialized = true
 
+    history_store.open()
+
     -- Join the default public channel
     channels.join("#Public", nil)
 
@@ -13,10 +13,13 @@
 -- "pending" → "delivered" (ACK received) or "failed" (max retries exhausted).
 
 local contacts_svc = require("services.contacts")
+local history_store = require("services.message_store")
 
 local dm = {}
 
 -- Constants
+-- Messages kept in RAM per conversation. The full history lives in the
+-- message store; older pages come in through dm.load_older().
 local MAX_HISTORY = 50
 local MAX_TEXT = 120
 local HEADER_SIZE = 2   -- dest_hash(1) + src_hash(1)
@@ -47,7 +50,8 @@ end
 local MAX_RETRIES = 2
 local RETRY_INTERVAL = 10000  -- 10 seconds between retries
 local ACK_TIMEOUT = 15000     -- Give up after 15 seconds with no ACK
-local SAVE_PATH = "/fs/dm_history.json"
+local LEGACY_PATH = "/fs/dm_history.json"  -- Pre-store history, imported once
+local UNREAD_PATH = "/fs/dm_unread.json"
 local SAVE_DELAY = 2000       -- Debounce: write at most every 2 seconds
 
 -- Pending-ciphertext cap and TTL. If the sender never advertises and
@@ -61,7 +65,9 @@ local PENDING_SWEEP_MS    = 5 * 60 * 1000        -- prune every 5 minutes
 local ADVERT_PUB_KEY_SIZE = 32
 
 -- State
-local conversations = {}   -- { [pub_key_hex] = { messages... } }
+local conversations = {}   -- { [pub_key_hex] = { newest messages... } }
+local window_size = {}     -- { [pub_key_hex] = messages kept in RAM, when above MAX_HISTORY }
+local has_older = {}       -- { [pub_key_hex] = true } when the store holds older messages
 local unread = {}           -- { [pub_key_hex] = count }
 local secret_cache = {}     -- { [pub_key_hex] = { secret, key } }
 -- Return-path cache, populated when we decrypt a PATH_RETURN from a
@@ -169,33 +175,43 @@ end
 -- Persistence
 -- =========================================================================
 
+local function conv_key(pub_key_hex)
+    return "dm:" .. pub_key_hex
+end
+
+-- The fields that go to the store; transient ones (retroactive, id)
+-- don't.
+local function record_of(msg)
+    return {
+        text = msg.text,
+        sender_key = msg.sender_key,
+        sender_name = msg.sender_name,
+        timestamp = msg.timestamp,
+        is_self = msg.is_self,
+        status = msg.status,
+        count = msg.count,
+        rssi = msg.rssi,
+        snr = msg.snr,
+    }
+end
+
+-- Write a changed message (status, duplicate count) back to the store.
+local function save_message(pub_key_hex, msg)
+    history_store.update(conv_key(pub_key_hex), record_of(msg), msg)
+end
+
+-- Unread counts are small and change on every read, so they stay in a
+-- JSON file of their own rather than in the message store.
 local function do_save()
-    local data = { conversations = {}, unread = {} }
-    for key, msgs in pairs(conversations) do
-        local saved = {}
-        for _, msg in ipairs(msgs) do
-            saved[#saved + 1] = {
-                text = msg.text,
-                sender_key = msg.sender_key,
-                sender_name = msg.sender_name,
-                timestamp = msg.timestamp,
-                is_self = msg.is_self,
-                status = msg.status,
-                count = msg.count,
-                rssi = msg.rssi,
-                snr = msg.snr,
-            }
-        end
-        data.conversations[key] = saved
-    end
+    local data = {}
     for key, count in pairs(unread) do
         if count > 0 then
-            data.unread[key] = count
+            data[key] = count
         end
     end
-    local json = ez.storage.json_encode(data)
-    if json then
-        ez.storage.write_file(SAVE_PATH, json)
+    local ok, err = ez.storage.json_write_file(UNREAD_PATH, data)
+    if not ok then
+        ez.log("[DM] Failed to save unread counts: " .. tostring(err))
     end
 end
 
@@ -212,33 +228,66 @@ local function schedule_save()
     end
 end
 
-local function load_history()
-    if not ez.storage.exists(SAVE_PATH) then return end
-    local json = ez.storage.read_file(SAVE_PATH)
-    if not json or #json == 0 then return end
+local function read_json(path)
+    if not ez.storage.exists(path) then return nil end
+    local json = ez.storage.read_file(path)
+    if not json or #json == 0 then return nil end
     local data, err = ez.storage.json_decode(json)
     if not data then
-        ez.log("[DM] Failed to load history: " .. (err or "unknown"))
-        return
+        ez.log("[DM] Failed to read " .. path .. ": " .. (err or "unknown"))
     end
-    if data.conversations then
-        for key, msgs in pairs(data.conversations) do
-            conversations[key] = {}
-            for _, msg in ipairs(msgs) do
-                if msg.status == "pending" then
-                    msg.status = "unconfirmed"
-                end
-                conversations[key][#conversations[key] + 1] = msg
+    return data
+end
+
+-- Move the old whole-file history into the store, once. The file is
+-- removed only after every message made it in.
+local function import_legacy()
+    -- Already imported (a failed removal left the file behind)
+    if #history_store.conversations("dm:") > 0 then return end
+    local data = read_json(LEGACY_PATH)
+    if not data then return end
+    local imported, failed = 0, false
+    for key, msgs in pairs(data.conversations or {}) do
+        for _, msg in ipairs(msgs) do
+            if msg.status == "pending" then
+                msg.status = "unconfirmed"
+            end
+            if history_store.append(conv_key(key), record_of(msg), msg) then
+                imported = imported + 1
+            else
+                failed = true
             end
         end
     end
-    if data.unread then
-        for key, count in pairs(data.unread) do
-            unread[key] = count
-        end
+    for key, count in pairs(data.unread or {}) do
+        unread[key] = count
+    end
+    if failed then return end
+    do_save()
+    ez.storage.remove(LEGACY_PATH)
+    ez.log("[DM] Imported " .. imported .. " messages from " .. LEGACY_PATH)
+end
+
+local function load_history()
+    if history_store.open() then
+        import_legacy()
+    end
+    for key, count in pairs(read_json(UNREAD_PATH) or {}) do
+        unread[key] = count
     end
     local count = 0
-    for _ in pairs(conversations) do count = count + 1 end
+    for _, key in ipairs(history_store.conversations("dm:")) do
+        local msgs, more = history_store.load(conv_key(key), MAX_HISTORY)
+        for _, msg in ipairs(msgs) do
+            -- Nothing is waiting for an ACK after a reboot
+            if msg.status == "pending" then
+                msg.status = "unconfirmed"
+            end
+        end
+        conversations[key] = msgs
+        has_older[key] = more or nil
+        count = count + 1
+    end
     ez.log("[DM] Loaded " .. count .. " conversations from storage")
 end
 
@@ -400,15 +449,19 @@ store_message = function(pub_key_hex, msg)
                 and (msg.timestamp or 0) - (last.timestamp or 0) <= RECV_DEDUP_WINDOW_S then
             last.count = (last.count or 1) + 1
             last.timestamp = msg.timestamp
+            save_message(pub_key_hex, last)
             return last
         end
     end
 
     msg.count = 1
+    history_store.append(conv_key(pub_key_hex), record_of(msg), msg)
     h[#h + 1] = msg
-    while #h > MAX_HISTORY do
+    while #h > (window_size[pub_key_hex] or MAX_HISTORY) do
         table.remove(h, 1)
+        has_older[pub_key_hex] = true
     end
+    -- Callers bump the unread count next; the debounced save covers it
     schedule_save()
     return msg
 end
@@ -598,7 +651,9 @@ local function process_ack_hash(ack_hash)
                 pub_key_hex = pending.pub_key_hex,
                 status      = "delivered",
             })
-            schedule_save()
+            if pending.msg_ref then
+                save_message(pending.pub_key_hex, pending.msg_ref)
+            end
             return  -- expected_ack is ~unique per outbound; one match is enough
         end
     end
@@ -898,7 +953,9 @@ function dm.init()
                     pending_acks[id] = nil
                     contacts_svc.set_known_by(pending.pub_key_hex, false)
                     ez.bus.post("dm/status", { pub_key_hex = pending.pub_key_hex, status = "unconfirmed" })
-                    schedule_save()
+                    if pending.msg_ref then
+                        save_message(pending.pub_key_hex, pending.msg_ref)
+                    end
                 end
             end
         end
@@ -947,7 +1004,7 @@ function dm.send(pub_key_hex, text)
             ez.bus.post("dm/status", {
                 pub_key_hex = pub_key_hex, status = "failed",
             })
-            schedule_save()
+            save_message(pub_key_hex, stored)
             return
         end
 
@@ -957,7 +1014,7 @@ function dm.send(pub_key_hex, text)
             ez.bus.post("dm/status", {
                 pub_key_hex = pub_key_hex, status = "sent",
             })
-            schedule_save()
+            save_message(pub_key_hex, stored)
         else
             local id = next_msg_id
             next_msg_id = next_msg_id + 1
@@ -986,14 +1043,38 @@ function dm.get_unread(pub_key_hex)
     return unread[pub_key_hex] or 0
 end
 
+-- Older messages from the store, prepended to the in-RAM history.
+-- Returns how many were added; dm.has_older() says whether to offer more.
+function dm.load_older(pub_key_hex, n)
+    local h = conversations[pub_key_hex]
+    if not h or not has_older[pub_key_hex] then return 0 end
+    local before = h[1] and h[1].id
+    if not before then return 0 end
+    local msgs, more = history_store.load(conv_key(pub_key_hex), n or MAX_HISTORY, before)
+    for i = #msgs, 1, -1 do
+        table.insert(h, 1, msgs[i])
+    end
+    has_older[pub_key_hex] = more or nil
+    window_size[pub_key_hex] = math.max(#h, MAX_HISTORY)
+    return #msgs
+end
+
+function dm.has_older(pub_key_hex)
+    return has_older[pub_key_hex] == true
+end
+
 function dm.delete_message(pub_key_hex, index)
     local h = conversations[pub_key_hex]
     if not h or not h[index] then return end
+    history_store.delete(conv_key(pub_key_hex), h[index])
     table.remove(h, index)
     if #h == 0 then
-        conversations[pub_key_hex] = nil
+        -- RAM window emptied; refill it from whatever the store still has
+        local msgs, more = history_store.load(conv_key(pub_key_hex), MAX_HISTORY)
+        conversations[pub_key_hex] = #msgs > 0 and msgs or nil
+        has_older[pub_key_hex] = more or nil
+        window_size[pub_key_hex] = nil
     end
-    schedule_save()
 end
 
 function dm.mark_read(pub_key_hex)
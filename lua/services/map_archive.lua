@@ -11,6 +11,10 @@
 --
 -- Memory budget:
 --   * Tile cache: 16 tiles × 24,576 bytes ≈ 384 KB of PSRAM (matches old viewer).
+--     Tiles are ez.buffer objects, not strings: the compressed bytes are
+--     read into a buffer, inflated into a tile buffer and drawn from it, so
+--     a tile load creates no Lua strings. Evicted tile buffers are kept on
+--     a spare list and reused by the next inflate.
 --   * Labels: parsed into a flat Lua array at open time. A global archive of
 --     ~30 k labels uses ~1 MB; regional archives stay well under that.
 
@@ -90,12 +94,12 @@ local function i8(s, i)
 end
 
 -- v6 archives are always zlib-compressed. Decoding hands off to
--- ez.compression.inflate (backed by ROM miniz on-device). Returns
--- decompressed bytes or nil. The compression byte from the header is
--- ignored — the writer only ever emits zlib in v6, and pre-v6 archives
--- are rejected at open() time.
-local function decompress_tile(_compression, data)
-    return ez.compression.inflate(data, PACKED_TILE_BYTES)
+-- ez.compression.inflate (backed by ROM miniz on-device), which fills
+-- `out` in place. Returns `out` or nil. The compression byte from the
+-- header is ignored — the writer only ever emits zlib in v6, and pre-v6
+-- archives are rejected at open() time.
+local function decompress_tile(_compression, data, out)
+    return ez.compression.inflate(data, PACKED_TILE_BYTES, false, out)
 end
 
 -- ---------------------------------------------------------------------------
@@ -158,12 +162,26 @@ function Archive:_cache_store(key, data)
     end
     table.sort(candidates, function(a, b) return a[2] < b[2] end)
     for i = 1, count - self.MAX_CACHE do
-        self.tile_cache[candidates[i][1]] = nil
+        local k = candidates[i][1]
+        self._spare[#self._spare + 1] = self.tile_cache[k].data
+        self.tile_cache[k] = nil
     end
 end
 
--- Returns decoded tile bytes (cache hit), the string "pending" (async load in
--- flight), or nil (tile known-absent from archive).
+-- A tile buffer for the next inflate: a recycled evictee when there is
+-- one, else a fresh (empty) buffer that inflate grows to tile size.
+function Archive:_take_buffer()
+    local n = #self._spare
+    if n > 0 then
+        local buf = self._spare[n]
+        self._spare[n] = nil
+        return buf
+    end
+    return ez.buffer.new(0)
+end
+
+-- Returns the decoded tile buffer (cache hit), the string "pending" (async
+-- load in flight), or nil (tile known-absent from archive).
 function Archive:get_tile(z, x, y)
     local key = tile_key(z, x, y)
 
@@ -191,15 +209,19 @@ function Archive:get_tile(z, x, y)
     -- the counter drops even if a read / decompress errors out.
     local async = require("ezui.async")
     async.task(function()
-        local compressed = ez.storage.async_read_bytes(path, entry.offset, entry.size)
+        local compressed = ez.storage.async_read_bytes(path, entry.offset, entry.size,
+            ez.buffer.new(0))
         self.pending[key] = nil
         if not compressed or #compressed == 0 then
             self.missing[key] = true
         else
-            local raw = decompress_tile(compression, compressed)
+            local out = self:_take_buffer()
+            local raw = decompress_tile(compression, compressed, out)
+            compressed:release()
             if raw then
                 self:_cache_store(key, raw)
             else
+                self._spare[#self._spare + 1] = out
                 self.missing[key] = true
             end
         end
@@ -235,6 +257,28 @@ function Archive:get_parent_fallback(z, x, y)
     return nil
 end
 
+-- Cached tiles one level below (z, x, y), used when zooming out: the four
+-- children of a not-yet-loaded tile are usually still in the LRU from the
+-- previous zoom level. Returns { [1..4] = data|false } in (tl, tr, bl, br)
+-- order, or nil when none of them are cached.
+function Archive:get_child_fallback(z, x, y)
+    if z + 1 > self.header.max_zoom then return nil end
+    local found = false
+    local out = {}
+    for i = 0, 3 do
+        local cached = self.tile_cache[tile_key(z + 1, (x << 1) + (i & 1), (y << 1) + (i >> 1))]
+        if cached then
+            cached.access = self._tick
+            out[i + 1] = cached.data
+            found = true
+        else
+            out[i + 1] = false
+        end
+    end
+    if not found then return nil end
+    return out
+end
+
 -- Flush the negative cache. Call after zoom changes so known-missing tiles can
 -- be re-checked against the archive (they are zoom-level specific).
 function Archive:invalidate_missing()
@@ -257,7 +301,10 @@ function Archive:labels_in_bounds(z, min_lat, max_lat, min_lon, max_lon)
 end
 
 function Archive:close()
+    for _, cached in pairs(self.tile_cache) do cached.data:release() end
+    for _, buf in ipairs(self._spare) do buf:release() end
     self.tile_cache = {}
+    self._spare = {}
     self.pending = {}
     self.missing = {}
     self.labels = {}
@@ -403,6 +450,7 @@ function map_archive.open(path)
         idx_bytes   = idx_bytes,
         labels      = labels,
         tile_cache  = {},
+        _spare      = {},
         pending     = {},
         missing     = {},
         _tick       = 0,
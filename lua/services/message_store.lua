@@ -0,0 +1,101 @@
+-- Message history store, shared by the DM and channel services.
+--
+-- Thin wrapper over ez.messages (the native append-only store, see
+-- src/util/msg_store.h). History goes to the SD card when one is mounted
+-- at first use, else to internal flash. Every call degrades to a no-op
+-- when the store couldn't be opened, so the services keep working with
+-- RAM-only history instead of failing outright.
+--
+-- Conversation keys are namespaced by the caller: "dm:<pub_key_hex>",
+-- "ch:<channel name>".
+
+local M = {}
+
+local DIRS = { "/sd/messages", "/fs/messages" }
+
+-- Compaction only runs when updates and deletes have left more dead
+-- bytes than live ones, so checking now and then is cheap. It blocks
+-- while it copies, which is why it isn't triggered from a write.
+local COMPACT_INTERVAL_MS = 10 * 60 * 1000
+
+local opened = nil  -- nil = not tried yet, then true/false
+
+function M.open()
+    if opened ~= nil then return opened end
+    opened = false
+    for _, dir in ipairs(DIRS) do
+        if dir:sub(1, 4) ~= "/sd/" or ez.storage.is_sd_available() then
+            local ok, err = ez.messages.open(dir)
+            if ok then
+                opened = true
+                break
+            end
+            ez.log("[Messages] Can't open " .. dir .. ": " .. tostring(err))
+        end
+    end
+    if opened then
+        ez.system.set_interval(COMPACT_INTERVAL_MS, function()
+            ez.messages.compact()
+        end)
+    end
+    return opened
+end
+
+-- Newest `n` messages of a conversation, oldest first, plus whether
+-- older ones remain. Pass `before` (a message id) to page further back.
+function M.load(conv, n, before)
+    if not opened then return {}, false end
+    return ez.messages.fetch(conv, before, n)
+end
+
+-- Store a new message; sets and returns msg.id.
+function M.append(conv, record, msg)
+    if not opened then return nil end
+    local id, err = ez.messages.append(conv, record)
+    if not id then
+        ez.log("[Messages] Append to " .. conv .. " failed: " .. tostring(err))
+        return nil
+    end
+    msg.id = id
+    return id
+end
+
+-- Rewrite a stored message after its fields changed.
+function M.update(conv, record, msg)
+    if not opened or not msg.id then return end
+    local ok, err = ez.messages.update(conv, msg.id, record)
+    if not ok then
+        ez.log("[Messages] Update in " .. conv .. " failed: " .. tostring(err))
+    end
+end
+
+function M.delete(conv, msg)
+    if not opened or not msg.id then return end
+    ez.messages.delete(conv, msg.id)
+end
+
+function M.clear(conv)
+    if not opened then return end
+    ez.messages.clear(conv)
+end
+
+-- Messages whose text matches every word of `query` (as word prefixes),
+-- newest first, across all conversations; each has conv and id set.
+function M.search(query, limit)
+    if not opened then return {} end
+    return ez.messages.search(query, limit)
+end
+
+-- Suffixes of every stored conversation key starting with `prefix`.
+function M.conversations(prefix)
+    local out = {}
+    if not opened then return out end
+    for conv in pairs(ez.messages.conversations()) do
+        if conv:sub(1, #prefix) == prefix then
+            out[#out + 1] = conv:sub(#prefix + 1)
+        end
+    end
+    return out
+end
+
+return M
@@ -220,6 +220,113 @@ def escape_bytes_for_c(data: bytes) -> str:
     return ','.join(parts)
 
 
+# ---------------------------------------------------------------------------
+# Perfect hash
+# ---------------------------------------------------------------------------
+#
+# Lookups by path use a hash-and-displace perfect hash built here at build
+# time, so the firmware finds any embedded file with two FNV-1a passes and
+# one strcmp instead of a strcmp against every entry:
+#
+#   bucket = fnv1a(path, 0) % num_buckets
+#   slot   = fnv1a(path, seeds[bucket]) % num_slots
+#   index  = slots[slot]            (0xFFFF = empty, i.e. not embedded)
+#
+# The C++ side must compute fnv1a exactly as fnv1a() below does.
+
+FNV_OFFSET = 0x811C9DC5
+FNV_PRIME = 0x01000193
+PHF_EMPTY = 0xFFFF
+
+
+def fnv1a(data: bytes, seed: int) -> int:
+    """32-bit FNV-1a with the seed folded into the offset basis.
+
+    The final xor-shift mixes high bits down: FNV's low bits only depend on
+    the low bits of the state, so without it small moduli see few seeds.
+    """
+    h = (FNV_OFFSET ^ (seed * 0x9E3779B1)) & 0xFFFFFFFF
+    for b in data:
+        h ^= b
+        h = (h * FNV_PRIME) & 0xFFFFFFFF
+    h ^= h >> 15
+    h = (h * 0x2C1B3C6D) & 0xFFFFFFFF
+    h ^= h >> 12
+    return h
+
+
+def build_perfect_hash(keys: list) -> tuple:
+    """Return (seeds, slots) for `keys` (list of str), see comment above."""
+    n = len(keys)
+    num_buckets = max(1, (n + 3) // 4)
+    num_slots = max(1, n + n // 4)
+    encoded = [k.encode('utf-8') for k in keys]
+
+    buckets = [[] for _ in range(num_buckets)]
+    for i, k in enumerate(encoded):
+        buckets[fnv1a(k, 0) % num_buckets].append(i)
+
+    seeds = [0] * num_buckets
+    slots = [PHF_EMPTY] * num_slots
+    # Largest buckets first: they are the hardest to place.
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        members = buckets[b]
+        if not members:
+            continue
+        for seed in range(1, 0xFFFF):
+            taken = [fnv1a(encoded[i], seed) % num_slots for i in members]
+            if len(set(taken)) == len(taken) and all(slots[t] == PHF_EMPTY for t in taken):
+                seeds[b] = seed
+                for i, t in zip(members, taken):
+                    slots[t] = i
+                break
+        else:
+            raise RuntimeError(f"perfect hash: no seed for bucket {b}")
+
+    # Self-check: every key must find itself.
+    for i, k in enumerate(encoded):
+        seed = seeds[fnv1a(k, 0) % num_buckets]
+        assert slots[fnv1a(k, seed) % num_slots] == i
+    return seeds, slots
+
+
+def emit_perfect_hash(lines: list, prefix: str, keys: list):
+    """Append the seed/slot tables and the fnv1a helper for `keys`."""
+    seeds, slots = build_perfect_hash(keys)
+
+    def table(name: str, values: list):
+        lines.append(f"static const uint16_t {name}[{len(values)}] = {{")
+        for i in range(0, len(values), 12):
+            lines.append("    " + ", ".join(f"{v}" for v in values[i:i+12]) + ",")
+        lines.append("};")
+
+    lines.append(f"// Perfect hash over {len(keys)} paths (see embed_lua_scripts.py)")
+    table(f"{prefix}_seeds", seeds)
+    table(f"{prefix}_slots", slots)
+    lines.extend([
+        "",
+        f"static uint32_t {prefix}_hash(const char* s, uint32_t seed) {{",
+        f"    uint32_t h = 0x{FNV_OFFSET:08X}u ^ (seed * 0x9E3779B1u);",
+        "    while (*s) {",
+        "        h ^= (uint8_t)*s++;",
+        f"        h *= 0x{FNV_PRIME:08X}u;",
+        "    }",
+        "    h ^= h >> 15;",
+        "    h *= 0x2C1B3C6Du;",
+        "    h ^= h >> 12;",
+        "    return h;",
+        "}",
+        "",
+        f"static int {prefix}_find(const char* path) {{",
+        f"    uint32_t seed = {prefix}_seeds[{prefix}_hash(path, 0) % {len(seeds)}];",
+        f"    uint16_t index = {prefix}_slots[{prefix}_hash(path, seed) % {len(slots)}];",
+        f"    if (index == 0x{PHF_EMPTY:04X}) return -1;",
+        "    return (int)index;",
+        "}",
+        "",
+    ])
+
+
 def generate_var_name(path: str) -> str:
     """Generate a valid C variable name from a path."""
     name = path.lstrip('/')
@@ -280,6 +387,7 @@ def generate_embedded_scripts_cpp(script_data: list, output_path: Path) -> int:
         f"// Total embedded Lua scripts: {len(script_data)}",
         "",
         '#include "embedded_lua_scripts.h"',
+        '#include <cstdint>',
         '#include <cstring>',
         "",
         "namespace embedded_lua {",
@@ -313,16 +421,14 @@ def generate_embedded_scripts_cpp(script_data: list, output_path: Path) -> int:
     lines.append("")
     lines.append(f"static const size_t script_count = {len(entries)};")
     lines.append("")
+    emit_perfect_hash(lines, "script", [e[0] for e in entries])
 
     lines.extend([
         "const char* get_script(const char* path, size_t* out_size) {",
-        "    for (size_t i = 0; i < script_count; i++) {",
-        "        if (strcmp(scripts[i].path, path) == 0) {",
-        "            if (out_size) *out_size = scripts[i].size;",
-        "            return scripts[i].content;",
-        "        }",
-        "    }",
-        "    return nullptr;",
+        "    int i = script_find(path);",
+        "    if (i < 0 || strcmp(scripts[i].path, path) != 0) return nullptr;",
+        "    if (out_size) *out_size = scripts[i].size;",
+        "    return scripts[i].content;",
         "}",
         "",
         "size_t get_script_count() {",
@@ -427,6 +533,7 @@ def generate_embedded_docs_cpp(doc_data: list, output_path: Path) -> int:
         f"// Total embedded docs: {len(doc_data)}",
         "",
         '#include "embedded_docs.h"',
+        '#include <cstdint>',
         '#include <cstring>',
         "",
         "namespace embedded_docs {",
@@ -456,15 +563,13 @@ def generate_embedded_docs_cpp(doc_data: list, output_path: Path) -> int:
     lines.append("")
     lines.append(f"static const size_t doc_count_v = {len(entries)};")
     lines.append("")
+    emit_perfect_hash(lines, "doc", [e[0] for e in entries])
     lines.extend([
         "const char* get_doc(const char* path, size_t* out_size) {",
-        "    for (size_t i = 0; i < doc_count_v; i++) {",
-        "        if (strcmp(docs[i].path, path) == 0) {",
-        "            if (out_size) *out_size = docs[i].size;",
-        "            return docs[i].content;",
-        "        }",
-        "    }",
-        "    return nullptr;",
+        "    int i = doc_find(path);",
+        "    if (i < 0 || strcmp(docs[i].path, path) != 0) return nullptr;",
+        "    if (out_size) *out_size = docs[i].size;",
+        "    return docs[i].content;",
         "}",
         "",
         "size_t get_doc_count() { return doc_count_v; }",
@@ -25,6 +25,7 @@
 #include "../fonts/InterAA17BoldItalic.h"
 #include "aa_font.h"
 #include "../config.h"
+#include "../util/heap_tags.h"
 
 // Build a shared `aa_font::Font` view over each generated header. The per-
 // header Glyph layout matches aa_font::Glyph byte-for-byte, so we cast the
@@ -133,6 +134,7 @@ bool Display::init() {
         Serial.println("Display: WARNING - Sprite buffer failed, using direct mode");
         // Continue anyway - will work but may flicker
     } else {
+        heapTagAdopt(HeapTag::DISPLAY, psram);
         Serial.printf("Display: Sprite buffer created (%dx%d)\n", TFT_WIDTH, TFT_HEIGHT);
     }
     _buffer.fillSprite(Colors::BACKGROUND);
@@ -1155,6 +1157,7 @@ bool Sprite::create(int width, int height) {
         Serial.printf("Sprite: Failed to create %dx%d sprite\n", width, height);
         return false;
     }
+    heapTagAdopt(HeapTag::DISPLAY, buffer);
 
     _valid = true;
     _sprite.fillSprite(0x0000);
@@ -1163,6 +1166,7 @@ bool Sprite::create(int width, int height) {
 
 void Sprite::destroy() {
     if (_valid) {
+        heapTagDisown(HeapTag::DISPLAY, _sprite.getBuffer());
         _sprite.deleteSprite();
         _valid = false;
         _width = 0;
@@ -1,4 +1,5 @@
 #include "radio.h"
+#include "../util/trace.h"
 #include <Arduino.h>
 #include <SPI.h>
 
@@ -233,6 +234,7 @@ RadioResult Radio::send(const uint8_t* data, size_t len) {
         Serial.printf("TX start failed with code: %d\n", state);
         return translateStatus(state);
     }
+    _txStartUs = trace_now();
 
     return RadioResult::OK;
 }
@@ -246,6 +248,8 @@ bool Radio::checkTxComplete() {
         _transmitting = false;
         _txDone = false;
         _lastTxTime = millis();
+        // Airtime spans frames, so it goes in as one finished span
+        TRACE_COMPLETE("radio.tx", _txStartUs);
         return true;
     }
 
@@ -333,6 +337,7 @@ int Radio::receive(uint8_t* buffer, size_t maxLen) {
 int Radio::receive(uint8_t* buffer, size_t maxLen, RxMetadata& metadata) {
     if (!_initialized) return -1;
     if (!_rxFlag) return 0;
+    TRACE_SCOPE("radio.rx");
 
     _rxFlag = false;
 
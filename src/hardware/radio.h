@@ -143,6 +143,7 @@ private:
     static constexpr uint32_t TX_THROTTLE_DEFAULT_MS = 100;  // Minimum ms between transmissions
     std::deque<QueuedTxPacket> _txQueue;
     uint32_t _lastTxTime = 0;
+    uint32_t _txStartUs = 0;    // esp_timer time of the last startTransmit
     uint32_t _throttleIntervalMs = TX_THROTTLE_DEFAULT_MS;
 
     // Interrupt flag (set by ISR)
@@ -1,5 +1,7 @@
 #include "usb_msc.h"
 #include "../config.h"
+#include "../util/file_handles.h"
+#include "../util/sd_block_cache.h"
 #include <SD.h>
 #include <SPI.h>
 #include <USB.h>
@@ -105,6 +107,9 @@ bool SDCardUSB::start() {
     }
 
     Serial.println("[USB MSC] Starting MSC mode...");
+    // The host writes sectors underneath the filesystem from here on
+    FileHandleCache::instance().invalidateAll(SD);
+    SdBlockCache::instance().setEnabled(false);
     Serial.printf("[USB MSC] SD card: %d sectors, %d bytes/sector\n",
                   sdCardSectors, sdSectorSize);
 
@@ -140,6 +145,8 @@ void SDCardUSB::stop() {
 
     Serial.println("[USB MSC] Stopping MSC mode...");
     msc.end();
+    FileHandleCache::instance().invalidateAll(SD);
+    SdBlockCache::instance().setEnabled(true);
     _active = false;
 }
 
@@ -1,19 +1,26 @@
 #include "async.h"
 #include "embedded_scripts.h"
+#include "script_loader.h"
 #include "../config.h"
+#include "../util/file_handles.h"
+#include "../util/heap_tags.h"
 #include "../util/log.h"
+#include "../util/read_coalescer.h"
+#include "../util/trace.h"
+#include "bindings/buffer_bindings.h"
+#include "lua_json.h"
+#include "scheduler.h"
 #include <Arduino.h>
 #include <SD.h>
 #include <LittleFS.h>
-#include <ArduinoJson.h>
 
 // mbedTLS for crypto
 #include "mbedtls/aes.h"
 #include "mbedtls/md.h"
 #include "mbedtls/sha256.h"
 
-// Queue sizes
-constexpr size_t QUEUE_SIZE = 8;
+// Result queue size (request queues are per lane, see LANE_QUEUE_SIZE)
+constexpr size_t RESULT_QUEUE_SIZE = 8;
 // Max file size for async read (512KB)
 constexpr size_t MAX_FILE_SIZE = 512 * 1024;
 // AES block size
@@ -60,22 +67,141 @@ void AsyncIO::setHttpProcessor(HttpProcessor fn) {
     s_http_processor = fn;
 }
 
-bool AsyncIO::queueHttpRequest(void* requestPtr, int coroRef) {
-    if (!_requestQueue) return false;
+bool AsyncIO::queueHttpRequest(lua_State* co, void* requestPtr, uint32_t token) {
     Request req = {};
     req.type = OpType::HTTP_FETCH;
-    req.coroRef = coroRef;
+    req.token = token;
     req.data = (uint8_t*)requestPtr;
-    return xQueueSend(_requestQueue, &req, 0) == pdTRUE;
+    return submit(co, req);
+}
+
+AsyncIO::Lane AsyncIO::laneFor(OpType type) {
+    switch (type) {
+        case OpType::AES_ENCRYPT:
+        case OpType::AES_DECRYPT:
+        case OpType::HMAC_SHA256:
+        case OpType::X25519_SHARED_SECRET:
+            return Lane::CRYPTO;
+        case OpType::HTTP_FETCH:
+            return Lane::BULK;
+        default:
+            return Lane::INTERACTIVE;
+    }
+}
+
+const char* AsyncIO::laneName(Lane lane) {
+    switch (lane) {
+        case Lane::INTERACTIVE: return "interactive";
+        case Lane::CRYPTO:      return "crypto";
+        case Lane::BULK:        return "bulk";
+        default:                return "?";
+    }
+}
+
+const char* AsyncIO::opName(OpType type) {
+    switch (type) {
+        case OpType::READ:                 return "async.read";
+        case OpType::READ_BYTES:           return "async.read_bytes";
+        case OpType::WRITE:                return "async.write";
+        case OpType::WRITE_BYTES:          return "async.write_bytes";
+        case OpType::APPEND:               return "async.append";
+        case OpType::EXISTS:               return "async.exists";
+        case OpType::JSON_READ:            return "async.json_read";
+        case OpType::JSON_WRITE:           return "async.json_write";
+        case OpType::RLE_READ:             return "async.rle_read";
+        case OpType::RLE_READ_RGB565:      return "async.rle_read_rgb565";
+        case OpType::AES_ENCRYPT:          return "async.aes_encrypt";
+        case OpType::AES_DECRYPT:          return "async.aes_decrypt";
+        case OpType::HMAC_SHA256:          return "async.hmac_sha256";
+        case OpType::X25519_SHARED_SECRET: return "async.x25519";
+        case OpType::HTTP_FETCH:           return "async.http_fetch";
+        case OpType::SCRIPT_LOAD:          return "async.script_load";
+        case OpType::SCRIPT_STORE:         return "async.script_store";
+        default:                           return "async.?";
+    }
+}
+
+// Lua thread. Takes a ticket, stamps the request and queues it on its lane.
+// On false nothing was queued and the caller still owns req.data and must unpark.
+bool AsyncIO::submit(lua_State* co, Request& req) {
+    Lane lane = laneFor(req.type);
+    LaneStats& st = _laneStats[(size_t)lane];
+    QueueHandle_t q = _laneQueues[(size_t)lane];
+    if (!q || !_workerTask) {
+        st.rejected++;
+        return false;
+    }
+
+    uint8_t t = 0;
+    while (t < MAX_TICKETS && _tickets[t].inUse) t++;
+    if (t == MAX_TICKETS) {
+        st.rejected++;
+        return false;
+    }
+    Ticket& ticket = _tickets[t];
+    ticket.co = co;
+    ticket.outRef = LUA_NOREF;
+    ticket.lane = lane;
+    ticket.cancelled.store(false);
+    ticket.inUse = true;
+
+    req.ticket = t;
+    req.enqueuedUs = micros();
+    if (xQueueSend(q, &req, 0) != pdTRUE) {
+        ticket.inUse = false;
+        st.rejected++;
+        return false;
+    }
+
+    st.submitted++;
+    uint32_t depth = uxQueueMessagesWaiting(q);
+    if (depth > st.maxDepth) st.maxDepth = depth;
+    xTaskNotifyGive(_workerTask);
+    return true;
+}
+
+// Lua thread. Queue the cache entry from a SCRIPT_LOAD miss for the worker
+// to write; nothing waits on it, and it is dropped if the lane is full.
+void AsyncIO::queueScriptStore(const char* path, void* entry) {
+    Request req = {};
+    req.type = OpType::SCRIPT_STORE;
+    req.token = Scheduler::NO_TOKEN;
+    strncpy(req.path, path, MAX_PATH - 1);
+    req.data = (uint8_t*)entry;
+    if (!submit(nullptr, req)) {
+        ScriptLoader::freeEntry((ScriptLoader::CacheEntry*)entry);
+        ScriptLoader::instance().noteStore(false, 0);
+    }
+}
+
+int AsyncIO::cancel(lua_State* co) {
+    int count = 0;
+    for (Ticket& t : _tickets) {
+        if (t.inUse && t.co == co && !t.cancelled.load()) {
+            t.cancelled.store(true);
+            count++;
+        }
+    }
+    return count;
+}
+
+void AsyncIO::getLaneStats(Lane lane, LaneStats& out, uint32_t& depth) const {
+    out = _laneStats[(size_t)lane];
+    QueueHandle_t q = _laneQueues[(size_t)lane];
+    depth = q ? uxQueueMessagesWaiting(q) : 0;
 }
 
 bool AsyncIO::init(lua_State* L) {
     _mainState = L;
 
-    _requestQueue = xQueueCreate(QUEUE_SIZE, sizeof(Request));
-    _resultQueue = xQueueCreate(QUEUE_SIZE, sizeof(Result));
+    bool ok = true;
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        _laneQueues[i] = xQueueCreate(LANE_QUEUE_SIZE[i], sizeof(Request));
+        ok = ok && _laneQueues[i];
+    }
+    _resultQueue = xQueueCreate(RESULT_QUEUE_SIZE, sizeof(Result));
 
-    if (!_requestQueue || !_resultQueue) {
+    if (!ok || !_resultQueue) {
         Serial.println("[AsyncIO] Failed to create queues");
         return false;
     }
@@ -93,6 +219,12 @@ bool AsyncIO::init(lua_State* L) {
     // resource, every KiB freed leaves more room for WiFi rx/tx
     // buffers, LCD DMA descriptors, audio I2S DMA, and the two cores'
     // FreeRTOS overhead.
+    //
+    // waitSlice() runs short jobs nested inside an HTTP fetch, so the
+    // worst case is an HTTP frame plus a file/crypto frame; both keep
+    // their buffers on the heap, which is why one 8 KiB stack still
+    // covers it (a second task stack is not an option, see
+    // http_bindings initModule()).
     BaseType_t res = xTaskCreatePinnedToCore(
         workerTask, "async_io", 8192, this, 1, &_workerTask, 0
     );
@@ -122,10 +254,7 @@ uint8_t* AsyncIO::rleDecompress(const uint8_t* data, size_t len, size_t* outLen)
     size_t maxOutput = (len < 1024) ? len * 256 : MAP_TILE_SIZE + 4096;
 
     // Allocate output buffer in PSRAM
-    uint8_t* output = (uint8_t*)ps_malloc(maxOutput);
-    if (!output) {
-        output = (uint8_t*)malloc(maxOutput);
-    }
+    uint8_t* output = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, maxOutput);
     if (!output) {
         *outLen = 0;
         return nullptr;
@@ -170,7 +299,7 @@ uint16_t* AsyncIO::rleDecompressToRgb565(const uint8_t* data, size_t len,
     constexpr size_t EXPECTED_INDEXED = 256 * 256 * 3 / 8;  // 24576 bytes
     if (indexedLen < EXPECTED_INDEXED) {
         Serial.printf("[AsyncIO] Indexed data too short: %d < %d\n", indexedLen, EXPECTED_INDEXED);
-        free(indexed);
+        heapTagFree(HeapTag::ASYNC, indexed);
         *outLen = 0;
         return nullptr;
     }
@@ -179,13 +308,10 @@ uint16_t* AsyncIO::rleDecompressToRgb565(const uint8_t* data, size_t len,
     constexpr size_t TILE_PIXELS = 256 * 256;
     constexpr size_t RGB565_SIZE = TILE_PIXELS * sizeof(uint16_t);
 
-    uint16_t* output = (uint16_t*)ps_malloc(RGB565_SIZE);
-    if (!output) {
-        output = (uint16_t*)malloc(RGB565_SIZE);
-    }
+    uint16_t* output = (uint16_t*)heapTagPsMalloc(HeapTag::ASYNC, RGB565_SIZE);
     if (!output) {
         Serial.println("[AsyncIO] RGB565 buffer alloc failed");
-        free(indexed);
+        heapTagFree(HeapTag::ASYNC, indexed);
         *outLen = 0;
         return nullptr;
     }
@@ -212,7 +338,7 @@ uint16_t* AsyncIO::rleDecompressToRgb565(const uint8_t* data, size_t len,
         *outPtr++ = palette[(b2 >> 5) & 0x07];
     }
 
-    free(indexed);
+    heapTagFree(HeapTag::ASYNC, indexed);
     *outLen = RGB565_SIZE;
     return output;
 }
@@ -228,13 +354,12 @@ uint8_t* AsyncIO::aesEncrypt(const uint8_t* key, size_t keyLen,
     size_t paddedLen = ((dataLen + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
     if (paddedLen == 0) paddedLen = AES_BLOCK_SIZE;
 
-    uint8_t* padded = (uint8_t*)malloc(paddedLen);
-    uint8_t* output = (uint8_t*)ps_malloc(paddedLen);
-    if (!output) output = (uint8_t*)malloc(paddedLen);
+    uint8_t* padded = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, paddedLen);
+    uint8_t* output = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, paddedLen);
 
     if (!padded || !output) {
-        free(padded);
-        free(output);
+        heapTagFree(HeapTag::ASYNC, padded);
+        heapTagFree(HeapTag::ASYNC, output);
         *outLen = 0;
         return nullptr;
     }
@@ -248,8 +373,8 @@ uint8_t* AsyncIO::aesEncrypt(const uint8_t* key, size_t keyLen,
     int ret = mbedtls_aes_setkey_enc(&ctx, key, 128);
     if (ret != 0) {
         mbedtls_aes_free(&ctx);
-        free(padded);
-        free(output);
+        heapTagFree(HeapTag::ASYNC, padded);
+        heapTagFree(HeapTag::ASYNC, output);
         *outLen = 0;
         return nullptr;
     }
@@ -259,15 +384,15 @@ uint8_t* AsyncIO::aesEncrypt(const uint8_t* key, size_t keyLen,
         ret = mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, padded + i, output + i);
         if (ret != 0) {
             mbedtls_aes_free(&ctx);
-            free(padded);
-            free(output);
+            heapTagFree(HeapTag::ASYNC, padded);
+            heapTagFree(HeapTag::ASYNC, output);
             *outLen = 0;
             return nullptr;
         }
     }
 
     mbedtls_aes_free(&ctx);
-    free(padded);
+    heapTagFree(HeapTag::ASYNC, padded);
 
     *outLen = paddedLen;
     return output;
@@ -280,8 +405,7 @@ uint8_t* AsyncIO::aesDecrypt(const uint8_t* key, size_t keyLen,
         return nullptr;
     }
 
-    uint8_t* output = (uint8_t*)ps_malloc(dataLen);
-    if (!output) output = (uint8_t*)malloc(dataLen);
+    uint8_t* output = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, dataLen);
 
     if (!output) {
         *outLen = 0;
@@ -294,7 +418,7 @@ uint8_t* AsyncIO::aesDecrypt(const uint8_t* key, size_t keyLen,
     int ret = mbedtls_aes_setkey_dec(&ctx, key, 128);
     if (ret != 0) {
         mbedtls_aes_free(&ctx);
-        free(output);
+        heapTagFree(HeapTag::ASYNC, output);
         *outLen = 0;
         return nullptr;
     }
@@ -304,7 +428,7 @@ uint8_t* AsyncIO::aesDecrypt(const uint8_t* key, size_t keyLen,
         ret = mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_DECRYPT, data + i, output + i);
         if (ret != 0) {
             mbedtls_aes_free(&ctx);
-            free(output);
+            heapTagFree(HeapTag::ASYNC, output);
             *outLen = 0;
             return nullptr;
         }
@@ -318,7 +442,7 @@ uint8_t* AsyncIO::aesDecrypt(const uint8_t* key, size_t keyLen,
 
 uint8_t* AsyncIO::hmacSha256(const uint8_t* key, size_t keyLen,
                              const uint8_t* data, size_t dataLen) {
-    uint8_t* mac = (uint8_t*)malloc(32);
+    uint8_t* mac = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, 32);
     if (!mac) return nullptr;
 
     mbedtls_md_context_t ctx;
@@ -327,28 +451,28 @@ uint8_t* AsyncIO::hmacSha256(const uint8_t* key, size_t keyLen,
     const mbedtls_md_info_t* info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
     if (!info) {
         mbedtls_md_free(&ctx);
-        free(mac);
+        heapTagFree(HeapTag::ASYNC, mac);
         return nullptr;
     }
 
     int ret = mbedtls_md_setup(&ctx, info, 1);  // 1 = use HMAC
     if (ret != 0) {
         mbedtls_md_free(&ctx);
-        free(mac);
+        heapTagFree(HeapTag::ASYNC, mac);
         return nullptr;
     }
 
     ret = mbedtls_md_hmac_starts(&ctx, key, keyLen);
     if (ret != 0) {
         mbedtls_md_free(&ctx);
-        free(mac);
+        heapTagFree(HeapTag::ASYNC, mac);
         return nullptr;
     }
 
     ret = mbedtls_md_hmac_update(&ctx, data, dataLen);
     if (ret != 0) {
         mbedtls_md_free(&ctx);
-        free(mac);
+        heapTagFree(HeapTag::ASYNC, mac);
         return nullptr;
     }
 
@@ -356,7 +480,7 @@ uint8_t* AsyncIO::hmacSha256(const uint8_t* key, size_t keyLen,
     mbedtls_md_free(&ctx);
 
     if (ret != 0) {
-        free(mac);
+        heapTagFree(HeapTag::ASYNC, mac);
         return nullptr;
     }
 
@@ -367,313 +491,563 @@ uint8_t* AsyncIO::hmacSha256(const uint8_t* key, size_t keyLen,
 // Worker Task
 // =============================================================================
 
-void AsyncIO::workerTask(void* param) {
-    AsyncIO* self = static_cast<AsyncIO*>(param);
-    Request req;
+// Pick the next request. Lanes are tried in priority order, except that a
+// lane passed over STARVE_LIMIT times while non-empty goes first. Nested
+// picks (from waitSlice) never take bulk work.
+bool AsyncIO::nextRequest(Request& req, bool nestedOnly) {
+    size_t limit = nestedOnly ? (size_t)Lane::BULK : LANE_COUNT;
 
-    while (true) {
-        if (xQueueReceive(self->_requestQueue, &req, portMAX_DELAY) == pdTRUE) {
-            Result result;
-            result.type = req.type;
-            result.coroRef = req.coroRef;
-            result.data = nullptr;
-            result.len = 0;
-            result.success = false;
-            result.jsonString = nullptr;
-
-            // Get the appropriate filesystem based on path
-            const char* adjustedPath;
-            fs::FS* fs = getFS(req.path, &adjustedPath);
-
-            switch (req.type) {
-                case OpType::READ: {
-                    File f = fs->open(adjustedPath, FILE_READ);
-                    if (f) {
-                        size_t size = f.size();
-                        if (size > 0 && size <= MAX_FILE_SIZE) {
-                            result.data = (uint8_t*)ps_malloc(size);
-                            if (!result.data) {
-                                result.data = (uint8_t*)malloc(size);
-                            }
-                            if (result.data) {
-                                result.len = f.read(result.data, size);
-                                result.success = (result.len == size);
-                                if (!result.success) {
-                                    free(result.data);
-                                    result.data = nullptr;
-                                    result.len = 0;
-                                }
-                            }
-                        }
-                        f.close();
-                    }
-                    break;
-                }
+    size_t order[LANE_COUNT];
+    size_t n = 0;
+    for (size_t i = 0; i < limit; i++) {
+        if (_skipped[i] >= STARVE_LIMIT) order[n++] = i;
+    }
+    for (size_t i = 0; i < limit; i++) {
+        if (_skipped[i] < STARVE_LIMIT) order[n++] = i;
+    }
 
-                case OpType::READ_BYTES: {
-                    File f = fs->open(adjustedPath, FILE_READ);
-                    if (f) {
-                        size_t fileSize = f.size();
-                        if (req.offset < fileSize && req.length > 0) {
-                            size_t actualLen = req.length;
-                            if (req.offset + actualLen > fileSize) {
-                                actualLen = fileSize - req.offset;
-                            }
-                            result.data = (uint8_t*)ps_malloc(actualLen);
-                            if (!result.data) {
-                                result.data = (uint8_t*)malloc(actualLen);
-                            }
-                            if (result.data) {
-                                f.seek(req.offset);
-                                result.len = f.read(result.data, actualLen);
-                                result.success = (result.len == actualLen);
-                                if (!result.success) {
-                                    free(result.data);
-                                    result.data = nullptr;
-                                    result.len = 0;
-                                }
-                            }
+    for (size_t k = 0; k < n; k++) {
+        size_t lane = order[k];
+        if (xQueueReceive(_laneQueues[lane], &req, 0) != pdTRUE) continue;
+        _skipped[lane] = 0;
+        for (size_t i = 0; i < limit; i++) {
+            if (i != lane && uxQueueMessagesWaiting(_laneQueues[i]) > 0 &&
+                _skipped[i] < STARVE_LIMIT) {
+                _skipped[i]++;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Worker thread. Serve `first` (a READ_BYTES) together with any READ_BYTES
+// for the same file queued directly behind it. Stops at the first other
+// request so lane order is preserved. Returns false, having taken nothing
+// from the queue, when there is nothing to batch with.
+bool AsyncIO::runReadBatch(Request& first) {
+    QueueHandle_t q = _laneQueues[(size_t)Lane::INTERACTIVE];
+
+    struct Entry {
+        uint32_t token;
+        uint8_t ticket;
+        uint32_t enqueuedUs;
+        size_t offset;
+        size_t length;
+        uint8_t* data;
+        size_t len;
+        bool cancelled;
+    };
+    Entry entries[MAX_READ_BATCH];
+    size_t n = 0;
+
+    auto add = [&](const Request& r) {
+        Entry& e = entries[n++];
+        e.token = r.token;
+        e.ticket = r.ticket;
+        e.enqueuedUs = r.enqueuedUs;
+        e.offset = r.offset;
+        e.length = r.length;
+        e.data = nullptr;
+        e.len = 0;
+        e.cancelled = false;
+    };
+
+    // Only this task receives from the lane, so a peeked head is still
+    // the head when we take it.
+    Request next;
+    while (n + 1 < MAX_READ_BATCH && xQueuePeek(q, &next, 0) == pdTRUE &&
+           next.type == OpType::READ_BYTES && strcmp(next.path, first.path) == 0) {
+        if (n == 0) add(first);
+        if (xQueueReceive(q, &next, 0) != pdTRUE) break;
+        add(next);
+    }
+    if (n == 0) return false;
+
+    uint32_t startUs = micros();
+
+    const char* adjustedPath;
+    fs::FS* fs = getFS(first.path, &adjustedPath);
+    FileHandleCache::Lease lease(*fs, adjustedPath);
+    File& f = lease.file();
+    size_t fileSize = lease ? f.size() : 0;
+
+    // Clamp like the single-request path; drop cancelled and empty reads.
+    ReadRange ranges[MAX_READ_BATCH];
+    uint8_t rangeEntry[MAX_READ_BATCH];
+    size_t valid = 0;
+    for (size_t i = 0; i < n; i++) {
+        Entry& e = entries[i];
+        if (_tickets[e.ticket].cancelled.load()) {
+            e.cancelled = true;
+            continue;
+        }
+        if (!lease || e.offset >= fileSize || e.length == 0) continue;
+        if (e.offset + e.length > fileSize) e.length = fileSize - e.offset;
+        ranges[valid] = {(uint32_t)e.offset, (uint32_t)e.length};
+        rangeEntry[valid] = (uint8_t)i;
+        valid++;
+    }
+
+    uint16_t order[MAX_READ_BATCH];
+    ReadSpan spans[MAX_READ_BATCH];
+    size_t spanCount = planReadSpans(ranges, valid, order, spans,
+                                     COALESCE_MAX_GAP, COALESCE_MAX_SPAN);
+
+    auto readInto = [&](uint8_t* dst, size_t offset, size_t len) {
+        return f.seek(offset) && f.read(dst, len) == len;
+    };
+    auto allocBuf = [](size_t len) {
+        return (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, len);
+    };
+
+    for (size_t s = 0; s < spanCount; s++) {
+        const ReadSpan& span = spans[s];
+
+        // A lone range reads straight into its result buffer; a merged
+        // span is read once and sliced.
+        uint8_t* spanBuf = span.count > 1 ? allocBuf(span.length) : nullptr;
+        bool spanOk = spanBuf && readInto(spanBuf, span.offset, span.length);
+
+        for (size_t k = span.first; k < (size_t)span.first + span.count; k++) {
+            Entry& e = entries[rangeEntry[order[k]]];
+            uint8_t* buf = allocBuf(e.length);
+            if (!buf) continue;
+            bool ok;
+            if (spanOk) {
+                memcpy(buf, spanBuf + (e.offset - span.offset), e.length);
+                ok = true;
+            } else {
+                ok = readInto(buf, e.offset, e.length);
+            }
+            if (ok) {
+                e.data = buf;
+                e.len = e.length;
+            } else {
+                lease.discard();
+                heapTagFree(HeapTag::ASYNC, buf);
+            }
+        }
+        heapTagFree(HeapTag::ASYNC, spanBuf);
+    }
+
+    uint32_t elapsedUs = micros() - startUs;
+    if (_nested) _nestedUs += elapsedUs;
+
+    _coalesce.batches++;
+    _coalesce.requests += n;
+    _coalesce.ranges += valid;
+    _coalesce.spans += spanCount;
+
+    for (size_t i = 0; i < n; i++) {
+        const Entry& e = entries[i];
+        Result result = {};
+        result.type = OpType::READ_BYTES;
+        result.token = e.token;
+        result.ticket = e.ticket;
+        result.cancelled = e.cancelled;
+        result.data = e.data;
+        result.len = e.len;
+        result.success = e.data != nullptr;
+        result.waitUs = startUs - e.enqueuedUs;
+        result.runUs = elapsedUs / n;
+        xQueueSend(_resultQueue, &result, portMAX_DELAY);
+    }
+    return true;
+}
+
+// Worker thread. Runs one request and posts its result.
+void AsyncIO::runRequest(Request& req) {
+    TRACE_SCOPE(opName(req.type));
+    if (req.type == OpType::READ_BYTES && runReadBatch(req)) return;
+
+    Result result = {};
+    result.type = req.type;
+    result.token = req.token;
+    result.ticket = req.ticket;
+
+    uint32_t startUs = micros();
+    result.waitUs = startUs - req.enqueuedUs;
+
+    bool outer = !_nested;
+    if (outer) {
+        _runningTicket = req.ticket;
+        _nestedUs = 0;
+    }
+
+    // Cancelled before it started: skip the work, but still post a result
+    // so the Lua thread releases the ticket. HTTP always runs; its
+    // processor owns the request and bails out early.
+    if (_tickets[req.ticket].cancelled.load() && req.type != OpType::HTTP_FETCH) {
+        heapTagFree(HeapTag::ASYNC, req.data);
+        result.cancelled = true;
+    } else {
+        execute(req, result);
+    }
+
+    uint32_t runUs = micros() - startUs;
+    if (outer) {
+        result.runUs = runUs - _nestedUs;
+        _runningTicket = NO_TICKET;
+    } else {
+        result.runUs = runUs;
+        _nestedUs += runUs;
+    }
+
+    xQueueSend(_resultQueue, &result, portMAX_DELAY);
+}
+
+bool AsyncIO::waitSlice(uint32_t ms) {
+    AsyncIO& self = instance();
+    if (!self._nested) {
+        Request req;
+        if (self.nextRequest(req, true)) {
+            self._nested = true;
+            self.runRequest(req);
+            self._nested = false;
+        } else {
+            delay(ms);
+        }
+    } else {
+        delay(ms);
+    }
+    return !cancelRequested();
+}
+
+bool AsyncIO::cancelRequested() {
+    AsyncIO& self = instance();
+    uint8_t t = self._runningTicket;
+    return t != NO_TICKET && self._tickets[t].cancelled.load();
+}
+
+void AsyncIO::execute(Request& req, Result& result) {
+    // Get the appropriate filesystem based on path
+    const char* adjustedPath;
+    fs::FS* fs = getFS(req.path, &adjustedPath);
+
+    switch (req.type) {
+        case OpType::READ: {
+            File f = fs->open(adjustedPath, FILE_READ);
+            if (f) {
+                size_t size = f.size();
+                if (size > 0 && size <= MAX_FILE_SIZE) {
+                    result.data = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, size);
+                    if (result.data) {
+                        result.len = f.read(result.data, size);
+                        result.success = (result.len == size);
+                        if (!result.success) {
+                            heapTagFree(HeapTag::ASYNC, result.data);
+                            result.data = nullptr;
+                            result.len = 0;
                         }
-                        f.close();
                     }
-                    break;
                 }
+                f.close();
+            }
+            break;
+        }
 
-                case OpType::WRITE: {
-                    if (req.data && req.dataLen > 0) {
-                        File f = fs->open(adjustedPath, FILE_WRITE);
-                        if (f) {
-                            size_t written = f.write(req.data, req.dataLen);
-                            result.success = (written == req.dataLen);
-                            result.len = written;
-                            f.close();
+        case OpType::READ_BYTES: {
+            FileHandleCache::Lease lease(*fs, adjustedPath);
+            if (lease) {
+                File& f = lease.file();
+                size_t fileSize = f.size();
+                if (req.offset < fileSize && req.length > 0) {
+                    size_t actualLen = req.length;
+                    if (req.offset + actualLen > fileSize) {
+                        actualLen = fileSize - req.offset;
+                    }
+                    result.data = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, actualLen);
+                    if (result.data) {
+                        f.seek(req.offset);
+                        result.len = f.read(result.data, actualLen);
+                        result.success = (result.len == actualLen);
+                        if (!result.success) {
+                            lease.discard();
+                            heapTagFree(HeapTag::ASYNC, result.data);
+                            result.data = nullptr;
+                            result.len = 0;
                         }
-                        free(req.data);
                     }
-                    break;
                 }
+            }
+            break;
+        }
 
-                case OpType::WRITE_BYTES: {
-                    if (req.data && req.dataLen > 0) {
-                        // Open in read+write mode to preserve existing content
-                        File f = fs->open(adjustedPath, "r+");
-                        if (!f) {
-                            // File doesn't exist, create it
-                            f = fs->open(adjustedPath, FILE_WRITE);
-                        }
-                        if (f) {
-                            f.seek(req.offset);
-                            size_t written = f.write(req.data, req.dataLen);
-                            result.success = (written == req.dataLen);
-                            result.len = written;
-                            f.close();
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::WRITE: {
+            if (req.data && req.dataLen > 0) {
+                File f = fs->open(adjustedPath, FILE_WRITE);
+                if (f) {
+                    size_t written = f.write(req.data, req.dataLen);
+                    result.success = (written == req.dataLen);
+                    result.len = written;
+                    f.close();
+                    FileHandleCache::instance().invalidate(*fs, adjustedPath);
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::APPEND: {
-                    if (req.data && req.dataLen > 0) {
-                        File f = fs->open(adjustedPath, FILE_APPEND);
-                        if (f) {
-                            size_t written = f.write(req.data, req.dataLen);
-                            result.success = (written == req.dataLen);
-                            result.len = written;
-                            f.close();
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::WRITE_BYTES: {
+            if (req.data && req.dataLen > 0) {
+                // Open in read+write mode to preserve existing content
+                File f = fs->open(adjustedPath, "r+");
+                if (!f) {
+                    // File doesn't exist, create it
+                    f = fs->open(adjustedPath, FILE_WRITE);
+                }
+                if (f) {
+                    f.seek(req.offset);
+                    size_t written = f.write(req.data, req.dataLen);
+                    result.success = (written == req.dataLen);
+                    result.len = written;
+                    f.close();
+                    FileHandleCache::instance().invalidate(*fs, adjustedPath);
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::EXISTS: {
-                    result.success = fs->exists(adjustedPath);
-                    break;
+        case OpType::APPEND: {
+            if (req.data && req.dataLen > 0) {
+                File f = fs->open(adjustedPath, FILE_APPEND);
+                if (f) {
+                    size_t written = f.write(req.data, req.dataLen);
+                    result.success = (written == req.dataLen);
+                    result.len = written;
+                    f.close();
+                    FileHandleCache::instance().invalidate(*fs, adjustedPath);
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::JSON_READ: {
-                    File f = fs->open(adjustedPath, FILE_READ);
-                    if (f) {
-                        size_t size = f.size();
-                        if (size > 0 && size <= MAX_JSON_DOC) {
-                            char* content = (char*)malloc(size + 1);
-                            if (content) {
-                                size_t readLen = f.read((uint8_t*)content, size);
-                                content[readLen] = '\0';
-                                // Store raw JSON string - will be parsed in main thread
-                                result.jsonString = content;
-                                result.success = true;
-                            }
+        case OpType::EXISTS: {
+            result.success = fs->exists(adjustedPath);
+            break;
+        }
+
+        case OpType::JSON_READ: {
+            // Raw text only: the Lua thread parses it straight into
+            // tables (lua_json.h), so there is no document size cap here
+            // beyond PSRAM.
+            File f = fs->open(adjustedPath, FILE_READ);
+            if (f) {
+                size_t size = f.size();
+                if (size > 0) {
+                    result.data = (uint8_t*)heapTagPsMalloc(HeapTag::ASYNC, size);
+                    if (result.data) {
+                        result.len = f.read(result.data, size);
+                        result.success = (result.len == size);
+                        if (!result.success) {
+                            heapTagFree(HeapTag::ASYNC, result.data);
+                            result.data = nullptr;
                         }
-                        f.close();
                     }
-                    break;
                 }
+                f.close();
+            }
+            break;
+        }
 
-                case OpType::JSON_WRITE: {
-                    if (req.data && req.dataLen > 0) {
-                        File f = fs->open(adjustedPath, FILE_WRITE);
-                        if (f) {
-                            // Data is already JSON string from Lua
-                            size_t written = f.write(req.data, req.dataLen);
-                            result.success = (written == req.dataLen);
-                            f.close();
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::JSON_WRITE: {
+            if (req.data && req.dataLen > 0) {
+                // Written aside and renamed over the file, as json_write_file
+                // does, so a failed write leaves the old JSON in place
+                char tmpPath[MAX_PATH + 8];
+                snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", adjustedPath);
+                File f = fs->open(tmpPath, FILE_WRITE);
+                if (f) {
+                    // Data is already JSON string from Lua
+                    size_t written = f.write(req.data, req.dataLen);
+                    bool ok = (written == req.dataLen);
+                    f.close();
+                    if (ok && fs != &LittleFS && fs->exists(adjustedPath)) fs->remove(adjustedPath);
+                    ok = ok && fs->rename(tmpPath, adjustedPath);
+                    if (!ok) fs->remove(tmpPath);
+                    result.success = ok;
+                    FileHandleCache::instance().invalidate(*fs, adjustedPath);
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::RLE_READ: {
-                    File f = fs->open(adjustedPath, FILE_READ);
-                    if (f) {
-                        size_t fileSize = f.size();
-                        if (req.offset < fileSize && req.length > 0) {
-                            size_t actualLen = req.length;
-                            if (req.offset + actualLen > fileSize) {
-                                actualLen = fileSize - req.offset;
-                            }
-                            uint8_t* compressed = (uint8_t*)malloc(actualLen);
-                            if (compressed) {
-                                f.seek(req.offset);
-                                size_t readLen = f.read(compressed, actualLen);
-                                if (readLen == actualLen) {
-                                    // Decompress in worker thread
-                                    size_t decompLen;
-                                    result.data = rleDecompress(compressed, actualLen, &decompLen);
-                                    if (result.data) {
-                                        result.len = decompLen;
-                                        result.success = true;
-                                    }
-                                }
-                                free(compressed);
+        case OpType::SCRIPT_LOAD:
+            // Source read and hashed, cache entry read and verified; the
+            // Lua thread does the rest (ScriptLoader::loadRead)
+            result.data = (uint8_t*)ScriptLoader::readFile(*fs, adjustedPath);
+            result.success = (result.data != nullptr);
+            break;
+
+        case OpType::SCRIPT_STORE: {
+            auto* entry = (ScriptLoader::CacheEntry*)req.data;
+            result.success = ScriptLoader::writeEntry(*fs, adjustedPath, *entry);
+            ScriptLoader::freeEntry(entry);
+            break;
+        }
+
+        case OpType::RLE_READ: {
+            File f = fs->open(adjustedPath, FILE_READ);
+            if (f) {
+                size_t fileSize = f.size();
+                if (req.offset < fileSize && req.length > 0) {
+                    size_t actualLen = req.length;
+                    if (req.offset + actualLen > fileSize) {
+                        actualLen = fileSize - req.offset;
+                    }
+                    uint8_t* compressed = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, actualLen);
+                    if (compressed) {
+                        f.seek(req.offset);
+                        size_t readLen = f.read(compressed, actualLen);
+                        if (readLen == actualLen) {
+                            // Decompress in worker thread
+                            size_t decompLen;
+                            result.data = rleDecompress(compressed, actualLen, &decompLen);
+                            if (result.data) {
+                                result.len = decompLen;
+                                result.success = true;
                             }
                         }
-                        f.close();
+                        heapTagFree(HeapTag::ASYNC, compressed);
                     }
-                    break;
                 }
+                f.close();
+            }
+            break;
+        }
 
-                case OpType::RLE_READ_RGB565: {
-                    File f = fs->open(adjustedPath, FILE_READ);
-                    if (f) {
-                        size_t fileSize = f.size();
-                        if (req.offset < fileSize && req.length > 0) {
-                            size_t actualLen = req.length;
-                            if (req.offset + actualLen > fileSize) {
-                                actualLen = fileSize - req.offset;
-                            }
-                            uint8_t* compressed = (uint8_t*)malloc(actualLen);
-                            if (compressed) {
-                                f.seek(req.offset);
-                                size_t readLen = f.read(compressed, actualLen);
-                                if (readLen == actualLen) {
-                                    // Decompress and convert to RGB565 in one pass
-                                    size_t rgb565Len;
-                                    result.data = (uint8_t*)rleDecompressToRgb565(
-                                        compressed, actualLen, req.palette, &rgb565Len);
-                                    if (result.data) {
-                                        result.len = rgb565Len;
-                                        result.success = true;
-                                        Serial.printf("[AsyncIO] RGB565 tile: in=%d out=%d\n", actualLen, rgb565Len);
-                                    } else {
-                                        Serial.println("[AsyncIO] RGB565 conversion failed");
-                                    }
-                                } else {
-                                    Serial.printf("[AsyncIO] RGB565 read mismatch: %d vs %d\n", readLen, actualLen);
-                                }
-                                free(compressed);
+        case OpType::RLE_READ_RGB565: {
+            File f = fs->open(adjustedPath, FILE_READ);
+            if (f) {
+                size_t fileSize = f.size();
+                if (req.offset < fileSize && req.length > 0) {
+                    size_t actualLen = req.length;
+                    if (req.offset + actualLen > fileSize) {
+                        actualLen = fileSize - req.offset;
+                    }
+                    uint8_t* compressed = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, actualLen);
+                    if (compressed) {
+                        f.seek(req.offset);
+                        size_t readLen = f.read(compressed, actualLen);
+                        if (readLen == actualLen) {
+                            // Decompress and convert to RGB565 in one pass
+                            size_t rgb565Len;
+                            result.data = (uint8_t*)rleDecompressToRgb565(
+                                compressed, actualLen, req.palette, &rgb565Len);
+                            if (result.data) {
+                                result.len = rgb565Len;
+                                result.success = true;
+                                Serial.printf("[AsyncIO] RGB565 tile: in=%d out=%d\n", actualLen, rgb565Len);
                             } else {
-                                Serial.println("[AsyncIO] RGB565 malloc failed");
+                                Serial.println("[AsyncIO] RGB565 conversion failed");
                             }
+                        } else {
+                            Serial.printf("[AsyncIO] RGB565 read mismatch: %d vs %d\n", readLen, actualLen);
                         }
-                        f.close();
+                        heapTagFree(HeapTag::ASYNC, compressed);
                     } else {
-                        Serial.printf("[AsyncIO] RGB565 file open failed: %s\n", adjustedPath);
+                        Serial.println("[AsyncIO] RGB565 malloc failed");
                     }
-                    break;
                 }
+                f.close();
+            } else {
+                Serial.printf("[AsyncIO] RGB565 file open failed: %s\n", adjustedPath);
+            }
+            break;
+        }
 
-                case OpType::AES_ENCRYPT: {
-                    if (req.data && req.dataLen > 0 && req.keyLen == 16) {
-                        size_t outLen;
-                        result.data = aesEncrypt(req.key, req.keyLen, req.data, req.dataLen, &outLen);
-                        if (result.data) {
-                            result.len = outLen;
-                            result.success = true;
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::AES_ENCRYPT: {
+            if (req.data && req.dataLen > 0 && req.keyLen == 16) {
+                size_t outLen;
+                result.data = aesEncrypt(req.key, req.keyLen, req.data, req.dataLen, &outLen);
+                if (result.data) {
+                    result.len = outLen;
+                    result.success = true;
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::AES_DECRYPT: {
-                    if (req.data && req.dataLen > 0 && req.keyLen == 16) {
-                        size_t outLen;
-                        result.data = aesDecrypt(req.key, req.keyLen, req.data, req.dataLen, &outLen);
-                        if (result.data) {
-                            result.len = outLen;
-                            result.success = true;
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::AES_DECRYPT: {
+            if (req.data && req.dataLen > 0 && req.keyLen == 16) {
+                size_t outLen;
+                result.data = aesDecrypt(req.key, req.keyLen, req.data, req.dataLen, &outLen);
+                if (result.data) {
+                    result.len = outLen;
+                    result.success = true;
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::HMAC_SHA256: {
-                    if (req.data && req.dataLen > 0 && req.keyLen > 0) {
-                        result.data = hmacSha256(req.key, req.keyLen, req.data, req.dataLen);
-                        if (result.data) {
-                            result.len = 32;  // SHA256 output is always 32 bytes
-                            result.success = true;
-                        }
-                        free(req.data);
-                    }
-                    break;
+        case OpType::HMAC_SHA256: {
+            if (req.data && req.dataLen > 0 && req.keyLen > 0) {
+                result.data = hmacSha256(req.key, req.keyLen, req.data, req.dataLen);
+                if (result.data) {
+                    result.len = 32;  // SHA256 output is always 32 bytes
+                    result.success = true;
                 }
+                heapTagFree(HeapTag::ASYNC, req.data);
+            }
+            break;
+        }
 
-                case OpType::HTTP_FETCH: {
-                    // The HTTP processor owns the result delivery
-                    // (it talks to http_bindings' own response queue).
-                    // We don't fill in `result.*` for this op type --
-                    // see processResults() below where HTTP_FETCH is a
-                    // no-op result so we don't try to resume the
-                    // coroutine twice.
-                    if (s_http_processor && req.data) {
-                        s_http_processor((void*)req.data, req.coroRef);
-                    }
-                    // Suppress the standard result-queue path. We mark
-                    // the coroRef unused so processResults won't touch
-                    // the (already resumed-by-http) coroutine.
-                    result.coroRef = LUA_NOREF;
-                    break;
-                }
+        case OpType::HTTP_FETCH: {
+            // The HTTP processor owns the result delivery
+            // (it talks to http_bindings' own response queue).
+            // We don't fill in `result.*` for this op type --
+            // see processResults() below where HTTP_FETCH is a
+            // no-op result so we don't try to resume the
+            // coroutine twice.
+            if (s_http_processor && req.data) {
+                s_http_processor((void*)req.data, req.token);
+            }
+            // The result posted for it only releases the ticket; the
+            // processor is done with the request by now.
+            break;
+        }
 
-                case OpType::X25519_SHARED_SECRET: {
-                    // Peer's 32-byte Ed25519 pubkey arrives in req.data.
-                    // The handler does the Ed25519 → X25519 conversion
-                    // and X25519 ECDH internally; we just pass bytes
-                    // through. All memory allocation for the result is
-                    // ours so we can propagate it to Lua as a string.
-                    if (req.data && req.dataLen == 32 && s_x25519_handler) {
-                        uint8_t* secret = (uint8_t*)malloc(32);
-                        if (secret) {
-                            if (s_x25519_handler(req.data, secret)) {
-                                result.data = secret;
-                                result.len = 32;
-                                result.success = true;
-                            } else {
-                                free(secret);
-                            }
-                        }
+        case OpType::X25519_SHARED_SECRET: {
+            // Peer's 32-byte Ed25519 pubkey arrives in req.data.
+            // The handler does the Ed25519 → X25519 conversion
+            // and X25519 ECDH internally; we just pass bytes
+            // through. All memory allocation for the result is
+            // ours so we can propagate it to Lua as a string.
+            if (req.data && req.dataLen == 32 && s_x25519_handler) {
+                uint8_t* secret = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, 32);
+                if (secret) {
+                    if (s_x25519_handler(req.data, secret)) {
+                        result.data = secret;
+                        result.len = 32;
+                        result.success = true;
+                    } else {
+                        heapTagFree(HeapTag::ASYNC, secret);
                     }
-                    if (req.data) free(req.data);
-                    break;
                 }
             }
+            if (req.data) heapTagFree(HeapTag::ASYNC, req.data);
+            break;
+        }
+    }
+}
+
+void AsyncIO::workerTask(void* param) {
+    AsyncIO* self = static_cast<AsyncIO*>(param);
+    Request req;
 
-            xQueueSend(self->_resultQueue, &result, portMAX_DELAY);
+    while (true) {
+        if (self->nextRequest(req, false)) {
+            self->runRequest(req);
+        } else {
+            // submit() notifies after every send, so a request queued
+            // between the failed pick and this wait is not missed.
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         }
     }
 }
@@ -683,25 +1057,61 @@ void AsyncIO::update() {
 }
 
 void AsyncIO::processResults() {
+    Scheduler& sched = Scheduler::instance();
     Result result;
 
     while (xQueueReceive(_resultQueue, &result, 0) == pdTRUE) {
-        if (result.coroRef == LUA_NOREF) {
-            if (result.data) free(result.data);
-            if (result.jsonString) free(result.jsonString);
+        LaneStats& st = _laneStats[(size_t)laneFor(result.type)];
+        st.completed++;
+        st.waitUsTotal += result.waitUs;
+        if (result.waitUs > st.waitUsMax) st.waitUsMax = result.waitUs;
+        st.runUsTotal += result.runUs;
+        if (result.runUs > st.runUsMax) st.runUsMax = result.runUs;
+
+        Ticket& ticket = _tickets[result.ticket];
+        bool cancelled = result.cancelled || ticket.cancelled.load();
+        int outRef = ticket.outRef;
+        ticket.outRef = LUA_NOREF;
+        ticket.inUse = false;
+        if (cancelled) st.cancelled++;
+
+        // HTTP: http_bindings delivers the response and wakes the
+        // coroutine; this result only frees the ticket.
+        if (result.type == OpType::HTTP_FETCH) {
+            if (result.data) heapTagFree(HeapTag::ASYNC, result.data);
             continue;
         }
 
-        // Get coroutine
-        lua_rawgeti(_mainState, LUA_REGISTRYINDEX, result.coroRef);
-        lua_State* co = lua_tothread(_mainState, -1);
-        lua_pop(_mainState, 1);
+        // Cache entry written (or not) behind an earlier SCRIPT_LOAD
+        if (result.type == OpType::SCRIPT_STORE) {
+            ScriptLoader::instance().noteStore(result.success, result.runUs);
+            continue;
+        }
 
+        // Cancelled, or the task is gone: drop the result unseen.
+        lua_State* co = cancelled ? nullptr : sched.waiter(result.token);
         if (co) {
+            int nargs = 1;
             // Push result based on operation type
             switch (result.type) {
-                case OpType::READ:
                 case OpType::READ_BYTES:
+                    if (outRef != LUA_NOREF) {
+                        // Hand the worker's block to the caller's buffer
+                        // instead of copying it into a string.
+                        if (result.success && result.data) {
+                            heapTagDisown(HeapTag::ASYNC, result.data);
+                            lua_rawgeti(_mainState, LUA_REGISTRYINDEX, outRef);
+                            buffer_bindings::adopt(buffer_bindings::toBuffer(_mainState, -1),
+                                                   result.data, result.len);
+                            result.data = nullptr;
+                            lua_xmove(_mainState, co, 1);
+                        } else {
+                            lua_pushnil(co);
+                        }
+                        break;
+                    }
+                    // fallthrough
+                case OpType::READ:
                 case OpType::RLE_READ:
                 case OpType::RLE_READ_RGB565:
                 case OpType::AES_ENCRYPT:
@@ -720,61 +1130,63 @@ void AsyncIO::processResults() {
                 case OpType::APPEND:
                 case OpType::EXISTS:
                 case OpType::JSON_WRITE:
+                case OpType::HTTP_FETCH:    // Never gets here (see above)
                     lua_pushboolean(co, result.success);
                     break;
 
-                case OpType::HTTP_FETCH:
-                    // Should never land here -- the worker sets
-                    // coroRef = LUA_NOREF before sending so this op
-                    // gets dropped at the top of the loop. Defensive:
-                    // do nothing if it slips through.
-                    continue;
-
                 case OpType::JSON_READ:
-                    if (result.success && result.jsonString) {
-                        // Parse JSON string to Lua table
-                        JsonDocument doc;
-                        DeserializationError err = deserializeJson(doc, result.jsonString);
-                        if (err) {
+                    if (result.success && result.data) {
+                        if (!luaJsonDecode(co, (const char*)result.data, result.len)) {
+                            // Error message is on top: resume with nil, err
                             lua_pushnil(co);
-                        } else {
-                            // Convert JSON to Lua (recursive helper needed)
-                            // For simplicity, push raw string - Lua can use json_decode
-                            lua_pushstring(co, result.jsonString);
+                            lua_insert(co, -2);
+                            nargs = 2;
                         }
                     } else {
                         lua_pushnil(co);
+                        lua_pushstring(co, "read failed");
+                        nargs = 2;
                     }
                     break;
-            }
 
-            // Lua 5.4 lua_resume requires nresults output parameter
-            int nresults = 0;
-            int status = lua_resume(co, _mainState, 1, &nresults);
-            if (status != LUA_OK && status != LUA_YIELD) {
-                const char* errMsg = lua_tostring(co, -1);
-                Serial.printf("[AsyncIO] Coroutine error: %s\n", errMsg);
-
-                // Call global show_error function to display error screen
-                lua_getglobal(_mainState, "show_error");
-                if (lua_isfunction(_mainState, -1)) {
-                    lua_pushstring(_mainState, errMsg ? errMsg : "Unknown coroutine error");
-                    lua_pushstring(_mainState, "coroutine");
-                    if (lua_pcall(_mainState, 2, 0, 0) != LUA_OK) {
-                        Serial.printf("[AsyncIO] Failed to show error: %s\n", lua_tostring(_mainState, -1));
-                        lua_pop(_mainState, 1);
+                case OpType::SCRIPT_LOAD: {
+                    ScriptLoader::FileRead* read = (ScriptLoader::FileRead*)result.data;
+                    result.data = nullptr;
+                    lua_rawgeti(_mainState, LUA_REGISTRYINDEX, outRef);
+                    const char* chunkname = lua_tostring(_mainState, -1);
+                    ScriptLoader::CacheEntry* store = nullptr;
+                    int status = read ? ScriptLoader::instance().loadRead(co, read, chunkname, &store)
+                                      : -1;
+                    if (status < 0) {
+                        lua_pushnil(co);
+                        lua_pushfstring(co, "cannot open %s", chunkname + 1);
+                        nargs = 2;
+                    } else if (status != LUA_OK) {
+                        lua_pushnil(co);
+                        lua_insert(co, -2);  // nil, message
+                        nargs = 2;
                     }
-                } else {
+                    ScriptLoader::freeRead(read);
+                    if (store) queueScriptStore(chunkname + 1, store);
                     lua_pop(_mainState, 1);
+                    break;
                 }
 
-                lua_pop(co, 1);
+                case OpType::SCRIPT_STORE:  // Never gets here (see above)
+                    lua_pushnil(co);
+                    break;
             }
+
+            // Resumed by the scheduler later this frame
+            sched.wake(result.token, nargs);
         }
 
-        luaL_unref(_mainState, LUA_REGISTRYINDEX, result.coroRef);
-        if (result.data) free(result.data);
-        if (result.jsonString) free(result.jsonString);
+        luaL_unref(_mainState, LUA_REGISTRYINDEX, outRef);
+        if (result.type == OpType::SCRIPT_LOAD) {
+            ScriptLoader::freeRead((ScriptLoader::FileRead*)result.data);
+            result.data = nullptr;
+        }
+        if (result.data) heapTagFree(HeapTag::ASYNC, result.data);
     }
 }
 
@@ -790,7 +1202,7 @@ int AsyncIO::l_async_read(lua_State* L) {
     // Handle $ prefix: embedded system scripts (synchronous, instant)
     if (path[0] == '$') {
         size_t embeddedSize = 0;
-        const char* embedded = embedded_lua::get_script(path, &embeddedSize);
+        const char* embedded = ScriptLoader::instance().findEmbedded(path, &embeddedSize);
         if (embedded != nullptr) {
             lua_pushlstring(L, embedded, embeddedSize);
         } else {
@@ -814,16 +1226,15 @@ int AsyncIO::l_async_read(lua_State* L) {
 
     // Handle /sd/ or /fs/ - async read
     if (strncmp(path, "/sd/", 4) == 0 || strncmp(path, "/fs/", 4) == 0) {
-        lua_pushthread(L);
-        int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        Scheduler::Token token = Scheduler::instance().park(L);
 
         Request req = {};
         req.type = OpType::READ;
-        req.coroRef = coroRef;
+        req.token = token;
         strncpy(req.path, path, MAX_PATH - 1);
 
-        if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-            luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        if (!AsyncIO::instance().submit(L, req)) {
+            Scheduler::instance().unpark(token);
             return luaL_error(L, "async queue full");
         }
         return lua_yield(L, 0);
@@ -837,16 +1248,15 @@ int AsyncIO::l_async_read(lua_State* L) {
                 char sdPath[MAX_PATH];
                 snprintf(sdPath, sizeof(sdPath), "/sd%s", path);
 
-                lua_pushthread(L);
-                int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+                Scheduler::Token token = Scheduler::instance().park(L);
 
                 Request req = {};
                 req.type = OpType::READ;
-                req.coroRef = coroRef;
+                req.token = token;
                 strncpy(req.path, sdPath, MAX_PATH - 1);
 
-                if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-                    luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+                if (!AsyncIO::instance().submit(L, req)) {
+                    Scheduler::instance().unpark(token);
                     return luaL_error(L, "async queue full");
                 }
                 return lua_yield(L, 0);
@@ -855,12 +1265,12 @@ int AsyncIO::l_async_read(lua_State* L) {
                 File file = SD.open(path, "r");
                 if (file) {
                     size_t fileSize = file.size();
-                    char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+                    char* buffer = (char*)heapTagCapsMalloc(HeapTag::ASYNC, fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
                     if (buffer) {
                         size_t bytesRead = file.read((uint8_t*)buffer, fileSize);
                         file.close();
                         lua_pushlstring(L, buffer, bytesRead);
-                        heap_caps_free(buffer);
+                        heapTagFree(HeapTag::ASYNC, buffer);
                         return 1;
                     }
                     file.close();
@@ -877,16 +1287,15 @@ int AsyncIO::l_async_read(lua_State* L) {
                 char fsPath[MAX_PATH];
                 snprintf(fsPath, sizeof(fsPath), "/fs%s", path);
 
-                lua_pushthread(L);
-                int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+                Scheduler::Token token = Scheduler::instance().park(L);
 
                 Request req = {};
                 req.type = OpType::READ;
-                req.coroRef = coroRef;
+                req.token = token;
                 strncpy(req.path, fsPath, MAX_PATH - 1);
 
-                if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-                    luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+                if (!AsyncIO::instance().submit(L, req)) {
+                    Scheduler::instance().unpark(token);
                     return luaL_error(L, "async queue full");
                 }
                 return lua_yield(L, 0);
@@ -895,12 +1304,12 @@ int AsyncIO::l_async_read(lua_State* L) {
                 File file = LittleFS.open(path, "r");
                 if (file) {
                     size_t fileSize = file.size();
-                    char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+                    char* buffer = (char*)heapTagCapsMalloc(HeapTag::ASYNC, fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
                     if (buffer) {
                         size_t bytesRead = file.read((uint8_t*)buffer, fileSize);
                         file.close();
                         lua_pushlstring(L, buffer, bytesRead);
-                        heap_caps_free(buffer);
+                        heapTagFree(HeapTag::ASYNC, buffer);
                         return 1;
                     }
                     file.close();
@@ -923,47 +1332,55 @@ int AsyncIO::l_async_read(lua_State* L) {
     }
 
     // Unknown path format - try async I/O directly
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::READ;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
     return lua_yield(L, 0);
 }
 
-// async_read_bytes(path, offset, len) - yields coroutine, resumes with data or nil
+// async_read_bytes(path, offset, len [, buf]) - yields coroutine, resumes with
+// data or nil. With an ez.buffer, the worker's block becomes the buffer's
+// contents (no copy) and the coroutine resumes with the buffer.
 int AsyncIO::l_async_read_bytes(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
     lua_Integer offset = luaL_checkinteger(L, 2);
     lua_Integer len = luaL_checkinteger(L, 3);
+    bool intoBuffer = !lua_isnoneornil(L, 4);
+    if (intoBuffer && !buffer_bindings::toBuffer(L, 4)) {
+        return luaL_argerror(L, 4, "buffer expected");
+    }
 
     if (offset < 0 || len <= 0) {
         lua_pushnil(L);
         return 1;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::READ_BYTES;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.offset = (size_t)offset;
     req.length = (size_t)len;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
+    if (intoBuffer) {
+        lua_pushvalue(L, 4);
+        AsyncIO::instance()._tickets[req.ticket].outRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
 
     return lua_yield(L, 0);
 }
@@ -972,28 +1389,27 @@ int AsyncIO::l_async_read_bytes(lua_State* L) {
 int AsyncIO::l_async_write(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::WRITE;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.data = dataCopy;
     req.dataLen = dataLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1005,34 +1421,33 @@ int AsyncIO::l_async_write_bytes(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
     lua_Integer offset = luaL_checkinteger(L, 2);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 3, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 3, &dataLen);
 
     if (offset < 0) {
         lua_pushboolean(L, false);
         return 1;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::WRITE_BYTES;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.data = dataCopy;
     req.dataLen = dataLen;
     req.offset = (size_t)offset;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1043,28 +1458,27 @@ int AsyncIO::l_async_write_bytes(lua_State* L) {
 int AsyncIO::l_async_append(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::APPEND;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.data = dataCopy;
     req.dataLen = dataLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1075,68 +1489,114 @@ int AsyncIO::l_async_append(lua_State* L) {
 int AsyncIO::l_async_exists(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::EXISTS;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
     return lua_yield(L, 0);
 }
 
-// async_json_read(path) - yields coroutine, resumes with JSON string or nil
+// async_load(path) - ez.system.load_file(path) with the file work on the
+// worker: yields while the source and its cached bytecode are read, resumes
+// with the chunk or nil, err. Only the undump (or, on a cache miss, the
+// compile) runs on the Lua thread, and a new cache entry is written back by
+// the worker. $ paths load from flash; outside a coroutine, loads in place.
+int AsyncIO::l_async_load(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    ScriptLoader& loader = ScriptLoader::instance();
+
+    if (path[0] != '$' && lua_isyieldable(L)) {
+        Scheduler::Token token = Scheduler::instance().park(L);
+
+        Request req = {};
+        req.type = OpType::SCRIPT_LOAD;
+        req.token = token;
+        strncpy(req.path, path, MAX_PATH - 1);
+
+        if (!AsyncIO::instance().submit(L, req)) {
+            Scheduler::instance().unpark(token);
+            return luaL_error(L, "async queue full");
+        }
+        lua_pushfstring(L, "@%s", req.path);
+        AsyncIO::instance()._tickets[req.ticket].outRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        return lua_yield(L, 0);
+    }
+
+    int status = path[0] == '$' ? loader.loadEmbedded(L, path) : loader.loadPath(L, path);
+    if (status == LUA_OK) return 1;
+    lua_pushnil(L);
+    if (status < 0) {
+        lua_pushfstring(L, "cannot open %s", path);
+    } else {
+        lua_insert(L, -2);  // nil, message
+    }
+    return 2;
+}
+
+// async_json_read(path) - yields coroutine, resumes with the decoded value,
+// or nil plus an error message
 int AsyncIO::l_async_json_read(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::JSON_READ;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
     return lua_yield(L, 0);
 }
 
-// async_json_write(path, json_string) - yields coroutine, resumes with true/false
+// async_json_write(path, value) - yields coroutine, resumes with true/false.
+// A string is written as-is (already JSON); anything else is encoded here
+// on the Lua thread straight into a PSRAM block, never a Lua string.
 int AsyncIO::l_async_json_write(lua_State* L) {
     const char* path = luaL_checkstring(L, 1);
+    luaL_checkany(L, 2);
     size_t jsonLen;
-    const char* jsonStr = luaL_checklstring(L, 2, &jsonLen);
-
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
-
-    uint8_t* dataCopy = (uint8_t*)malloc(jsonLen);
-    if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
-        return luaL_error(L, "out of memory");
+    uint8_t* dataCopy;
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        const char* jsonStr = lua_tolstring(L, 2, &jsonLen);
+        dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, jsonLen);
+        if (!dataCopy) {
+            return luaL_error(L, "out of memory");
+        }
+        memcpy(dataCopy, jsonStr, jsonLen);
+    } else {
+        const char* err = nullptr;
+        dataCopy = (uint8_t*)luaJsonEncodeToBlock(L, 2, &jsonLen, &err);
+        if (!dataCopy) {
+            return luaL_error(L, "json encode failed: %s", err);
+        }
+        heapTagAdopt(HeapTag::ASYNC, dataCopy);
     }
-    memcpy(dataCopy, jsonStr, jsonLen);
+
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::JSON_WRITE;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.data = dataCopy;
     req.dataLen = jsonLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1154,18 +1614,17 @@ int AsyncIO::l_async_rle_read(lua_State* L) {
         return 1;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::RLE_READ;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.offset = (size_t)offset;
     req.length = (size_t)len;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1186,12 +1645,11 @@ int AsyncIO::l_async_rle_read_rgb565(lua_State* L) {
         return 1;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
     Request req = {};
     req.type = OpType::RLE_READ_RGB565;
-    req.coroRef = coroRef;
+    req.token = token;
     strncpy(req.path, path, MAX_PATH - 1);
     req.offset = (size_t)offset;
     req.length = (size_t)len;
@@ -1203,8 +1661,8 @@ int AsyncIO::l_async_rle_read_rgb565(lua_State* L) {
         lua_pop(L, 1);
     }
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1215,7 +1673,7 @@ int AsyncIO::l_async_rle_read_rgb565(lua_State* L) {
 int AsyncIO::l_async_aes_encrypt(lua_State* L) {
     size_t keyLen, dataLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
     if (keyLen != 16) {
         lua_pushnil(L);
@@ -1223,27 +1681,26 @@ int AsyncIO::l_async_aes_encrypt(lua_State* L) {
         return 2;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::AES_ENCRYPT;
-    req.coroRef = coroRef;
+    req.token = token;
     req.data = dataCopy;
     req.dataLen = dataLen;
     memcpy(req.key, key, keyLen);
     req.keyLen = keyLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1254,7 +1711,7 @@ int AsyncIO::l_async_aes_encrypt(lua_State* L) {
 int AsyncIO::l_async_aes_decrypt(lua_State* L) {
     size_t keyLen, dataLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
     if (keyLen != 16) {
         lua_pushnil(L);
@@ -1268,27 +1725,26 @@ int AsyncIO::l_async_aes_decrypt(lua_State* L) {
         return 2;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::AES_DECRYPT;
-    req.coroRef = coroRef;
+    req.token = token;
     req.data = dataCopy;
     req.dataLen = dataLen;
     memcpy(req.key, key, keyLen);
     req.keyLen = keyLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1310,25 +1766,24 @@ int AsyncIO::l_async_x25519_shared_secret(lua_State* L) {
         return 2;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(keyLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, keyLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, peer, keyLen);
 
     Request req = {};
     req.type = OpType::X25519_SHARED_SECRET;
-    req.coroRef = coroRef;
+    req.token = token;
     req.data = dataCopy;
     req.dataLen = keyLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
@@ -1339,7 +1794,7 @@ int AsyncIO::l_async_x25519_shared_secret(lua_State* L) {
 int AsyncIO::l_async_hmac_sha256(lua_State* L) {
     size_t keyLen, dataLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
     if (keyLen > MAX_KEY) {
         lua_pushnil(L);
@@ -1347,33 +1802,98 @@ int AsyncIO::l_async_hmac_sha256(lua_State* L) {
         return 2;
     }
 
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    Scheduler::Token token = Scheduler::instance().park(L);
 
-    uint8_t* dataCopy = (uint8_t*)malloc(dataLen);
+    uint8_t* dataCopy = (uint8_t*)heapTagMalloc(HeapTag::ASYNC, dataLen);
     if (!dataCopy) {
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "out of memory");
     }
     memcpy(dataCopy, data, dataLen);
 
     Request req = {};
     req.type = OpType::HMAC_SHA256;
-    req.coroRef = coroRef;
+    req.token = token;
     req.data = dataCopy;
     req.dataLen = dataLen;
     memcpy(req.key, key, keyLen);
     req.keyLen = keyLen;
 
-    if (xQueueSend(AsyncIO::instance()._requestQueue, &req, 0) != pdTRUE) {
-        free(dataCopy);
-        luaL_unref(L, LUA_REGISTRYINDEX, coroRef);
+    if (!AsyncIO::instance().submit(L, req)) {
+        heapTagFree(HeapTag::ASYNC, dataCopy);
+        Scheduler::instance().unpark(token);
         return luaL_error(L, "async queue full");
     }
 
     return lua_yield(L, 0);
 }
 
+// async_cancel(co) - cancel the task running coroutine co and the tasks it
+// spawned (see Scheduler::cancel). Pending async ops they started are
+// dropped and none of them is resumed again. Returns the number of
+// requests cancelled. Screens call this from on_exit with the coroutine
+// returned by spawn().
+int AsyncIO::l_async_cancel(lua_State* L) {
+    luaL_checktype(L, 1, LUA_TTHREAD);
+    lua_State* co = lua_tothread(L, 1);
+    lua_pushinteger(L, Scheduler::instance().cancel(co));
+    return 1;
+}
+
+// async_stats() - per-lane queue depth and latency:
+// { interactive = {depth, max_depth, submitted, rejected, completed,
+//   cancelled, wait_avg_us, wait_max_us, run_avg_us, run_max_us}, crypto = ..., bulk = ...,
+//   coalesce = {batches, requests, ranges, spans, opens_saved, reads_saved} }
+int AsyncIO::l_async_stats(lua_State* L) {
+    lua_createtable(L, 0, LANE_COUNT + 1);
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        LaneStats st;
+        uint32_t depth;
+        AsyncIO::instance().getLaneStats((Lane)i, st, depth);
+
+        lua_createtable(L, 0, 10);
+        lua_pushinteger(L, depth);
+        lua_setfield(L, -2, "depth");
+        lua_pushinteger(L, st.maxDepth);
+        lua_setfield(L, -2, "max_depth");
+        lua_pushinteger(L, st.submitted);
+        lua_setfield(L, -2, "submitted");
+        lua_pushinteger(L, st.rejected);
+        lua_setfield(L, -2, "rejected");
+        lua_pushinteger(L, st.completed);
+        lua_setfield(L, -2, "completed");
+        lua_pushinteger(L, st.cancelled);
+        lua_setfield(L, -2, "cancelled");
+        lua_pushinteger(L, st.completed ? (lua_Integer)(st.waitUsTotal / st.completed) : 0);
+        lua_setfield(L, -2, "wait_avg_us");
+        lua_pushinteger(L, st.waitUsMax);
+        lua_setfield(L, -2, "wait_max_us");
+        lua_pushinteger(L, st.completed ? (lua_Integer)(st.runUsTotal / st.completed) : 0);
+        lua_setfield(L, -2, "run_avg_us");
+        lua_pushinteger(L, st.runUsMax);
+        lua_setfield(L, -2, "run_max_us");
+        lua_setfield(L, -2, laneName((Lane)i));
+    }
+
+    // Each batched request saves an open; each merged range a seek+read.
+    const CoalesceStats& co = AsyncIO::instance().getCoalesceStats();
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, co.batches);
+    lua_setfield(L, -2, "batches");
+    lua_pushinteger(L, co.requests);
+    lua_setfield(L, -2, "requests");
+    lua_pushinteger(L, co.ranges);
+    lua_setfield(L, -2, "ranges");
+    lua_pushinteger(L, co.spans);
+    lua_setfield(L, -2, "spans");
+    lua_pushinteger(L, co.requests - co.batches);
+    lua_setfield(L, -2, "opens_saved");
+    lua_pushinteger(L, co.ranges - co.spans);
+    lua_setfield(L, -2, "reads_saved");
+    lua_setfield(L, -2, "coalesce");
+    return 1;
+}
+
 void AsyncIO::registerBindings(lua_State* L) {
     // File I/O
     lua_register(L, "async_read", l_async_read);
@@ -1385,6 +1905,9 @@ void AsyncIO::registerBindings(lua_State* L) {
     lua_register(L, "async_append", l_async_append);
     lua_register(L, "async_exists", l_async_exists);
 
+    // Scripts
+    lua_register(L, "async_load", l_async_load);
+
     // JSON
     lua_register(L, "async_json_read", l_async_json_read);
     lua_register(L, "async_json_write", l_async_json_write);
@@ -1399,5 +1922,9 @@ void AsyncIO::registerBindings(lua_State* L) {
     lua_register(L, "async_hmac_sha256", l_async_hmac_sha256);
     lua_register(L, "async_x25519_shared_secret", l_async_x25519_shared_secret);
 
+    // Scheduling
+    lua_register(L, "async_cancel", l_async_cancel);
+    lua_register(L, "async_stats", l_async_stats);
+
     Serial.println("[AsyncIO] Registered Lua bindings");
 }
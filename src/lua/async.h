@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 
 #include <freertos/FreeRTOS.h>
@@ -9,14 +10,71 @@
 
 // Async I/O and compute system for Lua
 // Runs operations on Core 0 so Lua on Core 1 isn't blocked
+//
+// Requests are sorted into lanes, each with its own bounded queue. The
+// single worker picks the highest-priority non-empty lane, but a lane that
+// has been passed over STARVE_LIMIT times in a row is served next, so bulk
+// work still progresses under a steady stream of tile reads. Long bulk jobs
+// (HTTP) call waitSlice() while blocked on the network, which runs one
+// queued interactive/crypto job in the gap instead of sleeping.
 class AsyncIO {
 public:
     static AsyncIO& instance();
 
+    enum class Lane : uint8_t {
+        INTERACTIVE,    // File reads/writes, JSON, RLE tiles
+        CRYPTO,         // AES, HMAC, X25519
+        BULK,           // HTTP fetches
+        COUNT
+    };
+
+    // Per-lane counters, kept on the Lua thread (see processResults)
+    struct LaneStats {
+        uint32_t submitted;     // Accepted into the lane
+        uint32_t rejected;      // Lane queue full or no free ticket
+        uint32_t completed;     // Results delivered (including cancelled)
+        uint32_t cancelled;     // Results discarded after async_cancel
+        uint32_t maxDepth;      // Deepest the lane queue has been
+        uint64_t waitUsTotal;   // Submit -> worker start
+        uint32_t waitUsMax;
+        uint64_t runUsTotal;    // Worker start -> finish, excluding nested jobs
+        uint32_t runUsMax;
+    };
+
+    void getLaneStats(Lane lane, LaneStats& out, uint32_t& depth) const;
+
+    // Consecutive READ_BYTES requests for one file are served as a batch:
+    // one open, reads sorted by offset and merged (see read_coalescer.h).
+    // Written by the worker, read on the Lua thread.
+    struct CoalesceStats {
+        uint32_t batches;       // Batches of two or more requests
+        uint32_t requests;      // Requests served by those batches
+        uint32_t ranges;        // ...of which actually read (not cancelled/empty)
+        uint32_t spans;         // Seek+read commands they needed
+    };
+    const CoalesceStats& getCoalesceStats() const { return _coalesce; }
+    static const char* laneName(Lane lane);
+
+    // Flag every pending request made by coroutine `co` as cancelled. Ops
+    // that have not started are skipped, and HTTP fetches abort at their
+    // next network wait. Returns the number of requests flagged. Lua thread
+    // only; Scheduler::cancel() calls this for each task it cancels, and
+    // its stale wait tokens keep the results from resuming anything.
+    int cancel(lua_State* co);
+
+    // For long jobs on the worker thread: wait about `ms`, running one queued
+    // interactive/crypto job instead if any is waiting. Returns false if the
+    // current job has been cancelled and should give up.
+    static bool waitSlice(uint32_t ms);
+
+    // True if the job currently running on the worker has been cancelled.
+    static bool cancelRequested();
+
     // Initialize (call once at startup after Lua is ready)
     bool init(lua_State* L);
 
-    // Process completions (call every frame from main loop)
+    // Process completions (call every frame from main loop). Waiting
+    // coroutines are woken through the Scheduler, which resumes them.
     void update();
 
     // Register Lua bindings
@@ -38,6 +96,9 @@ public:
     static int l_async_append(lua_State* L);
     static int l_async_exists(lua_State* L);
 
+    // Lua functions - Scripts
+    static int l_async_load(lua_State* L);
+
     // Lua functions - JSON
     static int l_async_json_read(lua_State* L);
     static int l_async_json_write(lua_State* L);
@@ -52,22 +113,27 @@ public:
     static int l_async_hmac_sha256(lua_State* L);
     static int l_async_x25519_shared_secret(lua_State* L);
 
+    // Lua functions - Scheduling
+    static int l_async_cancel(lua_State* L);
+    static int l_async_stats(lua_State* L);
+
     // Cross-module entry point: queue an HTTP request to be processed
     // on the worker thread. The opaque pointer is forwarded verbatim to
     // the registered HTTP processor (see setHttpProcessor). The caller
     // (http_bindings) retains ownership; the processor is responsible
     // for freeing the request after it produces a response.
+    // `token` is the caller's Scheduler wait token.
     // Returns false if the queue was full -- caller must clean up.
-    bool queueHttpRequest(void* requestPtr, int coroRef);
+    bool queueHttpRequest(lua_State* co, void* requestPtr, uint32_t token);
 
     // Install the function that the worker calls to process an
     // HTTP_FETCH op. http_bindings registers this at boot. Signature:
-    //   void(*)(void* requestPtr, int coroRef)
+    //   void(*)(void* requestPtr, uint32_t token)
     // The processor runs on the worker thread (Core 0); it must not
     // touch the Lua state directly. It typically deposits a response
     // struct on http_bindings' own response queue, which is drained by
     // http_bindings::update() on the Lua thread.
-    using HttpProcessor = void (*)(void* requestPtr, int coroRef);
+    using HttpProcessor = void (*)(void* requestPtr, uint32_t token);
     static void setHttpProcessor(HttpProcessor fn);
 
 private:
@@ -98,16 +164,51 @@ private:
         // worker thread rather than spawning a second one because
         // internal DRAM is too tight to afford a separate task stack.
         HTTP_FETCH,
+        // Scripts -- the worker does ScriptLoader's file work (source and
+        // cache entry read, new entry written); the Lua thread undumps or
+        // compiles in processResults
+        SCRIPT_LOAD,
+        SCRIPT_STORE,
     };
+    // Span name for ez.trace, e.g. "async.read"
+    static const char* opName(OpType type);
+
+    static constexpr size_t LANE_COUNT = (size_t)Lane::COUNT;
+    static constexpr size_t LANE_QUEUE_SIZE[LANE_COUNT] = {8, 4, 4};
+    // A lane skipped this many picks in a row is served next
+    static constexpr uint8_t STARVE_LIMIT = 4;
+    // Every queued request plus the one running and one nested in it
+    static constexpr size_t MAX_TICKETS = 8 + 4 + 4 + 2;
+    static constexpr uint8_t NO_TICKET = 0xFF;
+    // READ_BYTES batching limits: whole interactive queue plus the
+    // request that started the batch; ranges up to MAX_GAP apart share a
+    // read of at most MAX_SPAN bytes.
+    static constexpr size_t MAX_READ_BATCH = 8 + 1;
+    static constexpr uint32_t COALESCE_MAX_GAP = 2048;
+    static constexpr uint32_t COALESCE_MAX_SPAN = 64 * 1024;
 
     // Max sizes
     static constexpr size_t MAX_PATH = 128;
     static constexpr size_t MAX_KEY = 32;
-    static constexpr size_t MAX_JSON_DOC = 16384;
+
+    // One per in-flight request, from submit until its result is consumed
+    // (for HTTP, until the worker is done with it). `co`, `outRef` and
+    // `inUse` are only touched on the Lua thread; the worker reads
+    // `cancelled`.
+    struct Ticket {
+        lua_State* co;
+        int outRef;             // ez.buffer to fill (READ_BYTES), chunk name
+                                // (SCRIPT_LOAD), or LUA_NOREF
+        Lane lane;
+        bool inUse;
+        std::atomic<bool> cancelled;
+    };
 
     struct Request {
         OpType type;
-        int coroRef;
+        uint32_t token;         // Scheduler wait token of the requester
+        uint8_t ticket;
+        uint32_t enqueuedUs;    // micros() at submit
         char path[MAX_PATH];
         uint8_t* data;          // Input data (for write/crypto operations)
         size_t dataLen;
@@ -120,18 +221,39 @@ private:
 
     struct Result {
         OpType type;
-        int coroRef;
+        uint32_t token;
+        uint8_t ticket;
+        bool cancelled;         // Skipped because the ticket was cancelled
+        uint32_t waitUs;
+        uint32_t runUs;
         uint8_t* data;          // Output data
         size_t len;
         bool success;
-        char* jsonString;       // For JSON_READ result (parsed to Lua later)
     };
 
     lua_State* _mainState = nullptr;
-    QueueHandle_t _requestQueue = nullptr;
+    QueueHandle_t _laneQueues[LANE_COUNT] = {};
     QueueHandle_t _resultQueue = nullptr;
     TaskHandle_t _workerTask = nullptr;
 
+    Ticket _tickets[MAX_TICKETS] = {};
+    LaneStats _laneStats[LANE_COUNT] = {};
+
+    // Worker-thread scheduling state
+    uint8_t _skipped[LANE_COUNT] = {};
+    uint8_t _runningTicket = NO_TICKET;  // Outermost job on the worker
+    bool _nested = false;                // Inside waitSlice()
+    uint32_t _nestedUs = 0;              // Time spent in nested jobs
+    CoalesceStats _coalesce = {};
+
+    static Lane laneFor(OpType type);
+    bool submit(lua_State* co, Request& req);
+    void queueScriptStore(const char* path, void* entry);
+    bool nextRequest(Request& req, bool nestedOnly);
+    void runRequest(Request& req);
+    bool runReadBatch(Request& first);
+    static void execute(Request& req, Result& result);
+
     static void workerTask(void* param);
     void processResults();
 
@@ -4,8 +4,10 @@
 #include "../lua_bindings.h"
 #include "../../config.h"
 #include "../../audio/synth.h"
+#include "../../util/heap_tags.h"
 #include <Arduino.h>
 #include <driver/i2s.h>
+#include <esp_heap_caps.h>
 #include <cmath>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -730,7 +732,7 @@ static int findFreePreloadSlot() {
 static void freePreloadedSample(int index) {
     if (index >= 0 && index < MAX_PRELOADED && preloadedSamples[index].valid) {
         if (preloadedSamples[index].samples) {
-            free(preloadedSamples[index].samples);
+            heapTagFree(HeapTag::AUDIO, preloadedSamples[index].samples);
             preloadedSamples[index].samples = nullptr;
         }
         preloadedSamples[index].valid = false;
@@ -746,14 +748,15 @@ static void mp3DataCallback(MP3FrameInfo& info, short* pcm_buffer, size_t len, v
     // Resample if needed (MP3 can be 44100, 22050, etc.)
     if (info.samprate == SAMPLE_RATE && info.nChans == 1) {
         // Direct playback - just apply volume
-        int16_t* scaledBuf = (int16_t*)ps_malloc(len * sizeof(int16_t));
+        int16_t* scaledBuf = (int16_t*)heapTagCapsMalloc(HeapTag::AUDIO, len * sizeof(int16_t),
+                                                         MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
         if (scaledBuf) {
             for (size_t i = 0; i < len; i++) {
                 scaledBuf[i] = (int16_t)(pcm_buffer[i] * volumeScale);
             }
             size_t bytesWritten;
             i2s_write(I2S_PORT, scaledBuf, len * sizeof(int16_t), &bytesWritten, portMAX_DELAY);
-            free(scaledBuf);
+            heapTagFree(HeapTag::AUDIO, scaledBuf);
         }
     } else {
         // Resample and/or mix to mono
@@ -971,7 +974,8 @@ LUA_FUNCTION(l_audio_preload) {
         size_t numSamples = dataSize / (header.bitsPerSample / 8) / header.numChannels;
 
         // Allocate in PSRAM
-        sample.samples = (int16_t*)ps_malloc(numSamples * sizeof(int16_t));
+        sample.samples = (int16_t*)heapTagCapsMalloc(HeapTag::AUDIO, numSamples * sizeof(int16_t),
+                                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
         if (!sample.samples) {
             Serial.println("[Audio] Preload failed: out of memory");
             file.close();
@@ -1010,7 +1014,8 @@ LUA_FUNCTION(l_audio_preload) {
         // Raw PCM: 16-bit mono at 22050Hz
         size_t fileSize = file.size();
         sample.sampleCount = fileSize / 2;
-        sample.samples = (int16_t*)ps_malloc(sample.sampleCount * sizeof(int16_t));
+        sample.samples = (int16_t*)heapTagCapsMalloc(HeapTag::AUDIO, sample.sampleCount * sizeof(int16_t),
+                                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 
         if (!sample.samples) {
             Serial.println("[Audio] Preload failed: out of memory");
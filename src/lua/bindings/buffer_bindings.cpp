@@ -0,0 +1,520 @@
+// ez.buffer module bindings
+// PSRAM-backed mutable byte buffers accepted by the binary APIs
+
+#include "buffer_bindings.h"
+#include "../lua_bindings.h"
+#include "../../util/log.h"
+#include <esp_heap_caps.h>
+#include <string.h>
+
+// @module ez.buffer
+// @brief Mutable byte buffers in PSRAM
+// @description
+// Strings are immutable, so every binary API that returns one allocates,
+// hashes and copies a fresh Lua string -- megabytes per second for map
+// tiles, images and file transfers. A buffer is a mutable block of bytes
+// in PSRAM, outside the Lua heap. Functions that take binary input
+// (ez.compression.inflate, ez.crypto.*, ez.display.draw_bitmap and
+// draw_indexed_bitmap, sprite:set_raw, ez.image.decode_*, ez.net, ez.http
+// bodies, mesh payloads, ez.storage writes) accept a buffer anywhere they
+// accept a string. The bulk producers -- ez.storage.read_bytes,
+// ez.storage.async_read_bytes and ez.compression.inflate -- take an
+// optional output buffer and fill it instead of returning a string, so a
+// read -> inflate -> draw pipeline creates no Lua strings at all.
+//
+// slice() returns a view sharing the same bytes. Views keep the memory
+// alive and are clamped to the owner's current size. Buffer memory is not
+// counted by the Lua collector; call release() on large buffers you are
+// done with rather than waiting for the GC.
+// @end
+
+namespace buffer_bindings {
+
+namespace {
+
+uint32_t g_liveStores = 0;
+size_t g_liveBytes = 0;
+
+// data() for an empty buffer: a valid pointer for zero-length calls.
+uint8_t g_empty[1] = {0};
+
+uint8_t* allocBytes(size_t n) {
+    void* p = heap_caps_malloc(n, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p) p = malloc(n);
+    return static_cast<uint8_t*>(p);
+}
+
+// Grow the store's block to at least `cap` bytes. `exact` skips the
+// 1.5x headroom used for append().
+bool reserve(Store* s, size_t cap, bool exact) {
+    if (cap <= s->cap) return true;
+    size_t newCap = cap;
+    if (!exact && s->cap + s->cap / 2 > newCap) newCap = s->cap + s->cap / 2;
+    uint8_t* p = static_cast<uint8_t*>(
+        heap_caps_realloc(s->data, newCap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    if (!p) p = static_cast<uint8_t*>(heap_caps_realloc(s->data, newCap, MALLOC_CAP_8BIT));
+    if (!p) return false;
+    g_liveBytes += newCap - s->cap;
+    s->data = p;
+    s->cap = newCap;
+    return true;
+}
+
+void freeData(Store* s) {
+    if (s->data) heap_caps_free(s->data);
+    g_liveBytes -= s->cap;
+    s->data = nullptr;
+    s->size = 0;
+    s->cap = 0;
+}
+
+void unrefStore(Store* s) {
+    if (!s || --s->refs > 0) return;
+    freeData(s);
+    free(s);
+    g_liveStores--;
+}
+
+Store* newStore(size_t size) {
+    Store* s = static_cast<Store*>(malloc(sizeof(Store)));
+    if (!s) return nullptr;
+    *s = {};
+    s->refs = 1;
+    g_liveStores++;
+    if (size > 0) {
+        s->data = allocBytes(size);
+        if (!s->data) {
+            free(s);
+            g_liveStores--;
+            return nullptr;
+        }
+        s->cap = size;
+        g_liveBytes += size;
+    }
+    s->size = size;
+    return s;
+}
+
+LuaBuffer* checkBuffer(lua_State* L, int idx) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, idx, METATABLE));
+    if (!b->store) luaL_argerror(L, idx, "buffer was released");
+    return b;
+}
+
+LuaBuffer* checkOwner(lua_State* L, int idx) {
+    LuaBuffer* b = checkBuffer(L, idx);
+    if (b->view) luaL_argerror(L, idx, "cannot resize a view");
+    return b;
+}
+
+// string.sub-style range: 1-based, inclusive, negatives count from the
+// end. Returns the 0-based start and the length (0 if empty).
+void range(lua_State* L, int iIdx, int jIdx, size_t size, size_t* start, size_t* len) {
+    lua_Integer i = luaL_optinteger(L, iIdx, 1);
+    lua_Integer j = luaL_optinteger(L, jIdx, -1);
+    lua_Integer n = (lua_Integer)size;
+    if (i < 0) i = n + i + 1 > 0 ? n + i + 1 : 1;
+    else if (i == 0) i = 1;
+    if (j < 0) j = n + j + 1;
+    else if (j > n) j = n;
+    if (i > j) {
+        *start = 0;
+        *len = 0;
+    } else {
+        *start = (size_t)(i - 1);
+        *len = (size_t)(j - i + 1);
+    }
+}
+
+}  // namespace
+
+uint8_t* LuaBuffer::data() const {
+    if (!store || !store->data) return g_empty;
+    return store->data + (view ? offset : 0);
+}
+
+size_t LuaBuffer::size() const {
+    if (!store) return 0;
+    if (!view) return store->size;
+    if (offset >= store->size) return 0;
+    size_t avail = store->size - offset;
+    return length < avail ? length : avail;
+}
+
+LuaBuffer* toBuffer(lua_State* L, int idx) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_testudata(L, idx, METATABLE));
+    return b && b->store ? b : nullptr;
+}
+
+const uint8_t* toBytes(lua_State* L, int idx, size_t* len) {
+    if (LuaBuffer* b = toBuffer(L, idx)) {
+        *len = b->size();
+        return b->data();
+    }
+    if (lua_type(L, idx) == LUA_TSTRING || lua_type(L, idx) == LUA_TNUMBER) {
+        return reinterpret_cast<const uint8_t*>(lua_tolstring(L, idx, len));
+    }
+    *len = 0;
+    return nullptr;
+}
+
+const uint8_t* checkBytes(lua_State* L, int idx, size_t* len) {
+    if (LuaBuffer* b = toBuffer(L, idx)) {
+        *len = b->size();
+        return b->data();
+    }
+    return reinterpret_cast<const uint8_t*>(luaL_checklstring(L, idx, len));
+}
+
+uint8_t* prepareOutput(LuaBuffer* buf, size_t size) {
+    if (!buf || !buf->store) return nullptr;
+    if (buf->view) return buf->size() >= size ? buf->data() : nullptr;
+    if (!reserve(buf->store, size, true)) return nullptr;
+    buf->store->size = size;
+    return size ? buf->store->data : g_empty;
+}
+
+void adopt(LuaBuffer* buf, uint8_t* data, size_t len) {
+    if (!buf || !buf->store) {
+        free(data);
+        return;
+    }
+    if (buf->view) {
+        size_t n = len < buf->size() ? len : buf->size();
+        if (n) memcpy(buf->data(), data, n);
+        free(data);
+        return;
+    }
+    Store* s = buf->store;
+    freeData(s);
+    s->data = data;
+    s->size = len;
+    s->cap = len;
+    g_liveBytes += len;
+}
+
+LuaBuffer* pushNew(lua_State* L, size_t size) {
+    Store* s = newStore(size);
+    if (!s) return nullptr;
+    if (size) memset(s->data, 0, size);
+    LuaBuffer* b = lua_newuserdata_mt<LuaBuffer>(L, METATABLE);
+    b->store = s;
+    b->offset = 0;
+    b->length = 0;
+    b->view = false;
+    return b;
+}
+
+// @lua ez.buffer.new(size_or_data) -> buffer
+// @brief Create a buffer
+// @description With a number, a zero-filled buffer of that many bytes.
+// With a string or buffer, a copy of its bytes. Memory comes from PSRAM.
+// @param size_or_data Size in bytes, or a string/buffer to copy
+// @return New buffer
+// @example
+// local tile = ez.buffer.new(24576)
+// local copy = ez.buffer.new("\1\2\3")
+// @end
+LUA_FUNCTION(l_buffer_new) {
+    size_t len = 0;
+    const uint8_t* src = nullptr;
+    if (lua_type(L, 1) == LUA_TNUMBER) {
+        lua_Integer n = luaL_checkinteger(L, 1);
+        if (n < 0) return luaL_argerror(L, 1, "size must be >= 0");
+        len = (size_t)n;
+    } else {
+        src = checkBytes(L, 1, &len);
+    }
+    // Copy out of a source buffer before anything can move it
+    LuaBuffer* b = pushNew(L, len);
+    if (!b) return luaL_error(L, "out of memory for %d byte buffer", (int)len);
+    if (src && len) memcpy(b->data(), src, len);
+    return 1;
+}
+
+// @lua ez.buffer.is_buffer(value) -> boolean
+// @brief Check whether a value is a buffer
+// @param value Any value
+// @return true for buffers and views
+// @example
+// if ez.buffer.is_buffer(data) then print(#data) end
+// @end
+LUA_FUNCTION(l_buffer_is_buffer) {
+    lua_pushboolean(L, luaL_testudata(L, 1, METATABLE) != nullptr);
+    return 1;
+}
+
+// @lua ez.buffer.stats() -> table
+// @brief Get live buffer memory
+// @return Table with count (live blocks) and bytes (allocated capacity)
+// @example
+// print(ez.buffer.stats().bytes)
+// @end
+LUA_FUNCTION(l_buffer_stats) {
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, g_liveStores);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, (lua_Integer)g_liveBytes);
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+// @lua buffer:size() -> integer
+// @brief Size in bytes (same as #buffer)
+// @return Byte count; for views, clamped to the owner's current size
+// @example
+// print(buf:size())
+// @end
+LUA_FUNCTION(l_buffer_size) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    lua_pushinteger(L, (lua_Integer)b->size());
+    return 1;
+}
+
+// @lua buffer:capacity() -> integer
+// @brief Bytes allocated for the underlying block
+// @return Capacity in bytes
+// @example
+// print(buf:capacity())
+// @end
+LUA_FUNCTION(l_buffer_capacity) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    lua_pushinteger(L, b->store ? (lua_Integer)b->store->cap : 0);
+    return 1;
+}
+
+// @lua buffer:resize(size)
+// @brief Grow or shrink a buffer
+// @description New bytes are zero. Views cannot be resized; views of this
+// buffer see the new size.
+// @param size New size in bytes
+// @example
+// buf:resize(0)
+// @end
+LUA_FUNCTION(l_buffer_resize) {
+    LuaBuffer* b = checkOwner(L, 1);
+    lua_Integer n = luaL_checkinteger(L, 2);
+    if (n < 0) return luaL_argerror(L, 2, "size must be >= 0");
+    Store* s = b->store;
+    size_t old = s->size;
+    if (!reserve(s, (size_t)n, true)) return luaL_error(L, "out of memory");
+    if ((size_t)n > old) memset(s->data + old, 0, (size_t)n - old);
+    s->size = (size_t)n;
+    return 0;
+}
+
+// @lua buffer:slice(i, j) -> buffer
+// @brief View a range of the buffer without copying
+// @description Indices work like string.sub: 1-based, inclusive, negative
+// values count from the end. Writes through the view change the original.
+// @param i Start index (default 1)
+// @param j End index (default -1)
+// @return View sharing the buffer's bytes
+// @example
+// local header = buf:slice(1, 16)
+// @end
+LUA_FUNCTION(l_buffer_slice) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    size_t start, len;
+    range(L, 2, 3, b->size(), &start, &len);
+    LuaBuffer* v = lua_newuserdata_mt<LuaBuffer>(L, METATABLE);
+    v->store = b->store;
+    v->store->refs++;
+    v->offset = (b->view ? b->offset : 0) + start;
+    v->length = len;
+    v->view = true;
+    return 1;
+}
+
+// @lua buffer:tostring(i, j) -> string
+// @brief Copy bytes into a Lua string
+// @param i Start index (default 1)
+// @param j End index (default -1)
+// @return String with the selected bytes
+// @example
+// local magic = buf:tostring(1, 4)
+// @end
+LUA_FUNCTION(l_buffer_tostring) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    size_t start, len;
+    range(L, 2, 3, b->size(), &start, &len);
+    lua_pushlstring(L, reinterpret_cast<const char*>(b->data() + start), len);
+    return 1;
+}
+
+// @lua buffer:byte(i, j) -> integer...
+// @brief Read bytes as integers, like string.byte
+// @param i Start index (default 1)
+// @param j End index (default i)
+// @return One integer per byte in the range
+// @example
+// local b1, b2 = buf:byte(1, 2)
+// @end
+LUA_FUNCTION(l_buffer_byte) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    lua_Integer i = luaL_optinteger(L, 2, 1);
+    if (lua_isnoneornil(L, 3)) {
+        lua_settop(L, 2);
+        lua_pushinteger(L, i);
+    }
+    size_t start, len;
+    range(L, 2, 3, b->size(), &start, &len);
+    luaL_checkstack(L, (int)len, "byte range too large");
+    const uint8_t* p = b->data() + start;
+    for (size_t k = 0; k < len; k++) lua_pushinteger(L, p[k]);
+    return (int)len;
+}
+
+// @lua buffer:set(i, ...)
+// @brief Write byte values starting at index i
+// @description Values are truncated to 8 bits. Writing past the end raises
+// an error; resize() first.
+// @param i Start index (1-based)
+// @param ... Byte values
+// @example
+// buf:set(1, 0x89, 0x50, 0x4E, 0x47)
+// @end
+LUA_FUNCTION(l_buffer_set) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    int n = lua_gettop(L) - 2;
+    if (i < 1 || (size_t)(i - 1) + (size_t)n > b->size()) {
+        return luaL_error(L, "set: index out of range");
+    }
+    uint8_t* p = b->data() + (i - 1);
+    for (int k = 0; k < n; k++) p[k] = (uint8_t)luaL_checkinteger(L, 3 + k);
+    return 0;
+}
+
+// @lua buffer:fill(value, i, j)
+// @brief Set a range of bytes to one value
+// @param value Byte value
+// @param i Start index (default 1)
+// @param j End index (default -1)
+// @example
+// buf:fill(0)
+// @end
+LUA_FUNCTION(l_buffer_fill) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    int value = (int)luaL_checkinteger(L, 2);
+    size_t start, len;
+    range(L, 3, 4, b->size(), &start, &len);
+    if (len) memset(b->data() + start, value & 0xFF, len);
+    return 0;
+}
+
+// @lua buffer:write(i, data)
+// @brief Copy a string or buffer into this buffer at index i
+// @description Owners grow to fit; a view raises an error if the data
+// would run past its end. Overlapping source and destination are safe.
+// @param i Destination index (1-based; #buf + 1 appends)
+// @param data String or buffer
+// @return Index just past the written bytes
+// @example
+// local at = buf:write(1, header)
+// buf:write(at, body)
+// @end
+LUA_FUNCTION(l_buffer_write) {
+    LuaBuffer* b = checkBuffer(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    size_t len = 0;
+    checkBytes(L, 3, &len);
+    if (i < 1 || (size_t)(i - 1) > b->size()) return luaL_error(L, "write: index out of range");
+    size_t end = (size_t)(i - 1) + len;
+    if (end > b->size()) {
+        if (b->view) return luaL_error(L, "write: %d bytes past end of view", (int)(end - b->size()));
+        if (!reserve(b->store, end, false)) return luaL_error(L, "out of memory");
+        b->store->size = end;
+    }
+    // Re-read the source: growing may have moved it if it is this buffer
+    size_t srcLen;
+    const uint8_t* src = checkBytes(L, 3, &srcLen);
+    if (len) memmove(b->data() + (i - 1), src, len);
+    lua_pushinteger(L, (lua_Integer)end + 1);
+    return 1;
+}
+
+// @lua buffer:append(data)
+// @brief Append a string or buffer
+// @param data String or buffer
+// @example
+// for _, chunk in ipairs(chunks) do buf:append(chunk) end
+// @end
+LUA_FUNCTION(l_buffer_append) {
+    LuaBuffer* b = checkOwner(L, 1);
+    size_t len = 0;
+    checkBytes(L, 2, &len);
+    size_t at = b->store->size;
+    if (!reserve(b->store, at + len, false)) return luaL_error(L, "out of memory");
+    const uint8_t* src = checkBytes(L, 2, &len);
+    if (len) memmove(b->store->data + at, src, len);
+    b->store->size = at + len;
+    return 0;
+}
+
+// @lua buffer:release()
+// @brief Free the memory now instead of at garbage collection
+// @description For an owner, frees the bytes (views of it become empty).
+// For a view, drops its reference. The buffer is unusable afterwards.
+// @example
+// tile:release()
+// @end
+LUA_FUNCTION(l_buffer_release) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    if (!b->store) return 0;
+    if (!b->view) freeData(b->store);
+    unrefStore(b->store);
+    b->store = nullptr;
+    return 0;
+}
+
+LUA_FUNCTION(l_buffer_gc) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    unrefStore(b->store);
+    b->store = nullptr;
+    return 0;
+}
+
+LUA_FUNCTION(l_buffer_len) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    lua_pushinteger(L, (lua_Integer)b->size());
+    return 1;
+}
+
+LUA_FUNCTION(l_buffer_tostring_mt) {
+    LuaBuffer* b = static_cast<LuaBuffer*>(luaL_checkudata(L, 1, METATABLE));
+    lua_pushfstring(L, "buffer%s: %d bytes", b->view ? " view" : "", (int)b->size());
+    return 1;
+}
+
+void registerBindings(lua_State* L) {
+    static const luaL_Reg methods[] = {
+        {"size",     l_buffer_size},
+        {"capacity", l_buffer_capacity},
+        {"resize",   l_buffer_resize},
+        {"slice",    l_buffer_slice},
+        {"tostring", l_buffer_tostring},
+        {"byte",     l_buffer_byte},
+        {"set",      l_buffer_set},
+        {"fill",     l_buffer_fill},
+        {"write",    l_buffer_write},
+        {"append",   l_buffer_append},
+        {"release",  l_buffer_release},
+        {"__gc",       l_buffer_gc},
+        {"__len",      l_buffer_len},
+        {"__tostring", l_buffer_tostring_mt},
+        {nullptr, nullptr}
+    };
+    lua_create_class_metatable(L, METATABLE, methods);
+
+    static const luaL_Reg funcs[] = {
+        {"new",       l_buffer_new},
+        {"is_buffer", l_buffer_is_buffer},
+        {"stats",     l_buffer_stats},
+        {nullptr, nullptr}
+    };
+    lua_register_module(L, "buffer", funcs);
+    LOG("LuaRuntime", "Registered ez.buffer");
+}
+
+}  // namespace buffer_bindings
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" {
+#include <lua.h>
+}
+
+// ez.buffer: mutable byte buffers in PSRAM, outside the Lua heap.
+//
+// A buffer owns a resizable block; slice() returns views onto a range of
+// it. Owner and views share the block through a refcounted store, so a
+// view keeps the bytes alive after its owner is collected, and growing the
+// owner (which may move the block) never leaves a view dangling: a view
+// resolves its pointer through the store on every access and is clamped
+// to the owner's current size.
+//
+// Binary APIs take string-or-buffer arguments through checkBytes(), and
+// the ones that produce bulk data accept an output buffer to fill instead
+// of returning a new string.
+namespace buffer_bindings {
+
+constexpr const char* METATABLE = "ez.buffer";
+
+struct Store {
+    uint8_t* data;
+    size_t size;
+    size_t cap;
+    uint32_t refs;
+};
+
+struct LuaBuffer {
+    Store* store;
+    size_t offset;      // Views only
+    size_t length;      // Views only
+    bool view;
+
+    uint8_t* data() const;
+    size_t size() const;
+};
+
+void registerBindings(lua_State* L);
+
+// The buffer at `idx`, or nullptr if it isn't one.
+LuaBuffer* toBuffer(lua_State* L, int idx);
+
+// Bytes of a string or buffer argument, without copying. Raises the usual
+// argument error for anything else (numbers convert as with
+// luaL_checklstring). The pointer is valid while the value stays on the
+// stack and the buffer isn't resized.
+const uint8_t* checkBytes(lua_State* L, int idx, size_t* len);
+
+// Like checkBytes, but returns nullptr instead of raising.
+const uint8_t* toBytes(lua_State* L, int idx, size_t* len);
+
+// Make `buf` exactly `size` bytes for use as an output and return its
+// data. Owners grow or shrink; a view must already be at least `size`
+// bytes and is filled from its start. nullptr if out of memory or the
+// view is too small.
+uint8_t* prepareOutput(LuaBuffer* buf, size_t size);
+
+// Replace an owner's contents with `data` (allocated with malloc or
+// heap_caps_malloc), taking ownership -- no copy. Views get the bytes
+// copied in, truncated to the view. Frees `data` in that case.
+void adopt(LuaBuffer* buf, uint8_t* data, size_t len);
+
+// Push a new owner buffer of `size` zeroed bytes; nullptr (and nothing
+// pushed) if out of memory.
+LuaBuffer* pushNew(lua_State* L, size_t size);
+
+}  // namespace buffer_bindings
@@ -20,15 +20,15 @@ MessageBus& MessageBus::instance() {
     return bus;
 }
 
-bool MessageBus::topicMatches(const std::string& pattern, const std::string& topic) const {
-    // Exact match for now (wildcard support can be added later)
-    return pattern == topic;
-}
-
 int MessageBus::subscribe(lua_State* L, const char* topic, int callbackRef) {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    int id = _nextSubscriptionId++;
+    int id = _nextSubscriptionId;
+    if (!_router.subscribe(id, topic)) {
+        LOG("MessageBus", "Invalid topic pattern: %s", topic);
+        return 0;
+    }
+    _nextSubscriptionId++;
 
     LuaSubscription sub;
     sub.callbackRef = callbackRef;
@@ -45,75 +45,102 @@ int MessageBus::subscribe(lua_State* L, const char* topic, int callbackRef) {
 bool MessageBus::unsubscribe(int subscriptionId) {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    // Check Lua subscriptions
+    // Check Lua subscriptions. The entry (and its callback ref) is
+    // released by sweepInactive() on the next process().
     auto luaIt = _luaSubscriptions.find(subscriptionId);
-    if (luaIt != _luaSubscriptions.end()) {
+    if (luaIt != _luaSubscriptions.end() && luaIt->second.active) {
         luaIt->second.active = false;
+        _router.unsubscribe(subscriptionId);
+        _needsSweep = true;
         LOG("MessageBus", "Unsubscribed id=%d", subscriptionId);
         return true;
     }
 
     // Check C++ subscriptions
     auto cppIt = _cppSubscriptions.find(subscriptionId);
-    if (cppIt != _cppSubscriptions.end()) {
+    if (cppIt != _cppSubscriptions.end() && cppIt->second.active) {
         cppIt->second.active = false;
+        _router.unsubscribe(subscriptionId);
+        _needsSweep = true;
         return true;
     }
 
     return false;
 }
 
-void MessageBus::post(const char* topic, const char* data) {
-    std::lock_guard<std::mutex> lock(_mutex);
+QueuedMessage* MessageBus::reserveSlot(const char* topic) {
+    TopicRouter::TopicId topicId = _router.intern(topic);
+    if (topicId == TopicRouter::INVALID_TOPIC) {
+        _stats.dropped++;
+        LOG("MessageBus", "Topic table full, dropping %s", topic);
+        return nullptr;
+    }
 
-    if (_messageQueue.size() >= MAX_QUEUE_SIZE) {
-        LOG("MessageBus", "Queue full, dropping message");
-        return;
+    if (_queueCount >= MAX_QUEUE_SIZE) {
+        // Back-pressure: the caller gets false, and the drop is counted per
+        // topic so ez.bus.get_stats() can show who is flooding the queue.
+        _stats.dropped++;
+        if (_dropsByTopic.size() <= topicId) _dropsByTopic.resize(topicId + 1, 0);
+        _dropsByTopic[topicId]++;
+        uint32_t now = millis();
+        if (now - _lastDropLogMs >= 1000) {
+            LOG("MessageBus", "Queue full, dropping %s (%u dropped so far)",
+                topic, _stats.dropped);
+            _lastDropLogMs = now;
+        }
+        return nullptr;
     }
 
-    QueuedMessage msg;
-    msg.topic = topic;
-    msg.stringData = data ? data : "";
-    msg.dataType = QueuedMessage::DataType::String;
-    _messageQueue.push_back(std::move(msg));
+    QueuedMessage* slot = &_queue[(_queueHead + _queueCount) % MAX_QUEUE_SIZE];
+    _queueCount++;
+    if (_queueCount > _stats.highWater) _stats.highWater = _queueCount;
+    _stats.posted++;
+    slot->topicId = topicId;
+    return slot;
 }
 
-void MessageBus::postTable(const char* topic, TableBuilder builder) {
+bool MessageBus::post(const char* topic, const char* data) {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    if (_messageQueue.size() >= MAX_QUEUE_SIZE) {
-        LOG("MessageBus", "Queue full, dropping table message");
-        return;
-    }
+    QueuedMessage* msg = reserveSlot(topic);
+    if (!msg) return false;
 
-    QueuedMessage msg;
-    msg.topic = topic;
-    msg.tableBuilder = std::move(builder);
-    msg.dataType = QueuedMessage::DataType::TableBuilder;
-    _messageQueue.push_back(std::move(msg));
+    // assign() reuses the slot's existing string capacity
+    msg->stringData.assign(data ? data : "");
+    msg->dataType = QueuedMessage::DataType::String;
+    return true;
 }
 
-void MessageBus::postLuaTable(lua_State* L, const char* topic, int tableRef) {
+bool MessageBus::postTable(const char* topic, TableBuilder builder) {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    if (_messageQueue.size() >= MAX_QUEUE_SIZE) {
-        LOG("MessageBus", "Queue full, dropping Lua table message");
+    QueuedMessage* msg = reserveSlot(topic);
+    if (!msg) return false;
+
+    msg->tableBuilder = std::move(builder);
+    msg->dataType = QueuedMessage::DataType::TableBuilder;
+    return true;
+}
+
+bool MessageBus::postLuaTable(lua_State* L, const char* topic, int tableRef) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    QueuedMessage* msg = reserveSlot(topic);
+    if (!msg) {
         // Release the reference since we're not using it
         luaL_unref(L, LUA_REGISTRYINDEX, tableRef);
-        return;
+        return false;
     }
 
-    QueuedMessage msg;
-    msg.topic = topic;
-    msg.tableRef = tableRef;
-    msg.dataType = QueuedMessage::DataType::Table;
-    _messageQueue.push_back(std::move(msg));
+    msg->tableRef = tableRef;
+    msg->dataType = QueuedMessage::DataType::Table;
+    return true;
 }
 
 void MessageBus::pushMessageData(lua_State* L, QueuedMessage& msg) {
     switch (msg.dataType) {
         case QueuedMessage::DataType::String:
-            lua_pushstring(L, msg.stringData.c_str());
+            lua_pushlstring(L, msg.stringData.data(), msg.stringData.size());
             break;
 
         case QueuedMessage::DataType::TableBuilder:
@@ -134,55 +161,98 @@ void MessageBus::pushMessageData(lua_State* L, QueuedMessage& msg) {
     }
 }
 
+void MessageBus::sweepInactive(lua_State* L) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_needsSweep) return;
+    _needsSweep = false;
+
+    for (auto it = _luaSubscriptions.begin(); it != _luaSubscriptions.end();) {
+        if (!it->second.active) {
+            if (it->second.callbackRef != LUA_NOREF) {
+                luaL_unref(L, LUA_REGISTRYINDEX, it->second.callbackRef);
+            }
+            it = _luaSubscriptions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = _cppSubscriptions.begin(); it != _cppSubscriptions.end();) {
+        if (!it->second.active) it = _cppSubscriptions.erase(it);
+        else ++it;
+    }
+}
+
 void MessageBus::process(lua_State* L) {
-    // Take a snapshot of messages to process (avoid holding lock during callbacks)
-    std::vector<QueuedMessage> toProcess;
+    sweepInactive(L);
+
+    // Only deliver what is queued now; anything posted by a subscriber
+    // during delivery waits for the next frame.
+    size_t count;
     {
         std::lock_guard<std::mutex> lock(_mutex);
-        toProcess.reserve(_messageQueue.size());
-        while (!_messageQueue.empty()) {
-            toProcess.push_back(std::move(_messageQueue.front()));
-            _messageQueue.pop_front();
-        }
+        count = _queueCount;
         _cachedState = L;
     }
-
-    if (toProcess.empty()) return;
-
-    // Process each message
-    for (auto& msg : toProcess) {
-        // Collect matching subscriptions (avoid holding lock during callbacks)
-        std::vector<std::pair<int, int>> luaCallbacks;
-        std::vector<std::pair<int, std::function<void(lua_State*, const std::string&)>>> cppCallbacks;
+    if (count == 0) return;
+
+    // Reused across messages (and frames, via the static) so steady-state
+    // delivery doesn't allocate.
+    static QueuedMessage msg;
+    static std::vector<std::pair<int, int>> luaCallbacks;
+    static std::vector<std::function<void(lua_State*, const std::string&)>> cppCallbacks;
+
+    for (size_t n = 0; n < count; n++) {
+        const std::string* topic;
+        luaCallbacks.clear();
+        cppCallbacks.clear();
         {
+            // Swap the head slot out (keeping its buffers in the ring) so
+            // the lock isn't held during callbacks.
             std::lock_guard<std::mutex> lock(_mutex);
-            for (auto& [id, sub] : _luaSubscriptions) {
-                if (sub.active && topicMatches(sub.topic, msg.topic)) {
-                    luaCallbacks.push_back({id, sub.callbackRef});
+            QueuedMessage& head = _queue[_queueHead];
+            std::swap(msg, head);
+            head.tableBuilder = nullptr;
+            head.tableRef = LUA_NOREF;
+            _queueHead = (_queueHead + 1) % MAX_QUEUE_SIZE;
+            _queueCount--;
+            _stats.delivered++;
+
+            topic = &_router.name(msg.topicId);
+            for (int id : _router.match(msg.topicId)) {
+                auto luaIt = _luaSubscriptions.find(id);
+                if (luaIt != _luaSubscriptions.end()) {
+                    luaCallbacks.push_back({id, luaIt->second.callbackRef});
+                    continue;
                 }
-            }
-            for (auto& [id, sub] : _cppSubscriptions) {
-                if (sub.active && topicMatches(sub.topic, msg.topic)) {
-                    cppCallbacks.push_back({id, sub.callback});
+                auto cppIt = _cppSubscriptions.find(id);
+                if (cppIt != _cppSubscriptions.end()) {
+                    cppCallbacks.push_back(cppIt->second.callback);
                 }
             }
         }
 
         // Deliver to C++ subscribers first
-        for (const auto& [id, callback] : cppCallbacks) {
+        for (const auto& callback : cppCallbacks) {
             pushMessageData(L, msg);  // Push data onto stack
-            callback(L, msg.topic);   // Callback reads from stack
+            callback(L, *topic);      // Callback reads from stack
             lua_pop(L, 1);            // Pop data
         }
 
         // Deliver to Lua subscribers
         for (const auto& [id, callbackRef] : luaCallbacks) {
+            // Skip subscriptions cancelled by an earlier callback for this message
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = _luaSubscriptions.find(id);
+                if (it == _luaSubscriptions.end() || !it->second.active) continue;
+            }
+
             // Get callback function from registry
             lua_rawgeti(L, LUA_REGISTRYINDEX, callbackRef);
 
             if (lua_isfunction(L, -1)) {
                 // Push arguments: topic, data (string or table)
-                lua_pushstring(L, msg.topic.c_str());
+                lua_pushlstring(L, topic->data(), topic->size());
                 pushMessageData(L, msg);
 
                 // Call callback(topic, data)
@@ -199,13 +269,20 @@ void MessageBus::process(lua_State* L) {
         if (msg.dataType == QueuedMessage::DataType::Table && msg.tableRef != LUA_NOREF) {
             luaL_unref(L, LUA_REGISTRYINDEX, msg.tableRef);
         }
+        msg.tableRef = LUA_NOREF;
+        msg.tableBuilder = nullptr;
     }
 }
 
 int MessageBus::subscribeCpp(const char* topic, std::function<void(lua_State*, const std::string&)> callback) {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    int id = _nextSubscriptionId++;
+    int id = _nextSubscriptionId;
+    if (!_router.subscribe(id, topic)) {
+        LOG("MessageBus", "Invalid topic pattern: %s", topic);
+        return 0;
+    }
+    _nextSubscriptionId++;
 
     CppSubscription sub;
     sub.callback = std::move(callback);
@@ -221,26 +298,31 @@ int MessageBus::subscribeCpp(const char* topic, std::function<void(lua_State*, c
 bool MessageBus::hasSubscribers(const char* topic) const {
     std::lock_guard<std::mutex> lock(_mutex);
 
-    std::string topicStr(topic);
-
-    for (const auto& [id, sub] : _luaSubscriptions) {
-        if (sub.active && topicMatches(sub.topic, topicStr)) {
-            return true;
-        }
-    }
+    // A query must not intern: callers probe topics they may never publish,
+    // and each one would hold a slot of MAX_TOPICS for good
+    TopicRouter::TopicId topicId = _router.find(topic);
+    if (topicId != TopicRouter::INVALID_TOPIC) return !_router.match(topicId).empty();
+    return _router.matchesAny(topic);
+}
 
-    for (const auto& [id, sub] : _cppSubscriptions) {
-        if (sub.active && topicMatches(sub.topic, topicStr)) {
-            return true;
-        }
-    }
+size_t MessageBus::getPendingCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queueCount;
+}
 
-    return false;
+BusStats MessageBus::getStats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
 }
 
-size_t MessageBus::getPendingCount() const {
+void MessageBus::getDropsByTopic(std::vector<std::pair<std::string, uint32_t>>& out) const {
     std::lock_guard<std::mutex> lock(_mutex);
-    return _messageQueue.size();
+    out.clear();
+    for (size_t i = 0; i < _dropsByTopic.size(); i++) {
+        if (_dropsByTopic[i] > 0) {
+            out.push_back({_router.name((TopicRouter::TopicId)i), _dropsByTopic[i]});
+        }
+    }
 }
 
 void MessageBus::clearAll(lua_State* L) {
@@ -254,15 +336,21 @@ void MessageBus::clearAll(lua_State* L) {
     }
 
     // Release any pending Lua table references
-    for (auto& msg : _messageQueue) {
+    for (size_t n = 0; n < _queueCount; n++) {
+        QueuedMessage& msg = _queue[(_queueHead + n) % MAX_QUEUE_SIZE];
         if (msg.dataType == QueuedMessage::DataType::Table && msg.tableRef != LUA_NOREF) {
             luaL_unref(L, LUA_REGISTRYINDEX, msg.tableRef);
         }
+        msg.tableRef = LUA_NOREF;
+        msg.tableBuilder = nullptr;
     }
 
     _luaSubscriptions.clear();
     _cppSubscriptions.clear();
-    _messageQueue.clear();
+    _router.clear();
+    _queueHead = 0;
+    _queueCount = 0;
+    _needsSweep = false;
 
     LOG("MessageBus", "Cleared all subscriptions");
 }
@@ -277,13 +365,18 @@ void MessageBus::clearAll(lua_State* L) {
 // and C++ code. Topics are strings like "screen/pushed" or "mesh/message". When a
 // message is posted to a topic, all subscribers receive it with the topic name and
 // data payload. Keep the returned subscription ID to unsubscribe later.
-// @param topic Topic string to subscribe to
+// Patterns may use MQTT-style wildcards as whole segments: "+" matches exactly
+// one segment and "#" (last segment only) matches any remaining segments,
+// including none. Subscribers to one message are called in subscription order.
+// @param topic Topic string or pattern to subscribe to
 // @param callback Function(topic, data) called when message received
 // @return Subscription ID for use with unsubscribe
 // @example
 // local sub_id = ez.bus.subscribe("mesh/message", function(topic, data)
 //     print("Received:", data.text, "from", data.sender)
 // end)
+// -- Every mesh topic, e.g. "mesh/message" and "mesh/node/discovered"
+// ez.bus.subscribe("mesh/#", function(topic, data) print(topic) end)
 // @end
 LUA_FUNCTION(l_bus_subscribe) {
     LUA_CHECK_ARGC(L, 2);
@@ -296,6 +389,10 @@ LUA_FUNCTION(l_bus_subscribe) {
     int callbackRef = luaL_ref(L, LUA_REGISTRYINDEX);
 
     int subId = MessageBus::instance().subscribe(L, topic, callbackRef);
+    if (subId == 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, callbackRef);
+        return luaL_error(L, "invalid topic pattern: %s", topic);
+    }
 
     lua_pushinteger(L, subId);
     return 1;
@@ -327,14 +424,16 @@ LUA_FUNCTION(l_bus_unsubscribe) {
     return 1;
 }
 
-// @lua ez.bus.post(topic, data)
+// @lua ez.bus.post(topic, data) -> boolean
 // @brief Post a message to a topic
 // @description Sends a message to all subscribers of the given topic. The data can
 // be a string or a table. Messages are queued and delivered on the next main loop
 // iteration, so posting is non-blocking. Use consistent topic naming like
-// "module/event" (e.g., "screen/pushed", "mesh/node_discovered").
+// "module/event" (e.g., "screen/pushed", "mesh/node_discovered"). The queue holds
+// 64 messages; when it is full the message is dropped and false is returned.
 // @param topic Topic string to post to
 // @param data Message data (string or table)
+// @return true if queued, false if dropped because the queue is full
 // @example
 // -- Post a string message
 // ez.bus.post("status/update", "connected")
@@ -351,14 +450,14 @@ LUA_FUNCTION(l_bus_post) {
         // Copy the table to registry so it survives until delivery
         lua_pushvalue(L, 2);
         int tableRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        MessageBus::instance().postLuaTable(L, topic, tableRef);
+        lua_pushboolean(L, MessageBus::instance().postLuaTable(L, topic, tableRef));
     } else {
         // Treat as string (nil becomes empty string)
         const char* data = lua_isnil(L, 2) ? "" : luaL_checkstring(L, 2);
-        MessageBus::instance().post(topic, data);
+        lua_pushboolean(L, MessageBus::instance().post(topic, data));
     }
 
-    return 0;
+    return 1;
 }
 
 // @lua ez.bus.has_subscribers(topic) -> boolean
@@ -398,6 +497,49 @@ LUA_FUNCTION(l_bus_pending_count) {
     return 1;
 }
 
+// @lua ez.bus.get_stats() -> table
+// @brief Get message queue counters
+// @description Returns delivery counters since boot: pending (queued now),
+// capacity (queue size), posted, delivered, dropped (rejected because the queue
+// was full), high_water (deepest the queue has been) and dropped_by_topic, a
+// table mapping topic name to its drop count. Non-zero drops mean some producer
+// posts faster than the main loop drains the queue.
+// @return Table with queue counters
+// @example
+// local s = ez.bus.get_stats()
+// for topic, n in pairs(s.dropped_by_topic) do
+//     print(topic, "dropped", n)
+// end
+// @end
+LUA_FUNCTION(l_bus_get_stats) {
+    MessageBus& bus = MessageBus::instance();
+    BusStats st = bus.getStats();
+    std::vector<std::pair<std::string, uint32_t>> drops;
+    bus.getDropsByTopic(drops);
+
+    lua_newtable(L);
+    lua_pushinteger(L, bus.getPendingCount());
+    lua_setfield(L, -2, "pending");
+    lua_pushinteger(L, MessageBus::MAX_QUEUE_SIZE);
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, st.posted);
+    lua_setfield(L, -2, "posted");
+    lua_pushinteger(L, st.delivered);
+    lua_setfield(L, -2, "delivered");
+    lua_pushinteger(L, st.dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, st.highWater);
+    lua_setfield(L, -2, "high_water");
+
+    lua_createtable(L, 0, (int)drops.size());
+    for (const auto& [topic, count] : drops) {
+        lua_pushinteger(L, count);
+        lua_setfield(L, -2, topic.c_str());
+    }
+    lua_setfield(L, -2, "dropped_by_topic");
+    return 1;
+}
+
 // Function table for ez.bus
 static const luaL_Reg bus_funcs[] = {
     {"subscribe",       l_bus_subscribe},
@@ -405,6 +547,7 @@ static const luaL_Reg bus_funcs[] = {
     {"post",            l_bus_post},
     {"has_subscribers", l_bus_has_subscribers},
     {"pending_count",   l_bus_pending_count},
+    {"get_stats",       l_bus_get_stats},
     {nullptr, nullptr}
 };
 
@@ -4,10 +4,10 @@
 #pragma once
 
 #include "../lua_bindings.h"
+#include "../../util/topic_router.h"
 #include <functional>
 #include <string>
 #include <vector>
-#include <deque>
 #include <map>
 #include <mutex>
 
@@ -17,7 +17,7 @@ void registerBusModule(lua_State* L);
 // Subscription entry for Lua callbacks
 struct LuaSubscription {
     int callbackRef;      // Reference to Lua callback function
-    std::string topic;    // Topic pattern
+    std::string topic;    // Topic pattern (may contain + / # wildcards)
     bool active;          // Whether subscription is active
 };
 
@@ -32,9 +32,10 @@ struct CppSubscription {
 // Called during message delivery with lua_State, should push one table onto stack
 using TableBuilder = std::function<void(lua_State*)>;
 
-// Queued message for deferred delivery
+// Queued message for deferred delivery. Lives in MessageBus's fixed ring;
+// slots are reused, so string capacity is recycled rather than reallocated.
 struct QueuedMessage {
-    std::string topic;
+    TopicRouter::TopicId topicId = TopicRouter::INVALID_TOPIC;
     // For string data (legacy/simple events)
     std::string stringData;
     // For table data from C++ (builder creates table at delivery time)
@@ -45,15 +46,25 @@ struct QueuedMessage {
     enum class DataType { String, Table, TableBuilder } dataType = DataType::String;
 };
 
+// Delivery counters, reported by ez.bus.get_stats()
+struct BusStats {
+    uint32_t posted;      // Messages accepted into the queue
+    uint32_t delivered;   // Messages dispatched by process()
+    uint32_t dropped;     // Messages rejected because the queue was full
+    uint32_t highWater;   // Deepest the queue has been
+};
+
 // Global message bus singleton
 // Enables pub/sub communication between C++ and Lua code
 class MessageBus {
 public:
+    static constexpr size_t MAX_QUEUE_SIZE = 64;
+
     // Get singleton instance
     static MessageBus& instance();
 
-    // Subscribe a Lua callback to a topic
-    // Returns subscription ID (used for unsubscribe)
+    // Subscribe a Lua callback to a topic pattern (+ and # wildcards allowed)
+    // Returns subscription ID (used for unsubscribe), or 0 if the pattern is invalid
     // Callback signature: function(topic, data) where data is string or table
     int subscribe(lua_State* L, const char* topic, int callbackRef);
 
@@ -61,21 +72,25 @@ public:
     // Returns true if subscription was found and removed
     bool unsubscribe(int subscriptionId);
 
+    // Post functions return false when the message was dropped because the
+    // queue is full (back-pressure) or the topic table is exhausted.
+
     // Post a string message to a topic (legacy, for simple events)
-    void post(const char* topic, const char* data);
+    bool post(const char* topic, const char* data);
 
     // Post a table message from C++ using a builder function
     // The builder is called during process() to create the Lua table
-    void postTable(const char* topic, TableBuilder builder);
+    bool postTable(const char* topic, TableBuilder builder);
 
-    // Post a table message from Lua (stores registry reference)
-    void postLuaTable(lua_State* L, const char* topic, int tableRef);
+    // Post a table message from Lua (stores registry reference; released
+    // here if the message is dropped)
+    bool postLuaTable(lua_State* L, const char* topic, int tableRef);
 
     // Process pending messages (call from main loop)
     // Delivers all queued messages to subscribers
     void process(lua_State* L);
 
-    // Subscribe a C++ callback to a topic
+    // Subscribe a C++ callback to a topic pattern (+ and # wildcards allowed)
     // Callback receives lua_State with data on stack (string or table at index -1)
     int subscribeCpp(const char* topic, std::function<void(lua_State*, const std::string&)> callback);
 
@@ -85,6 +100,10 @@ public:
     // Get number of pending messages in queue
     size_t getPendingCount() const;
 
+    // Delivery counters and per-topic drop counts (topic, drops)
+    BusStats getStats() const;
+    void getDropsByTopic(std::vector<std::pair<std::string, uint32_t>>& out) const;
+
     // Clear all subscriptions (useful for cleanup/reset)
     void clearAll(lua_State* L);
 
@@ -94,20 +113,33 @@ private:
     MessageBus(const MessageBus&) = delete;
     MessageBus& operator=(const MessageBus&) = delete;
 
-    // Check if topic matches pattern (supports wildcards in future)
-    bool topicMatches(const std::string& pattern, const std::string& topic) const;
+    // Reserve the next ring slot for `topic`, or nullptr (and count the
+    // drop) if the queue is full. Caller holds _mutex.
+    QueuedMessage* reserveSlot(const char* topic);
+
+    // Release callback refs of unsubscribed Lua subscriptions. Done at the
+    // start of process() so an unsubscribe from inside a callback can't
+    // free a ref that is about to be called.
+    void sweepInactive(lua_State* L);
 
     // Push message data onto Lua stack (string or table)
     void pushMessageData(lua_State* L, QueuedMessage& msg);
 
-    // Subscription storage
+    // Subscription storage; the router maps topics to subscription IDs
     std::map<int, LuaSubscription> _luaSubscriptions;
     std::map<int, CppSubscription> _cppSubscriptions;
+    mutable TopicRouter _router;  // match() caches per topic
     int _nextSubscriptionId = 1;
+    bool _needsSweep = false;
 
-    // Message queue for deferred delivery
-    std::deque<QueuedMessage> _messageQueue;
-    static constexpr size_t MAX_QUEUE_SIZE = 64;
+    // Fixed ring of message slots for deferred delivery
+    QueuedMessage _queue[MAX_QUEUE_SIZE];
+    size_t _queueHead = 0;
+    size_t _queueCount = 0;
+
+    BusStats _stats = {};
+    std::vector<uint32_t> _dropsByTopic;  // Indexed by topic ID
+    uint32_t _lastDropLogMs = 0;
 
     // Thread safety for FreeRTOS
     mutable std::mutex _mutex;
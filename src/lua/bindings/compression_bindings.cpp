@@ -4,6 +4,7 @@
 // general-purpose module so any Lua code can unpack compressed blobs.
 
 #include "../lua_bindings.h"
+#include "buffer_bindings.h"
 #include <Arduino.h>
 
 // ROM miniz header. MINIZ_NO_ZLIB_APIS is set in the ROM build, so only the
@@ -16,30 +17,37 @@
 #define TINFL_FLAG_PARSE_ZLIB_HEADER 1
 #endif
 
-// ez.compression.inflate(data, out_size [, raw]) -> string | nil, error
+// ez.compression.inflate(data, out_size [, raw [, out_buf]]) -> string | buffer, decoded | nil, error
 // @brief Decompress zlib- or raw-deflate-encoded bytes.
 // @description
 //   Out-size must be the exact uncompressed length (no growth allowed). For
 //   map tiles this is always 24576 bytes (256*256*3/8). The third argument
 //   defaults to false, meaning the input carries a zlib wrapper (RFC 1950);
 //   pass true for raw DEFLATE streams (RFC 1951).
+//   With an ez.buffer as out_buf, decompresses straight into it and returns
+//   the buffer plus the decoded byte count instead of allocating a string.
+//   An owner buffer is resized to the decoded length; a view must hold
+//   out_size bytes. out_buf must not share memory with data.
 //   On failure returns nil plus an error string.
-// @param data Binary string: compressed input.
+// @param data Binary string or buffer: compressed input.
 // @param out_size Expected decompressed size in bytes.
 // @param raw Optional boolean; true = raw deflate, false/nil = zlib.
-// @return Decompressed binary string, or nil plus an error string.
+// @param out_buf Optional buffer to decompress into.
+// @return Decompressed binary string (or out_buf, decoded), or nil plus an error string.
 // @example
 //   local raw = ez.compression.inflate(compressed, 24576)
 //   if not raw then error("decompress failed: " .. tostring(err)) end
+//   local tile = ez.buffer.new(0)
+//   ez.compression.inflate(compressed, 24576, false, tile)
 // @end
 LUA_FUNCTION(l_compression_inflate) {
     int argc = lua_gettop(L);
     if (argc < 2) {
-        return luaL_error(L, "inflate(data, out_size [, raw]) requires at least 2 arguments");
+        return luaL_error(L, "inflate(data, out_size [, raw [, out_buf]]) requires at least 2 arguments");
     }
 
     size_t inLen = 0;
-    const char* inData = luaL_checklstring(L, 1, &inLen);
+    const char* inData = (const char*)buffer_bindings::checkBytes(L, 1, &inLen);
     lua_Integer outSize = luaL_checkinteger(L, 2);
     bool raw = (argc >= 3) && lua_toboolean(L, 3);
 
@@ -49,6 +57,33 @@ LUA_FUNCTION(l_compression_inflate) {
         return 2;
     }
 
+    if (argc >= 4 && !lua_isnil(L, 4)) {
+        buffer_bindings::LuaBuffer* out = buffer_bindings::toBuffer(L, 4);
+        if (!out) return luaL_argerror(L, 4, "buffer expected");
+        buffer_bindings::LuaBuffer* in = buffer_bindings::toBuffer(L, 1);
+        if (in && in->store == out->store) {
+            return luaL_argerror(L, 4, "output buffer shares memory with the input");
+        }
+        uint8_t* dst = buffer_bindings::prepareOutput(out, (size_t)outSize);
+        if (dst == nullptr) {
+            lua_pushnil(L);
+            lua_pushstring(L, out->view ? "view too small" : "out-of-memory");
+            return 2;
+        }
+        int flags = raw ? 0 : TINFL_FLAG_PARSE_ZLIB_HEADER;
+        size_t decoded = tinfl_decompress_mem_to_mem(dst, (size_t)outSize, inData, inLen, flags);
+        if (decoded == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED) {
+            lua_pushnil(L);
+            lua_pushstring(L, "inflate failed");
+            return 2;
+        }
+        // Trim an owner to what was actually produced; never reallocates
+        if (!out->view) buffer_bindings::prepareOutput(out, decoded);
+        lua_pushvalue(L, 4);
+        lua_pushinteger(L, (lua_Integer)decoded);
+        return 2;
+    }
+
     // Prefer PSRAM for the output buffer — tile payloads are large (24 KB)
     // and called many times per frame, so we don't want them on the small
     // DRAM heap. Fall back to regular malloc on non-PSRAM parts.
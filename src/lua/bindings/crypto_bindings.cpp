@@ -2,6 +2,7 @@
 // Provides cryptographic primitives for Lua
 
 #include "../lua_bindings.h"
+#include "buffer_bindings.h"
 #include <Arduino.h>
 #include <esp_random.h>
 
@@ -40,7 +41,7 @@ LUA_FUNCTION(l_crypto_sha256) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     uint8_t hash[32];
     mbedtls_sha256_context ctx;
@@ -70,7 +71,7 @@ LUA_FUNCTION(l_crypto_sha512) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     uint8_t hash[64];
     mbedtls_sha512_context ctx;
@@ -106,7 +107,7 @@ LUA_FUNCTION(l_crypto_hmac_sha256) {
 
     size_t keyLen, dataLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
     uint8_t mac[32];
     mbedtls_md_context_t ctx;
@@ -176,7 +177,7 @@ LUA_FUNCTION(l_crypto_aes128_ecb_encrypt) {
 
     size_t keyLen, plaintextLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* plaintext = luaL_checklstring(L, 2, &plaintextLen);
+    const char* plaintext = (const char*)buffer_bindings::checkBytes(L, 2, &plaintextLen);
 
     if (keyLen != 16) {
         lua_pushnil(L);
@@ -247,7 +248,7 @@ LUA_FUNCTION(l_crypto_aes128_ecb_decrypt) {
 
     size_t keyLen, ciphertextLen;
     const char* key = luaL_checklstring(L, 1, &keyLen);
-    const char* ciphertext = luaL_checklstring(L, 2, &ciphertextLen);
+    const char* ciphertext = (const char*)buffer_bindings::checkBytes(L, 2, &ciphertextLen);
 
     if (keyLen != 16) {
         lua_pushnil(L);
@@ -431,7 +432,7 @@ LUA_FUNCTION(l_crypto_bytes_to_hex) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     char* hex = new char[dataLen * 2 + 1];
     for (size_t i = 0; i < dataLen; i++) {
@@ -511,7 +512,7 @@ LUA_FUNCTION(l_crypto_base64_encode) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     // Calculate output size (4 bytes per 3 input bytes, rounded up)
     size_t outLen = ((dataLen + 2) / 3) * 4 + 1;
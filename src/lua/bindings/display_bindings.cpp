@@ -3,6 +3,10 @@
 
 #include "../lua_bindings.h"
 #include "../../hardware/display.h"
+#include "../frame_stats.h"
+#include "buffer_bindings.h"
+#include "../../util/heap_tags.h"
+#include <esp_heap_caps.h>
 
 // @module ez.display
 // @brief 2D drawing primitives and text rendering for the 320x240 LCD
@@ -87,6 +91,7 @@ LUA_FUNCTION(l_display_clear) {
 // @end
 LUA_FUNCTION(l_display_flush) {
     if (display) {
+        FramePhaseScope phase(FramePhase::FLUSH);
         display->flush();
     }
     return 0;
@@ -1033,7 +1038,7 @@ LUA_FUNCTION(l_display_draw_bitmap) {
     int height = luaL_checkinteger(L, 4);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 5, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 5, &dataLen);
 
     size_t expectedLen = width * height * 2;  // 2 bytes per pixel for RGB565
     if (dataLen < expectedLen) {
@@ -1071,7 +1076,7 @@ LUA_FUNCTION(l_display_draw_bitmap_transparent) {
     int height = luaL_checkinteger(L, 4);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 5, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 5, &dataLen);
     uint16_t transparentColor = luaL_checkinteger(L, 6);
 
     size_t expectedLen = width * height * 2;
@@ -1112,7 +1117,7 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap) {
     int height = luaL_checkinteger(L, 4);
 
     size_t dataLen;
-    const uint8_t* data = (const uint8_t*)luaL_checklstring(L, 5, &dataLen);
+    const uint8_t* data = buffer_bindings::checkBytes(L, 5, &dataLen);
 
     // Get palette table (8 RGB565 colors).
     // The TFT panel expects big-endian RGB565 on the SPI wire. fillRect swaps
@@ -1160,7 +1165,8 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap) {
     // This is the common case for map tiles
     if (startX == 0 && startY == 0 && endX == width && endY == height && width == 256 && height == 256) {
         // Allocate full tile buffer in PSRAM (256*256*2 = 128KB)
-        uint16_t* tileBuffer = (uint16_t*)ps_malloc(256 * 256 * sizeof(uint16_t));
+        uint16_t* tileBuffer = (uint16_t*)heapTagCapsMalloc(HeapTag::DISPLAY, 256 * 256 * sizeof(uint16_t),
+                                                          MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
         if (tileBuffer) {
             // Optimized decode: process 8 pixels at a time from each 3-byte group
             // This eliminates per-pixel switch and byte fetch overhead
@@ -1186,14 +1192,14 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap) {
 
             // Push entire tile at once (single DMA transfer)
             display->drawBitmap(x, y, 256, 256, tileBuffer);
-            free(tileBuffer);
+            heapTagFree(HeapTag::DISPLAY, tileBuffer);
             return 0;
         }
         // Fall through to row-by-row if PSRAM allocation fails
     }
 
     // SLOW PATH: Partial tile or non-standard size - process row by row
-    uint16_t* lineBuffer = (uint16_t*)malloc(visibleWidth * sizeof(uint16_t));
+    uint16_t* lineBuffer = (uint16_t*)heapTagMalloc(HeapTag::DISPLAY, visibleWidth * sizeof(uint16_t));
     if (!lineBuffer) {
         return 0;  // Can't allocate, skip this tile
     }
@@ -1228,7 +1234,7 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap) {
         display->drawBitmap(x + startX, y + row, visibleWidth, 1, lineBuffer);
     }
 
-    free(lineBuffer);
+    heapTagFree(HeapTag::DISPLAY, lineBuffer);
     return 0;
 }
 
@@ -1245,8 +1251,10 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap) {
 // @param src_w Source width to sample
 // @param src_h Source height to sample
 // @details
-// Used for map tile fallback rendering: shows a scaled-up portion of a parent tile
-// while the higher-resolution child tile is loading from SD card.
+// Nearest-neighbour scaling in either direction. Used by the map view for
+// parent-tile fallbacks (upscale), child-tile fallbacks (downscale) and
+// fractional zoom, where every visible tile goes through this path for
+// the duration of a zoom animation.
 // @end
 LUA_FUNCTION(l_display_draw_indexed_bitmap_scaled) {
     LUA_CHECK_ARGC(L, 10);
@@ -1256,7 +1264,7 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap_scaled) {
     int dest_h = luaL_checkinteger(L, 4);
 
     size_t dataLen;
-    const uint8_t* data = (const uint8_t*)luaL_checklstring(L, 5, &dataLen);
+    const uint8_t* data = buffer_bindings::checkBytes(L, 5, &dataLen);
 
     // Get palette table. Pre-swap to BE RGB565 — see the comment in
     // l_display_draw_indexed_bitmap for the byte-order rationale.
@@ -1293,65 +1301,78 @@ LUA_FUNCTION(l_display_draw_indexed_bitmap_scaled) {
         return 0;
     }
 
-    // Allocate line buffer
+    // One allocation holds the output line, the column lookup table and a
+    // fully decoded source row. The old per-pixel path re-unpacked the
+    // 3-byte group (with a switch) for every destination pixel, which made
+    // a 2x upscale decode each source pixel four times.
     int visibleWidth = endX - startX;
-    uint16_t* lineBuffer = (uint16_t*)malloc(visibleWidth * sizeof(uint16_t));
-    if (!lineBuffer) {
+    size_t scratchBytes = visibleWidth * sizeof(uint16_t)      // lineBuffer
+                        + visibleWidth * sizeof(int16_t)       // colMap
+                        + SRC_SIZE * sizeof(uint16_t);         // srcRow
+    uint8_t* scratch = (uint8_t*)heapTagMalloc(HeapTag::DISPLAY, scratchBytes);
+    if (!scratch) {
         return 0;
     }
+    uint16_t* lineBuffer = (uint16_t*)scratch;
+    int16_t* colMap = (int16_t*)(lineBuffer + visibleWidth);
+    uint16_t* srcRow = (uint16_t*)(colMap + visibleWidth);
 
-    // Scale factors (fixed point, 8.8 format)
-    int scaleX = (src_w << 8) / dest_w;
-    int scaleY = (src_h << 8) / dest_h;
-
-    // Helper lambda to get pixel at source coordinates
-    auto getPixel = [&](int px, int py) -> uint16_t {
-        if (px < 0 || px >= SRC_SIZE || py < 0 || py >= SRC_SIZE) {
-            return palette[0];  // Default to first palette color
-        }
-        int pixelIndex = py * SRC_SIZE + px;
-        int groupIndex = pixelIndex / 8;
-        int pixelInGroup = pixelIndex % 8;
-        int byteOffset = groupIndex * 3;
+    // Scale factors in 16.16 fixed point. 8.8 (the previous format) lost
+    // enough precision on fractional zoom ratios like 256/181 that the
+    // right-hand column of a tile sampled its neighbour's seam.
+    int32_t scaleX = (int32_t)(((int64_t)src_w << 16) / dest_w);
+    int32_t scaleY = (int32_t)(((int64_t)src_h << 16) / dest_h);
 
-        if (byteOffset + 2 >= (int)dataLen) {
-            return palette[0];
-        }
+    // Column map: destination column -> source column, or -1 when the
+    // sample falls outside the 256x256 source.
+    for (int dx = startX; dx < endX; dx++) {
+        int srcX = src_x + (int)(((int64_t)(dx - x) * scaleX) >> 16);
+        colMap[dx - startX] = (srcX >= 0 && srcX < SRC_SIZE) ? (int16_t)srcX : -1;
+    }
 
-        uint8_t b0 = data[byteOffset];
-        uint8_t b1 = data[byteOffset + 1];
-        uint8_t b2 = data[byteOffset + 2];
-
-        uint8_t paletteIndex;
-        switch (pixelInGroup) {
-            case 0: paletteIndex = b0 & 0x07; break;
-            case 1: paletteIndex = (b0 >> 3) & 0x07; break;
-            case 2: paletteIndex = ((b0 >> 6) & 0x03) | ((b1 & 0x01) << 2); break;
-            case 3: paletteIndex = (b1 >> 1) & 0x07; break;
-            case 4: paletteIndex = (b1 >> 4) & 0x07; break;
-            case 5: paletteIndex = ((b1 >> 7) & 0x01) | ((b2 & 0x03) << 1); break;
-            case 6: paletteIndex = (b2 >> 2) & 0x07; break;
-            default: paletteIndex = (b2 >> 5) & 0x07; break;
-        }
-        return palette[paletteIndex];
-    };
+    int decodedRow = -2;   // Source row currently unpacked in srcRow
+    int emittedRow = -2;   // Source row currently expanded in lineBuffer
 
-    // Render each row
     for (int dy = startY; dy < endY; dy++) {
-        int bufIdx = 0;
-        // Map destination Y to source Y
-        int srcY = src_y + (((dy - y) * scaleY) >> 8);
+        int srcY = src_y + (int)(((int64_t)(dy - y) * scaleY) >> 16);
+        if (srcY < 0 || srcY >= SRC_SIZE) srcY = -1;
 
-        for (int dx = startX; dx < endX; dx++) {
-            // Map destination X to source X
-            int srcX = src_x + (((dx - x) * scaleX) >> 8);
-            lineBuffer[bufIdx++] = getPixel(srcX, srcY);
+        // Upscaling repeats source rows; the expanded line is still valid.
+        if (srcY != emittedRow) {
+            if (srcY < 0 || (size_t)(srcY + 1) * SRC_SIZE * 3 / 8 > dataLen) {
+                for (int i = 0; i < visibleWidth; i++) lineBuffer[i] = palette[0];
+            } else {
+                if (srcY != decodedRow) {
+                    // Unpack the whole source row once: 32 groups of 8 pixels.
+                    const uint8_t* inPtr = data + (size_t)srcY * SRC_SIZE * 3 / 8;
+                    uint16_t* outPtr = srcRow;
+                    for (int g = 0; g < SRC_SIZE / 8; g++) {
+                        uint8_t b0 = *inPtr++;
+                        uint8_t b1 = *inPtr++;
+                        uint8_t b2 = *inPtr++;
+                        *outPtr++ = palette[b0 & 0x07];
+                        *outPtr++ = palette[(b0 >> 3) & 0x07];
+                        *outPtr++ = palette[((b0 >> 6) & 0x03) | ((b1 & 0x01) << 2)];
+                        *outPtr++ = palette[(b1 >> 1) & 0x07];
+                        *outPtr++ = palette[(b1 >> 4) & 0x07];
+                        *outPtr++ = palette[((b1 >> 7) & 0x01) | ((b2 & 0x03) << 1)];
+                        *outPtr++ = palette[(b2 >> 2) & 0x07];
+                        *outPtr++ = palette[(b2 >> 5) & 0x07];
+                    }
+                    decodedRow = srcY;
+                }
+                for (int i = 0; i < visibleWidth; i++) {
+                    int sx = colMap[i];
+                    lineBuffer[i] = (sx >= 0) ? srcRow[sx] : palette[0];
+                }
+            }
+            emittedRow = srcY;
         }
 
         display->drawBitmap(startX, dy, visibleWidth, 1, lineBuffer);
     }
 
-    free(lineBuffer);
+    heapTagFree(HeapTag::DISPLAY, scratch);
     return 0;
 }
 
@@ -1397,7 +1418,7 @@ LUA_FUNCTION(l_display_draw_bitmap_1bit) {
     int height = luaL_checkinteger(L, 4);
 
     size_t dataLen;
-    const uint8_t* data = (const uint8_t*)luaL_checklstring(L, 5, &dataLen);
+    const uint8_t* data = buffer_bindings::checkBytes(L, 5, &dataLen);
     int scale = luaL_optinteger(L, 6, 1);
     uint16_t color = luaL_optintegerdefault(L, 7, Colors::WHITE);
 
@@ -1746,7 +1767,7 @@ LUA_FUNCTION(l_sprite_draw_jpeg) {
     int x = luaL_checkinteger(L, 2);
     int y = luaL_checkinteger(L, 3);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 4, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 4, &dataLen);
     float scale_x = (float)luaL_optnumber(L, 5, 1.0);
     float scale_y = (float)luaL_optnumber(L, 6, 0.0);
     int off_x = (int)luaL_optinteger(L, 7, 0);
@@ -1768,7 +1789,7 @@ LUA_FUNCTION(l_sprite_draw_png) {
     int x = luaL_checkinteger(L, 2);
     int y = luaL_checkinteger(L, 3);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 4, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 4, &dataLen);
     float scale_x = (float)luaL_optnumber(L, 5, 1.0);
     float scale_y = (float)luaL_optnumber(L, 6, 0.0);
     int off_x = (int)luaL_optinteger(L, 7, 0);
@@ -1814,7 +1835,7 @@ LUA_FUNCTION(l_sprite_set_raw) {
     Sprite* sprite = checkSprite(L, 1);
     if (!sprite) return 0;
     size_t inLen;
-    const char* in = luaL_checklstring(L, 2, &inLen);
+    const char* in = (const char*)buffer_bindings::checkBytes(L, 2, &inLen);
     size_t expected = sprite->rawBufferSize();
     if (expected == 0) return 0;
     if (inLen < expected) {
@@ -1925,7 +1946,7 @@ LUA_FUNCTION(l_display_draw_jpeg) {
     int x = luaL_checkinteger(L, 1);
     int y = luaL_checkinteger(L, 2);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 3, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 3, &dataLen);
     float scale_x = (float)luaL_optnumber(L, 4, 1.0);
     float scale_y = (float)luaL_optnumber(L, 5, 0.0);
     int off_x = (int)luaL_optinteger(L, 6, 0);
@@ -1949,7 +1970,7 @@ LUA_FUNCTION(l_display_draw_png) {
     int x = luaL_checkinteger(L, 1);
     int y = luaL_checkinteger(L, 2);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 3, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 3, &dataLen);
     float scale_x = (float)luaL_optnumber(L, 4, 1.0);
     float scale_y = (float)luaL_optnumber(L, 5, 0.0);
     int off_x = (int)luaL_optinteger(L, 6, 0);
@@ -1974,7 +1995,7 @@ LUA_FUNCTION(l_display_draw_png) {
 LUA_FUNCTION(l_display_get_image_size) {
     LUA_CHECK_ARGC(L, 1);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
     const uint8_t* p = (const uint8_t*)data;
 
     // PNG: 8-byte signature [89 50 4E 47 0D 0A 1A 0A] then IHDR chunk
@@ -2706,11 +2727,11 @@ static uint8_t* z_buffer = nullptr;
 
 static inline bool zbuf_ensure() {
     if (z_buffer) return true;
-    z_buffer = (uint8_t*)heap_caps_malloc(
+    z_buffer = (uint8_t*)heapTagCapsMalloc(HeapTag::DISPLAY,
         (size_t)ZBUF_W * ZBUF_H,
         MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     if (!z_buffer) {
-        z_buffer = (uint8_t*)malloc((size_t)ZBUF_W * ZBUF_H);
+        z_buffer = (uint8_t*)heapTagMalloc(HeapTag::DISPLAY, (size_t)ZBUF_W * ZBUF_H);
     }
     return z_buffer != nullptr;
 }
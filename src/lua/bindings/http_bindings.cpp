@@ -10,8 +10,11 @@
  */
 
 #include "http_bindings.h"
+#include "buffer_bindings.h"
+#include "../../util/heap_tags.h"
 #include "../../util/log.h"
 #include "../async.h"
+#include "../scheduler.h"
 #include <Arduino.h>
 #include <WiFi.h>
 #include <HTTPClient.h>
@@ -51,14 +54,14 @@ struct HttpRequest {
     size_t headerCount;
     char* body;
     size_t bodyLen;
-    int coroRef;
+    uint32_t token;     // Scheduler wait token of the fetching coroutine
     int timeout;  // milliseconds
     bool followRedirects;
 };
 
 // Response structure
 struct HttpResponse {
-    int coroRef;
+    uint32_t token;
     int statusCode;
     char* body;
     size_t bodyLen;
@@ -164,7 +167,7 @@ static bool readLine(WiFiClient* client, String& out, uint32_t deadline_ms) {
         } else {
             if (millis() > deadline_ms) return false;
             if (!client->connected() && !client->available()) return false;
-            delay(2);
+            if (!AsyncIO::waitSlice(2)) return false;  // Cancelled
         }
     }
 }
@@ -180,7 +183,7 @@ static int readBytes(WiFiClient* client, char* buf, int wanted, uint32_t deadlin
         } else {
             if (millis() > deadline_ms) return got;
             if (!client->connected() && !client->available()) return got;
-            delay(2);
+            if (!AsyncIO::waitSlice(2)) return got;  // Cancelled
         }
     }
     return got;
@@ -212,7 +215,7 @@ static const char* methodName(Method m) {
 // If sending fails (queue full), the producer frees -- there's never a
 // case where the receiver doesn't take ownership of a successfully
 // dequeued pointer.
-static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
+static void processHttpRequest(void* requestPtr, uint32_t /*token*/) {
     HttpRequest* preq = (HttpRequest*)requestPtr;
     if (!preq) return;
     HttpRequest& req = *preq;
@@ -220,25 +223,32 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
         // Response also lives in PSRAM -- same reasoning as the request
         // alloc in l_fetch. The body is allocated separately (also PSRAM
         // when possible) and is what dominates the response footprint.
-        HttpResponse* presp = (HttpResponse*)heap_caps_calloc(
-            1, sizeof(HttpResponse), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-        if (!presp) presp = (HttpResponse*)calloc(1, sizeof(HttpResponse));
+        HttpResponse* presp = (HttpResponse*)heapTagPsCalloc(HeapTag::HTTP, 1, sizeof(HttpResponse));
         if (!presp) {
             // Without a response slot we can't even report the failure;
             // best we can do is drop the request.
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
         HttpResponse& resp = *presp;
-        resp.coroRef = req.coroRef;
+        resp.token = req.token;
         resp.success = false;
 
+        if (AsyncIO::cancelRequested()) {
+            // Nobody will read the response; skip the network entirely.
+            resp.errorMsg = strdup("cancelled");
+            xQueueSend(responseQueue, &presp, portMAX_DELAY);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
+            return;
+        }
+
         if (WiFi.status() != WL_CONNECTED) {
             resp.errorMsg = strdup("WiFi not connected");
             xQueueSend(responseQueue, &presp, portMAX_DELAY);
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
 
@@ -249,8 +259,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
         if (!parseUrl(req.url, isHttps, host, sizeof(host), port, path, sizeof(path))) {
             resp.errorMsg = strdup("bad URL");
             xQueueSend(responseQueue, &presp, portMAX_DELAY);
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
 
@@ -274,8 +284,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
             resp.errorMsg = strdup("connect failed");
             delete client;
             xQueueSend(responseQueue, &presp, portMAX_DELAY);
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
 
@@ -325,8 +335,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
             client->stop();
             delete client;
             xQueueSend(responseQueue, &presp, portMAX_DELAY);
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
         // Format: "HTTP/1.1 200 OK"
@@ -335,8 +345,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
             resp.errorMsg = strdup("malformed status");
             client->stop(); delete client;
             xQueueSend(responseQueue, &presp, portMAX_DELAY);
-            if (req.body) free(req.body);
-            free(preq);
+            if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+            heapTagFree(HeapTag::HTTP, preq);
             return;
         }
         resp.statusCode = atoi(statusLine.c_str() + sp1 + 1);
@@ -351,8 +361,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
                 resp.errorMsg = strdup("header read timeout");
                 client->stop(); delete client;
                 xQueueSend(responseQueue, &presp, portMAX_DELAY);
-                if (req.body) free(req.body);
-                free(preq);
+                if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+                heapTagFree(HeapTag::HTTP, preq);
                 return;
             }
             if (line.length() == 0) break;  // end of headers
@@ -386,8 +396,7 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
             if (chunked) {
                 // Chunked transfer: <hex-size>\r\n<bytes>\r\n... then 0\r\n\r\n
                 size_t cap = 4096;
-                body = (char*)ps_malloc(cap);
-                if (!body) body = (char*)malloc(cap);
+                body = (char*)heapTagPsMalloc(HeapTag::HTTP, cap);
                 while (body) {
                     String sizeLine;
                     if (!readLine(client, sizeLine, deadline)) break;
@@ -396,11 +405,10 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
                     if (bodyLen + chunkSize > MAX_RESPONSE_LEN) break;
                     if (bodyLen + chunkSize + 1 > cap) {
                         size_t newCap = bodyLen + chunkSize + 1;
-                        char* nb = (char*)ps_malloc(newCap);
-                        if (!nb) nb = (char*)malloc(newCap);
+                        char* nb = (char*)heapTagPsMalloc(HeapTag::HTTP, newCap);
                         if (!nb) break;
                         memcpy(nb, body, bodyLen);
-                        free(body);
+                        heapTagFree(HeapTag::HTTP, body);
                         body = nb;
                         cap = newCap;
                     }
@@ -413,8 +421,7 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
             } else if (contentLength > 0) {
                 size_t want = (contentLength <= (long)MAX_RESPONSE_LEN)
                               ? (size_t)contentLength : MAX_RESPONSE_LEN;
-                body = (char*)ps_malloc(want + 1);
-                if (!body) body = (char*)malloc(want + 1);
+                body = (char*)heapTagPsMalloc(HeapTag::HTTP, want + 1);
                 if (body) {
                     int got = readBytes(client, body, want, deadline);
                     bodyLen = got > 0 ? (size_t)got : 0;
@@ -423,21 +430,22 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
                 // No length header -- read until close. Grow the buffer
                 // as we go, capped at MAX_RESPONSE_LEN.
                 size_t cap = 4096;
-                body = (char*)ps_malloc(cap);
-                if (!body) body = (char*)malloc(cap);
+                body = (char*)heapTagPsMalloc(HeapTag::HTTP, cap);
                 while (body && bodyLen < MAX_RESPONSE_LEN) {
                     if (!client->connected() && !client->available()) break;
                     if (millis() > deadline) break;
                     int avail = client->available();
-                    if (avail <= 0) { delay(5); continue; }
+                    if (avail <= 0) {
+                        if (!AsyncIO::waitSlice(5)) break;  // Cancelled
+                        continue;
+                    }
                     if (bodyLen + 1 > cap) {
                         size_t newCap = cap * 2;
                         if (newCap > MAX_RESPONSE_LEN + 1) newCap = MAX_RESPONSE_LEN + 1;
-                        char* nb = (char*)ps_malloc(newCap);
-                        if (!nb) nb = (char*)malloc(newCap);
+                        char* nb = (char*)heapTagPsMalloc(HeapTag::HTTP, newCap);
                         if (!nb) break;
                         memcpy(nb, body, bodyLen);
-                        free(body);
+                        heapTagFree(HeapTag::HTTP, body);
                         body = nb;
                         cap = newCap;
                     }
@@ -457,8 +465,8 @@ static void processHttpRequest(void* requestPtr, int /*coroRef*/) {
 
     client->stop();
     delete client;
-    if (req.body) free(req.body);
-    free(preq);
+    if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+    heapTagFree(HeapTag::HTTP, preq);
     xQueueSend(responseQueue, &presp, portMAX_DELAY);
 }
 
@@ -502,7 +510,7 @@ static bool initModule() {
  * @param options table|nil Optional settings:
  *   - method: string HTTP method (default "GET")
  *   - headers: table Custom headers {["Header-Name"] = "value"}
- *   - body: string Request body for POST/PUT/PATCH
+ *   - body: string|buffer Request body for POST/PUT/PATCH
  *   - timeout: integer Request timeout in ms (default 10000)
  *   - follow_redirects: boolean Follow redirects (default true)
  *
@@ -541,6 +549,9 @@ static int l_fetch(lua_State* L) {
         lua_pushstring(L, "URL too long");
         return 2;
     }
+    if (!lua_isyieldable(L)) {
+        return luaL_error(L, "ez.http.fetch must be called from a coroutine (use spawn)");
+    }
 
     // Heap-alloc the request in PSRAM. It's ~8.7 KiB -- larger than
     // free internal DRAM in the typical post-boot state -- and
@@ -548,9 +559,7 @@ static int l_fetch(lua_State* L) {
     // stack alloc. PSRAM is fine here because the worker only reads
     // these fields once at the start of the request; nothing in the
     // hot path touches them.
-    HttpRequest* preq = (HttpRequest*)heap_caps_calloc(
-        1, sizeof(HttpRequest), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (!preq) preq = (HttpRequest*)calloc(1, sizeof(HttpRequest));
+    HttpRequest* preq = (HttpRequest*)heapTagPsCalloc(HeapTag::HTTP, 1, sizeof(HttpRequest));
     if (!preq) {
         lua_pushnil(L);
         lua_pushstring(L, "out of memory");
@@ -612,11 +621,15 @@ static int l_fetch(lua_State* L) {
 
         // Body
         lua_getfield(L, 2, "body");
-        if (lua_isstring(L, -1)) {
+        if (!lua_isnil(L, -1)) {
             size_t bodyLen;
-            const char* body = lua_tolstring(L, -1, &bodyLen);
+            const char* body = (const char*)buffer_bindings::toBytes(L, -1, &bodyLen);
+            if (!body) {
+                heapTagFree(HeapTag::HTTP, preq);
+                return luaL_argerror(L, 2, "body must be a string or ez.buffer");
+            }
             if (bodyLen > 0 && bodyLen <= MAX_BODY_LEN) {
-                req.body = (char*)malloc(bodyLen);
+                req.body = (char*)heapTagMalloc(HeapTag::HTTP, bodyLen);
                 if (req.body) {
                     memcpy(req.body, body, bodyLen);
                     req.bodyLen = bodyLen;
@@ -626,16 +639,15 @@ static int l_fetch(lua_State* L) {
         lua_pop(L, 1);
     }
 
-    // Store coroutine reference
-    lua_pushthread(L);
-    req.coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    // Park the coroutine until the response arrives
+    req.token = Scheduler::instance().park(L);
 
     // Hand off to the AsyncIO worker. processHttpRequest takes
     // ownership of preq from this point on.
-    if (!AsyncIO::instance().queueHttpRequest(preq, req.coroRef)) {
-        luaL_unref(L, LUA_REGISTRYINDEX, req.coroRef);
-        if (req.body) free(req.body);
-        free(preq);
+    if (!AsyncIO::instance().queueHttpRequest(L, preq, req.token)) {
+        Scheduler::instance().unpark(req.token);
+        if (req.body) heapTagFree(HeapTag::HTTP, req.body);
+        heapTagFree(HeapTag::HTTP, preq);
         lua_pushnil(L);
         lua_pushstring(L, "Request queue full");
         return 2;
@@ -675,7 +687,7 @@ static int l_get(lua_State* L) {
  * Must be called from a coroutine.
  *
  * @param url string URL to request
- * @param body string Request body
+ * @param body string|buffer Request body
  * @param content_type string|nil Content-Type header (default "application/x-www-form-urlencoded")
  * @return table Response (see fetch() for fields)
  *
@@ -688,8 +700,8 @@ static int l_get(lua_State* L) {
  */
 static int l_post(lua_State* L) {
     const char* url = luaL_checkstring(L, 1);
-    size_t bodyLen;
-    const char* body = luaL_optlstring(L, 2, "", &bodyLen);
+    size_t bodyLen = 0;
+    if (!lua_isnoneornil(L, 2)) buffer_bindings::checkBytes(L, 2, &bodyLen);
     const char* contentType = luaL_optstring(L, 3, "application/x-www-form-urlencoded");
 
     // Build options table
@@ -698,7 +710,9 @@ static int l_post(lua_State* L) {
     lua_pushstring(L, "POST");
     lua_setfield(L, -2, "method");
 
-    lua_pushlstring(L, body, bodyLen);
+    // A buffer goes through as is; fetch copies the bytes
+    if (bodyLen > 0) lua_pushvalue(L, 2);
+    else lua_pushliteral(L, "");
     lua_setfield(L, -2, "body");
 
     // Headers subtable
@@ -1106,17 +1120,9 @@ void update(lua_State* L) {
     while (xQueueReceive(responseQueue, &presp, 0) == pdTRUE) {
         if (!presp) continue;
         HttpResponse& resp = *presp;
-        if (resp.coroRef == LUA_NOREF) {
-            if (resp.body) free(resp.body);
-            if (resp.errorMsg) free(resp.errorMsg);
-            free(presp);
-            continue;
-        }
-
-        // Get coroutine
-        lua_rawgeti(L, LUA_REGISTRYINDEX, resp.coroRef);
-        lua_State* co = lua_tothread(L, -1);
-        lua_pop(L, 1);
+        // Cancelled via async_cancel, or the coroutine is gone: drop the
+        // response without resuming anything.
+        lua_State* co = Scheduler::instance().waiter(resp.token);
 
         if (co) {
             // Build response table
@@ -1149,20 +1155,13 @@ void update(lua_State* L) {
                 lua_setfield(co, -2, "error");
             }
 
-            // Resume coroutine with response table
-            int nresults = 0;
-            int status = lua_resume(co, L, 1, &nresults);
-            if (status != LUA_OK && status != LUA_YIELD) {
-                const char* errMsg = lua_tostring(co, -1);
-                LOG("HTTP", "Coroutine error: %s", errMsg ? errMsg : "unknown");
-                lua_pop(co, 1);
-            }
+            // Resumed by the scheduler with the response table
+            Scheduler::instance().wake(resp.token, 1);
         }
 
-        luaL_unref(L, LUA_REGISTRYINDEX, resp.coroRef);
-        if (resp.body) free(resp.body);
+        if (resp.body) heapTagFree(HeapTag::HTTP, resp.body);
         if (resp.errorMsg) free(resp.errorMsg);
-        free(presp);
+        heapTagFree(HeapTag::HTTP, presp);
     }
 }
 
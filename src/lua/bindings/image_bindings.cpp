@@ -17,6 +17,7 @@
 #include "image_bindings.h"
 #include "../lua_bindings.h"
 #include "../../hardware/display.h"
+#include "buffer_bindings.h"
 
 #include <Arduino.h>
 #include <esp_heap_caps.h>
@@ -306,7 +307,7 @@ LUA_FUNCTION(l_sprite_encode_png) {
 // nil if the input isn't a valid JPEG or no SOF marker is found.
 LUA_FUNCTION(l_image_jpeg_size) {
     size_t len;
-    const uint8_t* data = (const uint8_t*)luaL_checklstring(L, 1, &len);
+    const uint8_t* data = buffer_bindings::checkBytes(L, 1, &len);
     if (len < 4 || data[0] != 0xFF || data[1] != 0xD8) {
         lua_pushnil(L);
         return 1;
@@ -348,7 +349,7 @@ LUA_FUNCTION(l_image_jpeg_size) {
 // match the PNG signature.
 LUA_FUNCTION(l_image_png_size) {
     size_t len;
-    const uint8_t* data = (const uint8_t*)luaL_checklstring(L, 1, &len);
+    const uint8_t* data = buffer_bindings::checkBytes(L, 1, &len);
     static const uint8_t SIG[8] =
         { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
     if (len < 24 || memcmp(data, SIG, 8) != 0) {
@@ -2,6 +2,7 @@
 // Provides keyboard input functions
 
 #include "../lua_bindings.h"
+#include "../lua_runtime.h"
 #include "../../hardware/keyboard.h"
 
 // @module ez.keyboard
@@ -126,6 +127,8 @@ LUA_FUNCTION(l_keyboard_read) {
         return 1;
     }
 
+    // Defers frame GC while keys/trackball are arriving
+    LuaRuntime::instance().noteInput();
     pushKeyEvent(L, key);
     return 1;
 }
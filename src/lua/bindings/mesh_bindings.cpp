@@ -6,6 +6,7 @@
 #include "../../mesh/meshcore.h"
 #include "../../mesh/identity.h"
 #include "bus_bindings.h"
+#include "buffer_bindings.h"
 #include <deque>
 
 // @module ez.mesh
@@ -692,7 +693,7 @@ LUA_FUNCTION(l_mesh_send_group_packet) {
 
     lua_Integer channelHash = luaL_checkinteger(L, 1);
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 2, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &dataLen);
 
     if (!mesh) {
         lua_pushboolean(L, false);
@@ -755,7 +756,7 @@ LUA_FUNCTION(l_mesh_schedule_rebroadcast) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     if (mesh) {
         mesh->scheduleRawRebroadcast(reinterpret_cast<const uint8_t*>(data), dataLen);
@@ -840,7 +841,7 @@ LUA_FUNCTION(l_mesh_ed25519_sign) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     if (!mesh) {
         lua_pushnil(L);
@@ -878,7 +879,7 @@ LUA_FUNCTION(l_mesh_ed25519_verify) {
     LUA_CHECK_ARGC(L, 3);
 
     size_t dataLen, sigLen, keyLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
     const char* signature = luaL_checklstring(L, 2, &sigLen);
     const char* pubKey = luaL_checklstring(L, 3, &keyLen);
 
@@ -969,7 +970,7 @@ LUA_FUNCTION(l_mesh_build_packet) {
     lua_Integer routeType = luaL_checkinteger(L, 1);
     lua_Integer payloadType = luaL_checkinteger(L, 2);
     size_t payloadLen;
-    const char* payload = luaL_checklstring(L, 3, &payloadLen);
+    const char* payload = (const char*)buffer_bindings::checkBytes(L, 3, &payloadLen);
 
     size_t pathLen = 0;
     const char* path = nullptr;
@@ -1072,7 +1073,7 @@ LUA_FUNCTION(l_mesh_send_raw) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     if (!mesh) {
         lua_pushboolean(L, false);
@@ -1107,7 +1108,7 @@ LUA_FUNCTION(l_mesh_queue_send) {
     LUA_CHECK_ARGC(L, 1);
 
     size_t dataLen;
-    const char* data = luaL_checklstring(L, 1, &dataLen);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 1, &dataLen);
 
     if (!mesh) {
         lua_pushboolean(L, false);
@@ -0,0 +1,661 @@
+// ez.messages module bindings
+// Persistent DM and channel history on the log-structured message store
+
+#include "../lua_bindings.h"
+#include "../lua_json.h"
+#include "../../util/file_handles.h"
+#include "../../util/msg_search.h"
+#include "../../util/msg_store.h"
+#include "../../util/json_stream.h"
+#include "../../util/heap_tags.h"
+#include "../../util/log.h"
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <SD.h>
+#include <new>
+
+// @module ez.messages
+// @brief Append-only message history store
+// @description
+// Keeps message history for any number of conversations in segment files
+// on SD or LittleFS (see src/util/msg_store.h). Each add, update or
+// delete appends one small record, so a new message costs one short
+// write however long the history is; fetch() pages through it from the
+// newest end. Messages are Lua tables stored as JSON and come back with
+// an id field, which update() and delete() take. Conversation keys are
+// free-form strings up to 80 bytes; the services use "dm:<pubkey hex>"
+// and "ch:<channel>". A record cut short by power loss is skipped on
+// open() and never written over. Dead records left by updates and
+// deletes are reclaimed by compact().
+//
+// The text field of each appended message is also indexed for search()
+// (see src/util/msg_search.h), in an idx/ directory beside the segments.
+// @end
+
+namespace {
+
+constexpr size_t PATH_MAX_LEN = 96;
+constexpr lua_Integer FETCH_DEFAULT = 20;
+constexpr lua_Integer FETCH_MAX = 200;
+
+// Maps /sd/ and /fs/ paths onto the Arduino filesystems
+fs::FS* mapPath(const char* path, const char** adjusted) {
+    if (strncmp(path, "/sd/", 4) == 0) {
+        *adjusted = path + 3;
+        return &SD;
+    }
+    if (strncmp(path, "/fs/", 4) == 0) {
+        *adjusted = path + 3;
+        return &LittleFS;
+    }
+    return nullptr;
+}
+
+// Separate read and append handles: an append-mode File can't seek for
+// reading, and a read handle is reopened after appends so it sees them.
+class FsMsgFile : public MsgStoreFile {
+public:
+    FsMsgFile(fs::FS& fs, const char* path) : _fs(fs) {
+        snprintf(_path, sizeof(_path), "%s", path);
+    }
+    ~FsMsgFile() override {
+        if (_r) _r.close();
+        if (_w) _w.close();
+    }
+
+    bool create() {
+        _w = _fs.open(_path, FILE_WRITE);
+        return (bool)_w;
+    }
+
+    size_t read(uint32_t offset, void* buf, size_t len) override {
+        if (!_r) {
+            _r = _fs.open(_path, FILE_READ);
+            if (!_r) return 0;
+        }
+        if (!_r.seek(offset)) return 0;
+        return _r.read((uint8_t*)buf, len);
+    }
+
+    bool append(const void* buf, size_t len) override {
+        if (_r) _r.close();
+        if (!_w) {
+            _w = _fs.open(_path, FILE_APPEND);
+            if (!_w) return false;
+        }
+        size_t n = _w.write((const uint8_t*)buf, len);
+        _w.flush();
+        return n == len;
+    }
+
+    uint32_t size() override {
+        if (_w) return _w.size();
+        if (!_r) {
+            _r = _fs.open(_path, FILE_READ);
+            if (!_r) return 0;
+        }
+        return _r.size();
+    }
+
+    void release() override {
+        if (_r) _r.close();
+        if (_w) _w.close();
+    }
+
+private:
+    fs::FS& _fs;
+    char _path[PATH_MAX_LEN];
+    File _r;
+    File _w;
+};
+
+class FsStoreIO : public MsgStoreIO {
+public:
+    MsgStoreFile* open(const char* path, bool create) override {
+        const char* adjusted;
+        fs::FS* fs = mapPath(path, &adjusted);
+        if (!fs || strlen(adjusted) >= PATH_MAX_LEN) return nullptr;
+        if (!create && !fs->exists(adjusted)) return nullptr;
+        FsMsgFile* f = new (std::nothrow) FsMsgFile(*fs, adjusted);
+        if (f && create && !f->create()) {
+            delete f;
+            return nullptr;
+        }
+        return f;
+    }
+
+    bool remove(const char* path) override {
+        const char* adjusted;
+        fs::FS* fs = mapPath(path, &adjusted);
+        return fs && fs->remove(adjusted);
+    }
+
+    bool mkdir(const char* path) override {
+        const char* adjusted;
+        fs::FS* fs = mapPath(path, &adjusted);
+        return fs && fs->mkdir(adjusted);
+    }
+
+    void list(const char* dir, void (*fn)(void*, const char*), void* ctx) override {
+        const char* adjusted;
+        fs::FS* fs = mapPath(dir, &adjusted);
+        if (!fs) return;
+        File d = fs->open(adjusted);
+        if (!d || !d.isDirectory()) return;
+        for (File e = d.openNextFile(); e; e = d.openNextFile()) {
+            if (!e.isDirectory()) fn(ctx, e.name());
+            e.close();
+        }
+        d.close();
+    }
+};
+
+FsStoreIO s_io;
+MsgStore* s_store = nullptr;
+
+MsgSearch* s_search = nullptr;
+
+// The store object carries a record-sized scratch buffer; keep it in PSRAM
+MsgStore* store() {
+    if (!s_store) {
+        void* mem = heapTagPsMalloc(HeapTag::MESH, sizeof(MsgStore));
+        if (mem) s_store = new (mem) MsgStore(s_io);
+    }
+    return s_store;
+}
+
+bool messageAlive(void* ctx, uint32_t id) {
+    return static_cast<MsgStore*>(ctx)->contains(id);
+}
+
+MsgSearch* search() {
+    if (!s_search && store()) {
+        void* mem = heapTagPsMalloc(HeapTag::MESH, sizeof(MsgSearch));
+        if (mem) s_search = new (mem) MsgSearch(s_io, messageAlive, s_store);
+    }
+    return s_search;
+}
+
+// Picks the top-level "text" string out of a stored message's JSON
+class TextFieldHandler : public JsonHandler {
+public:
+    const char* text = nullptr;
+    size_t len = 0;
+
+    bool null() override { return value(); }
+    bool boolean(bool) override { return value(); }
+    bool integer(int64_t) override { return value(); }
+    bool number(double) override { return value(); }
+    bool string(const char* s, size_t n) override {
+        if (_depth == 1 && _isText) {
+            // `s` may point into the reader's scratch; keep a copy
+            _copy.assign(s, s + n);
+            text = _copy.data();
+            len = n;
+            return false;
+        }
+        return value();
+    }
+    bool key(const char* s, size_t n) override {
+        _isText = _depth == 1 && n == 4 && memcmp(s, "text", 4) == 0;
+        return true;
+    }
+    bool startObject() override { _depth++; return value(); }
+    bool endObject() override { _depth--; return true; }
+    bool startArray() override { _depth++; return value(); }
+    bool endArray() override { _depth--; return true; }
+
+private:
+    bool value() {
+        _isText = false;
+        return true;
+    }
+
+    int _depth = 0;
+    bool _isText = false;
+    MsgSearch::Vec<char> _copy;
+};
+
+void indexStored(void* ctx, const char*, uint32_t id, const char* body, size_t len) {
+    TextFieldHandler h;
+    JsonReader reader;
+    reader.parse(body, len, h);
+    MsgSearch* se = static_cast<MsgSearch*>(ctx);
+    se->add(id, h.text ? h.text : "", h.len);
+    if (se->flushDue()) se->flush();
+}
+
+// Open the search index beside the store's segments and index whatever
+// it is missing: messages since its last flush, or everything the first
+// time.
+void openSearch(MsgStore* st) {
+    MsgSearch* se = search();
+    if (!se) return;
+    char dir[PATH_MAX_LEN];
+    snprintf(dir, sizeof(dir), "%s/idx", st->dir());
+    if (!se->open(dir)) {
+        LOG_WARN("Messages", "Can't open search index %s", dir);
+        return;
+    }
+    uint32_t start = millis();
+    size_t added = st->scanSince(se->indexedUpTo(), indexStored, se);
+    st->closeFiles();
+    se->merge();
+    MsgSearchStats s;
+    se->getStats(s);
+    LOG("Messages", "Search index: %u segments, %u terms, %u messages caught up in %u ms",
+        (unsigned)s.segments, (unsigned)s.terms, (unsigned)added, (unsigned)(millis() - start));
+}
+
+// Index the text field of the message table at `idx`
+void indexAppended(lua_State* L, int idx, uint32_t id) {
+    MsgSearch* se = s_search;
+    if (!se || !se->isOpen()) return;
+    lua_getfield(L, idx, "text");
+    size_t len = 0;
+    const char* text = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : "";
+    se->add(id, text, len);
+    lua_pop(L, 1);
+    if (se->flushDue() && !se->flush()) {
+        LOG_WARN("Messages", "Search index flush failed");
+    }
+}
+
+MsgStore* checkOpen(lua_State* L) {
+    MsgStore* st = store();
+    if (!st || !st->isOpen()) luaL_error(L, "ez.messages: store not open");
+    return st;
+}
+
+// Encode the table at `idx` and hand the JSON to fn. Pushes nil, err on
+// failure, with `failure` as the error when fn returns false.
+template <typename Fn>
+bool withJson(lua_State* L, int idx, const char* failure, Fn fn) {
+    luaL_checktype(L, idx, LUA_TTABLE);
+    size_t len = 0;
+    const char* err = nullptr;
+    char* json = luaJsonEncodeToBlock(L, idx, &len, &err);
+    if (!json) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return false;
+    }
+    heapTagAdopt(HeapTag::MESH, json);
+    if (len > MSG_BODY_MAX) {
+        heapTagFree(HeapTag::MESH, json);
+        lua_pushnil(L);
+        lua_pushstring(L, "message too large");
+        return false;
+    }
+    bool ok = fn(json, len);
+    heapTagFree(HeapTag::MESH, json);
+    if (!ok) {
+        lua_pushnil(L);
+        lua_pushstring(L, failure);
+    }
+    return ok;
+}
+
+struct FetchCtx {
+    lua_State* L;
+    int table;
+    lua_Integer n;
+};
+
+void pushFetched(void* ctx, uint32_t id, const char* body, size_t len) {
+    FetchCtx* fc = static_cast<FetchCtx*>(ctx);
+    if (!luaJsonDecode(fc->L, body, len) || !lua_istable(fc->L, -1)) {
+        lua_pop(fc->L, 1);
+        return;
+    }
+    lua_pushinteger(fc->L, id);
+    lua_setfield(fc->L, -2, "id");
+    lua_rawseti(fc->L, fc->table, ++fc->n);
+}
+
+}  // namespace
+
+// @lua ez.messages.open(dir) -> boolean
+// @brief Open (or create) the store in a directory
+// @description Replays every segment to rebuild the index; a few ms per
+// thousand messages. Then opens the search index and indexes messages
+// added since it was last written out. Opening the directory that is already open is a
+// no-op; another directory closes the current one first.
+// @param dir Directory under /sd/ or /fs/
+// @return true on success, or nil and an error
+// @example
+// ez.messages.open("/sd/messages")
+// @end
+LUA_FUNCTION(l_messages_open) {
+    const char* dir = luaL_checkstring(L, 1);
+    MsgStore* st = store();
+    if (!st) {
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    if (st->isOpen() && strcmp(st->dir(), dir) == 0) {
+        lua_pushboolean(L, true);
+        return 1;
+    }
+    const char* adjusted;
+    if (!mapPath(dir, &adjusted) || !st->open(dir)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "invalid directory - use /sd/ or /fs/");
+        return 2;
+    }
+    MsgStoreStats s;
+    st->getStats(s);
+    LOG("Messages", "Opened %s: %u messages in %u conversations, %u segments",
+        dir, (unsigned)s.messages, (unsigned)s.conversations, (unsigned)s.segments);
+    if (s.tornBytes) {
+        LOG_WARN("Messages", "Skipped %u bytes of torn records", (unsigned)s.tornBytes);
+    }
+    openSearch(st);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// @lua ez.messages.append(conv, msg) -> integer
+// @brief Add a message to a conversation
+// @description The table is stored as JSON (up to 2 KB encoded) and
+// written through to the card before this returns. Its text field is
+// added to the search index.
+// @param conv Conversation key
+// @param msg Message table
+// @return The new message id, or nil and an error
+// @example
+// local id = ez.messages.append("ch:#Public", { text = "hi", timestamp = 0 })
+// @end
+LUA_FUNCTION(l_messages_append) {
+    MsgStore* st = checkOpen(L);
+    const char* conv = luaL_checkstring(L, 1);
+    uint32_t id = 0;
+    if (!withJson(L, 2, "write failed", [&](const char* json, size_t len) {
+            id = st->append(conv, json, len);
+            return id != 0;
+        })) {
+        return 2;
+    }
+    indexAppended(L, 2, id);
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+// @lua ez.messages.update(conv, id, msg) -> boolean
+// @brief Replace a stored message
+// @description Used for status changes (pending to delivered) and merged
+// duplicates. Appends the new version; the old one becomes dead bytes.
+// @param conv Conversation key
+// @param id Message id from append()
+// @param msg Full replacement message table
+// @return true, or nil and an error (unknown id, write failure)
+// @example
+// msg.status = "delivered"
+// ez.messages.update("dm:" .. key, msg.id, msg)
+// @end
+LUA_FUNCTION(l_messages_update) {
+    MsgStore* st = checkOpen(L);
+    const char* conv = luaL_checkstring(L, 1);
+    uint32_t id = (uint32_t)luaL_checkinteger(L, 2);
+    if (!withJson(L, 3, "unknown message or write failed", [&](const char* json, size_t len) {
+            return st->update(conv, id, json, len);
+        })) {
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// @lua ez.messages.delete(conv, id) -> boolean
+// @brief Delete one message
+// @param conv Conversation key
+// @param id Message id
+// @return true if the message existed and was deleted
+// @example
+// ez.messages.delete("dm:" .. key, msg.id)
+// @end
+LUA_FUNCTION(l_messages_delete) {
+    MsgStore* st = checkOpen(L);
+    const char* conv = luaL_checkstring(L, 1);
+    uint32_t id = (uint32_t)luaL_checkinteger(L, 2);
+    lua_pushboolean(L, st->remove(conv, id));
+    return 1;
+}
+
+// @lua ez.messages.clear(conv) -> boolean
+// @brief Delete a whole conversation
+// @param conv Conversation key
+// @return true unless the write failed
+// @example
+// ez.messages.clear("ch:#Test")
+// @end
+LUA_FUNCTION(l_messages_clear) {
+    MsgStore* st = checkOpen(L);
+    lua_pushboolean(L, st->drop(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+// @lua ez.messages.fetch(conv, before, n) -> table, boolean
+// @brief Page through a conversation, newest first
+// @description Returns up to n messages older than id `before` (or the
+// newest n when before is nil), oldest first, each with its id. The
+// second result says whether older messages remain, so the next page is
+// fetch(conv, page[1].id, n).
+// @param conv Conversation key
+// @param before Message id to page back from (optional)
+// @param n Page size (default 20, max 200)
+// @return Array of message tables, and whether there are older ones
+// @example
+// local page, more = ez.messages.fetch("dm:" .. key, nil, 50)
+// if more then
+//     local older = ez.messages.fetch("dm:" .. key, page[1].id, 50)
+// end
+// @end
+LUA_FUNCTION(l_messages_fetch) {
+    MsgStore* st = checkOpen(L);
+    const char* conv = luaL_checkstring(L, 1);
+    uint32_t before = (uint32_t)luaL_optinteger(L, 2, 0);
+    lua_Integer n = luaL_optinteger(L, 3, FETCH_DEFAULT);
+    if (n < 1) n = 1;
+    if (n > FETCH_MAX) n = FETCH_MAX;
+
+    lua_createtable(L, (int)n, 0);
+    FetchCtx ctx = {L, lua_gettop(L), 0};
+    bool more = false;
+    st->fetch(conv, before, (size_t)n, pushFetched, &ctx, &more);
+    lua_pushboolean(L, more);
+    return 2;
+}
+
+// @lua ez.messages.count(conv) -> integer
+// @brief Number of messages in a conversation
+// @param conv Conversation key
+// @return Message count (0 for an unknown key)
+// @example
+// print(ez.messages.count("ch:#Public"))
+// @end
+LUA_FUNCTION(l_messages_count) {
+    MsgStore* st = checkOpen(L);
+    lua_pushinteger(L, (lua_Integer)st->count(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+// @lua ez.messages.conversations() -> table
+// @brief All conversations with their message counts
+// @return Table mapping conversation key to count
+// @example
+// for conv, n in pairs(ez.messages.conversations()) do print(conv, n) end
+// @end
+LUA_FUNCTION(l_messages_conversations) {
+    MsgStore* st = checkOpen(L);
+    size_t n = st->conversationCount();
+    lua_createtable(L, 0, (int)n);
+    for (size_t i = 0; i < n; i++) {
+        lua_pushinteger(L, (lua_Integer)st->conversationSize(i));
+        lua_setfield(L, -2, st->conversationKey(i));
+    }
+    return 1;
+}
+
+// @lua ez.messages.compact(force) -> boolean
+// @brief Reclaim space held by updated and deleted records
+// @description Runs when dead bytes exceed both 32 KB and the live bytes,
+// or always with force. Rewrites every live record once, blocking for the
+// duration, so call it from an idle timer rather than a UI handler. Also
+// writes out the search index's pending entries and merges its segments.
+// @param force Compact even below the threshold (optional)
+// @return true if a compaction ran and succeeded
+// @example
+// ez.system.set_interval(600000, function() ez.messages.compact() end)
+// @end
+LUA_FUNCTION(l_messages_compact) {
+    MsgStore* st = checkOpen(L);
+    bool force = lua_toboolean(L, 1);
+    if (s_search && s_search->isOpen()) {
+        // A merge holds three files open; SD allows five in all
+        st->closeFiles();
+        FileHandleCache::instance().closeIdle();
+        if (!s_search->flush()) LOG_WARN("Messages", "Search index flush failed");
+        s_search->merge();
+    }
+    if (!force && !st->needsCompaction()) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    uint32_t start = millis();
+    bool ok = st->compact();
+    MsgStoreStats s;
+    st->getStats(s);
+    LOG("Messages", "Compaction %s in %u ms: %u bytes in %u segments",
+        ok ? "done" : "failed", (unsigned)(millis() - start),
+        (unsigned)s.totalBytes, (unsigned)s.segments);
+    lua_pushboolean(L, ok);
+    return 1;
+}
+
+struct SearchCtx {
+    lua_State* L;
+    int table;
+    lua_Integer n;
+};
+
+void pushFound(void* ctx, const char* conv, uint32_t id, const char* body, size_t len) {
+    SearchCtx* sc = static_cast<SearchCtx*>(ctx);
+    if (!luaJsonDecode(sc->L, body, len) || !lua_istable(sc->L, -1)) {
+        lua_pop(sc->L, 1);
+        return;
+    }
+    lua_pushinteger(sc->L, id);
+    lua_setfield(sc->L, -2, "id");
+    lua_pushstring(sc->L, conv);
+    lua_setfield(sc->L, -2, "conv");
+    lua_rawseti(sc->L, sc->table, ++sc->n);
+}
+
+// @lua ez.messages.search(query, limit) -> table
+// @brief Find messages by the words in their text
+// @description Matches messages whose text contains every word of the
+// query as the start of a word, ignoring ASCII case: "mee park" finds
+// "Meet at the park". Words shorter than 2 characters are ignored.
+// Searches all conversations; each result carries its conv key and id.
+// Cost is a few small reads per query word, independent of how many
+// messages are stored.
+// @param query Words to look for
+// @param limit Maximum results (default 20, max 200)
+// @return Array of message tables, newest first
+// @example
+// for _, m in ipairs(ez.messages.search("antenna", 10)) do
+//     print(m.conv, m.text)
+// end
+// @end
+LUA_FUNCTION(l_messages_search) {
+    MsgStore* st = checkOpen(L);
+    size_t qlen = 0;
+    const char* query = luaL_checklstring(L, 1, &qlen);
+    lua_Integer limit = luaL_optinteger(L, 2, FETCH_DEFAULT);
+    if (limit < 1) limit = 1;
+    if (limit > FETCH_MAX) limit = FETCH_MAX;
+
+    uint32_t ids[FETCH_MAX];
+    size_t n = 0;
+    if (s_search && s_search->isOpen()) {
+        n = s_search->search(query, qlen, ids, (size_t)limit);
+    }
+    lua_createtable(L, (int)n, 0);
+    SearchCtx ctx = {L, lua_gettop(L), 0};
+    for (size_t i = 0; i < n; i++) st->fetchById(ids[i], pushFound, &ctx);
+    return 1;
+}
+
+// @lua ez.messages.get_stats() -> table
+// @brief Store size and health counters
+// @return Table with open, dir, conversations, messages, segments,
+// total_bytes, live_bytes, torn_bytes, compactions, and for the search
+// index search_segments, search_terms, search_bytes, search_pending
+// (messages not yet written out), search_merges
+// @example
+// local s = ez.messages.get_stats()
+// print(s.messages .. " messages, " .. s.total_bytes .. " bytes")
+// @end
+LUA_FUNCTION(l_messages_get_stats) {
+    MsgStore* st = store();
+    MsgStoreStats s = {};
+    bool open = st && st->isOpen();
+    if (open) st->getStats(s);
+    lua_newtable(L);
+    lua_pushboolean(L, open);
+    lua_setfield(L, -2, "open");
+    if (open) {
+        lua_pushstring(L, st->dir());
+        lua_setfield(L, -2, "dir");
+    }
+    lua_pushinteger(L, s.conversations);
+    lua_setfield(L, -2, "conversations");
+    lua_pushinteger(L, s.messages);
+    lua_setfield(L, -2, "messages");
+    lua_pushinteger(L, s.segments);
+    lua_setfield(L, -2, "segments");
+    lua_pushinteger(L, s.totalBytes);
+    lua_setfield(L, -2, "total_bytes");
+    lua_pushinteger(L, s.liveBytes);
+    lua_setfield(L, -2, "live_bytes");
+    lua_pushinteger(L, s.tornBytes);
+    lua_setfield(L, -2, "torn_bytes");
+    lua_pushinteger(L, s.compactions);
+    lua_setfield(L, -2, "compactions");
+
+    MsgSearchStats ss = {};
+    if (open && s_search && s_search->isOpen()) s_search->getStats(ss);
+    lua_pushinteger(L, ss.segments);
+    lua_setfield(L, -2, "search_segments");
+    lua_pushinteger(L, ss.terms);
+    lua_setfield(L, -2, "search_terms");
+    lua_pushinteger(L, ss.bytes);
+    lua_setfield(L, -2, "search_bytes");
+    lua_pushinteger(L, ss.pendingDocs);
+    lua_setfield(L, -2, "search_pending");
+    lua_pushinteger(L, ss.merges);
+    lua_setfield(L, -2, "search_merges");
+    return 1;
+}
+
+static const luaL_Reg messages_funcs[] = {
+    {"open",          l_messages_open},
+    {"append",        l_messages_append},
+    {"update",        l_messages_update},
+    {"delete",        l_messages_delete},
+    {"clear",         l_messages_clear},
+    {"fetch",         l_messages_fetch},
+    {"count",         l_messages_count},
+    {"conversations", l_messages_conversations},
+    {"search",        l_messages_search},
+    {"compact",       l_messages_compact},
+    {"get_stats",     l_messages_get_stats},
+    {nullptr, nullptr}
+};
+
+void registerMessagesModule(lua_State* L) {
+    lua_register_module(L, "messages", messages_funcs);
+    LOG("LuaRuntime", "Registered ez.messages");
+}
@@ -38,6 +38,7 @@
 // a single syscall would.
 
 #include "../lua_bindings.h"
+#include "buffer_bindings.h"
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiClient.h>
@@ -232,7 +233,7 @@ LUA_FUNCTION(l_net_tcp_send) {
     LUA_CHECK_ARGC(L, 2);
     int cid = (int)luaL_checkinteger(L, 1);
     size_t len = 0;
-    const char* data = luaL_checklstring(L, 2, &len);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 2, &len);
     WiFiClient* c = getTcpClient(cid);
     if (!c || !c->connected()) { lua_pushnil(L); return 1; }
     size_t avail = (size_t)c->availableForWrite();
@@ -354,7 +355,7 @@ LUA_FUNCTION(l_net_udp_send) {
     const char* ip_str = luaL_checkstring(L, 2);
     uint16_t port = (uint16_t)luaL_checkinteger(L, 3);
     size_t len = 0;
-    const char* data = luaL_checklstring(L, 4, &len);
+    const char* data = (const char*)buffer_bindings::checkBytes(L, 4, &len);
     WiFiUDP* u = getUdp(uid);
     if (!u) { lua_pushnil(L); return 1; }
     IPAddress addr;
@@ -5,8 +5,10 @@
 //      streaming POST /ota authenticated with a per-session bearer
 //      token. Bytes flow into Update.write through the body callback
 //      as they arrive -- no main-loop blocking, no per-byte multipart
-//      parser. Also exposes /info, /logs, /screen.bmp, /lua, /key,
-//      /chat_event for the host-side dev console and the Claude bot.
+//      parser. Also exposes /info (with per-subsystem heap usage),
+//      /logs (plus /logs.bin, the raw binary records), /screen.bmp,
+//      /lua, /key, /chat_event, /profile, /trace.json for the host-side
+//      dev console and the Claude bot.
 //   2. A handful of helpers around esp_ota_* so boot.lua can mark the
 //      running image good (cancelling the IDF's auto-rollback) and
 //      callers can introspect / force a rollback.
@@ -21,7 +23,7 @@
 // bypasses the broken socket layer and reliably ships the full
 // 230 KiB framebuffer dump.
 //
-// /lua is the one handler that touches the Lua state. It can't run
+// /lua and /profile are the handlers that touch the Lua state. It can't run
 // on the AsyncTCP task directly (Lua is single-threaded and the main
 // loop is already calling into it) so we queue a stack-allocated
 // DeferredLua + block the AsyncTCP request handler on a flag while
@@ -38,7 +40,11 @@
 #include "ota_bindings.h"
 #include "bus_bindings.h"
 #include "../lua_runtime.h"
+#include "../profiler.h"
+#include "../worker.h"
+#include "../../util/heap_tags.h"
 #include "../../util/log.h"
+#include "../../util/trace.h"
 #include "../../hardware/display.h"
 #include "../../hardware/keyboard.h"
 
@@ -117,6 +123,11 @@ struct DeferredLua {
     volatile bool done;
     int status;
     String response_body;
+    // /profile: snapshot the profiler's folded stacks into a ps_malloc'd
+    // `blob` instead of running `body`. The handler takes ownership.
+    bool profileDump = false;
+    char* blob = nullptr;
+    size_t blobLen = 0;
 };
 QueueHandle_t g_mainQueue = nullptr;
 
@@ -260,6 +271,22 @@ void info_handler(AsyncWebServerRequest* req) {
     doc["total_psram"] = ESP.getPsramSize();
     doc["uptime_ms"]   = millis();
     doc["chip_model"]  = ESP.getChipModel();
+    // Per-subsystem native heap (atomic counters, safe to read from here)
+    // plus the two Lua heaps.
+    JsonObject heap = doc["heap"].to<JsonObject>();
+    for (size_t i = 0; i < (size_t)HeapTag::COUNT; i++) {
+        HeapTagStats st;
+        heapTagGetStats((HeapTag)i, st);
+        JsonObject t = heap[heapTagName((HeapTag)i)].to<JsonObject>();
+        t["live"]     = st.live;
+        t["peak"]     = st.peak;
+        t["allocs"]   = st.allocs;
+        t["frees"]    = st.frees;
+        t["failures"] = st.failures;
+    }
+    heap["lua"]["live"]    = LuaRuntime::instance().getMemoryUsed();
+    heap["worker"]["live"] = LuaWorker::instance().getStats().memUsed;
+    heap["worker"]["peak"] = LuaWorker::instance().getStats().memPeak;
     JsonObject wifi = doc["wifi"].to<JsonObject>();
     wifi["connected"] = WiFi.isConnected();
     wifi["ssid"]      = WiFi.isConnected() ? WiFi.SSID() : "";
@@ -303,6 +330,31 @@ void logs_handler(AsyncWebServerRequest* req) {
     req->send(response);
 }
 
+// Raw binary log records for tools/dev/log_decode.py: format strings
+// are resolved there, against the firmware image, so this is cheaper
+// than /logs and carries timestamps, levels and cores.
+void logs_bin_handler(AsyncWebServerRequest* req) {
+    if (!requireBearer(req)) return;
+    constexpr size_t CAP = 48 * 1024;
+    uint8_t* buf = (uint8_t*)ps_malloc(CAP);
+    if (!buf) {
+        req->send(500, "application/json",
+            "{\"ok\":false,\"error\":\"out of memory\"}");
+        return;
+    }
+    size_t n = log_dump_binary(buf, CAP);
+    req->_tempObject = buf;
+    auto* response = req->beginResponse("application/octet-stream", n,
+        [buf, n](uint8_t* dest, size_t maxLen, size_t index) -> size_t {
+            if (index >= n) return 0;
+            size_t take = n - index;
+            if (take > maxLen) take = maxLen;
+            memcpy(dest, buf + index, take);
+            return take;
+        });
+    req->send(response);
+}
+
 void screen_handler(AsyncWebServerRequest* req) {
     if (!requireBearer(req)) return;
     if (!display) {
@@ -381,23 +433,16 @@ struct LuaBodyBuf {
     char data[];  // flexible array follows
 };
 
-void lua_handler_complete(AsyncWebServerRequest* req) {
-    if (!requireBearer(req)) return;
-    auto* lb = (LuaBodyBuf*)req->_tempObject;
-    if (!lb || lb->len == 0) {
-        req->send(400, "application/json",
-            "{\"ok\":false,\"error\":\"empty body\"}");
-        return;
-    }
-    DeferredLua d;
-    d.body = String(lb->data, lb->len);
+// Queue `d` to the main loop and block until it has been processed.
+// On failure the error response has already been sent.
+bool runOnMainLoop(AsyncWebServerRequest* req, DeferredLua& d) {
     d.done = false;
     d.status = 0;
     DeferredLua* p = &d;
     if (!g_mainQueue || xQueueSend(g_mainQueue, &p, 0) != pdTRUE) {
         req->send(503, "application/json",
             "{\"ok\":false,\"error\":\"queue full\"}");
-        return;
+        return false;
     }
     // Block on the main thread filling in the response. 10 s ceiling
     // so a wedged main loop can't hold the AsyncTCP task forever.
@@ -408,12 +453,137 @@ void lua_handler_complete(AsyncWebServerRequest* req) {
     if (!d.done) {
         req->send(504, "application/json",
             "{\"ok\":false,\"error\":\"main loop timeout\"}");
+        return false;
+    }
+    return true;
+}
+
+void lua_handler_complete(AsyncWebServerRequest* req) {
+    if (!requireBearer(req)) return;
+    auto* lb = (LuaBodyBuf*)req->_tempObject;
+    if (!lb || lb->len == 0) {
+        req->send(400, "application/json",
+            "{\"ok\":false,\"error\":\"empty body\"}");
         return;
     }
+    DeferredLua d;
+    d.body = String(lb->data, lb->len);
+    if (!runOnMainLoop(req, d)) return;
     req->send(d.status ? d.status : 500,
         "application/json", d.response_body);
 }
 
+// GET /profile[?seconds=N]: folded stacks from ez.profiler as
+// text/plain, ready for flamegraph.pl or speedscope. With `seconds`
+// (1-8, bounded by how long we can hold the AsyncTCP task) the samples
+// are reset, the profiler runs for that long and is stopped again;
+// without it, whatever has been collected so far is returned.
+void profile_handler(AsyncWebServerRequest* req) {
+    if (!requireBearer(req)) return;
+    if (req->hasParam("seconds")) {
+        long secs = req->getParam("seconds")->value().toInt();
+        if (secs < 1) secs = 1;
+        if (secs > 8) secs = 8;
+        DeferredLua start;
+        start.body = "ez.profiler.reset() return ez.profiler.start()";
+        if (!runOnMainLoop(req, start)) return;
+        if (start.response_body != "{\"ok\":true,\"result\":true}") {
+            req->send(409, "application/json",
+                "{\"ok\":false,\"error\":\"profiler busy or out of memory\"}");
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(secs * 1000));
+        DeferredLua stop;
+        stop.body = "ez.profiler.stop()";
+        if (!runOnMainLoop(req, stop)) return;
+    }
+
+    DeferredLua d;
+    d.profileDump = true;
+    if (!runOnMainLoop(req, d)) return;
+    if (!d.blob) {
+        req->send(d.status ? d.status : 500, "application/json",
+            d.response_body);
+        return;
+    }
+    char* buf = d.blob;
+    size_t n = d.blobLen;
+    req->_tempObject = buf;
+    auto* response = req->beginResponse("text/plain; charset=utf-8", n,
+        [buf, n](uint8_t* dest, size_t maxLen, size_t index) -> size_t {
+            if (index >= n) return 0;
+            size_t take = n - index;
+            if (take > maxLen) take = maxLen;
+            memcpy(dest, buf + index, take);
+            return take;
+        });
+    req->send(response);
+}
+
+// GET /trace.json: the ez.trace ring as Chrome trace-event JSON. The
+// ring is lock-free, so this runs on the AsyncTCP task without the main
+// loop; the JSON is generated chunk by chunk from a PSRAM snapshot rather
+// than built up front (a full ring is several hundred KiB of text).
+void trace_handler(AsyncWebServerRequest* req) {
+    if (!requireBearer(req)) return;
+    TraceJsonWriter* w = trace_export_begin();
+    if (!w) {
+        req->send(404, "application/json",
+            "{\"ok\":false,\"error\":\"no trace data\"}");
+        return;
+    }
+    // One heap block with a trivial destructor, so the request's free()
+    // of _tempObject releases it
+    req->_tempObject = w;
+    auto* response = req->beginChunkedResponse("application/json",
+        [w](uint8_t* dest, size_t maxLen, size_t) -> size_t {
+            return w->read((char*)dest, maxLen);
+        });
+    req->send(response);
+}
+
+// Main-loop half of /profile: the profiler tables are only written from
+// the Lua thread, so copy them out here. Two passes -- measure, then
+// fill an exactly-sized PSRAM buffer.
+void snapshotProfile(DeferredLua* d) {
+    LuaProfiler& prof = LuaProfiler::instance();
+    if (!prof.hasData()) {
+        d->status = 404;
+        d->response_body = "{\"ok\":false,\"error\":\"no profile data\"}";
+        return;
+    }
+    constexpr size_t CHUNK = FoldedStacks::MAX_DEPTH * FoldedStacks::FRAME_NAME_LEN + 64;
+    char* scratch = (char*)ps_malloc(CHUNK);
+    if (!scratch) {
+        d->status = 500;
+        d->response_body = "{\"ok\":false,\"error\":\"out of memory\"}";
+        return;
+    }
+    size_t total = 0;
+    size_t cursor = 0;
+    while (cursor < prof.foldedEnd()) {
+        total += prof.writeFolded(cursor, scratch, CHUNK);
+    }
+    free(scratch);
+
+    char* buf = (char*)ps_malloc(total + 1);
+    if (!buf) {
+        d->status = 500;
+        d->response_body = "{\"ok\":false,\"error\":\"out of memory\"}";
+        return;
+    }
+    size_t len = 0;
+    cursor = 0;
+    while (cursor < prof.foldedEnd() && len < total) {
+        size_t n = prof.writeFolded(cursor, buf + len, total + 1 - len);
+        if (n == 0) break;
+        len += n;
+    }
+    d->blob = buf;
+    d->blobLen = len;
+    d->status = 200;
+}
+
 void lua_handler_body(AsyncWebServerRequest* req, uint8_t* data,
                       size_t len, size_t index, size_t total) {
     constexpr size_t MAX_LUA = 64 * 1024;
@@ -734,7 +904,10 @@ LUA_FUNCTION(l_ota_dev_server_start) {
     g_server->on("/",           HTTP_GET,  status_handler);
     g_server->on("/info",       HTTP_GET,  info_handler);
     g_server->on("/logs",       HTTP_GET,  logs_handler);
+    g_server->on("/logs.bin",   HTTP_GET,  logs_bin_handler);
     g_server->on("/screen.bmp", HTTP_GET,  screen_handler);
+    g_server->on("/profile",    HTTP_GET,  profile_handler);
+    g_server->on("/trace.json", HTTP_GET,  trace_handler);
     g_server->on("/lua",        HTTP_POST, lua_handler_complete,
                  nullptr, lua_handler_body);
     g_server->on("/key",        HTTP_POST, key_handler_complete,
@@ -942,6 +1115,12 @@ void update() {
     while (xQueueReceive(g_mainQueue, &d, 0) == pdTRUE) {
         if (!d) continue;
 
+        if (d->profileDump) {
+            snapshotProfile(d);
+            d->done = true;
+            continue;
+        }
+
         lua_State* L = LUA_STATE;
         if (!L) {
             d->status = 503;
@@ -0,0 +1,153 @@
+// ez.profiler module bindings
+// Sampling Lua profiler with folded-stack (flamegraph) export
+
+#include "../lua_bindings.h"
+#include "../profiler.h"
+#include "../../util/log.h"
+#include <Arduino.h>
+
+// @module ez.profiler
+// @brief Sampling profiler for Lua code
+// @description
+// Samples the running Lua stack at a fixed rate and aggregates identical
+// stacks. dump() returns them in the folded format read by flamegraph.pl,
+// inferno and speedscope: one "root;caller;callee count" line per stack.
+// Time with no Lua running is reported as "(outside lua)". The dev OTA
+// server serves the same data at GET /profile, and
+// `ez_remote.py PORT --profile SECONDS` captures it over USB serial.
+// @end
+
+// @lua ez.profiler.start(hz) -> boolean
+// @brief Start sampling
+// @description Samples the main Lua thread and every coroutine the
+// scheduler runs (spawn, async, timers) at `hz` (default 1000, clamped to
+// 10-5000). Samples accumulate across
+// start/stop until reset().
+// @param hz Optional sampling rate in Hz
+// @return true if sampling started, false if already running or out of PSRAM
+// @example
+// ez.profiler.start(1000)
+// @end
+LUA_FUNCTION(l_profiler_start) {
+    uint32_t hz = (uint32_t)luaL_optinteger(L, 1, LuaProfiler::DEFAULT_HZ);
+    lua_pushboolean(L, LuaProfiler::instance().start(L, hz));
+    return 1;
+}
+
+// @lua ez.profiler.stop()
+// @brief Stop sampling, keeping the samples for dump()
+// @example
+// ez.profiler.stop()
+// @end
+LUA_FUNCTION(l_profiler_stop) {
+    LuaProfiler::instance().stop();
+    return 0;
+}
+
+// @lua ez.profiler.reset()
+// @brief Discard collected samples
+// @description When the profiler is stopped this also frees its PSRAM
+// tables.
+// @example
+// ez.profiler.reset()
+// @end
+LUA_FUNCTION(l_profiler_reset) {
+    LuaProfiler::instance().reset();
+    return 0;
+}
+
+// @lua ez.profiler.is_running() -> boolean
+// @brief Check whether the profiler is sampling
+// @return true while sampling
+// @example
+// if ez.profiler.is_running() then ez.profiler.stop() end
+// @end
+LUA_FUNCTION(l_profiler_is_running) {
+    lua_pushboolean(L, LuaProfiler::instance().running());
+    return 1;
+}
+
+// @lua ez.profiler.get_stats() -> table
+// @brief Get sampling counters and measured overhead
+// @description overhead_pct is the share of profiled wall time spent
+// walking and recording stacks. It leaves out the count hook that runs
+// every 1000 instructions; for the full cost, time the same work with the
+// profiler on and off.
+// @return Table with running, hz, samples, outside, stacks, frames, dropped_samples, dropped_frames, hook_calls, sample_us, elapsed_us, overhead_pct
+// @example
+// local s = ez.profiler.get_stats()
+// print(s.samples, "samples,", s.overhead_pct, "% overhead")
+// @end
+LUA_FUNCTION(l_profiler_get_stats) {
+    LuaProfiler& p = LuaProfiler::instance();
+    LuaProfiler::Stats st = p.getStats();
+
+    lua_newtable(L);
+    lua_pushboolean(L, p.running());
+    lua_setfield(L, -2, "running");
+    lua_pushinteger(L, st.hz);
+    lua_setfield(L, -2, "hz");
+    lua_pushinteger(L, st.samples);
+    lua_setfield(L, -2, "samples");
+    lua_pushinteger(L, st.outside);
+    lua_setfield(L, -2, "outside");
+    lua_pushinteger(L, st.stacks);
+    lua_setfield(L, -2, "stacks");
+    lua_pushinteger(L, st.frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, st.droppedSamples);
+    lua_setfield(L, -2, "dropped_samples");
+    lua_pushinteger(L, st.droppedFrames);
+    lua_setfield(L, -2, "dropped_frames");
+    lua_pushinteger(L, st.hookCalls);
+    lua_setfield(L, -2, "hook_calls");
+    lua_pushinteger(L, st.sampleUs);
+    lua_setfield(L, -2, "sample_us");
+    lua_pushinteger(L, st.elapsedUs);
+    lua_setfield(L, -2, "elapsed_us");
+    lua_pushnumber(L, st.elapsedUs ? 100.0 * st.sampleUs / st.elapsedUs : 0.0);
+    lua_setfield(L, -2, "overhead_pct");
+    return 1;
+}
+
+// @lua ez.profiler.dump() -> string
+// @brief Export samples as folded stacks
+// @description One line per distinct stack, frames root-first separated by
+// ';', then a space and the sample count. Lua frames read
+// name@source:line_defined, C functions name [C]. Feed the text to
+// flamegraph.pl or open it in speedscope.
+// @return Folded stack text (empty if nothing was sampled)
+// @example
+// ez.storage.write_file("/sd/profile.folded", ez.profiler.dump())
+// @end
+LUA_FUNCTION(l_profiler_dump) {
+    LuaProfiler& p = LuaProfiler::instance();
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    if (p.hasData()) {
+        constexpr size_t CHUNK = FoldedStacks::MAX_DEPTH * FoldedStacks::FRAME_NAME_LEN + 64;
+        size_t cursor = 0;
+        while (cursor < p.foldedEnd()) {
+            char* out = luaL_prepbuffsize(&b, CHUNK);
+            size_t n = p.writeFolded(cursor, out, CHUNK);
+            luaL_addsize(&b, n);
+        }
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+static const luaL_Reg profiler_funcs[] = {
+    {"start",      l_profiler_start},
+    {"stop",       l_profiler_stop},
+    {"reset",      l_profiler_reset},
+    {"is_running", l_profiler_is_running},
+    {"get_stats",  l_profiler_get_stats},
+    {"dump",       l_profiler_dump},
+    {nullptr, nullptr}
+};
+
+void registerProfilerModule(lua_State* L) {
+    lua_register_module(L, "profiler", profiler_funcs);
+    LOG("LuaRuntime", "Registered ez.profiler");
+}
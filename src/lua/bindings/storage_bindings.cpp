@@ -4,14 +4,18 @@
 #include "../lua_bindings.h"
 #include "../embedded_scripts.h"
 #include "../async.h"
+#include "../lua_json.h"
 #include "../../config.h"
+#include "../../util/file_handles.h"
+#include "../../util/sd_block_cache.h"
+#include "../../util/nvs_prefs.h"
+#include "../../util/heap_tags.h"
+#include "buffer_bindings.h"
 #include <Arduino.h>
 #include <LittleFS.h>
 #include <SD.h>
 #include <SPI.h>
-#include <Preferences.h>
-#include <ArduinoJson.h>
-#include <nvs.h>
+#include <vector>
 
 // @module ez.storage
 // @brief File I/O for internal flash (LittleFS) and SD card
@@ -27,8 +31,6 @@
 
 // Storage state
 static bool sdInitialized = false;
-static Preferences prefs;
-static bool prefsOpened = false;
 
 // Mount point prefixes
 static const char* MOUNT_SD = "/sd";
@@ -42,6 +44,7 @@ static bool initSD() {
     SPI.begin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS);
     if (SD.begin(SD_CS)) {
         sdInitialized = true;
+        SdBlockCache::instance().install();
         Serial.println("[Storage] SD card initialized");
         return true;
     }
@@ -50,14 +53,6 @@ static bool initSD() {
     return false;
 }
 
-// Ensure preferences are open
-static void ensurePrefs() {
-    if (!prefsOpened) {
-        prefs.begin("lua_storage", false);
-        prefsOpened = true;
-    }
-}
-
 // Filesystem type enum
 enum class FSType { SD_CARD, LITTLEFS, EMBEDDED, VIRTUAL_ROOT, INVALID };
 
@@ -124,18 +119,23 @@ static fs::FS* getFS(const char* path, const char** adjustedPath) {
     return nullptr;
 }
 
-// @lua ez.storage.read_bytes(path, offset, length) -> string
+// @lua ez.storage.read_bytes(path, offset, length, out_buf) -> string
 // @brief Read bytes from file at specific offset (for random access)
 // @description Reads a specific range of bytes from a file without loading the
 // entire file into memory. Useful for reading headers, seeking within large
 // files, or implementing file formats with random access. The read is buffered
 // in PSRAM when available (falls back to internal heap), so country-scale map
 // indexes and other ~1 MB blocks load in a single call. For larger blobs, call
-// in a loop with successive offsets — each call is still a single file open.
+// in a loop with successive offsets; the file stays open between calls (see
+// get_cache_stats), so a loop like that opens it once.
+// Pass an ez.buffer as out_buf to read straight into it (an owner is resized
+// to the bytes read, a view must be large enough); the call then returns the
+// buffer and the byte count instead of creating a string.
 // @param path File path (prefix /sd/ for SD card)
 // @param offset Byte offset to start reading from (0-based)
 // @param length Number of bytes to read (max 1048576 — 1 MB per call)
-// @return Binary data as string, or nil with error message
+// @param out_buf Optional buffer to read into
+// @return Binary data as string (or out_buf, count), or nil with error message
 // @example
 // -- Read file header (first 16 bytes)
 // local header = ez.storage.read_bytes("/sd/maps/tiles.bin", 0, 16)
@@ -146,12 +146,20 @@ static fs::FS* getFS(const char* path, const char** adjustedPath) {
 //     if not chunk or #chunk == 0 then break end
 //     process(chunk); offset = offset + #chunk
 // end
+// -- Reuse one buffer for every chunk
+// local buf = ez.buffer.new(65536)
+// ez.storage.read_bytes("/sd/huge.bin", 0, 65536, buf)
 // @end
 LUA_FUNCTION(l_storage_read_bytes) {
     LUA_CHECK_ARGC(L, 3);
     const char* path = luaL_checkstring(L, 1);
     lua_Integer offset = luaL_checkinteger(L, 2);
     lua_Integer length = luaL_checkinteger(L, 3);
+    buffer_bindings::LuaBuffer* out = nullptr;
+    if (!lua_isnoneornil(L, 4)) {
+        out = buffer_bindings::toBuffer(L, 4);
+        if (!out) return luaL_argerror(L, 4, "buffer expected");
+    }
 
     // Safety ceiling: 1 MB matches read_file's limit and keeps a single
     // call from starving the internal heap when PSRAM fallback isn't
@@ -181,16 +189,16 @@ LUA_FUNCTION(l_storage_read_bytes) {
         return 2;
     }
 
-    File file = fs->open(adjustedPath, "r");
-    if (!file) {
+    FileHandleCache::Lease lease(*fs, adjustedPath);
+    if (!lease) {
         lua_pushnil(L);
         lua_pushstring(L, "File not found");
         return 2;
     }
+    File& file = lease.file();
 
     size_t fileSize = file.size();
     if ((size_t)offset >= fileSize) {
-        file.close();
         lua_pushnil(L);
         lua_pushstring(L, "Offset beyond file end");
         return 2;
@@ -204,14 +212,15 @@ LUA_FUNCTION(l_storage_read_bytes) {
 
     // Prefer PSRAM so multi-hundred-KB reads don't starve the internal
     // heap; fall back to malloc on boards without PSRAM.
-    char* buffer = (char*)ps_malloc(length);
-    if (!buffer) {
-        buffer = (char*)malloc(length);
+    char* buffer;
+    if (out) {
+        buffer = (char*)buffer_bindings::prepareOutput(out, length);
+    } else {
+        buffer = (char*)heapTagPsMalloc(HeapTag::STORAGE, length);
     }
     if (!buffer) {
-        file.close();
         lua_pushnil(L);
-        lua_pushstring(L, "Out of memory");
+        lua_pushstring(L, out && out->view ? "Buffer too small" : "Out of memory");
         return 2;
     }
 
@@ -225,18 +234,23 @@ LUA_FUNCTION(l_storage_read_bytes) {
         if (n == 0) break;
         totalRead += n;
     }
-    file.close();
 
     if (totalRead != (size_t)length) {
-        free(buffer);
+        lease.discard();
+        if (!out) heapTagFree(HeapTag::STORAGE, buffer);
         lua_pushnil(L);
         lua_pushfstring(L, "Read incomplete: got %I of %I bytes",
                         (lua_Integer)totalRead, (lua_Integer)length);
         return 2;
     }
 
+    if (out) {
+        lua_pushvalue(L, 4);
+        lua_pushinteger(L, length);
+        return 2;
+    }
     lua_pushlstring(L, buffer, length);
-    free(buffer);
+    heapTagFree(HeapTag::STORAGE, buffer);
     return 1;
 }
 
@@ -264,17 +278,14 @@ LUA_FUNCTION(l_storage_file_size) {
         return 2;
     }
 
-    File file = fs->open(adjustedPath, "r");
-    if (!file) {
+    FileHandleCache::Lease lease(*fs, adjustedPath);
+    if (!lease) {
         lua_pushnil(L);
         lua_pushstring(L, "File not found");
         return 2;
     }
 
-    size_t size = file.size();
-    file.close();
-
-    lua_pushinteger(L, size);
+    lua_pushinteger(L, lease.file().size());
     return 1;
 }
 
@@ -344,7 +355,7 @@ LUA_FUNCTION(l_storage_read_file) {
         return 2;
     }
 
-    char* buffer = (char*)malloc(size + 1);
+    char* buffer = (char*)heapTagMalloc(HeapTag::STORAGE, size + 1);
     if (!buffer) {
         file.close();
         lua_pushnil(L);
@@ -357,7 +368,7 @@ LUA_FUNCTION(l_storage_read_file) {
     file.close();
 
     lua_pushlstring(L, buffer, size);
-    free(buffer);
+    heapTagFree(HeapTag::STORAGE, buffer);
     return 1;
 }
 
@@ -378,7 +389,7 @@ LUA_FUNCTION(l_storage_write_file) {
     LUA_CHECK_ARGC(L, 2);
     const char* path = luaL_checkstring(L, 1);
     size_t len;
-    const char* content = luaL_checklstring(L, 2, &len);
+    const char* content = (const char*)buffer_bindings::checkBytes(L, 2, &len);
 
     const char* adjustedPath;
     fs::FS* fs = getFS(path, &adjustedPath);
@@ -397,6 +408,7 @@ LUA_FUNCTION(l_storage_write_file) {
 
     size_t written = file.write((const uint8_t*)content, len);
     file.close();
+    FileHandleCache::instance().invalidate(*fs, adjustedPath);
 
     if (written != len) {
         lua_pushboolean(L, false);
@@ -425,7 +437,7 @@ LUA_FUNCTION(l_storage_append_file) {
     LUA_CHECK_ARGC(L, 2);
     const char* path = luaL_checkstring(L, 1);
     size_t len;
-    const char* content = luaL_checklstring(L, 2, &len);
+    const char* content = (const char*)buffer_bindings::checkBytes(L, 2, &len);
 
     const char* adjustedPath;
     fs::FS* fs = getFS(path, &adjustedPath);
@@ -444,6 +456,7 @@ LUA_FUNCTION(l_storage_append_file) {
 
     size_t written = file.write((const uint8_t*)content, len);
     file.close();
+    FileHandleCache::instance().invalidate(*fs, adjustedPath);
 
     if (written != len) {
         lua_pushboolean(L, false);
@@ -549,6 +562,8 @@ LUA_FUNCTION(l_storage_remove) {
         return 1;
     }
 
+    // Before, so no cached handle outlives the file
+    FileHandleCache::instance().invalidate(*fs, adjustedPath);
     lua_pushboolean(L, fs->remove(adjustedPath));
     return 1;
 }
@@ -582,6 +597,8 @@ LUA_FUNCTION(l_storage_rename) {
         return 1;
     }
 
+    FileHandleCache::instance().invalidate(*fsOld, adjustedOld);
+    FileHandleCache::instance().invalidate(*fsOld, adjustedNew);
     lua_pushboolean(L, fsOld->rename(adjustedOld, adjustedNew));
     return 1;
 }
@@ -636,6 +653,7 @@ LUA_FUNCTION(l_storage_rmdir) {
         return 1;
     }
 
+    FileHandleCache::instance().invalidate(*fs, adjustedPath);
     lua_pushboolean(L, fs->rmdir(adjustedPath));
     return 1;
 }
@@ -805,14 +823,36 @@ LUA_FUNCTION(l_storage_list_dir) {
     return 1;
 }
 
+// Push a pref the way it was stored. Integer types come back as integers
+// whatever their width; Preferences.putBool stored a bool as int8, so an
+// old bool pref reads as 0/1.
+static void pushPref(lua_State* L, const PrefValue& v) {
+    switch (v.type) {
+        case PrefType::FLOAT:
+            lua_pushnumber(L, v.f);
+            break;
+        case PrefType::STR:
+        case PrefType::BLOB:
+            lua_pushlstring(L, v.data, v.len);
+            break;
+        case PrefType::U64:
+            lua_pushinteger(L, (lua_Integer)(uint64_t)v.i);
+            break;
+        default:
+            lua_pushinteger(L, (lua_Integer)v.i);
+            break;
+    }
+}
+
 // @lua ez.storage.get_pref(key, default) -> string
 // @brief Get preference value
-// @description Retrieves a stored preference value from non-volatile storage (NVS).
-// Preferences persist across reboots and are faster to access than files. Use for
-// settings, calibration values, and other small key-value data.
+// @description Retrieves a stored preference value. Preferences persist
+// across reboots in non-volatile storage (NVS) and are held in RAM from
+// boot, so a read is a table lookup: cheap enough to call while drawing.
+// Use for settings, calibration values, and other small key-value data.
 // @param key Preference key (max 15 chars)
 // @param default Default value if key not found (optional)
-// @return Stored value as string, or default/nil if not found
+// @return Stored value (integer, number or string), or default/nil if not found
 // @example
 // local brightness = ez.storage.get_pref("brightness", "200")
 // local volume = ez.storage.get_pref("volume", "80")
@@ -821,9 +861,19 @@ LUA_FUNCTION(l_storage_get_pref) {
     LUA_CHECK_ARGC_RANGE(L, 1, 2);
     const char* key = luaL_checkstring(L, 1);
 
-    ensurePrefs();
-
-    if (!prefs.isKey(key)) {
+    // Copy the value out under the cache's lock and push it after: a
+    // Lua allocation error must not unwind past a held mutex
+    PrefValue value;
+    char small[64];
+    char* data = nullptr;
+    bool found = NvsPrefs::instance().read(key, [&](const PrefValue& v) {
+        value = v;
+        if (!v.data) return;
+        data = v.len < sizeof(small) ? small : (char*)heapTagMalloc(HeapTag::STORAGE, v.len);
+        if (data) memcpy(data, v.data, v.len);
+    });
+
+    if (!found) {
         if (lua_gettop(L) >= 2) {
             lua_pushvalue(L, 2);  // Return default
         } else {
@@ -831,59 +881,24 @@ LUA_FUNCTION(l_storage_get_pref) {
         }
         return 1;
     }
-
-    // Get the type of the stored preference and read accordingly.
-    // Picking the right getter matters: each NVS type has its own call
-    // (e.g. getInt only reads PT_I32), and calling the wrong one
-    // silently returns the default. Most notably, Preferences.putBool
-    // uses nvs_set_i8 under the hood, so a stored bool is PT_I8 — not
-    // PT_U8, and not a dedicated bool type.
-    PreferenceType type = prefs.getType(key);
-    switch (type) {
-        case PT_I8:
-            lua_pushinteger(L, prefs.getChar(key, 0));
-            break;
-        case PT_U8:
-            lua_pushinteger(L, prefs.getUChar(key, 0));
-            break;
-        case PT_I16:
-            lua_pushinteger(L, prefs.getShort(key, 0));
-            break;
-        case PT_U16:
-            lua_pushinteger(L, prefs.getUShort(key, 0));
-            break;
-        case PT_I32:
-            lua_pushinteger(L, prefs.getInt(key, 0));
-            break;
-        case PT_U32:
-            lua_pushinteger(L, prefs.getUInt(key, 0));
-            break;
-        case PT_I64:
-            lua_pushinteger(L, (lua_Integer)prefs.getLong64(key, 0));
-            break;
-        case PT_U64:
-            lua_pushinteger(L, (lua_Integer)prefs.getULong64(key, 0));
-            break;
-        case PT_STR:
-            lua_pushstring(L, prefs.getString(key, "").c_str());
-            break;
-        case PT_BLOB:
-            // For blobs, try to read as string
-            lua_pushstring(L, prefs.getString(key, "").c_str());
-            break;
-        default:
-            // Unknown type — fall back to bool read and push as bool.
-            lua_pushboolean(L, prefs.getBool(key, false));
-            break;
+    if (value.data && !data) {
+        return luaL_error(L, "out of memory reading pref %s", key);
     }
+    value.data = data;
+    pushPref(L, value);
+    if (data != small) heapTagFree(HeapTag::STORAGE, data);
     return 1;
 }
 
 // @lua ez.storage.set_pref(key, value) -> boolean
 // @brief Set preference value
-// @description Stores a value in non-volatile storage (NVS). Values persist across
-// reboots. Supports strings, integers, floats, and booleans. The key length is
-// limited to 15 characters.
+// @description Stores a value that persists across reboots. Supports strings
+// (up to 4000 bytes), integers, floats, and booleans (stored as 0/1). The
+// key length is limited to 15 characters. The new value is visible to
+// get_pref at once; it is written to flash once changes have settled
+// (1.5 s after the last, 10 s at most), before a restart or sleep through
+// ez.system, or on flush_prefs(). Setting the value a key already holds
+// writes nothing.
 // @param key Preference key (max 15 chars)
 // @param value Value to store (string, number, or boolean)
 // @return true if saved successfully
@@ -897,12 +912,11 @@ LUA_FUNCTION(l_storage_set_pref) {
     const char* key = luaL_checkstring(L, 1);
 
     // NVS caps key names at 15 chars (NVS_KEY_NAME_MAX_SIZE - 1).
-    // Anything longer is rejected by nvs_set_*, but Arduino's
-    // Preferences library swallows the error and returns 0, so the
-    // setter looks like it worked while the value silently drops on
-    // the floor. We've been bitten by this twice (ui_sounds_enabled,
-    // display_brightness); fail loud here instead.
-    if (strlen(key) > 15) {
+    // Anything longer is rejected by nvs_set_*, and with the write
+    // deferred to the next flush nobody would see that fail; the value
+    // would just be gone after a reboot. We've been bitten by this twice
+    // (ui_sounds_enabled, display_brightness); fail loud here instead.
+    if (strlen(key) > PrefCache::KEY_MAX) {
         Serial.printf("[Storage] set_pref(\"%s\"): key too long for NVS "
                       "(%u chars, max 15) -- value will not persist\n",
                       key, (unsigned)strlen(key));
@@ -910,39 +924,52 @@ LUA_FUNCTION(l_storage_set_pref) {
         return 1;
     }
 
-    ensurePrefs();
-
-    bool ok = false;
+    PrefValue value;
+    bool coerced = false;
     // Dispatch on the value's actual Lua type, not on the convertible-to
     // type: lua_isnumber("1") and lua_isstring(1) are both true, which
     // used to route a string "1" into putFloat() — stored as a blob,
     // then read back as an empty string. Using lua_type pins us to what
-    // the caller actually passed.
+    // the caller actually passed. The NVS types are the ones Preferences
+    // used (bool as int8, integer as int32, float as a 4-byte blob), so
+    // prefs written by older firmware read back unchanged.
     int t = lua_type(L, 2);
     if (t == LUA_TBOOLEAN) {
-        ok = prefs.putBool(key, lua_toboolean(L, 2)) > 0;
+        value = PrefValue::integer(PrefType::I8, lua_toboolean(L, 2) ? 1 : 0);
     } else if (t == LUA_TNUMBER) {
         if (lua_isinteger(L, 2)) {
-            ok = prefs.putInt(key, lua_tointeger(L, 2)) > 0;
+            value = PrefValue::integer(PrefType::I32, (int32_t)lua_tointeger(L, 2));
         } else {
-            ok = prefs.putFloat(key, lua_tonumber(L, 2)) > 0;
+            value = PrefValue::number((float)lua_tonumber(L, 2));
         }
-    } else if (t == LUA_TSTRING) {
-        ok = prefs.putString(key, lua_tostring(L, 2)) > 0;
     } else {
         // Nil / tables / userdata — coerce to a string representation.
-        ok = prefs.putString(key, luaL_tolstring(L, 2, nullptr)) > 0;
-        lua_pop(L, 1);
+        size_t len = 0;
+        coerced = t != LUA_TSTRING;
+        const char* str = coerced ? luaL_tolstring(L, 2, &len) : lua_tolstring(L, 2, &len);
+        // NVS strings end at the first NUL
+        len = strnlen(str, len);
+        if (len > PrefCache::VALUE_MAX) {
+            Serial.printf("[Storage] set_pref(\"%s\"): %u byte value is over the "
+                          "NVS limit (%u) -- not stored\n",
+                          key, (unsigned)len, (unsigned)PrefCache::VALUE_MAX);
+            lua_pushboolean(L, false);
+            return 1;
+        }
+        value = PrefValue::string(str, len);
     }
 
+    bool ok = NvsPrefs::instance().set(key, value);
+    if (coerced) lua_pop(L, 1);
     lua_pushboolean(L, ok);
     return 1;
 }
 
 // @lua ez.storage.remove_pref(key) -> boolean
 // @brief Remove a preference
-// @description Deletes a single preference from non-volatile storage. Use
-// clear_prefs() to remove all preferences at once.
+// @description Deletes a single preference. Like set_pref, the flash
+// entry is erased with the next write-back. Use clear_prefs() to remove
+// all preferences at once.
 // @param key Preference key to remove
 // @return true if preference was removed
 // @example
@@ -952,16 +979,15 @@ LUA_FUNCTION(l_storage_remove_pref) {
     LUA_CHECK_ARGC(L, 1);
     const char* key = luaL_checkstring(L, 1);
 
-    ensurePrefs();
-    lua_pushboolean(L, prefs.remove(key));
+    lua_pushboolean(L, NvsPrefs::instance().remove(key));
     return 1;
 }
 
 // @lua ez.storage.clear_prefs() -> boolean
 // @brief Clear all preferences
-// @description Removes all stored preferences from non-volatile storage. Use with
-// caution - this resets all settings to defaults. Useful for factory reset
-// functionality.
+// @description Removes all stored preferences from non-volatile storage
+// immediately, including changes not yet written. Use with caution - this
+// resets all settings to defaults. Useful for factory reset functionality.
 // @return true if all preferences were cleared
 // @example
 // -- Factory reset
@@ -969,65 +995,79 @@ LUA_FUNCTION(l_storage_remove_pref) {
 // print("All settings reset to defaults")
 // @end
 LUA_FUNCTION(l_storage_clear_prefs) {
-    ensurePrefs();
-    lua_pushboolean(L, prefs.clear());
+    lua_pushboolean(L, NvsPrefs::instance().clear());
+    return 1;
+}
+
+// @lua ez.storage.flush_prefs() -> boolean
+// @brief Write pending preference changes to flash now
+// @description set_pref and remove_pref changes are written back in
+// batches once they settle, and ez.system flushes before restarting or
+// sleeping. Call this before cutting power some other way, or to be sure
+// a value has reached flash.
+// @return true if every pending change was written
+// @example
+// ez.storage.set_pref("radio_region", 1)
+// ez.storage.flush_prefs()
+// @end
+LUA_FUNCTION(l_storage_flush_prefs) {
+    lua_pushboolean(L, NvsPrefs::instance().flush());
     return 1;
 }
 
 // @lua ez.storage.list_prefs() -> table
 // @brief Enumerate every pref in the lua_storage namespace
-// @description Returns an array of { key = "...", type = "bool" | "int" |
-// "string" | "float" | "blob" } for every key currently stored in NVS
-// under the Lua prefs namespace. Used by the developer prefs editor
-// to show all keys — including ones not declared in the system-prefs
-// registry.
+// @description Returns an array of { key = "...", type = "int8" | "int32" |
+// "string" | "blob" | ... } for every key currently set under the Lua
+// prefs namespace, including changes not yet written to flash. Used by
+// the developer prefs editor to show all keys — including ones not
+// declared in the system-prefs registry.
 // @return Array of {key, type} tables
 // @end
 LUA_FUNCTION(l_storage_list_prefs) {
-    ensurePrefs();
-    lua_newtable(L);
+    // Report the exact NVS storage type so the editor can pick a
+    // matching setter and display accurate metadata. Booleans are
+    // stored as int8 — the editor treats int8/uint8 as bool-ish
+    // (0/non-zero) when it makes sense, but the type label itself stays
+    // honest about what's on disk, so floats (4-byte blobs) are "blob".
+    struct Listed {
+        char key[PrefCache::KEY_MAX + 1];
+        PrefType type;
+    };
+    std::vector<Listed> keys;
+    NvsPrefs::instance().list([&](const char* key, const PrefValue& v) {
+        Listed e;
+        snprintf(e.key, sizeof(e.key), "%s", key);
+        e.type = v.type;
+        keys.push_back(e);
+    });
+
+    lua_createtable(L, (int)keys.size(), 0);
     int index = 0;
-
-    // The ESP32 Preferences library opens NVS in the "nvs" partition
-    // and its own namespace (here "lua_storage"). Older arduino-esp32
-    // (ESP-IDF 4.x) exposes the iterator via a return value rather
-    // than an out-param, so advance with `nvs_entry_next(it)` returning
-    // the next iterator.
-    nvs_iterator_t it = nvs_entry_find("nvs", "lua_storage", NVS_TYPE_ANY);
-    while (it != nullptr) {
-        nvs_entry_info_t info;
-        nvs_entry_info(it, &info);
-
-        // Report the exact NVS storage type so the editor can pick a
-        // matching setter and display accurate metadata. Booleans are
-        // stored as int8 by Preferences.putBool — the editor treats
-        // int8/uint8 as bool-ish (0/non-zero) when it makes sense, but
-        // the type label itself stays honest about what's on disk.
+    for (const Listed& e : keys) {
         const char* typeStr = "unknown";
-        switch (info.type) {
-            case NVS_TYPE_I8:     typeStr = "int8";   break;
-            case NVS_TYPE_U8:     typeStr = "uint8";  break;
-            case NVS_TYPE_I16:    typeStr = "int16";  break;
-            case NVS_TYPE_U16:    typeStr = "uint16"; break;
-            case NVS_TYPE_I32:    typeStr = "int32";  break;
-            case NVS_TYPE_U32:    typeStr = "uint32"; break;
-            case NVS_TYPE_I64:    typeStr = "int64";  break;
-            case NVS_TYPE_U64:    typeStr = "uint64"; break;
-            case NVS_TYPE_STR:    typeStr = "string"; break;
-            case NVS_TYPE_BLOB:   typeStr = "blob";   break;
+        switch (e.type) {
+            case PrefType::I8:    typeStr = "int8";   break;
+            case PrefType::U8:    typeStr = "uint8";  break;
+            case PrefType::I16:   typeStr = "int16";  break;
+            case PrefType::U16:   typeStr = "uint16"; break;
+            case PrefType::I32:   typeStr = "int32";  break;
+            case PrefType::U32:   typeStr = "uint32"; break;
+            case PrefType::I64:   typeStr = "int64";  break;
+            case PrefType::U64:   typeStr = "uint64"; break;
+            case PrefType::STR:   typeStr = "string"; break;
+            case PrefType::FLOAT:
+            case PrefType::BLOB:  typeStr = "blob";   break;
             default:              typeStr = "unknown"; break;
         }
 
         lua_newtable(L);
-        lua_pushstring(L, info.key);
+        lua_pushstring(L, e.key);
         lua_setfield(L, -2, "key");
         lua_pushstring(L, typeStr);
         lua_setfield(L, -2, "type");
         lua_rawseti(L, -2, ++index);
-
-        it = nvs_entry_next(it);
     }
-    // No release needed when the iterator has already walked to NULL.
     return 1;
 }
 
@@ -1110,114 +1150,16 @@ LUA_FUNCTION(l_storage_get_flash_info) {
     return 1;
 }
 
-// Helper: Convert Lua value to JSON
-static void luaToJson(lua_State* L, int idx, JsonVariant json);
-static void luaTableToJson(lua_State* L, int idx, JsonVariant json) {
-    // Check if array or object by looking at keys
-    bool isArray = true;
-    lua_Integer maxIdx = 0;
-
-    lua_pushnil(L);
-    while (lua_next(L, idx) != 0) {
-        if (lua_type(L, -2) != LUA_TNUMBER || !lua_isinteger(L, -2)) {
-            isArray = false;
-            lua_pop(L, 2);
-            break;
-        }
-        lua_Integer i = lua_tointeger(L, -2);
-        if (i > maxIdx) maxIdx = i;
-        lua_pop(L, 1);
-    }
-
-    if (isArray && maxIdx > 0) {
-        JsonArray arr = json.to<JsonArray>();
-        for (lua_Integer i = 1; i <= maxIdx; i++) {
-            lua_rawgeti(L, idx, i);
-            JsonVariant elem = arr.add<JsonVariant>();
-            luaToJson(L, lua_gettop(L), elem);
-            lua_pop(L, 1);
-        }
-    } else {
-        JsonObject obj = json.to<JsonObject>();
-        lua_pushnil(L);
-        while (lua_next(L, idx) != 0) {
-            const char* key = lua_tostring(L, -2);
-            if (key) {
-                JsonVariant val = obj[key].to<JsonVariant>();
-                luaToJson(L, lua_gettop(L), val);
-            }
-            lua_pop(L, 1);
-        }
-    }
-}
-
-static void luaToJson(lua_State* L, int idx, JsonVariant json) {
-    int absIdx = lua_absindex(L, idx);
-    switch (lua_type(L, absIdx)) {
-        case LUA_TNIL:
-            json.set(nullptr);
-            break;
-        case LUA_TBOOLEAN:
-            json.set(lua_toboolean(L, absIdx) != 0);
-            break;
-        case LUA_TNUMBER:
-            if (lua_isinteger(L, absIdx)) {
-                json.set(lua_tointeger(L, absIdx));
-            } else {
-                json.set(lua_tonumber(L, absIdx));
-            }
-            break;
-        case LUA_TSTRING:
-            json.set(lua_tostring(L, absIdx));
-            break;
-        case LUA_TTABLE:
-            luaTableToJson(L, absIdx, json);
-            break;
-        default:
-            json.set(nullptr);
-            break;
-    }
-}
-
-// Helper: Convert JSON to Lua value
-static void jsonToLua(lua_State* L, JsonVariantConst json) {
-    if (json.isNull()) {
-        lua_pushnil(L);
-    } else if (json.is<bool>()) {
-        lua_pushboolean(L, json.as<bool>());
-    } else if (json.is<long long>()) {
-        lua_pushinteger(L, json.as<long long>());
-    } else if (json.is<double>()) {
-        lua_pushnumber(L, json.as<double>());
-    } else if (json.is<const char*>()) {
-        lua_pushstring(L, json.as<const char*>());
-    } else if (json.is<JsonArrayConst>()) {
-        JsonArrayConst arr = json.as<JsonArrayConst>();
-        lua_createtable(L, arr.size(), 0);
-        int i = 1;
-        for (JsonVariantConst elem : arr) {
-            jsonToLua(L, elem);
-            lua_rawseti(L, -2, i++);
-        }
-    } else if (json.is<JsonObjectConst>()) {
-        JsonObjectConst obj = json.as<JsonObjectConst>();
-        lua_createtable(L, 0, obj.size());
-        for (JsonPairConst kv : obj) {
-            jsonToLua(L, kv.value());
-            lua_setfield(L, -2, kv.key().c_str());
-        }
-    } else {
-        lua_pushnil(L);
-    }
-}
-
 // @lua ez.storage.json_encode(value) -> string
 // @brief Encode Lua value to JSON string
 // @description Converts a Lua value to a JSON string. Supports tables (converted
 // to arrays or objects), strings, numbers, booleans, and nil. Nested tables are
-// supported. Useful for saving configuration or sending data over network.
+// supported. A table is an array when all its keys are positive integers and it
+// isn't too sparse; empty tables encode as {}. Functions and other values JSON
+// can't hold become null. To save a large table, json_write_file() streams it
+// to disk without building the string.
 // @param value Lua table, string, number, boolean, or nil
-// @return JSON string
+// @return JSON string, or nil with error message (e.g. cyclic table)
 // @example
 // local data = {
 //     name = "Alice",
@@ -1230,22 +1172,28 @@ static void jsonToLua(lua_State* L, JsonVariantConst json) {
 LUA_FUNCTION(l_storage_json_encode) {
     LUA_CHECK_ARGC(L, 1);
 
-    JsonDocument doc;
-    JsonVariant root = doc.to<JsonVariant>();
-    luaToJson(L, 1, root);
-
-    String output;
-    serializeJson(doc, output);
-    lua_pushstring(L, output.c_str());
+    size_t len = 0;
+    const char* err = nullptr;
+    char* json = luaJsonEncodeToBlock(L, 1, &len, &err);
+    if (!json) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    heapTagAdopt(HeapTag::STORAGE, json);
+    lua_pushlstring(L, json, len);
+    heapTagFree(HeapTag::STORAGE, json);
     return 1;
 }
 
-// @lua ez.storage.json_decode(json_string) -> value
+// @lua ez.storage.json_decode(json) -> value
 // @brief Decode JSON string to Lua value
-// @description Parses a JSON string and returns the corresponding Lua value.
+// @description Parses JSON text and returns the corresponding Lua value.
 // JSON objects become Lua tables, arrays become indexed tables, and primitives
-// become their Lua equivalents. Returns nil with error message on parse failure.
-// @param json_string JSON string to parse
+// become their Lua equivalents (null becomes nil). Tables are built directly
+// while parsing, with no intermediate document or size limit. Accepts a string
+// or an ez.buffer. Returns nil with error message on parse failure.
+// @param json JSON text (string or buffer)
 // @return Lua value (table, string, number, boolean, or nil), or nil with error
 // @example
 // local json = ez.storage.read_file("/config.json")
@@ -1258,18 +1206,89 @@ LUA_FUNCTION(l_storage_json_encode) {
 // @end
 LUA_FUNCTION(l_storage_json_decode) {
     LUA_CHECK_ARGC(L, 1);
-    const char* json = luaL_checkstring(L, 1);
+    size_t len;
+    const char* json = (const char*)buffer_bindings::checkBytes(L, 1, &len);
+
+    if (!luaJsonDecode(L, json, len)) {
+        lua_pushnil(L);
+        lua_insert(L, -2);
+        return 2;
+    }
+    return 1;
+}
+
+// Chunk sink for json_write_file
+static bool fileSink(void* ctx, const char* data, size_t len) {
+    return static_cast<File*>(ctx)->write((const uint8_t*)data, len) == len;
+}
+
+// @lua ez.storage.json_write_file(path, value) -> boolean
+// @brief Encode a Lua value as JSON straight into a file
+// @description Streams the encoded JSON to the file in 4 KB chunks as it walks
+// the table, so saving a large table (message history, settings) never holds
+// the whole text in memory. Same encoding rules as json_encode(). The JSON
+// goes to <path>.tmp first and replaces the file only once it is complete,
+// so a failed encode, a full disk or a reset leaves the old file intact.
+// @param path File path (prefix /sd/ for SD card)
+// @param value Lua value to encode
+// @return true on success, or nil with error message
+// @example
+// ez.storage.json_write_file("/fs/history.json", history)
+// @end
+LUA_FUNCTION(l_storage_json_write_file) {
+    LUA_CHECK_ARGC(L, 2);
+    const char* path = luaL_checkstring(L, 1);
 
-    JsonDocument doc;
-    DeserializationError err = deserializeJson(doc, json);
+    const char* adjustedPath;
+    fs::FS* fs = getFS(path, &adjustedPath);
+    if (!fs) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Storage not available");
+        return 2;
+    }
+    char tmpPath[260];
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", adjustedPath) >= (int)sizeof(tmpPath)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Path too long");
+        return 2;
+    }
 
-    if (err) {
+    // The chunk buffer lives in the heap, not on the 10 KB loop stack
+    const size_t CHUNK = 4096;
+    char* chunk = (char*)heapTagMalloc(HeapTag::STORAGE, CHUNK);
+    if (!chunk) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Out of memory");
+        return 2;
+    }
+    File file = fs->open(tmpPath, FILE_WRITE);
+    if (!file) {
+        heapTagFree(HeapTag::STORAGE, chunk);
         lua_pushnil(L);
-        lua_pushstring(L, err.c_str());
+        lua_pushstring(L, "Cannot open file");
         return 2;
     }
+    JsonWriter writer(chunk, CHUNK, fileSink, &file);
+    const char* err = nullptr;
+    bool ok = luaJsonEncode(L, 2, writer, &err) && writer.finish();
+    heapTagFree(HeapTag::STORAGE, chunk);
+    file.close();
+
+    // FAT won't rename over an existing file; LittleFS replaces it in one step
+    if (ok && fs != &LittleFS && fs->exists(adjustedPath)) fs->remove(adjustedPath);
+    if (ok && !fs->rename(tmpPath, adjustedPath)) {
+        err = "Cannot replace file";
+        ok = false;
+    }
+    if (!ok) fs->remove(tmpPath);
+    FileHandleCache::instance().invalidate(*fs, adjustedPath);
 
-    jsonToLua(L, doc.as<JsonVariantConst>());
+    if (!ok) {
+        lua_pushnil(L);
+        lua_pushstring(L, err ? err : "Write failed");
+        return 2;
+    }
+    lua_pushboolean(L, true);
     return 1;
 }
 
@@ -1329,6 +1348,7 @@ LUA_FUNCTION(l_storage_copy_file) {
 
     srcFile.close();
     dstFile.close();
+    FileHandleCache::instance().invalidate(*dstFs, dstPath);
 
     lua_pushboolean(L, success);
     return 1;
@@ -1365,6 +1385,113 @@ LUA_FUNCTION(l_storage_get_free_space) {
     return 1;
 }
 
+// @lua ez.storage.get_cache_stats() -> table
+// @brief Counters for the file-handle, SD block and preference caches
+// @description read_bytes, file_size and async_read_bytes keep recently
+// read files open (up to 2 on SD, 2 on flash) so repeated reads skip the
+// open. Writes, renames and removes through ez.storage and the async
+// functions drop the affected handles; any handle is reopened after 5 s.
+// Underneath, sectors read from the SD card are kept in a PSRAM block
+// cache with read-ahead for files read front to back; writes go straight
+// through to the card. Counts in blocks are sectors (512 bytes) unless
+// noted. Preferences are held in RAM and written back to NVS in batches
+// (see set_pref).
+// @return Table with handles = {opens_avoided, opens, evictions,
+// invalidations, expired, bypassed} and blocks = {enabled, bytes, hits,
+// misses, readahead, readahead_used, readahead_wasted (blocks), bypassed,
+// written, device_reads, device_writes, evictions (blocks), invalidations,
+// window (read-ahead cap in 4 KB blocks)} and prefs = {keys, dirty (not yet
+// written), bytes, reads, misses, changes, unchanged (sets of the value
+// already held), flushes, stored, erased, failures}
+// @example
+// local h = ez.storage.get_cache_stats().handles
+// print(h.opens_avoided .. " opens avoided, " .. h.opens .. " opens")
+// local b = ez.storage.get_cache_stats().blocks
+// print(string.format("SD hit rate %.1f%%", 100 * b.hits / math.max(1, b.hits + b.misses)))
+// @end
+LUA_FUNCTION(l_storage_get_cache_stats) {
+    HandleCacheStats hs;
+    FileHandleCache::instance().getStats(hs);
+    lua_newtable(L);
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, hs.hits);
+    lua_setfield(L, -2, "opens_avoided");
+    lua_pushinteger(L, hs.opens);
+    lua_setfield(L, -2, "opens");
+    lua_pushinteger(L, hs.evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushinteger(L, hs.invalidations);
+    lua_setfield(L, -2, "invalidations");
+    lua_pushinteger(L, hs.expired);
+    lua_setfield(L, -2, "expired");
+    lua_pushinteger(L, hs.bypassed);
+    lua_setfield(L, -2, "bypassed");
+    lua_setfield(L, -2, "handles");
+
+    SdBlockCache& sd = SdBlockCache::instance();
+    BlockCacheStats bs;
+    sd.getStats(bs);
+    lua_createtable(L, 0, 15);
+    lua_pushboolean(L, sd.installed());
+    lua_setfield(L, -2, "enabled");
+    lua_pushinteger(L, (lua_Integer)sd.memoryBytes());
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, bs.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, bs.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, bs.readahead);
+    lua_setfield(L, -2, "readahead");
+    lua_pushinteger(L, bs.readaheadUsed);
+    lua_setfield(L, -2, "readahead_used");
+    lua_pushinteger(L, bs.readaheadWasted);
+    lua_setfield(L, -2, "readahead_wasted");
+    lua_pushinteger(L, bs.bypassed);
+    lua_setfield(L, -2, "bypassed");
+    lua_pushinteger(L, bs.written);
+    lua_setfield(L, -2, "written");
+    lua_pushinteger(L, bs.deviceReads);
+    lua_setfield(L, -2, "device_reads");
+    lua_pushinteger(L, bs.deviceWrites);
+    lua_setfield(L, -2, "device_writes");
+    lua_pushinteger(L, bs.evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushinteger(L, bs.invalidations);
+    lua_setfield(L, -2, "invalidations");
+    lua_pushinteger(L, bs.window);
+    lua_setfield(L, -2, "window");
+    lua_setfield(L, -2, "blocks");
+
+    NvsPrefs& prefs = NvsPrefs::instance();
+    PrefCacheStats ps;
+    prefs.getStats(ps);
+    lua_createtable(L, 0, 11);
+    lua_pushinteger(L, ps.keys);
+    lua_setfield(L, -2, "keys");
+    lua_pushinteger(L, ps.dirty);
+    lua_setfield(L, -2, "dirty");
+    lua_pushinteger(L, (lua_Integer)prefs.memoryBytes());
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, ps.reads);
+    lua_setfield(L, -2, "reads");
+    lua_pushinteger(L, ps.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, ps.changes);
+    lua_setfield(L, -2, "changes");
+    lua_pushinteger(L, ps.unchanged);
+    lua_setfield(L, -2, "unchanged");
+    lua_pushinteger(L, ps.flushes);
+    lua_setfield(L, -2, "flushes");
+    lua_pushinteger(L, ps.stored);
+    lua_setfield(L, -2, "stored");
+    lua_pushinteger(L, ps.erased);
+    lua_setfield(L, -2, "erased");
+    lua_pushinteger(L, ps.failures);
+    lua_setfield(L, -2, "failures");
+    lua_setfield(L, -2, "prefs");
+    return 1;
+}
+
 // @lua ez.storage.list_embedded(prefix) -> table
 // @brief List embedded script paths
 // @description Returns a list of all embedded Lua scripts. These are scripts
@@ -1480,13 +1607,16 @@ static const luaL_Reg storage_funcs[] = {
     {"set_pref",        l_storage_set_pref},
     {"remove_pref",     l_storage_remove_pref},
     {"clear_prefs",     l_storage_clear_prefs},
+    {"flush_prefs",     l_storage_flush_prefs},
     {"is_sd_available", l_storage_is_sd_available},
     {"get_sd_info",     l_storage_get_sd_info},
     {"get_flash_info",  l_storage_get_flash_info},
     {"json_encode",     l_storage_json_encode},
     {"json_decode",     l_storage_json_decode},
+    {"json_write_file", l_storage_json_write_file},
     {"copy_file",       l_storage_copy_file},
     {"get_free_space",  l_storage_get_free_space},
+    {"get_cache_stats", l_storage_get_cache_stats},
     // Embedded script functions
     {"list_embedded",   l_storage_list_embedded},
     {"read_embedded",   l_storage_read_embedded},
@@ -4,8 +4,15 @@
 #include "../lua_bindings.h"
 #include "../lua_runtime.h"
 #include "../embedded_scripts.h"
+#include "../script_loader.h"
+#include "../frame_stats.h"
+#include "../scheduler.h"
+#include "../worker.h"
 #include "../../hardware/usb_msc.h"
+#include "../../util/heap_tags.h"
 #include "../../util/log.h"
+#include "../../util/nvs_prefs.h"
+#include "../../util/timer_wheel.h"
 #include "ota_bindings.h"
 #include <Arduino.h>
 #include <esp_heap_caps.h>
@@ -18,6 +25,7 @@
 #include <LittleFS.h>
 #include <SD.h>
 #include <sys/time.h>
+#include <vector>
 
 // @module ez.system
 // @brief System utilities, timers, memory info, and power management
@@ -87,30 +95,16 @@
 
 // =============================================================================
 
-// Timer entry for scheduled callbacks
-struct TimerEntry {
-    int callbackRef;     // Registry reference to Lua callback
-    uint32_t interval;   // Interval in ms (0 for one-shot)
-    uint32_t nextTrigger;
-    bool active;
-};
-
-// Simple timer pool (limited number of active timers)
-static constexpr int MAX_TIMERS = 16;
-static TimerEntry timers[MAX_TIMERS];
-static int nextTimerId = 1;
-// timerLuaState uses LUA_STATE macro (main state) to avoid dangling pointers
+// Lua timers: the wheel's payload is the registry ref of the callback.
+// Pool-backed, so there is no fixed timer limit.
+// Callbacks run on LUA_STATE (main state) to avoid dangling pointers
 // when timers are registered from coroutines that later get garbage collected.
-// Previously this stored the registering coroutine's lua_State* which would
-// become invalid after the coroutine was collected.
-
-// Deferred coroutine queue - coroutines yielded via defer() are resumed next frame
-static constexpr int MAX_DEFERRED = 16;
-static int deferredCoroutines[MAX_DEFERRED];
-static int deferredCount = 0;
+static TimerWheel luaTimers;
+static bool timersRunning = false;  // advance() is not re-entrant
 
 // Forward declarations
 void processLuaTimers();
+bool luaTimersNextDue(uint32_t now, uint32_t& ms);
 
 // @lua ez.system.millis() -> integer
 // @brief Returns milliseconds since boot
@@ -129,6 +123,22 @@ LUA_FUNCTION(l_system_millis) {
     return 1;
 }
 
+// @lua ez.system.micros() -> integer
+// @brief Returns microseconds since boot
+// @description Microsecond counterpart of millis() for timing short
+// operations such as module loads. Wraps around roughly every 71 minutes;
+// subtract two readings taken close together.
+// @return Microseconds elapsed since device started
+// @example
+// local t0 = ez.system.micros()
+// require("services.gps")
+// print("gps loaded in", ez.system.micros() - t0, "us")
+// @end
+LUA_FUNCTION(l_system_micros) {
+    lua_pushinteger(L, micros());
+    return 1;
+}
+
 // @lua ez.system.delay(ms)
 // @brief Blocking delay execution
 // @description Pauses execution for the specified duration. Blocks all Lua code
@@ -161,33 +171,19 @@ LUA_FUNCTION(l_system_set_timer) {
     LUA_CHECK_ARGC(L, 2);
     int ms = luaL_checkinteger(L, 1);
     luaL_checktype(L, 2, LUA_TFUNCTION);
-
-    // Find free timer slot
-    int slot = -1;
-    for (int i = 0; i < MAX_TIMERS; i++) {
-        if (!timers[i].active) {
-            slot = i;
-            break;
-        }
-    }
-
-    if (slot < 0) {
-        return luaL_error(L, "No free timer slots");
-    }
+    if (ms < 0) ms = 0;
 
     // Store callback in registry
     lua_pushvalue(L, 2);
     int ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    // Set up timer
-    timers[slot].callbackRef = ref;
-    timers[slot].interval = 0;  // One-shot
-    timers[slot].nextTrigger = millis() + ms;
-    timers[slot].active = true;
+    TimerWheel::Id id = luaTimers.schedule(millis(), ms, 0, ref);
+    if (id == 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "Too many timers");
+    }
 
-    // Return timer ID (slot + base)
-    int timerId = nextTimerId++;
-    lua_pushinteger(L, timerId);
+    lua_pushinteger(L, id);
     return 1;
 }
 
@@ -208,30 +204,17 @@ LUA_FUNCTION(l_system_set_interval) {
         return luaL_error(L, "Interval must be >= 10ms");
     }
 
-    // Find free timer slot
-    int slot = -1;
-    for (int i = 0; i < MAX_TIMERS; i++) {
-        if (!timers[i].active) {
-            slot = i;
-            break;
-        }
-    }
-
-    if (slot < 0) {
-        return luaL_error(L, "No free timer slots");
-    }
-
     // Store callback in registry
     lua_pushvalue(L, 2);
     int ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    // Set up repeating timer
-    timers[slot].callbackRef = ref;
-    timers[slot].interval = ms;
-    timers[slot].nextTrigger = millis() + ms;
-    timers[slot].active = true;
+    TimerWheel::Id id = luaTimers.schedule(millis(), ms, ms, ref);
+    if (id == 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "Too many timers");
+    }
 
-    lua_pushinteger(L, slot);
+    lua_pushinteger(L, id);
     return 1;
 }
 
@@ -248,41 +231,36 @@ LUA_FUNCTION(l_system_set_interval) {
 // @end
 LUA_FUNCTION(l_system_cancel_timer) {
     LUA_CHECK_ARGC(L, 1);
-    int slot = luaL_checkinteger(L, 1);
+    lua_Integer id = luaL_checkinteger(L, 1);
 
-    if (slot >= 0 && slot < MAX_TIMERS && timers[slot].active) {
-        luaL_unref(L, LUA_REGISTRYINDEX, timers[slot].callbackRef);
-        timers[slot].active = false;
+    int ref;
+    if (id > 0 && luaTimers.cancel((TimerWheel::Id)id, &ref)) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
     }
 
     return 0;
 }
 
-// @lua defer()
-// @brief Yield the current coroutine and resume it on the next frame
-// @description Cooperative yield for coroutines. The coroutine is suspended and
-// automatically resumed on the next main loop iteration, after async I/O
-// completions are processed. Enables polling patterns and parallel async work.
-// Must be called from within a coroutine (spawn/async context).
+// @lua ez.system.get_next_timer() -> integer|nil
+// @brief Milliseconds until the next timer or scheduled coroutine is due
+// @description Returns 0 when a coroutine is ready to run on the next frame,
+// otherwise the time until the earliest pending timer or wait_ms() wake-up
+// (timers exact within 64 ms, a lower bound beyond that), or nil if nothing
+// is scheduled. Lets
+// custom loops sleep exactly as long as they can.
+// @return Milliseconds until something is due, or nil
 // @example
-// -- Wait for a condition without blocking
-// while not ready do defer() end
+// local wait = ez.system.get_next_timer()
+// if wait and wait > 5 then ez.system.yield(math.min(wait, 100)) end
 // @end
-LUA_FUNCTION(l_defer) {
-    if (!lua_isyieldable(L)) {
-        return luaL_error(L, "defer() must be called from a coroutine");
-    }
-
-    if (deferredCount >= MAX_DEFERRED) {
-        return luaL_error(L, "defer queue full");
+LUA_FUNCTION(l_system_get_next_timer) {
+    uint32_t ms;
+    if (!luaTimersNextDue(millis(), ms)) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, ms);
     }
-
-    // Store coroutine reference for resumption on next frame
-    lua_pushthread(L);
-    int coroRef = luaL_ref(L, LUA_REGISTRYINDEX);
-    deferredCoroutines[deferredCount++] = coroRef;
-
-    return lua_yield(L, 0);
+    return 1;
 }
 
 // @lua ez.system.get_battery_percent() -> integer
@@ -390,7 +368,9 @@ LUA_FUNCTION(l_system_get_total_psram) {
 // @brief Log message to serial output
 // @description Sends a log message to the serial console. Messages are prefixed
 // with #LOG#[Lua] for easy filtering. Use for debugging during development.
-// Also available as ez.log() shorthand for convenience.
+// Also available as ez.log() shorthand for convenience. Goes through the
+// same binary log ring as C++ LOG() calls, so it shows up in /logs and the
+// persistent log file too; messages longer than 200 bytes are cut.
 // @param message Text to log
 // @example
 // ez.log("Starting initialization")
@@ -399,16 +379,39 @@ LUA_FUNCTION(l_system_get_total_psram) {
 LUA_FUNCTION(l_system_log) {
     LUA_CHECK_ARGC(L, 1);
     const char* msg = luaL_checkstring(L, 1);
-    // Prefix with #LOG# so remote control client can filter out log lines
-    Serial.printf("#LOG#[Lua] %s\n", msg);
-    // Tee into the same in-memory ring that LOG() uses so Lua-side
-    // messages flow through the /logs endpoint and the persistent
-    // log file -- previously they only hit Serial and disappeared on
-    // reboot.
-    log_buffer_appendf("[Lua] ", "%s", msg);
+    LOG("Lua", "%s", msg);
     return 0;
 }
 
+// @lua ez.system.get_log_stats() -> table
+// @brief Counters for the binary log ring
+// @description LOG() calls and ez.log() record raw arguments into a
+// lock-free ring; a printer task formats them later for Serial, /logs and
+// drain_logs(). Returns records (written since boot), bytes (binary bytes
+// written), lost_bytes (overwritten before they were formatted -- the
+// printer fell a whole ring behind), dropped (records logged before the
+// ring was allocated) and pending (binary bytes not formatted yet).
+// @example
+// local s = ez.system.get_log_stats()
+// if s.lost_bytes > 0 then print("log ring overran") end
+// @end
+LUA_FUNCTION(l_system_get_log_stats) {
+    LogStats st;
+    log_get_stats(st);
+    lua_newtable(L);
+    lua_pushinteger(L, st.records);
+    lua_setfield(L, -2, "records");
+    lua_pushinteger(L, st.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, st.lostBytes);
+    lua_setfield(L, -2, "lost_bytes");
+    lua_pushinteger(L, st.dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, st.pending);
+    lua_setfield(L, -2, "pending");
+    return 1;
+}
+
 // @lua ez.system.get_reset_reason() -> string
 // @brief Why the device most recently rebooted
 // @description Returns one of "power_on", "panic", "task_wdt",
@@ -544,6 +547,10 @@ LUA_FUNCTION(l_system_restart) {
     // dev OTA server first so its accept/write loops don't trap us.
     ota_bindings::shutdown();
 
+    // The shutdown handler would flush too, but with a 100 ms grace on
+    // the lock; here nothing else is going to hold it that long
+    NvsPrefs::instance().flush();
+
     esp_restart();
 
     // esp_restart() should never return. If it does (driver bug,
@@ -831,7 +838,8 @@ LUA_FUNCTION(l_system_gc) {
 // @lua ez.system.gc_step(steps) -> integer
 // @brief Perform incremental garbage collection
 // @description Runs a limited number of GC steps without completing a full cycle.
-// Used by the main loop to spread GC work across frames, preventing frame drops.
+// The main loop already steps the collector within each frame's idle budget
+// (see set_gc_budget), so this is only needed inside long-running scripts.
 // @param steps Number of GC steps (default 10)
 // @return 1 if collection finished, 0 if more work needed
 // @example
@@ -844,6 +852,316 @@ LUA_FUNCTION(l_system_gc_step) {
     return 1;
 }
 
+// @lua ez.system.set_gc_budget(us)
+// @brief Set the per-frame incremental GC budget
+// @description After each frame renders, the main loop runs incremental GC
+// steps for up to this many microseconds. When a loop delay is set, the idle
+// time before the next frame is used instead if it is longer (capped at 8 ms).
+// Steps are skipped while keys or touches are arriving.
+// @param us Budget in microseconds (default 1000)
+// @example
+// ez.system.set_gc_budget(500)  -- Tighter budget for an animation-heavy screen
+// @end
+LUA_FUNCTION(l_system_set_gc_budget) {
+    lua_Integer us = luaL_checkinteger(L, 1);
+    if (us < 0) us = 0;
+    if (us > 20000) us = 20000;
+    LuaRuntime::instance().setGCBudget((uint32_t)us);
+    return 0;
+}
+
+// @lua ez.system.set_gc_threshold(bytes)
+// @brief Set the heap size that triggers a full garbage collection
+// @description Full collections stall the frame they run in, so the main loop
+// only does one when Lua memory crosses this threshold. If live data alone is
+// close to the threshold, the next full collect waits until the heap is 1.5x
+// its post-collection size.
+// @param bytes Threshold in bytes (default 4 MB)
+// @example
+// ez.system.set_gc_threshold(2 * 1024 * 1024)
+// @end
+LUA_FUNCTION(l_system_set_gc_threshold) {
+    lua_Integer bytes = luaL_checkinteger(L, 1);
+    if (bytes < 65536) bytes = 65536;
+    LuaRuntime::instance().setGCFullThreshold((size_t)bytes);
+    return 0;
+}
+
+static void pushGCHistogram(lua_State* L, const uint32_t* hist) {
+    lua_createtable(L, LuaRuntime::GC_HIST_BUCKETS, 0);
+    for (int i = 0; i < LuaRuntime::GC_HIST_BUCKETS; i++) {
+        lua_createtable(L, 0, 2);
+        if (i < LuaRuntime::GC_HIST_BUCKETS - 1) {
+            lua_pushinteger(L, LuaRuntime::GC_HIST_BOUNDS_US[i]);
+        } else {
+            lua_pushnumber(L, HUGE_VAL);
+        }
+        lua_setfield(L, -2, "le");
+        lua_pushinteger(L, hist[i]);
+        lua_setfield(L, -2, "count");
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+// @lua ez.system.get_gc_stats(reset) -> table
+// @brief Get frame GC statistics and pause histograms
+// @description Returns counters for the main loop's frame-budgeted collector
+// and two pause histograms (incremental frames and full collects). Each
+// histogram is an array of { le = upper_bound_us, count = n }; the last
+// bucket has le = math.huge.
+// @param reset If true, clear the counters after reading
+// @return Table with frames, steps, cycles, full_collects, skipped_input, max_pause_us, last_pause_us, budget_us, threshold, step_hist, full_hist
+// @example
+// local s = ez.system.get_gc_stats()
+// for _, b in ipairs(s.step_hist) do print(b.le, b.count) end
+// @end
+LUA_FUNCTION(l_system_get_gc_stats) {
+    LuaRuntime& rt = LuaRuntime::instance();
+    // Copy before the optional reset clears them.
+    LuaRuntime::GCStats st = rt.getGCStats();
+    if (lua_toboolean(L, 1)) rt.resetGCStats();
+
+    lua_newtable(L);
+    lua_pushinteger(L, st.frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, st.steps);
+    lua_setfield(L, -2, "steps");
+    lua_pushinteger(L, st.cycles);
+    lua_setfield(L, -2, "cycles");
+    lua_pushinteger(L, st.fullCollects);
+    lua_setfield(L, -2, "full_collects");
+    lua_pushinteger(L, st.skippedInput);
+    lua_setfield(L, -2, "skipped_input");
+    lua_pushinteger(L, st.maxPauseUs);
+    lua_setfield(L, -2, "max_pause_us");
+    lua_pushinteger(L, st.lastPauseUs);
+    lua_setfield(L, -2, "last_pause_us");
+    lua_pushinteger(L, rt.getGCBudget());
+    lua_setfield(L, -2, "budget_us");
+    lua_pushinteger(L, rt.getGCFullThreshold());
+    lua_setfield(L, -2, "threshold");
+    pushGCHistogram(L, st.stepHist);
+    lua_setfield(L, -2, "step_hist");
+    pushGCHistogram(L, st.fullHist);
+    lua_setfield(L, -2, "full_hist");
+    return 1;
+}
+
+static void pushFrameSummary(lua_State* L, const FrameStats::Summary& s) {
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, s.count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, s.p50);
+    lua_setfield(L, -2, "p50");
+    lua_pushinteger(L, s.p95);
+    lua_setfield(L, -2, "p95");
+    lua_pushinteger(L, s.p99);
+    lua_setfield(L, -2, "p99");
+    lua_pushinteger(L, s.max);
+    lua_setfield(L, -2, "max");
+    lua_pushinteger(L, s.avg);
+    lua_setfield(L, -2, "avg");
+}
+
+// @lua ez.system.get_frame_stats(reset) -> table|nil
+// @brief Get per-phase main loop timing percentiles
+// @description Every main loop frame is split into phases: remote, gps,
+// touch, timers, async_io, http, dev_server, bus, lua (main_loop outside the
+// marked sub-phases), input, logic, render, flush, gc, idle (loop delay) and
+// other. Each phase's self time per frame goes into a rolling histogram over
+// the last 256-512 frames. All times are microseconds, with percentiles
+// within 12.5%. `frame` is the whole frame, `busy` the frame minus idle.
+// Returns nil if frame timing is unavailable (no PSRAM).
+// @param reset If true, clear the histograms after reading
+// @return Table with frames, window, fps, frame, busy and phases (name -> { count, p50, p95, p99, max, avg })
+// @example
+// local s = ez.system.get_frame_stats()
+// print("render p95", s.phases.render.p95, "us")
+// @end
+LUA_FUNCTION(l_system_get_frame_stats) {
+    FrameStats& fs = FrameStats::instance();
+    if (!fs.enabled()) {
+        lua_pushnil(L);
+        return 1;
+    }
+    FrameStats::Summary frame = fs.frame();
+
+    lua_newtable(L);
+    lua_pushinteger(L, fs.frames());
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, fs.windowFrames());
+    lua_setfield(L, -2, "window");
+    lua_pushnumber(L, frame.avg ? 1000000.0 / frame.avg : 0.0);
+    lua_setfield(L, -2, "fps");
+    pushFrameSummary(L, frame);
+    lua_setfield(L, -2, "frame");
+    pushFrameSummary(L, fs.busy());
+    lua_setfield(L, -2, "busy");
+    lua_createtable(L, 0, FrameStats::PHASES);
+    for (int i = 0; i < FrameStats::PHASES; i++) {
+        FramePhase p = (FramePhase)i;
+        pushFrameSummary(L, fs.phase(p));
+        lua_setfield(L, -2, FrameStats::phaseName(p));
+    }
+    lua_setfield(L, -2, "phases");
+
+    if (lua_toboolean(L, 1)) fs.reset();
+    return 1;
+}
+
+// @lua ez.system.frame_mark(phase)
+// @brief Attribute the rest of main_loop's time to a phase
+// @description Switches the current frame phase to "input", "logic",
+// "render" or "lua" (unattributed). Only takes effect while main_loop is
+// running; elsewhere (timers, bus handlers) it is ignored. ezui's
+// screen.update marks its input, logic and render steps. No allocation.
+// @param phase Phase name
+// @example
+// ez.system.frame_mark("render")
+// @end
+LUA_FUNCTION(l_system_frame_mark) {
+    FramePhase p;
+    if (!FrameStats::parseLuaPhase(luaL_checkstring(L, 1), p)) {
+        return luaL_argerror(L, 1, "expected input, logic, render or lua");
+    }
+    FrameStats::instance().mark(p);
+    return 0;
+}
+
+// @lua ez.system.load_embedded(path) -> function|nil, string
+// @brief Compile an embedded script straight from flash
+// @description Like load() on the contents of a $ path, without first copying
+// the script into a Lua string: the chunk is read from flash by lua_load
+// directly. Does not run the chunk. Used by load_module for $ paths.
+// @param path Embedded script path (e.g. "$core/modules.lua")
+// @return The compiled chunk, or nil and an error message
+// @example
+// local chunk = assert(ez.system.load_embedded("$ezui/init.lua"))
+// local ui = chunk()
+// @end
+LUA_FUNCTION(l_system_load_embedded) {
+    LUA_CHECK_ARGC(L, 1);
+    const char* path = luaL_checkstring(L, 1);
+    int status = ScriptLoader::instance().loadEmbedded(L, path);
+    if (status == LUA_OK) return 1;
+    lua_pushnil(L);
+    if (status < 0) {
+        lua_pushfstring(L, "not embedded: %s", path);
+    } else {
+        lua_insert(L, -2);  // nil, message
+    }
+    return 2;
+}
+
+// @lua ez.system.load_file(path) -> function|nil, string
+// @brief Compile a script file through the bytecode cache
+// @description Like load() on the contents of a /sd/ or /fs/ file (paths
+// without a prefix are on LittleFS), but the compiled bytecode is kept in
+// /.luac/ on the same filesystem and reused while the source is unchanged,
+// so later loads skip the parser. Does not run the chunk. Reads on the Lua
+// thread; async_load(path) is the same with the file work on the AsyncIO
+// worker, and is what load_module uses.
+// @param path Script path (e.g. "/sd/apps/notes.lua")
+// @return The compiled chunk, or nil and an error message
+// @example
+// local chunk = assert(ez.system.load_file("/sd/apps/notes.lua"))
+// local app = chunk()
+// @end
+LUA_FUNCTION(l_system_load_file) {
+    LUA_CHECK_ARGC(L, 1);
+    const char* path = luaL_checkstring(L, 1);
+    int status = ScriptLoader::instance().loadPath(L, path);
+    if (status == LUA_OK) return 1;
+    lua_pushnil(L);
+    if (status < 0) {
+        lua_pushfstring(L, "cannot open %s", path);
+    } else {
+        lua_insert(L, -2);  // nil, message
+    }
+    return 2;
+}
+
+// @lua ez.system.clear_script_cache() -> integer
+// @brief Delete all cached script bytecode
+// @description Removes every entry in /.luac/ on LittleFS and SD. Entries
+// are checked against their source on every load, so this is only needed to
+// reclaim space or to time cold loads.
+// @return Number of cache files removed
+// @example
+// print(ez.system.clear_script_cache(), "cached chunks removed")
+// @end
+LUA_FUNCTION(l_system_clear_script_cache) {
+    lua_pushinteger(L, ScriptLoader::instance().clearCache());
+    return 1;
+}
+
+static void pushEmbeddedStats(lua_State* L, const ScriptLoader::EmbeddedStats& st) {
+    lua_newtable(L);
+    lua_pushinteger(L, st.lookups);
+    lua_setfield(L, -2, "lookups");
+    lua_pushinteger(L, st.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, st.lookupUs);
+    lua_setfield(L, -2, "lookup_us");
+    lua_pushinteger(L, st.loads);
+    lua_setfield(L, -2, "modules");
+    lua_pushinteger(L, st.loadErrors);
+    lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, st.loadUs);
+    lua_setfield(L, -2, "load_us");
+    lua_pushinteger(L, st.bytes);
+    lua_setfield(L, -2, "bytes");
+}
+
+// @lua ez.system.get_script_stats() -> table
+// @brief Get script lookup, load and bytecode cache timings
+// @description Counters for $ path lookups and chunk loads since power-on,
+// plus a snapshot taken when $boot.lua returned. Both tables have lookups,
+// misses, lookup_us, modules, errors, load_us and bytes; boot also has
+// boot_us (time spent running the boot script). cache covers scripts loaded
+// from SD and LittleFS: hits, misses, stale, stores, store_errors, hit_us,
+// miss_us, store_us, hit_bytes and miss_bytes.
+// @return Table with the live counters, embedded (script count), boot and cache
+// @example
+// local s = ez.system.get_script_stats()
+// print(s.boot.modules, s.boot.load_us / 1000, "ms")
+// @end
+LUA_FUNCTION(l_system_get_script_stats) {
+    ScriptLoader& loader = ScriptLoader::instance();
+    pushEmbeddedStats(L, loader.getEmbeddedStats());
+    lua_pushinteger(L, embedded_lua::get_script_count());
+    lua_setfield(L, -2, "embedded");
+    pushEmbeddedStats(L, loader.getBootStats());
+    lua_pushinteger(L, loader.getBootUs());
+    lua_setfield(L, -2, "boot_us");
+    lua_setfield(L, -2, "boot");
+
+    const ScriptLoader::CacheStats& cs = loader.getCacheStats();
+    lua_createtable(L, 0, 10);
+    lua_pushinteger(L, cs.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, cs.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, cs.stale);
+    lua_setfield(L, -2, "stale");
+    lua_pushinteger(L, cs.stores);
+    lua_setfield(L, -2, "stores");
+    lua_pushinteger(L, cs.storeErrors);
+    lua_setfield(L, -2, "store_errors");
+    lua_pushinteger(L, cs.hitUs);
+    lua_setfield(L, -2, "hit_us");
+    lua_pushinteger(L, cs.missUs);
+    lua_setfield(L, -2, "miss_us");
+    lua_pushinteger(L, cs.storeUs);
+    lua_setfield(L, -2, "store_us");
+    lua_pushinteger(L, cs.hitBytes);
+    lua_setfield(L, -2, "hit_bytes");
+    lua_pushinteger(L, cs.missBytes);
+    lua_setfield(L, -2, "miss_bytes");
+    lua_setfield(L, -2, "cache");
+    return 1;
+}
+
 // @lua ez.system.get_lua_memory() -> integer
 // @brief Get memory used by Lua runtime
 // @description Returns memory currently allocated by the Lua VM for scripts,
@@ -857,6 +1175,208 @@ LUA_FUNCTION(l_system_get_lua_memory) {
     return 1;
 }
 
+// @lua ez.system.get_heap_stats() -> table
+// @brief Get heap usage broken down by subsystem
+// @description Native buffers allocated by the display, async I/O, audio,
+// HTTP, mesh and storage code are counted per subsystem. Each of the
+// `display`, `async`, `audio`, `http`, `mesh` and `storage` fields is a table
+// with live (bytes held now), peak, allocs, frees and failures (allocations
+// that returned nothing). `lua` has the main Lua heap (live, allocs) and
+// `worker` the background Lua state (live, peak, limit). free_heap and
+// free_psram are the totals that are left.
+// @return Table with one entry per subsystem plus lua, worker, free_heap, free_psram
+// @example
+// local h = ez.system.get_heap_stats()
+// print("sprites", h.display.live // 1024, "KB, http peak", h.http.peak // 1024, "KB")
+// @end
+LUA_FUNCTION(l_system_get_heap_stats) {
+    lua_createtable(L, 0, (int)HeapTag::COUNT + 4);
+    for (size_t i = 0; i < (size_t)HeapTag::COUNT; i++) {
+        HeapTagStats st;
+        heapTagGetStats((HeapTag)i, st);
+        lua_createtable(L, 0, 5);
+        lua_pushinteger(L, st.live);
+        lua_setfield(L, -2, "live");
+        lua_pushinteger(L, st.peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, st.allocs);
+        lua_setfield(L, -2, "allocs");
+        lua_pushinteger(L, st.frees);
+        lua_setfield(L, -2, "frees");
+        lua_pushinteger(L, st.failures);
+        lua_setfield(L, -2, "failures");
+        lua_setfield(L, -2, heapTagName((HeapTag)i));
+    }
+
+    LuaRuntime& rt = LuaRuntime::instance();
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, rt.getMemoryUsed());
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, rt.getAllocCount());
+    lua_setfield(L, -2, "allocs");
+    lua_setfield(L, -2, "lua");
+
+    const LuaWorker::Stats& ws = LuaWorker::instance().getStats();
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, ws.memUsed);
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, ws.memPeak);
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, LuaWorker::HEAP_LIMIT);
+    lua_setfield(L, -2, "limit");
+    lua_setfield(L, -2, "worker");
+
+    lua_pushinteger(L, ESP.getFreeHeap());
+    lua_setfield(L, -2, "free_heap");
+    lua_pushinteger(L, ESP.getFreePsram());
+    lua_setfield(L, -2, "free_psram");
+    return 1;
+}
+
+// @lua ez.system.get_alloc_count() -> integer
+// @brief Get the number of Lua heap blocks allocated so far
+// @description Cumulative count of fresh allocations made by the Lua VM
+// (frees and in-place resizes are not counted). Take the difference of two
+// readings to see how many allocations an operation made.
+// @return Allocation count since the Lua state was created
+// @example
+// local a0 = ez.system.get_alloc_count()
+// local t = { 1, 2, 3 }
+// print(ez.system.get_alloc_count() - a0, "allocations")
+// @end
+LUA_FUNCTION(l_system_get_alloc_count) {
+    lua_pushinteger(L, LuaRuntime::instance().getAllocCount());
+    return 1;
+}
+
+// @lua ez.system.get_alloc_stats() -> table
+// @brief Get Lua heap allocator statistics
+// @description Blocks up to 256 bytes come from per-size-class slabs carved out
+// of 64 KB PSRAM arenas; bigger blocks go straight to the PSRAM heap. Returns
+// arena usage, large-block totals and a `classes` array with one entry per size
+// class: size, live, peak, allocs, frees and carved (blocks ever taken from an
+// arena, live or sitting on the free list).
+// @return Table with arenas, arena_bytes, arena_unused, slab_live_bytes, slab_free_bytes, large_allocs, large_live, large_bytes, classes
+// @example
+// local s = ez.system.get_alloc_stats()
+// for _, c in ipairs(s.classes) do
+//     print(c.size, c.live, c.peak)
+// end
+// @end
+LUA_FUNCTION(l_system_get_alloc_stats) {
+    LuaSlab& slab = LuaRuntime::instance().getSlab();
+    LuaSlab::Stats st;
+    slab.getStats(st);
+
+    lua_newtable(L);
+    lua_pushinteger(L, st.arenaCount);
+    lua_setfield(L, -2, "arenas");
+    lua_pushinteger(L, st.arenaBytes);
+    lua_setfield(L, -2, "arena_bytes");
+    lua_pushinteger(L, st.arenaUnused);
+    lua_setfield(L, -2, "arena_unused");
+    lua_pushinteger(L, st.slabLiveBytes);
+    lua_setfield(L, -2, "slab_live_bytes");
+    lua_pushinteger(L, st.slabFreeBytes);
+    lua_setfield(L, -2, "slab_free_bytes");
+    lua_pushinteger(L, st.largeAllocs);
+    lua_setfield(L, -2, "large_allocs");
+    lua_pushinteger(L, st.largeLive);
+    lua_setfield(L, -2, "large_live");
+    lua_pushinteger(L, st.largeBytes);
+    lua_setfield(L, -2, "large_bytes");
+
+    // Snapshot before building the classes table; the table itself allocates.
+    LuaSlab::ClassStats classes[LuaSlab::NUM_CLASSES];
+    for (int i = 0; i < LuaSlab::NUM_CLASSES; i++) classes[i] = slab.classStats(i);
+
+    lua_createtable(L, LuaSlab::NUM_CLASSES, 0);
+    for (int i = 0; i < LuaSlab::NUM_CLASSES; i++) {
+        const LuaSlab::ClassStats& c = classes[i];
+        lua_createtable(L, 0, 6);
+        lua_pushinteger(L, c.size);
+        lua_setfield(L, -2, "size");
+        lua_pushinteger(L, c.live);
+        lua_setfield(L, -2, "live");
+        lua_pushinteger(L, c.peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, c.allocs);
+        lua_setfield(L, -2, "allocs");
+        lua_pushinteger(L, c.frees);
+        lua_setfield(L, -2, "frees");
+        lua_pushinteger(L, c.carved);
+        lua_setfield(L, -2, "carved");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "classes");
+    return 1;
+}
+
+// @lua ez.system.alloc_trace_start(max_events) -> boolean
+// @brief Start recording Lua heap allocations
+// @description Records every allocator call (16 bytes each) into a PSRAM buffer
+// for offline replay with tools/bench/lua_alloc_replay. Recording stops quietly
+// once max_events is reached. Restarting discards any previous trace.
+// @param max_events Buffer size in events (default 200000, ~3 MB)
+// @return true if the trace buffer was allocated
+// @example
+// ez.system.alloc_trace_start(100000)
+// -- ... exercise the UI ...
+// ez.system.alloc_trace_save("/sd/alloc.trace")
+// @end
+LUA_FUNCTION(l_system_alloc_trace_start) {
+    lua_Integer maxEvents = luaL_optinteger(L, 1, 200000);
+    if (maxEvents <= 0) {
+        return luaL_error(L, "max_events must be positive");
+    }
+    lua_pushboolean(L, LuaRuntime::instance().getSlab().startTrace((size_t)maxEvents));
+    return 1;
+}
+
+// @lua ez.system.alloc_trace_save(path) -> integer
+// @brief Stop allocation tracing and write the trace to a file
+// @description Writes the recorded events as raw little-endian records
+// (ptr, result, osize, nsize; four uint32 each) and frees the trace buffer.
+// Paths must start with /sd/ or /fs/.
+// @param path Destination file, e.g. "/sd/alloc.trace"
+// @return Number of events written, or nil and an error message
+// @example
+// local n = ez.system.alloc_trace_save("/sd/alloc.trace")
+// print("Captured", n, "allocations")
+// @end
+LUA_FUNCTION(l_system_alloc_trace_save) {
+    const char* path = luaL_checkstring(L, 1);
+    LuaSlab& slab = LuaRuntime::instance().getSlab();
+    if (!slab.isTracing()) {
+        lua_pushnil(L);
+        lua_pushstring(L, "no allocation trace running");
+        return 2;
+    }
+
+    File file;
+    if (strncmp(path, "/sd/", 4) == 0) {
+        file = SD.open(path + 3, FILE_WRITE);
+    } else if (strncmp(path, "/fs/", 4) == 0) {
+        file = LittleFS.open(path + 3, FILE_WRITE);
+    }
+    if (!file) {
+        slab.stopTrace();
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot open %s", path);
+        return 2;
+    }
+
+    // Copy the count first: stopTrace() below frees the buffer, and any
+    // allocation between here and there would append to it.
+    size_t count = slab.traceCount();
+    file.write((const uint8_t*)slab.traceEvents(), count * sizeof(LuaSlab::TraceEvent));
+    file.close();
+    slab.stopTrace();
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
 // @lua ez.system.is_low_memory() -> boolean
 // @brief Check if memory is critically low
 // @description Returns true when free heap drops below 32KB. At this level, the
@@ -1034,8 +1554,9 @@ LUA_FUNCTION(l_system_get_loop_delay) {
 // @lua ez.system.yield(ms)
 // @brief Yield execution to allow C++ background tasks to run
 // @description Temporarily yields execution to allow background C++ tasks (radio,
-// GPS, timers) to run. Also processes Lua timers. Essential in custom main loops
-// to prevent watchdog timeouts and keep mesh networking responsive.
+// GPS, timers) to run. Also processes Lua timers and resumes ready coroutines.
+// Essential in custom main loops to prevent watchdog timeouts and keep mesh
+// networking responsive.
 // @param ms Optional sleep time in milliseconds (default 1, max 100)
 // @example
 // while game_running do
@@ -1049,8 +1570,9 @@ LUA_FUNCTION(l_system_yield) {
     if (ms < 0) ms = 0;
     if (ms > 100) ms = 100;  // Cap to prevent long blocks
 
-    // Process timers while yielding
+    // Process timers and ready coroutines while yielding
     processLuaTimers();
+    Scheduler::instance().run();
 
     // Small delay to yield to other tasks
     if (ms > 0) {
@@ -1081,6 +1603,9 @@ LUA_FUNCTION(l_system_deep_sleep) {
     // Configure GPIO wake source (trackball button on GPIO 0)
     esp_sleep_enable_ext0_wakeup(GPIO_NUM_0, 0);
 
+    // Deep sleep skips the shutdown handlers and loses RAM
+    NvsPrefs::instance().flush();
+
     LOG("System", "Entering deep sleep...");
     Serial.flush();
 
@@ -1105,6 +1630,9 @@ LUA_FUNCTION(l_system_light_sleep) {
     // Configure GPIO wake source (trackball button on GPIO 0)
     esp_sleep_enable_ext0_wakeup(GPIO_NUM_0, 0);
 
+    // RAM survives light sleep, but the battery may not
+    NvsPrefs::instance().flush();
+
     // Enter light sleep - blocks until wake
     esp_err_t err = esp_light_sleep_start();
 
@@ -1159,10 +1687,12 @@ LUA_FUNCTION(l_system_get_mac_address) {
 // Function table for ez.system
 static const luaL_Reg system_funcs[] = {
     {"millis",             l_system_millis},
+    {"micros",             l_system_micros},
     {"delay",              l_system_delay},
     {"set_timer",          l_system_set_timer},
     {"set_interval",       l_system_set_interval},
     {"cancel_timer",       l_system_cancel_timer},
+    {"get_next_timer",     l_system_get_next_timer},
     {"get_battery_percent", l_system_get_battery_percent},
     {"get_battery_voltage", l_system_get_battery_voltage},
     {"get_free_heap",      l_system_get_free_heap},
@@ -1183,7 +1713,22 @@ static const luaL_Reg system_funcs[] = {
     {"reload_scripts",     l_system_reload_scripts},
     {"gc",                 l_system_gc},
     {"gc_step",            l_system_gc_step},
+    {"set_gc_budget",      l_system_set_gc_budget},
+    {"set_gc_threshold",   l_system_set_gc_threshold},
+    {"get_gc_stats",       l_system_get_gc_stats},
+    {"get_frame_stats",    l_system_get_frame_stats},
+    {"frame_mark",         l_system_frame_mark},
     {"get_lua_memory",     l_system_get_lua_memory},
+    {"get_heap_stats",     l_system_get_heap_stats},
+    {"get_log_stats",      l_system_get_log_stats},
+    {"load_embedded",      l_system_load_embedded},
+    {"load_file",          l_system_load_file},
+    {"clear_script_cache", l_system_clear_script_cache},
+    {"get_script_stats",   l_system_get_script_stats},
+    {"get_alloc_stats",    l_system_get_alloc_stats},
+    {"get_alloc_count",    l_system_get_alloc_count},
+    {"alloc_trace_start",  l_system_alloc_trace_start},
+    {"alloc_trace_save",   l_system_alloc_trace_save},
     {"is_low_memory",      l_system_is_low_memory},
     {"get_last_error",     l_system_get_last_error},
     // USB Mass Storage for SD card file transfer
@@ -1211,61 +1756,37 @@ static const luaL_Reg system_funcs[] = {
 // Load a file from filesystem (checks SD card first, then LittleFS)
 // Returns true if successful, false otherwise (with error on stack)
 static bool loadScriptFile(lua_State* L, const char* path) {
-    File file;
+    ScriptLoader& loader = ScriptLoader::instance();
+    int status = -1;
 
     // Check SD card first (allows overriding built-in scripts)
     // SD paths are the same as LittleFS paths
     if (SD.exists(path)) {
-        file = SD.open(path, "r");
-        if (file) {
+        status = loader.loadFile(L, SD, path, path);
+        if (status >= 0) {
             LOG("Lua", "Loading from SD: %s", path);
         }
     }
 
     // Fall back to LittleFS
-    if (!file) {
-        file = LittleFS.open(path, "r");
+    if (status < 0) {
+        status = loader.loadFile(L, LittleFS, path, path);
     }
 
-    if (!file) {
+    if (status < 0) {
         lua_pushfstring(L, "cannot open %s: No such file or directory", path);
         return false;
     }
-
-    size_t size = file.size();
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) {
-        file.close();
-        lua_pushstring(L, "out of memory");
-        return false;
-    }
-
-    file.readBytes(buffer, size);
-    buffer[size] = '\0';
-    file.close();
-
-    int status = luaL_loadbuffer(L, buffer, size, path);
-    free(buffer);
-
-    if (status != LUA_OK) {
-        return false;  // Error message already on stack
-    }
-    return true;
+    return status == LUA_OK;  // Error message already on stack otherwise
 }
 
 // Try loading an embedded script by path, return 2 on success (loader + path on stack)
 static int tryEmbedded(lua_State* L, const char* path) {
-    size_t size = 0;
-    const char* data = embedded_lua::get_script(path, &size);
-    if (data != nullptr) {
-        int status = luaL_loadbuffer(L, data, size, path);
-        if (status == LUA_OK) {
-            lua_pushstring(L, path);
-            return 2;
-        }
-        return 1;  // Load error on stack
-    }
-    return 0;  // Not found
+    int status = ScriptLoader::instance().loadEmbedded(L, path);
+    if (status < 0) return 0;  // Not found
+    if (status != LUA_OK) return 1;  // Load error on stack
+    lua_pushstring(L, path);
+    return 2;
 }
 
 // Custom package searcher for scripts
@@ -1343,11 +1864,9 @@ void registerSystemModule(lua_State* L) {
     lua_setfield(L, -2, "log");
     lua_pop(L, 1);
 
-    // Register defer() as a global function (coroutine next-tick yield/resume)
-    lua_register(L, "defer", l_defer);
-
-    // Initialize deferred coroutine queue
-    deferredCount = 0;
+    // Timers from a previous Lua state hold refs into a registry that no
+    // longer exists; drop them. (defer() and spawn() live in scheduler.cpp.)
+    luaTimers.clear([](int) {});
 
     // Override global dofile with our custom version (checks SD first, then LittleFS)
     lua_pushcfunction(L, l_dofile_script);
@@ -1376,19 +1895,17 @@ void registerSystemModule(lua_State* L) {
     LOG("LuaRuntime", "Registered ez.system");
 }
 
-// Process pending timers and deferred coroutines (called from LuaRuntime::update())
+// Process pending timers (called from LuaRuntime::update())
 void processLuaTimers() {
     lua_State* L = LUA_STATE;
     if (L == nullptr) return;
 
-    uint32_t now = millis();
-
-    for (int i = 0; i < MAX_TIMERS; i++) {
-        if (!timers[i].active) continue;
-
-        if (now >= timers[i].nextTrigger) {
-            // Get callback from registry
-            lua_rawgeti(L, LUA_REGISTRYINDEX, timers[i].callbackRef);
+    // ez.system.yield() calls back in here; a yield inside a timer callback
+    // skips timers.
+    if (!timersRunning) {
+        timersRunning = true;
+        luaTimers.advance(millis(), [L](TimerWheel::Id, int ref, bool repeating) {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
 
             // Call callback with no arguments
             if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
@@ -1396,44 +1913,27 @@ void processLuaTimers() {
                 lua_pop(L, 1);
             }
 
-            // Handle one-shot vs interval
-            if (timers[i].interval == 0) {
-                // One-shot: deactivate
-                luaL_unref(L, LUA_REGISTRYINDEX, timers[i].callbackRef);
-                timers[i].active = false;
-            } else {
-                // Interval: reschedule
-                timers[i].nextTrigger = now + timers[i].interval;
+            // One-shots are already off the wheel; intervals keep their ref
+            // until cancel_timer() releases it.
+            if (!repeating) {
+                luaL_unref(L, LUA_REGISTRYINDEX, ref);
             }
-        }
+        });
+        timersRunning = false;
     }
+}
 
-    // Resume deferred coroutines (from defer() calls)
-    if (deferredCount > 0) {
-        int count = deferredCount;
-        // Copy and reset before resuming (coroutines may defer again)
-        int refs[MAX_DEFERRED];
-        for (int i = 0; i < count; i++) {
-            refs[i] = deferredCoroutines[i];
-        }
-        deferredCount = 0;
-
-        for (int i = 0; i < count; i++) {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, refs[i]);
-            lua_State* co = lua_tothread(L, -1);
-            lua_pop(L, 1);
-
-            if (co) {
-                int nresults = 0;
-                int status = lua_resume(co, L, 0, &nresults);
-                if (status != LUA_OK && status != LUA_YIELD) {
-                    const char* err = lua_tostring(co, -1);
-                    LOG("Defer", "Coroutine error: %s", err ? err : "unknown");
-                    lua_pop(co, 1);
-                }
-            }
-
-            luaL_unref(L, LUA_REGISTRYINDEX, refs[i]);
-        }
+// Time until the next timer or scheduled coroutine (ready, or sleeping in
+// wait_ms) is due. False if neither is pending. Used by the main loop to
+// cap its idle sleep.
+bool luaTimersNextDue(uint32_t now, uint32_t& ms) {
+    bool any = Scheduler::instance().nextDue(now, ms);
+    uint32_t at;
+    if (luaTimers.nextDeadline(at)) {
+        int32_t delta = (int32_t)(at - now);
+        uint32_t timerMs = delta > 0 ? (uint32_t)delta : 0;
+        if (!any || timerMs < ms) ms = timerMs;
+        any = true;
     }
+    return any;
 }
@@ -19,6 +19,7 @@
 
 #include "touch_bindings.h"
 #include "../lua_bindings.h"
+#include "../lua_runtime.h"
 #include "../../hardware/touch.h"
 #include "bus_bindings.h"
 
@@ -52,6 +53,7 @@ namespace {
     TrackState g_prev[MAX_TRACKED];
 
     void postPoint(const char* topic, const Touch::Point& p) {
+        LuaRuntime::instance().noteInput();
         MessageBus::instance().postTable(topic, [p](lua_State* L) {
             lua_createtable(L, 0, 4);
             lua_pushinteger(L, p.id);
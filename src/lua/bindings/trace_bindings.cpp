@@ -0,0 +1,202 @@
+// ez.trace module bindings
+// Timeline spans and instant events, exported as Chrome trace-event JSON
+
+#include "../lua_bindings.h"
+#include "../../util/trace.h"
+#include "../../util/log.h"
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+// @module ez.trace
+// @brief Timeline tracing across C++ and Lua
+// @description
+// Records begin/end spans and instant events into a fixed-size ring of the
+// newest 8192 events, from Lua and from the firmware itself (main-loop
+// phases, display flushes, AsyncIO jobs on Core 0, radio RX/TX, worker
+// jobs). Each event carries a microsecond timestamp, the core and the task.
+// dump() returns Chrome trace-event JSON for ui.perfetto.dev or
+// chrome://tracing; the dev OTA server serves the same at GET /trace.json
+// and `ez_remote.py PORT --trace SECONDS` captures it over USB serial.
+// Recording is off until start().
+// @end
+
+namespace {
+
+// Lua names are interned so events can keep a pointer to them. The table
+// only grows; past NAME_SLOTS distinct names, new ones are recorded as
+// "lua". Main Lua thread only.
+constexpr size_t NAME_SLOTS = 128;
+constexpr size_t NAME_LEN = 32;
+
+char (*s_names)[NAME_LEN] = nullptr;
+
+const char* internName(const char* name, size_t len) {
+    if (!s_names) {
+        s_names = (char (*)[NAME_LEN])heap_caps_calloc(NAME_SLOTS, NAME_LEN,
+                                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!s_names) return "lua";
+    }
+    if (len > NAME_LEN - 1) len = NAME_LEN - 1;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    for (size_t probe = 0; probe < NAME_SLOTS; probe++) {
+        char* slot = s_names[(h + probe) & (NAME_SLOTS - 1)];
+        if (!slot[0]) {
+            memcpy(slot, name, len);
+            slot[len] = '\0';
+            return slot;
+        }
+        if (strncmp(slot, name, len) == 0 && slot[len] == '\0') return slot;
+    }
+    return "lua";
+}
+
+const char* checkName(lua_State* L, int idx) {
+    size_t len;
+    const char* name = luaL_checklstring(L, idx, &len);
+    return internName(name, len);
+}
+
+}  // namespace
+
+// @lua ez.trace.start() -> boolean
+// @brief Start recording events
+// @description Allocates the PSRAM ring on first use (about 160 KB).
+// Events keep accumulating across start/stop until clear().
+// @return true if recording, false if out of PSRAM or tracing is compiled out
+// @example
+// ez.trace.clear()
+// ez.trace.start()
+// @end
+LUA_FUNCTION(l_trace_start) {
+    lua_pushboolean(L, trace_start());
+    return 1;
+}
+
+// @lua ez.trace.stop()
+// @brief Stop recording, keeping the events for dump()
+// @example
+// ez.trace.stop()
+// @end
+LUA_FUNCTION(l_trace_stop) {
+    trace_stop();
+    return 0;
+}
+
+// @lua ez.trace.clear()
+// @brief Discard recorded events
+// @example
+// ez.trace.clear()
+// @end
+LUA_FUNCTION(l_trace_clear) {
+    trace_clear();
+    return 0;
+}
+
+// @lua ez.trace.begin(name)
+// @brief Open a span on the calling task
+// @description Spans nest: finish() closes the innermost open one. Names
+// are interned (up to 128 distinct, 31 bytes each).
+// @param name Span name
+// @example
+// ez.trace.begin("load_map")
+// load_tiles()
+// ez.trace.finish()
+// @end
+LUA_FUNCTION(l_trace_begin) {
+    const char* name = checkName(L, 1);
+    if (trace_active()) trace_record(name, TRACE_PHASE_BEGIN);
+    return 0;
+}
+
+// @lua ez.trace.finish()
+// @brief Close the innermost open span
+// @description Named finish rather than end, which is a Lua keyword.
+// @example
+// ez.trace.finish()
+// @end
+LUA_FUNCTION(l_trace_finish) {
+    if (trace_active()) trace_record(nullptr, TRACE_PHASE_END);
+    return 0;
+}
+
+// @lua ez.trace.instant(name)
+// @brief Record a point-in-time event
+// @param name Event name
+// @example
+// ez.trace.instant("message_received")
+// @end
+LUA_FUNCTION(l_trace_instant) {
+    const char* name = checkName(L, 1);
+    if (trace_active()) trace_record(name, TRACE_PHASE_INSTANT);
+    return 0;
+}
+
+// @lua ez.trace.get_stats() -> table
+// @brief Recording state and counters
+// @description recorded counts events since the last clear; once it
+// passes capacity the oldest events are being overwritten.
+// @return Table with running, recorded, capacity, threads
+// @example
+// local s = ez.trace.get_stats()
+// print(s.recorded .. "/" .. s.capacity)
+// @end
+LUA_FUNCTION(l_trace_get_stats) {
+    TraceStats st;
+    trace_get_stats(st);
+    lua_newtable(L);
+    lua_pushboolean(L, st.running);
+    lua_setfield(L, -2, "running");
+    lua_pushinteger(L, st.recorded);
+    lua_setfield(L, -2, "recorded");
+    lua_pushinteger(L, st.capacity);
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, st.threads);
+    lua_setfield(L, -2, "threads");
+    return 1;
+}
+
+// @lua ez.trace.dump() -> string
+// @brief Export recorded events as Chrome trace-event JSON
+// @description Returns a JSON object with a traceEvents array, cores as
+// processes and tasks as threads, timestamps in microseconds from the
+// oldest event. Save it and open it in ui.perfetto.dev or chrome://tracing.
+// @return JSON text (nil if nothing was ever recorded or out of PSRAM)
+// @example
+// ez.storage.write_file("/sd/trace.json", ez.trace.dump())
+// @end
+LUA_FUNCTION(l_trace_dump) {
+    TraceJsonWriter* w = trace_export_begin();
+    if (!w) {
+        lua_pushnil(L);
+        return 1;
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (;;) {
+        char* out = luaL_prepbuffsize(&b, TraceJsonWriter::MIN_CHUNK * 8);
+        size_t n = w->write(out, TraceJsonWriter::MIN_CHUNK * 8);
+        if (n == 0) break;
+        luaL_addsize(&b, n);
+    }
+    trace_export_end(w);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+static const luaL_Reg trace_funcs[] = {
+    {"start",     l_trace_start},
+    {"stop",      l_trace_stop},
+    {"clear",     l_trace_clear},
+    {"begin",     l_trace_begin},
+    {"finish",    l_trace_finish},
+    {"instant",   l_trace_instant},
+    {"get_stats", l_trace_get_stats},
+    {"dump",      l_trace_dump},
+    {nullptr, nullptr}
+};
+
+void registerTraceModule(lua_State* L) {
+    lua_register_module(L, "trace", trace_funcs);
+    LOG("LuaRuntime", "Registered ez.trace");
+}
@@ -3,6 +3,7 @@
 
 #include "../lua_bindings.h"
 #include "../../config.h"
+#include "buffer_bindings.h"
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
@@ -872,7 +873,7 @@ LUA_FUNCTION(l_wifi_tcp_serve_blob) {
     LUA_CHECK_ARGC_RANGE(L, 2, 3);
     uint16_t port = (uint16_t)luaL_checkinteger(L, 1);
     size_t blob_len = 0;
-    const char* blob = luaL_checklstring(L, 2, &blob_len);
+    const char* blob = (const char*)buffer_bindings::checkBytes(L, 2, &blob_len);
     uint32_t timeout = (uint32_t)luaL_optintegerdefault(L, 3, 30000);
 
     WiFiServer server(port);
@@ -0,0 +1,125 @@
+#include "frame_stats.h"
+#include "../util/log.h"
+#include <esp_heap_caps.h>
+#include <new>
+#include <string.h>
+
+static const char* const PHASE_NAMES[FrameStats::PHASES] = {
+    "remote", "gps", "touch", "timers", "async_io", "http", "coroutines",
+    "dev_server", "bus", "lua", "input", "logic", "render", "flush", "gc",
+    "idle", "other"
+};
+
+FrameStats& FrameStats::instance() {
+    static FrameStats stats;
+    return stats;
+}
+
+bool FrameStats::begin() {
+    if (_hist) return true;
+    size_t bytes = sizeof(LatencyHistogram) * SERIES * 2;
+    void* mem = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) {
+        LOG("FrameStats", "No PSRAM for histograms (%u bytes), disabled", (unsigned)bytes);
+        return false;
+    }
+    auto* hist = static_cast<LatencyHistogram(*)[2]>(mem);
+    for (int s = 0; s < SERIES; s++) {
+        new (&hist[s][0]) LatencyHistogram();
+        new (&hist[s][1]) LatencyHistogram();
+    }
+    uint32_t mhz = ESP.getCpuFreqMHz();
+    _cyclesPerUs = mhz ? mhz : 240;
+    _hist = hist;
+    LOG("FrameStats", "Frame timing enabled (%u bytes PSRAM)", (unsigned)bytes);
+    return true;
+}
+
+void FrameStats::beginFrame() {
+    if (!_hist) return;
+    uint32_t now = ESP.getCycleCount();
+
+    if (_inFrame) {
+        charge(now);
+        uint32_t total = (now - _frameStart) / _cyclesPerUs;
+        uint32_t idle = _accum[(int)FramePhase::IDLE] / _cyclesPerUs;
+        for (int p = 0; p < PHASES; p++) {
+            _hist[p][_half].record(_accum[p] / _cyclesPerUs);
+        }
+        _hist[FRAME_SERIES][_half].record(total);
+        _hist[BUSY_SERIES][_half].record(total > idle ? total - idle : 0);
+        _frames++;
+
+        // Rotate the rolling window: the older half is dropped.
+        if (++_halfFrames >= WINDOW_FRAMES) {
+            _half ^= 1;
+            for (int s = 0; s < SERIES; s++) _hist[s][_half].clear();
+            _halfFrames = 0;
+            uint32_t mhz = ESP.getCpuFreqMHz();
+            if (mhz) _cyclesPerUs = mhz;
+        }
+    }
+
+    memset(_accum, 0, sizeof(_accum));
+    _stack[0] = FramePhase::OTHER;
+    _depth = 1;
+    _frameStart = now;
+    _last = now;
+    _inFrame = true;
+}
+
+FrameStats::Summary FrameStats::summarize(int series) const {
+    Summary s = {};
+    if (!_hist) return s;
+    const LatencyHistogram* h[2] = {&_hist[series][0], &_hist[series][1]};
+    s.count = h[0]->count() + h[1]->count();
+    if (s.count == 0) return s;
+    s.p50 = LatencyHistogram::percentile(h, 2, 0.50f);
+    s.p95 = LatencyHistogram::percentile(h, 2, 0.95f);
+    s.p99 = LatencyHistogram::percentile(h, 2, 0.99f);
+    s.max = h[0]->max() > h[1]->max() ? h[0]->max() : h[1]->max();
+    s.avg = (uint32_t)((h[0]->sum() + h[1]->sum()) / s.count);
+    return s;
+}
+
+FrameStats::Summary FrameStats::phase(FramePhase p) const {
+    return summarize((int)p);
+}
+
+FrameStats::Summary FrameStats::frame() const {
+    return summarize(FRAME_SERIES);
+}
+
+FrameStats::Summary FrameStats::busy() const {
+    return summarize(BUSY_SERIES);
+}
+
+uint32_t FrameStats::windowFrames() const {
+    if (!_hist) return 0;
+    return _hist[FRAME_SERIES][0].count() + _hist[FRAME_SERIES][1].count();
+}
+
+void FrameStats::reset() {
+    if (!_hist) return;
+    for (int s = 0; s < SERIES; s++) {
+        _hist[s][0].clear();
+        _hist[s][1].clear();
+    }
+    _halfFrames = 0;
+    _frames = 0;
+}
+
+const char* FrameStats::phaseName(FramePhase p) {
+    int i = (int)p;
+    return i >= 0 && i < PHASES ? PHASE_NAMES[i] : "?";
+}
+
+bool FrameStats::parseLuaPhase(const char* name, FramePhase& out) {
+    if (!name) return false;
+    if (strcmp(name, "input") == 0) out = FramePhase::INPUT;
+    else if (strcmp(name, "logic") == 0) out = FramePhase::LOGIC;
+    else if (strcmp(name, "render") == 0) out = FramePhase::RENDER;
+    else if (strcmp(name, "lua") == 0) out = FramePhase::LUA_LOOP;
+    else return false;
+    return true;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "../util/latency_histogram.h"
+#include "../util/trace.h"
+#include <Arduino.h>
+
+// Where a main-loop frame goes. Native phases are timed with scopes in
+// main.cpp / LuaRuntime::update / ez.display.flush; INPUT, LOGIC and
+// RENDER are marked from Lua (ezui's screen.update) inside LUA_LOOP.
+enum class FramePhase : uint8_t {
+    REMOTE,         // USB remote-control commands
+    GPS,
+    TOUCH,
+    TIMERS,         // Lua timers
+    ASYNC_IO,       // AsyncIO completions
+    HTTP,
+    COROUTINES,     // Scheduler run queue
+    DEV_SERVER,     // Dev OTA server's deferred /lua calls
+    BUS,            // Message bus dispatch
+    LUA_LOOP,       // main_loop outside the marked sub-phases
+    INPUT,
+    LOGIC,
+    RENDER,         // Drawing into the framebuffer
+    FLUSH,          // Framebuffer -> panel
+    GC,
+    IDLE,           // Loop delay
+    OTHER,          // Frame time no phase claimed
+    COUNT
+};
+
+// Per-phase frame timing.
+//
+// Phases nest: entering one pauses the current phase, so each phase's
+// figure is its self time within the frame. Time comes from the CPU cycle
+// counter. At the end of each frame the per-phase totals go into rolling
+// histograms (two LatencyHistogram halves of WINDOW_FRAMES each, reported
+// together), along with the whole frame and the frame minus IDLE.
+//
+// Histograms live in PSRAM, allocated once by begin(); nothing on the
+// measurement path allocates. While ez.trace is recording, phases are
+// also traced as spans named after the phase. Before begin() (or if PSRAM is short)
+// every call is a no-op. Main loop task only.
+class FrameStats {
+public:
+    static FrameStats& instance();
+
+    static constexpr uint32_t WINDOW_FRAMES = 256;
+    static constexpr int MAX_DEPTH = 8;
+    static constexpr int PHASES = (int)FramePhase::COUNT;
+
+    bool begin();
+    bool enabled() const { return _hist != nullptr; }
+
+    // Close the previous frame and start a new one. Call at the top of
+    // loop(); resets the phase stack.
+    void beginFrame();
+
+    void enter(FramePhase phase) {
+        TRACE_BEGIN(phaseName(phase));
+        if (!_hist) return;
+        uint32_t now = ESP.getCycleCount();
+        charge(now);
+        if (_depth < MAX_DEPTH) _stack[_depth] = phase;
+        _depth++;
+    }
+
+    void leave() {
+        TRACE_END();
+        if (!_hist || _depth == 0) return;
+        charge(ESP.getCycleCount());
+        _depth--;
+    }
+
+    // Switch between Lua's sequential sub-phases (input/logic/render)
+    // without nesting, charging the time so far to the one replaced. Only
+    // applies while main_loop is the innermost phase, so a mark from a
+    // timer callback or bus handler can't relabel TIMERS or BUS, and a
+    // Lua error between marks can't leave the stack unbalanced.
+    void mark(FramePhase phase) {
+        if (!_hist || _depth == 0 || _depth > MAX_DEPTH) return;
+        FramePhase top = _stack[_depth - 1];
+        if (top != FramePhase::LUA_LOOP && top != FramePhase::INPUT &&
+            top != FramePhase::LOGIC && top != FramePhase::RENDER) return;
+        charge(ESP.getCycleCount());
+        _stack[_depth - 1] = phase;
+        TRACE_END();
+        TRACE_BEGIN(phaseName(phase));
+    }
+
+    struct Summary {
+        uint32_t count;
+        uint32_t p50, p95, p99, max;    // Microseconds
+        uint32_t avg;
+    };
+    // Over the last WINDOW_FRAMES..2*WINDOW_FRAMES frames.
+    Summary phase(FramePhase p) const;
+    Summary frame() const;
+    Summary busy() const;
+
+    uint32_t frames() const { return _frames; }
+    uint32_t windowFrames() const;
+    void reset();
+
+    static const char* phaseName(FramePhase p);
+    // Lua-markable phases by name ("input", "logic", "render", "lua").
+    static bool parseLuaPhase(const char* name, FramePhase& out);
+
+private:
+    FrameStats() = default;
+
+    void charge(uint32_t now) {
+        if (_depth > 0 && _depth <= MAX_DEPTH) {
+            _accum[(int)_stack[_depth - 1]] += now - _last;
+        }
+        _last = now;
+    }
+
+    // [PHASES + 2][2]: per phase, then frame, then busy; two halves each.
+    static constexpr int SERIES = PHASES + 2;
+    static constexpr int FRAME_SERIES = PHASES;
+    static constexpr int BUSY_SERIES = PHASES + 1;
+    Summary summarize(int series) const;
+
+    LatencyHistogram (*_hist)[2] = nullptr;
+    int _half = 0;
+    uint32_t _halfFrames = 0;
+
+    FramePhase _stack[MAX_DEPTH] = {};
+    int _depth = 0;
+    uint32_t _accum[PHASES] = {};
+    uint32_t _last = 0;
+    uint32_t _frameStart = 0;
+    bool _inFrame = false;
+
+    uint32_t _cyclesPerUs = 240;
+    uint32_t _frames = 0;
+};
+
+// Times a native phase for the enclosing scope.
+class FramePhaseScope {
+public:
+    explicit FramePhaseScope(FramePhase p) { FrameStats::instance().enter(p); }
+    ~FramePhaseScope() { FrameStats::instance().leave(); }
+    FramePhaseScope(const FramePhaseScope&) = delete;
+    FramePhaseScope& operator=(const FramePhaseScope&) = delete;
+};
@@ -0,0 +1,332 @@
+#include "lua_json.h"
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <new>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+namespace {
+
+// Builds the decoded value on the Lua stack: each open container sits on
+// the stack, with an object's pending key above it.
+class LuaBuilder : public JsonHandler {
+public:
+    explicit LuaBuilder(lua_State* L) : L(L) {}
+
+    bool null() override {
+        lua_pushnil(L);
+        return add();
+    }
+    bool boolean(bool value) override {
+        lua_pushboolean(L, value);
+        return add();
+    }
+    bool integer(int64_t value) override {
+        lua_pushinteger(L, (lua_Integer)value);
+        return add();
+    }
+    bool number(double value) override {
+        lua_pushnumber(L, (lua_Number)value);
+        return add();
+    }
+    bool string(const char* s, size_t len) override {
+        lua_pushlstring(L, s, len);
+        return add();
+    }
+    bool key(const char* s, size_t len) override {
+        lua_pushlstring(L, s, len);
+        return true;
+    }
+    bool startObject() override { return open(true); }
+    bool startArray() override { return open(false); }
+    bool endObject() override { return close(); }
+    bool endArray() override { return close(); }
+
+private:
+    bool open(bool object) {
+        // Table, key and value of this level plus the next level's table
+        if (!lua_checkstack(L, 4)) return false;
+        lua_createtable(L, 0, 0);
+        _object[_depth] = object;
+        _next[_depth] = 1;
+        _depth++;
+        return true;
+    }
+
+    bool close() {
+        _depth--;
+        return add();
+    }
+
+    // Store the value on top into the enclosing container, if any
+    bool add() {
+        if (_depth == 0) return true;
+        size_t d = _depth - 1;
+        if (_object[d]) lua_rawset(L, -3);
+        else lua_rawseti(L, -2, _next[d]++);
+        return true;
+    }
+
+    lua_State* L;
+    size_t _depth = 0;
+    bool _object[JsonReader::MAX_DEPTH];
+    lua_Integer _next[JsonReader::MAX_DEPTH];
+};
+
+// One open table during encoding
+struct EncodeFrame {
+    int table;              // Absolute stack index
+    bool array;
+    lua_Integer len;
+    lua_Integer next;
+};
+
+void writeScalar(lua_State* L, int idx, JsonWriter& w) {
+    switch (lua_type(L, idx)) {
+        case LUA_TBOOLEAN:
+            w.boolean(lua_toboolean(L, idx) != 0);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) w.integer((int64_t)lua_tointeger(L, idx));
+            else w.number((double)lua_tonumber(L, idx));
+            break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* s = lua_tolstring(L, idx, &len);
+            w.string(s, len);
+            break;
+        }
+        default:
+            w.null();
+            break;
+    }
+}
+
+// Write the key at `idx` without converting it in place (that would
+// confuse lua_next). False for keys JSON can't hold, which are skipped.
+bool writeKey(lua_State* L, int idx, JsonWriter& w) {
+    int t = lua_type(L, idx);
+    if (t == LUA_TSTRING) {
+        size_t len;
+        const char* s = lua_tolstring(L, idx, &len);
+        w.key(s, len);
+        return true;
+    }
+    if (t == LUA_TNUMBER) {
+        char tmp[32];
+        int n = lua_isinteger(L, idx)
+            ? snprintf(tmp, sizeof(tmp), "%lld", (long long)lua_tointeger(L, idx))
+            : snprintf(tmp, sizeof(tmp), "%.14g", (double)lua_tonumber(L, idx));
+        w.key(tmp, (size_t)n);
+        return true;
+    }
+    return false;
+}
+
+// Array when every key is a positive integer and the table isn't sparse
+void classify(lua_State* L, int table, EncodeFrame& f) {
+    lua_Integer maxIdx = 0;
+    lua_Integer count = 0;
+    bool array = true;
+    lua_pushnil(L);
+    while (lua_next(L, table) != 0) {
+        lua_pop(L, 1);
+        count++;
+        if (!lua_isinteger(L, -1) || lua_tointeger(L, -1) < 1) {
+            array = false;
+            lua_pop(L, 1);
+            break;
+        }
+        lua_Integer i = lua_tointeger(L, -1);
+        if (i > maxIdx) maxIdx = i;
+    }
+    f.array = array && maxIdx > 0 && maxIdx <= 2 * count;
+    f.len = maxIdx;
+    f.next = 1;
+}
+
+struct Block {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+bool blockSink(void* ctx, const char* data, size_t len) {
+    Block* b = static_cast<Block*>(ctx);
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        while (cap < b->len + len) cap *= 2;
+        char* p = (char*)heap_caps_realloc(b->data, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!p) p = (char*)heap_caps_realloc(b->data, cap, MALLOC_CAP_8BIT);
+        if (!p) return false;
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return true;
+}
+
+// The parse and the encode run under lua_pcall: a Lua allocation that
+// fails raises, and the longjmp must not skip freeing the builder, the
+// reader's scratch block or the encoder's frames
+struct DecodeCall {
+    const char* data;
+    size_t len;
+    JsonReader* reader;
+    LuaBuilder* builder;
+    bool ok;
+};
+
+int decodeProtected(lua_State* L) {
+    DecodeCall* call = static_cast<DecodeCall*>(lua_touserdata(L, 1));
+    lua_pop(L, 1);
+    call->ok = call->reader->parse(call->data, call->len, *call->builder);
+    return call->ok ? 1 : 0;
+}
+
+struct EncodeCall {
+    JsonWriter* writer;
+    EncodeFrame* frames;
+    const char* err;
+    bool ok;
+};
+
+// Encodes argument 2
+int encodeProtected(lua_State* L) {
+    EncodeCall* call = static_cast<EncodeCall*>(lua_touserdata(L, 1));
+    JsonWriter& w = *call->writer;
+    EncodeFrame* frames = call->frames;
+    size_t depth = 0;
+    bool ok = true;
+
+    while (ok) {
+        // Encode the value on top. A table stays on the stack as an open frame.
+        if (lua_type(L, -1) == LUA_TTABLE) {
+            if (depth == JsonWriter::MAX_DEPTH || !lua_checkstack(L, 4)) {
+                call->err = "nesting too deep (cyclic table?)";
+                ok = false;
+                break;
+            }
+            EncodeFrame& f = frames[depth++];
+            f.table = lua_gettop(L);
+            classify(L, f.table, f);
+            if (f.array) {
+                w.beginArray();
+            } else {
+                w.beginObject();
+                lua_pushnil(L);     // lua_next cursor
+            }
+        } else {
+            writeScalar(L, -1, w);
+            lua_pop(L, 1);
+        }
+        if (!w.ok()) {
+            call->err = "write failed";
+            ok = false;
+            break;
+        }
+
+        // Push the next value to encode, closing finished tables
+        bool pushed = false;
+        while (depth > 0 && !pushed) {
+            EncodeFrame& f = frames[depth - 1];
+            if (f.array) {
+                if (f.next <= f.len) {
+                    lua_rawgeti(L, f.table, f.next++);
+                    pushed = true;
+                    break;
+                }
+                w.endArray();
+            } else {
+                while (lua_next(L, f.table) != 0) {
+                    if (writeKey(L, -2, w)) {
+                        pushed = true;
+                        break;
+                    }
+                    lua_pop(L, 1);
+                }
+                if (pushed) break;
+                w.endObject();
+            }
+            lua_pop(L, 1);  // The table (lua_next already dropped its cursor)
+            depth--;
+        }
+        if (!pushed) break;
+    }
+
+    if (ok && !w.ok()) {
+        call->err = "write failed";
+        ok = false;
+    }
+    call->ok = ok;
+    return 0;
+}
+
+}  // namespace
+
+bool luaJsonDecode(lua_State* L, const char* data, size_t len) {
+    int top = lua_gettop(L);
+    // ~1 KB of per-level state: keep it off the loop task's stack
+    LuaBuilder* builder = new (std::nothrow) LuaBuilder(L);
+    if (!builder) {
+        lua_pushstring(L, "out of memory");
+        return false;
+    }
+    JsonReader reader;
+    DecodeCall call = {data, len, &reader, builder, false};
+    lua_pushcfunction(L, decodeProtected);
+    lua_pushlightuserdata(L, &call);
+    int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+    delete builder;
+    if (status == LUA_OK && call.ok) return true;
+    lua_settop(L, top);
+    if (status == LUA_ERRMEM) {
+        lua_pushliteral(L, "out of memory");
+    } else if (status != LUA_OK) {
+        lua_pushliteral(L, "decode failed");
+    } else {
+        lua_pushfstring(L, "%s at byte %d", reader.error(), (int)reader.errorOffset());
+    }
+    return false;
+}
+
+bool luaJsonEncode(lua_State* L, int idx, JsonWriter& w, const char** err) {
+    idx = lua_absindex(L, idx);
+    int base = lua_gettop(L);
+    EncodeFrame* frames = (EncodeFrame*)malloc(sizeof(EncodeFrame) * JsonWriter::MAX_DEPTH);
+    if (!frames) {
+        *err = "out of memory";
+        return false;
+    }
+    EncodeCall call = {&w, frames, nullptr, false};
+    lua_pushcfunction(L, encodeProtected);
+    lua_pushlightuserdata(L, &call);
+    lua_pushvalue(L, idx);
+    int status = lua_pcall(L, 2, 0, 0);
+    free(frames);
+    lua_settop(L, base);
+    if (status != LUA_OK) {
+        *err = status == LUA_ERRMEM ? "out of memory" : "encode failed";
+        return false;
+    }
+    if (!call.ok) *err = call.err;
+    return call.ok;
+}
+
+char* luaJsonEncodeToBlock(lua_State* L, int idx, size_t* len, const char** err) {
+    *err = nullptr;
+    Block block = {nullptr, 0, 0};
+    char chunk[512];
+    JsonWriter w(chunk, sizeof(chunk), blockSink, &block);
+    if (!luaJsonEncode(L, idx, w, err) || !w.finish()) {
+        if (!*err) *err = "out of memory";
+        heap_caps_free(block.data);
+        return nullptr;
+    }
+    *len = block.len;
+    return block.data;
+}
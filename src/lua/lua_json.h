@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../util/json_stream.h"
+#include <stddef.h>
+
+extern "C" {
+#include <lua.h>
+}
+
+// Lua <-> JSON on top of the streaming reader/writer in util/json_stream.
+//
+// Decoding builds tables straight from the parser's callbacks; encoding
+// walks tables with an explicit frame stack and feeds a JsonWriter, so
+// neither side builds an intermediate document or recurses in C. Shared
+// by ez.storage's json_* functions and AsyncIO's async_json_read/write.
+//
+// Mapping: objects and arrays become tables (JSON null is nil, which
+// leaves a hole in arrays); integers stay integers. A table encodes as an
+// array when every key is a positive integer and it is not too sparse
+// (largest index <= 2 x entries), else as an object with integer and
+// float keys written as strings. Empty tables encode as {}. Values JSON
+// can't hold (functions, userdata) encode as null.
+
+// Decode data[0..len) and push the value. On failure pushes an error
+// message ("<reason> at byte <n>") instead and returns false.
+bool luaJsonDecode(lua_State* L, const char* data, size_t len);
+
+// Encode the value at `idx` through `writer` (finish() is left to the
+// caller). On failure returns false and sets *err; what was written so
+// far is incomplete.
+bool luaJsonEncode(lua_State* L, int idx, JsonWriter& writer, const char** err);
+
+// Encode the value at `idx` into one malloc'd block (PSRAM preferred),
+// for callers that need the whole text. Returns nullptr and sets *err on
+// failure; the caller frees the block.
+char* luaJsonEncodeToBlock(lua_State* L, int idx, size_t* len, const char** err);
@@ -0,0 +1,222 @@
+#include "lua_pack.h"
+
+#include <esp_heap_caps.h>
+#include <string.h>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+namespace {
+
+// Tags. A table is TABLE, its entry count, then key/value pairs.
+enum : uint8_t {
+    TAG_NIL = 0,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,
+    TAG_FLOAT,
+    TAG_STRING,
+    TAG_TABLE,
+};
+
+struct Writer {
+    uint8_t* data = nullptr;
+    size_t len = 0;
+    size_t cap = 0;
+    bool ok = true;
+
+    void put(const void* p, size_t n) {
+        if (!ok) return;
+        if (len + n > cap) {
+            size_t c = cap ? cap * 2 : 256;
+            while (c < len + n) c *= 2;
+            uint8_t* d = (uint8_t*)heap_caps_realloc(data, c, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (!d) d = (uint8_t*)heap_caps_realloc(data, c, MALLOC_CAP_8BIT);
+            if (!d) {
+                ok = false;
+                return;
+            }
+            data = d;
+            cap = c;
+        }
+        memcpy(data + len, p, n);
+        len += n;
+    }
+    void tag(uint8_t t) { put(&t, 1); }
+    void u32(uint32_t v) { put(&v, sizeof(v)); }
+};
+
+bool packValue(lua_State* L, int idx, Writer& w, int depth, const char** err) {
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            w.tag(TAG_NIL);
+            return true;
+        case LUA_TBOOLEAN:
+            w.tag(lua_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE);
+            return true;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                lua_Integer v = lua_tointeger(L, idx);
+                w.tag(TAG_INT);
+                w.put(&v, sizeof(v));
+            } else {
+                lua_Number v = lua_tonumber(L, idx);
+                w.tag(TAG_FLOAT);
+                w.put(&v, sizeof(v));
+            }
+            return true;
+        case LUA_TSTRING: {
+            size_t n;
+            const char* s = lua_tolstring(L, idx, &n);
+            w.tag(TAG_STRING);
+            w.u32((uint32_t)n);
+            w.put(s, n);
+            return true;
+        }
+        case LUA_TTABLE: {
+            if (depth >= LUA_PACK_MAX_DEPTH || !lua_checkstack(L, 3)) {
+                *err = "nesting too deep (cyclic table?)";
+                return false;
+            }
+            idx = lua_absindex(L, idx);
+            // Count first so the receiver can size the table in one go
+            uint32_t count = 0;
+            lua_pushnil(L);
+            while (lua_next(L, idx) != 0) {
+                lua_pop(L, 1);
+                count++;
+            }
+            w.tag(TAG_TABLE);
+            w.u32(count);
+            lua_pushnil(L);
+            while (lua_next(L, idx) != 0) {
+                if (!packValue(L, -2, w, depth + 1, err) || !packValue(L, -1, w, depth + 1, err)) {
+                    lua_pop(L, 2);
+                    return false;
+                }
+                lua_pop(L, 1);
+            }
+            return true;
+        }
+        default:
+            *err = "functions, userdata and threads can't be passed between Lua states";
+            return false;
+    }
+}
+
+struct Reader {
+    const uint8_t* p;
+    const uint8_t* end;
+
+    bool get(void* out, size_t n) {
+        if ((size_t)(end - p) < n) return false;
+        memcpy(out, p, n);
+        p += n;
+        return true;
+    }
+};
+
+bool unpackValue(lua_State* L, Reader& r, int depth) {
+    uint8_t tag;
+    if (!r.get(&tag, 1)) return false;
+    switch (tag) {
+        case TAG_NIL:
+            lua_pushnil(L);
+            return true;
+        case TAG_FALSE:
+        case TAG_TRUE:
+            lua_pushboolean(L, tag == TAG_TRUE);
+            return true;
+        case TAG_INT: {
+            lua_Integer v;
+            if (!r.get(&v, sizeof(v))) return false;
+            lua_pushinteger(L, v);
+            return true;
+        }
+        case TAG_FLOAT: {
+            lua_Number v;
+            if (!r.get(&v, sizeof(v))) return false;
+            lua_pushnumber(L, v);
+            return true;
+        }
+        case TAG_STRING: {
+            uint32_t n;
+            if (!r.get(&n, sizeof(n)) || (size_t)(r.end - r.p) < n) return false;
+            lua_pushlstring(L, (const char*)r.p, n);
+            r.p += n;
+            return true;
+        }
+        case TAG_TABLE: {
+            uint32_t count;
+            // Every entry takes at least two bytes
+            if (depth >= LUA_PACK_MAX_DEPTH || !r.get(&count, sizeof(count)) ||
+                count > (size_t)(r.end - r.p) / 2 || !lua_checkstack(L, 3)) {
+                return false;
+            }
+            lua_createtable(L, 0, (int)count);
+            for (uint32_t i = 0; i < count; i++) {
+                if (!unpackValue(L, r, depth + 1)) {
+                    lua_pop(L, 1);
+                    return false;
+                }
+                if (lua_isnil(L, -1)) {
+                    lua_pop(L, 2);
+                    return false;
+                }
+                if (!unpackValue(L, r, depth + 1)) {
+                    lua_pop(L, 2);
+                    return false;
+                }
+                lua_rawset(L, -3);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+bool luaPack(lua_State* L, int first, int count, LuaPacked& out, const char** err) {
+    first = lua_absindex(L, first);
+    Writer w;
+    w.u32((uint32_t)count);
+    for (int i = 0; i < count; i++) {
+        if (!packValue(L, first + i, w, 0, err)) {
+            heap_caps_free(w.data);
+            return false;
+        }
+    }
+    if (!w.ok) {
+        heap_caps_free(w.data);
+        *err = "out of memory";
+        return false;
+    }
+    out.data = w.data;
+    out.len = w.len;
+    return true;
+}
+
+int luaUnpack(lua_State* L, const uint8_t* data, size_t len) {
+    int top = lua_gettop(L);
+    Reader r = {data, data + len};
+    uint32_t count;
+    if (!r.get(&count, sizeof(count)) || count > len || !lua_checkstack(L, (int)count + 3)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!unpackValue(L, r, 0)) {
+            lua_settop(L, top);
+            return -1;
+        }
+    }
+    return (int)count;
+}
+
+void luaPackFree(LuaPacked& packed) {
+    heap_caps_free(packed.data);
+    packed.data = nullptr;
+    packed.len = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" {
+#include <lua.h>
+}
+
+// Copies plain Lua values between states (see worker.h) as a flat byte
+// string: the sender packs into a PSRAM block, the receiver unpacks it
+// into fresh values, so neither thread ever touches the other's state.
+//
+// Plain data means nil, booleans, integers, floats, strings and tables
+// of those. Integers and floats keep their subtype. Table keys may be any
+// of these except nil. Functions, userdata and threads are refused, as
+// are tables nested deeper than MAX_DEPTH (which catches cycles); a table
+// reachable twice is copied twice. Metatables are not carried.
+
+static constexpr int LUA_PACK_MAX_DEPTH = 32;
+
+struct LuaPacked {
+    uint8_t* data;          // heap_caps block, PSRAM preferred; caller frees
+    size_t len;
+};
+
+// Pack the `count` values starting at stack index `first`. On failure
+// returns false with *err set and nothing allocated.
+bool luaPack(lua_State* L, int first, int count, LuaPacked& out, const char** err);
+
+// Push the values in `data`. Returns how many were pushed, or -1 (with
+// the stack as it was) if the data is malformed.
+int luaUnpack(lua_State* L, const uint8_t* data, size_t len);
+
+void luaPackFree(LuaPacked& packed);
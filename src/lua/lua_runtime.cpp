@@ -1,6 +1,11 @@
 #include "lua_runtime.h"
 #include "async.h"
+#include "scheduler.h"
+#include "worker.h"
 #include "embedded_scripts.h"
+#include "script_loader.h"
+#include "profiler.h"
+#include "frame_stats.h"
 #include "../config.h"
 #include "../util/log.h"
 #include <esp_heap_caps.h>
@@ -30,6 +35,13 @@ void registerCryptoModule(lua_State* L);
 void registerCompressionModule(lua_State* L);
 // On-device documentation (embedded markdown)
 void registerDocsModule(lua_State* L);
+// Sampling profiler
+void registerProfilerModule(lua_State* L);
+void registerTraceModule(lua_State* L);
+// Persistent message history
+void registerMessagesModule(lua_State* L);
+// PSRAM byte buffers (accepted by the binary APIs below)
+#include "bindings/buffer_bindings.h"
 // GPS module
 #include "bindings/gps_bindings.h"
 // WiFi module
@@ -61,36 +73,17 @@ LuaRuntime::~LuaRuntime() {
 void* LuaRuntime::luaAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
     LuaRuntime* self = static_cast<LuaRuntime*>(ud);
 
-    // Free operation
-    if (nsize == 0) {
-        if (ptr != nullptr) {
-            self->_memoryUsed -= osize;
-            heap_caps_free(ptr);
-        }
-        return nullptr;
-    }
-
-    // Allocation or reallocation - always prefer PSRAM
-    void* newPtr = nullptr;
-
-    // Try PSRAM first
-    if (ptr == nullptr) {
-        newPtr = heap_caps_malloc(nsize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    } else {
-        newPtr = heap_caps_realloc(ptr, nsize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    }
+    // Small blocks come from the slab's PSRAM arenas; larger ones go to
+    // heap_caps (PSRAM first, internal RAM if PSRAM is exhausted).
+    void* newPtr = self->_slab.alloc(ptr, osize, nsize);
 
-    // Fall back to internal RAM only if PSRAM allocation failed
-    if (newPtr == nullptr) {
-        if (ptr == nullptr) {
-            newPtr = heap_caps_malloc(nsize, MALLOC_CAP_8BIT);
-        } else {
-            newPtr = heap_caps_realloc(ptr, nsize, MALLOC_CAP_8BIT);
-        }
-    }
-
-    if (newPtr != nullptr) {
-        self->_memoryUsed = self->_memoryUsed - osize + nsize;
+    // When ptr is null, osize is Lua's object type tag rather than a size.
+    size_t oldSize = ptr ? osize : 0;
+    if (nsize == 0) {
+        self->_memoryUsed -= oldSize;
+    } else if (newPtr != nullptr) {
+        self->_memoryUsed = self->_memoryUsed - oldSize + nsize;
+        if (!ptr) self->_allocCount++;
     }
 
     return newPtr;
@@ -165,11 +158,14 @@ bool LuaRuntime::init() {
 
 void LuaRuntime::shutdown() {
     if (_state != nullptr) {
+        LuaProfiler::instance().stop();
         http_bindings::shutdown();
         ota_bindings::shutdown();
         lua_close(_state);
         _state = nullptr;
+        _slab.releaseAll();
         _memoryUsed = 0;
+        _gcManual = false;
         LOG("LuaRuntime", "Shutdown complete");
     }
 }
@@ -189,6 +185,9 @@ void LuaRuntime::registerAllModules() {
     registerDisplayModule(_state);
     registerKeyboardModule(_state);
 
+    // ez.buffer (PSRAM byte buffers taken by the binary APIs)
+    buffer_bindings::registerBindings(_state);
+
     // Phase 3 modules
     registerRadioModule(_state);
     registerMeshModule(_state);
@@ -200,6 +199,9 @@ void LuaRuntime::registerAllModules() {
     registerCryptoModule(_state);
     registerCompressionModule(_state);
     registerDocsModule(_state);
+    registerProfilerModule(_state);
+    registerTraceModule(_state);
+    registerMessagesModule(_state);
 
     // GPS module
     gps_bindings::registerBindings(_state);
@@ -207,6 +209,12 @@ void LuaRuntime::registerAllModules() {
     // Async I/O bindings (async_read, async_write, async_exists)
     AsyncIO::registerBindings(_state);
 
+    // Coroutine scheduler (spawn, defer, wait_ms)
+    Scheduler::registerBindings(_state);
+
+    // Background Lua state on Core 0 (ez.worker)
+    LuaWorker::registerBindings(_state);
+
     // Message bus module
     registerBusModule(_state);
 
@@ -284,7 +292,7 @@ bool LuaRuntime::executeFile(const char* path) {
     // Handle $ prefix: embedded system scripts (instant, no I/O)
     if (path[0] == '$') {
         size_t size = 0;
-        const char* embedded = embedded_lua::get_script(path, &size);
+        const char* embedded = ScriptLoader::instance().findEmbedded(path, &size);
         if (embedded != nullptr) {
             return executeBuffer(embedded, size, path);
         }
@@ -298,20 +306,9 @@ bool LuaRuntime::executeFile(const char* path) {
     if (strncmp(path, "/sd/", 4) == 0) {
         const char* fsPath = path + 3;  // Strip "/sd"
         if (SD.begin(SD_CS)) {
-            File file = SD.open(fsPath, "r");
-            if (file) {
-                size_t fileSize = file.size();
-                char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-                if (buffer) {
-                    size_t bytesRead = file.read((uint8_t*)buffer, fileSize);
-                    file.close();
-                    buffer[bytesRead] = '\0';
-                    bool result = executeBuffer(buffer, bytesRead, path);
-                    heap_caps_free(buffer);
-                    return result;
-                }
-                file.close();
-            }
+            bool found;
+            bool result = executeScriptFile(SD, fsPath, path, found);
+            if (found) return result;
         }
         char err[128];
         snprintf(err, sizeof(err), "Script not found on SD: %s", path);
@@ -322,20 +319,9 @@ bool LuaRuntime::executeFile(const char* path) {
     // Handle explicit /fs/ path
     if (strncmp(path, "/fs/", 4) == 0) {
         const char* fsPath = path + 3;  // Strip "/fs"
-        File file = LittleFS.open(fsPath, "r");
-        if (file) {
-            size_t fileSize = file.size();
-            char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-            if (buffer) {
-                size_t bytesRead = file.read((uint8_t*)buffer, fileSize);
-                file.close();
-                buffer[bytesRead] = '\0';
-                bool result = executeBuffer(buffer, bytesRead, path);
-                heap_caps_free(buffer);
-                return result;
-            }
-            file.close();
-        }
+        bool found;
+        bool result = executeScriptFile(LittleFS, fsPath, path, found);
+        if (found) return result;
         char err[128];
         snprintf(err, sizeof(err), "Script not found on FS: %s", path);
         reportError(err);
@@ -359,38 +345,16 @@ bool LuaRuntime::executeFile(const char* path) {
     // Legacy /scripts/ paths: try SD > FS > embedded
     if (strncmp(path, "/scripts/", 9) == 0) {
         // 1. Try SD card
+        bool found = false;
+        bool result = false;
         if (SD.begin(SD_CS)) {
-            File file = SD.open(path, "r");
-            if (file) {
-                size_t fileSize = file.size();
-                char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-                if (buffer) {
-                    size_t bytesRead = file.read((uint8_t*)buffer, fileSize);
-                    file.close();
-                    buffer[bytesRead] = '\0';
-                    bool result = executeBuffer(buffer, bytesRead, path);
-                    heap_caps_free(buffer);
-                    return result;
-                }
-                file.close();
-            }
+            result = executeScriptFile(SD, path, path, found);
+            if (found) return result;
         }
 
         // 2. Try LittleFS
-        File fsFile = LittleFS.open(path, "r");
-        if (fsFile) {
-            size_t fileSize = fsFile.size();
-            char* buffer = (char*)heap_caps_malloc(fileSize + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-            if (buffer) {
-                size_t bytesRead = fsFile.read((uint8_t*)buffer, fileSize);
-                fsFile.close();
-                buffer[bytesRead] = '\0';
-                bool result = executeBuffer(buffer, bytesRead, path);
-                heap_caps_free(buffer);
-                return result;
-            }
-            fsFile.close();
-        }
+        result = executeScriptFile(LittleFS, path, path, found);
+        if (found) return result;
 
         // 3. Fall back to embedded
         size_t size = 0;
@@ -419,6 +383,29 @@ bool LuaRuntime::executeBuffer(const char* buffer, size_t size, const char* name
 
     // Load the script from buffer
     int status = luaL_loadbuffer(_state, buffer, size, name);
+    return runLoadedChunk(errfunc, status);
+}
+
+bool LuaRuntime::executeScriptFile(fs::FS& fs, const char* fsPath, const char* name, bool& found) {
+    found = true;
+    if (_state == nullptr) {
+        reportError("Lua not initialized");
+        return false;
+    }
+
+    lua_pushcfunction(_state, errorHandler);
+    int errfunc = lua_gettop(_state);
+
+    int status = ScriptLoader::instance().loadFile(_state, fs, fsPath, name);
+    if (status < 0) {
+        found = false;
+        lua_pop(_state, 1);  // error handler
+        return false;
+    }
+    return runLoadedChunk(errfunc, status);
+}
+
+bool LuaRuntime::runLoadedChunk(int errfunc, int status) {
     if (status != LUA_OK) {
         const char* err = lua_tostring(_state, -1);
         reportError(err ? err : "Load error");
@@ -441,6 +428,7 @@ bool LuaRuntime::executeBuffer(const char* buffer, size_t size, const char* name
 
 bool LuaRuntime::callGlobalFunction(const char* name) {
     if (_state == nullptr) return false;
+    LuaProfiler::instance().resync();
 
     // Push error handler
     lua_pushcfunction(_state, errorHandler);
@@ -566,25 +554,137 @@ extern void processLuaTimers();
 void LuaRuntime::update() {
     if (_state == nullptr) return;
 
+    // Ticks since Lua last ran were spent outside it
+    LuaProfiler::instance().resync();
+
+    FrameStats& frameStats = FrameStats::instance();
+
     // Process pending timers
+    frameStats.enter(FramePhase::TIMERS);
     processLuaTimers();
+    frameStats.leave();
 
-    // Process async I/O completions (resumes waiting coroutines)
+    // Process async I/O and worker completions (wakes waiting coroutines)
+    frameStats.enter(FramePhase::ASYNC_IO);
     AsyncIO::instance().update();
+    LuaWorker::instance().update();
+    frameStats.leave();
 
-    // Process HTTP responses (resumes waiting coroutines)
+    // Process HTTP responses (wakes waiting coroutines)
+    frameStats.enter(FramePhase::HTTP);
     http_bindings::update(_state);
+    frameStats.leave();
+
+    // Resume what the above woke, plus deferred and sleeping coroutines
+    frameStats.enter(FramePhase::COROUTINES);
+    Scheduler::instance().run();
+    frameStats.leave();
 
     // Pump the dev OTA web server when it's running. Runs from the
     // Lua update loop so the bus events it posts land on the same
     // tick as everything else.
+    frameStats.enter(FramePhase::DEV_SERVER);
     ota_bindings::update();
+    frameStats.leave();
 
     // Process message bus (delivers queued messages to subscribers)
+    frameStats.enter(FramePhase::BUS);
     MessageBus::instance().process(_state);
+    frameStats.leave();
+
+    // GC runs separately in runFrameGC(), after the frame has rendered.
+}
 
-    // Note: GC is handled by Lua-side scheduler every 2 seconds
-    // Running per-frame GC here was redundant (~100 calls/sec vs 0.5/sec)
+// Histogram bucket upper bounds (microseconds); see GCStats.
+const uint32_t LuaRuntime::GC_HIST_BOUNDS_US[LuaRuntime::GC_HIST_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2000, 5000, 10000
+};
+
+// Input within this window counts as a burst: GC steps wait for it to end.
+static const uint32_t GC_INPUT_QUIET_MS = 150;
+// ...but never starve the collector for longer than this.
+static const uint32_t GC_MAX_DEFER_MS = 1000;
+// Start a new incremental cycle once the heap has grown this much (percent)
+// past its size at the end of the previous one, like Lua's own gcpause.
+static const size_t GC_CYCLE_PAUSE_PCT = 150;
+// Upper bound on idle time spent in GC in one frame.
+static const uint32_t GC_MAX_IDLE_US = 8000;
+
+static void recordPause(uint32_t* hist, uint32_t us) {
+    int i = 0;
+    while (i < LuaRuntime::GC_HIST_BUCKETS - 1 && us > LuaRuntime::GC_HIST_BOUNDS_US[i]) i++;
+    hist[i]++;
+}
+
+void LuaRuntime::runFrameGC(uint32_t idleUs) {
+    if (_state == nullptr) return;
+
+    // Boot scripts run before the first frame with Lua's automatic
+    // collector; from here on this function owns the pacing. Explicit
+    // collectgarbage() calls and Lua's emergency GC still work.
+    if (!_gcManual) {
+        lua_gc(_state, LUA_GCSTOP);
+        _gcManual = true;
+        _gcCycleEndBytes = _memoryUsed;
+    }
+
+    uint32_t now = millis();
+
+    if (_memoryUsed >= _gcNextFull) {
+        uint32_t t0 = micros();
+        lua_gc(_state, LUA_GCCOLLECT);
+        uint32_t pause = micros() - t0;
+
+        // If live data alone is near the threshold, push the next full
+        // collect out rather than collecting every frame.
+        size_t after = _memoryUsed;
+        _gcNextFull = _gcFullThreshold;
+        if (after + after / 2 > _gcNextFull) _gcNextFull = after + after / 2;
+        _gcBetweenCycles = true;
+        _gcCycleEndBytes = after;
+        _lastGCFrameMs = now;
+
+        _gcStats.fullCollects++;
+        _gcStats.lastPauseUs = pause;
+        if (pause > _gcStats.maxPauseUs) _gcStats.maxPauseUs = pause;
+        recordPause(_gcStats.fullHist, pause);
+        return;
+    }
+
+    if (_gcBetweenCycles &&
+        _memoryUsed * 100 < _gcCycleEndBytes * GC_CYCLE_PAUSE_PCT) {
+        return;  // Not enough new garbage to be worth a cycle
+    }
+
+    if (now - _lastInputMs < GC_INPUT_QUIET_MS &&
+        now - _lastGCFrameMs < GC_MAX_DEFER_MS) {
+        _gcStats.skippedInput++;
+        return;
+    }
+
+    uint32_t budget = idleUs > _gcBudgetUs ? idleUs : _gcBudgetUs;
+    if (budget > GC_MAX_IDLE_US) budget = GC_MAX_IDLE_US;
+
+    uint32_t t0 = micros();
+    uint32_t elapsed = 0;
+    do {
+        _gcStats.steps++;
+        _gcBetweenCycles = false;
+        if (lua_gc(_state, LUA_GCSTEP, 0)) {
+            _gcBetweenCycles = true;
+            _gcCycleEndBytes = _memoryUsed;
+            _gcStats.cycles++;
+            elapsed = micros() - t0;
+            break;
+        }
+        elapsed = micros() - t0;
+    } while (elapsed < budget);
+
+    _lastGCFrameMs = now;
+    _gcStats.frames++;
+    _gcStats.lastPauseUs = elapsed;
+    if (elapsed > _gcStats.maxPauseUs) _gcStats.maxPauseUs = elapsed;
+    recordPause(_gcStats.stepHist, elapsed);
 }
 
 bool LuaRuntime::reloadScripts() {
@@ -2,9 +2,11 @@
 
 #include <Arduino.h>
 #include <functional>
+#include "lua_slab.h"
 
 // Forward declarations to avoid including full Lua headers everywhere
 struct lua_State;
+namespace fs { class FS; }
 
 // Callback types for Lua events
 using LuaErrorCallback = std::function<void(const char* error)>;
@@ -40,6 +42,11 @@ public:
     // Load and execute an embedded script by path (e.g., "/scripts/boot.lua")
     bool executeFile(const char* path);
 
+    // Load `fsPath` from SD or LittleFS through the bytecode cache (see
+    // ScriptLoader::loadFile) and execute it. `found` is false, with no
+    // error reported, if the file can't be opened.
+    bool executeScriptFile(fs::FS& fs, const char* fsPath, const char* name, bool& found);
+
     // Call a global Lua function with no arguments
     bool callGlobalFunction(const char* name);
 
@@ -63,6 +70,12 @@ public:
     // Get memory usage info
     size_t getMemoryUsed() const { return _memoryUsed; }
 
+    // Blocks allocated since the state was created (reallocs not counted)
+    uint32_t getAllocCount() const { return _allocCount; }
+
+    // Lua heap allocator (size-class stats, allocation tracing)
+    LuaSlab& getSlab() { return _slab; }
+
     // Error handling
     void setErrorCallback(LuaErrorCallback callback) { _errorCallback = callback; }
     const char* getLastError() const { return _lastError; }
@@ -79,6 +92,36 @@ public:
     void setGCPause(int pause);
     void setGCStepMul(int stepmul);
 
+    // Frame-budgeted GC. Call once per loop() after main_loop (i.e. after
+    // the screen has rendered). Spends up to `idleUs` microseconds (never
+    // less than the configured budget) on incremental steps; backs off
+    // while input is arriving, and does a full collect only when the heap
+    // crosses the full-collect threshold.
+    void runFrameGC(uint32_t idleUs);
+    void noteInput() { _lastInputMs = millis(); }
+    void setGCBudget(uint32_t us) { _gcBudgetUs = us; }
+    uint32_t getGCBudget() const { return _gcBudgetUs; }
+    void setGCFullThreshold(size_t bytes) { _gcFullThreshold = bytes; _gcNextFull = bytes; }
+    size_t getGCFullThreshold() const { return _gcFullThreshold; }
+
+    // Per-frame GC pause histogram. Bucket i counts pauses up to
+    // GC_HIST_BOUNDS_US[i]; the last bucket is everything longer.
+    static constexpr int GC_HIST_BUCKETS = 8;
+    static const uint32_t GC_HIST_BOUNDS_US[GC_HIST_BUCKETS - 1];
+    struct GCStats {
+        uint32_t frames;          // Frames that ran incremental steps
+        uint32_t steps;           // LUA_GCSTEP calls
+        uint32_t cycles;          // Incremental cycles completed
+        uint32_t fullCollects;    // Threshold-triggered full collects
+        uint32_t skippedInput;    // Frames skipped because input was arriving
+        uint32_t maxPauseUs;      // Longest single-frame GC pause
+        uint32_t lastPauseUs;
+        uint32_t stepHist[GC_HIST_BUCKETS];
+        uint32_t fullHist[GC_HIST_BUCKETS];
+    };
+    const GCStats& getGCStats() const { return _gcStats; }
+    void resetGCStats() { _gcStats = {}; }
+
     // Memory pressure handling
     bool isLowMemory() const;
     size_t getAvailableMemory() const;
@@ -87,12 +130,29 @@ private:
     LuaRuntime() = default;
     ~LuaRuntime();
 
+    // Run the chunk loaded above the error handler at `errfunc`, or report
+    // the load error there when `status` isn't LUA_OK
+    bool runLoadedChunk(int errfunc, int status);
+
     lua_State* _state = nullptr;
     size_t _memoryUsed = 0;
+    uint32_t _allocCount = 0;
+    LuaSlab _slab;
+
+    // Frame GC state
+    bool _gcManual = false;         // Automatic collector stopped
+    bool _gcBetweenCycles = true;   // Last step finished a cycle
+    size_t _gcCycleEndBytes = 0;    // Heap size when the last cycle finished
+    uint32_t _gcBudgetUs = 1000;
+    size_t _gcFullThreshold = 4 * 1024 * 1024;
+    size_t _gcNextFull = 4 * 1024 * 1024;
+    uint32_t _lastInputMs = 0;
+    uint32_t _lastGCFrameMs = 0;
+    GCStats _gcStats = {};
     char _lastError[256] = {0};
     LuaErrorCallback _errorCallback = nullptr;
 
-    // Custom allocator for PSRAM support
+    // Custom allocator: slab for small blocks, PSRAM heap for the rest
     static void* luaAlloc(void* ud, void* ptr, size_t osize, size_t nsize);
 
     // Error handler for protected calls
@@ -0,0 +1,231 @@
+#include "lua_slab.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#define SLAB_CAPS_PSRAM     (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define SLAB_CAPS_INTERNAL  (MALLOC_CAP_8BIT)
+#define SLAB_MALLOC(n, caps)        heap_caps_malloc((n), (caps))
+#define SLAB_REALLOC(p, n, caps)    heap_caps_realloc((p), (n), (caps))
+#define SLAB_FREE(p)                heap_caps_free(p)
+#else
+// Host build (allocation replay benchmark): one flat heap, caps ignored.
+#include <stdlib.h>
+#define SLAB_CAPS_PSRAM     0
+#define SLAB_CAPS_INTERNAL  0
+#define SLAB_MALLOC(n, caps)        malloc(n)
+#define SLAB_REALLOC(p, n, caps)    realloc((p), (n))
+#define SLAB_FREE(p)                free(p)
+#endif
+
+// Block sizes are multiples of 8 so every block keeps lua_Number /
+// pointer alignment. The spacing is dense where Lua 5.4 objects cluster
+// (TString headers, Table = 56 B, LClosure/UpVal = 32-40 B on 32-bit)
+// and coarser towards MAX_SMALL.
+static const uint16_t CLASS_SIZES[LuaSlab::NUM_CLASSES] = {
+    8, 16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256
+};
+
+// (size + 7) / 8 -> class index, for sizes 1..MAX_SMALL.
+static int8_t s_classLookup[LuaSlab::MAX_SMALL / 8 + 1];
+static bool s_lookupReady = false;
+
+static void buildLookup() {
+    int cls = 0;
+    for (size_t i = 0; i <= LuaSlab::MAX_SMALL / 8; i++) {
+        size_t size = i * 8;
+        while (cls < LuaSlab::NUM_CLASSES - 1 && CLASS_SIZES[cls] < size) cls++;
+        s_classLookup[i] = (int8_t)cls;
+    }
+    s_lookupReady = true;
+}
+
+int LuaSlab::classFor(size_t size) {
+    return s_classLookup[(size + 7) >> 3];
+}
+
+void LuaSlab::initClasses() {
+    if (!s_lookupReady) buildLookup();
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        _classes[i].freeList = nullptr;
+        _classes[i].stats = {};
+        _classes[i].stats.size = CLASS_SIZES[i];
+    }
+    _classesInit = true;
+}
+
+bool LuaSlab::newArena() {
+    if (_arenaCount >= MAX_ARENAS) return false;
+
+    size_t size = ARENA_SIZE;
+    void* arena = SLAB_MALLOC(size, SLAB_CAPS_PSRAM);
+    if (!arena) {
+        size = FALLBACK_ARENA_SIZE;
+        arena = SLAB_MALLOC(size, SLAB_CAPS_INTERNAL);
+    }
+    if (!arena) return false;
+
+    _arenas[_arenaCount++] = arena;
+    _arenaBytes += size;
+
+    // heap_caps only guarantees 4-byte alignment; blocks need 8.
+    uintptr_t start = ((uintptr_t)arena + 7) & ~(uintptr_t)7;
+    _bump = (uint8_t*)start;
+    _bumpEnd = (uint8_t*)arena + size;
+    return true;
+}
+
+void* LuaSlab::allocSmall(int cls) {
+    SizeClass& sc = _classes[cls];
+    void* block;
+
+    if (sc.freeList) {
+        block = sc.freeList;
+        sc.freeList = sc.freeList->next;
+    } else {
+        size_t size = sc.stats.size;
+        if (_bump == nullptr || (size_t)(_bumpEnd - _bump) < size) {
+            // Whatever is left of the old arena stays uncarved; at most
+            // MAX_SMALL - 8 bytes per 64 KB arena.
+            if (!newArena()) return nullptr;
+        }
+        block = _bump;
+        _bump += size;
+        sc.stats.carved++;
+    }
+
+    sc.stats.allocs++;
+    sc.stats.live++;
+    if (sc.stats.live > sc.stats.peak) sc.stats.peak = sc.stats.live;
+    return block;
+}
+
+void LuaSlab::freeSmall(void* ptr, int cls) {
+    SizeClass& sc = _classes[cls];
+    FreeBlock* fb = static_cast<FreeBlock*>(ptr);
+    fb->next = sc.freeList;
+    sc.freeList = fb;
+    sc.stats.frees++;
+    sc.stats.live--;
+}
+
+void* LuaSlab::allocLarge(size_t size) {
+    // Prefer PSRAM; internal RAM only if PSRAM is exhausted.
+    void* p = SLAB_MALLOC(size, SLAB_CAPS_PSRAM);
+    if (!p) p = SLAB_MALLOC(size, SLAB_CAPS_INTERNAL);
+    if (p) {
+        _largeAllocs++;
+        _largeLive++;
+        _largeBytes += size;
+    }
+    return p;
+}
+
+void* LuaSlab::reallocLarge(void* ptr, size_t osize, size_t nsize) {
+    void* p = SLAB_REALLOC(ptr, nsize, SLAB_CAPS_PSRAM);
+    if (!p) p = SLAB_REALLOC(ptr, nsize, SLAB_CAPS_INTERNAL);
+    if (p) _largeBytes = _largeBytes - osize + nsize;
+    return p;
+}
+
+void LuaSlab::freeLarge(void* ptr, size_t size) {
+    SLAB_FREE(ptr);
+    _largeLive--;
+    _largeBytes -= size;
+}
+
+void LuaSlab::record(void* ptr, void* result, size_t osize, size_t nsize) {
+    if (_traceCount >= _traceCap) return;
+    TraceEvent& ev = _trace[_traceCount++];
+    ev.ptr = (uint32_t)(uintptr_t)ptr;
+    ev.result = (uint32_t)(uintptr_t)result;
+    ev.osize = (uint32_t)osize;
+    ev.nsize = (uint32_t)nsize;
+}
+
+void* LuaSlab::alloc(void* ptr, size_t osize, size_t nsize) {
+    if (!_classesInit) initClasses();
+
+    void* result = nullptr;
+
+    if (ptr == nullptr) {
+        // Fresh allocation; osize is a type tag, not a size.
+        if (nsize == 0) return nullptr;
+        result = nsize <= MAX_SMALL ? allocSmall(classFor(nsize)) : allocLarge(nsize);
+    } else if (nsize == 0) {
+        if (osize <= MAX_SMALL) freeSmall(ptr, classFor(osize));
+        else freeLarge(ptr, osize);
+    } else if (osize <= MAX_SMALL && nsize <= MAX_SMALL) {
+        int oc = classFor(osize);
+        int nc = classFor(nsize);
+        if (oc == nc) {
+            result = ptr;
+        } else {
+            result = allocSmall(nc);
+            if (result) {
+                memcpy(result, ptr, osize < nsize ? osize : nsize);
+                freeSmall(ptr, oc);
+            }
+        }
+    } else if (osize > MAX_SMALL && nsize > MAX_SMALL) {
+        result = reallocLarge(ptr, osize, nsize);
+    } else {
+        // Crossing the small/large boundary: move the block so the next
+        // free can find it from its size alone.
+        result = nsize <= MAX_SMALL ? allocSmall(classFor(nsize)) : allocLarge(nsize);
+        if (result) {
+            memcpy(result, ptr, osize < nsize ? osize : nsize);
+            if (osize <= MAX_SMALL) freeSmall(ptr, classFor(osize));
+            else freeLarge(ptr, osize);
+        }
+    }
+
+    if (_trace) record(ptr, result, osize, nsize);
+    return result;
+}
+
+void LuaSlab::releaseAll() {
+    stopTrace();
+    for (int i = 0; i < _arenaCount; i++) {
+        SLAB_FREE(_arenas[i]);
+        _arenas[i] = nullptr;
+    }
+    _arenaCount = 0;
+    _arenaBytes = 0;
+    _bump = _bumpEnd = nullptr;
+    _largeAllocs = _largeLive = _largeBytes = 0;
+    initClasses();
+}
+
+void LuaSlab::getStats(Stats& out) const {
+    out = {};
+    out.arenaCount = _arenaCount;
+    out.arenaBytes = _arenaBytes;
+    out.arenaUnused = _bump ? (uint32_t)(_bumpEnd - _bump) : 0;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        const ClassStats& s = _classes[i].stats;
+        out.slabLiveBytes += s.live * s.size;
+        out.slabFreeBytes += (s.carved - s.live) * s.size;
+    }
+    out.largeAllocs = _largeAllocs;
+    out.largeLive = _largeLive;
+    out.largeBytes = _largeBytes;
+}
+
+bool LuaSlab::startTrace(size_t maxEvents) {
+    stopTrace();
+    if (maxEvents == 0) return false;
+    _trace = (TraceEvent*)SLAB_MALLOC(maxEvents * sizeof(TraceEvent), SLAB_CAPS_PSRAM);
+    if (!_trace) return false;
+    _traceCap = maxEvents;
+    _traceCount = 0;
+    return true;
+}
+
+void LuaSlab::stopTrace() {
+    if (_trace) SLAB_FREE(_trace);
+    _trace = nullptr;
+    _traceCap = 0;
+    _traceCount = 0;
+}
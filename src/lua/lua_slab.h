@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size-class slab allocator for the Lua heap.
+//
+// Lua's allocation mix is dominated by 16-64 byte strings, tables, closures
+// and upvalues. Routing each of those through heap_caps_malloc takes the
+// global heap lock and scatters tiny blocks across PSRAM. Instead, blocks up
+// to MAX_SMALL bytes are carved from 64 KB PSRAM arenas into per-class free
+// lists; anything bigger falls through to heap_caps as before.
+//
+// No block headers: lua_Alloc passes the old size on every free/realloc, so
+// the size class is always recoverable from `osize`. Blocks never migrate
+// between classes and arenas are only released by releaseAll() when the Lua
+// state is closed.
+//
+// Single owner: only the Lua thread (loop task on Core 1) may call alloc(),
+// so there is no locking. This file has no Arduino dependencies and builds
+// on the host (see tools/bench/lua_alloc_replay.cpp).
+class LuaSlab {
+public:
+    static constexpr size_t MAX_SMALL = 256;
+    static constexpr int NUM_CLASSES = 13;
+    static constexpr size_t ARENA_SIZE = 64 * 1024;
+    // Internal-RAM arena used when PSRAM is exhausted, mirroring the old
+    // allocator's internal fallback. Kept small so it can't starve DMA.
+    static constexpr size_t FALLBACK_ARENA_SIZE = 8 * 1024;
+    static constexpr int MAX_ARENAS = 160;  // 10 MB of PSRAM arenas
+
+    struct ClassStats {
+        uint16_t size;     // Block size in bytes
+        uint32_t allocs;   // Cumulative allocations
+        uint32_t frees;    // Cumulative frees
+        uint32_t live;     // Blocks currently handed out
+        uint32_t peak;     // High-water mark of `live`
+        uint32_t carved;   // Blocks ever carved from arenas (live + free list)
+    };
+
+    struct Stats {
+        uint32_t arenaCount;
+        uint32_t arenaBytes;     // Total bytes held in arenas
+        uint32_t arenaUnused;    // Bytes not yet carved in the current arena
+        uint32_t slabLiveBytes;  // Bytes in live small blocks
+        uint32_t slabFreeBytes;  // Bytes parked on class free lists
+        uint32_t largeAllocs;    // Cumulative heap_caps allocations
+        uint32_t largeLive;      // Large blocks currently allocated
+        uint32_t largeBytes;     // Bytes in live large blocks
+    };
+
+    // One allocator call, as recorded by the optional trace. Pointers are
+    // 32-bit on the ESP32; the replay tool maps them to host pointers.
+    struct TraceEvent {
+        uint32_t ptr;    // Block passed in (0 for fresh allocations)
+        uint32_t result; // Block returned (0 for frees / failures)
+        uint32_t osize;  // As passed by Lua (type tag when ptr == 0)
+        uint32_t nsize;
+    };
+
+    // lua_Alloc semantics: free when nsize == 0, malloc when ptr == nullptr,
+    // otherwise realloc. Returns nullptr on failure (Lua runs an emergency
+    // GC and retries).
+    void* alloc(void* ptr, size_t osize, size_t nsize);
+
+    // Free every arena and reset stats. Only valid once the Lua state that
+    // owns the blocks has been closed.
+    void releaseAll();
+
+    const ClassStats& classStats(int index) const { return _classes[index].stats; }
+    void getStats(Stats& out) const;
+
+    // Allocation tracing for offline replay. Events go to a PSRAM buffer of
+    // `maxEvents` entries; recording stops silently when it fills up.
+    bool startTrace(size_t maxEvents);
+    void stopTrace();
+    bool isTracing() const { return _trace != nullptr; }
+    const TraceEvent* traceEvents() const { return _trace; }
+    size_t traceCount() const { return _traceCount; }
+
+private:
+    struct FreeBlock { FreeBlock* next; };
+
+    struct SizeClass {
+        FreeBlock* freeList = nullptr;
+        ClassStats stats = {};
+    };
+
+    SizeClass _classes[NUM_CLASSES];
+    void* _arenas[MAX_ARENAS] = {};
+    int _arenaCount = 0;
+    uint32_t _arenaBytes = 0;
+    uint8_t* _bump = nullptr;     // Next uncarved byte in the current arena
+    uint8_t* _bumpEnd = nullptr;
+    bool _classesInit = false;
+
+    uint32_t _largeAllocs = 0;
+    uint32_t _largeLive = 0;
+    uint32_t _largeBytes = 0;
+
+    TraceEvent* _trace = nullptr;
+    size_t _traceCap = 0;
+    size_t _traceCount = 0;
+
+    static int classFor(size_t size);
+    void initClasses();
+    void* allocSmall(int cls);
+    void freeSmall(void* ptr, int cls);
+    bool newArena();
+    void* allocLarge(size_t size);
+    void* reallocLarge(void* ptr, size_t osize, size_t nsize);
+    void freeLarge(void* ptr, size_t size);
+    void record(void* ptr, void* result, size_t osize, size_t nsize);
+};
@@ -0,0 +1,165 @@
+#include "profiler.h"
+#include "../util/log.h"
+#include <esp_heap_caps.h>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+LuaProfiler& LuaProfiler::instance() {
+    static LuaProfiler profiler;
+    return profiler;
+}
+
+void LuaProfiler::onTimer(void*) {
+    instance()._ticks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LuaProfiler::onHook(lua_State* L, lua_Debug*) {
+    LuaProfiler& p = instance();
+    if (!p._running) {
+        // A coroutine that inherited the hook outlived the session.
+        lua_sethook(L, nullptr, 0, 0);
+        return;
+    }
+    p._hookCalls++;
+    uint32_t ticks = p._ticks.load(std::memory_order_relaxed);
+    if (ticks == p._lastTick) return;
+    uint32_t weight = ticks - p._lastTick;
+    p._lastTick = ticks;
+    p.sample(L, weight);
+}
+
+bool LuaProfiler::start(lua_State* L, uint32_t hz) {
+    if (_running || !L) return false;
+    if (hz < 10) hz = 10;
+    if (hz > 5000) hz = 5000;
+
+    if (!_mem) {
+        size_t bytes = FoldedStacks::bytesNeeded(FRAME_SLOTS, STACK_SLOTS);
+        _mem = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!_mem) {
+            LOG("Profiler", "No PSRAM for sample tables (%u bytes)", (unsigned)bytes);
+            return false;
+        }
+        _table.attach(_mem, FRAME_SLOTS, STACK_SLOTS);
+        _outsideFrame = _table.insert(FoldedStacks::hash("(outside lua)"), "(outside lua)");
+    }
+
+    if (!_timer) {
+        esp_timer_create_args_t args = {};
+        args.callback = onTimer;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "lua_prof";
+        if (esp_timer_create(&args, &_timer) != ESP_OK) {
+            _timer = nullptr;
+            return false;
+        }
+    }
+
+    // Hook the main thread even when started from a coroutine.
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    _state = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    _hz = hz;
+    _lastTick = _ticks.load(std::memory_order_relaxed);
+    _startUs = micros();
+    lua_sethook(_state, onHook, LUA_MASKCOUNT, HOOK_COUNT);
+    if (L != _state) lua_sethook(L, onHook, LUA_MASKCOUNT, HOOK_COUNT);
+    esp_timer_start_periodic(_timer, 1000000 / hz);
+    _running = true;
+    LOG("Profiler", "Sampling at %lu Hz", (unsigned long)hz);
+    return true;
+}
+
+void LuaProfiler::stop() {
+    if (!_running) return;
+    esp_timer_stop(_timer);
+    lua_sethook(_state, nullptr, 0, 0);
+    resyncSlow();
+    _elapsedUs += micros() - _startUs;
+    _running = false;
+    _state = nullptr;
+}
+
+void LuaProfiler::reset() {
+    _outside = 0;
+    _hookCalls = 0;
+    _sampleUs = 0;
+    _elapsedUs = 0;
+    _startUs = micros();
+    _lastTick = _ticks.load(std::memory_order_relaxed);
+    if (_running) {
+        _table.clear();
+        _outsideFrame = _table.insert(FoldedStacks::hash("(outside lua)"), "(outside lua)");
+        return;
+    }
+    _table.detach();
+    heap_caps_free(_mem);
+    _mem = nullptr;
+    _outsideFrame = FoldedStacks::NO_FRAME;
+}
+
+void LuaProfiler::resyncSlow() {
+    uint32_t ticks = _ticks.load(std::memory_order_relaxed);
+    uint32_t weight = ticks - _lastTick;
+    _lastTick = ticks;
+    if (weight == 0 || _outsideFrame == FoldedStacks::NO_FRAME) return;
+    _outside += weight;
+    _table.add(&_outsideFrame, 1, weight);
+}
+
+void LuaProfiler::sample(lua_State* L, uint32_t weight) {
+    uint32_t t0 = micros();
+    uint16_t ids[FoldedStacks::MAX_DEPTH];
+    size_t depth = 0;
+    lua_Debug ar;
+    char name[FoldedStacks::FRAME_NAME_LEN];
+
+    for (int level = 0; depth < FoldedStacks::MAX_DEPTH && lua_getstack(L, level, &ar); level++) {
+        if (!lua_getinfo(L, "Snf", &ar)) break;
+        // Identity: the C function pointer, or the Lua chunk + line the
+        // function was defined on (shared by every closure of it).
+        uint32_t key;
+        lua_CFunction cf = lua_tocfunction(L, -1);
+        lua_pop(L, 1);
+        if (cf) {
+            key = FoldedStacks::hash((uint32_t)(uintptr_t)cf, 0x811C9DC5u);
+        } else {
+            key = FoldedStacks::hash((uint32_t)(uintptr_t)ar.source, 0x811C9DC5u);
+            key = FoldedStacks::hash((uint32_t)ar.linedefined, key);
+        }
+
+        uint16_t id = _table.find(key);
+        if (id == FoldedStacks::NO_FRAME) {
+            if (cf) {
+                snprintf(name, sizeof(name), "%s [C]", ar.name ? ar.name : "?");
+            } else if (ar.what && ar.what[0] == 'm') {
+                snprintf(name, sizeof(name), "main@%s", ar.short_src);
+            } else {
+                snprintf(name, sizeof(name), "%s@%s:%d", ar.name ? ar.name : "?",
+                         ar.short_src, ar.linedefined);
+            }
+            id = _table.insert(key, name);
+        }
+        ids[depth++] = id;
+    }
+    if (depth > 0) _table.add(ids, depth, weight);
+    _sampleUs += micros() - t0;
+}
+
+LuaProfiler::Stats LuaProfiler::getStats() const {
+    const FoldedStacks::Stats& t = _table.stats();
+    Stats s;
+    s.hz = _hz;
+    s.samples = t.samples;
+    s.outside = _outside;
+    s.stacks = t.stacks;
+    s.frames = t.frames;
+    s.droppedSamples = t.droppedSamples;
+    s.droppedFrames = t.droppedFrames;
+    s.hookCalls = _hookCalls;
+    s.sampleUs = _sampleUs;
+    s.elapsedUs = _elapsedUs + (_running ? micros() - _startUs : 0);
+    return s;
+}
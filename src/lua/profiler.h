@@ -0,0 +1,102 @@
+#pragma once
+
+#include "../util/folded_stacks.h"
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <atomic>
+
+extern "C" {
+#include <lua.h>
+}
+
+// Sampling profiler for Lua code on the main task.
+//
+// A periodic esp_timer bumps a tick counter at the sampling rate; that is
+// all it does. A Lua count hook (every HOOK_COUNT VM instructions) checks
+// the counter and, when it has moved, walks the running coroutine's stack
+// and adds it to a FoldedStacks table in PSRAM, weighted by the ticks that
+// elapsed. Ticks that pass while no Lua runs (rendering, GC, loop delay)
+// are booked to an "(outside lua)" frame at the next Lua entry point, so
+// the folded output covers wall time.
+//
+// The hook is installed on the main thread (and the coroutine that called
+// start()); coroutines created while the profiler runs inherit it, and the
+// scheduler hooks each task it resumes through attach(), so tasks spawned
+// before start() are sampled too. Only coroutines older than start() and
+// resumed by hand with coroutine.resume() go unsampled.
+class LuaProfiler {
+public:
+    static LuaProfiler& instance();
+
+    static constexpr uint32_t DEFAULT_HZ = 1000;
+    static constexpr int HOOK_COUNT = 1000;
+    static constexpr size_t FRAME_SLOTS = 1024;
+    static constexpr size_t STACK_SLOTS = 2048;
+
+    struct Stats {
+        uint32_t hz;
+        uint32_t samples;       // Weighted samples recorded, incl. outside
+        uint32_t outside;       // Ticks with no Lua running
+        uint32_t stacks;
+        uint32_t frames;
+        uint32_t droppedSamples;
+        uint32_t droppedFrames;
+        uint32_t hookCalls;
+        uint32_t sampleUs;      // Time spent walking and recording stacks
+        uint32_t elapsedUs;     // Time profiled so far
+    };
+
+    // Start sampling `L` at `hz`. Allocates the tables on first use.
+    bool start(lua_State* L, uint32_t hz = DEFAULT_HZ);
+    void stop();
+    bool running() const { return _running; }
+
+    // Clear the samples; frees the tables when not running.
+    void reset();
+
+    // Book ticks that elapsed outside Lua. Call before entering Lua.
+    void resync() {
+        if (_running) resyncSlow();
+    }
+
+    // Hook a coroutine about to be resumed; it may predate start().
+    void attach(lua_State* co) {
+        if (_running && lua_gethook(co) != onHook) {
+            lua_sethook(co, onHook, LUA_MASKCOUNT, HOOK_COUNT);
+        }
+    }
+
+    Stats getStats() const;
+
+    // Folded-stack export, see FoldedStacks::writeFolded.
+    size_t writeFolded(size_t& cursor, char* out, size_t cap) const {
+        return _table.writeFolded(cursor, out, cap);
+    }
+    size_t foldedEnd() const { return _table.end(); }
+    bool hasData() const { return _table.attached(); }
+
+private:
+    LuaProfiler() = default;
+
+    static void onTimer(void* arg);
+    static void onHook(lua_State* L, lua_Debug* ar);
+    void resyncSlow();
+    void sample(lua_State* L, uint32_t weight);
+
+    lua_State* _state = nullptr;
+    esp_timer_handle_t _timer = nullptr;
+    std::atomic<uint32_t> _ticks{0};
+    uint32_t _lastTick = 0;
+    bool _running = false;
+
+    FoldedStacks _table;
+    void* _mem = nullptr;
+    uint16_t _outsideFrame = FoldedStacks::NO_FRAME;
+
+    uint32_t _hz = 0;
+    uint32_t _outside = 0;
+    uint32_t _hookCalls = 0;
+    uint32_t _sampleUs = 0;
+    uint32_t _startUs = 0;
+    uint32_t _elapsedUs = 0;   // Accumulated over previous start/stop runs
+};
@@ -0,0 +1,455 @@
+#include "scheduler.h"
+#include "async.h"
+#include "lua_bindings.h"
+#include "profiler.h"
+#include "../util/log.h"
+
+Scheduler& Scheduler::instance() {
+    static Scheduler inst;
+    return inst;
+}
+
+// Next generation for a slot, skipping the one that would make its
+// token NO_TOKEN
+uint32_t Scheduler::nextGen(uint32_t gen) {
+    gen++;
+    if ((gen << SLOT_BITS) == 0) gen++;
+    return gen;
+}
+
+// True if `co` is suspended in a yield or has not started yet (the same
+// test coroutine.status uses for "suspended")
+static bool resumable(lua_State* co) {
+    int status = lua_status(co);
+    if (status == LUA_YIELD) return true;
+    if (status != LUA_OK) return false;
+    lua_Debug ar;
+    return lua_getstack(co, 0, &ar) == 0 && lua_gettop(co) > 0;
+}
+
+void Scheduler::reset(lua_State* L) {
+    // The refs lived in the previous state's registry; nothing to release
+    _L = L;
+    _tasks.clear();
+    _free.clear();
+    _byThread.clear();
+    _ready.clear();
+    _sleepers.clear();
+    _nextId = 1;
+    _live = 0;
+    _running = false;
+    _stats = {};
+}
+
+int Scheduler::findTask(lua_State* co) const {
+    auto it = _byThread.find(co);
+    return it == _byThread.end() ? -1 : it->second;
+}
+
+int Scheduler::slotFor(Token token, State state) const {
+    uint32_t slot = token & SLOT_MASK;
+    if (token == NO_TOKEN || slot >= _tasks.size()) return -1;
+    const Task& t = _tasks[slot];
+    if (t.state != state || tokenFor((uint16_t)slot) != token) return -1;
+    return (int)slot;
+}
+
+int Scheduler::newTask(lua_State* co, int ref, uint32_t parent) {
+    uint16_t slot;
+    if (!_free.empty()) {
+        slot = _free.back();
+        _free.pop_back();
+    } else {
+        if (_tasks.size() == MAX_TASKS) return -1;
+        slot = (uint16_t)_tasks.size();
+        _tasks.push_back(Task{});
+        _tasks[slot].gen = 1;
+    }
+    // The generation carries over so tokens of the slot's previous
+    // occupant stay stale
+    Task& t = _tasks[slot];
+    t.co = co;
+    t.ref = ref;
+    t.id = _nextId++;
+    t.parent = parent;
+    t.wakeAt = 0;
+    t.nargs = 0;
+    t.state = State::RUNNING;
+    t.sleeping = false;
+    t.cancelled = false;
+    t.owned = false;
+    _byThread[co] = slot;
+    _live++;
+    return slot;
+}
+
+void Scheduler::freeTask(uint16_t slot) {
+    Task& t = _tasks[slot];
+    _byThread.erase(t.co);
+    luaL_unref(_L, LUA_REGISTRYINDEX, t.ref);
+    t.co = nullptr;
+    t.ref = LUA_NOREF;
+    t.state = State::FREE;
+    t.gen = nextGen(t.gen);
+    _free.push_back(slot);
+    _live--;
+}
+
+void Scheduler::makeReady(uint16_t slot, int nargs) {
+    Task& t = _tasks[slot];
+    t.state = State::READY;
+    t.nargs = nargs;
+    _ready.push_back(tokenFor(slot));
+    if (_ready.size() > _stats.maxReady) _stats.maxReady = _ready.size();
+}
+
+Scheduler::Token Scheduler::park(lua_State* co) {
+    if (!lua_isyieldable(co)) {
+        luaL_error(co, "attempt to wait outside a coroutine (use spawn)");
+        return NO_TOKEN;
+    }
+    int slot = findTask(co);
+    if (slot < 0) {
+        // Created with coroutine.create: adopt it so its wake-up goes
+        // through the run queue like any other
+        lua_pushthread(co);
+        int ref = luaL_ref(co, LUA_REGISTRYINDEX);
+        slot = newTask(co, ref, 0);
+        if (slot < 0) {
+            luaL_unref(co, LUA_REGISTRYINDEX, ref);
+            luaL_error(co, "too many tasks");
+            return NO_TOKEN;
+        }
+    }
+    Task& t = _tasks[slot];
+    t.gen = nextGen(t.gen);
+    t.state = State::PARKED;
+    t.sleeping = false;
+    return tokenFor((uint16_t)slot);
+}
+
+void Scheduler::unpark(Token token) {
+    int slot = slotFor(token, State::PARKED);
+    if (slot < 0) return;
+    Task& t = _tasks[slot];
+    if (!t.owned) {
+        // Adopted by this park() and never run by us: let go again
+        freeTask((uint16_t)slot);
+        return;
+    }
+    t.gen = nextGen(t.gen);
+    t.state = State::RUNNING;
+}
+
+lua_State* Scheduler::waiter(Token token) const {
+    int slot = slotFor(token, State::PARKED);
+    return slot < 0 ? nullptr : _tasks[slot].co;
+}
+
+bool Scheduler::wake(Token token, int nargs) {
+    int slot = slotFor(token, State::PARKED);
+    if (slot < 0) {
+        _stats.staleWakes++;
+        return false;
+    }
+    _tasks[slot].sleeping = false;
+    makeReady((uint16_t)slot, nargs);
+    return true;
+}
+
+void Scheduler::resume(uint16_t slot, lua_State* from, int nargs) {
+    lua_State* co = _tasks[slot].co;
+    if (!resumable(co)) {
+        // Finished or failed while driven by a plain coroutine.resume()
+        freeTask(slot);
+        return;
+    }
+    _tasks[slot].state = State::RUNNING;
+    _tasks[slot].owned = true;
+    _stats.resumes++;
+    LuaProfiler::instance().attach(co);
+
+    int nresults = 0;
+    int status = lua_resume(co, from, nargs, &nresults);
+
+    // A spawn() inside the task may have grown _tasks: index again
+    Task& t = _tasks[slot];
+    if (status != LUA_OK && status != LUA_YIELD) {
+        reportError(co);
+        freeTask(slot);
+    } else if (status == LUA_OK || t.cancelled) {
+        freeTask(slot);
+    } else if (t.state == State::RUNNING) {
+        // Bare coroutine.yield(): run again next frame
+        lua_pop(co, nresults);
+        t.gen = nextGen(t.gen);
+        makeReady(slot, 0);
+    }
+    // Otherwise it parked (or deferred, which parks and wakes at once)
+}
+
+void Scheduler::reportError(lua_State* co) {
+    _stats.errors++;
+    const char* errMsg = lua_tostring(co, -1);
+    LOG("Scheduler", "Coroutine error: %s", errMsg ? errMsg : "unknown");
+
+    // Call global show_error function to display error screen
+    lua_getglobal(_L, "show_error");
+    if (lua_isfunction(_L, -1)) {
+        lua_pushstring(_L, errMsg ? errMsg : "Unknown coroutine error");
+        lua_pushstring(_L, "coroutine");
+        if (lua_pcall(_L, 2, 0, 0) != LUA_OK) {
+            LOG("Scheduler", "Failed to show error: %s", lua_tostring(_L, -1));
+            lua_pop(_L, 1);
+        }
+    } else {
+        lua_pop(_L, 1);
+    }
+    lua_pop(co, 1);
+}
+
+int Scheduler::cancel(lua_State* co) {
+    int count = AsyncIO::instance().cancel(co);
+    int slot = findTask(co);
+    if (slot < 0 || _tasks[slot].cancelled) return count;
+
+    // Walk the tree breadth-first by task id
+    std::vector<uint32_t> ids;
+    ids.push_back(_tasks[slot].id);
+    std::vector<uint16_t> doomed;
+    doomed.push_back((uint16_t)slot);
+    for (size_t i = 0; i < ids.size(); i++) {
+        for (size_t s = 0; s < _tasks.size(); s++) {
+            const Task& t = _tasks[s];
+            if (t.state != State::FREE && !t.cancelled && t.parent == ids[i]) {
+                ids.push_back(t.id);
+                doomed.push_back((uint16_t)s);
+                count += AsyncIO::instance().cancel(t.co);
+            }
+        }
+    }
+
+    for (uint16_t s : doomed) {
+        _stats.cancelled++;
+        if (_tasks[s].state == State::RUNNING) {
+            // Somewhere up the C stack: resume() frees it on return
+            _tasks[s].cancelled = true;
+        } else {
+            freeTask(s);
+        }
+    }
+    return count;
+}
+
+void Scheduler::run() {
+    if (_running || _L == nullptr) return;
+    _running = true;
+
+    uint32_t now = millis();
+    for (size_t i = 0; i < _sleepers.size();) {
+        int slot = slotFor(_sleepers[i], State::PARKED);
+        if (slot >= 0 && (int32_t)(now - _tasks[slot].wakeAt) < 0) {
+            i++;
+            continue;
+        }
+        if (slot >= 0) wake(_sleepers[i], 0);
+        _sleepers[i] = _sleepers.back();
+        _sleepers.pop_back();
+    }
+
+    // Only what is queued now: a task that defers again runs next frame
+    size_t pending = _ready.size();
+    uint32_t resumed = 0;
+    uint32_t t0 = micros();
+    while (pending > 0) {
+        if (resumed == MAX_RESUMES_PER_RUN ||
+            (resumed > 0 && micros() - t0 >= RUN_BUDGET_US)) {
+            _stats.budgetHits++;
+            break;
+        }
+        Token token = _ready.front();
+        _ready.pop_front();
+        pending--;
+        int slot = slotFor(token, State::READY);
+        if (slot < 0) continue;  // Cancelled since it was woken
+        resume((uint16_t)slot, _L, _tasks[slot].nargs);
+        resumed++;
+    }
+
+    _running = false;
+}
+
+bool Scheduler::nextDue(uint32_t now, uint32_t& ms) const {
+    if (!_ready.empty()) {
+        ms = 0;
+        return true;
+    }
+    bool any = false;
+    int32_t best = 0;
+    for (Token token : _sleepers) {
+        int slot = slotFor(token, State::PARKED);
+        if (slot < 0) continue;
+        int32_t delta = (int32_t)(_tasks[slot].wakeAt - now);
+        if (!any || delta < best) best = delta;
+        any = true;
+    }
+    if (any) ms = best > 0 ? (uint32_t)best : 0;
+    return any;
+}
+
+void Scheduler::getStats(Stats& out) const {
+    out = _stats;
+    out.tasks = _live;
+    out.ready = 0;
+    out.parked = 0;
+    out.sleeping = 0;
+    for (const Task& t : _tasks) {
+        if (t.state == State::READY) out.ready++;
+        if (t.state == State::PARKED) out.parked++;
+        if (t.state == State::PARKED && t.sleeping) out.sleeping++;
+    }
+}
+
+// =============================================================================
+// Lua Bindings
+// =============================================================================
+
+// @lua spawn(fn, ...) -> thread
+// @brief Run a function as a scheduled coroutine
+// @description Creates a task running fn(...) and runs it at once until it
+// first waits (async I/O, HTTP, defer, wait_ms) or finishes; the scheduler
+// resumes it when what it waits on completes. Spawning from inside a task
+// is safe and makes the new task its child: async_cancel() on a task also
+// cancels its children. Errors are logged and shown with show_error().
+// @param fn Function to run
+// @param ... Arguments passed to fn
+// @return The task's coroutine (for async_cancel / coroutine.status)
+// @example
+// spawn(function()
+//     local data = async_read("/sd/notes.txt")
+//     spawn(function() async_write("/sd/notes.bak", data) end)
+// end)
+// @end
+int Scheduler::l_spawn(lua_State* L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    Scheduler& self = instance();
+    int nargs = lua_gettop(L) - 1;
+
+    lua_State* co = lua_newthread(L);
+    lua_pushvalue(L, -1);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    int parentSlot = self.findTask(L);
+    uint32_t parent = parentSlot >= 0 ? self._tasks[parentSlot].id : 0;
+    int slot = self.newTask(co, ref, parent);
+    if (slot < 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "too many tasks");
+    }
+    self._stats.spawned++;
+
+    // Thread below, function and arguments over to the coroutine
+    lua_insert(L, 1);
+    lua_xmove(L, co, nargs + 1);
+    self.resume((uint16_t)slot, L, nargs);
+    return 1;
+}
+
+// @lua defer()
+// @brief Yield the current coroutine and resume it on the next frame
+// @description Cooperative yield for coroutines. The coroutine is suspended and
+// automatically resumed on the next main loop iteration, after async I/O
+// completions are processed. Enables polling patterns and parallel async work.
+// Must be called from within a coroutine (spawn/async context).
+// @example
+// -- Wait for a condition without blocking
+// while not ready do defer() end
+// @end
+int Scheduler::l_defer(lua_State* L) {
+    if (!lua_isyieldable(L)) {
+        return luaL_error(L, "defer() must be called from a coroutine");
+    }
+    Scheduler& self = instance();
+    self.wake(self.park(L), 0);
+    return lua_yield(L, 0);
+}
+
+// @lua wait_ms(ms)
+// @brief Suspend the current coroutine for a number of milliseconds
+// @description Cooperative sleep: the main loop keeps rendering and handling
+// input while the coroutine waits, unlike ez.system.delay() which blocks the
+// whole Lua runtime. The loop's idle sleep is cut short for the deadline.
+// Must be called from within a coroutine.
+// @param ms Milliseconds to wait (0 behaves like defer())
+// @example
+// spawn(function()
+//     ez.log("start")
+//     wait_ms(500)
+//     ez.log("half a second later")
+// end)
+// @end
+int Scheduler::l_wait_ms(lua_State* L) {
+    lua_Integer ms = luaL_optinteger(L, 1, 0);
+    if (!lua_isyieldable(L)) {
+        return luaL_error(L, "wait_ms() must be called from a coroutine");
+    }
+    Scheduler& self = instance();
+    Token token = self.park(L);
+    if (ms <= 0) {
+        self.wake(token, 0);
+    } else {
+        Task& t = self._tasks[token & SLOT_MASK];
+        t.sleeping = true;
+        t.wakeAt = millis() + (uint32_t)ms;
+        self._sleepers.push_back(token);
+    }
+    return lua_yield(L, 0);
+}
+
+// @lua ez.system.get_scheduler_stats() -> table
+// @brief Coroutine scheduler counters
+// @description Current task counts and totals since boot for the scheduler
+// that runs spawn()ed coroutines and resumes them when their async waits
+// complete. budget_hits counts frames that left ready tasks for the next
+// frame because the per-frame resume budget ran out; stale_wakes counts
+// completions dropped because their task was cancelled or had finished.
+// @return Table with tasks, ready, parked, sleeping, spawned, resumes, errors,
+// cancelled, stale_wakes, budget_hits, max_ready
+// @example
+// local s = ez.system.get_scheduler_stats()
+// print(s.tasks .. " tasks, " .. s.ready .. " ready")
+// @end
+int Scheduler::l_get_scheduler_stats(lua_State* L) {
+    Stats s;
+    instance().getStats(s);
+    lua_createtable(L, 0, 11);
+    lua_pushinteger(L, s.tasks);        lua_setfield(L, -2, "tasks");
+    lua_pushinteger(L, s.ready);        lua_setfield(L, -2, "ready");
+    lua_pushinteger(L, s.parked);       lua_setfield(L, -2, "parked");
+    lua_pushinteger(L, s.sleeping);     lua_setfield(L, -2, "sleeping");
+    lua_pushinteger(L, s.spawned);      lua_setfield(L, -2, "spawned");
+    lua_pushinteger(L, s.resumes);      lua_setfield(L, -2, "resumes");
+    lua_pushinteger(L, s.errors);       lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, s.cancelled);    lua_setfield(L, -2, "cancelled");
+    lua_pushinteger(L, s.staleWakes);   lua_setfield(L, -2, "stale_wakes");
+    lua_pushinteger(L, s.budgetHits);   lua_setfield(L, -2, "budget_hits");
+    lua_pushinteger(L, s.maxReady);     lua_setfield(L, -2, "max_ready");
+    return 1;
+}
+
+void Scheduler::registerBindings(lua_State* L) {
+    instance().reset(L);
+
+    lua_register(L, "spawn", l_spawn);
+    lua_register(L, "defer", l_defer);
+    lua_register(L, "wait_ms", l_wait_ms);
+
+    lua_getglobal(L, "ez");
+    lua_getfield(L, -1, "system");
+    if (lua_istable(L, -1)) {
+        lua_pushcfunction(L, l_get_scheduler_stats);
+        lua_setfield(L, -2, "get_scheduler_stats");
+    }
+    lua_pop(L, 2);
+
+    LOG("LuaRuntime", "Registered scheduler (spawn, defer, wait_ms)");
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "lua.hpp"
+
+// Coroutine scheduler: the one place Lua coroutines are resumed from C++.
+//
+// Every coroutine that waits on the firmware is a task. spawn() creates
+// one and runs it until its first yield; a coroutine that yields through
+// an async binding without having been spawned (boot.lua's, say) becomes
+// a task the first time it parks.
+//
+// A binding that suspends its caller parks it: park() hands back a token,
+// the binding stores the token with its request and yields. The producer
+// of the result (AsyncIO, http_bindings, a timer) later asks waiter() for
+// the coroutine, pushes the values onto it and calls wake(), which puts
+// the task on the run queue. Nothing is resumed from a completion site;
+// run() drains the queue once per frame under a resume budget, and a task
+// only ever runs when it is parked-and-woken or ready, so a coroutine is
+// never resumed twice for one yield or while it is itself resuming a
+// child. Tokens carry a generation, so a completion for a task that was
+// cancelled or has moved on is recognised and dropped without a search.
+//
+// A task that yields without parking (a bare coroutine.yield()) is put
+// back on the run queue for the next frame, like defer().
+//
+// Tasks spawned from inside a task are its children. Cancelling a task
+// cancels its descendants as well and flags their AsyncIO requests; a
+// task that finishes normally leaves its children running.
+//
+// Lua thread only.
+class Scheduler {
+public:
+    static Scheduler& instance();
+
+    // Generation in the high bits, task slot in the low bits; never 0
+    typedef uint32_t Token;
+    static constexpr Token NO_TOKEN = 0;
+
+    // Resumes per run() and the time after which run() stops early; what
+    // is left waits for the next frame.
+    static constexpr uint32_t MAX_RESUMES_PER_RUN = 32;
+    static constexpr uint32_t RUN_BUDGET_US = 6000;
+
+    struct Stats {
+        uint32_t tasks;         // Live tasks
+        uint32_t ready;         // On the run queue
+        uint32_t parked;        // Waiting on a token (sleepers included)
+        uint32_t sleeping;      // Parked in wait_ms()
+        uint32_t spawned;       // Totals since the state was created
+        uint32_t resumes;
+        uint32_t errors;
+        uint32_t cancelled;
+        uint32_t staleWakes;    // Completions for cancelled/finished waits
+        uint32_t budgetHits;    // run() calls that left work for next frame
+        uint32_t maxReady;
+    };
+
+    // Drop every task (their registry refs belong to the state being
+    // replaced) and register spawn/defer/wait_ms and the stats binding.
+    static void registerBindings(lua_State* L);
+
+    // Park the running coroutine `co` and return its wait token. The
+    // caller then stores the token with its request and returns
+    // lua_yield(). Raises a Lua error if `co` can't yield.
+    Token park(lua_State* co);
+
+    // Undo a park() whose request could not be queued (before yielding).
+    void unpark(Token token);
+
+    // The coroutine waiting on `token`, or nullptr if the wait is stale
+    // (cancelled, finished, already woken). Push the resume values onto
+    // it, then call wake().
+    lua_State* waiter(Token token) const;
+
+    // Queue the task waiting on `token` to resume with the top `nargs`
+    // values of its stack. False if the token is stale.
+    bool wake(Token token, int nargs);
+
+    // Cancel the task running `co` and all its descendants. None of them
+    // is resumed again; their AsyncIO requests are flagged (see
+    // AsyncIO::cancel). Returns the number of requests cancelled.
+    int cancel(lua_State* co);
+
+    // Resume ready tasks and due sleepers, within the per-run budget.
+    // Not re-entrant: a call from inside a resumed task returns at once.
+    void run();
+
+    // Milliseconds until run() next has work: 0 if tasks are ready, else
+    // the nearest wait_ms() deadline. False if nothing is scheduled.
+    bool nextDue(uint32_t now, uint32_t& ms) const;
+
+    void getStats(Stats& out) const;
+
+    // Lua functions
+    static int l_spawn(lua_State* L);
+    static int l_defer(lua_State* L);
+    static int l_wait_ms(lua_State* L);
+    static int l_get_scheduler_stats(lua_State* L);
+
+private:
+    Scheduler() = default;
+
+    enum class State : uint8_t { FREE, RUNNING, PARKED, READY };
+
+    static constexpr uint32_t SLOT_BITS = 12;
+    static constexpr uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1;
+    static constexpr size_t MAX_TASKS = SLOT_MASK + 1;
+
+    struct Task {
+        lua_State* co;
+        int ref;                // Registry ref keeping the thread alive
+        uint32_t id;            // Unique for the life of the state
+        uint32_t parent;        // Spawning task's id, 0 for roots
+        uint32_t gen;           // Bumped on every park and on free
+        uint32_t wakeAt;        // wait_ms() deadline (millis), if sleeping
+        int nargs;              // Values to resume with once READY
+        State state;
+        bool sleeping;
+        bool cancelled;         // Cancelled while running: free on return
+        bool owned;             // Spawned, or resumed by run() at least once
+    };
+
+    static uint32_t nextGen(uint32_t gen);
+    Token tokenFor(uint16_t slot) const { return (_tasks[slot].gen << SLOT_BITS) | slot; }
+    // Slot for a live token, or -1
+    int slotFor(Token token, State state) const;
+    int findTask(lua_State* co) const;
+    int newTask(lua_State* co, int ref, uint32_t parent);
+    void freeTask(uint16_t slot);
+    void makeReady(uint16_t slot, int nargs);
+    void resume(uint16_t slot, lua_State* from, int nargs);
+    void reportError(lua_State* co);
+    void reset(lua_State* L);
+
+    lua_State* _L = nullptr;
+    std::vector<Task> _tasks;
+    std::vector<uint16_t> _free;
+    std::unordered_map<lua_State*, uint16_t> _byThread;
+    std::deque<Token> _ready;
+    std::vector<Token> _sleepers;
+    uint32_t _nextId = 1;
+    uint32_t _live = 0;
+    bool _running = false;
+    Stats _stats = {};
+};
@@ -1,15 +1,23 @@
 #include "script_loader.h"
 #include "lua_runtime.h"
+#include "embedded_scripts.h"
 #include "../config.h"
 #include "../util/log.h"
+#include "../util/sd_block_cache.h"
 #include <LittleFS.h>
 #include <SD.h>
 #include <SPI.h>
+#include <esp_heap_caps.h>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+// VM internals, for naming stripped prototypes (see nameStrippedChunk)
+#include <lobject.h>
+#include <lgc.h>
+#include <lstring.h>
 }
 
 // Script search paths in priority order
@@ -32,6 +40,7 @@ bool ScriptLoader::init() {
     SPI.begin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS);
     if (SD.begin(SD_CS)) {
         _sdAvailable = true;
+        SdBlockCache::instance().install();
         LOG("ScriptLoader", "SD card available");
 
         // Check if scripts directory exists on SD
@@ -89,7 +98,8 @@ bool ScriptLoader::scriptExists(const char* scriptName) {
 }
 
 bool ScriptLoader::loadFromPath(lua_State* L, const char* path) {
-    File file;
+    fs::FS* fs = &LittleFS;
+    const char* fsPath = path;
 
     // Determine which filesystem to use
     if (strncmp(path, "/sd/", 4) == 0) {
@@ -97,41 +107,18 @@ bool ScriptLoader::loadFromPath(lua_State* L, const char* path) {
             LOG("ScriptLoader", "SD not available for: %s", path);
             return false;
         }
-        file = SD.open(path + 3, "r");  // Skip "/sd" prefix
-    } else {
-        file = LittleFS.open(path, "r");
+        fs = &SD;
+        fsPath = path + 3;  // Skip "/sd" prefix
     }
 
-    if (!file) {
-        LOG("ScriptLoader", "Cannot open: %s", path);
-        return false;
-    }
+    LOG("ScriptLoader", "Loading: %s", path);
 
-    // Read file content
-    size_t size = file.size();
-    if (size > 512 * 1024) {  // 512KB limit for scripts
-        LOG("ScriptLoader", "Script too large: %s (%u bytes)", path, size);
-        file.close();
-        return false;
-    }
-
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) {
-        LOG("ScriptLoader", "Out of memory loading: %s", path);
-        file.close();
-        return false;
+    // Compile (or fetch from the bytecode cache) and execute the script
+    bool found;
+    bool success = LuaRuntime::instance().executeScriptFile(*fs, fsPath, path, found);
+    if (!found) {
+        LOG("ScriptLoader", "Cannot open: %s", path);
     }
-
-    file.readBytes(buffer, size);
-    buffer[size] = '\0';
-    file.close();
-
-    LOG("ScriptLoader", "Loading: %s (%u bytes)", path, size);
-
-    // Execute the script
-    bool success = LuaRuntime::instance().executeString(buffer, path);
-    free(buffer);
-
     return success;
 }
 
@@ -181,3 +168,396 @@ bool ScriptLoader::reloadScripts(lua_State* L) {
     // Reload boot script
     return loadBootScript(L);
 }
+
+const char* ScriptLoader::findEmbedded(const char* path, size_t* size) {
+    uint32_t start = micros();
+    const char* data = embedded_lua::get_script(path, size);
+    _embeddedStats.lookupUs += micros() - start;
+    _embeddedStats.lookups++;
+    if (!data) _embeddedStats.misses++;
+    return data;
+}
+
+namespace {
+
+// Hands the whole flash image to lua_load in one block. Lua's undump and
+// lexer read through this without an intermediate copy.
+struct FlashChunk {
+    const char* data;
+    size_t size;
+};
+
+const char* readFlashChunk(lua_State*, void* ud, size_t* size) {
+    FlashChunk* chunk = static_cast<FlashChunk*>(ud);
+    *size = chunk->size;
+    chunk->size = 0;
+    return *size ? chunk->data : nullptr;
+}
+
+// Bytecode compiled with luac -s carries no source name, so every embedded
+// function reports "?" in tracebacks and to the profiler. Give the chunk's
+// prototypes the chunk name instead (line info stays stripped).
+void nameStrippedProtos(lua_State* L, Proto* p, TString* source) {
+    if (p->source == nullptr) {
+        p->source = source;
+        luaC_objbarrier(L, p, source);
+    }
+    for (int i = 0; i < p->sizep; i++) nameStrippedProtos(L, p->p[i], source);
+}
+
+void nameStrippedChunk(lua_State* L, const char* chunkname) {
+    if (lua_type(L, -1) != LUA_TFUNCTION || lua_iscfunction(L, -1)) return;
+    // For Lua closures lua_topointer is the LClosure itself.
+    const LClosure* cl = static_cast<const LClosure*>(lua_topointer(L, -1));
+    if (cl->p->source != nullptr) return;  // Not stripped
+    // No allocation between creating the string and linking it in, so it
+    // can't be collected in between; the barrier covers an incremental GC.
+    nameStrippedProtos(L, cl->p, luaS_new(L, chunkname));
+}
+
+}  // namespace
+
+int ScriptLoader::loadEmbedded(lua_State* L, const char* path, const char* chunkname) {
+    size_t size = 0;
+    const char* data = findEmbedded(path, &size);
+    if (!data) return -1;
+
+    char name[128];
+    if (!chunkname) {
+        snprintf(name, sizeof(name), "@%s", path);
+        chunkname = name;
+    }
+
+    uint32_t start = micros();
+    FlashChunk chunk = {data, size};
+    int status = lua_load(L, readFlashChunk, &chunk, chunkname, nullptr);
+    _embeddedStats.loadUs += micros() - start;
+    _embeddedStats.bytes += size;
+    if (status == LUA_OK) {
+        nameStrippedChunk(L, chunkname);
+        _embeddedStats.loads++;
+    } else {
+        _embeddedStats.loadErrors++;
+    }
+    return status;
+}
+
+void ScriptLoader::markBootComplete(uint32_t bootUs) {
+    _bootStats = _embeddedStats;
+    _bootUs = bootUs;
+    LOG("ScriptLoader", "Boot: %lu ms, %lu modules (%lu KB) loaded in %lu.%03lu ms, "
+        "%lu lookups in %lu.%03lu ms",
+        (unsigned long)(bootUs / 1000), (unsigned long)_bootStats.loads,
+        (unsigned long)(_bootStats.bytes / 1024),
+        (unsigned long)(_bootStats.loadUs / 1000), (unsigned long)(_bootStats.loadUs % 1000),
+        (unsigned long)_bootStats.lookups,
+        (unsigned long)(_bootStats.lookupUs / 1000), (unsigned long)(_bootStats.lookupUs % 1000));
+}
+
+namespace {
+
+constexpr uint32_t CACHE_MAGIC = 0x4342455a;    // "EZBC"
+constexpr uint16_t CACHE_FORMAT = 1;
+// Leave this much of LittleFS free when adding cache entries
+constexpr size_t CACHE_FS_RESERVE = 64 * 1024;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t luaVersion;
+    uint32_t srcSize;
+    uint32_t srcHash;
+    uint32_t codeSize;
+    uint32_t codeHash;
+    uint16_t pathLen;       // Source path follows the header, then the code
+    uint16_t reserved;
+};
+
+uint32_t fnv1a(const void* data, size_t len, uint32_t h = 2166136261u) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+char* allocBuffer(size_t size) {
+    char* p = (char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p) p = (char*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    return p;
+}
+
+// The whole file, or nullptr on a short read or no memory
+char* readAll(File& file, size_t size) {
+    char* buffer = allocBuffer(size + 1);
+    if (!buffer) return nullptr;
+    if (file.read((uint8_t*)buffer, size) != size) {
+        heap_caps_free(buffer);
+        return nullptr;
+    }
+    buffer[size] = '\0';
+    return buffer;
+}
+
+void cachePathFor(const char* fsPath, const char* ext, char* out, size_t outSize) {
+    snprintf(out, outSize, "%s/%08lx.%s", ScriptLoader::CACHE_DIR,
+             (unsigned long)fnv1a(fsPath, strlen(fsPath)), ext);
+}
+
+struct DumpBlock {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+int dumpWriter(lua_State*, const void* p, size_t size, void* ud) {
+    DumpBlock* b = static_cast<DumpBlock*>(ud);
+    if (b->len + size > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 16 * 1024;
+        while (cap < b->len + size) cap *= 2;
+        char* data = (char*)heap_caps_realloc(b->data, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!data) data = (char*)heap_caps_realloc(b->data, cap, MALLOC_CAP_8BIT);
+        if (!data) return 1;
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, p, size);
+    b->len += size;
+    return 0;
+}
+
+// The verified bytecode of the entry for `want`, or nullptr. `stale` is set
+// when an entry existed but didn't verify.
+char* readCached(fs::FS& fs, const char* cachePath, const char* fsPath,
+                 const CacheHeader& want, uint32_t& codeSize, bool& stale) {
+    stale = false;
+    if (!fs.exists(cachePath)) return nullptr;
+    File file = fs.open(cachePath, "r");
+    if (!file) return nullptr;
+
+    stale = true;
+    size_t pathLen = strlen(fsPath);
+    CacheHeader hdr;
+    char storedPath[128];
+    if (file.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != CACHE_MAGIC || hdr.format != CACHE_FORMAT ||
+        hdr.luaVersion != want.luaVersion || hdr.srcSize != want.srcSize ||
+        hdr.srcHash != want.srcHash ||
+        hdr.pathLen != pathLen || pathLen >= sizeof(storedPath) ||
+        file.size() != sizeof(hdr) + hdr.pathLen + hdr.codeSize ||
+        file.read((uint8_t*)storedPath, pathLen) != pathLen ||
+        memcmp(storedPath, fsPath, pathLen) != 0) {
+        file.close();
+        return nullptr;
+    }
+
+    char* code = readAll(file, hdr.codeSize);
+    file.close();
+    if (!code) return nullptr;
+    // Lua doesn't verify bytecode, so a damaged entry must never reach it
+    if (fnv1a(code, hdr.codeSize) != hdr.codeHash) {
+        heap_caps_free(code);
+        return nullptr;
+    }
+    stale = false;
+    codeSize = hdr.codeSize;
+    return code;
+}
+
+}  // namespace
+
+ScriptLoader::FileRead* ScriptLoader::readFile(fs::FS& fs, const char* fsPath) {
+    File src = fs.open(fsPath, "r");
+    if (!src || src.isDirectory()) return nullptr;
+
+    // The source is always read and hashed: FAT and LittleFS mtimes have
+    // a resolution of seconds (and no meaning before the clock is set), so
+    // they can't tell a quick same-size edit apart. Reading and hashing is
+    // a small fraction of what compiling costs.
+    uint32_t start = micros();
+    FileRead* read = (FileRead*)heap_caps_calloc(1, sizeof(FileRead), MALLOC_CAP_8BIT);
+    if (!read) {
+        src.close();
+        return nullptr;
+    }
+    read->srcSize = src.size();
+    read->source = readAll(src, read->srcSize);
+    src.close();
+    if (read->source) {
+        read->srcHash = fnv1a(read->source, read->srcSize);
+
+        CacheHeader want = {};
+        want.luaVersion = LUA_VERSION_NUM;
+        want.srcSize = read->srcSize;
+        want.srcHash = read->srcHash;
+        char cachePath[32];
+        cachePathFor(fsPath, "luac", cachePath, sizeof(cachePath));
+        read->code = readCached(fs, cachePath, fsPath, want, read->codeSize, read->stale);
+        if (read->stale) fs.remove(cachePath);
+    }
+    read->readUs = micros() - start;
+    return read;
+}
+
+void ScriptLoader::freeRead(FileRead* read) {
+    if (!read) return;
+    heap_caps_free(read->source);
+    heap_caps_free(read->code);
+    heap_caps_free(read);
+}
+
+int ScriptLoader::loadRead(lua_State* L, FileRead* read, const char* chunkname,
+                           CacheEntry** store) {
+    *store = nullptr;
+    if (!read->source) {
+        lua_pushfstring(L, "cannot read %s", chunkname[0] == '@' ? chunkname + 1 : chunkname);
+        return LUA_ERRFILE;
+    }
+
+    uint32_t start = micros();
+    if (read->code) {
+        if (luaL_loadbufferx(L, read->code, read->codeSize, chunkname, "b") == LUA_OK) {
+            _cacheStats.hits++;
+            _cacheStats.hitUs += read->readUs + (micros() - start);
+            _cacheStats.hitBytes += read->srcSize;
+            return LUA_OK;
+        }
+        // Undump error (e.g. built for another VM); the store below replaces it
+        lua_pop(L, 1);
+        read->stale = true;
+    }
+    if (read->stale) _cacheStats.stale++;
+
+    int status = luaL_loadbuffer(L, read->source, read->srcSize, chunkname);
+    _cacheStats.misses++;
+    _cacheStats.missUs += read->readUs + (micros() - start);
+    _cacheStats.missBytes += read->srcSize;
+
+    // Files that are already bytecode gain nothing from a copy
+    if (status == LUA_OK && read->srcSize > 0 && read->source[0] != LUA_SIGNATURE[0]) {
+        uint32_t dumpStart = micros();
+        DumpBlock block = {nullptr, 0, 0};
+        CacheEntry* entry = nullptr;
+        // Keep debug info: these are user scripts, and tracebacks need lines
+        if (lua_dump(L, dumpWriter, &block, 0) == 0 && block.len > 0) {
+            entry = (CacheEntry*)heap_caps_malloc(sizeof(CacheEntry), MALLOC_CAP_8BIT);
+        }
+        if (entry) {
+            entry->srcSize = read->srcSize;
+            entry->srcHash = read->srcHash;
+            entry->code = block.data;
+            entry->codeSize = block.len;
+            *store = entry;
+        } else {
+            heap_caps_free(block.data);
+            _cacheStats.storeErrors++;
+        }
+        _cacheStats.storeUs += micros() - dumpStart;
+    }
+    return status;
+}
+
+bool ScriptLoader::writeEntry(fs::FS& fs, const char* fsPath, const CacheEntry& entry) {
+    char tmpPath[32], cachePath[32];
+    cachePathFor(fsPath, "tmp", tmpPath, sizeof(tmpPath));
+    cachePathFor(fsPath, "luac", cachePath, sizeof(cachePath));
+    // Only written after a miss, so whatever entry is there is of no use;
+    // FAT won't rename over it in any case
+    if (fs.exists(cachePath)) fs.remove(cachePath);
+
+    CacheHeader hdr = {};
+    hdr.magic = CACHE_MAGIC;
+    hdr.format = CACHE_FORMAT;
+    hdr.luaVersion = LUA_VERSION_NUM;
+    hdr.srcSize = entry.srcSize;
+    hdr.srcHash = entry.srcHash;
+    hdr.codeSize = entry.codeSize;
+    hdr.codeHash = fnv1a(entry.code, entry.codeSize);
+    size_t pathLen = strlen(fsPath);
+    hdr.pathLen = pathLen;
+
+    size_t total = sizeof(hdr) + pathLen + entry.codeSize;
+    if (&fs == &LittleFS &&
+        LittleFS.totalBytes() - LittleFS.usedBytes() < total + CACHE_FS_RESERVE) {
+        return false;
+    }
+    if (!fs.exists(CACHE_DIR)) fs.mkdir(CACHE_DIR);
+
+    // Written to a temporary file and renamed, so a reset mid-write leaves
+    // no entry rather than a torn one
+    bool ok = false;
+    File file = fs.open(tmpPath, FILE_WRITE);
+    if (file) {
+        ok = file.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+             file.write((const uint8_t*)fsPath, pathLen) == pathLen &&
+             file.write((const uint8_t*)entry.code, entry.codeSize) == entry.codeSize;
+        file.close();
+    }
+    ok = ok && fs.rename(tmpPath, cachePath);
+    if (!ok) fs.remove(tmpPath);
+    return ok;
+}
+
+void ScriptLoader::freeEntry(CacheEntry* entry) {
+    if (!entry) return;
+    heap_caps_free(entry->code);
+    heap_caps_free(entry);
+}
+
+void ScriptLoader::noteStore(bool ok, uint32_t us) {
+    if (ok) {
+        _cacheStats.stores++;
+    } else {
+        _cacheStats.storeErrors++;
+    }
+    _cacheStats.storeUs += us;
+}
+
+int ScriptLoader::loadFile(lua_State* L, fs::FS& fs, const char* fsPath, const char* chunkname) {
+    FileRead* read = readFile(fs, fsPath);
+    if (!read) return -1;
+
+    CacheEntry* store = nullptr;
+    int status = loadRead(L, read, chunkname, &store);
+    freeRead(read);
+    if (store) {
+        uint32_t start = micros();
+        bool ok = writeEntry(fs, fsPath, *store);
+        if (!ok) LOG("ScriptLoader", "Bytecode cache: could not store %s", fsPath);
+        noteStore(ok, micros() - start);
+        freeEntry(store);
+    }
+    return status;
+}
+
+int ScriptLoader::loadPath(lua_State* L, const char* path, const char* chunkname) {
+    char name[128];
+    if (!chunkname) {
+        snprintf(name, sizeof(name), "@%s", path);
+        chunkname = name;
+    }
+    if (strncmp(path, "/sd/", 4) == 0) return loadFile(L, SD, path + 3, chunkname);
+    if (strncmp(path, "/fs/", 4) == 0) return loadFile(L, LittleFS, path + 3, chunkname);
+    return loadFile(L, LittleFS, path, chunkname);
+}
+
+int ScriptLoader::clearCache() {
+    int removed = 0;
+    fs::FS* filesystems[] = {&LittleFS, &SD};
+    for (fs::FS* fs : filesystems) {
+        File dir = fs->open(CACHE_DIR);
+        if (!dir || !dir.isDirectory()) continue;
+        // Collect first: removing entries while iterating upsets FAT
+        std::vector<String> paths;
+        for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+            paths.push_back(f.path());
+            f.close();
+        }
+        dir.close();
+        for (const String& p : paths) {
+            if (fs->remove(p.c_str())) removed++;
+        }
+    }
+    return removed;
+}
@@ -6,6 +6,8 @@ extern "C" {
 #include <lua.h>
 }
 
+namespace fs { class FS; }
+
 // Script loading priority:
 // 1. SD Card: /sd/scripts/
 // 2. Internal Flash: /scripts/ (LittleFS)
@@ -38,6 +40,106 @@ public:
     // Check if SD card scripts are available
     bool hasSDScripts() const { return _sdAvailable; }
 
+    // Embedded scripts ($ paths) live in flash. Lookups use the perfect hash
+    // emitted by embed_lua_scripts.py; loads feed lua_load straight from
+    // flash through a lua_Reader instead of copying into a Lua string first.
+    struct EmbeddedStats {
+        uint32_t lookups;
+        uint32_t misses;
+        uint32_t lookupUs;
+        uint32_t loads;         // Chunks compiled/undumped
+        uint32_t loadErrors;
+        uint32_t loadUs;
+        uint32_t bytes;         // Script bytes fed to lua_load
+    };
+
+    // Find an embedded script; nullptr if not embedded
+    const char* findEmbedded(const char* path, size_t* size = nullptr);
+
+    // Load (don't run) an embedded script. Returns LUA_OK with the chunk on
+    // the stack, a Lua error status with the message on the stack, or -1
+    // with nothing pushed if the script isn't embedded. `chunkname`
+    // defaults to "@<path>".
+    int loadEmbedded(lua_State* L, const char* path, const char* chunkname = nullptr);
+
+    const EmbeddedStats& getEmbeddedStats() const { return _embeddedStats; }
+
+    // Snapshot and log the counters once the boot script has returned
+    void markBootComplete(uint32_t bootUs);
+    const EmbeddedStats& getBootStats() const { return _bootStats; }
+    uint32_t getBootUs() const { return _bootUs; }
+
+    // Scripts read from SD or LittleFS are compiled once; the bytecode is
+    // kept in /.luac/ on the same filesystem, one file per script named by
+    // a hash of its path. An entry is used only while the source's size and
+    // content hash still match and the bytecode's own checksum verifies;
+    // anything else is recompiled and rewritten. hitUs vs missUs per
+    // source byte is the saving.
+    struct CacheStats {
+        uint32_t hits;
+        uint32_t misses;        // Compiled from source
+        uint32_t stale;         // Entries rejected (out of date or corrupt)
+        uint32_t stores;
+        uint32_t storeErrors;   // No space, or the write failed
+        uint32_t hitUs;         // Reading and undumping cached bytecode
+        uint32_t missUs;        // Reading and compiling source
+        uint32_t storeUs;       // Dumping and writing new entries
+        uint32_t hitBytes;      // Source bytes behind the hits
+        uint32_t missBytes;
+    };
+
+    static constexpr const char* CACHE_DIR = "/.luac";
+
+    // Load (don't run) `fsPath` from `fs` (SD or LittleFS) through the
+    // bytecode cache. Returns like loadEmbedded(): -1 with nothing pushed
+    // if the file can't be opened.
+    int loadFile(lua_State* L, fs::FS& fs, const char* fsPath, const char* chunkname);
+
+    // loadFile() for a /sd/ or /fs/ path; paths without a mount prefix are
+    // on LittleFS. `chunkname` defaults to "@<path>".
+    int loadPath(lua_State* L, const char* path, const char* chunkname = nullptr);
+
+    // loadFile() in three steps, so async_load can keep the file work off
+    // the Lua thread: readFile() and writeEntry() touch no Lua state and
+    // run on the AsyncIO worker; loadRead() undumps or compiles on the Lua
+    // thread and hands back the entry to write on a miss.
+    struct FileRead {
+        uint32_t srcSize;
+        uint32_t srcHash;
+        char* source;           // nullptr if the read failed
+        char* code;             // Verified cached bytecode, or nullptr
+        uint32_t codeSize;
+        bool stale;             // An entry existed but didn't verify (removed)
+        uint32_t readUs;
+    };
+
+    struct CacheEntry {
+        uint32_t srcSize;
+        uint32_t srcHash;
+        char* code;
+        uint32_t codeSize;
+    };
+
+    // nullptr if the file can't be opened
+    static FileRead* readFile(fs::FS& fs, const char* fsPath);
+    static void freeRead(FileRead* read);
+
+    // Returns like loadFile(). On a miss that should be cached, *store is
+    // set to a new entry for writeEntry() (free it with freeEntry()).
+    int loadRead(lua_State* L, FileRead* read, const char* chunkname, CacheEntry** store);
+
+    // Replace the cache entry for `fsPath` (written aside and renamed)
+    static bool writeEntry(fs::FS& fs, const char* fsPath, const CacheEntry& entry);
+    static void freeEntry(CacheEntry* entry);
+
+    // Count a writeEntry() that took `us` (plus the dump in loadRead())
+    void noteStore(bool ok, uint32_t us);
+
+    // Delete every cached chunk on both filesystems; returns files removed
+    int clearCache();
+
+    const CacheStats& getCacheStats() const { return _cacheStats; }
+
 private:
     ScriptLoader() = default;
     ~ScriptLoader() = default;
@@ -51,4 +153,9 @@ private:
     bool _initialized = false;
     bool _sdAvailable = false;
     char _pathBuffer[128];
+
+    EmbeddedStats _embeddedStats = {};
+    EmbeddedStats _bootStats = {};
+    uint32_t _bootUs = 0;
+    CacheStats _cacheStats = {};
 };
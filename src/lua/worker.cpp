@@ -0,0 +1,557 @@
+#include "worker.h"
+#include "scheduler.h"
+#include "script_loader.h"
+#include "lua_json.h"
+#include "lua_bindings.h"
+#include "../util/log.h"
+#include "../util/trace.h"
+
+#include <esp_heap_caps.h>
+#include <string.h>
+
+// Instructions between timeout checks
+static const int HOOK_INTERVAL = 10000;
+static const char* MODULES_KEY = "worker.modules";
+
+LuaWorker& LuaWorker::instance() {
+    static LuaWorker inst;
+    return inst;
+}
+
+// =============================================================================
+// Worker state (worker task only)
+// =============================================================================
+
+void* LuaWorker::alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    LuaWorker* self = static_cast<LuaWorker*>(ud);
+    Stats& st = self->_stats;
+
+    // When ptr is null, osize is Lua's object type tag rather than a size.
+    size_t oldSize = ptr ? osize : 0;
+    if (nsize > oldSize && st.memUsed - oldSize + nsize > HEAP_LIMIT) {
+        return nullptr;  // Lua collects and retries, then raises "not enough memory"
+    }
+
+    void* newPtr = self->_slab.alloc(ptr, osize, nsize);
+    if (nsize == 0) {
+        st.memUsed -= oldSize;
+    } else if (newPtr != nullptr) {
+        st.memUsed = st.memUsed - oldSize + nsize;
+        if (st.memUsed > st.memPeak) st.memPeak = st.memUsed;
+    }
+    return newPtr;
+}
+
+void LuaWorker::timeoutHook(lua_State* L, lua_Debug*) {
+    LuaWorker& self = instance();
+    if (millis() - self._jobStart > JOB_TIMEOUT_MS) {
+        self._timedOut = true;
+        luaL_error(L, "worker job timed out after %d ms", (int)JOB_TIMEOUT_MS);
+    }
+}
+
+static int w_log(lua_State* L) {
+    LOG("Worker", "%s", luaL_checkstring(L, 1));
+    return 0;
+}
+
+static int w_print(lua_State* L) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (int i = 1, n = lua_gettop(L); i <= n; i++) {
+        if (i > 1) luaL_addchar(&b, '\t');
+        luaL_tolstring(L, i, nullptr);
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    LOG("Worker", "%s", lua_tostring(L, -1));
+    return 0;
+}
+
+static int w_millis(lua_State* L) {
+    lua_pushinteger(L, millis());
+    return 1;
+}
+
+static int w_micros(lua_State* L) {
+    lua_pushinteger(L, micros());
+    return 1;
+}
+
+static int w_json_encode(lua_State* L) {
+    LUA_CHECK_ARGC(L, 1);
+    size_t len = 0;
+    const char* err = nullptr;
+    char* json = luaJsonEncodeToBlock(L, 1, &len, &err);
+    if (!json) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    lua_pushlstring(L, json, len);
+    free(json);
+    return 1;
+}
+
+static int w_json_decode(lua_State* L) {
+    size_t len;
+    const char* json = luaL_checklstring(L, 1, &len);
+    if (!luaJsonDecode(L, json, len)) {
+        lua_pushnil(L);
+        lua_insert(L, -2);
+        return 2;
+    }
+    return 1;
+}
+
+// Runs protected: running out of memory here must not panic
+static int setupState(lua_State* L) {
+    static const luaL_Reg libs[] = {
+        {LUA_GNAME, luaopen_base},
+        {LUA_COLIBNAME, luaopen_coroutine},
+        {LUA_TABLIBNAME, luaopen_table},
+        {LUA_STRLIBNAME, luaopen_string},
+        {LUA_MATHLIBNAME, luaopen_math},
+        {LUA_UTF8LIBNAME, luaopen_utf8},
+    };
+    for (const luaL_Reg& lib : libs) {
+        luaL_requiref(L, lib.name, lib.func, 1);
+        lua_pop(L, 1);
+    }
+    // No filesystem from this task (see worker.h)
+    lua_pushnil(L);
+    lua_setglobal(L, "dofile");
+    lua_pushnil(L);
+    lua_setglobal(L, "loadfile");
+    lua_pushcfunction(L, w_print);
+    lua_setglobal(L, "print");
+
+    static const luaL_Reg systemFuncs[] = {
+        {"millis", w_millis},
+        {"micros", w_micros},
+        {nullptr, nullptr}
+    };
+    static const luaL_Reg storageFuncs[] = {
+        {"json_encode", w_json_encode},
+        {"json_decode", w_json_decode},
+        {nullptr, nullptr}
+    };
+    lua_newtable(L);
+    lua_pushcfunction(L, w_log);
+    lua_setfield(L, -2, "log");
+    luaL_newlib(L, systemFuncs);
+    lua_setfield(L, -2, "system");
+    luaL_newlib(L, storageFuncs);
+    lua_setfield(L, -2, "storage");
+    lua_setglobal(L, "ez");
+
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, MODULES_KEY);
+    return 0;
+}
+
+bool LuaWorker::openState() {
+    _W = lua_newstate(alloc, this);
+    if (!_W) return false;
+    lua_pushcfunction(_W, setupState);
+    if (lua_pcall(_W, 0, 0, 0) != LUA_OK) {
+        closeState();
+        return false;
+    }
+    return true;
+}
+
+void LuaWorker::closeState() {
+    if (!_W) return;
+    lua_close(_W);
+    _W = nullptr;
+    _slab.releaseAll();
+    _stats.memUsed = 0;
+}
+
+// Push the module table for `job`, or an error message and return false
+bool LuaWorker::loadModule(Job* job) {
+    lua_State* W = _W;
+    lua_getfield(W, LUA_REGISTRYINDEX, MODULES_KEY);
+    lua_getfield(W, -1, job->module);
+    if (lua_istable(W, -1)) {
+        lua_remove(W, -2);
+        return true;
+    }
+    lua_pop(W, 1);
+
+    if (!job->code) {
+        lua_pop(W, 1);
+        lua_pushfstring(W, "module %s is not loaded", job->module);
+        return false;
+    }
+    char chunkname[MAX_NAME + 1];
+    snprintf(chunkname, sizeof(chunkname), "@%s", job->module);
+    if (luaL_loadbufferx(W, job->code, job->codeLen, chunkname, nullptr) != LUA_OK ||
+        lua_pcall(W, 0, 1, 0) != LUA_OK) {
+        lua_remove(W, -2);
+        return false;
+    }
+    if (!lua_istable(W, -1)) {
+        lua_pop(W, 2);
+        lua_pushfstring(W, "module %s did not return a table", job->module);
+        return false;
+    }
+    lua_pushvalue(W, -1);
+    lua_setfield(W, -3, job->module);
+    lua_remove(W, -2);
+    return true;
+}
+
+static int traceback(lua_State* L) {
+    const char* msg = lua_tostring(L, 1);
+    luaL_traceback(L, L, msg ? msg : "(error object is not a string)", 1);
+    return 1;
+}
+
+// Pack the message on top of the stack as the job's result
+static void packError(lua_State* W, LuaPacked& out) {
+    const char* err = nullptr;
+    if (!lua_isstring(W, -1)) lua_pushliteral(W, "(error object is not a string)");
+    if (!luaPack(W, -1, 1, out, &err)) out = {nullptr, 0};  // update() reports it
+}
+
+// Runs protected with the job as its only argument, so the module load,
+// the arguments and the results can all run out of worker heap without a
+// panic: everything here allocates from the capped state
+int LuaWorker::callJob(lua_State* W) {
+    LuaWorker& self = instance();
+    Job* job = static_cast<Job*>(lua_touserdata(W, 1));
+    Result* result = job->result;
+    lua_settop(W, 0);
+
+    if (!self.loadModule(job)) return lua_error(W);
+    result->moduleLoaded = true;
+    lua_getfield(W, 1, job->fn);
+    if (!lua_isfunction(W, -1)) {
+        return luaL_error(W, "module %s has no function %s", job->module, job->fn);
+    }
+    int nargs = luaUnpack(W, job->args.data, job->args.len);
+    if (nargs < 0) return luaL_error(W, "bad arguments");
+    lua_call(W, nargs, LUA_MULTRET);
+
+    // Module table, then the results
+    const char* err = nullptr;
+    if (!luaPack(W, 2, lua_gettop(W) - 1, result->values, &err)) {
+        return luaL_error(W, "cannot return result: %s", err);
+    }
+    return 0;
+}
+
+void LuaWorker::runJob(Job* job, Result* result) {
+    TRACE_SCOPE("worker.job");
+    uint32_t start = micros();
+    if (!_W && !openState()) {
+        // No state to build the message in; update() reports it
+        result->runUs = micros() - start;
+        return;
+    }
+    lua_State* W = _W;
+    lua_settop(W, 0);
+    lua_pushcfunction(W, traceback);
+    lua_pushcfunction(W, callJob);
+    lua_pushlightuserdata(W, job);
+
+    // The module's top level counts against the timeout too
+    _jobStart = millis();
+    _timedOut = false;
+    lua_sethook(W, timeoutHook, LUA_MASKCOUNT, HOOK_INTERVAL);
+    int status = lua_pcall(W, 1, 0, 1);
+    lua_sethook(W, nullptr, 0, 0);
+
+    if (status == LUA_OK) {
+        result->ok = true;
+    } else if (status == LUA_ERRMEM) {
+        // Free what the job left before building the message
+        lua_settop(W, 0);
+        lua_gc(W, LUA_GCCOLLECT, 0);
+        lua_pushliteral(W, "not enough memory");
+        packError(W, result->values);
+    } else {
+        packError(W, result->values);
+    }
+    lua_settop(W, 0);
+
+    result->timedOut = _timedOut;
+    result->runUs = micros() - start;
+}
+
+void LuaWorker::task(void* arg) {
+    LuaWorker* self = static_cast<LuaWorker*>(arg);
+    for (;;) {
+        Job* job;
+        if (xQueueReceive(self->_jobs, &job, portMAX_DELAY) != pdTRUE) continue;
+        Result* result = job->result;
+        if (!result) {
+            self->closeState();  // Reset request
+        } else {
+            self->runJob(job, result);
+            xQueueSend(self->_results, &result, portMAX_DELAY);
+        }
+        freeJob(job);
+    }
+}
+
+// =============================================================================
+// Lua thread
+// =============================================================================
+
+void LuaWorker::freeJob(Job* job) {
+    if (job->codeOwned) heap_caps_free((void*)job->code);
+    luaPackFree(job->args);
+    heap_caps_free(job);
+}
+
+bool LuaWorker::start() {
+    if (_task) return true;
+
+    _jobs = xQueueCreate(QUEUE_SIZE, sizeof(Job*));
+    // Room for every job that can be queued or running
+    _results = xQueueCreate(QUEUE_SIZE + 1, sizeof(Result*));
+    // Only the TCB takes internal RAM; the stack goes to PSRAM (see header)
+    StaticTask_t* tcb = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t),
+                                                        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    StackType_t* stack = (StackType_t*)heap_caps_malloc(STACK_SIZE,
+                                                        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (_jobs && _results && tcb && stack) {
+        _task = xTaskCreateStaticPinnedToCore(task, "lua_worker", STACK_SIZE, this,
+                                              tskIDLE_PRIORITY, stack, tcb, 0);
+    }
+    if (!_task) {
+        if (_jobs) vQueueDelete(_jobs);
+        if (_results) vQueueDelete(_results);
+        _jobs = _results = nullptr;
+        heap_caps_free(tcb);
+        heap_caps_free(stack);
+        LOG("Worker", "Failed to start worker task");
+        return false;
+    }
+    LOG("Worker", "Started on Core 0 (%u KB PSRAM stack)", (unsigned)(STACK_SIZE / 1024));
+    return true;
+}
+
+void LuaWorker::update() {
+    if (!_results) return;
+    Result* result;
+    Scheduler& sched = Scheduler::instance();
+    while (xQueueReceive(_results, &result, 0) == pdTRUE) {
+        _stats.completed++;
+        _stats.busyUs += result->runUs;
+        if (!result->ok) _stats.errors++;
+        if (result->timedOut) _stats.timeouts++;
+        if (result->moduleLoaded) _shipped.insert(result->module);
+
+        lua_State* co = sched.waiter(result->token);
+        if (!co) {
+            _stats.staleResults++;
+        } else {
+            int top = lua_gettop(co);
+            lua_pushboolean(co, result->ok);
+            int n = result->values.data
+                ? luaUnpack(co, result->values.data, result->values.len) : -1;
+            if (n < 0) {
+                lua_settop(co, top);
+                lua_pushboolean(co, 0);
+                lua_pushliteral(co, "worker out of memory");
+                n = 1;
+            }
+            sched.wake(result->token, n + 1);
+        }
+        luaPackFree(result->values);
+        heap_caps_free(result);
+    }
+}
+
+// =============================================================================
+// Lua Bindings
+// =============================================================================
+
+namespace {
+
+// File modules are compiled here and shipped to the worker as bytecode
+struct CodeBlock {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+int codeWriter(lua_State*, const void* p, size_t size, void* ud) {
+    CodeBlock* b = static_cast<CodeBlock*>(ud);
+    if (b->len + size > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 16 * 1024;
+        while (cap < b->len + size) cap *= 2;
+        char* data = (char*)heap_caps_realloc(b->data, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!data) return 1;
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, p, size);
+    b->len += size;
+    return 0;
+}
+
+}  // namespace
+
+// @lua ez.worker.call(module, fn, ...) -> boolean, ...
+// @brief Run a module function on the background Lua worker (Core 0)
+// @description Calls module[fn](...) in the worker's own Lua state and
+// suspends the calling coroutine until it returns, so CPU-heavy script work
+// doesn't stall the UI. Arguments and results are copied between the states:
+// only nil, booleans, numbers, strings and tables of those can cross.
+// The worker sees none of the main state's globals and only a small ez table
+// (log, system.millis/micros, storage.json_encode/json_decode); it has no file
+// or hardware access. module is a $ path or a /sd/ or /fs/ file that returns
+// a table of functions; it is loaded once and keeps its upvalues between
+// calls. A call running longer than 10 s is aborted. Must be called from a
+// coroutine; ez.worker.post() returns a Promise instead.
+// @param module Module path (e.g. "$workers/index.lua" or "/sd/apps/x/job.lua")
+// @param fn Name of the function in the module's table
+// @param ... Arguments (plain data)
+// @return true and fn's results, or false and an error message
+// @example
+// spawn(function()
+//     local ok, index = ez.worker.call("/sd/apps/notes/index.lua", "build", notes)
+//     if ok then state.index = index end
+// end)
+// @end
+int LuaWorker::l_call(lua_State* L) {
+    size_t moduleLen, fnLen;
+    const char* module = luaL_checklstring(L, 1, &moduleLen);
+    const char* fn = luaL_checklstring(L, 2, &fnLen);
+    if (!lua_isyieldable(L)) {
+        return luaL_error(L, "ez.worker.call() must be called from a coroutine");
+    }
+    if (moduleLen >= MAX_NAME || fnLen >= sizeof(Job::fn)) {
+        return luaL_error(L, "module or function name too long");
+    }
+
+    LuaWorker& self = instance();
+    if (!self.start()) {
+        return luaL_error(L, "worker unavailable");
+    }
+
+    Job* job = (Job*)heap_caps_calloc(1, sizeof(Job), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    Result* result = (Result*)heap_caps_calloc(1, sizeof(Result),
+                                               MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!job || !result) {
+        heap_caps_free(job);
+        heap_caps_free(result);
+        return luaL_error(L, "out of memory");
+    }
+    memcpy(job->module, module, moduleLen + 1);
+    memcpy(job->fn, fn, fnLen + 1);
+    memcpy(result->module, module, moduleLen + 1);
+    job->result = result;
+
+    const char* err = nullptr;
+    if (!luaPack(L, 3, lua_gettop(L) - 2, job->args, &err)) {
+        freeJob(job);
+        heap_caps_free(result);
+        return luaL_error(L, "ez.worker.call: %s", err);
+    }
+
+    // Ship the module unless the worker has confirmed loading it
+    if (!self._shipped.count(module)) {
+        ScriptLoader& loader = ScriptLoader::instance();
+        if (module[0] == '$') {
+            job->code = loader.findEmbedded(module, &job->codeLen);
+        } else {
+            int status = loader.loadPath(L, module);
+            if (status == LUA_OK) {
+                CodeBlock code = {nullptr, 0, 0};
+                status = lua_dump(L, codeWriter, &code, 0);
+                lua_pop(L, 1);
+                job->code = code.data;
+                job->codeLen = code.len;
+                job->codeOwned = true;
+                if (status != 0) {
+                    freeJob(job);
+                    heap_caps_free(result);
+                    return luaL_error(L, "out of memory");
+                }
+            } else if (status > 0) {
+                freeJob(job);
+                heap_caps_free(result);
+                return lua_error(L);  // Compile error on the stack
+            }
+        }
+        if (!job->code) {
+            freeJob(job);
+            heap_caps_free(result);
+            return luaL_error(L, "module not found: %s", module);
+        }
+    }
+
+    Scheduler& sched = Scheduler::instance();
+    Scheduler::Token token = sched.park(L);
+    result->token = token;
+    if (xQueueSend(self._jobs, &job, 0) != pdTRUE) {
+        sched.unpark(token);
+        freeJob(job);
+        heap_caps_free(result);
+        self._stats.rejected++;
+        lua_pushboolean(L, 0);
+        lua_pushliteral(L, "worker queue full");
+        return 2;
+    }
+    self._stats.posted++;
+    return lua_yield(L, 0);
+}
+
+// @lua ez.worker.stats() -> table
+// @brief Background Lua worker counters
+// @description Totals since boot for ez.worker jobs, plus the worker state's
+// current and peak heap use against its limit. running is false until the
+// first job starts the worker task.
+// @return Table with running, posted, completed, errors, rejected, timeouts,
+// stale, queued, busy_us, mem_used, mem_peak, mem_limit, modules
+// @example
+// local s = ez.worker.stats()
+// print(s.completed .. " jobs, " .. s.busy_us // 1000 .. " ms on Core 0")
+// @end
+int LuaWorker::l_stats(lua_State* L) {
+    LuaWorker& self = instance();
+    const Stats& s = self._stats;
+    lua_createtable(L, 0, 13);
+    lua_pushboolean(L, self._task != nullptr);  lua_setfield(L, -2, "running");
+    lua_pushinteger(L, s.posted);               lua_setfield(L, -2, "posted");
+    lua_pushinteger(L, s.completed);            lua_setfield(L, -2, "completed");
+    lua_pushinteger(L, s.errors);               lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, s.rejected);             lua_setfield(L, -2, "rejected");
+    lua_pushinteger(L, s.timeouts);             lua_setfield(L, -2, "timeouts");
+    lua_pushinteger(L, s.staleResults);         lua_setfield(L, -2, "stale");
+    lua_pushinteger(L, self._jobs ? uxQueueMessagesWaiting(self._jobs) : 0);
+    lua_setfield(L, -2, "queued");
+    lua_pushinteger(L, s.busyUs);               lua_setfield(L, -2, "busy_us");
+    lua_pushinteger(L, s.memUsed);              lua_setfield(L, -2, "mem_used");
+    lua_pushinteger(L, s.memPeak);              lua_setfield(L, -2, "mem_peak");
+    lua_pushinteger(L, HEAP_LIMIT);             lua_setfield(L, -2, "mem_limit");
+    lua_pushinteger(L, self._shipped.size());   lua_setfield(L, -2, "modules");
+    return 1;
+}
+
+void LuaWorker::registerBindings(lua_State* L) {
+    LuaWorker& self = instance();
+    // Modules may have changed on disk since the worker loaded them, and
+    // results for the old state's coroutines are already stale.
+    self._shipped.clear();
+    if (self._task) {
+        Job* reset = (Job*)heap_caps_calloc(1, sizeof(Job), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (reset && xQueueSend(self._jobs, &reset, portMAX_DELAY) != pdTRUE) {
+            heap_caps_free(reset);
+        }
+    }
+
+    static const luaL_Reg funcs[] = {
+        {"call",  l_call},
+        {"stats", l_stats},
+        {nullptr, nullptr}
+    };
+    lua_register_module(L, "worker", funcs);
+    LOG("LuaRuntime", "Registered ez.worker");
+}
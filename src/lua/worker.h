@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "lua.hpp"
+#include "lua_pack.h"
+#include "lua_slab.h"
+
+// Background Lua: a second, sandboxed lua_State on Core 0 for CPU-heavy
+// script work (indexing, preprocessing, parsing imports) that would
+// otherwise stall the UI on Core 1.
+//
+// ez.worker.call(module, fn, ...) runs module[fn](...) on the worker and
+// suspends the calling coroutine until it returns, like the async_*
+// functions; ez.worker.post() (ezui/async.lua) wraps it in a Promise.
+// Nothing is shared between the states: arguments and results are packed
+// into plain data (lua_pack.h) on one side and rebuilt on the other.
+//
+// The worker state has the pure standard libraries (base without
+// dofile/loadfile, string, table, math, utf8, coroutine) and a small ez
+// table: log, system.millis/micros and storage.json_encode/json_decode.
+// No file, display, radio or other hardware access. A module is loaded
+// once per worker state: $ modules straight from flash, file modules
+// compiled on the Lua thread (through the bytecode cache) and shipped as
+// bytecode with the first call that needs them. The module must return a
+// table of functions.
+//
+// The worker task is created on first use. Its stack lives in PSRAM,
+// which is why the worker can't touch flash filesystems or NVS (those
+// disable the cache the stack is read through); it runs at idle priority
+// so a long job shares Core 0 with the idle task instead of tripping the
+// task watchdog. The state has its own slab allocator capped at
+// HEAP_LIMIT, and a job that runs past JOB_TIMEOUT_MS is aborted.
+class LuaWorker {
+public:
+    static LuaWorker& instance();
+
+    static constexpr size_t STACK_SIZE = 32 * 1024;
+    static constexpr size_t HEAP_LIMIT = 2 * 1024 * 1024;
+    static constexpr uint32_t JOB_TIMEOUT_MS = 10000;
+    static constexpr size_t QUEUE_SIZE = 8;
+
+    struct Stats {
+        uint32_t posted;
+        uint32_t completed;     // Results delivered, errors included
+        uint32_t errors;
+        uint32_t rejected;      // Job queue full
+        uint32_t timeouts;
+        uint32_t staleResults;  // Caller was cancelled or its state replaced
+        uint32_t busyUs;        // Time spent running jobs on Core 0
+        uint32_t memUsed;       // Worker heap (written by the worker)
+        uint32_t memPeak;
+    };
+
+    // Register ez.worker. A new main state means new module code may be
+    // on disk: the worker drops its state before the next job.
+    static void registerBindings(lua_State* L);
+
+    // Deliver finished jobs to their coroutines (Lua thread, every frame)
+    void update();
+
+    const Stats& getStats() const { return _stats; }
+
+    static int l_call(lua_State* L);
+    static int l_stats(lua_State* L);
+
+private:
+    LuaWorker() = default;
+
+    static constexpr size_t MAX_NAME = 96;
+
+    struct Result;
+
+    struct Job {
+        Result* result;         // Filled in by the worker; nullptr = reset
+        char module[MAX_NAME];
+        char fn[48];
+        const char* code;       // Module chunk if the worker may not have it
+        size_t codeLen;
+        bool codeOwned;         // `code` is a PSRAM copy, not flash
+        LuaPacked args;
+    };
+
+    struct Result {
+        uint32_t token;         // Scheduler wait token of the caller
+        bool ok;
+        bool moduleLoaded;
+        bool timedOut;
+        uint32_t runUs;
+        char module[MAX_NAME];
+        LuaPacked values;       // Return values, or the error message
+    };
+
+    bool start();
+    static void task(void* arg);
+    void runJob(Job* job, Result* result);
+    bool openState();
+    void closeState();
+    bool loadModule(Job* job);
+    static int callJob(lua_State* W);
+    static void freeJob(Job* job);
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+    static void timeoutHook(lua_State* L, lua_Debug* ar);
+
+    QueueHandle_t _jobs = nullptr;
+    QueueHandle_t _results = nullptr;
+    TaskHandle_t _task = nullptr;
+
+    // Lua thread only, apart from memUsed/memPeak
+    std::unordered_set<std::string> _shipped;   // Modules the worker has loaded
+    Stats _stats = {};
+
+    // Worker task only
+    lua_State* _W = nullptr;
+    LuaSlab _slab;
+    uint32_t _jobStart = 0;
+    bool _timedOut = false;
+};
@@ -11,6 +11,8 @@
 #include "esp_system.h"
 #include "config.h"
 #include "util/log.h"
+#include "util/trace.h"
+#include "util/nvs_prefs.h"
 #include "hardware/display.h"
 #include "hardware/keyboard.h"
 #include "hardware/radio.h"
@@ -21,6 +23,8 @@
 #include "lua/async.h"
 #include "settings.h"
 #include "lua/lua_runtime.h"
+#include "lua/script_loader.h"
+#include "lua/frame_stats.h"
 #include "remote/remote_control.h"
 
 
@@ -93,6 +97,9 @@ void setup() {
         delay(10);
     }
 
+    // Start printing queued LOG() records now that Serial is up
+    log_init();
+
     Serial.println();
     Serial.println("=====================================");
     Serial.println("  T-Deck Plus MeshCore");
@@ -223,6 +230,9 @@ void setup() {
         });
     }
 
+    // Read the Lua prefs into RAM before any script asks for one
+    NvsPrefs::instance().begin();
+
     // Initialize Lua runtime
     Serial.println("Initializing Lua runtime...");
     if (LuaRuntime::instance().init()) {
@@ -232,10 +242,15 @@ void setup() {
         Serial.println("WARNING: Lua init failed");
     }
 
+    // Per-phase frame timing for loop() (ez.system.get_frame_stats)
+    FrameStats::instance().begin();
+
     // Run boot script (requires display and keyboard)
     if (displayOk && keyboardOk && luaOk) {
         Serial.println("Running boot script...");
+        uint32_t bootStart = micros();
         if (LuaRuntime::instance().executeFile("$boot.lua")) {
+            ScriptLoader::instance().markBootComplete(micros() - bootStart);
             Serial.println("Boot script executed - Lua shell active");
         } else {
             Serial.println("ERROR: Boot script failed!");
@@ -329,28 +344,41 @@ void setup() {
 
 // Declared in system_bindings.cpp
 extern uint32_t g_loopDelayMs;
+extern bool luaTimersNextDue(uint32_t now, uint32_t& ms);
 
 void loop() {
+    TRACE_SCOPE("frame");
     uint32_t frameStart = millis();
+    FrameStats& frameStats = FrameStats::instance();
+    frameStats.beginFrame();
 
     // Process remote control commands (non-blocking)
+    frameStats.enter(FramePhase::REMOTE);
     RemoteControl::instance().update();
+    frameStats.leave();
 
     // Update GPS (reads serial data, auto-syncs time on first fix)
     if (gpsOk) {
+        FramePhaseScope phase(FramePhase::GPS);
         GPS::instance().update();
     }
 
     // Poll the touch controller and dispatch touch/down, touch/move,
     // touch/up bus events. Cheap when nothing is pressed (one I2C
     // status read).
+    frameStats.enter(FramePhase::TOUCH);
     touch_bindings::update();
+    frameStats.leave();
 
     // Process async I/O, timers, and GC
     if (luaOk) {
         LuaRuntime::instance().update();
     }
 
+    // Write back pref changes once they have settled. A flag check
+    // until something has changed.
+    NvsPrefs::instance().update();
+
     // Pump the UDP echo server used by the WiFi test screen. No-op when
     // the echo server isn't running, so the cost while WiFi testing is
     // inactive is a single boolean check.
@@ -359,19 +387,41 @@ void loop() {
 
     // Call Lua main loop (if defined)
     if (luaOk) {
+        FramePhaseScope phase(FramePhase::LUA_LOOP);
         LuaRuntime::instance().callGlobalFunction("main_loop");
     }
 
+    // Incremental GC after the frame has rendered. With a loop delay set,
+    // the time that would otherwise be slept becomes GC budget.
+    if (luaOk) {
+        uint32_t idleUs = 0;
+        uint32_t elapsed = millis() - frameStart;
+        if (elapsed < g_loopDelayMs) {
+            idleUs = (g_loopDelayMs - elapsed) * 1000;
+        }
+        FramePhaseScope phase(FramePhase::GC);
+        LuaRuntime::instance().runFrameGC(idleUs);
+    }
+
     // Keep mesh alive if Lua isn't doing it
     if (mesh && meshOk && !luaOk) {
         mesh->update();
     }
 
-    // Configurable loop delay (default 0 for maximum FPS)
+    // Configurable loop delay (default 0 for maximum FPS). Wake early if
+    // a Lua timer or deferred coroutine comes due before the delay is up.
     if (g_loopDelayMs > 0) {
         uint32_t elapsed = millis() - frameStart;
         if (elapsed < g_loopDelayMs) {
-            delay(g_loopDelayMs - elapsed);
+            uint32_t sleepMs = g_loopDelayMs - elapsed;
+            uint32_t dueMs;
+            if (luaOk && luaTimersNextDue(millis(), dueMs) && dueMs < sleepMs) {
+                sleepMs = dueMs;
+            }
+            if (sleepMs > 0) {
+                FramePhaseScope phase(FramePhase::IDLE);
+                delay(sleepMs);
+            }
         }
     }
 }
@@ -3,6 +3,7 @@
 #include <functional>
 #include <vector>
 #include "../hardware/radio.h"
+#include "../util/heap_tags.h"
 #include "packet.h"
 #include "identity.h"
 
@@ -99,8 +100,12 @@ public:
     // Schedule a raw packet for rebroadcast (called from Lua)
     void scheduleRawRebroadcast(const uint8_t* data, size_t len);
 
+    // Mesh containers count against HeapTag::MESH
+    template <typename T>
+    using MeshVector = std::vector<T, HeapTagAllocator<T, HeapTag::MESH>>;
+
     // Get known nodes
-    const std::vector<NodeInfo>& getNodes() const { return _nodes; }
+    const MeshVector<NodeInfo>& getNodes() const { return _nodes; }
 
     // Get our identity
     const Identity& getIdentity() const { return _identity; }
@@ -127,8 +132,8 @@ private:
     Radio& _radio;
     Identity _identity;
 
-    std::vector<NodeInfo> _nodes;
-    std::vector<Message> _messages;
+    MeshVector<NodeInfo> _nodes;
+    MeshVector<Message> _messages;
 
     MessageCallback _onMessage;
     NodeCallback _onNode;
@@ -147,7 +152,7 @@ private:
         size_t len;
         uint32_t sendAt;
     };
-    std::vector<PendingRebroadcast> _pendingRebroadcasts;
+    MeshVector<PendingRebroadcast> _pendingRebroadcasts;
 
     // Process received packet
     void handlePacket(const uint8_t* data, size_t len, const RxMetadata& meta);
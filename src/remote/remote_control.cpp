@@ -3,6 +3,8 @@
 #include "../hardware/display.h"
 #include "../lua/lua_runtime.h"
 #include "../config.h"
+#include "../util/log.h"
+#include "../util/file_handles.h"
 #include <lua.hpp>
 #include <LittleFS.h>
 
@@ -202,6 +204,10 @@ void RemoteControl::processCommand(uint8_t cmd, const uint8_t* payload, uint16_t
 }
 
 void RemoteControl::sendResponse(uint8_t status, const uint8_t* data, uint32_t len) {
+    // The log printer writes from its own task; keep its lines out of
+    // the middle of a response
+    LogSerialGuard serial;
+
     // Response header: [STATUS:1][LEN:4] (little-endian)
     Serial.write(status);
     Serial.write(len & 0xFF);
@@ -641,6 +647,7 @@ void RemoteControl::handleFileWrite(const uint8_t* payload, uint16_t len) {
 
     size_t written = f.write(fileData, dataLen);
     f.close();
+    FileHandleCache::instance().invalidate(LittleFS, fsPath);
 
     char resp[32];
     int respLen = snprintf(resp, sizeof(resp), "%u", (unsigned)written);
@@ -723,6 +730,7 @@ void RemoteControl::handleWriteAt(const uint8_t* payload, uint16_t len) {
     f.seek(offset);
     size_t written = f.write(fileData, dataLen);
     f.close();
+    FileHandleCache::instance().invalidate(LittleFS, fsPath);
 
     char resp[32];
     int respLen = snprintf(resp, sizeof(resp), "%u", (unsigned)written);
@@ -0,0 +1,311 @@
+#include "block_cache.h"
+
+#include "heap_tags.h"
+
+#include <string.h>
+
+BlockCache::BlockCache(BlockDevice& dev, const BlockCacheConfig& cfg)
+    : _dev(dev), _cfg(cfg), _blockBytes(cfg.blockSectors * SECTOR_SIZE) {
+    memset(_streams, 0, sizeof(_streams));
+}
+
+BlockCache::~BlockCache() {
+    end();
+}
+
+bool BlockCache::begin(uint32_t sectorCount) {
+    end();
+    if (_cfg.blockSectors == 0 || _cfg.blockSectors > 32 || _cfg.blocks == 0) return false;
+    _sectorCount = sectorCount;
+
+    // One fetch covers the blocks a read below bypassSectors can span,
+    // plus the read-ahead. Keep it to half the cache so a fetch never
+    // evicts the block it was made for.
+    uint32_t spanBlocks = (_cfg.bypassSectors + _cfg.blockSectors - 1) / _cfg.blockSectors + 1;
+    if (spanBlocks * 2 > _cfg.blocks) return false;
+    uint32_t maxAhead = _cfg.blocks / 2 - spanBlocks;
+    if (_cfg.maxReadahead > maxAhead) _cfg.maxReadahead = maxAhead;
+    _maxRun = spanBlocks + _cfg.maxReadahead;
+
+    uint32_t buckets = 1;
+    while (buckets < _cfg.blocks * 2) buckets <<= 1;
+
+    _data = (uint8_t*)heapTagPsMalloc(HeapTag::STORAGE, (size_t)_cfg.blocks * _blockBytes);
+    _staging = (uint8_t*)heapTagPsMalloc(HeapTag::STORAGE, (size_t)_maxRun * _blockBytes);
+    _slots = (Slot*)heapTagPsMalloc(HeapTag::STORAGE, _cfg.blocks * sizeof(Slot));
+    _buckets = (int32_t*)heapTagPsMalloc(HeapTag::STORAGE, buckets * sizeof(int32_t));
+    if (!_data || !_staging || !_slots || !_buckets) {
+        end();
+        return false;
+    }
+    _bucketMask = buckets - 1;
+    _raCap = _cfg.maxReadahead;
+    invalidate();
+    _stats.invalidations = 0;
+    return true;
+}
+
+void BlockCache::end() {
+    heapTagFree(HeapTag::STORAGE, _data);
+    heapTagFree(HeapTag::STORAGE, _staging);
+    heapTagFree(HeapTag::STORAGE, _slots);
+    heapTagFree(HeapTag::STORAGE, _buckets);
+    _data = _staging = nullptr;
+    _slots = nullptr;
+    _buckets = nullptr;
+    _head = _tail = NIL;
+}
+
+void BlockCache::invalidate() {
+    _stats.invalidations++;
+    if (!_data) return;
+    for (uint32_t i = 0; i <= _bucketMask; i++) _buckets[i] = NIL;
+    _head = _tail = NIL;
+    for (uint32_t i = 0; i < _cfg.blocks; i++) {
+        _slots[i].used = false;
+        _slots[i].ahead = false;
+        pushBack((int32_t)i);
+    }
+    memset(_streams, 0, sizeof(_streams));
+}
+
+void BlockCache::getStats(BlockCacheStats& out) const {
+    out = _stats;
+    out.window = _raCap;
+}
+
+size_t BlockCache::memoryBytes() const {
+    if (!_data) return 0;
+    return ((size_t)_cfg.blocks + _maxRun) * _blockBytes + _cfg.blocks * sizeof(Slot) +
+           (_bucketMask + 1) * sizeof(int32_t);
+}
+
+bool BlockCache::deviceRead(uint32_t sector, uint8_t* buf, uint32_t count) {
+    _stats.deviceReads++;
+    return _dev.readSectors(sector, buf, count);
+}
+
+BlockCache::Stream& BlockCache::stream(uint32_t sector, uint32_t count, bool& sequential) {
+    // A read that starts where a stream left off continues it (or one
+    // sector either side: FatFs re-reads a partial sector now and then)
+    Stream* oldest = &_streams[0];
+    for (Stream& st : _streams) {
+        if (st.used && sector + 1 >= st.next && sector <= st.next + 1) {
+            sequential = true;
+            st.lastUse = ++_tick;
+            if (sector + count > st.next) {
+                st.run += sector + count - st.next;
+                st.next = sector + count;
+            }
+            return st;
+        }
+        if (!st.used || (oldest->used && st.lastUse < oldest->lastUse)) oldest = &st;
+    }
+    sequential = false;
+    oldest->used = true;
+    oldest->next = sector + count;
+    oldest->run = count;
+    oldest->lastUse = ++_tick;
+    return *oldest;
+}
+
+bool BlockCache::read(uint32_t sector, uint8_t* buf, uint32_t count) {
+    if (!_data || count == 0 || sector + count > _sectorCount || sector + count < sector) {
+        return deviceRead(sector, buf, count);
+    }
+    bool sequential;
+    Stream& st = stream(sector, count, sequential);
+    if (count >= _cfg.bypassSectors) {
+        _stats.bypassed += count;
+        return deviceRead(sector, buf, count);
+    }
+
+    const uint32_t bs = _cfg.blockSectors;
+    const uint32_t end = sector + count;
+    bool fetched = false;
+    for (uint32_t s = sector; s < end;) {
+        uint32_t block = s / bs;
+        uint32_t off = s - block * bs;
+        uint32_t n = end - s < bs - off ? end - s : bs - off;
+        uint32_t want = sectorMask(off, n);
+        int32_t slot = find(block);
+        if (slot == NIL || (_slots[slot].valid & want) != want) {
+            // A random miss reads just the rest of the request; on a slow
+            // bus a whole block would cost more than it saves. A stream
+            // reads to the end of the block and its window beyond.
+            uint32_t last = end;
+            if (sequential && st.run >= bs) {
+                uint32_t window = st.run / bs < _raCap ? st.run / bs : _raCap;
+                uint32_t endBlock = (end - 1) / bs + 1;
+                uint32_t limit = block + _maxRun;
+                if (limit > endBlock + window) limit = endBlock + window;
+                last = endBlock * bs;
+                for (uint32_t b = endBlock; b < limit && b * bs < _sectorCount && !isFull(b); b++) {
+                    last = (b + 1) * bs;
+                }
+                if (last > _sectorCount) last = _sectorCount;
+            }
+            if (!fill(s, last - s, end)) return false;
+            fetched = true;
+            slot = find(block);
+        }
+        Slot& e = _slots[slot];
+        if (fetched) {
+            _stats.misses += n;
+        } else {
+            _stats.hits += n;
+        }
+        if (e.ahead) {
+            e.ahead = false;
+            _stats.readaheadUsed += (uint32_t)__builtin_popcount(e.valid);
+            if (_raCap < _cfg.maxReadahead && ++_raCredit >= _raCap) {
+                _raCap++;
+                _raCredit = 0;
+            }
+        }
+        memcpy(buf, slotData(slot) + off * SECTOR_SIZE, (size_t)n * SECTOR_SIZE);
+        unlink(slot);
+        pushFront(slot);
+        buf += (size_t)n * SECTOR_SIZE;
+        s += n;
+    }
+    return true;
+}
+
+bool BlockCache::write(uint32_t sector, const uint8_t* buf, uint32_t count) {
+    _stats.deviceWrites++;
+    bool ok = _dev.writeSectors(sector, buf, count);
+    if (!_data || count == 0) return ok;
+    _stats.written += count;
+
+    // Bring cached copies up to date, or drop them if the device may now
+    // hold something else. Blocks that aren't cached stay that way.
+    const uint32_t bs = _cfg.blockSectors;
+    const uint32_t end = sector + count;
+    for (uint32_t s = sector; s < end;) {
+        uint32_t block = s / bs;
+        uint32_t off = s - block * bs;
+        uint32_t n = end - s < bs - off ? end - s : bs - off;
+        int32_t slot = find(block);
+        if (slot != NIL) {
+            if (ok) {
+                memcpy(slotData(slot) + off * SECTOR_SIZE, buf + (size_t)(s - sector) * SECTOR_SIZE,
+                       (size_t)n * SECTOR_SIZE);
+                _slots[slot].valid |= sectorMask(off, n);
+            } else {
+                drop(slot);
+            }
+        }
+        s += n;
+    }
+    return ok;
+}
+
+uint32_t BlockCache::sectorMask(uint32_t off, uint32_t n) {
+    return (n >= 32 ? ~0u : (1u << n) - 1) << off;
+}
+
+bool BlockCache::isFull(uint32_t block) const {
+    int32_t slot = find(block);
+    if (slot == NIL) return false;
+    uint32_t first = block * _cfg.blockSectors;
+    uint32_t n = _sectorCount - first < _cfg.blockSectors ? _sectorCount - first : _cfg.blockSectors;
+    uint32_t full = sectorMask(0, n);
+    return (_slots[slot].valid & full) == full;
+}
+
+int32_t BlockCache::find(uint32_t block) const {
+    for (int32_t i = _buckets[hash(block)]; i != NIL; i = _slots[i].hashNext) {
+        if (_slots[i].block == block) return i;
+    }
+    return NIL;
+}
+
+// Read `count` sectors from `first` in one command and store them,
+// creating blocks as needed. Whole blocks from demandEnd on are read-ahead.
+bool BlockCache::fill(uint32_t first, uint32_t count, uint32_t demandEnd) {
+    if (!deviceRead(first, _staging, count)) return false;
+    const uint32_t bs = _cfg.blockSectors;
+    const uint32_t end = first + count;
+    if (end > demandEnd) _stats.readahead += end - demandEnd;
+    for (uint32_t s = first; s < end;) {
+        uint32_t block = s / bs;
+        uint32_t off = s - block * bs;
+        uint32_t n = end - s < bs - off ? end - s : bs - off;
+        int32_t slot = find(block);
+        if (slot == NIL) {
+            slot = allocSlot();
+            Slot& e = _slots[slot];
+            e.block = block;
+            e.valid = 0;
+            e.used = true;
+            e.ahead = s >= demandEnd;
+            int32_t& bucket = _buckets[hash(block)];
+            e.hashNext = bucket;
+            bucket = slot;
+        }
+        memcpy(slotData(slot) + off * SECTOR_SIZE, _staging + (size_t)(s - first) * SECTOR_SIZE,
+               (size_t)n * SECTOR_SIZE);
+        _slots[slot].valid |= sectorMask(off, n);
+        unlink(slot);
+        pushFront(slot);
+        s += n;
+    }
+    return true;
+}
+
+// Least recently used slot, emptied
+int32_t BlockCache::allocSlot() {
+    int32_t slot = _tail;
+    Slot& e = _slots[slot];
+    if (e.used) {
+        _stats.evictions++;
+        if (e.ahead) {
+            // Reading ahead further than the cache can hold on to
+            _stats.readaheadWasted++;
+            _raCap = _raCap > 2 ? _raCap / 2 : 1;
+            _raCredit = 0;
+        }
+        unhash(slot);
+        e.used = false;
+        e.ahead = false;
+    }
+    return slot;
+}
+
+void BlockCache::drop(int32_t slot) {
+    unhash(slot);
+    _slots[slot].used = false;
+    _slots[slot].ahead = false;
+    unlink(slot);
+    pushBack(slot);
+}
+
+void BlockCache::unhash(int32_t slot) {
+    int32_t* link = &_buckets[hash(_slots[slot].block)];
+    while (*link != slot) link = &_slots[*link].hashNext;
+    *link = _slots[slot].hashNext;
+}
+
+void BlockCache::unlink(int32_t slot) {
+    Slot& e = _slots[slot];
+    if (e.prev != NIL) _slots[e.prev].next = e.next; else _head = e.next;
+    if (e.next != NIL) _slots[e.next].prev = e.prev; else _tail = e.prev;
+    e.prev = e.next = NIL;
+}
+
+void BlockCache::pushFront(int32_t slot) {
+    Slot& e = _slots[slot];
+    e.prev = NIL;
+    e.next = _head;
+    if (_head != NIL) _slots[_head].prev = slot; else _tail = slot;
+    _head = slot;
+}
+
+void BlockCache::pushBack(int32_t slot) {
+    Slot& e = _slots[slot];
+    e.next = NIL;
+    e.prev = _tail;
+    if (_tail != NIL) _slots[_tail].next = slot; else _head = slot;
+    _tail = slot;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sector cache for a block device, for use underneath a filesystem.
+//
+// FatFs reads a file that is consumed in small pieces (an MP3 decoder, a
+// JPEG loader, a file being served over HTTP) one sector per call, and
+// every call is a separate SD command with its own setup and wait for the
+// card. Hot regions that are read again and again (map indexes, font
+// packs, the FAT itself) go back to the card every time.
+//
+// The cache keeps recently read sectors in blocks of blockSectors, evicted
+// least recently used first, with a bit per sector for what a block holds.
+// A random miss reads only the sectors asked for: at the SD library's
+// 4 MHz clock the transfer, not the command, dominates a small read. When
+// the reader is streaming the miss reads to the end of the block and
+// ahead: up to STREAMS readers are told apart by where their next read
+// lands, and a stream reads ahead as far as it has already come, so the
+// window doubles from one miss to the next. It is capped, and the cap
+// halves whenever a block read ahead is evicted unread and creeps back up
+// as read-ahead pays off. A short run (walking a FAT chain) gets nothing
+// past the end of its block. Reads of bypassSectors or more go
+// straight to the device; they already amortise the command and would
+// only push out hotter blocks.
+//
+// Writes go through to the device before the call returns and update any
+// cached copy, so the device is never behind the cache and there is
+// nothing to flush. Whoever writes to the device by another route (USB
+// mass storage) must call invalidate().
+//
+// Not thread-safe; see sd_block_cache.h for the locked SD wrapper. No
+// Arduino dependencies (see tools/bench/block_cache_bench.cpp).
+
+struct BlockCacheStats {
+    uint32_t hits;              // Sectors read from the cache
+    uint32_t misses;            // Sectors the reader waited on the device for
+    uint32_t readahead;         // Sectors fetched ahead of the reader
+    uint32_t readaheadUsed;     // Of those, sectors read before eviction
+    uint32_t readaheadWasted;   // Blocks read ahead and evicted unread
+    uint32_t bypassed;          // Sectors of large reads passed straight through
+    uint32_t written;           // Sectors written through
+    uint32_t deviceReads;       // Read commands issued to the device
+    uint32_t deviceWrites;      // Write commands issued to the device
+    uint32_t evictions;         // Blocks evicted to make room
+    uint32_t invalidations;     // Calls to invalidate()
+    uint32_t window;            // Current read-ahead cap, in blocks
+};
+
+// The device underneath. Multi-sector calls should be one command.
+class BlockDevice {
+public:
+    virtual ~BlockDevice() {}
+    virtual bool readSectors(uint32_t sector, uint8_t* buf, uint32_t count) = 0;
+    virtual bool writeSectors(uint32_t sector, const uint8_t* buf, uint32_t count) = 0;
+};
+
+struct BlockCacheConfig {
+    uint32_t blockSectors = 8;      // Sectors per block (4 KB), at most 32
+    uint32_t blocks = 128;          // Cache size in blocks
+    uint32_t maxReadahead = 16;     // Read-ahead cap, in blocks
+    uint32_t bypassSectors = 64;    // Reads this long skip the cache
+};
+
+class BlockCache {
+public:
+    static constexpr uint32_t SECTOR_SIZE = 512;
+    static constexpr size_t STREAMS = 4;
+
+    BlockCache(BlockDevice& dev, const BlockCacheConfig& cfg);
+    ~BlockCache();
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // Allocate the blocks (PSRAM) for a device of sectorCount sectors.
+    // Returns false if memory is short; the cache then passes everything
+    // through. Calling it again drops the contents.
+    bool begin(uint32_t sectorCount);
+    void end();
+    bool active() const { return _data != nullptr; }
+
+    bool read(uint32_t sector, uint8_t* buf, uint32_t count);
+    bool write(uint32_t sector, const uint8_t* buf, uint32_t count);
+
+    // Forget every cached block (the device changed underneath)
+    void invalidate();
+
+    void getStats(BlockCacheStats& out) const;
+    // Cache and staging buffer bytes held
+    size_t memoryBytes() const;
+    const BlockCacheConfig& config() const { return _cfg; }
+
+private:
+    static constexpr int32_t NIL = -1;
+
+    struct Slot {
+        uint32_t block;
+        int32_t hashNext;
+        int32_t prev;           // LRU list, head is most recent
+        int32_t next;
+        uint32_t valid;         // Bit per sector held
+        bool used;
+        bool ahead;             // Read ahead and not yet read
+    };
+
+    struct Stream {
+        uint32_t next;          // Sector after the last read
+        uint32_t run;           // Sectors read in sequence so far
+        uint32_t lastUse;
+        bool used;
+    };
+
+    Stream& stream(uint32_t sector, uint32_t count, bool& sequential);
+    static uint32_t sectorMask(uint32_t off, uint32_t n);
+    uint32_t hash(uint32_t block) const { return (block * 2654435761u) & _bucketMask; }
+    bool isFull(uint32_t block) const;
+    int32_t find(uint32_t block) const;
+    bool fill(uint32_t first, uint32_t count, uint32_t demandEnd);
+    int32_t allocSlot();
+    void drop(int32_t slot);
+    void unhash(int32_t slot);
+    void unlink(int32_t slot);
+    void pushFront(int32_t slot);
+    void pushBack(int32_t slot);
+    uint8_t* slotData(int32_t slot) { return _data + (size_t)slot * _blockBytes; }
+    bool deviceRead(uint32_t sector, uint8_t* buf, uint32_t count);
+
+    BlockDevice& _dev;
+    BlockCacheConfig _cfg;
+    uint32_t _blockBytes;
+    uint32_t _sectorCount = 0;
+    uint32_t _maxRun = 0;           // Blocks one fetch may read
+    uint8_t* _data = nullptr;
+    uint8_t* _staging = nullptr;
+    Slot* _slots = nullptr;
+    int32_t* _buckets = nullptr;
+    uint32_t _bucketMask = 0;
+    int32_t _head = NIL;
+    int32_t _tail = NIL;
+    Stream _streams[STREAMS];
+    uint32_t _tick = 0;
+    uint32_t _raCap = 0;
+    uint32_t _raCredit = 0;         // Read-ahead blocks used since the cap last grew
+    BlockCacheStats _stats = {};
+};
@@ -0,0 +1,80 @@
+#include "file_handles.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <SD.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+namespace {
+
+enum : uint8_t { GROUP_SD = 0, GROUP_FS = 1 };
+
+}  // namespace
+
+FileHandleCache& FileHandleCache::instance() {
+    static FileHandleCache inst;
+    return inst;
+}
+
+FileHandleCache::FileHandleCache()
+    : _mutex(xSemaphoreCreateMutex()), _cache(MAX_AGE_MS) {}
+
+uint8_t FileHandleCache::groupOf(fs::FS& fs) {
+    return &fs == &SD ? GROUP_SD : GROUP_FS;
+}
+
+void FileHandleCache::lock() {
+    xSemaphoreTake((SemaphoreHandle_t)_mutex, portMAX_DELAY);
+}
+
+void FileHandleCache::unlock() {
+    xSemaphoreGive((SemaphoreHandle_t)_mutex);
+}
+
+FileHandleCache::Lease::Lease(fs::FS& fs, const char* path)
+    : _slot(-1), _group(groupOf(fs)), _file(&_own) {
+    FileHandleCache& c = instance();
+    size_t limit = _group == GROUP_SD ? SD_HANDLES : FS_HANDLES;
+    c.lock();
+    // The open runs under the lock; the other thread would be waiting on
+    // the same card anyway
+    _slot = c._cache.acquire(path, _group, limit, millis(),
+                             [&fs](const char* p) { return fs.open(p, FILE_READ); });
+    if (_slot >= 0) _file = &c._cache.handle(_slot);
+    c.unlock();
+    if (_slot == HandleCache<File, SLOTS>::NONE) _own = fs.open(path, FILE_READ);
+}
+
+FileHandleCache::Lease::~Lease() {
+    if (_slot < 0) {
+        if (_own) _own.close();
+        return;
+    }
+    FileHandleCache& c = instance();
+    c.lock();
+    c._cache.release(_slot, _keep);
+    c.unlock();
+}
+
+void FileHandleCache::invalidate(fs::FS& fs, const char* path) {
+    lock();
+    _cache.invalidate(groupOf(fs), path);
+    unlock();
+}
+
+void FileHandleCache::invalidateAll(fs::FS& fs) {
+    invalidate(fs, "/");
+}
+
+void FileHandleCache::closeIdle() {
+    lock();
+    _cache.closeIdle(0, true);
+    unlock();
+}
+
+void FileHandleCache::getStats(HandleCacheStats& out) {
+    lock();
+    _cache.getStats(out);
+    unlock();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <FS.h>
+
+#include "handle_cache.h"
+
+// Shared cache of open read handles for /sd/ and /fs/ files (see
+// handle_cache.h), used by ez.storage.read_bytes/file_size and AsyncIO's
+// READ_BYTES path so repeated reads of one file skip the open.
+//
+// Everything that writes, renames or removes a file through ez.storage,
+// AsyncIO or the remote-control file commands calls invalidate(); USB mass
+// storage calls invalidateAll() for the SD card before the host can write
+// to it. Writers outside those paths (the message store, the log) never
+// read through the cache, and any handle is reopened after MAX_AGE_MS
+// regardless.
+//
+// The SD card is mounted with room for five open files, so at most
+// SD_HANDLES of them sit in the cache; closeIdle() gives them back
+// before something that needs several files at once.
+//
+// Safe to use from the Lua thread and the AsyncIO worker: bookkeeping is
+// under a mutex, and a handle is only ever lent to one reader.
+class FileHandleCache {
+public:
+    static constexpr size_t SLOTS = 4;
+    static constexpr size_t SD_HANDLES = 2;
+    static constexpr size_t FS_HANDLES = 2;
+    static constexpr uint32_t MAX_AGE_MS = 5000;
+
+    static FileHandleCache& instance();
+
+    // A file open for reading for as long as the lease lives: a cached
+    // handle when one is free, else one opened (and closed) just for it.
+    class Lease {
+    public:
+        Lease(fs::FS& fs, const char* path);
+        ~Lease();
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        explicit operator bool() const { return (bool)*_file; }
+        File& file() { return *_file; }
+        // Don't keep the handle (a read failed on it)
+        void discard() { _keep = false; }
+
+    private:
+        int _slot;
+        uint8_t _group;
+        File _own;
+        File* _file;
+        bool _keep = true;
+    };
+
+    // `path` on `fs` (and anything under it) changed
+    void invalidate(fs::FS& fs, const char* path);
+    void invalidateAll(fs::FS& fs);
+    // Close every idle cached handle
+    void closeIdle();
+    void getStats(HandleCacheStats& out);
+
+private:
+    FileHandleCache();
+    static uint8_t groupOf(fs::FS& fs);
+    void lock();
+    void unlock();
+
+    void* _mutex;
+    HandleCache<File, SLOTS> _cache;
+};
@@ -0,0 +1,158 @@
+#include "folded_stacks.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static constexpr uint32_t FNV_PRIME = 0x01000193u;
+
+uint32_t FoldedStacks::hash(const char* s, uint32_t h) {
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint32_t FoldedStacks::hash(uint32_t v, uint32_t h) {
+    for (int i = 0; i < 4; i++) {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+size_t FoldedStacks::bytesNeeded(size_t frameSlots, size_t stackSlots) {
+    return frameSlots * sizeof(Frame) + stackSlots * sizeof(Stack);
+}
+
+void FoldedStacks::attach(void* mem, size_t frameSlots, size_t stackSlots) {
+    // Stack holds uint32_t, Frame too: both arrays stay 4-byte aligned.
+    _frames = static_cast<Frame*>(mem);
+    _stacks = reinterpret_cast<Stack*>(_frames + frameSlots);
+    _frameSlots = frameSlots;
+    _stackSlots = stackSlots;
+    clear();
+}
+
+void FoldedStacks::detach() {
+    _frames = nullptr;
+    _stacks = nullptr;
+    _frameSlots = 0;
+    _stackSlots = 0;
+    _stats = {};
+}
+
+void FoldedStacks::clear() {
+    if (_frames) memset(_frames, 0, _frameSlots * sizeof(Frame));
+    if (_stacks) memset(_stacks, 0, _stackSlots * sizeof(Stack));
+    _stats = {};
+}
+
+uint16_t FoldedStacks::find(uint32_t key) const {
+    if (!_frames) return NO_FRAME;
+    if (key == 0) key = 1;
+    size_t i = key % _frameSlots;
+    for (size_t probe = 0; probe < _frameSlots; probe++) {
+        const Frame& f = _frames[i];
+        if (f.key == key) return (uint16_t)i;
+        if (f.key == 0) break;
+        i = (i + 1) % _frameSlots;
+    }
+    return NO_FRAME;
+}
+
+uint16_t FoldedStacks::insert(uint32_t key, const char* name) {
+    if (!_frames) return NO_FRAME;
+    if (key == 0) key = 1;
+    size_t i = key % _frameSlots;
+    for (size_t probe = 0; probe < _frameSlots; probe++) {
+        Frame& f = _frames[i];
+        if (f.key == key) return (uint16_t)i;
+        if (f.key == 0) {
+            // Keep a slot free so lookups of unknown keys terminate early.
+            if (_stats.frames + 1 >= _frameSlots || i >= NO_FRAME) break;
+            strncpy(f.name, name, FRAME_NAME_LEN - 1);
+            f.name[FRAME_NAME_LEN - 1] = '\0';
+            // ';' separates frames in the folded format.
+            for (char* p = f.name; *p; p++) {
+                if (*p == ';') *p = ',';
+            }
+            f.key = key;
+            _stats.frames++;
+            return (uint16_t)i;
+        }
+        i = (i + 1) % _frameSlots;
+    }
+    _stats.droppedFrames++;
+    return NO_FRAME;
+}
+
+void FoldedStacks::add(const uint16_t* ids, size_t depth, uint32_t weight) {
+    if (!_stacks || depth == 0) return;
+    if (depth > MAX_DEPTH) depth = MAX_DEPTH;
+
+    uint32_t h = 0x811C9DC5u;
+    for (size_t d = 0; d < depth; d++) h = hash(ids[d], h);
+    h = hash((uint32_t)depth, h);
+    if (h == 0) h = 1;
+
+    size_t i = h % _stackSlots;
+    for (size_t probe = 0; probe < _stackSlots; probe++) {
+        Stack& s = _stacks[i];
+        if (s.hash == h && s.depth == depth &&
+            memcmp(s.ids, ids, depth * sizeof(uint16_t)) == 0) {
+            s.count += weight;
+            _stats.samples += weight;
+            return;
+        }
+        if (s.hash == 0) {
+            if (_stats.stacks + 1 >= _stackSlots) break;
+            memcpy(s.ids, ids, depth * sizeof(uint16_t));
+            s.depth = (uint16_t)depth;
+            s.count = weight;
+            s.hash = h;
+            _stats.stacks++;
+            _stats.samples += weight;
+            return;
+        }
+        i = (i + 1) % _stackSlots;
+    }
+    _stats.droppedSamples += weight;
+}
+
+size_t FoldedStacks::writeFolded(size_t& cursor, char* out, size_t cap) const {
+    size_t len = 0;
+    for (; cursor < _stackSlots; cursor++) {
+        const Stack& s = _stacks[cursor];
+        if (s.hash == 0 || s.count == 0) continue;
+
+        // Build the line in place; back out if it doesn't fit.
+        size_t start = len;
+        bool fits = true;
+        for (int d = (int)s.depth - 1; d >= 0 && fits; d--) {
+            uint16_t id = s.ids[d];
+            const char* name = id < _frameSlots && _frames[id].key ? _frames[id].name : "?";
+            size_t n = strlen(name);
+            if (len + n + 1 >= cap) {
+                fits = false;
+                break;
+            }
+            memcpy(out + len, name, n);
+            len += n;
+            out[len++] = d > 0 ? ';' : ' ';
+        }
+        if (fits) {
+            int n = snprintf(out + len, cap - len, "%lu\n", (unsigned long)s.count);
+            if (n < 0 || (size_t)n >= cap - len) {
+                fits = false;
+            } else {
+                len += (size_t)n;
+            }
+        }
+        if (!fits) {
+            len = start;
+            break;
+        }
+    }
+    return len;
+}
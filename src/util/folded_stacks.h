@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size aggregation of sampled call stacks, exported in the "folded"
+// format flamegraph.pl and speedscope read: one line per distinct stack,
+// frames root-first separated by ';', then a space and the sample count.
+//
+// Two open-addressed tables live in caller-provided memory (PSRAM on the
+// device), so recording a sample never allocates:
+//
+//   frames  key (caller's hash of the function identity) -> name, id
+//   stacks  sequence of frame ids -> count
+//
+// When either table fills up, new frames or stacks are counted as dropped
+// rather than evicting old ones. Frame names longer than FRAME_NAME_LEN-1
+// are truncated.
+//
+// No Arduino dependencies (see tools/bench/folded_stacks_check.cpp).
+class FoldedStacks {
+public:
+    static constexpr size_t MAX_DEPTH = 32;
+    static constexpr size_t FRAME_NAME_LEN = 56;
+    static constexpr uint16_t NO_FRAME = 0xFFFF;
+
+    struct Stats {
+        uint32_t samples;       // Sum of recorded weights
+        uint32_t stacks;        // Distinct stacks stored
+        uint32_t frames;        // Distinct frames stored
+        uint32_t droppedSamples;
+        uint32_t droppedFrames;
+    };
+
+    // Bytes of memory attach() needs for the given table sizes.
+    static size_t bytesNeeded(size_t frameSlots, size_t stackSlots);
+
+    // Use `mem` (bytesNeeded() bytes, any alignment from malloc) for the
+    // tables and clear them. Slot counts should leave ~25% headroom.
+    void attach(void* mem, size_t frameSlots, size_t stackSlots);
+    void detach();
+    bool attached() const { return _frames != nullptr; }
+
+    void clear();
+
+    // Id of the frame with identity `key` (0 is remapped), or NO_FRAME if
+    // it hasn't been inserted. Split from insert() so callers only format
+    // a name for frames they haven't seen.
+    uint16_t find(uint32_t key) const;
+
+    // Insert a frame and return its id (the existing id if already there).
+    // NO_FRAME if the frame table is full.
+    uint16_t insert(uint32_t key, const char* name);
+
+    // Count `weight` samples of the stack `ids[0..depth)`, leaf first.
+    // Stacks deeper than MAX_DEPTH keep their MAX_DEPTH innermost frames.
+    void add(const uint16_t* ids, size_t depth, uint32_t weight);
+
+    // Write folded lines for stack slots starting at `cursor` into `out`
+    // (never splitting a line) and advance `cursor`. Returns the bytes
+    // written; 0 with cursor == end() means done. `cap` must fit a line
+    // (MAX_DEPTH * FRAME_NAME_LEN + 16 bytes always does).
+    size_t writeFolded(size_t& cursor, char* out, size_t cap) const;
+    size_t end() const { return _stackSlots; }
+
+    const Stats& stats() const { return _stats; }
+
+    // Hash helper for frame keys (FNV-1a, continues from `h`).
+    static uint32_t hash(const char* s, uint32_t h = 0x811C9DC5u);
+    static uint32_t hash(uint32_t v, uint32_t h);
+
+private:
+    struct Frame {
+        uint32_t key;           // 0 = empty slot
+        char name[FRAME_NAME_LEN];
+    };
+
+    struct Stack {
+        uint32_t hash;          // 0 = empty slot
+        uint32_t count;
+        uint16_t depth;
+        uint16_t ids[MAX_DEPTH];
+    };
+
+    Frame* _frames = nullptr;
+    Stack* _stacks = nullptr;
+    size_t _frameSlots = 0;
+    size_t _stackSlots = 0;
+    Stats _stats = {};
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// LRU cache of open read handles, keyed by path.
+//
+// Opening a file on FAT walks its directory chain again every time, so
+// code that reads one large file in many small pieces (map tiles, font
+// glyphs, an archive index) pays for a directory walk on every read.
+// This keeps up to N handles open between reads. acquire() hands an
+// entry out exclusively and release() takes it back; a second reader
+// asking for a path that is out gets NONE and opens a handle of its own,
+// so a handle's file position is never shared.
+//
+// Whoever writes, renames or removes a file calls invalidate() so the
+// next read reopens it. Entries also expire maxAgeMs after they were
+// opened, which bounds how stale a handle can get after a write that
+// didn't go through invalidate(). Entries belong to a group (one per
+// filesystem) with its own limit, so a filesystem with a small open-file
+// budget isn't filled up by idle cached handles.
+//
+// Handle must be default-constructible and assignable, test true when
+// open and have close(). Not thread-safe; see file_handles.h for the
+// locked firmware wrapper. No Arduino dependencies (see
+// tools/bench/handle_cache_bench.cpp).
+
+struct HandleCacheStats {
+    uint32_t hits;              // Reads served by an open handle
+    uint32_t opens;             // Misses that opened a handle
+    uint32_t evictions;         // Idle handles closed to make room
+    uint32_t invalidations;     // Handles dropped by invalidate()
+    uint32_t expired;           // Handles reopened after maxAgeMs
+    uint32_t bypassed;          // Path already in use, or too long
+};
+
+template <typename Handle, size_t N>
+class HandleCache {
+public:
+    static constexpr size_t PATH_MAX_LEN = 96;
+    static constexpr int NONE = -1;
+    static constexpr int FAILED = -2;
+
+    explicit HandleCache(uint32_t maxAgeMs) : _maxAgeMs(maxAgeMs) {}
+    ~HandleCache() { closeIdle(0, true); }
+    HandleCache(const HandleCache&) = delete;
+    HandleCache& operator=(const HandleCache&) = delete;
+
+    // Entry holding `path` open, now in use. On a miss open(path) fills
+    // the least recently used idle entry of `group` (or a free one, while
+    // the group has fewer than groupLimit). Returns FAILED if that open
+    // failed, and NONE when the caller should open the file itself: the
+    // path is in use or too long, or every candidate entry is in use.
+    template <typename OpenFn>
+    int acquire(const char* path, uint8_t group, size_t groupLimit, uint32_t now, OpenFn&& open) {
+        size_t len = strlen(path);
+        if (len >= PATH_MAX_LEN) {
+            _stats.bypassed++;
+            return NONE;
+        }
+        for (size_t i = 0; i < N; i++) {
+            Entry& e = _e[i];
+            if (!e.used || e.group != group || strcmp(e.path, path) != 0) continue;
+            if (e.busy) {
+                _stats.bypassed++;
+                return NONE;
+            }
+            if (now - e.openedAt <= _maxAgeMs) {
+                e.busy = true;
+                e.lastUse = ++_tick;
+                _stats.hits++;
+                return (int)i;
+            }
+            _stats.expired++;
+            drop(e);
+            break;
+        }
+
+        int slot = victim(group, groupLimit);
+        if (slot == NONE) {
+            _stats.bypassed++;
+            return NONE;
+        }
+        Entry& e = _e[slot];
+        if (e.used) {
+            _stats.evictions++;
+            drop(e);
+        }
+        e.handle = open(path);
+        if (!e.handle) {
+            e.handle = Handle();
+            return FAILED;
+        }
+        memcpy(e.path, path, len + 1);
+        e.group = group;
+        e.openedAt = now;
+        e.lastUse = ++_tick;
+        e.used = true;
+        e.busy = true;
+        e.stale = false;
+        _stats.opens++;
+        return slot;
+    }
+
+    Handle& handle(int slot) { return _e[slot].handle; }
+
+    // Hand an entry back. keep = false closes it (after a read error).
+    void release(int slot, bool keep = true) {
+        Entry& e = _e[slot];
+        e.busy = false;
+        if (!keep || e.stale) drop(e);
+    }
+
+    // Drop entries for `path` and anything below it (a renamed or removed
+    // directory). Entries in use are closed when released.
+    void invalidate(uint8_t group, const char* path) {
+        size_t len = strlen(path);
+        while (len > 1 && path[len - 1] == '/') len--;
+        for (Entry& e : _e) {
+            if (!e.used || e.group != group || strncmp(e.path, path, len) != 0) continue;
+            if (e.path[len] != '\0' && e.path[len] != '/' && !(len == 1 && path[0] == '/')) continue;
+            _stats.invalidations++;
+            if (e.busy) {
+                e.stale = true;
+            } else {
+                drop(e);
+            }
+        }
+    }
+
+    // Close idle entries opened more than maxAgeMs ago, or every idle
+    // entry when `all`, giving their handles back to the filesystem.
+    void closeIdle(uint32_t now, bool all) {
+        for (Entry& e : _e) {
+            if (e.used && !e.busy && (all || now - e.openedAt > _maxAgeMs)) drop(e);
+        }
+    }
+
+    size_t openCount() const {
+        size_t n = 0;
+        for (const Entry& e : _e) n += e.used;
+        return n;
+    }
+
+    void getStats(HandleCacheStats& out) const { out = _stats; }
+
+private:
+    struct Entry {
+        Handle handle;
+        char path[PATH_MAX_LEN];
+        uint32_t openedAt;
+        uint32_t lastUse;
+        uint8_t group;
+        bool used = false;
+        bool busy = false;
+        bool stale = false;     // Invalidated while in use
+    };
+
+    void drop(Entry& e) {
+        e.handle.close();
+        e.handle = Handle();
+        e.used = false;
+        e.busy = false;
+        e.stale = false;
+    }
+
+    // Free entry if the group is under its limit, else its least recently
+    // used idle entry
+    int victim(uint8_t group, size_t groupLimit) {
+        size_t inGroup = 0;
+        int free = NONE, lru = NONE;
+        for (size_t i = 0; i < N; i++) {
+            const Entry& e = _e[i];
+            if (!e.used) {
+                if (free == NONE) free = (int)i;
+                continue;
+            }
+            if (e.group != group) continue;
+            inGroup++;
+            if (!e.busy && (lru == NONE || e.lastUse < _e[lru].lastUse)) lru = (int)i;
+        }
+        if (inGroup < groupLimit && free != NONE) return free;
+        return lru;
+    }
+
+    Entry _e[N];
+    uint32_t _maxAgeMs;
+    uint32_t _tick = 0;
+    HandleCacheStats _stats = {};
+};
@@ -0,0 +1,96 @@
+#include "heap_tags.h"
+
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <stdlib.h>
+
+namespace {
+
+struct Counters {
+    std::atomic<uint32_t> live{0};
+    std::atomic<uint32_t> peak{0};
+    std::atomic<uint32_t> allocs{0};
+    std::atomic<uint32_t> frees{0};
+    std::atomic<uint32_t> failures{0};
+};
+
+Counters g_counters[(size_t)HeapTag::COUNT];
+
+const char* const TAG_NAMES[(size_t)HeapTag::COUNT] = {
+    "display", "async", "audio", "http", "mesh", "storage",
+};
+
+void charge(HeapTag tag, const void* ptr) {
+    Counters& c = g_counters[(size_t)tag];
+    uint32_t size = (uint32_t)heap_caps_get_allocated_size((void*)ptr);
+    uint32_t live = c.live.fetch_add(size, std::memory_order_relaxed) + size;
+    c.allocs.fetch_add(1, std::memory_order_relaxed);
+    uint32_t peak = c.peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !c.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void release(HeapTag tag, const void* ptr) {
+    Counters& c = g_counters[(size_t)tag];
+    c.live.fetch_sub((uint32_t)heap_caps_get_allocated_size((void*)ptr), std::memory_order_relaxed);
+    c.frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* account(HeapTag tag, void* ptr) {
+    if (ptr) {
+        charge(tag, ptr);
+    } else {
+        g_counters[(size_t)tag].failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+}  // namespace
+
+const char* heapTagName(HeapTag tag) {
+    return tag < HeapTag::COUNT ? TAG_NAMES[(size_t)tag] : "?";
+}
+
+void heapTagGetStats(HeapTag tag, HeapTagStats& out) {
+    const Counters& c = g_counters[(size_t)tag];
+    out.live = c.live.load(std::memory_order_relaxed);
+    out.peak = c.peak.load(std::memory_order_relaxed);
+    out.allocs = c.allocs.load(std::memory_order_relaxed);
+    out.frees = c.frees.load(std::memory_order_relaxed);
+    out.failures = c.failures.load(std::memory_order_relaxed);
+}
+
+void* heapTagMalloc(HeapTag tag, size_t size) {
+    return account(tag, malloc(size));
+}
+
+void* heapTagPsMalloc(HeapTag tag, size_t size) {
+    void* p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p) p = malloc(size);
+    return account(tag, p);
+}
+
+void* heapTagPsCalloc(HeapTag tag, size_t n, size_t size) {
+    void* p = heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!p) p = calloc(n, size);
+    return account(tag, p);
+}
+
+void* heapTagCapsMalloc(HeapTag tag, size_t size, uint32_t caps) {
+    return account(tag, heap_caps_malloc(size, caps));
+}
+
+void heapTagFree(HeapTag tag, void* ptr) {
+    if (!ptr) return;
+    release(tag, ptr);
+    free(ptr);
+}
+
+void heapTagAdopt(HeapTag tag, const void* ptr) {
+    if (ptr) charge(tag, ptr);
+}
+
+void heapTagDisown(HeapTag tag, const void* ptr) {
+    if (ptr) release(tag, ptr);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+
+// Per-subsystem heap accounting. The free-heap/free-PSRAM totals can't say
+// whether a squeeze comes from sprites, map tiles, audio samples or HTTP
+// bodies; allocating through these wrappers with a tag keeps live bytes,
+// peak bytes and block counts per subsystem.
+//
+// Sizes come from heap_caps_get_allocated_size() on both alloc and free,
+// so there is no per-block header and a block may be freed on another
+// thread or core than the one that allocated it, as long as the tag
+// matches. The cost over a bare malloc is that lookup plus a few relaxed
+// atomic adds.
+//
+// Blocks allocated by code we don't own (a sprite's framebuffer inside
+// LovyanGFX, a JSON encoder's output) are accounted with heapTagAdopt()
+// once they exist and heapTagDisown() just before they are freed.
+
+enum class HeapTag : uint8_t {
+    DISPLAY,    // Sprites, map tiles, line and scratch buffers
+    ASYNC,      // Async I/O request and result buffers
+    AUDIO,      // Preloaded and scaled samples
+    HTTP,       // Request/response structs and bodies
+    MESH,       // Node table, message history, rebroadcast queue
+    STORAGE,    // File read and copy buffers
+    COUNT
+};
+
+struct HeapTagStats {
+    uint32_t live;      // Bytes currently held
+    uint32_t peak;      // High-water mark of live
+    uint32_t allocs;    // Blocks allocated or adopted
+    uint32_t frees;     // Blocks freed or disowned
+    uint32_t failures;  // Allocations that returned nullptr
+};
+
+const char* heapTagName(HeapTag tag);  // "display", "async", ...
+void heapTagGetStats(HeapTag tag, HeapTagStats& out);
+
+// malloc() placement (PSRAM above the SPIRAM malloc threshold)
+void* heapTagMalloc(HeapTag tag, size_t size);
+// PSRAM first, internal RAM if PSRAM is exhausted
+void* heapTagPsMalloc(HeapTag tag, size_t size);
+void* heapTagPsCalloc(HeapTag tag, size_t n, size_t size);
+// Exactly these capabilities, no fallback
+void* heapTagCapsMalloc(HeapTag tag, size_t size, uint32_t caps);
+void heapTagFree(HeapTag tag, void* ptr);
+
+void heapTagAdopt(HeapTag tag, const void* ptr);
+void heapTagDisown(HeapTag tag, const void* ptr);
+
+// STL allocator for containers whose storage should count against a tag
+template <typename T, HeapTag Tag>
+struct HeapTagAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = HeapTagAllocator<U, Tag>; };
+
+    HeapTagAllocator() = default;
+    template <typename U>
+    HeapTagAllocator(const HeapTagAllocator<U, Tag>&) {}
+
+    T* allocate(size_t n) {
+        T* p = (T*)heapTagMalloc(Tag, n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+    void deallocate(T* p, size_t) { heapTagFree(Tag, p); }
+
+    template <typename U>
+    bool operator==(const HeapTagAllocator<U, Tag>&) const { return true; }
+    template <typename U>
+    bool operator!=(const HeapTagAllocator<U, Tag>&) const { return false; }
+};
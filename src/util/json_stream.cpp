@@ -0,0 +1,490 @@
+#include "json_stream.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char* skipWs(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    return p;
+}
+
+bool hex4(const char* p, const char* end, uint32_t& out) {
+    if (end - p < 4) return false;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+        else return false;
+    }
+    out = v;
+    return true;
+}
+
+size_t utf8Encode(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// JsonReader
+// ---------------------------------------------------------------------------
+
+JsonReader::~JsonReader() {
+    free(_scratch);
+}
+
+bool JsonReader::fail(const char* at, const char* message) {
+    _error = message;
+    _errorOffset = (size_t)(at - _start);
+    return false;
+}
+
+bool JsonReader::reserveScratch(size_t n) {
+    if (n <= _scratchCap) return true;
+    size_t cap = _scratchCap ? _scratchCap * 2 : 256;
+    if (cap < n) cap = n;
+    char* p = (char*)realloc(_scratch, cap);
+    if (!p) return false;
+    _scratch = p;
+    _scratchCap = cap;
+    return true;
+}
+
+// `p` is at the opening quote; on success it is just past the closing one.
+bool JsonReader::parseString(const char*& p, const char* end, const char*& out, size_t& outLen) {
+    const char* q = p + 1;
+    const char* run = q;
+    while (q < end) {
+        unsigned char c = (unsigned char)*q;
+        if (c == '"') {
+            out = run;
+            outLen = (size_t)(q - run);
+            p = q + 1;
+            return true;
+        }
+        if (c == '\\' || c < 0x20) break;
+        q++;
+    }
+
+    // Escapes: decode into scratch, copying unescaped runs whole
+    size_t n = 0;
+    for (;;) {
+        size_t runLen = (size_t)(q - run);
+        if (!reserveScratch(n + runLen + 4)) return fail(p, "out of memory");
+        memcpy(_scratch + n, run, runLen);
+        n += runLen;
+        if (q >= end) return fail(p, "unterminated string");
+
+        unsigned char c = (unsigned char)*q;
+        if (c == '"') {
+            out = _scratch;
+            outLen = n;
+            p = q + 1;
+            return true;
+        }
+        if (c < 0x20) return fail(q, "control character in string");
+
+        // Backslash
+        if (q + 1 >= end) return fail(p, "unterminated string");
+        char e = q[1];
+        q += 2;
+        switch (e) {
+            case '"':  _scratch[n++] = '"'; break;
+            case '\\': _scratch[n++] = '\\'; break;
+            case '/':  _scratch[n++] = '/'; break;
+            case 'b':  _scratch[n++] = '\b'; break;
+            case 'f':  _scratch[n++] = '\f'; break;
+            case 'n':  _scratch[n++] = '\n'; break;
+            case 'r':  _scratch[n++] = '\r'; break;
+            case 't':  _scratch[n++] = '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (!hex4(q, end, cp)) return fail(q - 2, "invalid \\u escape");
+                q += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t lo;
+                    if (end - q >= 6 && q[0] == '\\' && q[1] == 'u' && hex4(q + 2, end, lo) &&
+                        lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        q += 6;
+                    } else {
+                        cp = 0xFFFD;  // Unpaired surrogate
+                    }
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = 0xFFFD;
+                }
+                n += utf8Encode(cp, _scratch + n);
+                break;
+            }
+            default:
+                return fail(q - 2, "invalid escape");
+        }
+
+        run = q;
+        while (q < end) {
+            unsigned char r = (unsigned char)*q;
+            if (r == '"' || r == '\\' || r < 0x20) break;
+            q++;
+        }
+    }
+}
+
+bool JsonReader::parseNumber(const char*& p, const char* end, JsonHandler& handler) {
+    const char* q = p;
+    bool neg = false;
+    if (*q == '-') {
+        neg = true;
+        q++;
+    }
+    const char* digits = q;
+    if (q < end && *q == '0') {
+        q++;
+    } else if (q < end && *q >= '1' && *q <= '9') {
+        while (q < end && isDigit(*q)) q++;
+    } else {
+        return fail(p, "invalid number");
+    }
+    size_t intDigits = (size_t)(q - digits);
+    bool isInt = true;
+    if (q < end && *q == '.') {
+        q++;
+        if (q >= end || !isDigit(*q)) return fail(p, "invalid number");
+        while (q < end && isDigit(*q)) q++;
+        isInt = false;
+    }
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        q++;
+        if (q < end && (*q == '+' || *q == '-')) q++;
+        if (q >= end || !isDigit(*q)) return fail(p, "invalid number");
+        while (q < end && isDigit(*q)) q++;
+        isInt = false;
+    }
+
+    // 19 digits always fit in uint64; beyond that it's a double.
+    if (isInt && intDigits <= 19) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < intDigits; i++) v = v * 10 + (uint64_t)(digits[i] - '0');
+        uint64_t limit = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+        if (v <= limit) {
+            int64_t r = neg ? (v == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)v) : (int64_t)v;
+            const char* at = p;
+            p = q;
+            return handler.integer(r) || fail(at, "aborted by handler");
+        }
+    }
+
+    // strtod needs a terminator the input doesn't have
+    size_t n = (size_t)(q - p);
+    char tmp[64];
+    const char* src = tmp;
+    if (n < sizeof(tmp)) {
+        memcpy(tmp, p, n);
+        tmp[n] = '\0';
+    } else {
+        if (!reserveScratch(n + 1)) return fail(p, "out of memory");
+        memcpy(_scratch, p, n);
+        _scratch[n] = '\0';
+        src = _scratch;
+    }
+    double v = strtod(src, nullptr);
+    const char* at = p;
+    p = q;
+    return handler.number(v) || fail(at, "aborted by handler");
+}
+
+bool JsonReader::parse(const char* data, size_t len, JsonHandler& h) {
+    _start = data;
+    _error = nullptr;
+    _errorOffset = 0;
+
+    const char* p = data;
+    const char* end = data + len;
+    bool isObject[MAX_DEPTH];
+    size_t depth = 0;
+    const char* s;
+    size_t slen;
+
+    // At a key's opening quote: read it and the ':' after it.
+    auto parseKey = [&]() -> bool {
+        if (p >= end || *p != '"') return fail(p, "expected string key");
+        if (!parseString(p, end, s, slen)) return false;
+        if (!h.key(s, slen)) return fail(p, "aborted by handler");
+        p = skipWs(p, end);
+        if (p >= end || *p != ':') return fail(p, "expected ':'");
+        p = skipWs(p + 1, end);
+        return true;
+    };
+
+    p = skipWs(p, end);
+    for (;;) {
+        // A value starts at p
+        if (p >= end) return fail(p, "unexpected end of input");
+        char c = *p;
+        if (c == '{' || c == '[') {
+            bool obj = c == '{';
+            if (depth == MAX_DEPTH) return fail(p, "nesting too deep");
+            if (!(obj ? h.startObject() : h.startArray())) return fail(p, "aborted by handler");
+            p = skipWs(p + 1, end);
+            if (p < end && *p == (obj ? '}' : ']')) {
+                p++;
+                if (!(obj ? h.endObject() : h.endArray())) return fail(p, "aborted by handler");
+            } else {
+                isObject[depth++] = obj;
+                if (obj && !parseKey()) return false;
+                continue;
+            }
+        } else if (c == '"') {
+            if (!parseString(p, end, s, slen)) return false;
+            if (!h.string(s, slen)) return fail(p, "aborted by handler");
+        } else if (c == '-' || isDigit(c)) {
+            if (!parseNumber(p, end, h)) return false;
+        } else if (c == 't' && end - p >= 4 && memcmp(p, "true", 4) == 0) {
+            if (!h.boolean(true)) return fail(p, "aborted by handler");
+            p += 4;
+        } else if (c == 'f' && end - p >= 5 && memcmp(p, "false", 5) == 0) {
+            if (!h.boolean(false)) return fail(p, "aborted by handler");
+            p += 5;
+        } else if (c == 'n' && end - p >= 4 && memcmp(p, "null", 4) == 0) {
+            if (!h.null()) return fail(p, "aborted by handler");
+            p += 4;
+        } else {
+            return fail(p, "unexpected character");
+        }
+
+        // A value just ended: close containers until one wants more
+        for (;;) {
+            p = skipWs(p, end);
+            if (depth == 0) {
+                if (p != end) return fail(p, "trailing characters");
+                return true;
+            }
+            if (p >= end) return fail(p, "unexpected end of input");
+            bool obj = isObject[depth - 1];
+            if (*p == ',') {
+                p = skipWs(p + 1, end);
+                if (obj && !parseKey()) return false;
+                break;
+            }
+            if (*p != (obj ? '}' : ']')) {
+                return fail(p, obj ? "expected ',' or '}'" : "expected ',' or ']'");
+            }
+            p++;
+            depth--;
+            if (!(obj ? h.endObject() : h.endArray())) return fail(p, "aborted by handler");
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// JsonWriter
+// ---------------------------------------------------------------------------
+
+JsonWriter::JsonWriter(char* buf, size_t cap, Sink sink, void* ctx)
+    : _buf(buf), _cap(cap), _sink(sink), _ctx(ctx) {}
+
+void JsonWriter::flush() {
+    if (_len == 0) return;
+    if (!_failed && !_sink(_ctx, _buf, _len)) _failed = true;
+    _total += _len;
+    _len = 0;
+}
+
+void JsonWriter::put(char c) {
+    if (_len == _cap) flush();
+    _buf[_len++] = c;
+}
+
+void JsonWriter::write(const char* s, size_t len) {
+    while (len > 0) {
+        if (_len == _cap) flush();
+        size_t n = _cap - _len;
+        if (n > len) n = len;
+        memcpy(_buf + _len, s, n);
+        _len += n;
+        s += n;
+        len -= n;
+    }
+}
+
+void JsonWriter::writeEscaped(const char* s, size_t len) {
+    put('"');
+    const char* end = s + len;
+    while (s < end) {
+        const char* run = s;
+        while (s < end) {
+            unsigned char c = (unsigned char)*s;
+            if (c < 0x20 || c == '"' || c == '\\') break;
+            s++;
+        }
+        if (s > run) write(run, (size_t)(s - run));
+        if (s >= end) break;
+
+        unsigned char c = (unsigned char)*s++;
+        char esc[7] = {'\\', 0};
+        size_t n = 2;
+        switch (c) {
+            case '"':  esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            default: {
+                static const char hex[] = "0123456789abcdef";
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xF];
+                n = 6;
+                break;
+            }
+        }
+        write(esc, n);
+    }
+    put('"');
+}
+
+void JsonWriter::beforeValue() {
+    if (_afterKey) {
+        _afterKey = false;
+        return;
+    }
+    if (_depth == 0) return;
+    uint8_t bit = (uint8_t)(1u << (_depth % 8));
+    uint8_t& slot = _hasElem[_depth / 8];
+    if (slot & bit) put(',');
+    else slot |= bit;
+}
+
+void JsonWriter::beginObject() {
+    beforeValue();
+    if (_depth == MAX_DEPTH) {
+        _failed = true;
+        return;
+    }
+    put('{');
+    _depth++;
+    _hasElem[_depth / 8] &= (uint8_t)~(1u << (_depth % 8));
+}
+
+void JsonWriter::endObject() {
+    if (_depth == 0 || _afterKey) {
+        _failed = true;
+        return;
+    }
+    _depth--;
+    put('}');
+}
+
+void JsonWriter::beginArray() {
+    beforeValue();
+    if (_depth == MAX_DEPTH) {
+        _failed = true;
+        return;
+    }
+    put('[');
+    _depth++;
+    _hasElem[_depth / 8] &= (uint8_t)~(1u << (_depth % 8));
+}
+
+void JsonWriter::endArray() {
+    if (_depth == 0 || _afterKey) {
+        _failed = true;
+        return;
+    }
+    _depth--;
+    put(']');
+}
+
+void JsonWriter::key(const char* s, size_t len) {
+    beforeValue();
+    writeEscaped(s, len);
+    put(':');
+    _afterKey = true;
+}
+
+void JsonWriter::string(const char* s, size_t len) {
+    beforeValue();
+    writeEscaped(s, len);
+}
+
+void JsonWriter::integer(int64_t value) {
+    beforeValue();
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    uint64_t v = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) *--p = '-';
+    write(p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+void JsonWriter::number(double value) {
+    beforeValue();
+    if (!isfinite(value)) {
+        write("null", 4);
+        return;
+    }
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.14g", value);
+    if (n <= 0 || n >= (int)sizeof(tmp)) {
+        write("null", 4);
+        return;
+    }
+    // Keep floats floats on the way back in: "3" would decode as integer
+    if (strspn(tmp, "-0123456789") == (size_t)n) {
+        tmp[n++] = '.';
+        tmp[n++] = '0';
+    }
+    write(tmp, (size_t)n);
+}
+
+void JsonWriter::boolean(bool value) {
+    beforeValue();
+    if (value) write("true", 4);
+    else write("false", 5);
+}
+
+void JsonWriter::null() {
+    beforeValue();
+    write("null", 4);
+}
+
+bool JsonWriter::finish() {
+    if (_depth != 0 || _afterKey) _failed = true;
+    flush();
+    return !_failed;
+}
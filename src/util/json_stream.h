@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming (SAX-style) JSON reader and writer.
+//
+// JsonReader walks a complete document in memory and reports each token to
+// a JsonHandler as it is found; nothing is built in between, so decoding
+// into Lua tables is one pass with no intermediate document and no size
+// cap beyond the input buffer itself. Nesting is tracked on an explicit
+// stack rather than by recursion, which keeps the 10 KB loop task stack
+// safe from deeply nested input. Strings without escapes are handed to the
+// handler as pointers into the input; escaped ones are decoded into a
+// scratch block that grows as needed.
+//
+// JsonWriter produces JSON into a caller-provided block and hands it to a
+// sink whenever the block fills, so encoding a large table into a file
+// needs one chunk of memory rather than the whole output.
+//
+// No Arduino dependencies (see tools/bench/json_stream_bench.cpp).
+
+// Token callbacks. Returning false stops the parse; JsonReader::parse()
+// then fails with "aborted by handler".
+class JsonHandler {
+public:
+    virtual ~JsonHandler() = default;
+    virtual bool null() = 0;
+    virtual bool boolean(bool value) = 0;
+    // Integers that fit in 64 bits; anything with a fraction, exponent or
+    // more digits arrives as number().
+    virtual bool integer(int64_t value) = 0;
+    virtual bool number(double value) = 0;
+    // Neither is NUL-terminated; valid until the callback returns.
+    virtual bool string(const char* s, size_t len) = 0;
+    virtual bool key(const char* s, size_t len) = 0;
+    virtual bool startObject() = 0;
+    virtual bool endObject() = 0;
+    virtual bool startArray() = 0;
+    virtual bool endArray() = 0;
+};
+
+class JsonReader {
+public:
+    static constexpr size_t MAX_DEPTH = 128;
+
+    JsonReader() = default;
+    ~JsonReader();
+    JsonReader(const JsonReader&) = delete;
+    JsonReader& operator=(const JsonReader&) = delete;
+
+    // Parse one JSON value (surrounding whitespace allowed) from
+    // data[0..len). Returns false on malformed input, excess nesting,
+    // out-of-memory or a handler abort; error() and errorOffset() say why
+    // and where. The handler may have seen a prefix of the tokens.
+    bool parse(const char* data, size_t len, JsonHandler& handler);
+
+    const char* error() const { return _error; }
+    size_t errorOffset() const { return _errorOffset; }
+
+private:
+    bool fail(const char* at, const char* message);
+    bool parseString(const char*& p, const char* end, const char*& out, size_t& outLen);
+    bool parseNumber(const char*& p, const char* end, JsonHandler& handler);
+    bool reserveScratch(size_t n);
+
+    const char* _start = nullptr;
+    const char* _error = nullptr;
+    size_t _errorOffset = 0;
+    char* _scratch = nullptr;
+    size_t _scratchCap = 0;
+};
+
+class JsonWriter {
+public:
+    static constexpr size_t MAX_DEPTH = 128;
+
+    // Receives each filled chunk; return false to stop (write error).
+    typedef bool (*Sink)(void* ctx, const char* data, size_t len);
+
+    // `buf` (cap >= 64) is the chunk buffer; output reaches `sink` in
+    // pieces of at most `cap` bytes.
+    JsonWriter(char* buf, size_t cap, Sink sink, void* ctx);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char* s, size_t len);
+    void string(const char* s, size_t len);
+    void integer(int64_t value);
+    // Written with 14 significant digits (Lua's own %.14g); NaN and
+    // infinities become null.
+    void number(double value);
+    void boolean(bool value);
+    void null();
+
+    // Flush what is buffered. False if the sink failed, nesting overflowed
+    // or containers are still open.
+    bool finish();
+
+    bool ok() const { return !_failed; }
+    size_t bytesWritten() const { return _total + _len; }
+    size_t depth() const { return _depth; }
+
+private:
+    void beforeValue();
+    void put(char c);
+    void write(const char* s, size_t len);
+    void writeEscaped(const char* s, size_t len);
+    void flush();
+
+    char* _buf;
+    size_t _cap;
+    size_t _len = 0;
+    size_t _total = 0;
+    Sink _sink;
+    void* _ctx;
+    size_t _depth = 0;
+    bool _afterKey = false;
+    bool _failed = false;
+    // Bit per level: that container already holds an element
+    uint8_t _hasElem[MAX_DEPTH / 8 + 1] = {};
+};
@@ -0,0 +1,53 @@
+#include "latency_histogram.h"
+
+#include <string.h>
+
+void LatencyHistogram::clear() {
+    memset(_counts, 0, sizeof(_counts));
+    _count = 0;
+    _max = 0;
+    _sum = 0;
+}
+
+int LatencyHistogram::bucketOf(uint32_t value) {
+    if (value < SUB_COUNT) return (int)value;
+    int msb = 31 - __builtin_clz(value);
+    if (msb > MAX_MSB) return BUCKETS - 1;
+    int shift = msb - SUB_BITS;
+    // (value >> shift) is in [SUB_COUNT, 2 * SUB_COUNT)
+    return (shift + 1) * (int)SUB_COUNT + (int)((value >> shift) - SUB_COUNT);
+}
+
+uint32_t LatencyHistogram::bucketHigh(int bucket) {
+    if (bucket < (int)SUB_COUNT) return (uint32_t)bucket;
+    if (bucket >= BUCKETS - 1) return UINT32_MAX;
+    int shift = bucket / (int)SUB_COUNT - 1;
+    uint32_t sub = SUB_COUNT + (uint32_t)(bucket % (int)SUB_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+uint32_t LatencyHistogram::percentile(const LatencyHistogram* const* hists, size_t n, float q) {
+    uint32_t total = 0;
+    uint32_t max = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += hists[i]->_count;
+        if (hists[i]->_max > max) max = hists[i]->_max;
+    }
+    if (total == 0) return 0;
+    if (q <= 0.0f) q = 0.0f;
+    if (q >= 1.0f) return max;
+
+    // Rank of the sample we want, 1-based
+    uint32_t rank = (uint32_t)(q * (float)total) + 1;
+    if (rank > total) rank = total;
+
+    uint32_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        for (size_t i = 0; i < n; i++) seen += hists[i]->_counts[b];
+        if (seen >= rank) {
+            uint32_t high = bucketHigh(b);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size log-linear histogram of durations, in the style of
+// HdrHistogram: values below 8 get a bucket each, above that every power
+// of two is split into 8 equal sub-buckets, so a reported percentile is
+// within 12.5% of the true value. Values up to 2^24 (16.7 s in
+// microseconds) are resolved; larger ones land in the last bucket. The
+// exact maximum and sum are kept alongside.
+//
+// record() is a few shifts and an increment -- no allocation, no
+// floating point -- so it can sit on a per-frame path. Counts are 16-bit:
+// clear() well before 65535 samples (a rolling window does).
+//
+// No Arduino dependencies.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr uint32_t SUB_COUNT = 1u << SUB_BITS;
+    static constexpr int MAX_MSB = 23;
+    static constexpr int BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB_COUNT;
+
+    void record(uint32_t value) {
+        int b = bucketOf(value);
+        if (_counts[b] != 0xFFFF) _counts[b]++;
+        _count++;
+        _sum += value;
+        if (value > _max) _max = value;
+    }
+
+    void clear();
+
+    uint32_t count() const { return _count; }
+    uint32_t max() const { return _max; }
+    uint64_t sum() const { return _sum; }
+    uint16_t bucketCount(int bucket) const { return _counts[bucket]; }
+
+    // Bucket index for `value`, and the largest value that bucket holds.
+    static int bucketOf(uint32_t value);
+    static uint32_t bucketHigh(int bucket);
+
+    // Value at quantile `q` (0..1) over the union of `n` histograms, as the
+    // upper edge of the bucket it falls in, capped at the observed max.
+    // Lets a rolling window report over its current and previous halves
+    // without merging them. 0 when empty.
+    static uint32_t percentile(const LatencyHistogram* const* hists, size_t n, float q);
+
+private:
+    uint16_t _counts[BUCKETS] = {};
+    uint32_t _count = 0;
+    uint32_t _max = 0;
+    uint64_t _sum = 0;
+};
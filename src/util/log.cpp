@@ -1,7 +1,11 @@
 #include "log.h"
 
+#include <atomic>
+#include <esp_heap_caps.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <soc/soc_memory_layout.h>
 #include <string.h>
 #include <stdio.h>
 #include <LittleFS.h>
@@ -22,8 +26,30 @@ size_t   g_count = 0;   // bytes currently stored, capped at LOG_BUF_SIZE
 // rate, so no overflow handling needed.
 uint64_t g_total   = 0;  // every byte ever appended
 uint64_t g_drained = 0;  // bytes already returned by drain()
+uint64_t g_printed = 0;  // bytes already written to Serial
 SemaphoreHandle_t g_mutex = nullptr;
 
+// Binary records waiting to be formatted. 32 KiB in PSRAM holds well
+// over a second of the busiest boot logging; allocated on the first
+// LOG() so records from static constructors aren't lost.
+constexpr size_t RING_SIZE = 32 * 1024;
+constexpr size_t RING_FALLBACK_SIZE = 4 * 1024;   // Internal RAM, no PSRAM
+
+enum : uint8_t { RING_NONE, RING_INIT, RING_READY };
+
+LogRing g_ring;
+std::atomic<uint8_t> g_ringState{RING_NONE};
+std::atomic<uint32_t> g_dropped{0};
+uint32_t g_pumpCursor = 0;   // Next binary record to format (under g_mutex)
+uint32_t g_lostBytes = 0;
+
+// Printer task: formatting and Serial writes happen here, off the
+// logging path. PSRAM stack, so it must not touch flash.
+constexpr uint32_t PRINTER_STACK_SIZE = 6 * 1024;
+constexpr uint32_t PRINTER_IDLE_MS = 10;
+TaskHandle_t g_printer = nullptr;
+SemaphoreHandle_t g_serialMutex = nullptr;   // Serial output, see log_serial_lock()
+
 void ensure_init() {
     if (!g_mutex) {
         g_mutex = xSemaphoreCreateMutex();
@@ -52,78 +78,224 @@ void append_raw(const char* data, size_t n) {
     g_total += n;
 }
 
+bool ensure_ring() {
+    uint8_t state = g_ringState.load(std::memory_order_acquire);
+    if (state == RING_READY) return true;
+    // One caller allocates; anyone logging meanwhile drops the record
+    if (state != RING_NONE ||
+        !g_ringState.compare_exchange_strong(state, RING_INIT, std::memory_order_acquire)) {
+        return false;
+    }
+    size_t size = RING_SIZE;
+    uint8_t* mem = (uint8_t*)heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) {
+        size = RING_FALLBACK_SIZE;
+        mem = (uint8_t*)heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (!mem) {
+        g_ringState.store(RING_NONE, std::memory_order_release);
+        return false;
+    }
+    g_ring.init(mem, size);
+    g_ringState.store(RING_READY, std::memory_order_release);
+    return true;
+}
+
+// A torn record (a writer stalled for a whole lap) could carry any
+// pointer; only format ones that point at readable memory.
+bool fmt_readable(const char* fmt) {
+    return fmt && (esp_ptr_in_drom(fmt) || esp_ptr_byte_accessible(fmt));
+}
+
+// Format every new binary record into the text ring. Caller holds the
+// mutex; the buffers are static so the loop task's stack doesn't pay.
+void pump_locked() {
+    if (g_ringState.load(std::memory_order_acquire) != RING_READY) return;
+    static uint8_t rec[LOG_MAX_RECORD];
+    static char line[256];
+    size_t len;
+    while ((len = g_ring.read(g_pumpCursor, rec, g_lostBytes)) != 0) {
+        const LogRecordHeader* h = (const LogRecordHeader*)rec;
+        if (!fmt_readable(h->fmt)) continue;
+        size_t n = logFormat(rec, len, line, sizeof(line) - 1);
+        line[n++] = '\n';
+        append_raw(line, n);
+    }
+}
+
+// Copy text-ring bytes past `cursor` into `out`, advancing it. If the
+// ring overwrote some of them, skip ahead to the oldest byte left.
+// Caller holds the mutex.
+size_t copy_since_locked(uint64_t& cursor, char* out, size_t cap) {
+    // Bytes the producer has written that we haven't yet emitted.
+    uint64_t pending = g_total - cursor;
+    if (pending == 0) return 0;
+    // Bytes still actually present in the ring. If the producer
+    // wrote faster than we've been draining and bytes have
+    // already rolled out the back, fast-forward the cursor to
+    // the oldest still-present byte -- we accept losing the gap
+    // rather than re-emitting older data.
+    uint64_t available = (uint64_t)g_count;
+    if (pending > available) {
+        cursor  = g_total - available;
+        pending = available;
+    }
+
+    size_t n = (pending < (uint64_t)cap) ? (size_t)pending : cap;
+    // Ring layout: g_count valid bytes ending at g_head. The
+    // first byte of valid data sits at (g_head - g_count) mod
+    // LOG_BUF_SIZE; we want to start `skip` bytes into that
+    // window where skip = cursor bytes already past the oldest
+    // available byte.
+    size_t skip = (size_t)(cursor - (g_total - g_count));
+    size_t tail_start =
+        (g_head + LOG_BUF_SIZE - g_count + skip) % LOG_BUF_SIZE;
+    size_t first = LOG_BUF_SIZE - tail_start;
+    if (n <= first) {
+        memcpy(out, g_buf + tail_start, n);
+    } else {
+        memcpy(out, g_buf + tail_start, first);
+        memcpy(out + first, g_buf, n - first);
+    }
+    cursor += n;
+    return n;
+}
+
+void printer_task(void*) {
+    static char chunk[1024];
+    bool lineStart = true;
+    for (;;) {
+        size_t n = 0;
+        if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+            pump_locked();
+            n = copy_since_locked(g_printed, chunk, sizeof(chunk));
+            xSemaphoreGive(g_mutex);
+        }
+        if (n == 0) {
+            vTaskDelay(pdMS_TO_TICKS(PRINTER_IDLE_MS));
+            continue;
+        }
+        // Serial writes happen outside the mutex so a slow or absent
+        // USB host never holds up drain or /logs
+        LogSerialGuard serial;
+        const char* p = chunk;
+        const char* end = chunk + n;
+        while (p < end) {
+            if (lineStart) Serial.write("#LOG#", 5);
+            const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+            const char* stop = nl ? nl + 1 : end;
+            Serial.write((const uint8_t*)p, (size_t)(stop - p));
+            lineStart = nl != nullptr;
+            p = stop;
+        }
+    }
+}
+
 } // namespace
 
-void log_buffer_appendf(const char* prefix, const char* fmt, ...) {
+void log_init() {
     ensure_init();
+    ensure_ring();
+    if (g_printer || !g_mutex) return;
+    g_serialMutex = xSemaphoreCreateMutex();
+    // Only the TCB takes internal RAM; the stack goes to PSRAM
+    StaticTask_t* tcb = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t),
+                                                        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    StackType_t* stack = (StackType_t*)heap_caps_malloc(PRINTER_STACK_SIZE,
+                                                        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (tcb && stack) {
+        g_printer = xTaskCreateStaticPinnedToCore(printer_task, "log_printer", PRINTER_STACK_SIZE,
+                                                  nullptr, 1, stack, tcb, 0);
+    }
+    if (!g_printer) {
+        heap_caps_free(tcb);
+        heap_caps_free(stack);
+        Serial.println("[Log] Failed to start printer task");
+    }
+}
 
-    char line[256];
-    int  hlen = prefix ? snprintf(line, sizeof(line), "%s", prefix) : 0;
-    if (hlen < 0) hlen = 0;
-    if ((size_t)hlen >= sizeof(line) - 1) hlen = sizeof(line) - 1;
-
-    va_list args;
-    va_start(args, fmt);
-    int blen = vsnprintf(line + hlen, sizeof(line) - hlen - 1, fmt, args);
-    va_end(args);
-    if (blen < 0) blen = 0;
+void log_serial_lock() {
+    if (g_serialMutex) xSemaphoreTake(g_serialMutex, portMAX_DELAY);
+}
 
-    size_t total = hlen + blen;
-    if (total >= sizeof(line) - 1) total = sizeof(line) - 1;
-    line[total] = '\n';
-    total += 1;
+void log_serial_unlock() {
+    if (g_serialMutex) xSemaphoreGive(g_serialMutex);
+}
 
-    if (g_mutex && xSemaphoreTake(g_mutex, pdMS_TO_TICKS(20)) == pdTRUE) {
-        append_raw(line, total);
-        xSemaphoreGive(g_mutex);
+void log_commit(const uint8_t* rec, size_t len) {
+    if (ensure_ring()) {
+        g_ring.write(rec, len);
     } else {
-        // Best-effort write without the lock. Two concurrent appends
-        // can interleave bytes, but losing log fidelity under
-        // contention is preferable to dropping the line entirely.
-        append_raw(line, total);
+        g_dropped.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
+void log_get_stats(LogStats& out) {
+    memset(&out, 0, sizeof(out));
+    out.dropped = g_dropped.load(std::memory_order_relaxed);
+    if (g_ringState.load(std::memory_order_acquire) != RING_READY) return;
+    LogRing::Stats st = g_ring.stats();
+    out.records = st.written;
+    out.bytes = st.bytes;
+    // Read without the mutex: a stats snapshot can be a record stale
+    out.lostBytes = g_lostBytes;
+    out.pending = st.bytes - g_pumpCursor;
+}
+
+size_t log_dump_binary(uint8_t* out, size_t cap) {
+    static const uint8_t MAGIC[] = {'E', 'Z', 'L', 'G', 1};
+    if (cap < sizeof(MAGIC)) return 0;
+    memcpy(out, MAGIC, sizeof(MAGIC));
+    size_t n = sizeof(MAGIC);
+    if (g_ringState.load(std::memory_order_acquire) != RING_READY) return n;
+
+    // Formats already sent. Call sites number in the low hundreds, so a
+    // linear scan is fine; past the table, formats are just resent.
+    constexpr size_t MAX_SEEN = 256;
+    const char** seen = (const char**)heap_caps_malloc(MAX_SEEN * sizeof(const char*),
+                                                        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    size_t seenCount = 0;
+    uint8_t rec[LOG_MAX_RECORD];
+    uint32_t cursor = g_ring.oldest();
+    uint32_t lost = 0;
+    // Stop at the head as it was when we started, not one that keeps
+    // moving under us
+    uint32_t stop = g_ring.head();
+    size_t len;
+    while ((int32_t)(cursor - stop) < 0 && (len = g_ring.read(cursor, rec, lost)) != 0) {
+        const char* fmt = ((const LogRecordHeader*)rec)->fmt;
+        if (!fmt_readable(fmt)) continue;
+        bool known = false;
+        for (size_t i = 0; i < seenCount && !known; i++) known = seen[i] == fmt;
+        if (!known) {
+            size_t flen = strnlen(fmt, 0xFFFF);
+            if (n + 7 + flen + 1 + len > cap) break;
+            uint32_t ptr = (uint32_t)(uintptr_t)fmt;
+            uint16_t len16 = (uint16_t)flen;
+            out[n++] = 'F';
+            memcpy(out + n, &ptr, 4);
+            memcpy(out + n + 4, &len16, 2);
+            memcpy(out + n + 6, fmt, flen);
+            n += 6 + flen;
+            if (seen && seenCount < MAX_SEEN) seen[seenCount++] = fmt;
+        }
+        if (n + 1 + len > cap) break;
+        out[n++] = 'R';
+        memcpy(out + n, rec, len);
+        n += len;
+    }
+    heap_caps_free(seen);
+    return n;
+}
+
 size_t log_buffer_drain(char* out, size_t cap) {
     ensure_init();
     if (cap == 0) return 0;
 
     size_t n = 0;
     if (g_mutex && xSemaphoreTake(g_mutex, pdMS_TO_TICKS(50)) == pdTRUE) {
-        // Bytes the producer has written that we haven't yet emitted.
-        uint64_t pending = g_total - g_drained;
-        if (pending == 0) {
-            xSemaphoreGive(g_mutex);
-            return 0;
-        }
-        // Bytes still actually present in the ring. If the producer
-        // wrote faster than we've been draining and bytes have
-        // already rolled out the back, fast-forward the cursor to
-        // the oldest still-present byte -- we accept losing the gap
-        // rather than re-emitting older data.
-        uint64_t available = (uint64_t)g_count;
-        if (pending > available) {
-            g_drained = g_total - available;
-            pending   = available;
-        }
-
-        n = (pending < (uint64_t)cap) ? (size_t)pending : cap;
-        // Ring layout: g_count valid bytes ending at g_head. The
-        // first byte of valid data sits at (g_head - g_count) mod
-        // LOG_BUF_SIZE; we want to start `skip` bytes into that
-        // window where skip = drained-bytes already past the oldest
-        // available byte.
-        size_t skip = (size_t)(g_drained - (g_total - g_count));
-        size_t tail_start =
-            (g_head + LOG_BUF_SIZE - g_count + skip) % LOG_BUF_SIZE;
-        size_t first = LOG_BUF_SIZE - tail_start;
-        if (n <= first) {
-            memcpy(out, g_buf + tail_start, n);
-        } else {
-            memcpy(out, g_buf + tail_start, first);
-            memcpy(out + first, g_buf, n - first);
-        }
-        g_drained += n;
+        pump_locked();
+        n = copy_since_locked(g_drained, out, cap);
         xSemaphoreGive(g_mutex);
     }
     return n;
@@ -135,6 +307,7 @@ size_t log_buffer_snapshot(char* out, size_t cap) {
 
     size_t n = 0;
     if (g_mutex && xSemaphoreTake(g_mutex, pdMS_TO_TICKS(50)) == pdTRUE) {
+        pump_locked();
         n = g_count < cap ? g_count : cap;
         // Skip past anything we'll truncate. The "older entries" we
         // drop here come from the start of the ring -- we still want
@@ -169,12 +342,13 @@ void log_panic_flush(const char* reason) {
     static char buf[LOG_BUF_SIZE];
     size_t n = 0;
 
-    // Use a short timeout; if the producer task is wedged we give
+    // Use a short timeout; if the printer task is wedged we give
     // up rather than hanging the shutdown. The mutex is only held
-    // for low-microsecond memcpys in normal operation, so any
-    // failure to acquire here is a strong signal we're in deep
-    // trouble.
+    // while formatting what's queued in the binary ring (a few ms at
+    // worst), so any failure to acquire here is a strong signal
+    // we're in deep trouble.
     if (g_mutex && xSemaphoreTake(g_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        pump_locked();
         n = g_count;
         size_t tail_start = (g_head + LOG_BUF_SIZE - g_count) % LOG_BUF_SIZE;
         size_t first = LOG_BUF_SIZE - tail_start;
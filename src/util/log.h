@@ -1,9 +1,11 @@
 #pragma once
 
 #include <Arduino.h>
-#include <stdarg.h>
+#include <esp_timer.h>
 #include <stddef.h>
 
+#include "log_ring.h"
+
 // Log prefix that remote control can filter out
 // All log messages should start with this prefix followed by tag and message
 // Format: #LOG#[Tag] message
@@ -14,11 +16,58 @@
 #define LOG_ENABLED 1
 #endif
 
-// Append a formatted line to the in-memory ring buffer that backs the
-// dev-server /logs endpoint. Always called with the printf-style args
-// alongside Serial.printf so the on-device buffer mirrors what shows up
-// on the USB console.
-void log_buffer_appendf(const char* prefix, const char* fmt, ...);
+// LOG() doesn't format anything. It records the format string pointer,
+// a timestamp, level, core and the raw arguments into a lock-free binary
+// ring (see log_ring.h) and returns; string arguments are copied, so
+// passing a temporary buffer is fine. The log printer task started by
+// log_init() formats records into the text ring behind /logs and
+// drain_logs, and writes them to Serial with the #LOG# prefix. The raw
+// records are also served from /logs.bin for tools/dev/log_decode.py.
+//
+// Because nothing formats on the caller, the format string must be a
+// literal (the LOG macros only accept one), and %s arguments are cut at
+// LOG_MAX_STRING bytes.
+
+// Start the printer task. Call once after Serial.begin(); records
+// logged before that are kept in the ring and printed when it starts.
+void log_init();
+
+// Copy one encoded record into the ring. Lock-free; LOG() calls this.
+void log_commit(const uint8_t* rec, size_t len);
+
+// Hold off the printer task while writing something to Serial that a
+// #LOG# line must not land in the middle of (remote-control responses).
+void log_serial_lock();
+void log_serial_unlock();
+
+class LogSerialGuard {
+public:
+    LogSerialGuard() { log_serial_lock(); }
+    ~LogSerialGuard() { log_serial_unlock(); }
+    LogSerialGuard(const LogSerialGuard&) = delete;
+    LogSerialGuard& operator=(const LogSerialGuard&) = delete;
+};
+
+template <typename... Args>
+inline void log_write(uint8_t level, const char* fmt, Args... args) {
+    alignas(8) uint8_t rec[LOG_MAX_RECORD];
+    size_t len = logEncode(rec, level, (uint8_t)xPortGetCoreID(),
+                           (uint32_t)esp_timer_get_time(), fmt, args...);
+    log_commit(rec, len);
+}
+
+// Never called; lets the compiler check LOG() arguments against the
+// format string the way it did when LOG() was a Serial.printf.
+inline void __attribute__((format(printf, 1, 2))) log_check_format(const char*, ...) {}
+
+struct LogStats {
+    uint32_t records;       // Records written to the binary ring
+    uint32_t bytes;         // Binary bytes written
+    uint32_t lostBytes;     // Overwritten before the printer formatted them
+    uint32_t dropped;       // Logged before the ring could be allocated
+    uint32_t pending;       // Binary bytes not formatted yet
+};
+void log_get_stats(LogStats& out);
 
 // Copy the current buffer into `out` (newest entries last). Returns the
 // number of bytes written; never exceeds `cap`. Lives behind a mutex so
@@ -35,6 +84,13 @@ size_t log_buffer_snapshot(char* out, size_t cap);
 // cursor jumps forward to the oldest still-available byte.
 size_t log_buffer_drain(char* out, size_t cap);
 
+// Dump every record still in the binary ring, unformatted, for the
+// host-side decoder. Layout: "EZLG", a version byte, then entries:
+//   'F' u32 fmt_ptr, u16 len, len bytes   (first use of each format)
+//   'R' record bytes                      (LogRecordHeader.len long)
+// all little-endian. Returns bytes written; stops early at `cap`.
+size_t log_dump_binary(uint8_t* out, size_t cap);
+
 // Best-effort flush of the entire ring buffer to /fs/logs/system.log
 // from C++. Designed for the panic path: the Lua flusher runs every
 // FLUSH_INTERVAL_MS, leaving up to ~1 s of bytes in RAM when a
@@ -51,33 +107,16 @@ size_t log_buffer_drain(char* out, size_t cap);
 void log_panic_flush(const char* reason);
 
 #if LOG_ENABLED
-    // Tee every LOG call to both Serial and the ring buffer. The
-    // do/while wrapping keeps the macro safe in `if` statements.
-    //
-    // The log_buffer_appendf path is gated on LOG_TO_BUFFER so we
-    // can flip the in-memory tee off when investigating tasks that
-    // can't tolerate the per-call mutex (e.g. the OTA upload-handler
-    // hot loop). Default-on so /logs continues to work for normal
-    // diagnostics.
-    #ifndef LOG_TO_BUFFER
-    #define LOG_TO_BUFFER 1
-    #endif
-    #if LOG_TO_BUFFER
-        #define LOG(tag, fmt, ...) do {                               \
-            Serial.printf("#LOG#[" tag "] " fmt "\n", ##__VA_ARGS__); \
-            log_buffer_appendf("[" tag "] ", fmt, ##__VA_ARGS__);     \
-        } while (0)
-        #define LOG_RAW(fmt, ...) do {                                \
-            Serial.printf("#LOG#" fmt "\n", ##__VA_ARGS__);           \
-            log_buffer_appendf("", fmt, ##__VA_ARGS__);               \
+    // The do/while wrapping keeps the macros safe in `if` statements.
+    #define LOG_AT(level, fmt, ...) do {                              \
+            if (0) log_check_format(fmt, ##__VA_ARGS__);              \
+            log_write(level, fmt, ##__VA_ARGS__);                     \
         } while (0)
-    #else
-        #define LOG(tag, fmt, ...) \
-            Serial.printf("#LOG#[" tag "] " fmt "\n", ##__VA_ARGS__)
-        #define LOG_RAW(fmt, ...) \
-            Serial.printf("#LOG#" fmt "\n", ##__VA_ARGS__)
-    #endif
 #else
-    #define LOG(tag, fmt, ...) ((void)0)
-    #define LOG_RAW(fmt, ...) ((void)0)
+    #define LOG_AT(level, fmt, ...) ((void)0)
 #endif
+
+#define LOG(tag, fmt, ...)       LOG_AT(LOG_LEVEL_INFO, "[" tag "] " fmt, ##__VA_ARGS__)
+#define LOG_WARN(tag, fmt, ...)  LOG_AT(LOG_LEVEL_WARN, "[" tag "] " fmt, ##__VA_ARGS__)
+#define LOG_ERROR(tag, fmt, ...) LOG_AT(LOG_LEVEL_ERROR, "[" tag "] " fmt, ##__VA_ARGS__)
+#define LOG_RAW(fmt, ...)        LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
@@ -0,0 +1,261 @@
+#include "log_ring.h"
+
+#include <stdio.h>
+
+namespace {
+
+// Commit word for a record starting at `pos`. Positions are 8-aligned,
+// so the low bit tells a committed header from zeroed memory at 0.
+inline uint32_t commitFor(uint32_t pos) { return pos | 1; }
+
+struct ArgReader {
+    const uint8_t* p;
+    const uint8_t* end;
+
+    // Next argument, or false when there are none left (or it's torn)
+    bool next(uint8_t& tag, const uint8_t*& data, size_t& n) {
+        if (p >= end || *p == LOG_ARG_END) return false;
+        tag = *p++;
+        switch (tag) {
+            case LOG_ARG_I32:
+            case LOG_ARG_PTR: n = 4; break;
+            case LOG_ARG_I64:
+            case LOG_ARG_F64: n = 8; break;
+            case LOG_ARG_STR:
+                if (p >= end) return false;
+                n = *p++;
+                break;
+            default: return false;
+        }
+        if ((size_t)(end - p) < n) return false;
+        data = p;
+        p += n;
+        return true;
+    }
+};
+
+uint32_t u32At(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t u64At(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+}  // namespace
+
+size_t logFormat(const uint8_t* rec, size_t len, char* out, size_t cap) {
+    if (cap == 0) return 0;
+    size_t n = 0;
+    auto emit = [&](const char* s, size_t k) {
+        if (k > cap - 1 - n) k = cap - 1 - n;
+        memcpy(out + n, s, k);
+        n += k;
+    };
+
+    const LogRecordHeader* h = (const LogRecordHeader*)rec;
+    ArgReader args = {rec + sizeof(LogRecordHeader), rec + len};
+    const char* f = h->fmt;
+
+    while (*f && n < cap - 1) {
+        if (*f != '%') {
+            const char* lit = f;
+            while (*f && *f != '%') f++;
+            emit(lit, (size_t)(f - lit));
+            continue;
+        }
+        if (f[1] == '%') {
+            emit("%", 1);
+            f += 2;
+            continue;
+        }
+
+        // Rebuild the conversion with our own length modifier: the
+        // recorded tag says how wide the value really is.
+        char spec[24];
+        size_t sl = 0;
+        int stars[2];
+        int starCount = 0;
+        spec[sl++] = *f++;
+        while (*f && strchr("-+ #0", *f) && sl < 8) spec[sl++] = *f++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*f != '.') break;
+                spec[sl++] = *f++;
+            }
+            if (*f == '*') {
+                spec[sl++] = *f++;
+                uint8_t tag;
+                const uint8_t* d;
+                size_t dn;
+                stars[starCount++] = args.next(tag, d, dn) && tag == LOG_ARG_I32 ? (int)u32At(d) : 0;
+            } else {
+                while (*f >= '0' && *f <= '9' && sl < 16) spec[sl++] = *f++;
+            }
+        }
+        while (*f && strchr("hlLqjzt", *f)) f++;
+        char conv = *f;
+        if (!conv) break;
+        f++;
+
+        uint8_t tag;
+        const uint8_t* d;
+        size_t dn;
+        if (!args.next(tag, d, dn)) {
+            emit("<?>", 3);
+            continue;
+        }
+
+        char tmp[LOG_MAX_STRING + 48];
+        int k = -1;
+        bool isInt = strchr("diouxXc", conv) != nullptr;
+        bool isFloat = strchr("fFeEgGaA", conv) != nullptr;
+        if (isInt && (tag == LOG_ARG_I32 || tag == LOG_ARG_I64)) {
+            if (tag == LOG_ARG_I64 && conv != 'c') {
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+            }
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            bool sign = conv == 'd' || conv == 'i';
+            if (tag == LOG_ARG_I64 && conv != 'c') {
+                uint64_t v = u64At(d);
+                if (starCount == 2) k = sign ? snprintf(tmp, sizeof(tmp), spec, stars[0], stars[1], (long long)v)
+                                             : snprintf(tmp, sizeof(tmp), spec, stars[0], stars[1], (unsigned long long)v);
+                else if (starCount == 1) k = sign ? snprintf(tmp, sizeof(tmp), spec, stars[0], (long long)v)
+                                                  : snprintf(tmp, sizeof(tmp), spec, stars[0], (unsigned long long)v);
+                else k = sign ? snprintf(tmp, sizeof(tmp), spec, (long long)v)
+                              : snprintf(tmp, sizeof(tmp), spec, (unsigned long long)v);
+            } else {
+                // Both int and unsigned are 32-bit here
+                unsigned v = tag == LOG_ARG_I32 ? u32At(d) : (unsigned)u64At(d);
+                if (starCount == 2) k = snprintf(tmp, sizeof(tmp), spec, stars[0], stars[1], v);
+                else if (starCount == 1) k = snprintf(tmp, sizeof(tmp), spec, stars[0], v);
+                else k = snprintf(tmp, sizeof(tmp), spec, v);
+            }
+        } else if (isFloat && tag == LOG_ARG_F64) {
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            double v;
+            memcpy(&v, d, sizeof(v));
+            if (starCount == 2) k = snprintf(tmp, sizeof(tmp), spec, stars[0], stars[1], v);
+            else if (starCount == 1) k = snprintf(tmp, sizeof(tmp), spec, stars[0], v);
+            else k = snprintf(tmp, sizeof(tmp), spec, v);
+        } else if (conv == 's' && tag == LOG_ARG_STR) {
+            spec[sl++] = 's';
+            spec[sl] = '\0';
+            char str[LOG_MAX_STRING + 1];
+            memcpy(str, d, dn);
+            str[dn] = '\0';
+            if (starCount == 2) k = snprintf(tmp, sizeof(tmp), spec, stars[0], stars[1], str);
+            else if (starCount == 1) k = snprintf(tmp, sizeof(tmp), spec, stars[0], str);
+            else k = snprintf(tmp, sizeof(tmp), spec, str);
+        } else if (conv == 'p' && (tag == LOG_ARG_PTR || tag == LOG_ARG_I32)) {
+            k = snprintf(tmp, sizeof(tmp), "0x%08x", (unsigned)u32At(d));
+        }
+
+        if (k < 0) {
+            emit("<?>", 3);
+        } else {
+            emit(tmp, (size_t)k < sizeof(tmp) ? (size_t)k : sizeof(tmp) - 1);
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void LogRing::init(uint8_t* storage, size_t size) {
+    _mask = (uint32_t)size - 1;
+    _buf = storage;
+}
+
+void LogRing::write(const uint8_t* rec, size_t len) {
+    uint32_t pos = _reserved.fetch_add((uint32_t)len, std::memory_order_acq_rel);
+    uint32_t at = pos & _mask;
+    // Everything after the commit word; the header never straddles the
+    // end (8-aligned records, ring a multiple of 8) but the body may.
+    size_t first = _mask + 1 - at;
+    if (len <= first) {
+        memcpy(_buf + at + 4, rec + 4, len - 4);
+    } else {
+        memcpy(_buf + at + 4, rec + 4, first - 4);
+        memcpy(_buf, rec + first, len - first);
+    }
+    ((std::atomic<uint32_t>*)(_buf + at))->store(commitFor(pos), std::memory_order_release);
+    _written.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LogRing::copyOut(uint32_t pos, uint8_t* out, size_t n) const {
+    uint32_t at = pos & _mask;
+    size_t first = _mask + 1 - at;
+    if (n <= first) {
+        memcpy(out, _buf + at, n);
+    } else {
+        memcpy(out, _buf + at, first);
+        memcpy(out + first, _buf, n - first);
+    }
+}
+
+uint32_t LogRing::oldest() const {
+    // Before the first lap this starts in never-written (zeroed) space
+    // and scans forward to the record at 0
+    return (head() - (_mask + 1)) | 1;
+}
+
+size_t LogRing::read(uint32_t& cursor, uint8_t* out, uint32_t& lostBytes) const {
+    if (!_buf) return 0;
+    const uint32_t size = _mask + 1;
+    // Bit 0 of a cursor means "not on a record boundary, scan for one"
+    bool scanning = cursor & 1;
+    uint32_t pos = cursor & ~7u;
+
+    for (;;) {
+        uint32_t head = this->head();
+        if (head - pos > size) {
+            // Lapped: everything up to a ring behind the head is gone
+            uint32_t from = head - size;
+            lostBytes += from - pos;
+            pos = from;
+            scanning = true;
+        }
+        if (pos == head) {
+            scanning = false;   // The next write starts here
+            break;
+        }
+
+        uint32_t commit = ((const std::atomic<uint32_t>*)(_buf + (pos & _mask)))
+                              ->load(std::memory_order_acquire);
+        if (commit != commitFor(pos)) {
+            if (!scanning) break;   // Next record not committed yet
+            pos += 8;
+            continue;
+        }
+        LogRecordHeader h;
+        copyOut(pos, (uint8_t*)&h, sizeof(h));
+        if (h.len < sizeof(LogRecordHeader) || h.len > LOG_MAX_RECORD || (h.len & 7)) {
+            pos += 8;
+            scanning = true;
+            continue;
+        }
+        copyOut(pos, out, h.len);
+        // A writer a lap ahead may have overwritten it while we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->head() - pos > size) continue;
+
+        cursor = pos + h.len;
+        return h.len;
+    }
+    cursor = pos | (scanning ? 1 : 0);
+    return 0;
+}
+
+LogRing::Stats LogRing::stats() const {
+    Stats s;
+    s.written = _written.load(std::memory_order_relaxed);
+    s.bytes = head();
+    return s;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// Binary log records and the ring they go through.
+//
+// A record is the format string pointer, a timestamp, level, core and the
+// raw arguments -- no formatting on the logging path. logFormat() turns
+// one back into text later, on whichever side reads it (the log printer
+// task, drain, or the host decoder in tools/dev/log_decode.py).
+//
+// LogRing is a byte ring with lock-free multi-producer writes: a writer
+// reserves space with one fetch_add on the write position, copies its
+// record in, and commits it by storing the record's position in its first
+// word. Readers keep their own cursor and never block writers; a reader
+// that falls more than a ring behind loses the oldest records and
+// resynchronises on the next committed header. A writer stalled for a
+// whole lap of the ring can still tear a newer record, so readers check
+// every length they use.
+//
+// No Arduino dependencies (see tools/bench/log_ring_bench.cpp).
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_ERROR = 1,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+struct LogRecordHeader {
+    uint32_t commit;        // Ring position | 1, stored last by the writer
+    uint16_t len;           // Whole record, header included, multiple of 8
+    uint8_t level;
+    uint8_t core;
+    const char* fmt;        // String literal; must outlive the ring
+    uint32_t timeUs;
+};
+
+// Argument tags. Strings are copied (length byte, then the bytes) because
+// the caller's buffer is gone by the time anything formats the record.
+enum : uint8_t {
+    LOG_ARG_END = 0,
+    LOG_ARG_I32 = 'i',
+    LOG_ARG_I64 = 'l',
+    LOG_ARG_F64 = 'd',
+    LOG_ARG_STR = 's',
+    LOG_ARG_PTR = 'p',
+};
+
+static constexpr size_t LOG_MAX_RECORD = 256;
+static constexpr size_t LOG_MAX_STRING = 200;   // Longer string args are cut
+
+// Builds one record in a caller-provided buffer. Arguments that don't
+// fit are dropped; logFormat() prints them as "<?>".
+struct LogEncoder {
+    uint8_t* p;
+    uint8_t* end;
+
+    void put(uint8_t tag, const void* v, size_t n) {
+        if ((size_t)(end - p) < n + 1) {
+            p = end;
+            return;
+        }
+        *p++ = tag;
+        memcpy(p, v, n);
+        p += n;
+    }
+    void i32(uint32_t v) { put(LOG_ARG_I32, &v, sizeof(v)); }
+    void i64(uint64_t v) { put(LOG_ARG_I64, &v, sizeof(v)); }
+    void f64(double v) { put(LOG_ARG_F64, &v, sizeof(v)); }
+    void ptr(const void* v) {
+        uint32_t u = (uint32_t)(uintptr_t)v;
+        put(LOG_ARG_PTR, &u, sizeof(u));
+    }
+    void str(const char* s) {
+        if (!s) s = "(null)";
+        size_t room = (size_t)(end - p);
+        if (room < 2) {
+            p = end;
+            return;
+        }
+        size_t n = strnlen(s, LOG_MAX_STRING);
+        if (n > room - 2) n = room - 2;
+        *p++ = LOG_ARG_STR;
+        *p++ = (uint8_t)n;
+        memcpy(p, s, n);
+        p += n;
+    }
+};
+
+inline void logEncodeArg(LogEncoder& e, const char* s) { e.str(s); }
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+logEncodeArg(LogEncoder& e, T v) {
+    if (sizeof(T) <= 4) {
+        e.i32((uint32_t)v);
+    } else {
+        e.i64((uint64_t)v);
+    }
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+logEncodeArg(LogEncoder& e, T v) {
+    e.f64((double)v);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type
+logEncodeArg(LogEncoder& e, T* v) {
+    e.ptr(v);
+}
+
+// Fill `buf` (LOG_MAX_RECORD bytes) with a record; returns its length.
+template <typename... Args>
+inline size_t logEncode(uint8_t* buf, uint8_t level, uint8_t core, uint32_t timeUs,
+                        const char* fmt, Args... args) {
+    LogRecordHeader* h = (LogRecordHeader*)buf;
+    h->commit = 0;
+    h->level = level;
+    h->core = core;
+    h->fmt = fmt;
+    h->timeUs = timeUs;
+    LogEncoder e = {buf + sizeof(LogRecordHeader), buf + LOG_MAX_RECORD};
+    int expand[] = {0, (logEncodeArg(e, args), 0)...};
+    (void)expand;
+    // Zero tail padding reads as LOG_ARG_END
+    size_t len = (size_t)(e.p - buf);
+    size_t padded = (len + 7) & ~(size_t)7;
+    memset(buf + len, 0, padded - len);
+    h->len = (uint16_t)padded;
+    return padded;
+}
+
+// Format a record's message (without a trailing newline) into `out`.
+// Returns the length written, always NUL-terminated. The caller has
+// already checked that hdr->fmt is safe to read.
+size_t logFormat(const uint8_t* rec, size_t len, char* out, size_t cap);
+
+class LogRing {
+public:
+    struct Stats {
+        uint32_t written;   // Records committed
+        uint32_t bytes;     // Write position (bytes ever reserved, mod 2^32)
+    };
+
+    // `storage` is `size` bytes, a power of two and at least
+    // 2 * LOG_MAX_RECORD; it must be zeroed.
+    void init(uint8_t* storage, size_t size);
+    bool ready() const { return _buf != nullptr; }
+
+    // Copy in one record built by logEncode(). Lock-free; safe from any
+    // task on either core.
+    void write(const uint8_t* rec, size_t len);
+
+    // Next committed record at or after `cursor` into `out` (at least
+    // LOG_MAX_RECORD bytes). Returns its length and advances the cursor,
+    // or 0 when there is nothing new (or the next record is still being
+    // written). `lostBytes` grows by the bytes skipped because the ring
+    // lapped the cursor.
+    size_t read(uint32_t& cursor, uint8_t* out, uint32_t& lostBytes) const;
+
+    // Cursor of the oldest byte still in the ring; read() from here
+    // resynchronises on the first whole record.
+    uint32_t oldest() const;
+    uint32_t head() const { return _reserved.load(std::memory_order_acquire); }
+
+    Stats stats() const;
+
+private:
+    void copyOut(uint32_t pos, uint8_t* out, size_t n) const;
+
+    uint8_t* _buf = nullptr;
+    uint32_t _mask = 0;
+    std::atomic<uint32_t> _reserved{0};
+    std::atomic<uint32_t> _written{0};
+};
@@ -0,0 +1,749 @@
+#include "msg_search.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+constexpr size_t BLOCK = 4096;
+constexpr uint8_t IDX_MAGIC[4] = {'E', 'Z', 'I', 'X'};
+constexpr uint8_t IDX_VERSION = 1;
+// magic, version + pad, blocks, terms, postings, maxId, sparse length,
+// .dat size, crc (over the sparse index then the footer before it)
+constexpr size_t FOOTER = 36;
+// Dictionary entry: u8 length, word, u32 posting offset, u32 posting bytes
+// (in .dat), u32 id count. A zero length ends a block.
+constexpr size_t ENTRY_FIXED = 1 + 12;
+// Posting lists are written through a buffer of this size
+constexpr size_t DAT_CHUNK = 4096;
+constexpr size_t INITIAL_HASH = 1024;
+
+void putU32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t putVarint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// Decode a delta-coded posting list, appending the ids to out. False if
+// it is malformed.
+bool decodePostings(const uint8_t* p, size_t len, MsgSearch::Vec<uint32_t>& out) {
+    const uint8_t* end = p + len;
+    uint32_t id = 0;
+    while (p < end) {
+        uint32_t delta = 0;
+        int shift = 0;
+        for (;;) {
+            if (p >= end || shift > 28) return false;
+            uint8_t b = *p++;
+            delta |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+            shift += 7;
+        }
+        id += delta;
+        out.push_back(id);
+    }
+    return true;
+}
+
+int compareTerm(const char* a, size_t al, const char* b, size_t bl) {
+    int c = memcmp(a, b, std::min(al, bl));
+    if (c != 0) return c;
+    return al < bl ? -1 : (al > bl ? 1 : 0);
+}
+
+bool hasPrefix(const char* term, size_t termLen, const char* prefix, size_t prefixLen) {
+    return termLen >= prefixLen && memcmp(term, prefix, prefixLen) == 0;
+}
+
+bool isWordByte(uint8_t c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+uint32_t hashTerm(const char* p, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)p[i]) * 16777619u;
+    return h;
+}
+
+// Parse "<8 digits>.<ext>"; ext is "idx" or "dat".
+bool parseSegmentName(const char* name, uint32_t* number, bool* isIdx) {
+    const char* base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    if (strlen(base) != 12 || base[8] != '.') return false;
+    if (strcmp(base + 9, "idx") == 0) {
+        *isIdx = true;
+    } else if (strcmp(base + 9, "dat") == 0) {
+        *isIdx = false;
+    } else {
+        return false;
+    }
+    uint32_t n = 0;
+    for (int i = 0; i < 8; i++) {
+        if (base[i] < '0' || base[i] > '9') return false;
+        n = n * 10 + (uint32_t)(base[i] - '0');
+    }
+    if (n == 0) return false;
+    *number = n;
+    return true;
+}
+
+struct QueryTerms {
+    char words[MsgSearch::MAX_QUERY_TERMS][SEARCH_TERM_MAX];
+    uint8_t lens[MsgSearch::MAX_QUERY_TERMS];
+    size_t count;
+};
+
+}  // namespace
+
+void searchTokenize(const char* text, size_t len,
+                    void (*fn)(void* ctx, const char* word, size_t len), void* ctx) {
+    char word[SEARCH_TERM_MAX];
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && !isWordByte((uint8_t)text[i])) i++;
+        size_t start = i;
+        size_t n = 0;
+        while (i < len && isWordByte((uint8_t)text[i])) {
+            if (n < SEARCH_TERM_MAX) {
+                char c = text[i];
+                word[n++] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+            }
+            i++;
+        }
+        if (i - start >= SEARCH_TERM_MIN) fn(ctx, word, n);
+    }
+}
+
+// =============================================================================
+// Segment files
+// =============================================================================
+
+// Writes one segment from words in ascending order.
+class SearchSegmentWriter {
+public:
+    explicit SearchSegmentWriter(MsgSearch& s) : _s(s) {}
+    ~SearchSegmentWriter() {
+        delete _dat;
+        delete _idx;
+        heapTagFree(HeapTag::MESH, _datBuf);
+        heapTagFree(HeapTag::MESH, _block);
+    }
+
+    bool begin(uint32_t number) {
+        _number = number;
+        char path[sizeof(_s._dir) + 14];
+        _s.path(number, "dat", path);
+        _dat = _s._io.open(path, true);
+        _s.path(number, "idx", path);
+        _idx = _s._io.open(path, true);
+        _datBuf = (uint8_t*)heapTagPsMalloc(HeapTag::MESH, DAT_CHUNK);
+        _block = (uint8_t*)heapTagPsMalloc(HeapTag::MESH, BLOCK);
+        return _dat && _idx && _datBuf && _block;
+    }
+
+    // `ids` ascending, non-empty
+    bool addTerm(const char* term, size_t len, const uint32_t* ids, size_t n) {
+        uint32_t postOff = _datTotal + (uint32_t)_datLen;
+        uint32_t prev = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (DAT_CHUNK - _datLen < 5 && !flushDat()) return false;
+            _datLen += putVarint(_datBuf + _datLen, ids[i] - prev);
+            prev = ids[i];
+        }
+        uint32_t postLen = _datTotal + (uint32_t)_datLen - postOff;
+
+        size_t need = ENTRY_FIXED + len;
+        if (_blockLen + need > BLOCK && !flushBlock()) return false;
+        if (_blockLen == 0) {
+            _sparse.push_back((char)len);
+            _sparse.insert(_sparse.end(), term, term + len);
+        }
+        uint8_t* e = _block + _blockLen;
+        e[0] = (uint8_t)len;
+        memcpy(e + 1, term, len);
+        putU32(e + 1 + len, postOff);
+        putU32(e + 5 + len, postLen);
+        putU32(e + 9 + len, (uint32_t)n);
+        _blockLen += need;
+        _terms++;
+        _postings += (uint32_t)n;
+        return true;
+    }
+
+    bool finish(uint32_t maxId, MsgSearch::Segment& out) {
+        if (!flushDat()) return false;
+        if (_blockLen && !flushBlock()) return false;
+        if (!_sparse.empty() && !_idx->append(_sparse.data(), _sparse.size())) return false;
+
+        uint8_t foot[FOOTER] = {IDX_MAGIC[0], IDX_MAGIC[1], IDX_MAGIC[2], IDX_MAGIC[3],
+                                IDX_VERSION, 0, 0, 0};
+        putU32(foot + 8, _blocks);
+        putU32(foot + 12, _terms);
+        putU32(foot + 16, _postings);
+        putU32(foot + 20, maxId);
+        putU32(foot + 24, (uint32_t)_sparse.size());
+        putU32(foot + 28, _datTotal);
+        uint32_t crc = msgStoreCrc32((const uint8_t*)_sparse.data(), _sparse.size());
+        putU32(foot + 32, msgStoreCrc32(foot, FOOTER - 4, crc));
+        if (!_idx->append(foot, sizeof(foot))) return false;
+
+        out.number = _number;
+        out.maxId = maxId;
+        out.terms = _terms;
+        out.postings = _postings;
+        out.blocks = _blocks;
+        out.bytes = _blocks * (uint32_t)BLOCK + (uint32_t)_sparse.size() + FOOTER + _datTotal;
+        out.sparse.swap(_sparse);
+        out.sparseAt.clear();
+        for (size_t off = 0; off < out.sparse.size(); off += 1 + (uint8_t)out.sparse[off]) {
+            out.sparseAt.push_back((uint32_t)off);
+        }
+        return true;
+    }
+
+private:
+    bool flushDat() {
+        if (_datLen && !_dat->append(_datBuf, _datLen)) return false;
+        _datTotal += (uint32_t)_datLen;
+        _datLen = 0;
+        return true;
+    }
+
+    bool flushBlock() {
+        memset(_block + _blockLen, 0, BLOCK - _blockLen);
+        if (!_idx->append(_block, BLOCK)) return false;
+        // Only the .dat handles stay open through a merge
+        _idx->release();
+        _blockLen = 0;
+        _blocks++;
+        return true;
+    }
+
+    MsgSearch& _s;
+    uint32_t _number = 0;
+    MsgStoreFile* _dat = nullptr;
+    MsgStoreFile* _idx = nullptr;
+    uint8_t* _datBuf = nullptr;
+    size_t _datLen = 0;
+    uint32_t _datTotal = 0;
+    uint8_t* _block = nullptr;
+    size_t _blockLen = 0;
+    uint32_t _blocks = 0;
+    MsgSearch::Vec<char> _sparse;
+    uint32_t _terms = 0;
+    uint32_t _postings = 0;
+};
+
+// Walks a segment's dictionary in order, for lookups and merges.
+class SearchSegmentReader {
+public:
+    SearchSegmentReader() = default;
+    ~SearchSegmentReader() {
+        delete _dat;
+        delete _idx;
+        heapTagFree(HeapTag::MESH, _block);
+    }
+    SearchSegmentReader(const SearchSegmentReader&) = delete;
+    SearchSegmentReader& operator=(const SearchSegmentReader&) = delete;
+
+    bool open(MsgSearch& s, const MsgSearch::Segment& seg) {
+        _seg = &seg;
+        char path[sizeof(s._dir) + 14];
+        s.path(seg.number, "idx", path);
+        _idx = s._io.open(path, false);
+        s.path(seg.number, "dat", path);
+        _dat = s._io.open(path, false);
+        _block = (uint8_t*)heapTagPsMalloc(HeapTag::MESH, BLOCK);
+        return _idx && _dat && _block;
+    }
+
+    // Position on the first entry of block b; false past the last block
+    // or on a read error (error() tells which).
+    bool seekBlock(uint32_t b) {
+        _valid = false;
+        _blockIndex = b;
+        if (b >= _seg->blocks) return false;
+        bool ok = _idx->read(b * (uint32_t)BLOCK, _block, BLOCK) == BLOCK;
+        _idx->release();
+        if (!ok) {
+            _error = true;
+            return false;
+        }
+        _pos = 0;
+        return parse();
+    }
+
+    // Next entry, moving on to the next block at the end of this one
+    bool next() {
+        if (!_valid) return false;
+        _pos += ENTRY_FIXED + _len;
+        if (parse()) return true;
+        return seekBlock(_blockIndex + 1);
+    }
+
+    bool valid() const { return _valid; }
+    bool error() const { return _error; }
+    uint32_t blockIndex() const { return _blockIndex; }
+    const char* term() const { return (const char*)_block + _pos + 1; }
+    size_t termLen() const { return _len; }
+
+    // Append the current entry's ids to out
+    bool readIds(MsgSearch::Vec<uint8_t>& buf, MsgSearch::Vec<uint32_t>& out) {
+        const uint8_t* e = _block + _pos + 1 + _len;
+        uint32_t off = getU32(e);
+        uint32_t len = getU32(e + 4);
+        buf.resize(len);
+        if (len && _dat->read(off, buf.data(), len) != len) {
+            _error = true;
+            return false;
+        }
+        if (!decodePostings(buf.data(), len, out)) {
+            _error = true;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool parse() {
+        _valid = false;
+        if (_pos >= BLOCK || _block[_pos] == 0) return false;
+        _len = _block[_pos];
+        if (_len > SEARCH_TERM_MAX || _pos + ENTRY_FIXED + _len > BLOCK) {
+            _error = true;
+            return false;
+        }
+        _valid = true;
+        return true;
+    }
+
+    const MsgSearch::Segment* _seg = nullptr;
+    MsgStoreFile* _idx = nullptr;
+    MsgStoreFile* _dat = nullptr;
+    uint8_t* _block = nullptr;
+    uint32_t _blockIndex = 0;
+    size_t _pos = 0;
+    size_t _len = 0;
+    bool _valid = false;
+    bool _error = false;
+};
+
+void MsgSearch::path(uint32_t number, const char* ext, char* out) const {
+    snprintf(out, sizeof(_dir) + 14, "%s/%08u.%s", _dir, (unsigned)number, ext);
+}
+
+void MsgSearch::removeSegmentFiles(uint32_t number) {
+    // Index first: without it the .dat is an orphan open() cleans up
+    char p[sizeof(_dir) + 14];
+    path(number, "idx", p);
+    _io.remove(p);
+    path(number, "dat", p);
+    _io.remove(p);
+}
+
+bool MsgSearch::loadSegment(uint32_t number) {
+    char p[sizeof(_dir) + 14];
+    path(number, "idx", p);
+    MsgStoreFile* f = _io.open(p, false);
+    if (!f) return false;
+
+    Segment seg;
+    uint8_t foot[FOOTER];
+    uint32_t size = f->size();
+    bool ok = size >= FOOTER && f->read(size - FOOTER, foot, FOOTER) == FOOTER &&
+              memcmp(foot, IDX_MAGIC, 4) == 0 && foot[4] == IDX_VERSION;
+    uint32_t sparseLen = 0, datSize = 0;
+    if (ok) {
+        seg.number = number;
+        seg.blocks = getU32(foot + 8);
+        seg.terms = getU32(foot + 12);
+        seg.postings = getU32(foot + 16);
+        seg.maxId = getU32(foot + 20);
+        sparseLen = getU32(foot + 24);
+        datSize = getU32(foot + 28);
+        ok = (uint64_t)seg.blocks * BLOCK + sparseLen + FOOTER == size;
+    }
+    if (ok) {
+        seg.sparse.resize(sparseLen);
+        ok = f->read(seg.blocks * (uint32_t)BLOCK, seg.sparse.data(), sparseLen) == sparseLen;
+    }
+    delete f;
+    if (ok) {
+        uint32_t crc = msgStoreCrc32((const uint8_t*)seg.sparse.data(), sparseLen);
+        ok = msgStoreCrc32(foot, FOOTER - 4, crc) == getU32(foot + 32);
+    }
+    if (ok) {
+        for (size_t off = 0; off < sparseLen; off += 1 + (uint8_t)seg.sparse[off]) {
+            seg.sparseAt.push_back((uint32_t)off);
+        }
+        ok = seg.sparseAt.size() == seg.blocks;
+    }
+    if (ok) {
+        path(number, "dat", p);
+        f = _io.open(p, false);
+        ok = f && f->size() >= datSize;
+        delete f;
+    }
+    if (!ok) return false;
+    seg.bytes = size + datSize;
+    _segs.push_back(std::move(seg));
+    return true;
+}
+
+// =============================================================================
+// Open
+// =============================================================================
+
+bool MsgSearch::open(const char* dir) {
+    close();
+    if (!dir || strlen(dir) >= sizeof(_dir)) return false;
+    strcpy(_dir, dir);
+    _io.mkdir(_dir);
+
+    struct Found {
+        uint32_t number;
+        bool isIdx;
+    };
+    std::vector<Found> found;
+    _io.list(_dir, [](void* ctx, const char* name) {
+        Found f;
+        if (parseSegmentName(name, &f.number, &f.isIdx)) {
+            static_cast<std::vector<Found>*>(ctx)->push_back(f);
+        }
+    }, &found);
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+        return a.number != b.number ? a.number < b.number : a.isIdx < b.isIdx;
+    });
+
+    for (size_t i = 0; i < found.size(); i++) {
+        uint32_t n = found[i].number;
+        bool hasIdx = false;
+        while (i < found.size() && found[i].number == n) {
+            hasIdx |= found[i].isIdx;
+            i++;
+        }
+        i--;
+        if (!hasIdx || !loadSegment(n)) removeSegmentFiles(n);
+    }
+    for (const Segment& s : _segs) _maxId = std::max(_maxId, s.maxId);
+    _open = true;
+    return true;
+}
+
+void MsgSearch::close() {
+    _segs.clear();
+    _arena.clear();
+    _terms.clear();
+    _hash.clear();
+    _pending.clear();
+    _pendingDocs = 0;
+    _maxId = 0;
+    _open = false;
+}
+
+// =============================================================================
+// Adding
+// =============================================================================
+
+uint32_t MsgSearch::internPending(const char* word, size_t len) {
+    if (_hash.empty() || _terms.size() * 2 >= _hash.size()) {
+        Vec<int32_t> grown(_hash.empty() ? INITIAL_HASH : _hash.size() * 2, -1);
+        size_t mask = grown.size() - 1;
+        for (size_t t = 0; t < _terms.size(); t++) {
+            size_t h = hashTerm(&_arena[_terms[t].off], _terms[t].len) & mask;
+            while (grown[h] >= 0) h = (h + 1) & mask;
+            grown[h] = (int32_t)t;
+        }
+        _hash.swap(grown);
+    }
+    size_t mask = _hash.size() - 1;
+    size_t h = hashTerm(word, len) & mask;
+    while (_hash[h] >= 0) {
+        const PendingTerm& t = _terms[_hash[h]];
+        if (t.len == len && memcmp(&_arena[t.off], word, len) == 0) return (uint32_t)_hash[h];
+        h = (h + 1) & mask;
+    }
+    _hash[h] = (int32_t)_terms.size();
+    _terms.push_back({(uint32_t)_arena.size(), (uint8_t)len, 0});
+    _arena.insert(_arena.end(), word, word + len);
+    return (uint32_t)_terms.size() - 1;
+}
+
+void MsgSearch::add(uint32_t id, const char* text, size_t len) {
+    if (!_open || id <= _maxId) return;
+    _maxId = id;
+    _pendingDocs++;
+    struct Ctx {
+        MsgSearch* self;
+        uint32_t id;
+    } ctx = {this, id};
+    searchTokenize(text, len, [](void* c, const char* word, size_t wordLen) {
+        Ctx* x = static_cast<Ctx*>(c);
+        uint32_t t = x->self->internPending(word, wordLen);
+        PendingTerm& term = x->self->_terms[t];
+        if (term.lastId == x->id) return;
+        term.lastId = x->id;
+        x->self->_pending.push_back({t, x->id});
+    }, &ctx);
+}
+
+bool MsgSearch::flush() {
+    if (!_open) return false;
+    if (_pending.empty()) {
+        _pendingDocs = 0;
+        return true;
+    }
+
+    // Words in dictionary order, then each word's ids (already ascending)
+    Vec<uint32_t> order(_terms.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (uint32_t)i;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return compareTerm(&_arena[_terms[a].off], _terms[a].len,
+                           &_arena[_terms[b].off], _terms[b].len) < 0;
+    });
+    Vec<uint32_t> rank(_terms.size());
+    for (size_t i = 0; i < order.size(); i++) rank[order[i]] = (uint32_t)i;
+    Vec<Posting> sorted(_pending);
+    std::stable_sort(sorted.begin(), sorted.end(), [&rank](const Posting& a, const Posting& b) {
+        return rank[a.term] < rank[b.term];
+    });
+
+    uint32_t number = _segs.empty() ? 1 : _segs.back().number + 1;
+    Segment seg;
+    bool ok;
+    {
+        SearchSegmentWriter w(*this);
+        ok = w.begin(number);
+        Vec<uint32_t> ids;
+        for (size_t i = 0; ok && i < sorted.size();) {
+            uint32_t t = sorted[i].term;
+            ids.clear();
+            for (; i < sorted.size() && sorted[i].term == t; i++) ids.push_back(sorted[i].id);
+            ok = w.addTerm(&_arena[_terms[t].off], _terms[t].len, ids.data(), ids.size());
+        }
+        ok = ok && w.finish(_maxId, seg);
+    }
+    if (!ok) {
+        removeSegmentFiles(number);
+        return false;
+    }
+    _segs.push_back(std::move(seg));
+    _arena.clear();
+    _terms.clear();
+    _hash.clear();
+    _pending.clear();
+    _pendingDocs = 0;
+    return true;
+}
+
+// =============================================================================
+// Merging
+// =============================================================================
+
+size_t MsgSearch::merge() {
+    size_t merges = 0;
+    while (_open && _segs.size() >= 2) {
+        const Segment& last = _segs[_segs.size() - 1];
+        const Segment& prev = _segs[_segs.size() - 2];
+        if ((uint64_t)last.postings * 4 < prev.postings && _segs.size() <= MAX_SEGMENTS) break;
+        if (!mergeLast(2)) break;
+        merges++;
+    }
+    return merges;
+}
+
+bool MsgSearch::mergeLast(size_t count) {
+    const size_t first = _segs.size() - count;
+    uint32_t number = _segs.back().number + 1;
+    uint32_t maxId = 0;
+    for (size_t i = first; i < _segs.size(); i++) maxId = std::max(maxId, _segs[i].maxId);
+
+    Segment seg;
+    bool ok = true;
+    {
+        Vec<SearchSegmentReader> readers(count);
+        for (size_t i = 0; ok && i < count; i++) {
+            ok = readers[i].open(*this, _segs[first + i]);
+            if (ok) {
+                readers[i].seekBlock(0);
+                ok = !readers[i].error();
+            }
+        }
+        SearchSegmentWriter w(*this);
+        ok = ok && w.begin(number);
+
+        char term[SEARCH_TERM_MAX];
+        Vec<uint8_t> buf;
+        Vec<uint32_t> ids;
+        while (ok) {
+            // Smallest current word across the inputs
+            const SearchSegmentReader* min = nullptr;
+            for (const SearchSegmentReader& r : readers) {
+                if (r.valid() && (!min || compareTerm(r.term(), r.termLen(),
+                                                      min->term(), min->termLen()) < 0)) {
+                    min = &r;
+                }
+            }
+            if (!min) break;
+            size_t len = min->termLen();
+            memcpy(term, min->term(), len);
+
+            // Older segments hold older ids, so the lists concatenate in order
+            ids.clear();
+            for (SearchSegmentReader& r : readers) {
+                if (!r.valid() || compareTerm(r.term(), r.termLen(), term, len) != 0) continue;
+                ok = r.readIds(buf, ids);
+                r.next();
+                ok = ok && !r.error();
+                if (!ok) break;
+            }
+            if (!ok) break;
+            size_t keep = 0;
+            for (uint32_t id : ids) {
+                if (_alive(_aliveCtx, id)) ids[keep++] = id;
+            }
+            if (keep) ok = w.addTerm(term, len, ids.data(), keep);
+        }
+        ok = ok && w.finish(maxId, seg);
+    }
+    if (!ok) {
+        removeSegmentFiles(number);
+        return false;
+    }
+    for (size_t i = first; i < _segs.size(); i++) removeSegmentFiles(_segs[i].number);
+    _segs.erase(_segs.begin() + first, _segs.end());
+    _segs.push_back(std::move(seg));
+    _merges++;
+    return true;
+}
+
+// =============================================================================
+// Queries
+// =============================================================================
+
+bool MsgSearch::lookup(const Segment& seg, const char* prefix, size_t len, Vec<uint32_t>& out) {
+    if (seg.blocks == 0) return true;
+
+    // Last block whose first word is <= prefix; earlier ones can't match
+    auto firstWord = [&seg](uint32_t b, size_t* wordLen) {
+        const char* p = &seg.sparse[seg.sparseAt[b]];
+        *wordLen = (uint8_t)p[0];
+        return p + 1;
+    };
+    uint32_t lo = 0, hi = seg.blocks;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        size_t wl;
+        const char* w = firstWord(mid, &wl);
+        if (compareTerm(w, wl, prefix, len) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    SearchSegmentReader r;
+    if (!r.open(*this, seg)) return false;
+    Vec<uint8_t> buf;
+    size_t expansions = 0;
+    for (r.seekBlock(lo); r.valid(); r.next()) {
+        if (hasPrefix(r.term(), r.termLen(), prefix, len)) {
+            if (++expansions > MAX_EXPANSIONS) break;
+            if (!r.readIds(buf, out)) return false;
+        } else if (compareTerm(r.term(), r.termLen(), prefix, len) > 0) {
+            break;
+        }
+    }
+    return !r.error();
+}
+
+void MsgSearch::lookupPending(const char* prefix, size_t len, Vec<uint32_t>& out) {
+    if (_pending.empty()) return;
+    Vec<uint8_t> match(_terms.size(), 0);
+    bool any = false;
+    for (size_t t = 0; t < _terms.size(); t++) {
+        if (hasPrefix(&_arena[_terms[t].off], _terms[t].len, prefix, len)) {
+            match[t] = 1;
+            any = true;
+        }
+    }
+    if (!any) return;
+    for (const Posting& p : _pending) {
+        if (match[p.term]) out.push_back(p.id);
+    }
+}
+
+size_t MsgSearch::search(const char* query, size_t len, uint32_t* out, size_t limit) {
+    if (!_open || !query || limit == 0) return 0;
+    QueryTerms q;
+    q.count = 0;
+    searchTokenize(query, len, [](void* ctx, const char* word, size_t wordLen) {
+        QueryTerms* q = static_cast<QueryTerms*>(ctx);
+        for (size_t i = 0; i < q->count; i++) {
+            if (q->lens[i] == wordLen && memcmp(q->words[i], word, wordLen) == 0) return;
+        }
+        if (q->count == MAX_QUERY_TERMS) return;
+        memcpy(q->words[q->count], word, wordLen);
+        q->lens[q->count++] = (uint8_t)wordLen;
+    }, &q);
+    if (q.count == 0) return 0;
+
+    // Sources hold disjoint id ranges, so walk them newest first (pending,
+    // then segments from the last) and stop once `limit` results are in
+    size_t n = 0;
+    Vec<uint32_t> acc, ids, both;
+    for (size_t src = _segs.size() + 1; src-- > 0 && n < limit;) {
+        for (size_t t = 0; t < q.count; t++) {
+            ids.clear();
+            if (src == _segs.size()) {
+                lookupPending(q.words[t], q.lens[t], ids);
+            } else {
+                lookup(_segs[src], q.words[t], q.lens[t], ids);
+            }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            if (t == 0) {
+                acc.swap(ids);
+            } else {
+                both.clear();
+                std::set_intersection(acc.begin(), acc.end(), ids.begin(), ids.end(),
+                                      std::back_inserter(both));
+                acc.swap(both);
+            }
+            if (acc.empty()) break;
+        }
+        for (size_t i = acc.size(); i-- > 0 && n < limit;) {
+            if (_alive(_aliveCtx, acc[i])) out[n++] = acc[i];
+        }
+    }
+    return n;
+}
+
+void MsgSearch::getStats(MsgSearchStats& out) const {
+    out.segments = (uint32_t)_segs.size();
+    out.terms = 0;
+    out.postings = 0;
+    out.bytes = 0;
+    for (const Segment& s : _segs) {
+        out.terms += s.terms;
+        out.postings += s.postings;
+        out.bytes += s.bytes;
+    }
+    out.pendingDocs = _pendingDocs;
+    out.pendingPostings = (uint32_t)_pending.size();
+    out.indexedUpTo = _maxId;
+    out.merges = _merges;
+}
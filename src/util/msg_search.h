@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "heap_tags.h"
+#include "msg_store.h"
+
+// Full-text search over message history: an inverted index from words to
+// the ids of the MsgStore messages containing them.
+//
+// Text is split into words of letters and digits (bytes >= 0x80 count as
+// letters, so UTF-8 words stay whole), ASCII is case-folded, and words
+// shorter than SEARCH_TERM_MIN are skipped; longer than SEARCH_TERM_MAX
+// they are cut. A query matches messages containing every query word as
+// the start of some word ("mee park" finds "Meet at the park").
+//
+// New messages go to an in-RAM pending index. flush() writes it out as an
+// immutable segment: `<n>.dat` holds each word's posting list (ids,
+// delta-coded as varints) and `<n>.idx` the word dictionary in 4 KB
+// blocks, then a sparse index (first word of each block) and a footer
+// with a crc. Only the sparse index stays in RAM, so a lookup costs one
+// dictionary block read plus the posting lists of the matching words.
+// merge() folds the newest segments together so there are only a few;
+// each id is rewritten a logarithmic number of times.
+//
+// Nothing is logged for pending entries: a segment records the highest id
+// it covers, and after a reboot the caller re-adds anything newer from
+// the store (see indexedUpTo()). The footer is written last, so a
+// segment cut short by power loss is discarded and its messages are
+// re-added the same way. Deleted messages are dropped from results, and
+// from posting lists as merges rewrite them, through the alive callback.
+// Only a message's text when it was added is indexed; later updates
+// (delivery status, duplicate counts) don't change it.
+//
+// Not thread-safe. No Arduino dependencies (see
+// tools/bench/msg_search_bench.cpp).
+
+static constexpr size_t SEARCH_TERM_MIN = 2;
+static constexpr size_t SEARCH_TERM_MAX = 24;
+
+// Calls fn(ctx, word, len) for each indexable word of text[0..len),
+// case-folded, in order (repeats included).
+void searchTokenize(const char* text, size_t len,
+                    void (*fn)(void* ctx, const char* word, size_t len), void* ctx);
+
+struct MsgSearchStats {
+    uint32_t segments;
+    uint32_t terms;             // Dictionary entries across segments
+    uint32_t postings;          // Ids across segments' posting lists
+    uint32_t bytes;             // Segment files on disk
+    uint32_t pendingDocs;       // Added since the last flush
+    uint32_t pendingPostings;
+    uint32_t indexedUpTo;
+    uint32_t merges;
+};
+
+class MsgSearch {
+public:
+    // Whether message `id` still exists
+    using AliveFn = bool (*)(void* ctx, uint32_t id);
+
+    MsgSearch(MsgStoreIO& io, AliveFn alive, void* aliveCtx)
+        : _io(io), _alive(alive), _aliveCtx(aliveCtx) {}
+    ~MsgSearch() { close(); }
+    MsgSearch(const MsgSearch&) = delete;
+    MsgSearch& operator=(const MsgSearch&) = delete;
+
+    // Create `dir` if needed and load its segments' sparse indexes.
+    // Partial segments are deleted.
+    bool open(const char* dir);
+    void close();
+    bool isOpen() const { return _open; }
+
+    // Highest id indexed (on disk or pending); add anything newer.
+    uint32_t indexedUpTo() const { return _maxId; }
+
+    // Index message `id`. Ids must increase; older ones are ignored.
+    void add(uint32_t id, const char* text, size_t len);
+    // Pending entries are past FLUSH_POSTINGS and should be flushed
+    bool flushDue() const { return _pending.size() >= FLUSH_POSTINGS; }
+    // Write pending entries as a new segment. False on a write error
+    // (they stay pending).
+    bool flush();
+    // Merge the newest segments while the newest is at least a quarter
+    // the size of the one before (or there are more than MAX_SEGMENTS).
+    // Returns how many merges ran; stops at the first failure.
+    size_t merge();
+
+    // Ids of live messages matching `query`, newest first, at most
+    // `limit`. A query word matches at most MAX_EXPANSIONS distinct words
+    // per segment, which only limits very short prefixes.
+    size_t search(const char* query, size_t len, uint32_t* out, size_t limit);
+
+    void getStats(MsgSearchStats& out) const;
+
+    static constexpr size_t FLUSH_POSTINGS = 16384;
+    static constexpr size_t MAX_SEGMENTS = 8;
+    static constexpr size_t MAX_QUERY_TERMS = 8;
+    static constexpr size_t MAX_EXPANSIONS = 256;
+
+    template <typename T>
+    using Vec = std::vector<T, HeapTagAllocator<T, HeapTag::MESH>>;
+
+private:
+    struct Segment {
+        uint32_t number;
+        uint32_t maxId;
+        uint32_t terms;
+        uint32_t postings;
+        uint32_t blocks;
+        uint32_t bytes;         // .idx + .dat
+        Vec<char> sparse;       // First word of each block, each u8 length + bytes
+        Vec<uint32_t> sparseAt; // Offset of each block's word in sparse
+    };
+    struct PendingTerm {
+        uint32_t off;           // Into _arena
+        uint8_t len;
+        uint32_t lastId;        // Skip repeats within one message
+    };
+    struct Posting {
+        uint32_t term;
+        uint32_t id;
+    };
+
+    void path(uint32_t number, const char* ext, char* out) const;
+    bool loadSegment(uint32_t number);
+    void removeSegmentFiles(uint32_t number);
+    uint32_t internPending(const char* word, size_t len);
+    // Append ids of words starting with prefix in segment `seg` to out
+    bool lookup(const Segment& seg, const char* prefix, size_t len, Vec<uint32_t>& out);
+    void lookupPending(const char* prefix, size_t len, Vec<uint32_t>& out);
+    bool mergeLast(size_t count);
+
+    friend class SearchSegmentWriter;
+    friend class SearchSegmentReader;
+
+    MsgStoreIO& _io;
+    AliveFn _alive;
+    void* _aliveCtx;
+    char _dir[80] = {};
+    bool _open = false;
+    Vec<Segment> _segs;
+    Vec<char> _arena;
+    Vec<PendingTerm> _terms;
+    Vec<int32_t> _hash;         // Open addressing into _terms; -1 empty
+    Vec<Posting> _pending;
+    uint32_t _pendingDocs = 0;
+    uint32_t _maxId = 0;
+    uint32_t _merges = 0;
+};
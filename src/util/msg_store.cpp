@@ -0,0 +1,549 @@
+#include "msg_store.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+constexpr uint8_t REC_MAGIC = 0xE5;
+constexpr size_t REC_HEADER = 12;
+constexpr uint8_t SEG_MAGIC[4] = {'E', 'Z', 'M', 'S'};
+constexpr uint8_t SEG_VERSION = 1;
+constexpr size_t SEG_HEADER = 8;
+constexpr size_t REC_MAX = REC_HEADER + 1 + MSG_KEY_MAX + MSG_BODY_MAX;
+// Compaction batches records into writes of this size
+constexpr size_t COPY_CHUNK = 4096;
+
+enum RecType : uint8_t {
+    REC_MESSAGE = 1,    // New message, or a new body for an existing id
+    REC_DELETE = 2,     // Message id removed
+    REC_DROP = 3,       // Whole conversation removed (id unused)
+};
+
+uint32_t recordCrc(const uint8_t* rec, size_t payloadLen) {
+    uint32_t crc = msgStoreCrc32(rec, 8);
+    return msgStoreCrc32(rec + REC_HEADER, payloadLen, crc);
+}
+
+void putU16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+void putU32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+uint16_t getU16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Header and payload of the record at rec[0..avail) check out. Returns the
+// whole record length, 0 if it doesn't.
+size_t checkRecord(const uint8_t* rec, size_t avail) {
+    if (avail < REC_HEADER || rec[0] != REC_MAGIC) return 0;
+    uint8_t type = rec[1];
+    uint16_t len = getU16(rec + 2);
+    if (type < REC_MESSAGE || type > REC_DROP) return 0;
+    if (len < 1 || REC_HEADER + len > REC_MAX || REC_HEADER + len > avail) return 0;
+    uint8_t keyLen = rec[REC_HEADER];
+    if (keyLen == 0 || keyLen > MSG_KEY_MAX || 1u + keyLen > len) return 0;
+    if (type != REC_MESSAGE && len != 1u + keyLen) return 0;
+    if (recordCrc(rec, len) != getU32(rec + 8)) return 0;
+    return REC_HEADER + len;
+}
+
+bool parseSegmentName(const char* name, uint32_t* number) {
+    const char* base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    if (strlen(base) != 12 || strcmp(base + 8, ".seg") != 0) return false;
+    uint32_t n = 0;
+    for (int i = 0; i < 8; i++) {
+        if (base[i] < '0' || base[i] > '9') return false;
+        n = n * 10 + (uint32_t)(base[i] - '0');
+    }
+    if (n == 0) return false;
+    *number = n;
+    return true;
+}
+
+}  // namespace
+
+// Nibble-table CRC-32 (IEEE, reflected): small enough to keep in flash
+// and still a few cycles per byte.
+uint32_t msgStoreCrc32(const uint8_t* p, size_t len, uint32_t crc) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+// =============================================================================
+// Open / replay
+// =============================================================================
+
+bool MsgStore::open(const char* dir) {
+    close();
+    if (!dir || strlen(dir) >= sizeof(_dir) - 14) return false;
+    strcpy(_dir, dir);
+    _io.mkdir(_dir);
+
+    std::vector<uint32_t> numbers;
+    _io.list(_dir, [](void* ctx, const char* name) {
+        uint32_t n;
+        if (parseSegmentName(name, &n)) static_cast<std::vector<uint32_t>*>(ctx)->push_back(n);
+    }, &numbers);
+    std::sort(numbers.begin(), numbers.end());
+    if (numbers.size() > UINT16_MAX) numbers.resize(UINT16_MAX);
+
+    bool clean = true;
+    for (uint32_t n : numbers) {
+        _segs.push_back({n, 0});
+        clean = replaySegment((uint16_t)(_segs.size() - 1));
+    }
+    // Never append after a torn record: the next write starts a segment
+    _appendable = !_segs.empty() && clean && _segs.back().size < MSG_SEGMENT_MAX;
+    _open = true;
+    return true;
+}
+
+void MsgStore::close() {
+    closeFiles();
+    _convs.clear();
+    _segs.clear();
+    _appendable = false;
+    _nextId = 1;
+    _liveBytes = 0;
+    _tornBytes = 0;
+    _open = false;
+}
+
+void MsgStore::closeFiles() {
+    delete _readFile;
+    _readFile = nullptr;
+    delete _appendFile;
+    _appendFile = nullptr;
+}
+
+bool MsgStore::replaySegment(uint16_t seg) {
+    MsgStoreFile* f = segFile(seg);
+    if (!f) return false;
+    uint32_t fileSize = f->size();
+
+    uint8_t header[SEG_HEADER];
+    if (fileSize < SEG_HEADER || f->read(0, header, SEG_HEADER) != SEG_HEADER ||
+        memcmp(header, SEG_MAGIC, 4) != 0 || header[4] != SEG_VERSION) {
+        _tornBytes += fileSize;
+        _segs[seg].size = 0;
+        return false;
+    }
+
+    uint32_t off = SEG_HEADER;
+    while (off < fileSize) {
+        size_t want = std::min<size_t>(sizeof(_scratch), fileSize - off);
+        size_t got = f->read(off, _scratch, want);
+        size_t len = checkRecord(_scratch, got);
+        if (len == 0) break;
+        apply(_scratch[1], getU32(_scratch + 4), (const char*)_scratch + REC_HEADER + 1,
+              _scratch[REC_HEADER], seg, off, (uint16_t)len);
+        off += len;
+    }
+    _segs[seg].size = off;
+    if (off < fileSize) {
+        _tornBytes += fileSize - off;
+        return false;
+    }
+    return true;
+}
+
+// =============================================================================
+// Index
+// =============================================================================
+
+MsgStore::Conv* MsgStore::findConv(const char* key, size_t keyLen) {
+    for (Conv& c : _convs) {
+        if (strncmp(c.key, key, keyLen) == 0 && c.key[keyLen] == '\0') return &c;
+    }
+    return nullptr;
+}
+
+const MsgStore::Conv* MsgStore::findConv(const char* key) const {
+    for (const Conv& c : _convs) {
+        if (strcmp(c.key, key) == 0) return &c;
+    }
+    return nullptr;
+}
+
+MsgStore::Conv* MsgStore::addConv(const char* key, size_t keyLen) {
+    _convs.emplace_back();
+    Conv& c = _convs.back();
+    memcpy(c.key, key, keyLen);
+    c.key[keyLen] = '\0';
+    return &c;
+}
+
+MsgStore::Loc* MsgStore::findLoc(Vec<Loc>& msgs, uint32_t id) {
+    auto it = std::lower_bound(msgs.begin(), msgs.end(), id,
+                               [](const Loc& l, uint32_t v) { return l.id < v; });
+    return (it != msgs.end() && it->id == id) ? &*it : nullptr;
+}
+
+void MsgStore::apply(uint8_t type, uint32_t id, const char* key, size_t keyLen,
+                     uint16_t seg, uint32_t offset, uint16_t len) {
+    if (id >= _nextId) _nextId = id + 1;
+    Conv* c = findConv(key, keyLen);
+
+    if (type == REC_MESSAGE) {
+        if (!c) c = addConv(key, keyLen);
+        Loc loc = {id, offset, seg, len};
+        if (Loc* old = findLoc(c->msgs, id)) {
+            _liveBytes -= old->len;
+            *old = loc;
+        } else if (c->msgs.empty() || c->msgs.back().id < id) {
+            c->msgs.push_back(loc);
+        } else {
+            auto it = std::lower_bound(c->msgs.begin(), c->msgs.end(), id,
+                                       [](const Loc& l, uint32_t v) { return l.id < v; });
+            c->msgs.insert(it, loc);
+        }
+        _liveBytes += len;
+        return;
+    }
+    if (!c) return;
+
+    if (type == REC_DELETE) {
+        Loc* old = findLoc(c->msgs, id);
+        if (!old) return;
+        _liveBytes -= old->len;
+        c->msgs.erase(c->msgs.begin() + (old - c->msgs.data()));
+        if (!c->msgs.empty()) return;
+    } else {
+        for (const Loc& l : c->msgs) _liveBytes -= l.len;
+    }
+    _convs.erase(_convs.begin() + (c - _convs.data()));
+}
+
+// =============================================================================
+// Writes
+// =============================================================================
+
+void MsgStore::segPath(uint32_t number, char* out) const {
+    snprintf(out, sizeof(_dir) + 14, "%s/%08u.seg", _dir, (unsigned)number);
+}
+
+MsgStoreFile* MsgStore::segFile(uint16_t seg) {
+    if (_readFile && _readSeg == seg) return _readFile;
+    delete _readFile;
+    char path[sizeof(_dir) + 14];
+    segPath(_segs[seg].number, path);
+    _readFile = _io.open(path, false);
+    _readSeg = seg;
+    return _readFile;
+}
+
+bool MsgStore::startSegment() {
+    delete _appendFile;
+    _appendFile = nullptr;
+    _appendable = false;
+    if (_segs.size() >= UINT16_MAX) return false;
+
+    uint32_t number = _segs.empty() ? 1 : _segs.back().number + 1;
+    char path[sizeof(_dir) + 14];
+    segPath(number, path);
+    _appendFile = _io.open(path, true);
+    if (!_appendFile) return false;
+
+    uint8_t header[SEG_HEADER] = {SEG_MAGIC[0], SEG_MAGIC[1], SEG_MAGIC[2], SEG_MAGIC[3],
+                                  SEG_VERSION, 0, 0, 0};
+    _segs.push_back({number, 0});
+    if (!_appendFile->append(header, sizeof(header))) return false;
+    _segs.back().size = SEG_HEADER;
+    _appendable = true;
+    return true;
+}
+
+bool MsgStore::writeRecord(uint8_t type, uint32_t id, const char* key, size_t keyLen,
+                           const char* body, size_t bodyLen) {
+    size_t payload = 1 + keyLen + bodyLen;
+    size_t len = REC_HEADER + payload;
+    uint8_t* rec = _scratch;
+    rec[0] = REC_MAGIC;
+    rec[1] = type;
+    putU16(rec + 2, (uint16_t)payload);
+    putU32(rec + 4, id);
+    rec[REC_HEADER] = (uint8_t)keyLen;
+    memcpy(rec + REC_HEADER + 1, key, keyLen);
+    if (bodyLen) memcpy(rec + REC_HEADER + 1 + keyLen, body, bodyLen);
+    putU32(rec + 8, recordCrc(rec, payload));
+
+    if (!_appendable || _segs.back().size + len > MSG_SEGMENT_MAX) {
+        if (!startSegment()) return false;
+    }
+    uint16_t seg = (uint16_t)(_segs.size() - 1);
+    if (!_appendFile) {
+        char path[sizeof(_dir) + 14];
+        segPath(_segs[seg].number, path);
+        _appendFile = _io.open(path, false);
+        if (!_appendFile) return false;
+    }
+    // A reader opened before this append may not see it
+    if (_readFile && _readSeg == seg) {
+        delete _readFile;
+        _readFile = nullptr;
+    }
+    if (!_appendFile->append(rec, len)) {
+        // Whatever made it out is a torn record; leave it behind
+        _appendable = false;
+        return false;
+    }
+    uint32_t offset = _segs[seg].size;
+    _segs[seg].size += len;
+    apply(type, id, key, keyLen, seg, offset, (uint16_t)len);
+    return true;
+}
+
+uint32_t MsgStore::append(const char* key, const char* body, size_t len) {
+    size_t keyLen = key ? strlen(key) : 0;
+    if (!_open || keyLen == 0 || keyLen > MSG_KEY_MAX || len > MSG_BODY_MAX) return 0;
+    uint32_t id = _nextId;
+    return writeRecord(REC_MESSAGE, id, key, keyLen, body, len) ? id : 0;
+}
+
+bool MsgStore::update(const char* key, uint32_t id, const char* body, size_t len) {
+    size_t keyLen = key ? strlen(key) : 0;
+    if (!_open || keyLen == 0 || keyLen > MSG_KEY_MAX || len > MSG_BODY_MAX) return false;
+    Conv* c = findConv(key, keyLen);
+    if (!c || !findLoc(c->msgs, id)) return false;
+    return writeRecord(REC_MESSAGE, id, key, keyLen, body, len);
+}
+
+bool MsgStore::remove(const char* key, uint32_t id) {
+    size_t keyLen = key ? strlen(key) : 0;
+    if (!_open || keyLen == 0 || keyLen > MSG_KEY_MAX) return false;
+    Conv* c = findConv(key, keyLen);
+    if (!c || !findLoc(c->msgs, id)) return false;
+    return writeRecord(REC_DELETE, id, key, keyLen, nullptr, 0);
+}
+
+bool MsgStore::drop(const char* key) {
+    size_t keyLen = key ? strlen(key) : 0;
+    if (!_open || keyLen == 0 || keyLen > MSG_KEY_MAX) return false;
+    if (!findConv(key, keyLen)) return true;
+    return writeRecord(REC_DROP, 0, key, keyLen, nullptr, 0);
+}
+
+// =============================================================================
+// Reads
+// =============================================================================
+
+bool MsgStore::readRecord(const Loc& loc, uint8_t* buf) {
+    MsgStoreFile* f = segFile(loc.seg);
+    if (!f) return false;
+    size_t got = f->read(loc.offset, buf, loc.len);
+    return got == loc.len && checkRecord(buf, got) == loc.len;
+}
+
+size_t MsgStore::fetch(const char* key, uint32_t beforeId, size_t n,
+                       FetchFn fn, void* ctx, bool* more) {
+    if (more) *more = false;
+    if (!_open || !key) return 0;
+    Conv* c = findConv(key, strlen(key));
+    if (!c) return 0;
+
+    size_t end = c->msgs.size();
+    if (beforeId) {
+        end = std::lower_bound(c->msgs.begin(), c->msgs.end(), beforeId,
+                               [](const Loc& l, uint32_t v) { return l.id < v; }) - c->msgs.begin();
+    }
+    size_t start = end > n ? end - n : 0;
+    if (more) *more = start > 0;
+
+    // Copy the locations out: fn may run Lua that appends and moves msgs
+    size_t count = end - start;
+    Vec<Loc> locs(c->msgs.begin() + start, c->msgs.begin() + end);
+    size_t delivered = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Loc& loc = locs[i];
+        if (!readRecord(loc, _scratch)) continue;
+        size_t keyLen = _scratch[REC_HEADER];
+        size_t bodyOff = REC_HEADER + 1 + keyLen;
+        fn(ctx, loc.id, (const char*)_scratch + bodyOff, loc.len - bodyOff);
+        delivered++;
+    }
+    return delivered;
+}
+
+size_t MsgStore::count(const char* key) const {
+    const Conv* c = key ? findConv(key) : nullptr;
+    return c ? c->msgs.size() : 0;
+}
+
+bool MsgStore::contains(uint32_t id) const {
+    for (const Conv& c : _convs) {
+        auto it = std::lower_bound(c.msgs.begin(), c.msgs.end(), id,
+                                   [](const Loc& l, uint32_t v) { return l.id < v; });
+        if (it != c.msgs.end() && it->id == id) return true;
+    }
+    return false;
+}
+
+bool MsgStore::fetchById(uint32_t id, ScanFn fn, void* ctx) {
+    if (!_open) return false;
+    for (Conv& c : _convs) {
+        Loc* loc = findLoc(c.msgs, id);
+        if (!loc) continue;
+        if (!readRecord(*loc, _scratch)) return false;
+        size_t bodyOff = REC_HEADER + 1 + _scratch[REC_HEADER];
+        fn(ctx, c.key, id, (const char*)_scratch + bodyOff, loc->len - bodyOff);
+        return true;
+    }
+    return false;
+}
+
+size_t MsgStore::scanSince(uint32_t afterId, ScanFn fn, void* ctx) {
+    if (!_open) return 0;
+    Vec<Loc> locs;
+    for (const Conv& c : _convs) {
+        auto it = std::upper_bound(c.msgs.begin(), c.msgs.end(), afterId,
+                                   [](uint32_t v, const Loc& l) { return v < l.id; });
+        locs.insert(locs.end(), it, c.msgs.end());
+    }
+    std::sort(locs.begin(), locs.end(), [](const Loc& a, const Loc& b) { return a.id < b.id; });
+
+    size_t delivered = 0;
+    char key[MSG_KEY_MAX + 1];
+    for (const Loc& loc : locs) {
+        if (!readRecord(loc, _scratch)) continue;
+        size_t keyLen = _scratch[REC_HEADER];
+        memcpy(key, _scratch + REC_HEADER + 1, keyLen);
+        key[keyLen] = '\0';
+        size_t bodyOff = REC_HEADER + 1 + keyLen;
+        fn(ctx, key, loc.id, (const char*)_scratch + bodyOff, loc.len - bodyOff);
+        delivered++;
+    }
+    return delivered;
+}
+
+// =============================================================================
+// Compaction
+// =============================================================================
+
+bool MsgStore::needsCompaction() const {
+    MsgStoreStats st;
+    getStats(st);
+    uint32_t dead = st.totalBytes - st.liveBytes;
+    return dead >= COMPACT_MIN_DEAD && dead > st.liveBytes;
+}
+
+bool MsgStore::compact() {
+    if (!_open) return false;
+    const size_t oldCount = _segs.size();
+
+    uint8_t* chunk = (uint8_t*)heapTagPsMalloc(HeapTag::MESH, COPY_CHUNK);
+    if (!chunk) return false;
+    size_t chunkLen = 0;
+
+    // New locations, in the same order as the conversations' msgs
+    Vec<Loc> moved;
+    size_t total = 0;
+    for (const Conv& c : _convs) total += c.msgs.size();
+    moved.reserve(total);
+
+    bool ok = true;
+    _appendable = false;
+    auto flush = [&]() {
+        if (chunkLen && !_appendFile->append(chunk, chunkLen)) ok = false;
+        chunkLen = 0;
+    };
+    for (Conv& c : _convs) {
+        for (Loc& loc : c.msgs) {
+            if (!ok) break;
+            if (!readRecord(loc, _scratch)) {
+                // Unreadable now; drop it rather than copy garbage
+                moved.push_back({loc.id, 0, UINT16_MAX, 0});
+                continue;
+            }
+            if (!_appendable || _segs.back().size + loc.len > MSG_SEGMENT_MAX) {
+                if (_appendable) flush();
+                if (!ok || !startSegment()) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (chunkLen + loc.len > COPY_CHUNK) flush();
+            memcpy(chunk + chunkLen, _scratch, loc.len);
+            chunkLen += loc.len;
+            moved.push_back({loc.id, _segs.back().size, (uint16_t)(_segs.size() - 1), loc.len});
+            _segs.back().size += loc.len;
+        }
+    }
+    if (ok && _appendable) flush();
+    heapTagFree(HeapTag::MESH, chunk);
+    delete _appendFile;
+    _appendFile = nullptr;
+    delete _readFile;
+    _readFile = nullptr;
+
+    char path[sizeof(_dir) + 14];
+    if (!ok) {
+        // Back out: the old segments still hold everything
+        while (_segs.size() > oldCount) {
+            segPath(_segs.back().number, path);
+            _io.remove(path);
+            _segs.pop_back();
+        }
+        _appendable = false;
+        return false;
+    }
+
+    // Oldest first, so a delete record never outlives what it deleted
+    for (size_t i = 0; i < oldCount; i++) {
+        segPath(_segs[i].number, path);
+        _io.remove(path);
+    }
+    _segs.erase(_segs.begin(), _segs.begin() + oldCount);
+
+    size_t m = 0;
+    _liveBytes = 0;
+    for (size_t ci = 0; ci < _convs.size();) {
+        Conv& c = _convs[ci];
+        size_t keep = 0;
+        for (size_t i = 0; i < c.msgs.size(); i++) {
+            const Loc& nl = moved[m++];
+            if (nl.seg == UINT16_MAX) continue;
+            c.msgs[keep] = nl;
+            c.msgs[keep].seg = (uint16_t)(nl.seg - oldCount);
+            _liveBytes += nl.len;
+            keep++;
+        }
+        c.msgs.resize(keep);
+        if (keep == 0) {
+            _convs.erase(_convs.begin() + ci);
+        } else {
+            ci++;
+        }
+    }
+    _tornBytes = 0;
+    _appendable = !_segs.empty() && _segs.back().size < MSG_SEGMENT_MAX;
+    _compactions++;
+    return true;
+}
+
+void MsgStore::getStats(MsgStoreStats& out) const {
+    out.conversations = (uint32_t)_convs.size();
+    out.messages = 0;
+    for (const Conv& c : _convs) out.messages += (uint32_t)c.msgs.size();
+    out.segments = (uint32_t)_segs.size();
+    out.totalBytes = 0;
+    for (const Seg& s : _segs) out.totalBytes += s.size;
+    out.liveBytes = _liveBytes;
+    out.tornBytes = _tornBytes;
+    out.compactions = _compactions;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "heap_tags.h"
+
+// Log-structured message store: DM and channel history as records
+// appended to segment files, with a per-conversation index in RAM.
+//
+// A conversation is any key up to MSG_KEY_MAX bytes ("dm:<pubkey hex>",
+// "ch:#Public"); a message is an opaque body (the Lua side stores JSON)
+// with a store-wide id that only grows. Adding a message, replacing its
+// body (a delivery status change) and deleting it each append one small
+// record to the newest segment, so the cost of a write doesn't depend on
+// how much history there is. Replacements and deletes leave the old
+// record behind as dead bytes; compact() rewrites the live records into
+// fresh segments once dead bytes outweigh live ones.
+//
+// Segment files are `<dir>/<8 digit number>.seg`: an 8-byte header
+// ("EZMS", version) followed by records, each
+//   u8 magic, u8 type, u16 payload length, u32 id, u32 crc32, payload
+// where the payload is a u8 key length, the key, then (for messages) the
+// body. The crc covers everything but itself. open() replays every
+// segment in order; a record that fails its check ends that segment
+// (a write cut short by power loss), and appends continue in a new
+// segment rather than after the torn bytes, so nothing already written
+// is ever modified.
+//
+// Not thread-safe; the firmware drives it from the Lua main thread. No
+// Arduino dependencies: file access goes through MsgStoreIO (see
+// tools/bench/msg_store_check.cpp for the stdio version).
+
+static constexpr size_t MSG_KEY_MAX = 80;
+static constexpr size_t MSG_BODY_MAX = 2048;
+static constexpr uint32_t MSG_SEGMENT_MAX = 64 * 1024;
+
+// CRC-32 (IEEE) of p[0..len), continuing from `crc` (0 to start).
+uint32_t msgStoreCrc32(const uint8_t* p, size_t len, uint32_t crc = 0);
+
+// One segment file, opened by MsgStoreIO::open().
+class MsgStoreFile {
+public:
+    virtual ~MsgStoreFile() = default;
+    // Read up to `len` bytes at `offset`; returns bytes read.
+    virtual size_t read(uint32_t offset, void* buf, size_t len) = 0;
+    // Append at the end and flush to the medium; false on a short write.
+    virtual bool append(const void* buf, size_t len) = 0;
+    virtual uint32_t size() = 0;
+    // Close any underlying handle; the next call reopens it. For callers
+    // juggling more files than the filesystem allows open at once.
+    virtual void release() {}
+};
+
+class MsgStoreIO {
+public:
+    virtual ~MsgStoreIO() = default;
+    // nullptr if the file is missing (and `create` is false) or can't be
+    // opened. Deleting the returned object closes it.
+    virtual MsgStoreFile* open(const char* path, bool create) = 0;
+    virtual bool remove(const char* path) = 0;
+    virtual bool mkdir(const char* path) = 0;
+    // Call fn(ctx, name) for each file directly inside `dir`.
+    virtual void list(const char* dir, void (*fn)(void* ctx, const char* name), void* ctx) = 0;
+};
+
+struct MsgStoreStats {
+    uint32_t conversations;
+    uint32_t messages;
+    uint32_t segments;
+    uint32_t totalBytes;    // Valid bytes across all segments
+    uint32_t liveBytes;     // Of which current message records
+    uint32_t tornBytes;     // Skipped at open() after a failed check
+    uint32_t compactions;
+};
+
+class MsgStore {
+public:
+    // Called by fetch() once per message, oldest first. `body` is only
+    // valid during the call.
+    using FetchFn = void (*)(void* ctx, uint32_t id, const char* body, size_t len);
+    // Same, for lookups across conversations
+    using ScanFn = void (*)(void* ctx, const char* key, uint32_t id,
+                            const char* body, size_t len);
+
+    explicit MsgStore(MsgStoreIO& io) : _io(io) {}
+    ~MsgStore() { close(); }
+    MsgStore(const MsgStore&) = delete;
+    MsgStore& operator=(const MsgStore&) = delete;
+
+    // Create `dir` if needed and replay its segments. Reopening closes
+    // whatever was open first.
+    bool open(const char* dir);
+    void close();
+    bool isOpen() const { return _open; }
+    const char* dir() const { return _dir; }
+    // Close the cached segment handles (reopened on the next read or
+    // write), freeing them for another user of the filesystem.
+    void closeFiles();
+
+    // Returns the new message's id, 0 on failure (key or body too long,
+    // write error).
+    uint32_t append(const char* key, const char* body, size_t len);
+    // Replace the body of message `id` in conversation `key`.
+    bool update(const char* key, uint32_t id, const char* body, size_t len);
+    bool remove(const char* key, uint32_t id);
+    // Delete a whole conversation.
+    bool drop(const char* key);
+
+    // Up to `n` messages of `key` older than `beforeId` (0 for the newest),
+    // passed to fn oldest first. Returns how many were delivered; *more is
+    // set when older messages remain.
+    size_t fetch(const char* key, uint32_t beforeId, size_t n,
+                 FetchFn fn, void* ctx, bool* more = nullptr);
+    size_t count(const char* key) const;
+
+    bool contains(uint32_t id) const;
+    // Message `id` in whichever conversation holds it; false if none does.
+    bool fetchById(uint32_t id, ScanFn fn, void* ctx);
+    // Every message with an id above `afterId`, in id order. Returns how
+    // many were delivered. Holds their locations in RAM, so meant for
+    // catching up on recent history rather than walking all of it.
+    size_t scanSince(uint32_t afterId, ScanFn fn, void* ctx);
+
+    size_t conversationCount() const { return _convs.size(); }
+    const char* conversationKey(size_t i) const { return _convs[i].key; }
+    size_t conversationSize(size_t i) const { return _convs[i].msgs.size(); }
+
+    // Dead bytes are at least COMPACT_MIN_DEAD and exceed the live bytes.
+    bool needsCompaction() const;
+    // Copy every live record into new segments and delete the old ones.
+    // False (store unchanged) if a write fails. Blocks for as long as the
+    // copy takes: about the live bytes read once and written once.
+    bool compact();
+
+    void getStats(MsgStoreStats& out) const;
+
+    static constexpr uint32_t COMPACT_MIN_DEAD = 32 * 1024;
+
+private:
+    template <typename T>
+    using Vec = std::vector<T, HeapTagAllocator<T, HeapTag::MESH>>;
+
+    struct Loc {
+        uint32_t id;
+        uint32_t offset;    // Record start within the segment
+        uint16_t seg;       // Index into _segs
+        uint16_t len;       // Whole record, header included
+    };
+    struct Conv {
+        char key[MSG_KEY_MAX + 1];
+        Vec<Loc> msgs;      // Ascending id
+    };
+    struct Seg {
+        uint32_t number;
+        uint32_t size;      // Valid bytes; appends only go to the last
+    };
+
+    Conv* findConv(const char* key, size_t keyLen);
+    const Conv* findConv(const char* key) const;
+    Conv* addConv(const char* key, size_t keyLen);
+    static Loc* findLoc(Vec<Loc>& msgs, uint32_t id);
+
+    void segPath(uint32_t number, char* out) const;
+    MsgStoreFile* segFile(uint16_t seg);
+    bool replaySegment(uint16_t seg);
+    void apply(uint8_t type, uint32_t id, const char* key, size_t keyLen,
+               uint16_t seg, uint32_t offset, uint16_t len);
+    bool writeRecord(uint8_t type, uint32_t id, const char* key, size_t keyLen,
+                     const char* body, size_t bodyLen);
+    bool startSegment();
+    bool readRecord(const Loc& loc, uint8_t* buf);
+
+    MsgStoreIO& _io;
+    char _dir[64] = {};
+    bool _open = false;
+    Vec<Conv> _convs;
+    Vec<Seg> _segs;
+    bool _appendable = false;       // Last segment takes appends
+    MsgStoreFile* _readFile = nullptr;
+    uint16_t _readSeg = 0;
+    MsgStoreFile* _appendFile = nullptr;
+    uint32_t _nextId = 1;
+    uint32_t _liveBytes = 0;
+    uint32_t _tornBytes = 0;
+    uint32_t _compactions = 0;
+    uint8_t _scratch[12 + 1 + MSG_KEY_MAX + MSG_BODY_MAX];
+};
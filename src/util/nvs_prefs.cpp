@@ -0,0 +1,241 @@
+#include "nvs_prefs.h"
+
+#include "heap_tags.h"
+#include "log.h"
+
+#include <Arduino.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <string.h>
+
+namespace {
+
+const char* NAMESPACE = "lua_storage";
+
+class NvsSink : public PrefSink {
+public:
+    explicit NvsSink(nvs_handle_t h) : _h(h) {}
+
+    bool put(const char* key, const PrefValue& v, PrefType stored) override {
+        // NVS keeps one entry per key and type; a set of another type
+        // would leave the old entry behind for the loader to find
+        if (stored != PrefType::NONE && stored != v.type && !erase(key)) return false;
+        esp_err_t err;
+        switch (v.type) {
+            case PrefType::I8:    err = nvs_set_i8(_h, key, (int8_t)v.i); break;
+            case PrefType::U8:    err = nvs_set_u8(_h, key, (uint8_t)v.i); break;
+            case PrefType::I16:   err = nvs_set_i16(_h, key, (int16_t)v.i); break;
+            case PrefType::U16:   err = nvs_set_u16(_h, key, (uint16_t)v.i); break;
+            case PrefType::I32:   err = nvs_set_i32(_h, key, (int32_t)v.i); break;
+            case PrefType::U32:   err = nvs_set_u32(_h, key, (uint32_t)v.i); break;
+            case PrefType::I64:   err = nvs_set_i64(_h, key, v.i); break;
+            case PrefType::U64:   err = nvs_set_u64(_h, key, (uint64_t)v.i); break;
+            case PrefType::FLOAT: err = nvs_set_blob(_h, key, &v.f, sizeof(v.f)); break;
+            case PrefType::STR:   err = nvs_set_str(_h, key, v.data); break;
+            case PrefType::BLOB:  err = nvs_set_blob(_h, key, v.data, v.len); break;
+            default:              return false;
+        }
+        if (err != ESP_OK) {
+            LOG_WARN("Prefs", "Writing %s failed: %s", key, esp_err_to_name(err));
+        }
+        return err == ESP_OK;
+    }
+
+    bool erase(const char* key) override {
+        esp_err_t err = nvs_erase_key(_h, key);
+        return err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    bool commit() override {
+        return nvs_commit(_h) == ESP_OK;
+    }
+
+private:
+    nvs_handle_t _h;
+};
+
+// Read one entry as the cache holds it. A 4-byte blob is a float: only
+// set_pref writes this namespace, and it writes no other blobs that size.
+bool loadEntry(nvs_handle_t h, const nvs_entry_info_t& info, PrefCache& cache) {
+    const char* key = info.key;
+    switch (info.type) {
+#define PREF_INT(nvsType, cType, getter, prefType)                          \
+        case nvsType: {                                                     \
+            cType v;                                                        \
+            if (getter(h, key, &v) != ESP_OK) return false;                 \
+            return cache.load(key, PrefValue::integer(prefType, (int64_t)v)); \
+        }
+        PREF_INT(NVS_TYPE_I8,  int8_t,   nvs_get_i8,  PrefType::I8)
+        PREF_INT(NVS_TYPE_U8,  uint8_t,  nvs_get_u8,  PrefType::U8)
+        PREF_INT(NVS_TYPE_I16, int16_t,  nvs_get_i16, PrefType::I16)
+        PREF_INT(NVS_TYPE_U16, uint16_t, nvs_get_u16, PrefType::U16)
+        PREF_INT(NVS_TYPE_I32, int32_t,  nvs_get_i32, PrefType::I32)
+        PREF_INT(NVS_TYPE_U32, uint32_t, nvs_get_u32, PrefType::U32)
+        PREF_INT(NVS_TYPE_I64, int64_t,  nvs_get_i64, PrefType::I64)
+        PREF_INT(NVS_TYPE_U64, uint64_t, nvs_get_u64, PrefType::U64)
+#undef PREF_INT
+        case NVS_TYPE_STR: {
+            size_t len = 0;
+            if (nvs_get_str(h, key, nullptr, &len) != ESP_OK || len == 0) return false;
+            char* buf = (char*)heapTagMalloc(HeapTag::STORAGE, len);
+            if (!buf) return false;
+            bool ok = nvs_get_str(h, key, buf, &len) == ESP_OK &&
+                      cache.load(key, PrefValue::string(buf, strlen(buf)));
+            heapTagFree(HeapTag::STORAGE, buf);
+            return ok;
+        }
+        case NVS_TYPE_BLOB: {
+            size_t len = 0;
+            if (nvs_get_blob(h, key, nullptr, &len) != ESP_OK) return false;
+            if (len == sizeof(float)) {
+                float f;
+                if (nvs_get_blob(h, key, &f, &len) != ESP_OK) return false;
+                return cache.load(key, PrefValue::number(f));
+            }
+            char* buf = (char*)heapTagMalloc(HeapTag::STORAGE, len ? len : 1);
+            if (!buf) return false;
+            bool ok = nvs_get_blob(h, key, buf, &len) == ESP_OK &&
+                      cache.load(key, PrefValue::blob(buf, len));
+            heapTagFree(HeapTag::STORAGE, buf);
+            return ok;
+        }
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+NvsPrefs& NvsPrefs::instance() {
+    static NvsPrefs inst;
+    return inst;
+}
+
+NvsPrefs::NvsPrefs()
+    : _mutex(xSemaphoreCreateMutex()), _cache(DEBOUNCE_MS, MAX_DELAY_MS) {}
+
+void NvsPrefs::lock() {
+    xSemaphoreTake((SemaphoreHandle_t)_mutex, portMAX_DELAY);
+}
+
+void NvsPrefs::unlock() {
+    xSemaphoreGive((SemaphoreHandle_t)_mutex);
+}
+
+bool NvsPrefs::begin() {
+    if (_open) return true;
+    lock();
+    if (_open) {
+        unlock();
+        return true;
+    }
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(NAMESPACE, NVS_READWRITE, &h);
+    if (err != ESP_OK) {
+        unlock();
+        LOG_ERROR("Prefs", "Opening NVS namespace %s failed: %s", NAMESPACE, esp_err_to_name(err));
+        return false;
+    }
+    _handle = h;
+
+    uint32_t start = millis();
+    int loaded = 0;
+    int failed = 0;
+    nvs_iterator_t it = nvs_entry_find("nvs", NAMESPACE, NVS_TYPE_ANY);
+    while (it != nullptr) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        if (loadEntry(h, info, _cache)) {
+            loaded++;
+        } else {
+            failed++;
+        }
+        it = nvs_entry_next(it);
+    }
+    _open = true;
+    unlock();
+
+    esp_register_shutdown_handler(&NvsPrefs::flushAtShutdown);
+    LOG("Prefs", "Loaded %d prefs in %u ms (%u bytes)", loaded,
+        (unsigned)(millis() - start), (unsigned)memoryBytes());
+    if (failed) LOG_WARN("Prefs", "%d prefs could not be read", failed);
+    return true;
+}
+
+bool NvsPrefs::set(const char* key, const PrefValue& v) {
+    if (!begin()) return false;
+    lock();
+    bool ok = _cache.set(key, v, millis());
+    unlock();
+    return ok;
+}
+
+bool NvsPrefs::remove(const char* key) {
+    if (!begin()) return false;
+    lock();
+    bool ok = _cache.remove(key, millis());
+    unlock();
+    return ok;
+}
+
+bool NvsPrefs::clear() {
+    if (!begin()) return false;
+    lock();
+    bool ok = nvs_erase_all(_handle) == ESP_OK && nvs_commit(_handle) == ESP_OK;
+    if (ok) _cache.clear();
+    unlock();
+    return ok;
+}
+
+void NvsPrefs::update() {
+    if (!_open) return;
+    lock();
+    if (_cache.due(millis())) flushLocked();
+    unlock();
+}
+
+bool NvsPrefs::flush() {
+    if (!_open) return true;
+    lock();
+    bool ok = flushLocked();
+    unlock();
+    return ok;
+}
+
+bool NvsPrefs::flushLocked() {
+    if (!_cache.dirty()) return true;
+    NvsSink sink(_handle);
+    bool ok = _cache.flush(sink, millis());
+    if (!ok) {
+        PrefCacheStats after;
+        _cache.getStats(after);
+        LOG_WARN("Prefs", "Write-back incomplete, %u prefs still pending", (unsigned)after.dirty);
+    }
+    return ok;
+}
+
+void NvsPrefs::flushAtShutdown() {
+    // A short wait: if whoever holds the lock never gives it back, the
+    // restart matters more than the last few changes
+    NvsPrefs& p = instance();
+    if (!p._open) return;
+    if (xSemaphoreTake((SemaphoreHandle_t)p._mutex, pdMS_TO_TICKS(100)) != pdTRUE) return;
+    p.flushLocked();
+    xSemaphoreGive((SemaphoreHandle_t)p._mutex);
+}
+
+void NvsPrefs::getStats(PrefCacheStats& out) {
+    lock();
+    _cache.getStats(out);
+    unlock();
+}
+
+size_t NvsPrefs::memoryBytes() {
+    lock();
+    size_t n = _cache.memoryBytes();
+    unlock();
+    return n;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "pref_cache.h"
+
+// The Lua preferences (NVS namespace "lua_storage") held in RAM (see
+// pref_cache.h) for ez.storage's get_pref/set_pref and friends.
+//
+// begin() opens the namespace and reads every key once; main.cpp calls it
+// at boot and every other call makes sure of it. Changes are written back
+// by update() from the main loop once they settle, by flush() before a
+// restart or sleep (ez.system), and by a shutdown handler for any other
+// esp_restart(). clear() erases the namespace at once.
+//
+// Safe from any task: the cache is under a mutex, and read() and list()
+// hand values out only while holding it.
+class NvsPrefs {
+public:
+    static constexpr uint32_t DEBOUNCE_MS = 1500;
+    static constexpr uint32_t MAX_DELAY_MS = 10000;
+
+    static NvsPrefs& instance();
+
+    bool begin();
+
+    // Calls fn(const PrefValue&) if key is set; returns whether it was
+    template<typename Fn>
+    bool read(const char* key, Fn fn) {
+        begin();
+        lock();
+        const PrefValue* v = _cache.get(key);
+        if (v) fn(*v);
+        unlock();
+        return v != nullptr;
+    }
+
+    bool set(const char* key, const PrefValue& v);
+    bool remove(const char* key);
+    bool clear();
+
+    // Calls fn(const char* key, const PrefValue&) for every key
+    template<typename Fn>
+    void list(Fn fn) {
+        begin();
+        lock();
+        _cache.forEach(fn);
+        unlock();
+    }
+
+    // Write back if changes are due (main loop)
+    void update();
+    // Write back now; false if anything failed
+    bool flush();
+
+    void getStats(PrefCacheStats& out);
+    size_t memoryBytes();
+
+private:
+    NvsPrefs();
+    void lock();
+    void unlock();
+    bool flushLocked();
+    static void flushAtShutdown();
+
+    void* _mutex;
+    uint32_t _handle = 0;
+    bool _open = false;
+    PrefCache _cache;
+};
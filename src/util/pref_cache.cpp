@@ -0,0 +1,275 @@
+#include "pref_cache.h"
+
+#include "heap_tags.h"
+
+#include <string.h>
+
+PrefValue PrefValue::integer(PrefType type, int64_t v) {
+    PrefValue out;
+    out.type = type;
+    out.i = v;
+    return out;
+}
+
+PrefValue PrefValue::number(float v) {
+    PrefValue out;
+    out.type = PrefType::FLOAT;
+    out.f = v;
+    return out;
+}
+
+PrefValue PrefValue::string(const char* s, size_t len) {
+    PrefValue out;
+    out.type = PrefType::STR;
+    out.data = s;
+    out.len = len;
+    return out;
+}
+
+PrefValue PrefValue::blob(const void* p, size_t len) {
+    PrefValue out;
+    out.type = PrefType::BLOB;
+    out.data = (const char*)p;
+    out.len = len;
+    return out;
+}
+
+PrefCache::PrefCache(uint32_t debounceMs, uint32_t maxDelayMs)
+    : _debounceMs(debounceMs), _maxDelayMs(maxDelayMs) {}
+
+PrefCache::~PrefCache() {
+    clear();
+    heapTagFree(HeapTag::STORAGE, _table);
+}
+
+uint32_t PrefCache::hash(const char* key) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (const char* p = key; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+PrefCache::Entry* PrefCache::find(const char* key) const {
+    if (!_table) return nullptr;
+    uint32_t mask = _capacity - 1;
+    for (uint32_t i = hash(key) & mask;; i = (i + 1) & mask) {
+        Entry& e = _table[i];
+        if (!e.used) return nullptr;
+        if (strcmp(e.key, key) == 0) return &e;
+    }
+}
+
+PrefCache::Entry* PrefCache::insert(const char* key) {
+    Entry* e = find(key);
+    if (e) return e;
+    // Keep the table at most three quarters full so probes stay short
+    // and always reach an empty slot
+    if ((_used + 1) * 4 > _capacity * 3 && !grow()) return nullptr;
+
+    uint32_t mask = _capacity - 1;
+    uint32_t i = hash(key) & mask;
+    while (_table[i].used) i = (i + 1) & mask;
+    e = &_table[i];
+    *e = Entry();
+    strcpy(e->key, key);
+    e->used = true;
+    _used++;
+    return e;
+}
+
+bool PrefCache::grow() {
+    // Removed keys the sink no longer holds are dropped on the way
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < _capacity; i++) {
+        const Entry& e = _table[i];
+        if (e.used && (e.value.type != PrefType::NONE || e.stored != PrefType::NONE)) live++;
+    }
+    uint32_t capacity = 16;
+    while ((live + 1) * 2 > capacity) capacity *= 2;
+
+    Entry* table = (Entry*)heapTagMalloc(HeapTag::STORAGE, capacity * sizeof(Entry));
+    if (!table) return false;
+    for (uint32_t i = 0; i < capacity; i++) table[i] = Entry();
+
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i < _capacity; i++) {
+        const Entry& e = _table[i];
+        if (!e.used || (e.value.type == PrefType::NONE && e.stored == PrefType::NONE)) continue;
+        uint32_t j = hash(e.key) & mask;
+        while (table[j].used) j = (j + 1) & mask;
+        table[j] = e;
+    }
+    heapTagFree(HeapTag::STORAGE, _table);
+    _table = table;
+    _capacity = capacity;
+    _used = live;
+    return true;
+}
+
+bool PrefCache::same(const PrefValue& a, const PrefValue& b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case PrefType::NONE:
+            return true;
+        case PrefType::FLOAT:
+            return memcmp(&a.f, &b.f, sizeof(a.f)) == 0;
+        case PrefType::STR:
+        case PrefType::BLOB:
+            return a.len == b.len && memcmp(a.data, b.data, a.len) == 0;
+        default:
+            return a.i == b.i;
+    }
+}
+
+void PrefCache::release(PrefValue& v) {
+    if (v.type == PrefType::STR || v.type == PrefType::BLOB) {
+        heapTagFree(HeapTag::STORAGE, (void*)v.data);
+    }
+    v = PrefValue();
+}
+
+bool PrefCache::assign(Entry& e, const PrefValue& v) {
+    PrefValue copy = v;
+    if (v.type == PrefType::STR || v.type == PrefType::BLOB) {
+        // NUL-terminated either way so a STR can be handed out as is
+        char* p = (char*)heapTagMalloc(HeapTag::STORAGE, v.len + 1);
+        if (!p) return false;
+        if (v.len) memcpy(p, v.data, v.len);
+        p[v.len] = '\0';
+        copy.data = p;
+    } else {
+        copy.data = nullptr;
+        copy.len = 0;
+    }
+    _valueBytes -= e.value.data ? e.value.len + 1 : 0;
+    release(e.value);
+    e.value = copy;
+    _valueBytes += copy.data ? copy.len + 1 : 0;
+    return true;
+}
+
+void PrefCache::markDirty(Entry& e, uint32_t now) {
+    // A key set and removed again between flushes leaves nothing to write
+    bool dirty = !(e.value.type == PrefType::NONE && e.stored == PrefType::NONE);
+    if (dirty && !e.dirty) {
+        if (_dirty == 0) _firstChange = now;
+        _dirty++;
+    } else if (!dirty && e.dirty) {
+        _dirty--;
+    }
+    e.dirty = dirty;
+    _lastChange = now;
+}
+
+bool PrefCache::load(const char* key, const PrefValue& v) {
+    if (strlen(key) > KEY_MAX || v.type == PrefType::NONE) return false;
+    Entry* e = insert(key);
+    if (!e || !assign(*e, v)) return false;
+    e->stored = v.type;
+    if (e->dirty) {
+        e->dirty = false;
+        _dirty--;
+    }
+    return true;
+}
+
+const PrefValue* PrefCache::get(const char* key) {
+    _stats.reads++;
+    Entry* e = find(key);
+    if (!e || e->value.type == PrefType::NONE) {
+        _stats.misses++;
+        return nullptr;
+    }
+    return &e->value;
+}
+
+bool PrefCache::set(const char* key, const PrefValue& v, uint32_t now) {
+    if (strlen(key) > KEY_MAX || v.type == PrefType::NONE) return false;
+    if ((v.type == PrefType::STR || v.type == PrefType::BLOB) && v.len > VALUE_MAX) return false;
+
+    Entry* e = insert(key);
+    if (!e) return false;
+    if (same(e->value, v)) {
+        _stats.unchanged++;
+        return true;
+    }
+    if (!assign(*e, v)) return false;
+    _stats.changes++;
+    markDirty(*e, now);
+    return true;
+}
+
+bool PrefCache::remove(const char* key, uint32_t now) {
+    Entry* e = find(key);
+    if (!e || e->value.type == PrefType::NONE) return false;
+    assign(*e, PrefValue());
+    _stats.changes++;
+    markDirty(*e, now);
+    return true;
+}
+
+void PrefCache::clear() {
+    for (uint32_t i = 0; i < _capacity; i++) {
+        Entry& e = _table[i];
+        if (e.used) release(e.value);
+        e.used = false;
+    }
+    _used = 0;
+    _dirty = 0;
+    _valueBytes = 0;
+}
+
+bool PrefCache::due(uint32_t now) const {
+    if (_dirty == 0) return false;
+    return now - _lastChange >= _debounceMs || now - _firstChange >= _maxDelayMs;
+}
+
+bool PrefCache::flush(PrefSink& sink, uint32_t now) {
+    if (_dirty == 0) return true;
+    _stats.flushes++;
+
+    bool ok = true;
+    for (uint32_t i = 0; i < _capacity; i++) {
+        Entry& e = _table[i];
+        if (!e.used || !e.dirty) continue;
+        bool done;
+        if (e.value.type == PrefType::NONE) {
+            done = sink.erase(e.key);
+            if (done) _stats.erased++;
+        } else {
+            done = sink.put(e.key, e.value, e.stored);
+            if (done) _stats.stored++;
+        }
+        if (!done) {
+            _stats.failures++;
+            ok = false;
+            continue;
+        }
+        e.stored = e.value.type;
+        e.dirty = false;
+        _dirty--;
+    }
+    // One commit for the whole batch
+    if (!sink.commit()) {
+        _stats.failures++;
+        ok = false;
+    }
+    // Whatever failed waits out another debounce before the retry
+    _firstChange = _lastChange = now;
+    return ok;
+}
+
+void PrefCache::getStats(PrefCacheStats& out) const {
+    out = _stats;
+    uint32_t keys = 0;
+    forEach([&](const char*, const PrefValue&) { keys++; });
+    out.keys = keys;
+    out.dirty = _dirty;
+}
+
+size_t PrefCache::memoryBytes() const {
+    return _capacity * sizeof(Entry) + _valueBytes;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory copy of a preferences namespace, written back in batches.
+//
+// Screens read the same handful of prefs (theme, fonts, key repeat, radio
+// settings) every time they build or redraw, and every read through
+// Preferences is a key lookup in the NVS page cache under its lock. A
+// slider or a settings screen writes the same key many times a second,
+// and each of those writes appends a new entry to flash and erases the
+// old one.
+//
+// The cache holds every key of the namespace in an open-addressed table
+// with its NVS type, loaded once with load(). get() is a hash lookup.
+// set() and remove() change only the cached entry and mark it dirty; a
+// set() to the value already held changes nothing. flush() writes the
+// dirty entries to a PrefSink and commits once. due() says when to flush:
+// DEBOUNCE after the last change, or MAX_DELAY after the first unflushed
+// one if the changes keep coming, so a slider drag costs one flash write
+// for the value it lands on. Entries that fail to write stay dirty and
+// are tried again on the next flush.
+//
+// Not thread-safe; see nvs_prefs.h for the locked NVS wrapper. No Arduino
+// dependencies (see tools/bench/pref_cache_check.cpp).
+
+enum class PrefType : uint8_t {
+    NONE,
+    I8, U8, I16, U16, I32, U32, I64, U64,
+    FLOAT,      // A 4-byte blob, as Preferences::putFloat stores it
+    STR,
+    BLOB,
+};
+
+// A value as passed to set()/load(); data is copied. As returned by get(),
+// data belongs to the cache and is valid until the key next changes.
+struct PrefValue {
+    PrefType type = PrefType::NONE;
+    int64_t i = 0;                  // Integer types (U64 reinterpreted)
+    float f = 0;                    // FLOAT
+    const char* data = nullptr;     // STR (NUL-terminated) and BLOB
+    size_t len = 0;                 // Bytes at data, without the NUL
+
+    static PrefValue integer(PrefType type, int64_t v);
+    static PrefValue number(float v);
+    static PrefValue string(const char* s, size_t len);
+    static PrefValue blob(const void* p, size_t len);
+};
+
+struct PrefCacheStats {
+    uint32_t reads;         // get() calls
+    uint32_t misses;        // Of those, for keys not set
+    uint32_t changes;       // set()/remove() calls that changed a value
+    uint32_t unchanged;     // set() calls with the value already held
+    uint32_t flushes;       // Batches written to the sink
+    uint32_t stored;        // Entries written by them
+    uint32_t erased;        // Entries erased by them
+    uint32_t failures;      // Writes and commits that failed
+    uint32_t keys;          // Keys held
+    uint32_t dirty;         // Keys changed since the last flush
+};
+
+// Where flush() writes to
+class PrefSink {
+public:
+    virtual ~PrefSink() {}
+    // `stored` is the type the sink already holds under key (NONE if
+    // none); a put of a different type must replace it
+    virtual bool put(const char* key, const PrefValue& v, PrefType stored) = 0;
+    virtual bool erase(const char* key) = 0;
+    virtual bool commit() = 0;
+};
+
+class PrefCache {
+public:
+    static constexpr size_t KEY_MAX = 15;          // NVS key name limit
+    static constexpr size_t VALUE_MAX = 4000;      // NVS string/blob limit
+
+    PrefCache(uint32_t debounceMs, uint32_t maxDelayMs);
+    ~PrefCache();
+    PrefCache(const PrefCache&) = delete;
+    PrefCache& operator=(const PrefCache&) = delete;
+
+    // Add an entry as the sink already holds it (clean)
+    bool load(const char* key, const PrefValue& v);
+
+    // nullptr if the key isn't set
+    const PrefValue* get(const char* key);
+    // False for a bad key, an oversized value or no memory
+    bool set(const char* key, const PrefValue& v, uint32_t now);
+    // False if the key wasn't set
+    bool remove(const char* key, uint32_t now);
+    // Forget everything, clean: the caller has already erased the sink
+    void clear();
+
+    // Each key that is set, with its value
+    template<typename Fn>
+    void forEach(Fn fn) const {
+        for (uint32_t i = 0; i < _capacity; i++) {
+            const Entry& e = _table[i];
+            if (e.used && e.value.type != PrefType::NONE) fn(e.key, e.value);
+        }
+    }
+
+    bool dirty() const { return _dirty != 0; }
+    bool due(uint32_t now) const;
+    // Write every dirty entry and commit. False if anything failed.
+    bool flush(PrefSink& sink, uint32_t now);
+
+    void getStats(PrefCacheStats& out) const;
+    size_t memoryBytes() const;
+
+private:
+    struct Entry {
+        char key[KEY_MAX + 1];
+        PrefValue value;        // NONE once removed
+        PrefType stored;        // What the sink holds under key
+        bool used;
+        bool dirty;
+    };
+
+    static uint32_t hash(const char* key);
+    Entry* find(const char* key) const;
+    Entry* insert(const char* key);
+    bool grow();
+    bool assign(Entry& e, const PrefValue& v);
+    static bool same(const PrefValue& a, const PrefValue& b);
+    static void release(PrefValue& v);
+    void markDirty(Entry& e, uint32_t now);
+
+    uint32_t _debounceMs;
+    uint32_t _maxDelayMs;
+    Entry* _table = nullptr;
+    uint32_t _capacity = 0;     // Power of two
+    uint32_t _used = 0;         // Slots taken, removed keys included
+    uint32_t _dirty = 0;
+    uint32_t _firstChange = 0;  // Since the last flush
+    uint32_t _lastChange = 0;
+    size_t _valueBytes = 0;
+    PrefCacheStats _stats = {};
+};
@@ -0,0 +1,41 @@
+#include "read_coalescer.h"
+
+size_t planReadSpans(const ReadRange* ranges, size_t n, uint16_t* order,
+                     ReadSpan* spans, uint32_t maxGap, uint32_t maxSpan) {
+    if (n == 0) return 0;
+
+    // Insertion sort: batches are a handful of requests, and it is stable.
+    for (size_t i = 0; i < n; i++) {
+        uint16_t idx = (uint16_t)i;
+        size_t j = i;
+        while (j > 0 && ranges[order[j - 1]].offset > ranges[idx].offset) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = idx;
+    }
+
+    size_t count = 0;
+    ReadSpan* cur = nullptr;
+    uint64_t curEnd = 0;
+    for (size_t k = 0; k < n; k++) {
+        const ReadRange& r = ranges[order[k]];
+        uint64_t end = (uint64_t)r.offset + r.length;
+        if (cur) {
+            uint64_t mergedEnd = end > curEnd ? end : curEnd;
+            if ((uint64_t)r.offset <= curEnd + maxGap && mergedEnd - cur->offset <= maxSpan) {
+                curEnd = mergedEnd;
+                cur->length = (uint32_t)(curEnd - cur->offset);
+                cur->count++;
+                continue;
+            }
+        }
+        cur = &spans[count++];
+        cur->offset = r.offset;
+        cur->length = r.length;
+        cur->first = (uint16_t)k;
+        cur->count = 1;
+        curEnd = end;
+    }
+    return count;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read planning for batches of byte-range reads against one file.
+//
+// Given the pending ranges, planReadSpans() sorts them by offset (an
+// elevator pass over the file) and merges overlapping, adjacent or nearly
+// adjacent ranges into spans, so a batch costs one open and one seek+read
+// per span instead of per request. Reading a small gap is cheaper on SD
+// than a second command, so ranges up to `maxGap` bytes apart share a
+// span; `maxSpan` bounds the buffer a merged span needs.
+//
+// No Arduino dependencies (see tools/bench/read_coalesce_check.cpp).
+
+struct ReadRange {
+    uint32_t offset;
+    uint32_t length;    // Must be > 0
+};
+
+struct ReadSpan {
+    uint32_t offset;
+    uint32_t length;
+    uint16_t first;     // Index into `order` of the span's first range
+    uint16_t count;     // Ranges covered, consecutive in `order`
+};
+
+// Plan `n` ranges. Writes the offset order (indices into `ranges`) to
+// `order` and the spans to `spans` (both sized >= n); returns the span
+// count. A range longer than maxSpan still gets a span of its own. Ties
+// keep submission order.
+size_t planReadSpans(const ReadRange* ranges, size_t n, uint16_t* order,
+                     ReadSpan* spans, uint32_t maxGap, uint32_t maxSpan);
@@ -0,0 +1,181 @@
+#include "sd_block_cache.h"
+
+#include "log.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+extern "C" {
+#include "ff.h"
+#include "diskio.h"
+#include "diskio_impl.h"
+}
+
+// The SD library's FatFs driver (sd_diskio.cpp). The cache sits between
+// FatFs and these; they issue one CMD18/CMD25 for a multi-sector call.
+DSTATUS ff_sd_initialize(uint8_t pdrv);
+DSTATUS ff_sd_status(uint8_t pdrv);
+DRESULT ff_sd_read(uint8_t pdrv, uint8_t* buffer, DWORD sector, UINT count);
+DRESULT ff_sd_write(uint8_t pdrv, const uint8_t* buffer, DWORD sector, UINT count);
+DRESULT ff_sd_ioctl(uint8_t pdrv, uint8_t cmd, void* buff);
+
+namespace {
+
+class SdDisk : public BlockDevice {
+public:
+    bool readSectors(uint32_t sector, uint8_t* buf, uint32_t count) override {
+        last = ff_sd_read(pdrv, buf, sector, count);
+        return last == RES_OK;
+    }
+    bool writeSectors(uint32_t sector, const uint8_t* buf, uint32_t count) override {
+        last = ff_sd_write(pdrv, buf, sector, count);
+        return last == RES_OK;
+    }
+
+    uint8_t pdrv = 0;
+    DRESULT last = RES_OK;      // Passed back to FatFs on failure
+};
+
+BlockCacheConfig cacheConfig() {
+    BlockCacheConfig cfg;
+    cfg.blockSectors = SdBlockCache::BLOCK_SECTORS;
+    cfg.blocks = (uint32_t)SD_BLOCK_CACHE_KB * 1024 / (SdBlockCache::BLOCK_SECTORS * BlockCache::SECTOR_SIZE);
+    cfg.maxReadahead = SdBlockCache::MAX_READAHEAD;
+    cfg.bypassSectors = SdBlockCache::BYPASS_SECTORS;
+    return cfg;
+}
+
+SdDisk s_disk;
+BlockCache s_cache(s_disk, cacheConfig());
+
+DRESULT result(bool ok) {
+    if (ok) return RES_OK;
+    return s_disk.last != RES_OK ? s_disk.last : RES_ERROR;
+}
+
+DSTATUS diskInit(unsigned char pdrv) {
+    // FatFs only re-initialises after an error or a remount, and the card
+    // in the slot may not be the one that was cached
+    SdBlockCache::instance().invalidate();
+    return ff_sd_initialize(pdrv);
+}
+
+DSTATUS diskStatus(unsigned char pdrv) {
+    return ff_sd_status(pdrv);
+}
+
+DRESULT diskRead(unsigned char pdrv, unsigned char* buff, uint32_t sector, unsigned count) {
+    return result(SdBlockCache::instance().read(sector, buff, count));
+}
+
+DRESULT diskWrite(unsigned char pdrv, const unsigned char* buff, uint32_t sector, unsigned count) {
+    return result(SdBlockCache::instance().write(sector, buff, count));
+}
+
+// Writes are through, so CTRL_SYNC has nothing of ours to flush
+DRESULT diskIoctl(unsigned char pdrv, unsigned char cmd, void* buff) {
+    return ff_sd_ioctl(pdrv, cmd, buff);
+}
+
+const ff_diskio_impl_t CACHED_IMPL = {
+    .init = &diskInit,
+    .status = &diskStatus,
+    .read = &diskRead,
+    .write = &diskWrite,
+    .ioctl = &diskIoctl,
+};
+
+}  // namespace
+
+SdBlockCache& SdBlockCache::instance() {
+    static SdBlockCache inst;
+    return inst;
+}
+
+SdBlockCache::SdBlockCache() : _mutex(xSemaphoreCreateMutex()) {}
+
+void SdBlockCache::lock() {
+    xSemaphoreTake((SemaphoreHandle_t)_mutex, portMAX_DELAY);
+}
+
+void SdBlockCache::unlock() {
+    xSemaphoreGive((SemaphoreHandle_t)_mutex);
+}
+
+bool SdBlockCache::install() {
+    if (_installed) return true;
+    if (SD_BLOCK_CACHE_KB == 0) return false;
+
+    // The SD library mounts the card on the first free FatFs drive and
+    // nothing else here mounts FAT (the flash filesystem is LittleFS), so
+    // the card is drive 0 exactly when drive 1 is the next free one.
+    // Anything else and we leave the driver alone.
+    BYTE next = 0xFF;
+    if (ff_diskio_get_drive(&next) != ESP_OK || next != 1) {
+        LOG_WARN("SdCache", "SD is not the only FatFs drive (next free %u), not caching", next);
+        return false;
+    }
+    s_disk.pdrv = 0;
+    DWORD sectors = 0;
+    if (ff_sd_ioctl(s_disk.pdrv, GET_SECTOR_COUNT, &sectors) != RES_OK || sectors == 0) {
+        LOG_WARN("SdCache", "Couldn't read the card size, not caching");
+        return false;
+    }
+
+    lock();
+    bool ok = s_cache.begin(sectors);
+    unlock();
+    if (!ok) {
+        LOG_WARN("SdCache", "No memory for a %u KB cache", (unsigned)SD_BLOCK_CACHE_KB);
+        return false;
+    }
+    if (ff_diskio_register(s_disk.pdrv, &CACHED_IMPL) != ESP_OK) {
+        lock();
+        s_cache.end();
+        unlock();
+        return false;
+    }
+    _installed = true;
+    LOG("SdCache", "%u KB block cache on %u sectors", (unsigned)SD_BLOCK_CACHE_KB, (unsigned)sectors);
+    return true;
+}
+
+bool SdBlockCache::read(uint32_t sector, uint8_t* buf, uint32_t count) {
+    lock();
+    bool ok = _enabled ? s_cache.read(sector, buf, count) : s_disk.readSectors(sector, buf, count);
+    unlock();
+    return ok;
+}
+
+bool SdBlockCache::write(uint32_t sector, const uint8_t* buf, uint32_t count) {
+    lock();
+    bool ok = _enabled ? s_cache.write(sector, buf, count) : s_disk.writeSectors(sector, buf, count);
+    unlock();
+    return ok;
+}
+
+void SdBlockCache::setEnabled(bool enabled) {
+    lock();
+    if (enabled != _enabled) s_cache.invalidate();
+    _enabled = enabled;
+    unlock();
+}
+
+void SdBlockCache::invalidate() {
+    lock();
+    s_cache.invalidate();
+    unlock();
+}
+
+void SdBlockCache::getStats(BlockCacheStats& out) {
+    lock();
+    s_cache.getStats(out);
+    unlock();
+}
+
+size_t SdBlockCache::memoryBytes() {
+    lock();
+    size_t n = s_cache.memoryBytes();
+    unlock();
+    return n;
+}
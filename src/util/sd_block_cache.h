@@ -0,0 +1,51 @@
+#pragma once
+
+#include "block_cache.h"
+
+// PSRAM sector cache (see block_cache.h) under the FatFs volume on the SD
+// card. install() swaps the card's FatFs disk driver for one that reads
+// and writes through the cache, so every path into the card's files (the
+// VFS, ez.storage, AsyncIO, the message store, the log) shares it without
+// knowing. Call it after SD.begin(); it is a no-op once installed.
+//
+// USB mass storage reads and writes raw sectors around FatFs, so
+// SDCardUSB turns the cache off while the host owns the card and back on
+// (empty) when it lets go.
+//
+// Sized at build time; SD_BLOCK_CACHE_KB=0 leaves the SD driver alone.
+#ifndef SD_BLOCK_CACHE_KB
+#define SD_BLOCK_CACHE_KB 512
+#endif
+
+class SdBlockCache {
+public:
+    static constexpr uint32_t BLOCK_SECTORS = 8;
+    static constexpr uint32_t MAX_READAHEAD = 16;   // Blocks (64 KB)
+    static constexpr uint32_t BYPASS_SECTORS = 64;
+
+    static SdBlockCache& instance();
+
+    bool install();
+    bool installed() const { return _installed; }
+
+    // The driver's read and write (FatFs holds the volume lock)
+    bool read(uint32_t sector, uint8_t* buf, uint32_t count);
+    bool write(uint32_t sector, const uint8_t* buf, uint32_t count);
+
+    // Pass everything straight to the card while disabled; re-enabling
+    // starts from an empty cache
+    void setEnabled(bool enabled);
+    void invalidate();
+
+    void getStats(BlockCacheStats& out);
+    size_t memoryBytes();
+
+private:
+    SdBlockCache();
+    void lock();
+    void unlock();
+
+    void* _mutex;
+    bool _installed = false;
+    bool _enabled = true;
+};
@@ -0,0 +1,186 @@
+#include "timer_wheel.h"
+
+// Ids keep the top bit clear so they stay positive even with 32-bit Lua
+// integers: 20 bits of node index, 11 bits of generation (1..2047).
+static constexpr uint16_t MAX_GEN = 2047;
+
+void TimerWheel::resetHeads() {
+    for (uint16_t i = 0; i < NUM_LISTS; i++) _heads[i] = NIL;
+    for (int l = 0; l < LEVELS; l++) _occupied[l] = 0;
+}
+
+uint32_t TimerWheel::allocNode() {
+    uint32_t index;
+    if (_freeHead != NIL) {
+        index = _freeHead;
+        _freeHead = _nodes[index].next;
+    } else {
+        if (_nodes.size() > INDEX_MASK) return NIL;
+        index = (uint32_t)_nodes.size();
+        Node n = {};
+        n.gen = 1;
+        _nodes.push_back(n);
+    }
+    Node& n = _nodes[index];
+    n.prev = n.next = NIL;
+    n.list = NOT_LINKED;
+    n.live = true;
+    _count++;
+    return index;
+}
+
+void TimerWheel::freeNode(uint32_t index) {
+    Node& n = _nodes[index];
+    n.live = false;
+    n.list = NOT_LINKED;
+    n.gen = n.gen >= MAX_GEN ? 1 : n.gen + 1;
+    n.next = _freeHead;
+    _freeHead = index;
+    _count--;
+}
+
+TimerWheel::Node* TimerWheel::lookup(Id id) {
+    uint32_t index = id & INDEX_MASK;
+    if (index >= _nodes.size()) return nullptr;
+    Node& n = _nodes[index];
+    if (!n.live || n.gen != (id >> INDEX_BITS)) return nullptr;
+    return &n;
+}
+
+// Append to the tail so equal deadlines keep scheduling order. Lists are
+// singly headed; the tail is found through the head's `prev` link.
+void TimerWheel::link(uint32_t index, uint16_t list) {
+    Node& n = _nodes[index];
+    n.list = list;
+    n.next = NIL;
+    uint32_t head = _heads[list];
+    if (head == NIL) {
+        n.prev = index;  // Head's prev points at the tail
+        _heads[list] = index;
+    } else {
+        uint32_t tail = _nodes[head].prev;
+        _nodes[tail].next = index;
+        n.prev = tail;
+        _nodes[head].prev = index;
+    }
+    if (list < OVERFLOW_LIST) {
+        _occupied[list / SLOTS] |= (uint64_t)1 << (list % SLOTS);
+    }
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& n = _nodes[index];
+    uint16_t list = n.list;
+    uint32_t head = _heads[list];
+
+    if (index == head) {
+        _heads[list] = n.next;
+        if (n.next != NIL) _nodes[n.next].prev = n.prev;  // Carry the tail
+    } else {
+        _nodes[n.prev].next = n.next;
+        if (n.next != NIL) {
+            _nodes[n.next].prev = n.prev;
+        } else {
+            _nodes[head].prev = n.prev;  // Removed the tail
+        }
+    }
+
+    n.list = NOT_LINKED;
+    n.prev = n.next = NIL;
+    if (list < OVERFLOW_LIST && _heads[list] == NIL) {
+        _occupied[list / SLOTS] &= ~((uint64_t)1 << (list % SLOTS));
+    }
+}
+
+void TimerWheel::place(uint32_t index, bool fresh) {
+    Node& n = _nodes[index];
+    // New deadlines never land on the current (already processed) tick or
+    // in the past. Cascaded ones can be due exactly now; advance() fires
+    // the current slot right after cascading.
+    if (fresh && (int32_t)(n.deadline - _current) <= 0) n.deadline = _current + 1;
+
+    uint32_t diff = n.deadline ^ _current;
+    for (int level = 0; level < LEVELS; level++) {
+        if (diff < ((uint32_t)1 << (SLOT_BITS * (level + 1)))) {
+            uint32_t slot = (n.deadline >> (SLOT_BITS * level)) & SLOT_MASK;
+            link(index, (uint16_t)(level * SLOTS + slot));
+            return;
+        }
+    }
+    link(index, OVERFLOW_LIST);
+}
+
+void TimerWheel::cascade(uint16_t list) {
+    // Detach first: place() may put a node straight back on this list.
+    uint32_t i = _heads[list];
+    if (i == NIL) return;
+    _heads[list] = NIL;
+    if (list < OVERFLOW_LIST) {
+        _occupied[list / SLOTS] &= ~((uint64_t)1 << (list % SLOTS));
+    }
+    while (i != NIL) {
+        uint32_t next = _nodes[i].next;
+        _nodes[i].list = NOT_LINKED;
+        place(i, false);
+        i = next;
+    }
+}
+
+// Called when `tick` is a multiple of 64. Redistribute every higher-level
+// slot whose window starts at this tick, coarsest first.
+void TimerWheel::cascadeAt(uint32_t tick) {
+    if ((tick & ((1u << (SLOT_BITS * LEVELS)) - 1)) == 0) cascade(OVERFLOW_LIST);
+    for (int level = LEVELS - 1; level >= 1; level--) {
+        uint32_t lowMask = (1u << (SLOT_BITS * level)) - 1;
+        if ((tick & lowMask) != 0) continue;
+        uint32_t slot = (tick >> (SLOT_BITS * level)) & SLOT_MASK;
+        cascade((uint16_t)(level * SLOTS + slot));
+    }
+}
+
+TimerWheel::Id TimerWheel::schedule(uint32_t now, uint32_t delayMs, uint32_t intervalMs, int payload) {
+    uint32_t index = allocNode();
+    if (index == NIL) return 0;
+    Node& n = _nodes[index];
+    n.deadline = now + delayMs;
+    n.interval = intervalMs;
+    n.payload = payload;
+    place(index);
+    return makeId(index);
+}
+
+bool TimerWheel::cancel(Id id, int* payloadOut) {
+    Node* n = lookup(id);
+    if (!n) return false;
+    uint32_t index = id & INDEX_MASK;
+    if (payloadOut) *payloadOut = n->payload;
+    if (n->list != NOT_LINKED) unlink(index);
+    freeNode(index);
+    return true;
+}
+
+bool TimerWheel::nextDeadline(uint32_t& at) const {
+    if (_count == 0) return false;
+    if (_heads[FIRING_LIST] != NIL) {
+        at = _current;
+        return true;
+    }
+
+    // Lower levels always hold earlier deadlines than higher ones, and
+    // within a level every occupied slot lies after the current tick's.
+    for (int level = 0; level < LEVELS; level++) {
+        if (_occupied[level] == 0) continue;
+        int shift = SLOT_BITS * level;
+        uint32_t cur = (_current >> shift) & SLOT_MASK;
+        uint64_t ahead = cur == SLOT_MASK ? 0 : _occupied[level] >> (cur + 1);
+        if (ahead == 0) continue;
+        uint32_t slot = cur + 1 + (uint32_t)__builtin_ctzll(ahead);
+        uint32_t windowMask = ((uint32_t)1 << (shift + SLOT_BITS)) - 1;
+        at = (_current & ~windowMask) | (slot << shift);
+        return true;
+    }
+
+    // Only overflow timers left: nothing before the next 2^24 boundary.
+    at = (_current | ((1u << (SLOT_BITS * LEVELS)) - 1)) + 1;
+    return true;
+}
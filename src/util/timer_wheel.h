@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Hierarchical timing wheel with 1 ms ticks.
+//
+// Four levels of 64 slots cover 2^24 ms (~4.6 h); later deadlines park on an
+// overflow list that is re-sorted every 2^24 ms. A timer lives in the level
+// chosen by the highest 6-bit group in which its deadline differs from the
+// current tick, and moves down a level each time the wheel crosses that
+// group's boundary ("cascade"). Insert and cancel are O(1); advancing is
+// O(expired timers) plus one step per 64 ms when level 0 is empty.
+//
+// Timer nodes come from a growable pool with a free list, so there is no
+// fixed timer limit. Ids carry a generation counter: cancelling an id whose
+// timer already fired (and whose node was reused) is a harmless no-op.
+//
+// Timers that share a deadline fire in the order they were scheduled.
+// Time is uint32_t milliseconds and wraps like millis().
+//
+// No Arduino dependencies; owned and driven by a single thread.
+class TimerWheel {
+public:
+    using Id = uint32_t;   // 0 is never a valid id
+
+    explicit TimerWheel(uint32_t now = 0) : _current(now) { resetHeads(); }
+
+    // Schedule `payload` to fire `delayMs` after `now`, then every
+    // `intervalMs` (0 = one-shot). Returns its id.
+    Id schedule(uint32_t now, uint32_t delayMs, uint32_t intervalMs, int payload);
+
+    // Cancel a pending timer. Returns false if it already fired or was
+    // cancelled; otherwise stores its payload in *payloadOut (if given).
+    bool cancel(Id id, int* payloadOut = nullptr);
+
+    // Fire every timer due at or before `now`, in deadline order. `fire`
+    // is called as fire(id, payload, repeating). One-shot timers are
+    // removed before their callback runs; repeating timers are re-armed
+    // for now + interval after it returns, unless the callback cancelled
+    // them. Callbacks may schedule and cancel freely.
+    template <typename Fn>
+    void advance(uint32_t now, Fn&& fire);
+
+    // Earliest time anything may be due, as an absolute tick. Exact for
+    // timers within 64 ms; a lower bound for later ones. False when empty.
+    bool nextDeadline(uint32_t& at) const;
+
+    size_t size() const { return _count; }
+
+    // Drop every timer, invoking drop(payload) so owners can release them.
+    template <typename Fn>
+    void clear(Fn&& drop);
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr uint32_t SLOT_MASK = SLOTS - 1;
+    static constexpr uint32_t NIL = 0xFFFFFFFF;
+    static constexpr uint16_t OVERFLOW_LIST = LEVELS * SLOTS;
+    static constexpr uint16_t FIRING_LIST = OVERFLOW_LIST + 1;
+    static constexpr uint16_t NUM_LISTS = FIRING_LIST + 1;
+    static constexpr uint16_t NOT_LINKED = 0xFFFF;
+    static constexpr uint32_t INDEX_BITS = 20;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+    struct Node {
+        uint32_t deadline;
+        uint32_t interval;
+        int payload;
+        uint32_t prev;
+        uint32_t next;
+        uint16_t list;   // Owning list, NOT_LINKED while firing/free
+        uint16_t gen;    // Bumped on every free; 0 is never used
+        bool live;
+    };
+
+    std::vector<Node> _nodes;
+    uint32_t _freeHead = NIL;
+    uint32_t _heads[NUM_LISTS];
+    uint64_t _occupied[LEVELS] = {};
+    uint32_t _current;
+    size_t _count = 0;
+
+    void resetHeads();
+    uint32_t allocNode();
+    void freeNode(uint32_t index);
+    Id makeId(uint32_t index) const { return ((uint32_t)_nodes[index].gen << INDEX_BITS) | index; }
+    Node* lookup(Id id);
+    void link(uint32_t index, uint16_t list);
+    void unlink(uint32_t index);
+    void place(uint32_t index, bool fresh = true);
+    void cascade(uint16_t list);
+    void cascadeAt(uint32_t tick);
+};
+
+template <typename Fn>
+void TimerWheel::advance(uint32_t now, Fn&& fire) {
+    while ((int32_t)(now - _current) > 0) {
+        if (_count == 0) {
+            _current = now;
+            break;
+        }
+
+        if (_occupied[0] == 0) {
+            // Nothing in level 0: jump straight to the next cascade point.
+            uint32_t boundary = (_current | SLOT_MASK) + 1;
+            if ((int32_t)(now - boundary) < 0) {
+                _current = now;
+                break;
+            }
+            _current = boundary;
+        } else {
+            _current++;
+        }
+
+        if ((_current & SLOT_MASK) == 0) cascadeAt(_current);
+
+        uint16_t slot = (uint16_t)(_current & SLOT_MASK);
+        if (_heads[slot] == NIL) continue;
+
+        // Move the slot onto the firing list so callbacks can cancel any
+        // of its timers (or schedule new ones) while we walk it.
+        while (_heads[slot] != NIL) {
+            uint32_t i = _heads[slot];
+            unlink(i);
+            link(i, FIRING_LIST);
+        }
+
+        while (_heads[FIRING_LIST] != NIL) {
+            uint32_t i = _heads[FIRING_LIST];
+            unlink(i);
+            Id id = makeId(i);
+            int payload = _nodes[i].payload;
+            if (_nodes[i].interval == 0) {
+                freeNode(i);
+                fire(id, payload, false);
+            } else {
+                fire(id, payload, true);
+                // `_nodes` may have grown; re-check the node by id.
+                Node* n = lookup(id);
+                if (n && n->list == NOT_LINKED) {
+                    n->deadline = now + n->interval;
+                    place(i);
+                }
+            }
+        }
+    }
+}
+
+template <typename Fn>
+void TimerWheel::clear(Fn&& drop) {
+    for (uint32_t i = 0; i < _nodes.size(); i++) {
+        if (_nodes[i].live) {
+            int payload = _nodes[i].payload;
+            if (_nodes[i].list != NOT_LINKED) unlink(i);
+            freeNode(i);
+            drop(payload);
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#include "topic_router.h"
+
+#include <algorithm>
+
+// Segment id reserved for "segment never seen": it can't match any trie edge.
+static constexpr uint16_t UNKNOWN_SEGMENT = 0xFFFF;
+
+static void splitTopic(const char* topic, std::vector<std::string>& out) {
+    out.clear();
+    const char* start = topic;
+    for (const char* p = topic;; p++) {
+        if (*p == '/' || *p == '\0') {
+            out.emplace_back(start, p - start);
+            if (*p == '\0') break;
+            start = p + 1;
+        }
+    }
+}
+
+TopicRouter::TopicRouter() {
+    _nodes.emplace_back();
+}
+
+TopicRouter::SegmentId TopicRouter::segment(const std::string& seg, bool create) {
+    auto it = _segmentIds.find(seg);
+    if (it != _segmentIds.end()) return it->second;
+    if (!create || _segmentIds.size() >= UNKNOWN_SEGMENT) return UNKNOWN_SEGMENT;
+    SegmentId id = (SegmentId)_segmentIds.size();
+    _segmentIds.emplace(seg, id);
+    return id;
+}
+
+TopicRouter::TopicId TopicRouter::intern(const char* topic) {
+    auto it = _topicIds.find(topic);
+    if (it != _topicIds.end()) return it->second;
+    if (_topics.size() >= MAX_TOPICS) return INVALID_TOPIC;
+
+    TopicId id = (TopicId)_topics.size();
+    _topics.emplace_back();
+    Topic& t = _topics.back();
+    t.name = topic;
+
+    std::vector<std::string> parts;
+    splitTopic(topic, parts);
+    t.segments.reserve(parts.size());
+    for (const auto& part : parts) t.segments.push_back(segment(part, true));
+
+    _topicIds.emplace(t.name, id);
+    return id;
+}
+
+TopicRouter::TopicId TopicRouter::find(const char* topic) const {
+    auto it = _topicIds.find(topic);
+    return it == _topicIds.end() ? INVALID_TOPIC : it->second;
+}
+
+bool TopicRouter::subscribe(int subscriber, const char* pattern) {
+    std::vector<std::string> parts;
+    splitTopic(pattern, parts);
+
+    // Validate before touching the trie.
+    for (size_t i = 0; i < parts.size(); i++) {
+        const std::string& p = parts[i];
+        bool wild = p.find_first_of("+#") != std::string::npos;
+        if (!wild) continue;
+        if (p.size() != 1) return false;
+        if (p == "#" && i != parts.size() - 1) return false;
+    }
+
+    unsubscribe(subscriber);
+
+    uint32_t node = 0;
+    bool hash = false;
+    for (const auto& p : parts) {
+        if (p == "#") {
+            hash = true;
+            break;
+        }
+        uint32_t next;
+        if (p == "+") {
+            next = _nodes[node].plus;
+            if (next == NONE) {
+                next = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                _nodes[node].plus = next;
+            }
+        } else {
+            SegmentId seg = segment(p, true);
+            if (seg == UNKNOWN_SEGMENT) return false;
+            auto it = _nodes[node].children.find(seg);
+            if (it != _nodes[node].children.end()) {
+                next = it->second;
+            } else {
+                next = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                _nodes[node].children.emplace(seg, next);
+            }
+        }
+        node = next;
+    }
+
+    (hash ? _nodes[node].hashSubs : _nodes[node].subs).push_back(subscriber);
+    _placements[subscriber] = {node, hash};
+    _gen++;
+    return true;
+}
+
+bool TopicRouter::unsubscribe(int subscriber) {
+    auto it = _placements.find(subscriber);
+    if (it == _placements.end()) return false;
+
+    // Trie nodes are left in place; patterns are few and get reused.
+    std::vector<int>& list = it->second.hash ? _nodes[it->second.node].hashSubs
+                                             : _nodes[it->second.node].subs;
+    list.erase(std::remove(list.begin(), list.end(), subscriber), list.end());
+    _placements.erase(it);
+    _gen++;
+    return true;
+}
+
+void TopicRouter::clear() {
+    _nodes.clear();
+    _nodes.emplace_back();
+    _placements.clear();
+    _gen++;
+}
+
+void TopicRouter::collect(uint32_t node, const std::vector<SegmentId>& segs, size_t depth,
+                          std::vector<int>& out) const {
+    const Node& n = _nodes[node];
+    out.insert(out.end(), n.hashSubs.begin(), n.hashSubs.end());
+    if (depth == segs.size()) {
+        out.insert(out.end(), n.subs.begin(), n.subs.end());
+        return;
+    }
+    auto it = n.children.find(segs[depth]);
+    if (it != n.children.end()) collect(it->second, segs, depth + 1, out);
+    if (n.plus != NONE) collect(n.plus, segs, depth + 1, out);
+}
+
+const std::vector<int>& TopicRouter::match(TopicId topic) {
+    Topic& t = _topics[topic];
+    if (t.matchGen != _gen) {
+        t.matches.clear();
+        collect(0, t.segments, 0, t.matches);
+        // Overlapping patterns can't match twice (one placement per
+        // subscriber), but keep delivery in subscription order.
+        std::sort(t.matches.begin(), t.matches.end());
+        t.matchGen = _gen;
+    }
+    return t.matches;
+}
+
+bool TopicRouter::anyMatch(uint32_t node, const std::vector<SegmentId>& segs,
+                           size_t depth) const {
+    const Node& n = _nodes[node];
+    if (!n.hashSubs.empty()) return true;
+    if (depth == segs.size()) return !n.subs.empty();
+    auto it = n.children.find(segs[depth]);
+    if (it != n.children.end() && anyMatch(it->second, segs, depth + 1)) return true;
+    return n.plus != NONE && anyMatch(n.plus, segs, depth + 1);
+}
+
+bool TopicRouter::matchesAny(const char* topic) const {
+    std::vector<std::string> parts;
+    splitTopic(topic, parts);
+    // A segment no pattern has used can still match '+' or '#'
+    std::vector<SegmentId> segs;
+    segs.reserve(parts.size());
+    for (const auto& part : parts) {
+        auto it = _segmentIds.find(part);
+        segs.push_back(it == _segmentIds.end() ? UNKNOWN_SEGMENT : it->second);
+    }
+    return anyMatch(0, segs, 0);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Topic interning and wildcard subscription matching for the message bus.
+//
+// Topics are '/'-separated paths ("mesh/packet"). Each distinct topic string
+// is interned once to a small integer id, and each of its segments to a
+// segment id, so a publish costs one hash lookup instead of a string compare
+// per subscription.
+//
+// Subscription patterns live in a segment trie and may use MQTT-style
+// wildcards:
+//   +   matches exactly one segment      ("mesh/+/rx" ~ "mesh/ch1/rx")
+//   #   matches any remaining segments,  ("mesh/#" ~ "mesh", "mesh/a/b")
+//       including none; only valid last
+//
+// match() results are cached per topic and invalidated whenever the set of
+// subscriptions changes, so steady-state dispatch does no trie walk at all.
+//
+// Not thread-safe; MessageBus serialises access with its own mutex.
+// No Arduino dependencies (see tools/bench/bus_throughput.cpp).
+class TopicRouter {
+public:
+    using TopicId = uint16_t;
+    static constexpr TopicId INVALID_TOPIC = 0xFFFF;
+    static constexpr size_t MAX_TOPICS = 1024;
+
+    TopicRouter();
+
+    // Intern a topic string. Returns INVALID_TOPIC once MAX_TOPICS distinct
+    // topics exist (topics are meant to be a fixed vocabulary, not carry data).
+    TopicId intern(const char* topic);
+
+    // Look up without interning. INVALID_TOPIC if never seen.
+    TopicId find(const char* topic) const;
+
+    const std::string& name(TopicId id) const { return _topics[id].name; }
+    size_t topicCount() const { return _topics.size(); }
+
+    // Add `subscriber` under `pattern`. False if the pattern is malformed
+    // ('#' anywhere but the last segment, or wildcards mixed into a segment).
+    bool subscribe(int subscriber, const char* pattern);
+    bool unsubscribe(int subscriber);
+    void clear();
+
+    // Subscribers whose pattern matches `topic`, ascending by id. The
+    // reference stays valid until the next subscribe/unsubscribe/clear.
+    const std::vector<int>& match(TopicId topic);
+
+    // Whether any pattern matches `topic`, without interning it: a
+    // wildcard subscriber can match a topic nobody has published yet.
+    bool matchesAny(const char* topic) const;
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    using SegmentId = uint16_t;
+
+    struct Node {
+        std::unordered_map<SegmentId, uint32_t> children;
+        uint32_t plus = NONE;        // Child for a '+' segment
+        std::vector<int> subs;       // Patterns ending exactly here
+        std::vector<int> hashSubs;   // Patterns ending with '#' here
+    };
+
+    struct Topic {
+        std::string name;
+        std::vector<SegmentId> segments;
+        std::vector<int> matches;
+        uint32_t matchGen = 0;       // _gen when `matches` was computed
+    };
+
+    struct Placement {
+        uint32_t node;
+        bool hash;
+    };
+
+    std::vector<Node> _nodes;                          // [0] is the root
+    std::deque<Topic> _topics;                         // deque: names stay put
+    std::unordered_map<std::string, TopicId> _topicIds;
+    std::unordered_map<std::string, SegmentId> _segmentIds;
+    std::unordered_map<int, Placement> _placements;
+    uint32_t _gen = 1;
+
+    SegmentId segment(const std::string& seg, bool create);
+    void collect(uint32_t node, const std::vector<SegmentId>& segs, size_t depth,
+                 std::vector<int>& out) const;
+    bool anyMatch(uint32_t node, const std::vector<SegmentId>& segs, size_t depth) const;
+};
@@ -0,0 +1,85 @@
+#include "trace.h"
+
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <new>
+#include <string.h>
+
+std::atomic<bool> g_traceActive{false};
+
+namespace {
+
+// Ring and thread table live in PSRAM and are only allocated by the first
+// trace_start(), so an untraced session pays nothing but this object
+TraceRing g_ring;
+TraceThreads* g_threads = nullptr;
+
+uint8_t currentThread() {
+    return g_threads->lookup((uintptr_t)xTaskGetCurrentTaskHandle(), pcTaskGetName(nullptr));
+}
+
+}  // namespace
+
+bool trace_start() {
+#if TRACE_ENABLED
+    if (!g_ring.ready()) {
+        void* slots = heap_caps_calloc(TRACE_CAPACITY, sizeof(TraceEvent),
+                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        void* threads = heap_caps_malloc(sizeof(TraceThreads), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!slots || !threads) {
+            heap_caps_free(slots);
+            heap_caps_free(threads);
+            return false;
+        }
+        g_threads = new (threads) TraceThreads();
+        g_ring.init((TraceEvent*)slots, TRACE_CAPACITY);
+    }
+    g_traceActive.store(true, std::memory_order_release);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void trace_stop() {
+    g_traceActive.store(false, std::memory_order_release);
+}
+
+void trace_clear() {
+    if (g_ring.ready()) g_ring.clear();
+}
+
+void trace_record(const char* name, uint8_t phase) {
+    if (!g_ring.ready()) return;
+    g_ring.record(name, phase, (uint8_t)xPortGetCoreID(), currentThread(), trace_now());
+}
+
+void trace_complete(const char* name, uint32_t startUs) {
+    if (!g_ring.ready()) return;
+    g_ring.record(name, TRACE_PHASE_COMPLETE, (uint8_t)xPortGetCoreID(), currentThread(),
+                  startUs, trace_now() - startUs);
+}
+
+void trace_get_stats(TraceStats& out) {
+    out.running = trace_active();
+    out.recorded = g_ring.ready() ? g_ring.head() : 0;
+    out.capacity = TRACE_CAPACITY;
+    out.threads = g_threads ? g_threads->count() : 0;
+}
+
+TraceJsonWriter* trace_export_begin() {
+    if (!g_ring.ready()) return nullptr;
+    // The writer and its copy of the events in one PSRAM block
+    size_t bytes = sizeof(TraceJsonWriter) + 8 + TRACE_CAPACITY * sizeof(TraceEvent);
+    uint8_t* mem = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) return nullptr;
+    TraceEvent* scratch = (TraceEvent*)(mem + ((sizeof(TraceJsonWriter) + 7) & ~(size_t)7));
+    return new (mem) TraceJsonWriter(g_ring, *g_threads, scratch);
+}
+
+void trace_export_end(TraceJsonWriter* w) {
+    if (!w) return;
+    w->~TraceJsonWriter();
+    heap_caps_free(w);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+
+#include "trace_ring.h"
+
+// Timeline tracing: begin/end spans and instant events from C++ (the
+// TRACE_* macros) and Lua (ez.trace), stamped with esp_timer time, the
+// core and the calling task, kept in a fixed-size PSRAM ring of the
+// newest TRACE_CAPACITY events. Export is Chrome trace-event JSON: GET
+// /trace.json on the dev server, ez.trace.dump(), or
+// `ez_remote.py PORT --trace SECONDS` over USB serial. Open the file in
+// ui.perfetto.dev or chrome://tracing.
+//
+// Recording is off until trace_start(); while off each macro costs one
+// relaxed load. Build with -DTRACE_ENABLED=0 to compile the macros to
+// nothing (ez.trace.start() then returns false).
+//
+// Spans nest per task: TRACE_END closes the innermost open TRACE_BEGIN on
+// the same task. Anything that starts on one task and finishes on another,
+// or overlaps unrelated spans (a radio transmit in flight across frames),
+// should be recorded with TRACE_COMPLETE once it is done.
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+static constexpr uint32_t TRACE_CAPACITY = 8192;   // Events; 20 bytes each
+
+extern std::atomic<bool> g_traceActive;
+inline bool trace_active() { return g_traceActive.load(std::memory_order_relaxed); }
+
+// Allocate the ring on first use and start recording. False if tracing is
+// compiled out or PSRAM is short.
+bool trace_start();
+void trace_stop();
+void trace_clear();
+
+void trace_record(const char* name, uint8_t phase);
+// A span that already finished: started at `startUs` (esp_timer time).
+void trace_complete(const char* name, uint32_t startUs);
+inline uint32_t trace_now() { return (uint32_t)esp_timer_get_time(); }
+
+struct TraceStats {
+    bool running;
+    uint32_t recorded;      // Events since the last clear
+    uint32_t capacity;
+    uint8_t threads;        // Tasks seen
+};
+void trace_get_stats(TraceStats& out);
+
+// Snapshot the ring for export; see TraceJsonWriter. nullptr if nothing
+// was ever recorded or PSRAM is short. Free with trace_export_end().
+TraceJsonWriter* trace_export_begin();
+void trace_export_end(TraceJsonWriter* w);
+
+// Records a span for the enclosing scope. The end is only recorded if the
+// begin was, so starting a trace mid-scope leaves no stray end.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : _on(trace_active()) {
+        if (_on) trace_record(name, TRACE_PHASE_BEGIN);
+    }
+    ~TraceScope() {
+        if (_on) trace_record(nullptr, TRACE_PHASE_END);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    bool _on;
+};
+
+#if TRACE_ENABLED
+    #define TRACE_CONCAT_(a, b) a##b
+    #define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+    #define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
+    #define TRACE_BEGIN(name) do {                                    \
+            if (trace_active()) trace_record(name, TRACE_PHASE_BEGIN); \
+        } while (0)
+    #define TRACE_END() do {                                          \
+            if (trace_active()) trace_record(nullptr, TRACE_PHASE_END); \
+        } while (0)
+    #define TRACE_INSTANT(name) do {                                  \
+            if (trace_active()) trace_record(name, TRACE_PHASE_INSTANT); \
+        } while (0)
+    #define TRACE_COMPLETE(name, startUs) do {                        \
+            if (trace_active()) trace_complete(name, startUs);        \
+        } while (0)
+#else
+    #define TRACE_SCOPE(name) ((void)0)
+    #define TRACE_BEGIN(name) ((void)0)
+    #define TRACE_END() ((void)0)
+    #define TRACE_INSTANT(name) ((void)0)
+    #define TRACE_COMPLETE(name, startUs) ((void)0)
+#endif
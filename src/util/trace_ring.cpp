@@ -0,0 +1,257 @@
+#include "trace_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+constexpr uint8_t CORES = 2;
+
+// Copy `s` as a JSON string body; returns bytes written, or 0 if it
+// doesn't fit in `cap`.
+size_t jsonEscape(const char* s, char* out, size_t cap) {
+    size_t n = 0;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            if (n + 2 > cap) return 0;
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        } else if (c < 0x20) {
+            if (n + 6 > cap) return 0;
+            n += (size_t)snprintf(out + n, cap - n, "\\u%04x", c);
+        } else {
+            if (n + 1 > cap) return 0;
+            out[n++] = (char)c;
+        }
+    }
+    return n;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// TraceRing
+// ---------------------------------------------------------------------------
+
+void TraceRing::init(TraceEvent* slots, uint32_t count) {
+    _mask = count - 1;
+    _slots = slots;
+}
+
+void TraceRing::record(const char* name, uint8_t phase, uint8_t core, uint8_t thread,
+                       uint32_t tsUs, uint32_t arg) {
+    uint32_t index = _head.fetch_add(1, std::memory_order_acq_rel);
+    TraceEvent& e = _slots[index & _mask];
+    e.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.name = name;
+    e.tsUs = tsUs;
+    e.arg = arg;
+    e.phase = phase;
+    e.core = core;
+    e.thread = thread;
+    e.seq.store(index + 1, std::memory_order_release);
+}
+
+bool TraceRing::read(uint32_t index, TraceEvent& out) const {
+    const TraceEvent& e = _slots[index & _mask];
+    if (e.seq.load(std::memory_order_acquire) != index + 1) return false;
+    out.name = e.name;
+    out.tsUs = e.tsUs;
+    out.arg = e.arg;
+    out.phase = e.phase;
+    out.core = e.core;
+    out.thread = e.thread;
+    // A writer that claimed this slot while we copied has cleared seq
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(std::memory_order_relaxed) == index + 1;
+}
+
+void TraceRing::clear() {
+    for (uint32_t i = 0; i <= _mask; i++) {
+        _slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+    _head.store(0, std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------
+// TraceThreads
+// ---------------------------------------------------------------------------
+
+uint8_t TraceThreads::lookup(uintptr_t key, const char* name) {
+    for (uint8_t i = 0; i < MAX_THREADS; i++) {
+        Slot& s = _slots[i];
+        uintptr_t k = s.key.load(std::memory_order_acquire);
+        if (k == key) return i;
+        if (k != 0) continue;
+        if (s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+            strncpy(s.name, name ? name : "?", NAME_LEN - 1);
+            s.name[NAME_LEN - 1] = '\0';
+            s.named.store(true, std::memory_order_release);
+            return i;
+        }
+        if (k == key) return i;     // Another core registered the same key
+    }
+    return OVERFLOW_THREAD;
+}
+
+const char* TraceThreads::name(uint8_t index) const {
+    if (index >= MAX_THREADS) return "other";
+    const Slot& s = _slots[index];
+    return s.named.load(std::memory_order_acquire) ? s.name : nullptr;
+}
+
+uint8_t TraceThreads::count() const {
+    uint8_t n = 0;
+    while (n < MAX_THREADS && _slots[n].key.load(std::memory_order_acquire) != 0) n++;
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// TraceJsonWriter
+// ---------------------------------------------------------------------------
+
+TraceJsonWriter::TraceJsonWriter(const TraceRing& ring, const TraceThreads& threads,
+                                 TraceEvent* scratch)
+    : _threads(threads), _events(scratch) {
+    if (!ring.ready()) return;
+    uint32_t head = ring.head();
+    uint32_t cap = ring.capacity();
+    uint32_t from = head > cap ? head - cap : 0;
+    for (uint32_t i = from; i != head; i++) {
+        if (ring.read(i, _events[_count])) _count++;
+    }
+    if (_count) _lastRaw = _events[0].tsUs;
+}
+
+size_t TraceJsonWriter::writeEvent(const TraceEvent& e, char* out, size_t cap) {
+    // Signed delta from the previous event: writers on two cores can land
+    // slightly out of order, and a complete event carries its start time
+    int64_t ts = (int64_t)_tsUs + (int32_t)(e.tsUs - _lastRaw);
+
+    int k = snprintf(out, cap, "%s{\"ph\":\"%c\",\"pid\":%u,\"tid\":%u,\"ts\":%lld",
+                     _first ? "" : ",", (char)e.phase, (unsigned)e.core, (unsigned)e.thread,
+                     (long long)ts);
+    if (k < 0 || (size_t)k >= cap) return 0;
+    size_t n = (size_t)k;
+    if (e.phase == TRACE_PHASE_COMPLETE) {
+        k = snprintf(out + n, cap - n, ",\"dur\":%u", (unsigned)e.arg);
+        if (k < 0 || (size_t)k >= cap - n) return 0;
+        n += (size_t)k;
+    } else if (e.phase == TRACE_PHASE_INSTANT) {
+        if (n + 8 > cap) return 0;
+        memcpy(out + n, ",\"s\":\"t\"", 8);
+        n += 8;
+    }
+    if (e.name) {
+        if (n + 10 > cap) return 0;
+        memcpy(out + n, ",\"name\":\"", 9);
+        n += 9;
+        size_t m = jsonEscape(e.name, out + n, cap - n - 1);
+        if (m == 0 && *e.name) return 0;
+        n += m;
+        out[n++] = '"';
+    }
+    if (n + 1 > cap) return 0;
+    out[n++] = '}';
+    _first = false;
+    if (e.phase != TRACE_PHASE_COMPLETE) {
+        _tsUs = ts < 0 ? 0 : ts;
+        _lastRaw = e.tsUs;
+    }
+    return n;
+}
+
+size_t TraceJsonWriter::write(char* out, size_t cap) {
+    size_t n = 0;
+    for (;;) {
+        size_t room = cap - n;
+        size_t k = 0;
+        switch (_stage) {
+            case 0: {
+                static const char HEAD[] = "{\"traceEvents\":[";
+                if (room < sizeof(HEAD) - 1) return n;
+                memcpy(out + n, HEAD, sizeof(HEAD) - 1);
+                k = sizeof(HEAD) - 1;
+                _stage = 1;
+                break;
+            }
+            case 1: {
+                // One process per core, then every thread's name under
+                // each core it may have run on
+                uint32_t threads = _threads.count();
+                uint32_t total = CORES + CORES * threads;
+                if (_metaNext >= total) {
+                    _stage = 2;
+                    continue;
+                }
+                int r;
+                const char* sep = _first ? "" : ",";
+                if (_metaNext < CORES) {
+                    r = snprintf(out + n, room,
+                                 "%s{\"ph\":\"M\",\"pid\":%u,\"name\":\"process_name\","
+                                 "\"args\":{\"name\":\"Core %u\"}}",
+                                 sep, (unsigned)_metaNext, (unsigned)_metaNext);
+                } else {
+                    uint32_t m = _metaNext - CORES;
+                    uint8_t tid = (uint8_t)(m / CORES);
+                    const char* name = _threads.name(tid);
+                    if (!name) {
+                        _metaNext++;
+                        continue;
+                    }
+                    char esc[TraceThreads::NAME_LEN * 6];
+                    size_t el = jsonEscape(name, esc, sizeof(esc) - 1);
+                    esc[el] = '\0';
+                    r = snprintf(out + n, room,
+                                 "%s{\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"name\":\"thread_name\","
+                                 "\"args\":{\"name\":\"%s\"}}",
+                                 sep, (unsigned)(m % CORES), (unsigned)tid, esc);
+                }
+                if (r < 0 || (size_t)r >= room) return n;
+                k = (size_t)r;
+                _first = false;
+                _metaNext++;
+                break;
+            }
+            case 2:
+                if (_next >= _count) {
+                    _stage = 3;
+                    continue;
+                }
+                k = writeEvent(_events[_next], out + n, room);
+                if (k == 0) return n;
+                _next++;
+                break;
+            case 3: {
+                static const char TAIL[] = "],\"displayTimeUnit\":\"ms\"}\n";
+                if (room < sizeof(TAIL) - 1) return n;
+                memcpy(out + n, TAIL, sizeof(TAIL) - 1);
+                k = sizeof(TAIL) - 1;
+                _stage = 4;
+                break;
+            }
+            default:
+                return n;
+        }
+        n += k;
+    }
+}
+
+size_t TraceJsonWriter::read(char* out, size_t cap) {
+    size_t n = 0;
+    while (n < cap) {
+        if (_pendingOff == _pendingLen) {
+            _pendingLen = write(_pending, sizeof(_pending));
+            _pendingOff = 0;
+            if (_pendingLen == 0) break;
+        }
+        size_t take = _pendingLen - _pendingOff;
+        if (take > cap - n) take = cap - n;
+        memcpy(out + n, _pending + _pendingOff, take);
+        _pendingOff += take;
+        n += take;
+    }
+    return n;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Timeline events and the fixed-size ring they are recorded into, plus the
+// Chrome trace-event JSON export (chrome://tracing, ui.perfetto.dev).
+//
+// An event is a name pointer, a microsecond timestamp, the core and a
+// small thread index; recording is one fetch_add to claim a slot and a
+// handful of stores. Each slot carries a sequence word the writer clears
+// before filling it and sets to the event's index + 1 after, so a reader
+// copying a slot that a writer is reusing sees the mismatch and skips it.
+// Old events are overwritten; the ring always holds the newest ones.
+//
+// Names must outlive the ring: string literals from the C++ macros, or
+// interned copies for names from Lua.
+//
+// No Arduino dependencies.
+
+enum TracePhase : uint8_t {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+    TRACE_PHASE_COMPLETE = 'X',     // `arg` is the duration in us
+};
+
+struct TraceEvent {
+    const char* name;
+    uint32_t tsUs;
+    uint32_t arg;
+    uint8_t phase;
+    uint8_t core;
+    uint8_t thread;
+    uint8_t pad;
+    std::atomic<uint32_t> seq;      // Event index + 1 once written
+};
+
+class TraceRing {
+public:
+    // `slots` is `count` zeroed events, `count` a power of two.
+    void init(TraceEvent* slots, uint32_t count);
+    bool ready() const { return _slots != nullptr; }
+    uint32_t capacity() const { return _mask + 1; }
+
+    // Lock-free; safe from any task on either core.
+    void record(const char* name, uint8_t phase, uint8_t core, uint8_t thread,
+                uint32_t tsUs, uint32_t arg = 0);
+
+    // Events ever recorded (mod 2^32); the newest has index head() - 1.
+    uint32_t head() const { return _head.load(std::memory_order_acquire); }
+
+    // Copy event `index` into `out`. False if it was overwritten, or is
+    // still being written.
+    bool read(uint32_t index, TraceEvent& out) const;
+
+    // Forget everything recorded so far. Writers racing a clear may leave
+    // a few events behind.
+    void clear();
+
+private:
+    TraceEvent* _slots = nullptr;
+    uint32_t _mask = 0;
+    std::atomic<uint32_t> _head{0};
+};
+
+// Small table mapping a thread key (a task handle) to an index and a name,
+// so events carry one byte instead of a pointer to a TCB that may be gone
+// by export time. Lookups scan at most MAX_THREADS keys; new threads claim
+// a slot with a CAS.
+class TraceThreads {
+public:
+    static constexpr uint8_t MAX_THREADS = 32;
+    static constexpr size_t NAME_LEN = 16;
+    static constexpr uint8_t OVERFLOW_THREAD = MAX_THREADS;   // Table full
+
+    // Index for `key`, registering it under `name` on first sight.
+    uint8_t lookup(uintptr_t key, const char* name);
+    // Name for an index, or nullptr if it was never registered.
+    const char* name(uint8_t index) const;
+    uint8_t count() const;
+
+private:
+    struct Slot {
+        std::atomic<uintptr_t> key{0};
+        std::atomic<bool> named{false};
+        char name[NAME_LEN];
+    };
+    Slot _slots[MAX_THREADS];
+};
+
+// Writes a snapshot of a ring as Chrome trace-event JSON in pieces, so
+// neither side needs the whole document in memory: construct it over a
+// ring (the events are copied out up front, into `scratch`), then call
+// write() until it returns 0. Each call emits whole JSON fragments only.
+//
+// Threads appear as tid, cores as pid ("Core 0", "Core 1"). Timestamps are
+// unwrapped from 32 bits and start at 0 for the oldest event.
+class TraceJsonWriter {
+public:
+    static constexpr size_t MIN_CHUNK = 512;    // Smallest `cap` for write()
+
+    // `scratch` holds ring.capacity() events.
+    TraceJsonWriter(const TraceRing& ring, const TraceThreads& threads, TraceEvent* scratch);
+
+    uint32_t events() const { return _count; }
+
+    // Next piece of the document into `out` (at least MIN_CHUNK bytes);
+    // returns bytes written, 0 at the end.
+    size_t write(char* out, size_t cap);
+
+    // Same as a byte stream: fills `out` as far as it can for any `cap`,
+    // for consumers that choose the size (an HTTP chunk filler). Don't
+    // mix with write().
+    size_t read(char* out, size_t cap);
+
+private:
+    size_t writeEvent(const TraceEvent& e, char* out, size_t cap);
+
+    const TraceThreads& _threads;
+    TraceEvent* _events;
+    uint32_t _count = 0;
+    uint32_t _next = 0;
+    int64_t _tsUs = 0;          // Unwrapped timestamp of the last event written
+    uint32_t _lastRaw = 0;
+    uint32_t _metaNext = 0;     // Metadata records written so far
+    uint8_t _stage = 0;
+    bool _first = true;
+    char _pending[MIN_CHUNK];
+    size_t _pendingLen = 0;
+    size_t _pendingOff = 0;
+};
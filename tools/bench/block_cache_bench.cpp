@@ -0,0 +1,468 @@
+// Host check and benchmark for the SD block cache
+// (src/util/block_cache.cpp).
+//
+// The device is an SD image file (default 64 MB, a few sectors past a
+// block boundary) read and written with pread/pwrite. Time on the card is
+// simulated per command: a fixed cost for the command and the wait for
+// the card, plus the SPI transfer per sector, at the SD library's default
+// 4 MHz clock and at 20 MHz. Host time would only measure the page cache.
+//
+// Checks, any failure exits 1:
+//   - random reads and writes of random lengths, through the cache,
+//     against a shadow copy of the image: every read matches, and every
+//     write is in the image file by the time write() returns
+//   - a write made behind the cache's back (USB mass storage) is seen
+//     after invalidate(); a failed write drops the cached copy; a failed
+//     read is reported
+//   - the short last block of the device reads correctly
+//
+// Then replays FatFs-shaped sector traces (a small model of f_read: whole
+// sectors go straight to the caller, partial ones through the file's
+// sector buffer, FAT sectors through the volume window, and a backwards
+// seek walks the FAT from the start of the file):
+//
+//   mp3      a 4 MB file in 1940-byte reads
+//   jpeg     thirty 96 KB files in 512-byte reads
+//   http     a 2 MB file in 1460-byte reads
+//   map      small random reads, 90% inside a 512 KB index at the head
+//            of a 16 MB tile file, 10% 4 KB tile reads anywhere in it
+//   mixed    mp3 playback with map lookups in between and a log line
+//            appended every 50 steps
+//
+// For each, with no cache and a few cache sizes (and one without
+// read-ahead), it reports the simulated card time, the throughput seen by
+// the reader, device commands, hit rate and read-ahead use.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/block_cache_bench
+//         tools/bench/block_cache_bench.cpp src/util/block_cache.cpp
+//     /tmp/block_cache_bench [image MB]
+
+#include "block_cache.h"
+#include "heap_tags.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// heap_tags.cpp needs the ESP heap; plain malloc will do here
+void* heapTagMalloc(HeapTag, size_t size) { return malloc(size); }
+void* heapTagPsMalloc(HeapTag, size_t size) { return malloc(size); }
+void heapTagFree(HeapTag, void* ptr) { free(ptr); }
+
+namespace {
+
+constexpr uint32_t SECTOR = BlockCache::SECTOR_SIZE;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+struct Timing {
+    const char* name;
+    double cmdUs;           // Command, card access latency, token wait
+    double sectorUs;        // 512 bytes plus CRC over SPI
+    double programUs;       // Card busy after a write
+};
+
+class ImageDevice : public BlockDevice {
+public:
+    ImageDevice(int fd, uint32_t sectors) : _fd(fd), _sectors(sectors) {}
+
+    bool readSectors(uint32_t sector, uint8_t* buf, uint32_t count) override {
+        if (failRead) {
+            failRead = false;
+            return false;
+        }
+        if (sector + count > _sectors) return false;
+        reads++;
+        sectorsRead += count;
+        if (timing) simUs += timing->cmdUs + count * timing->sectorUs;
+        return pread(_fd, buf, (size_t)count * SECTOR, (off_t)sector * SECTOR) == (ssize_t)(count * SECTOR);
+    }
+
+    bool writeSectors(uint32_t sector, const uint8_t* buf, uint32_t count) override {
+        if (failWrite) {
+            failWrite = false;
+            return false;
+        }
+        if (sector + count > _sectors) return false;
+        writes++;
+        if (timing) simUs += timing->cmdUs + count * (timing->sectorUs + timing->programUs);
+        return pwrite(_fd, buf, (size_t)count * SECTOR, (off_t)sector * SECTOR) == (ssize_t)(count * SECTOR);
+    }
+
+    void reset() {
+        simUs = 0;
+        reads = writes = sectorsRead = 0;
+    }
+
+    const Timing* timing = nullptr;
+    double simUs = 0;
+    uint64_t reads = 0, writes = 0, sectorsRead = 0;
+    bool failRead = false, failWrite = false;
+
+private:
+    int _fd;
+    uint32_t _sectors;
+};
+
+// What FatFs sees: the cache, or the card itself
+struct Disk {
+    BlockCache* cache;
+    ImageDevice* dev;
+    bool read(uint32_t s, uint8_t* b, uint32_t n) { return cache ? cache->read(s, b, n) : dev->readSectors(s, b, n); }
+    bool write(uint32_t s, const uint8_t* b, uint32_t n) { return cache ? cache->write(s, b, n) : dev->writeSectors(s, b, n); }
+};
+
+uint8_t pattern(uint64_t byte) {
+    uint64_t x = (byte / 8) * 0x9E3779B97F4A7C15ull;
+    x ^= x >> 31;
+    return (uint8_t)(x >> (8 * (byte % 8)));
+}
+
+void checkedRead(Disk& d, const std::vector<uint8_t>& shadow, uint32_t s, uint8_t* b, uint32_t n) {
+    bool ok = d.read(s, b, n);
+    if (!ok || memcmp(b, shadow.data() + (size_t)s * SECTOR, (size_t)n * SECTOR) != 0) {
+        static int reported = 0;
+        if (reported++ < 5) fprintf(stderr, "  read %u+%u %s\n", s, n, ok ? "mismatch" : "failed");
+        check(false, "read matches the image");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// FatFs model
+
+constexpr uint32_t CLUSTER = 64;            // 32 KB clusters
+constexpr uint32_t FAT_START = 2048;
+constexpr uint32_t DIR_SECTOR = 4096;
+
+struct FatFile {
+    uint32_t first;         // Contiguous, cluster aligned
+    uint32_t size;
+};
+
+struct FatVolume {
+    Disk& disk;
+    const std::vector<uint8_t>& shadow;
+    uint32_t winSector = UINT32_MAX;
+    uint8_t win[SECTOR];
+
+    void moveWindow(uint32_t sector) {
+        if (sector == winSector) return;
+        checkedRead(disk, shadow, sector, win, 1);
+        winSector = sector;
+    }
+    // FAT32: 128 entries per FAT sector
+    void getFat(uint32_t clusterSector) { moveWindow(FAT_START + clusterSector / CLUSTER / 128); }
+};
+
+struct FatOpen {
+    const FatFile* file;
+    uint32_t cluster = 0;               // Cluster index of the position
+    uint32_t bufSector = UINT32_MAX;
+    uint8_t buf[SECTOR];
+};
+
+void fatSeek(FatVolume& v, FatOpen& f, uint32_t offset) {
+    uint32_t target = offset / (CLUSTER * SECTOR);
+    uint32_t from = target < f.cluster ? 0 : f.cluster;
+    for (uint32_t c = from; c < target; c++) v.getFat(f.file->first + c * CLUSTER);
+    f.cluster = target;
+}
+
+void fatRead(FatVolume& v, FatOpen& f, uint32_t offset, uint32_t len, uint8_t* out) {
+    fatSeek(v, f, offset);
+    while (len) {
+        uint32_t cl = offset / (CLUSTER * SECTOR);
+        if (cl != f.cluster) {
+            v.getFat(f.file->first + f.cluster * CLUSTER);
+            f.cluster = cl;
+        }
+        uint32_t sector = f.file->first + offset / SECTOR;
+        uint32_t in = offset % SECTOR;
+        if (in == 0 && len >= SECTOR) {
+            uint32_t cc = len / SECTOR;
+            uint32_t csect = (offset / SECTOR) % CLUSTER;
+            if (csect + cc > CLUSTER) cc = CLUSTER - csect;
+            checkedRead(v.disk, v.shadow, sector, out, cc);
+            offset += cc * SECTOR;
+            out += cc * SECTOR;
+            len -= cc * SECTOR;
+            continue;
+        }
+        if (f.bufSector != sector) {
+            checkedRead(v.disk, v.shadow, sector, f.buf, 1);
+            f.bufSector = sector;
+        }
+        uint32_t n = SECTOR - in < len ? SECTOR - in : len;
+        memcpy(out, f.buf + in, n);
+        offset += n;
+        out += n;
+        len -= n;
+    }
+}
+
+// Open, append a line, close: directory entry, data sector read-modify-
+// write, directory entry update
+void fatAppend(FatVolume& v, std::vector<uint8_t>& shadow, uint32_t logFirst, uint32_t& logSize, uint32_t len) {
+    v.moveWindow(DIR_SECTOR);
+    uint32_t sector = logFirst + logSize / SECTOR;
+    uint8_t buf[SECTOR];
+    checkedRead(v.disk, shadow, sector, buf, 1);
+    uint32_t in = logSize % SECTOR;
+    uint32_t n = len < SECTOR - in ? len : SECTOR - in;
+    memset(buf + in, 'a' + (logSize % 26), n);
+    check(v.disk.write(sector, buf, 1), "log write");
+    memcpy(shadow.data() + (size_t)sector * SECTOR, buf, SECTOR);
+    logSize += n;
+    memcpy(v.win, &logSize, sizeof(logSize));
+    check(v.disk.write(DIR_SECTOR, v.win, 1), "dir write");
+    memcpy(shadow.data() + (size_t)DIR_SECTOR * SECTOR, v.win, SECTOR);
+}
+
+const FatFile MP3 = {8192, 4u << 20};
+const FatFile HTTP = {20480, 2u << 20};
+const FatFile JPEG_BASE = {28672, 96u << 10};      // Thirty of these, one cluster gap each
+const FatFile MAP = {40960, 16u << 20};
+constexpr uint32_t LOG_FIRST = 90112;
+
+enum Workload { MP3_PLAY, JPEG_LOAD, HTTP_SERVE, MAP_LOOKUP, MIXED, WORKLOADS };
+const char* WORKLOAD_NAMES[] = {"mp3", "jpeg", "http", "map", "mixed"};
+
+void streamFile(FatVolume& v, const FatFile& file, uint32_t chunk, uint64_t& delivered) {
+    FatOpen f;
+    f.file = &file;
+    std::vector<uint8_t> buf(chunk);
+    for (uint32_t off = 0; off < file.size; off += chunk) {
+        uint32_t n = file.size - off < chunk ? file.size - off : chunk;
+        fatRead(v, f, off, n, buf.data());
+        delivered += n;
+    }
+}
+
+void mapLookup(FatVolume& v, FatOpen& f, std::mt19937& rng, uint64_t& delivered) {
+    uint8_t buf[4096];
+    if (rng() % 10 != 0) {
+        uint32_t len = 16 + rng() % 241;
+        uint32_t off = rng() % ((512u << 10) - len);
+        fatRead(v, f, off, len, buf);
+        delivered += len;
+    } else {
+        uint32_t off = (rng() % (MAP.size / 4096)) * 4096;
+        fatRead(v, f, off, 4096, buf);
+        delivered += 4096;
+    }
+}
+
+uint64_t runWorkload(Workload w, FatVolume& v, std::vector<uint8_t>& shadow) {
+    uint64_t delivered = 0;
+    std::mt19937 rng(42);
+    switch (w) {
+    case MP3_PLAY:
+        streamFile(v, MP3, 1940, delivered);
+        break;
+    case JPEG_LOAD:
+        for (uint32_t i = 0; i < 30; i++) {
+            FatFile jpeg = {JPEG_BASE.first + i * (JPEG_BASE.size / SECTOR + CLUSTER), JPEG_BASE.size};
+            streamFile(v, jpeg, 512, delivered);
+        }
+        break;
+    case HTTP_SERVE:
+        streamFile(v, HTTP, 1460, delivered);
+        break;
+    case MAP_LOOKUP: {
+        FatOpen f;
+        f.file = &MAP;
+        for (int i = 0; i < 20000; i++) mapLookup(v, f, rng, delivered);
+        break;
+    }
+    case MIXED: {
+        FatOpen mp3, map;
+        mp3.file = &MP3;
+        map.file = &MAP;
+        uint32_t logSize = 0;
+        uint8_t buf[1940];
+        uint32_t step = 0;
+        for (uint32_t off = 0; off < MP3.size; off += sizeof(buf), step++) {
+            uint32_t n = MP3.size - off < sizeof(buf) ? MP3.size - off : sizeof(buf);
+            fatRead(v, mp3, off, n, buf);
+            delivered += n;
+            mapLookup(v, map, rng, delivered);
+            mapLookup(v, map, rng, delivered);
+            if (step % 50 == 0) fatAppend(v, shadow, LOG_FIRST, logSize, 120);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return delivered;
+}
+
+// ---------------------------------------------------------------------------
+
+void correctness(ImageDevice& dev, std::vector<uint8_t>& shadow, int fd, uint32_t sectors) {
+    BlockCacheConfig cfg;
+    cfg.blocks = 64;
+    cfg.maxReadahead = 8;
+    BlockCache cache(dev, cfg);
+    check(cache.begin(sectors), "begin");
+    Disk d = {&cache, &dev};
+    std::mt19937 rng(1);
+    std::vector<uint8_t> buf(256 * SECTOR), disk(256 * SECTOR);
+
+    // Random traffic, clustered so blocks get reused and streams form
+    uint32_t cursor = 0;
+    for (int i = 0; i < 200000; i++) {
+        uint32_t r = rng() % 100;
+        uint32_t count = r < 70 ? 1 + rng() % 4 : r < 95 ? 1 + rng() % 32 : 1 + rng() % 200;
+        uint32_t sector;
+        if (rng() % 3 == 0) {
+            sector = cursor;    // Sequential stream
+        } else {
+            sector = (rng() % 4 == 0 ? rng() % sectors : rng() % 4096);
+        }
+        if (sector + count > sectors) sector = sectors - count;
+        cursor = sector + count >= sectors ? 0 : sector + count;
+        if (rng() % 8 == 0) {
+            for (uint32_t k = 0; k < count * SECTOR; k++) buf[k] = (uint8_t)rng();
+            check(cache.write(sector, buf.data(), count), "write");
+            memcpy(shadow.data() + (size_t)sector * SECTOR, buf.data(), (size_t)count * SECTOR);
+            // Write-through: the image has it already
+            check(pread(fd, disk.data(), (size_t)count * SECTOR, (off_t)sector * SECTOR) ==
+                      (ssize_t)(count * SECTOR) && memcmp(disk.data(), buf.data(), (size_t)count * SECTOR) == 0,
+                  "write reached the image");
+        } else {
+            checkedRead(d, shadow, sector, buf.data(), count);
+        }
+    }
+
+    // The short last block
+    checkedRead(d, shadow, sectors - 3, buf.data(), 3);
+    checkedRead(d, shadow, sectors - 1, buf.data(), 1);
+
+    // Written behind the cache's back: stale until invalidated
+    uint32_t s = 100;
+    checkedRead(d, shadow, s, buf.data(), 1);
+    memset(disk.data(), 0xA5, SECTOR);
+    check(pwrite(fd, disk.data(), SECTOR, (off_t)s * SECTOR) == SECTOR, "raw write");
+    check(cache.read(s, buf.data(), 1) && memcmp(buf.data(), shadow.data() + (size_t)s * SECTOR, SECTOR) == 0,
+          "stale before invalidate");
+    memcpy(shadow.data() + (size_t)s * SECTOR, disk.data(), SECTOR);
+    cache.invalidate();
+    checkedRead(d, shadow, s, buf.data(), 1);
+
+    // A failed write drops the cached copy (the card state is unknown)
+    memset(buf.data(), 0x5A, SECTOR);
+    dev.failWrite = true;
+    check(!cache.write(s, buf.data(), 1), "failed write reported");
+    checkedRead(d, shadow, s, buf.data(), 1);
+    BlockCacheStats st;
+    cache.getStats(st);
+    uint32_t readsBefore = st.deviceReads;
+    cache.read(s, buf.data(), 1);
+    cache.getStats(st);
+    check(st.deviceReads == readsBefore, "re-read after failed write is cached again");
+
+    // A failed read is reported and caches nothing
+    cache.invalidate();
+    dev.failRead = true;
+    check(!cache.read(5000, buf.data(), 1), "failed read reported");
+    checkedRead(d, shadow, 5000, buf.data(), 1);
+}
+
+struct Config {
+    const char* name;
+    uint32_t blocks;        // 0 = no cache
+    uint32_t maxReadahead;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint32_t imageMb = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 64;
+    if (imageMb < 64) imageMb = 64;    // The workload layout needs it
+    // A few sectors past a block boundary, so the last block is short
+    uint32_t sectors = imageMb * 2048 + 3;
+    std::string path = "/tmp/block_cache_bench.img";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open image");
+        return 1;
+    }
+    std::vector<uint8_t> shadow((size_t)sectors * SECTOR);
+    for (size_t i = 0; i < shadow.size(); i++) shadow[i] = pattern(i);
+    if (pwrite(fd, shadow.data(), shadow.size(), 0) != (ssize_t)shadow.size()) {
+        perror("write image");
+        return 1;
+    }
+    ImageDevice dev(fd, sectors);
+    correctness(dev, shadow, fd, sectors);
+
+    const Timing timings[] = {
+        {"SPI 4 MHz (SD library default)", 300, 1060, 250},
+        {"SPI 20 MHz", 300, 215, 250},
+    };
+    const Config configs[] = {
+        {"no cache", 0, 0},
+        {"256 KB", 64, 16},
+        {"512 KB", 128, 16},
+        {"1 MB", 256, 16},
+        {"512 KB, no read-ahead", 128, 0},
+    };
+
+    for (const Timing& t : timings) {
+        printf("\n%s: %.0f us per command, %.0f us per sector\n", t.name, t.cmdUs, t.sectorUs);
+        dev.timing = &t;
+        for (int w = 0; w < WORKLOADS; w++) {
+            printf("  %s\n", WORKLOAD_NAMES[w]);
+            double baseUs = 0;
+            for (const Config& c : configs) {
+                BlockCacheConfig cfg;
+                cfg.blocks = c.blocks ? c.blocks : 64;
+                cfg.maxReadahead = c.maxReadahead;
+                BlockCache cache(dev, cfg);
+                if (c.blocks) check(cache.begin(sectors), "begin");
+                Disk d = {c.blocks ? &cache : nullptr, &dev};
+                FatVolume v = {d, shadow, UINT32_MAX, {}};
+                dev.reset();
+                uint64_t delivered = runWorkload((Workload)w, v, shadow);
+                if (!c.blocks) baseUs = dev.simUs;
+                BlockCacheStats s;
+                cache.getStats(s);
+                double mbps = delivered / 1048576.0 / (dev.simUs / 1e6);
+                printf("    %-22s %8.0f ms %7.3f MB/s %5.2fx %7llu cmds", c.name, dev.simUs / 1000, mbps,
+                       baseUs / dev.simUs, (unsigned long long)(dev.reads + dev.writes));
+                if (c.blocks) {
+                    uint32_t lookups = s.hits + s.misses;
+                    printf("  hit %5.1f%%  ahead %u used %u wasted %u",
+                           lookups ? 100.0 * s.hits / lookups : 0.0, s.readahead, s.readaheadUsed,
+                           s.readaheadWasted);
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    close(fd);
+    remove(path.c_str());
+    if (failures) {
+        printf("\n%d check(s) FAILED\n", failures);
+        return 1;
+    }
+    printf("\nall checks passed\n");
+    return 0;
+}
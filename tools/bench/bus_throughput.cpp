@@ -0,0 +1,193 @@
+// Host benchmark for message bus routing (src/util/topic_router.cpp).
+//
+// Measures publish -> dispatch throughput of the bus core without Lua:
+// messages go through a fixed ring like MessageBus's queue and are routed to
+// counting subscribers. Two routers are compared on the same workload:
+//
+//   linear   the previous scheme: a std::deque of messages carrying topic
+//            strings, and a string compare against every subscription for
+//            every message
+//   router   interned topic ids, the wildcard trie and per-topic match cache
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/bus_throughput
+//         tools/bench/bus_throughput.cpp src/util/topic_router.cpp
+//     /tmp/bus_throughput [messages] [subscribers]
+//
+// The workload is a UI-ish mix: a few hot topics (input, timers, mesh
+// traffic) and a long tail of rarer ones, each subscriber on an exact topic.
+// Lua callback cost dominates on the device; this isolates what the bus
+// itself adds per message.
+//
+// Also checks that matchesAny() answers like match() without interning.
+
+#include "topic_router.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t QUEUE_SIZE = 64;
+
+struct Workload {
+    std::vector<std::string> topics;
+    std::vector<uint32_t> sequence;  // Index into topics, per message
+    std::vector<std::string> patterns;
+};
+
+Workload makeWorkload(size_t messages, size_t subscribers) {
+    static const char* hot[] = {
+        "input/key", "input/touch", "timer/tick", "mesh/packet/rx",
+        "mesh/node/discovered", "screen/pushed", "gps/fix", "battery/level",
+    };
+    Workload w;
+    for (const char* t : hot) w.topics.push_back(t);
+    for (int i = 0; i < 56; i++) {
+        w.topics.push_back("service/" + std::to_string(i % 8) + "/event" + std::to_string(i));
+    }
+
+    std::mt19937 rng(4242);
+    for (size_t i = 0; i < subscribers; i++) {
+        w.patterns.push_back(w.topics[rng() % w.topics.size()]);
+    }
+    w.sequence.reserve(messages);
+    for (size_t i = 0; i < messages; i++) {
+        // 80% of traffic on the hot topics
+        uint32_t t = rng() % 10 < 8 ? rng() % 8 : rng() % w.topics.size();
+        w.sequence.push_back(t);
+    }
+    return w;
+}
+
+// Publish in bursts of up to a queue's worth, then drain, like a frame.
+template <typename Post, typename Drain>
+double run(size_t messages, Post&& post, Drain&& drain) {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while (i < messages) {
+        size_t burst = messages - i < QUEUE_SIZE ? messages - i : QUEUE_SIZE;
+        for (size_t j = 0; j < burst; j++) post(i + j);
+        drain();
+        i += burst;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count();
+}
+
+struct LinearMessage {
+    std::string topic;
+    std::string data;
+};
+
+struct RingMessage {
+    TopicRouter::TopicId topicId;
+    std::string data;
+};
+
+// matchesAny() (ez.bus.has_subscribers) must agree with intern() + match()
+// without interning anything, including for segments no pattern names.
+bool checkMatchesAny() {
+    static const char* patterns[] = {"input/key", "mesh/+/rx", "debug/#", "+/status", "a/+/+/d"};
+    static const char* probes[] = {
+        "input/key", "input/touch", "mesh/ch1/rx", "mesh/never_seen/rx", "mesh/ch1/tx",
+        "mesh/rx", "debug", "debug/memory/heap", "radio/status", "radio/status/x",
+        "a/b/c/d", "a/b/d", "nobody/listens", "", "mesh//rx",
+    };
+    TopicRouter probe, reference;
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        probe.subscribe((int)i + 1, patterns[i]);
+        reference.subscribe((int)i + 1, patterns[i]);
+    }
+    bool ok = true;
+    for (const char* topic : probes) {
+        bool expected = !reference.match(reference.intern(topic)).empty();
+        if (probe.matchesAny(topic) != expected) {
+            fprintf(stderr, "matchesAny(\"%s\") != %d\n", topic, expected);
+            ok = false;
+        }
+    }
+    if (probe.topicCount() != 0) {
+        fprintf(stderr, "matchesAny interned %zu topics\n", probe.topicCount());
+        ok = false;
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t messages = argc > 1 ? (size_t)atol(argv[1]) : 2000000;
+    size_t subscribers = argc > 2 ? (size_t)atol(argv[2]) : 40;
+    Workload w = makeWorkload(messages, subscribers);
+    const std::string payload = "payload";
+    if (!checkMatchesAny()) return 1;
+
+    // --- linear ---------------------------------------------------------
+    std::map<int, std::string> subs;
+    for (size_t i = 0; i < w.patterns.size(); i++) subs[(int)i + 1] = w.patterns[i];
+    std::vector<uint64_t> linearHits(subscribers + 1, 0);
+    std::deque<LinearMessage> queue;
+
+    double linearNs = run(messages,
+        [&](size_t i) { queue.push_back({w.topics[w.sequence[i]], payload}); },
+        [&]() {
+            std::vector<LinearMessage> batch;
+            while (!queue.empty()) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            for (const auto& msg : batch) {
+                std::vector<int> matched;
+                for (const auto& [id, pattern] : subs) {
+                    if (pattern == msg.topic) matched.push_back(id);
+                }
+                for (int id : matched) linearHits[id]++;
+            }
+        });
+
+    // --- router ---------------------------------------------------------
+    TopicRouter router;
+    for (size_t i = 0; i < w.patterns.size(); i++) router.subscribe((int)i + 1, w.patterns[i].c_str());
+    std::vector<uint64_t> routerHits(subscribers + 1, 0);
+    RingMessage ring[QUEUE_SIZE];
+    size_t head = 0, count = 0;
+
+    double routerNs = run(messages,
+        [&](size_t i) {
+            RingMessage& slot = ring[(head + count) % QUEUE_SIZE];
+            slot.topicId = router.intern(w.topics[w.sequence[i]].c_str());
+            slot.data.assign(payload);
+            count++;
+        },
+        [&]() {
+            while (count > 0) {
+                RingMessage& msg = ring[head];
+                head = (head + 1) % QUEUE_SIZE;
+                count--;
+                for (int id : router.match(msg.topicId)) routerHits[id]++;
+            }
+        });
+
+    if (linearHits != routerHits) {
+        fprintf(stderr, "routers disagree on deliveries\n");
+        return 1;
+    }
+    uint64_t deliveries = 0;
+    for (uint64_t h : routerHits) deliveries += h;
+
+    printf("%zu messages, %zu subscribers, %zu topics, %llu deliveries\n\n",
+           messages, subscribers, w.topics.size(), (unsigned long long)deliveries);
+    printf("  %-8s %8.1f ns/msg  %6.2f M msg/s\n", "linear",
+           linearNs / messages, messages / linearNs * 1e3);
+    printf("  %-8s %8.1f ns/msg  %6.2f M msg/s\n", "router",
+           routerNs / messages, messages / routerNs * 1e3);
+    return 0;
+}
@@ -0,0 +1,243 @@
+// Host check for the profiler's stack table (src/util/folded_stacks.cpp).
+//
+// Feeds a stream of synthetic samples -- a few hundred functions, call
+// stacks drawn from a skewed distribution like a real UI loop -- into
+// FoldedStacks and into a std::map reference, then parses the folded
+// export back and compares the counts. Also checks that a table too
+// small for the workload reports drops instead of corrupting entries,
+// and that a tiny export buffer never splits a line. Any mismatch exits 1.
+// Prints the cost of add() per sample.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/folded_stacks_check
+//         tools/bench/folded_stacks_check.cpp src/util/folded_stacks.cpp
+//     /tmp/folded_stacks_check [samples]
+
+#include "folded_stacks.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t FUNCS = 300;
+constexpr size_t SHAPES = 1500;     // Distinct stacks the workload can produce
+
+struct Shape {
+    std::vector<uint16_t> funcs;    // Leaf first, indices into names
+    std::string folded;             // Root-first reference line key
+};
+
+std::vector<std::string> makeNames() {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < FUNCS; i++) {
+        char buf[96];
+        if (i % 17 == 0) {
+            snprintf(buf, sizeof(buf), "fn%zu [C]", i);
+        } else if (i % 23 == 0) {
+            // Over-long, with a ';' that must not split the frame
+            snprintf(buf, sizeof(buf),
+                     "very_long_function_name_%zu;with_separator@$ui/some/deep/module.lua:%zu",
+                     i, i * 7);
+        } else {
+            snprintf(buf, sizeof(buf), "fn%zu@$ui/mod%zu.lua:%zu", i, i % 40, i * 3);
+        }
+        names.push_back(buf);
+    }
+    return names;
+}
+
+// What the table stores for `name`: truncated, ';' -> ','.
+std::string stored(const std::string& name) {
+    std::string s = name.substr(0, FoldedStacks::FRAME_NAME_LEN - 1);
+    for (char& c : s) {
+        if (c == ';') c = ',';
+    }
+    return s;
+}
+
+std::vector<Shape> makeShapes(const std::vector<std::string>& names, std::mt19937& rng) {
+    std::vector<Shape> shapes(SHAPES);
+    for (Shape& sh : shapes) {
+        size_t depth = 1 + rng() % 12;
+        if (rng() % 50 == 0) depth = FoldedStacks::MAX_DEPTH + 8;  // Too deep, gets cut
+        for (size_t d = 0; d < depth; d++) sh.funcs.push_back((uint16_t)(rng() % FUNCS));
+        size_t kept = depth < FoldedStacks::MAX_DEPTH ? depth : FoldedStacks::MAX_DEPTH;
+        for (size_t d = kept; d-- > 0;) {
+            sh.folded += stored(names[sh.funcs[d]]);
+            if (d > 0) sh.folded += ';';
+        }
+    }
+    return shapes;
+}
+
+std::map<std::string, uint64_t> parseFolded(const std::string& text, size_t& failures) {
+    std::map<std::string, uint64_t> out;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) {
+            failures++;  // Unterminated line
+            break;
+        }
+        std::string line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+        size_t sp = line.rfind(' ');
+        if (sp == std::string::npos) {
+            failures++;
+            continue;
+        }
+        out[line.substr(0, sp)] += strtoull(line.c_str() + sp + 1, nullptr, 10);
+    }
+    return out;
+}
+
+std::string exportAll(const FoldedStacks& t, size_t cap, size_t& failures) {
+    std::string text;
+    std::vector<char> buf(cap);
+    size_t cursor = 0;
+    while (cursor < t.end()) {
+        size_t before = cursor;
+        size_t n = t.writeFolded(cursor, buf.data(), cap);
+        if (n == 0 && cursor == before) {
+            failures++;  // A line that can never fit
+            break;
+        }
+        if (n > 0 && buf[n - 1] != '\n') failures++;  // Split line
+        text.append(buf.data(), n);
+    }
+    return text;
+}
+
+struct Run {
+    std::map<std::string, uint64_t> reference;
+    uint64_t weight = 0;
+    double addNs = 0;
+};
+
+// Record `samples` samples into `t`, the way LuaProfiler does: find the
+// frame, insert on miss, add the leaf-first id stack.
+Run record(FoldedStacks& t, const std::vector<std::string>& names,
+           const std::vector<Shape>& shapes, size_t samples, std::mt19937 rng) {
+    Run run;
+    std::vector<uint16_t> ids(FoldedStacks::MAX_DEPTH + 16);
+    std::chrono::nanoseconds spent{0};
+    for (size_t i = 0; i < samples; i++) {
+        // Skewed: a few stacks dominate, as in a render loop
+        size_t pick = (size_t)(SHAPES * std::pow((double)(rng() % 10000) / 10000.0, 3.0));
+        const Shape& sh = shapes[pick];
+        uint32_t weight = 1 + (rng() % 16 == 0 ? rng() % 5 : 0);
+
+        auto t0 = std::chrono::steady_clock::now();
+        size_t depth = 0;
+        for (size_t d = 0; d < sh.funcs.size() && depth < FoldedStacks::MAX_DEPTH; d++) {
+            uint32_t key = FoldedStacks::hash((uint32_t)sh.funcs[d], 0x811C9DC5u);
+            uint16_t id = t.find(key);
+            if (id == FoldedStacks::NO_FRAME) id = t.insert(key, names[sh.funcs[d]].c_str());
+            ids[depth++] = id;
+        }
+        t.add(ids.data(), depth, weight);
+        spent += std::chrono::steady_clock::now() - t0;
+
+        run.reference[sh.folded] += weight;
+        run.weight += weight;
+    }
+    run.addNs = (double)spent.count() / (double)samples;
+    return run;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t samples = argc > 1 ? (size_t)atol(argv[1]) : 200000;
+    size_t failures = 0;
+
+    std::mt19937 rng(4242);
+    std::vector<std::string> names = makeNames();
+    std::vector<Shape> shapes = makeShapes(names, rng);
+
+    // 1. Roomy tables (the device sizes): export must match exactly.
+    {
+        const size_t frameSlots = 1024, stackSlots = 2048;
+        std::vector<uint8_t> mem(FoldedStacks::bytesNeeded(frameSlots, stackSlots));
+        FoldedStacks t;
+        t.attach(mem.data(), frameSlots, stackSlots);
+        Run run = record(t, names, shapes, samples, rng);
+
+        const size_t cap = FoldedStacks::MAX_DEPTH * FoldedStacks::FRAME_NAME_LEN + 16;
+        std::string text = exportAll(t, cap, failures);
+        std::map<std::string, uint64_t> got = parseFolded(text, failures);
+        if (got != run.reference) {
+            size_t diff = 0;
+            for (const auto& kv : run.reference) {
+                auto it = got.find(kv.first);
+                if (it == got.end() || it->second != kv.second) diff++;
+            }
+            printf("full table: %zu stacks differ from reference\n", diff);
+            failures++;
+        }
+        const FoldedStacks::Stats& st = t.stats();
+        if (st.samples != run.weight || st.droppedSamples || st.droppedFrames) failures++;
+
+        printf("%zu samples, %u stacks, %u frames, %zu bytes of export\n", samples,
+               (unsigned)st.stacks, (unsigned)st.frames, text.size());
+        printf("  add path: %.0f ns/sample (find/insert + add)\n", run.addNs);
+
+        // The same export through a buffer that only ever fits one line
+        // must produce the same text.
+        size_t longest = 0, pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl - pos + 1 > longest) longest = nl - pos + 1;
+            pos = nl + 1;
+        }
+        std::string narrow = exportAll(t, longest + 1, failures);
+        if (narrow != text) {
+            printf("narrow export differs\n");
+            failures++;
+        }
+    }
+
+    // 2. Undersized tables: drops are counted, kept stacks stay exact.
+    {
+        const size_t frameSlots = 64, stackSlots = 128;
+        std::vector<uint8_t> mem(FoldedStacks::bytesNeeded(frameSlots, stackSlots));
+        FoldedStacks t;
+        t.attach(mem.data(), frameSlots, stackSlots);
+        Run run = record(t, names, shapes, samples / 4, rng);
+
+        const size_t cap = FoldedStacks::MAX_DEPTH * FoldedStacks::FRAME_NAME_LEN + 16;
+        std::map<std::string, uint64_t> got = parseFolded(exportAll(t, cap, failures), failures);
+        const FoldedStacks::Stats& st = t.stats();
+        if (st.samples + st.droppedSamples != run.weight) failures++;
+        if (st.stacks >= stackSlots || st.frames >= frameSlots) failures++;
+
+        // Stacks made only of known frames must carry their exact count.
+        uint64_t exported = 0;
+        for (const auto& kv : got) {
+            exported += kv.second;
+            if (kv.first.find('?') != std::string::npos) continue;
+            auto it = run.reference.find(kv.first);
+            if (it == run.reference.end() || it->second != kv.second) failures++;
+        }
+        if (exported != st.samples) failures++;
+        printf("undersized: kept %u samples in %u stacks, dropped %u samples, %u frames\n",
+               (unsigned)st.samples, (unsigned)st.stacks, (unsigned)st.droppedSamples,
+               (unsigned)st.droppedFrames);
+    }
+
+    if (failures) {
+        printf("\nFAILED: %zu mismatches\n", failures);
+        return 1;
+    }
+    printf("\nall checks passed\n");
+    return 0;
+}
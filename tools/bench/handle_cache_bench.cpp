@@ -0,0 +1,266 @@
+// Host check and benchmark for the read handle cache
+// (src/util/handle_cache.h).
+//
+// Writes a large archive file (default 64 MB) a few directories deep plus
+// three small hot files, then:
+//
+//   checks     random reads through the cache match the file contents;
+//              an invalidated file is reopened and shows its new bytes;
+//              expiry reopens a handle after maxAgeMs; a path already
+//              lent out is refused; group limits hold. Any failure exits 1.
+//   benchmark  random 4 KB reads against the archive, and a mix of the
+//              archive and the hot files, once opening the file for every
+//              read (what read_bytes used to do) and once through the
+//              cache with the firmware's slots and SD limit.
+//
+// Host opens are cheap next to FAT on an SD card, where each one walks
+// the directory chain, so the opens avoided are the number that carries
+// over to the device; the timings show the floor.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/handle_cache_bench
+//         tools/bench/handle_cache_bench.cpp
+//     /tmp/handle_cache_bench [archive MB]
+
+#include "handle_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t SLOTS = 4;           // Same as FileHandleCache
+constexpr size_t GROUP_LIMIT = 2;     // SD_HANDLES
+constexpr uint32_t MAX_AGE_MS = 5000;
+constexpr size_t READ_SIZE = 4096;
+
+struct PosixHandle {
+    int fd = -1;
+    explicit operator bool() const { return fd >= 0; }
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+};
+
+PosixHandle openPosix(const char* path) {
+    PosixHandle h;
+    h.fd = ::open(path, O_RDONLY);
+    return h;
+}
+
+using Cache = HandleCache<PosixHandle, SLOTS>;
+
+uint8_t expected(uint32_t salt, uint64_t offset) {
+    uint64_t x = (offset / 8) * 0x9E3779B97F4A7C15ull + salt;
+    x ^= x >> 29;
+    return (uint8_t)(x >> (8 * (offset % 8)));
+}
+
+void writeFile(const std::string& path, uint32_t salt, size_t size) {
+    FILE* f = fopen(path.c_str(), "wb");
+    std::vector<uint8_t> chunk(1 << 20);
+    for (size_t off = 0; off < size; off += chunk.size()) {
+        size_t n = std::min(chunk.size(), size - off);
+        for (size_t i = 0; i < n; i++) chunk[i] = expected(salt, off + i);
+        fwrite(chunk.data(), 1, n, f);
+    }
+    fclose(f);
+}
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+struct Target {
+    std::string path;
+    uint32_t salt;
+    size_t size;
+};
+
+// One read of READ_SIZE bytes the way read_bytes does it, through the
+// cache or with an open of its own
+bool readVia(Cache* cache, const Target& t, uint64_t offset, uint8_t* buf, uint32_t now) {
+    int slot = Cache::NONE;
+    PosixHandle own;
+    PosixHandle* h = &own;
+    if (cache) {
+        slot = cache->acquire(t.path.c_str(), 0, GROUP_LIMIT, now, openPosix);
+        if (slot >= 0) h = &cache->handle(slot);
+    }
+    if (slot == Cache::NONE) own = openPosix(t.path.c_str());
+    bool ok = *h && pread(h->fd, buf, READ_SIZE, (off_t)offset) == (ssize_t)READ_SIZE;
+    if (slot >= 0) {
+        cache->release(slot, ok);
+    } else {
+        own.close();
+    }
+    return ok;
+}
+
+bool matches(const Target& t, uint64_t offset, const uint8_t* buf) {
+    for (size_t i = 0; i < READ_SIZE; i++) {
+        if (buf[i] != expected(t.salt, offset + i)) return false;
+    }
+    return true;
+}
+
+struct RunResult {
+    double usPerRead;
+    double mbPerSec;
+    HandleCacheStats stats;
+};
+
+RunResult run(bool cached, const std::vector<Target>& targets, const std::vector<double>& weights,
+              size_t reads, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    Cache cache(MAX_AGE_MS);
+    uint8_t buf[READ_SIZE];
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reads; i++) {
+        const Target& t = targets[pick(rng)];
+        uint64_t offset = (rng() % (t.size / READ_SIZE)) * READ_SIZE;
+        // About one read per ms of simulated time, so expiry plays a part
+        if (!readVia(cached ? &cache : nullptr, t, offset, buf, (uint32_t)i)) {
+            check(false, "benchmark read");
+            break;
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    RunResult r;
+    r.usPerRead = sec * 1e6 / reads;
+    r.mbPerSec = reads * READ_SIZE / 1048576.0 / sec;
+    cache.getStats(r.stats);
+    return r;
+}
+
+void report(const char* name, const RunResult& plain, const RunResult& cached, size_t reads) {
+    const HandleCacheStats& s = cached.stats;
+    printf("%s (%zu reads of 4 KB)\n", name, reads);
+    printf("  open per read   %7.2f us/read %8.1f MB/s   %zu opens\n",
+           plain.usPerRead, plain.mbPerSec, reads);
+    printf("  handle cache    %7.2f us/read %8.1f MB/s   %u opens, %u avoided "
+           "(%.1f%%), %u evictions, %u expired\n",
+           cached.usPerRead, cached.mbPerSec, s.opens, s.hits,
+           100.0 * s.hits / reads, s.evictions, s.expired);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t archiveMb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+    std::string root = "/tmp/handle_cache_bench";
+    std::string deep = root + "/maps/region/tiles";
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/maps").c_str(), 0755);
+    mkdir((root + "/maps/region").c_str(), 0755);
+    mkdir(deep.c_str(), 0755);
+
+    std::vector<Target> targets = {
+        {deep + "/archive.bin", 1, archiveMb << 20},
+        {root + "/font_a.bin", 2, 256 << 10},
+        {root + "/font_b.bin", 3, 256 << 10},
+        {root + "/index.bin", 4, 128 << 10},
+    };
+    for (const Target& t : targets) writeFile(t.path, t.salt, t.size);
+
+    // Correctness: random mixed reads
+    {
+        std::mt19937 rng(7);
+        Cache cache(MAX_AGE_MS);
+        uint8_t buf[READ_SIZE];
+        for (uint32_t i = 0; i < 20000; i++) {
+            const Target& t = targets[rng() % targets.size()];
+            uint64_t offset = rng() % (t.size - READ_SIZE);
+            if (!readVia(&cache, t, offset, buf, i) || !matches(t, offset, buf)) {
+                check(false, "cached read matches file");
+                break;
+            }
+            check(cache.openCount() <= GROUP_LIMIT, "group limit");
+        }
+    }
+
+    // Invalidation: a rewritten file is reopened
+    {
+        Cache cache(MAX_AGE_MS);
+        uint8_t buf[READ_SIZE];
+        Target t = targets[1];
+        check(readVia(&cache, t, 0, buf, 0) && matches(t, 0, buf), "read before rewrite");
+        std::string tmp = t.path + ".new";
+        t.salt = 99;
+        writeFile(tmp, t.salt, t.size);
+        rename(tmp.c_str(), t.path.c_str());   // New inode; an old fd keeps the old bytes
+        check(readVia(&cache, t, 0, buf, 1) && !matches(t, 0, buf), "stale handle before invalidate");
+        cache.invalidate(0, root.c_str());
+        check(readVia(&cache, t, 0, buf, 2) && matches(t, 0, buf), "fresh after invalidating parent dir");
+
+        // Expiry: rewrite again without invalidating
+        t.salt = 100;
+        writeFile(tmp, t.salt, t.size);
+        rename(tmp.c_str(), t.path.c_str());
+        check(readVia(&cache, t, 0, buf, 3) && !matches(t, 0, buf), "stale within max age");
+        check(readVia(&cache, t, 0, buf, 4 + MAX_AGE_MS) && matches(t, 0, buf), "fresh after max age");
+        HandleCacheStats s;
+        cache.getStats(s);
+        check(s.invalidations == 1 && s.expired == 1, "invalidation and expiry counted");
+        writeFile(t.path, targets[1].salt, t.size);
+
+        // A path lent out is refused, and an invalidation while lent
+        // closes it on release
+        int a = cache.acquire(t.path.c_str(), 0, GROUP_LIMIT, 10, openPosix);
+        int b = cache.acquire(t.path.c_str(), 0, GROUP_LIMIT, 10, openPosix);
+        check(a >= 0 && b == Cache::NONE, "busy path bypassed");
+        cache.invalidate(0, t.path.c_str());
+        cache.release(a);
+        check(cache.openCount() == 0, "invalidated while busy closes on release");
+        check(cache.acquire((root + "/missing").c_str(), 0, GROUP_LIMIT, 10, openPosix) == Cache::FAILED,
+              "missing file fails");
+
+        // Another group keeps its own entries
+        int x = cache.acquire(targets[2].path.c_str(), 1, 2, 20, openPosix);
+        cache.release(x);
+        int y = cache.acquire(targets[3].path.c_str(), 0, 1, 20, openPosix);
+        cache.release(y);
+        int z = cache.acquire(targets[1].path.c_str(), 0, 1, 20, openPosix);
+        cache.release(z);
+        check(cache.openCount() == 2, "per-group limit evicts within the group");
+        cache.invalidate(1, "/");
+        check(cache.openCount() == 1, "invalidating a group root drops only that group");
+    }
+
+    const size_t reads = 200000;
+    RunResult plain = run(false, targets, {1}, reads, 11);
+    RunResult cached = run(true, targets, {1}, reads, 11);
+    report("archive only", plain, cached, reads);
+    RunResult plainMix = run(false, targets, {6, 2, 1, 1}, reads, 12);
+    RunResult cachedMix = run(true, targets, {6, 2, 1, 1}, reads, 12);
+    report("archive + 3 hot files", plainMix, cachedMix, reads);
+
+    for (const Target& t : targets) ::remove(t.path.c_str());
+    rmdir(deep.c_str());
+    rmdir((root + "/maps/region").c_str());
+    rmdir((root + "/maps").c_str());
+    rmdir(root.c_str());
+    if (failures) {
+        printf("\n%d check(s) FAILED\n", failures);
+        return 1;
+    }
+    printf("\nall checks passed\n");
+    return 0;
+}
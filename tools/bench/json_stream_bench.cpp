@@ -0,0 +1,250 @@
+// Host benchmark and check for the streaming JSON reader/writer
+// (src/util/json_stream.cpp).
+//
+// Checks a set of small documents (escapes, surrogate pairs, number forms,
+// nesting) round-trip to the expected canonical text, and that malformed
+// input is rejected. Then generates a message-history-like document of
+// the requested size with JsonWriter, and times:
+//
+//   parse      JsonReader into a handler that only counts tokens
+//   roundtrip  JsonReader -> JsonWriter into memory, compared byte for byte
+//              with the generated text
+//   write      JsonWriter into a 4 KB chunk sink (the file path's shape)
+//
+// Any mismatch or accepted bad input exits 1.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/json_stream_bench
+//         tools/bench/json_stream_bench.cpp src/util/json_stream.cpp
+//     /tmp/json_stream_bench [megabytes]
+
+#include "json_stream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace {
+
+bool stringSink(void* ctx, const char* data, size_t len) {
+    static_cast<std::string*>(ctx)->append(data, len);
+    return true;
+}
+
+bool countSink(void* ctx, const char*, size_t len) {
+    *static_cast<size_t*>(ctx) += len;
+    return true;
+}
+
+// Re-emits every token: parse + this = canonical minified JSON
+class Echo : public JsonHandler {
+public:
+    explicit Echo(JsonWriter& w) : w(w) {}
+    bool null() override { w.null(); return true; }
+    bool boolean(bool v) override { w.boolean(v); return true; }
+    bool integer(int64_t v) override { w.integer(v); return true; }
+    bool number(double v) override { w.number(v); return true; }
+    bool string(const char* s, size_t n) override { w.string(s, n); return true; }
+    bool key(const char* s, size_t n) override { w.key(s, n); return true; }
+    bool startObject() override { w.beginObject(); return true; }
+    bool endObject() override { w.endObject(); return true; }
+    bool startArray() override { w.beginArray(); return true; }
+    bool endArray() override { w.endArray(); return true; }
+
+private:
+    JsonWriter& w;
+};
+
+class Counter : public JsonHandler {
+public:
+    size_t tokens = 0;
+    size_t stringBytes = 0;
+    bool null() override { tokens++; return true; }
+    bool boolean(bool) override { tokens++; return true; }
+    bool integer(int64_t) override { tokens++; return true; }
+    bool number(double) override { tokens++; return true; }
+    bool string(const char*, size_t n) override { tokens++; stringBytes += n; return true; }
+    bool key(const char*, size_t n) override { tokens++; stringBytes += n; return true; }
+    bool startObject() override { tokens++; return true; }
+    bool endObject() override { return true; }
+    bool startArray() override { tokens++; return true; }
+    bool endArray() override { return true; }
+};
+
+bool roundTrip(const std::string& in, std::string& out, std::string& err) {
+    out.clear();
+    char chunk[64];
+    JsonWriter w(chunk, sizeof(chunk), stringSink, &out);
+    Echo echo(w);
+    JsonReader r;
+    if (!r.parse(in.data(), in.size(), echo)) {
+        err = std::string(r.error()) + " at " + std::to_string(r.errorOffset());
+        return false;
+    }
+    if (!w.finish()) {
+        err = "writer failed";
+        return false;
+    }
+    return true;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// A DM history: conversations keyed by peer, each an array of messages
+void generate(std::string& out, size_t targetBytes) {
+    std::mt19937 rng(42);
+    static const char* words[] = {"hello", "mesh", "node", "ok", "see", "you", "at", "the",
+                                  "ridge", "\"quoted\"", "caf\xc3\xa9", "line\nbreak", "tab\there"};
+    char chunk[4096];
+    JsonWriter w(chunk, sizeof(chunk), stringSink, &out);
+    w.beginObject();
+    w.key("conversations", 13);
+    w.beginObject();
+    int conv = 0;
+    while (w.bytesWritten() < targetBytes) {
+        char peer[16];
+        int n = snprintf(peer, sizeof(peer), "%08x", (unsigned)rng());
+        w.key(peer, (size_t)n);
+        w.beginArray();
+        for (int m = 0; m < 200; m++) {
+            w.beginObject();
+            std::string text;
+            for (int k = 0, nw = 3 + rng() % 12; k < nw; k++) {
+                if (k) text += ' ';
+                text += words[rng() % (sizeof(words) / sizeof(words[0]))];
+            }
+            w.key("text", 4);
+            w.string(text.data(), text.size());
+            w.key("timestamp", 9);
+            w.integer(1700000000 + (int64_t)(rng() % 10000000));
+            w.key("is_self", 7);
+            w.boolean(rng() & 1);
+            w.key("rssi", 4);
+            w.integer(-(int64_t)(rng() % 120));
+            w.key("snr", 3);
+            w.number((double)(int)(rng() % 400) / 16.0 - 10.0);
+            w.key("status", 6);
+            w.null();
+            w.endObject();
+        }
+        w.endArray();
+        conv++;
+    }
+    w.endObject();
+    w.key("unread", 6);
+    w.beginObject();
+    w.endObject();
+    w.endObject();
+    w.finish();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t mb = argc > 1 ? (size_t)atol(argv[1]) : 8;
+    size_t failures = 0;
+
+    struct Case { const char* in; const char* out; };
+    static const Case cases[] = {
+        {"  {\"a\" : [1, 2.5, -3e2, true, false, null], \"b\":{}}  ",
+         "{\"a\":[1,2.5,-300.0,true,false,null],\"b\":{}}"},
+        {"\"x\\\"\\\\\\/\\n\\u00e9\\ud83d\\ude00\"", "\"x\\\"\\\\/\\n\xc3\xa9\xf0\x9f\x98\x80\""},
+        {"\"\\ud800x\"", "\"\xef\xbf\xbdx\""},
+        {"[9223372036854775807,-9223372036854775808,9223372036854775808]",
+         "[9223372036854775807,-9223372036854775808,9.2233720368548e+18]"},
+        {"[0,-0,0.5,1E3,1e-2,12345678901234567890123]",
+         "[0,0,0.5,1000.0,0.01,1.2345678901235e+22]"},
+        {"[[[[[]]]],{\"k\":[{}]}]", "[[[[[]]]],{\"k\":[{}]}]"},
+        {"\"\x01\"", nullptr},
+        {"{\"a\":}", nullptr},
+        {"[1,]", nullptr},
+        {"[1 2]", nullptr},
+        {"{\"a\" 1}", nullptr},
+        {"{1:2}", nullptr},
+        {"\"abc", nullptr},
+        {"01", nullptr},
+        {"-", nullptr},
+        {"1.", nullptr},
+        {"tru", nullptr},
+        {"\"\\x\"", nullptr},
+        {"[1] x", nullptr},
+        {"", nullptr},
+    };
+    for (const Case& c : cases) {
+        std::string out, err;
+        bool ok = roundTrip(c.in, out, err);
+        if (c.out && (!ok || out != c.out)) {
+            printf("FAIL  %s\n  got %s%s\n  want %s\n", c.in, ok ? "" : "error: ",
+                   ok ? out.c_str() : err.c_str(), c.out);
+            failures++;
+        } else if (!c.out && ok) {
+            printf("FAIL  accepted bad input %s\n", c.in);
+            failures++;
+        }
+    }
+    {
+        std::string deep(JsonReader::MAX_DEPTH + 1, '['), out, err;
+        deep += std::string(JsonReader::MAX_DEPTH + 1, ']');
+        if (roundTrip(deep, out, err)) {
+            printf("FAIL  accepted nesting past MAX_DEPTH\n");
+            failures++;
+        }
+    }
+    printf("%zu fixed cases checked\n\n", sizeof(cases) / sizeof(cases[0]) + 1);
+
+    std::string doc;
+    doc.reserve(mb * 1024 * 1024 + 65536);
+    generate(doc, mb * 1024 * 1024);
+    double size = (double)doc.size() / (1024.0 * 1024.0);
+
+    Counter counter;
+    JsonReader reader;
+    auto t0 = std::chrono::steady_clock::now();
+    if (!reader.parse(doc.data(), doc.size(), counter)) {
+        printf("FAIL  generated document: %s at %zu\n", reader.error(), reader.errorOffset());
+        return 1;
+    }
+    double parseS = secondsSince(t0);
+
+    std::string echoed, err;
+    echoed.reserve(doc.size());
+    t0 = std::chrono::steady_clock::now();
+    bool ok = roundTrip(doc, echoed, err);
+    double rtS = secondsSince(t0);
+    if (!ok || echoed != doc) {
+        printf("FAIL  roundtrip %s\n", ok ? "output differs" : err.c_str());
+        failures++;
+    }
+
+    size_t written = 0;
+    char chunk[4096];
+    t0 = std::chrono::steady_clock::now();
+    {
+        JsonWriter w(chunk, sizeof(chunk), countSink, &written);
+        Echo echo(w);
+        JsonReader r;
+        r.parse(doc.data(), doc.size(), echo);
+        w.finish();
+    }
+    double writeS = secondsSince(t0) - parseS;
+
+    printf("document   %.1f MB, %zu tokens, %.1f MB of string data\n", size, counter.tokens,
+           (double)counter.stringBytes / (1024.0 * 1024.0));
+    printf("parse      %7.1f ms  %7.1f MB/s\n", parseS * 1000, size / parseS);
+    printf("roundtrip  %7.1f ms  %7.1f MB/s\n", rtS * 1000, size / rtS);
+    printf("write      %7.1f ms  %7.1f MB/s (4 KB chunks, parse time subtracted)\n",
+           writeS * 1000, writeS > 0 ? size / writeS : 0.0);
+
+    if (failures) {
+        printf("\nFAILED: %zu\n", failures);
+        return 1;
+    }
+    printf("\nall checks passed\n");
+    return 0;
+}
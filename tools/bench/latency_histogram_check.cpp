@@ -0,0 +1,97 @@
+// Host check for the frame-timing histogram (src/util/latency_histogram.cpp).
+//
+// Records frame-like durations (a 2-20 ms body with occasional 50-300 ms
+// hitches, plus exact small values and huge outliers) into a
+// LatencyHistogram split across two halves the way FrameStats rolls its
+// window, and compares p50/p95/p99/max against exact percentiles of the
+// sorted samples. Each reported percentile must not be below the true
+// value and must be within the 12.5% bucket error above it; any violation
+// exits 1. Also checks every bucket boundary and prints record() cost.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/latency_histogram_check
+//         tools/bench/latency_histogram_check.cpp src/util/latency_histogram.cpp
+//     /tmp/latency_histogram_check [samples]
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+uint32_t exactPercentile(const std::vector<uint32_t>& sorted, float q) {
+    uint32_t rank = (uint32_t)(q * (float)sorted.size()) + 1;
+    if (rank > sorted.size()) rank = (uint32_t)sorted.size();
+    return sorted[rank - 1];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t samples = argc > 1 ? (size_t)atol(argv[1]) : 60000;
+    if (samples > 2 * 60000) samples = 2 * 60000;  // 16-bit bucket counts
+    size_t failures = 0;
+
+    // Bucket mapping: every value maps to a bucket whose range holds it,
+    // and buckets are contiguous.
+    for (uint32_t v = 0; v < (1u << 22); v++) {
+        int b = LatencyHistogram::bucketOf(v);
+        uint32_t hi = LatencyHistogram::bucketHigh(b);
+        uint32_t lo = b == 0 ? 0 : LatencyHistogram::bucketHigh(b - 1) + 1;
+        if (v < lo || v > hi) {
+            printf("value %u outside bucket %d [%u, %u]\n", v, b, lo, hi);
+            failures++;
+            break;
+        }
+    }
+    if (LatencyHistogram::bucketOf(UINT32_MAX) != LatencyHistogram::BUCKETS - 1) failures++;
+
+    std::mt19937 rng(1234);
+    std::vector<uint32_t> values(samples);
+    for (auto& v : values) {
+        uint32_t r = rng() % 1000;
+        if (r < 900) v = 2000 + rng() % 18000;              // Normal frames
+        else if (r < 980) v = 50000 + rng() % 250000;       // Hitches
+        else if (r < 995) v = rng() % 8;                    // Exact small values
+        else v = 20000000 + rng() % 100000000;              // Past the top bucket
+    }
+
+    LatencyHistogram halves[2];
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples; i++) halves[i & 1].record(values[i]);
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() /
+                (double)samples;
+
+    std::vector<uint32_t> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    const LatencyHistogram* h[2] = {&halves[0], &halves[1]};
+
+    printf("%zu samples, record(): %.1f ns\n\n", samples, ns);
+    printf("  %-5s %12s %12s %8s\n", "", "exact", "histogram", "error");
+    const float qs[] = {0.50f, 0.95f, 0.99f, 0.999f, 1.0f};
+    const char* names[] = {"p50", "p95", "p99", "p99.9", "max"};
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+        uint32_t exact = qs[i] >= 1.0f ? sorted.back() : exactPercentile(sorted, qs[i]);
+        uint32_t got = LatencyHistogram::percentile(h, 2, qs[i]);
+        double err = exact ? 100.0 * ((double)got - exact) / exact : 0.0;
+        printf("  %-5s %12u %12u %7.2f%%\n", names[i], exact, got, err);
+        // Values past the top bucket are only bounded by the max.
+        bool inRange = exact < (1u << (LatencyHistogram::MAX_MSB + 1));
+        if (got < exact || (inRange && (double)got > exact * 1.125 + 1)) failures++;
+    }
+    if (halves[0].count() + halves[1].count() != samples) failures++;
+
+    if (failures) {
+        printf("\nFAILED: %zu mismatches\n", failures);
+        return 1;
+    }
+    printf("\nall percentiles within bucket error\n");
+    return 0;
+}
@@ -0,0 +1,223 @@
+// Host benchmark for the binary log ring (src/util/log_ring.cpp).
+//
+// Each producer thread stands in for a core logging flat out: it encodes
+// LOG-style records (a tag, two integers and a short string) and writes
+// them to the shared ring, while one reader thread drains and formats
+// them the way the log printer task does. Reports messages per second per
+// producer for:
+//
+//   mutex    the previous scheme: vsnprintf into a line, then append it to
+//            a text ring under a mutex, on the logging thread
+//   ring     logEncode() + LogRing::write(), formatting deferred to the
+//            reader
+//
+// and checks that every record the reader got formats back to the text
+// the producer meant, and that records lost to lapping are accounted for.
+// Exits 1 on any mismatch.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -pthread -Isrc/util -o /tmp/log_ring_bench
+//         tools/bench/log_ring_bench.cpp src/util/log_ring.cpp
+//     /tmp/log_ring_bench [messages-per-thread] [threads]
+//
+// On the device the producers are the two cores; on a desktop the numbers
+// are higher but the ratio between the schemes is what carries over.
+
+#include "log_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t RING_SIZE = 32 * 1024;     // Same as the device ring
+constexpr size_t TEXT_RING_SIZE = 16 * 1024;
+
+const char* const FMT = "[Radio] rx seq=%u rssi=%d from %s";
+
+double secondsSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// The old log_buffer_appendf(): format on the caller, then a locked copy
+struct TextRing {
+    char buf[TEXT_RING_SIZE];
+    size_t head = 0;
+    std::mutex mutex;
+
+    void appendf(const char* fmt, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(line, sizeof(line) - 1, fmt, args);
+        va_end(args);
+        if (n < 0) n = 0;
+        if ((size_t)n > sizeof(line) - 2) n = sizeof(line) - 2;
+        line[n++] = '\n';
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < n; i++) {
+            buf[head] = line[i];
+            head = (head + 1) % TEXT_RING_SIZE;
+        }
+    }
+};
+
+const char* peerName(uint32_t i) {
+    static const char* names[] = {"alpha", "bravo-node", "c", "delta-repeater-7"};
+    return names[i & 3];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t messages = argc > 1 ? (size_t)atol(argv[1]) : 200000;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    if (threads < 1) threads = 1;
+    if (threads > 16) threads = 16;
+    int failures = 0;
+
+    printf("%zu messages per thread, %d producer threads\n\n", messages, threads);
+
+    // --- mutex + vsnprintf ------------------------------------------------
+    {
+        static TextRing text;
+        std::vector<std::thread> pool;
+        std::vector<double> secs(threads);
+        for (int t = 0; t < threads; t++) {
+            pool.emplace_back([&, t] {
+                auto t0 = std::chrono::steady_clock::now();
+                for (uint32_t i = 0; i < messages; i++) {
+                    text.appendf(FMT, i, -(int)(i % 120), peerName(i));
+                }
+                secs[t] = secondsSince(t0);
+            });
+        }
+        for (auto& th : pool) th.join();
+        printf("mutex  ");
+        for (int t = 0; t < threads; t++) printf("  %8.0f msg/s", messages / secs[t]);
+        printf("\n");
+    }
+
+    // --- binary ring ------------------------------------------------------
+    {
+        std::vector<uint8_t> storage(RING_SIZE, 0);
+        LogRing ring;
+        ring.init(storage.data(), storage.size());
+
+        std::atomic<int> running{threads};
+        std::vector<double> secs(threads);
+        uint64_t read = 0;
+        uint32_t lostBytes = 0;
+        uint64_t mismatches = 0;
+
+        std::thread reader([&] {
+            uint8_t rec[LOG_MAX_RECORD];
+            char line[256];
+            char expect[256];
+            uint32_t cursor = 0;
+            for (;;) {
+                bool done = running.load() == 0;
+                size_t len = ring.read(cursor, rec, lostBytes);
+                if (!len) {
+                    if (done) break;
+                    std::this_thread::yield();
+                    continue;
+                }
+                read++;
+                logFormat(rec, len, line, sizeof(line));
+                // The producer put its sequence number first; rebuild
+                // what it meant to log and compare.
+                const uint8_t* a = rec + sizeof(LogRecordHeader);
+                uint32_t seq;
+                memcpy(&seq, a + 1, sizeof(seq));
+                snprintf(expect, sizeof(expect), FMT, seq, -(int)(seq % 120), peerName(seq));
+                if (strcmp(line, expect) != 0) mismatches++;
+            }
+        });
+
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; t++) {
+            pool.emplace_back([&, t] {
+                uint8_t rec[LOG_MAX_RECORD];
+                auto t0 = std::chrono::steady_clock::now();
+                for (uint32_t i = 0; i < messages; i++) {
+                    size_t len = logEncode(rec, LOG_LEVEL_INFO, (uint8_t)t, i, FMT,
+                                           i, -(int)(i % 120), peerName(i));
+                    ring.write(rec, len);
+                }
+                secs[t] = secondsSince(t0);
+                running.fetch_sub(1);
+            });
+        }
+        for (auto& th : pool) th.join();
+        reader.join();
+
+        printf("ring   ");
+        for (int t = 0; t < threads; t++) printf("  %8.0f msg/s", messages / secs[t]);
+        printf("\n\n");
+
+        uint64_t total = (uint64_t)messages * threads;
+        printf("reader: %llu formatted, %u bytes lost to lapping, %llu mismatched\n",
+               (unsigned long long)read, lostBytes, (unsigned long long)mismatches);
+        if (mismatches) {
+            printf("FAIL: formatted text differs from what was logged\n");
+            failures++;
+        }
+        if (read > total || (read < total && lostBytes == 0)) {
+            printf("FAIL: %llu of %llu records read with nothing reported lost\n",
+                   (unsigned long long)read, (unsigned long long)total);
+            failures++;
+        }
+        LogRing::Stats st = ring.stats();
+        if (st.written != total) {
+            printf("FAIL: ring counted %u writes, expected %llu\n", st.written,
+                   (unsigned long long)total);
+            failures++;
+        }
+    }
+
+    // --- formatter edge cases ---------------------------------------------
+    {
+        uint8_t rec[LOG_MAX_RECORD];
+        char out[256];
+        size_t n;
+        n = logEncode(rec, LOG_LEVEL_INFO, 0, 0, "%s=%5.2f%%", "load", 12.345);
+        logFormat(rec, n, out, sizeof(out));
+        if (strcmp(out, "load=12.35%") != 0) {
+            printf("FAIL: float and %%%% gave \"%s\"\n", out);
+            failures++;
+        }
+        n = logEncode(rec, LOG_LEVEL_INFO, 0, 0, "%-6s|%08lx|%lld|%c|%*d", "ab", 0xbeefUL,
+                      -5000000000LL, 'z', 4, 7);
+        logFormat(rec, n, out, sizeof(out));
+        if (strcmp(out, "ab    |0000beef|-5000000000|z|   7") != 0) {
+            printf("FAIL: mixed conversions gave \"%s\"\n", out);
+            failures++;
+        }
+        n = logEncode(rec, LOG_LEVEL_INFO, 0, 0, "%s and %d", (const char*)nullptr);
+        logFormat(rec, n, out, sizeof(out));
+        if (strcmp(out, "(null) and <?>") != 0) {
+            printf("FAIL: missing argument gave \"%s\"\n", out);
+            failures++;
+        }
+        std::string big(300, 'x');
+        n = logEncode(rec, LOG_LEVEL_INFO, 0, 0, "[%s]", big.c_str());
+        logFormat(rec, n, out, sizeof(out));
+        if (strlen(out) != LOG_MAX_STRING + 2 || n > LOG_MAX_RECORD) {
+            printf("FAIL: long string arg not cut to %zu (got %zu)\n", LOG_MAX_STRING, strlen(out));
+            failures++;
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+// Host replay benchmark for the Lua heap allocator (src/lua/lua_slab.cpp).
+//
+// Replays an allocation trace captured on the device with
+//
+//     ez.system.alloc_trace_start(200000)
+//     -- ... use the UI for a while ...
+//     ez.system.alloc_trace_save("/sd/alloc.trace")
+//
+// against LuaSlab and against plain malloc/realloc/free, and prints time per
+// call plus the slab's per-size-class stats. Without a trace file it replays
+// a synthetic Lua-like workload instead.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/lua -o /tmp/lua_alloc_replay
+//         tools/bench/lua_alloc_replay.cpp src/lua/lua_slab.cpp
+//     /tmp/lua_alloc_replay alloc.trace
+//     /tmp/lua_alloc_replay --synthetic 2000000
+//
+// Host numbers say nothing about absolute PSRAM latency; compare the two
+// columns and the fragmentation figures.
+
+#include "lua_slab.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Trace event with device pointers replaced by dense slot numbers, so the
+// timed loop is only allocator calls and array indexing.
+struct Op {
+    int32_t in;    // Slot of the block passed in, -1 for fresh allocations
+    int32_t out;   // Slot receiving the result, -1 for frees
+    uint32_t osize;
+    uint32_t nsize;
+};
+
+bool loadTrace(const char* path, std::vector<LuaSlab::TraceEvent>& events) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    LuaSlab::TraceEvent ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) events.push_back(ev);
+    fclose(f);
+    return true;
+}
+
+// Lua-ish mix: mostly 16-64 byte objects, some strings up to a few hundred
+// bytes, occasional table-array growth via realloc, and a GC-like sweep that
+// frees a random half of live blocks every so often.
+void synthesize(size_t count, std::vector<LuaSlab::TraceEvent>& events) {
+    std::mt19937 rng(12345);
+    std::vector<std::pair<uint32_t, uint32_t>> live;  // (id, size)
+    uint32_t nextId = 1;
+    auto smallSize = [&]() -> uint32_t {
+        static const uint32_t common[] = {16, 20, 24, 28, 32, 40, 56, 64};
+        if (rng() % 10 < 8) return common[rng() % 8];
+        return 17 + rng() % 300;
+    };
+    while (events.size() < count) {
+        uint32_t r = rng() % 100;
+        if (r < 55 || live.empty()) {
+            uint32_t size = rng() % 200 == 0 ? 512 + rng() % 8192 : smallSize();
+            uint32_t id = nextId++;
+            events.push_back({0, id, 4, size});
+            live.push_back({id, size});
+        } else if (r < 60) {
+            size_t i = rng() % live.size();
+            uint32_t nsize = live[i].second * 2;
+            if (nsize > 65536) nsize = 64;
+            uint32_t id = nextId++;
+            events.push_back({live[i].first, id, live[i].second, nsize});
+            live[i] = {id, nsize};
+        } else if (r < 99) {
+            size_t i = rng() % live.size();
+            events.push_back({live[i].first, 0, live[i].second, 0});
+            live[i] = live.back();
+            live.pop_back();
+        } else {
+            for (size_t i = 0; i < live.size() && events.size() < count;) {
+                if (rng() & 1) {
+                    events.push_back({live[i].first, 0, live[i].second, 0});
+                    live[i] = live.back();
+                    live.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+}
+
+size_t translate(const std::vector<LuaSlab::TraceEvent>& events, std::vector<Op>& ops) {
+    std::unordered_map<uint32_t, int32_t> slotOf;
+    std::vector<int32_t> freeSlots;
+    int32_t nextSlot = 0;
+    size_t skipped = 0;
+
+    auto take = [&]() {
+        if (!freeSlots.empty()) {
+            int32_t s = freeSlots.back();
+            freeSlots.pop_back();
+            return s;
+        }
+        return nextSlot++;
+    };
+
+    for (const auto& ev : events) {
+        if (ev.ptr == 0) {
+            if (ev.result == 0 || ev.nsize == 0) { skipped++; continue; }  // Failed on device
+            int32_t s = take();
+            slotOf[ev.result] = s;
+            ops.push_back({-1, s, ev.osize, ev.nsize});
+            continue;
+        }
+        auto it = slotOf.find(ev.ptr);
+        if (it == slotOf.end()) { skipped++; continue; }  // Allocated before the trace began
+        int32_t in = it->second;
+        if (ev.nsize == 0) {
+            slotOf.erase(it);
+            freeSlots.push_back(in);
+            ops.push_back({in, -1, ev.osize, 0});
+        } else if (ev.result != 0) {
+            slotOf.erase(it);
+            slotOf[ev.result] = in;
+            ops.push_back({in, in, ev.osize, ev.nsize});
+        } else {
+            skipped++;
+        }
+    }
+    return skipped;
+}
+
+template <typename Fn>
+double run(const std::vector<Op>& ops, std::vector<void*>& slots, Fn&& alloc) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (const Op& op : ops) {
+        void* p = alloc(op.in >= 0 ? slots[op.in] : nullptr, op.osize, op.nsize);
+        if (op.out >= 0) {
+            if (!p) {
+                fprintf(stderr, "allocation of %u bytes failed\n", op.nsize);
+                exit(1);
+            }
+            // Touch the block like Lua would when initialising an object.
+            *static_cast<volatile uint8_t*>(p) = 1;
+            slots[op.out] = p;
+        } else {
+            slots[op.in] = nullptr;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<LuaSlab::TraceEvent> events;
+    const char* source;
+    if (argc == 3 && strcmp(argv[1], "--synthetic") == 0) {
+        synthesize((size_t)atol(argv[2]), events);
+        source = "synthetic";
+    } else if (argc == 2) {
+        if (!loadTrace(argv[1], events)) return 1;
+        source = argv[1];
+    } else {
+        fprintf(stderr, "usage: %s <trace> | --synthetic <events>\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Op> ops;
+    size_t skipped = translate(events, ops);
+    int32_t slotCount = 0;
+    for (const Op& op : ops) {
+        if (op.out + 1 > slotCount) slotCount = op.out + 1;
+    }
+    printf("Replay: %s, %zu events (%zu skipped), %d slots\n\n",
+           source, ops.size(), skipped, slotCount);
+
+    std::vector<void*> slots(slotCount, nullptr);
+    double mallocNs = run(ops, slots, [](void* p, size_t, size_t n) -> void* {
+        if (n == 0) { free(p); return nullptr; }
+        return realloc(p, n);
+    });
+    for (void* p : slots) free(p);  // Leftovers live at the end of the trace
+    std::fill(slots.begin(), slots.end(), nullptr);
+
+    LuaSlab slab;
+    double slabNs = run(ops, slots, [&](void* p, size_t o, size_t n) {
+        return slab.alloc(p, o, n);
+    });
+
+    printf("  %-18s %10.1f ns/op  (%.1f ms total)\n", "malloc/realloc",
+           mallocNs / ops.size(), mallocNs / 1e6);
+    printf("  %-18s %10.1f ns/op  (%.1f ms total)\n\n", "LuaSlab",
+           slabNs / ops.size(), slabNs / 1e6);
+
+    LuaSlab::Stats st;
+    slab.getStats(st);
+    printf("  arenas %u (%u KB), uncarved %u B\n", st.arenaCount, st.arenaBytes / 1024, st.arenaUnused);
+    printf("  slab live %u B, on free lists %u B\n", st.slabLiveBytes, st.slabFreeBytes);
+    printf("  large: %u allocs, %u live, %u B\n\n", st.largeAllocs, st.largeLive, st.largeBytes);
+
+    printf("  %6s %10s %10s %8s %8s %8s\n", "size", "allocs", "frees", "live", "peak", "carved");
+    for (int i = 0; i < LuaSlab::NUM_CLASSES; i++) {
+        const LuaSlab::ClassStats& c = slab.classStats(i);
+        printf("  %6u %10u %10u %8u %8u %8u\n", c.size, c.allocs, c.frees, c.live, c.peak, c.carved);
+    }
+
+    slab.releaseAll();  // Large leftovers leak here; the process is exiting.
+    return 0;
+}
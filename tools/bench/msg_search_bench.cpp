@@ -0,0 +1,447 @@
+// Host check and benchmark for the message search index
+// (src/util/msg_search.cpp).
+//
+// Builds a synthetic history of N messages (default 100000) in a MsgStore:
+// words drawn from a Zipf-distributed vocabulary, spread over a few dozen
+// conversations. Each append is indexed the way the firmware does it
+// (add, flush when due, merge), then a slice of messages is deleted.
+//
+// Checks, any failure exits 1:
+//   - every query's results equal a brute-force scan of the corpus
+//     (prefix match on every query word, live messages only, newest first)
+//   - after close/reopen plus catch-up from the store, results are the same
+//   - a segment cut short (power loss while writing it) is discarded on
+//     open and its messages come back through catch-up
+//
+// Then reports per-query latency (p50/p99) by query shape, file reads and
+// bytes read per query, and the index size. Latency here is against the
+// host page cache; on the device the reads dominate, so those counts are
+// the numbers to carry over.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/msg_search_bench
+//         tools/bench/msg_search_bench.cpp src/util/msg_search.cpp src/util/msg_store.cpp
+//     /tmp/msg_search_bench [messages]
+
+#include "msg_search.h"
+#include "msg_store.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// heap_tags.cpp needs the ESP heap; plain malloc will do here
+void* heapTagMalloc(HeapTag, size_t size) { return malloc(size); }
+void* heapTagPsMalloc(HeapTag, size_t size) { return malloc(size); }
+void heapTagFree(HeapTag, void* ptr) { free(ptr); }
+
+namespace {
+
+struct IoCounters {
+    size_t reads = 0;
+    size_t readBytes = 0;
+    size_t opens = 0;
+};
+IoCounters g_io;
+
+class StdioFile : public MsgStoreFile {
+public:
+    explicit StdioFile(FILE* f) : _f(f) {}
+    ~StdioFile() override { fclose(_f); }
+
+    size_t read(uint32_t offset, void* buf, size_t len) override {
+        g_io.reads++;
+        if (fseek(_f, offset, SEEK_SET) != 0) return 0;
+        size_t n = fread(buf, 1, len, _f);
+        g_io.readBytes += n;
+        return n;
+    }
+    bool append(const void* buf, size_t len) override {
+        fseek(_f, 0, SEEK_END);
+        bool ok = fwrite(buf, 1, len, _f) == len;
+        fflush(_f);
+        return ok;
+    }
+    uint32_t size() override {
+        fseek(_f, 0, SEEK_END);
+        return (uint32_t)ftell(_f);
+    }
+
+private:
+    FILE* _f;
+};
+
+class StdioIO : public MsgStoreIO {
+public:
+    MsgStoreFile* open(const char* path, bool create) override {
+        g_io.opens++;
+        FILE* f = fopen(path, create ? "w+b" : "r+b");
+        return f ? new StdioFile(f) : nullptr;
+    }
+    bool remove(const char* path) override { return ::remove(path) == 0; }
+    bool mkdir(const char* path) override { return ::mkdir(path, 0755) == 0; }
+    void list(const char* dir, void (*fn)(void*, const char*), void* ctx) override {
+        DIR* d = opendir(dir);
+        if (!d) return;
+        while (dirent* e = readdir(d)) {
+            if (e->d_name[0] != '.') fn(ctx, e->d_name);
+        }
+        closedir(d);
+    }
+};
+
+void removeDir(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    while (dirent* e = readdir(d)) {
+        if (e->d_name[0] == '.') continue;
+        std::string p = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(p.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            removeDir(p);
+        } else {
+            ::remove(p.c_str());
+        }
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+// Pronounceable words from syllables, so prefixes are shared the way
+// real words share them
+std::vector<std::string> makeVocabulary(size_t n, std::mt19937& rng) {
+    static const char* syll[] = {"ba", "ke", "lo", "mi", "nu", "ra", "se", "ti", "vo", "za",
+                                 "an", "er", "in", "or", "us", "ch", "st", "th", "ph", "qu"};
+    std::vector<std::string> words;
+    while (words.size() < n) {
+        std::string w;
+        size_t parts = 1 + rng() % 4;
+        for (size_t i = 0; i < parts; i++) w += syll[rng() % 20];
+        if (w.size() < SEARCH_TERM_MIN) continue;
+        words.push_back(w);
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    std::shuffle(words.begin(), words.end(), rng);
+    return words;
+}
+
+class Zipf {
+public:
+    Zipf(size_t n, double s) : _cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow((double)(i + 1), s);
+            _cdf[i] = sum;
+        }
+        for (double& c : _cdf) c /= sum;
+    }
+    size_t operator()(std::mt19937& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(_cdf.begin(), _cdf.end(), u) - _cdf.begin();
+    }
+
+private:
+    std::vector<double> _cdf;
+};
+
+struct Doc {
+    uint32_t id;
+    std::vector<std::string> words;    // Tokenized, as searched
+};
+
+struct Corpus {
+    std::vector<Doc> docs;             // Ascending id
+    std::vector<bool> deleted;         // By id
+};
+
+bool aliveFn(void* ctx, uint32_t id) {
+    return static_cast<MsgStore*>(ctx)->contains(id);
+}
+
+std::vector<std::string> tokens(const std::string& text) {
+    std::vector<std::string> out;
+    searchTokenize(text.data(), text.size(), [](void* ctx, const char* w, size_t len) {
+        static_cast<std::vector<std::string>*>(ctx)->emplace_back(w, len);
+    }, &out);
+    return out;
+}
+
+std::vector<uint32_t> bruteForce(const Corpus& c, const std::string& query, size_t limit) {
+    std::vector<std::string> terms = tokens(query);
+    std::vector<uint32_t> out;
+    if (terms.empty()) return out;
+    for (size_t i = c.docs.size(); i-- > 0 && out.size() < limit;) {
+        const Doc& d = c.docs[i];
+        if (c.deleted[d.id]) continue;
+        bool all = true;
+        for (const std::string& t : terms) {
+            bool any = false;
+            for (const std::string& w : d.words) {
+                if (w.compare(0, t.size(), t) == 0) {
+                    any = true;
+                    break;
+                }
+            }
+            if (!any) {
+                all = false;
+                break;
+            }
+        }
+        if (all) out.push_back(d.id);
+    }
+    return out;
+}
+
+std::vector<uint32_t> runSearch(MsgSearch& s, const std::string& q, size_t limit) {
+    std::vector<uint32_t> out(limit);
+    out.resize(s.search(q.data(), q.size(), out.data(), limit));
+    return out;
+}
+
+struct Query {
+    const char* shape;
+    std::string text;
+};
+
+std::vector<Query> makeQueries(const std::vector<std::string>& vocab, Zipf& zipf,
+                               std::mt19937& rng, size_t perShape) {
+    std::vector<Query> out;
+    auto word = [&]() { return vocab[zipf(rng)]; };
+    auto rare = [&]() { return vocab[rng() % vocab.size()]; };
+    auto prefix = [&](const std::string& w) {
+        size_t n = std::min(w.size(), (size_t)(3 + rng() % 3));
+        return w.substr(0, n);
+    };
+    for (size_t i = 0; i < perShape; i++) {
+        out.push_back({"common word", word()});
+        out.push_back({"rare word", rare()});
+        out.push_back({"prefix", prefix(rare())});
+        out.push_back({"two words", word() + " " + rare()});
+        out.push_back({"three prefixes", prefix(word()) + " " + prefix(word()) + " " + prefix(rare())});
+    }
+    return out;
+}
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// A query word matching more distinct words than a lookup expands gets
+// partial results by design; those are only checked for being a subset.
+bool capped(const std::vector<std::string>& vocab, const std::string& query) {
+    for (const std::string& t : tokens(query)) {
+        size_t n = 0;
+        for (const std::string& w : vocab) n += w.compare(0, t.size(), t) == 0;
+        if (n > MsgSearch::MAX_EXPANSIONS) return true;
+    }
+    return false;
+}
+
+size_t verifyQueries(MsgSearch& s, const Corpus& c, const std::vector<std::string>& vocab,
+                     const std::vector<Query>& queries, size_t stride) {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < queries.size(); i += stride) {
+        bool partial = capped(vocab, queries[i].text);
+        for (size_t limit : {(size_t)20, (size_t)1000}) {
+            std::vector<uint32_t> want = bruteForce(c, queries[i].text, partial ? SIZE_MAX : limit);
+            std::vector<uint32_t> got = runSearch(s, queries[i].text, limit);
+            bool ok;
+            if (partial) {
+                ok = std::is_sorted(got.rbegin(), got.rend()) &&
+                     std::adjacent_find(got.begin(), got.end()) == got.end() &&
+                     std::all_of(got.begin(), got.end(), [&](uint32_t id) {
+                         return std::binary_search(want.rbegin(), want.rend(), id);
+                     });
+            } else {
+                ok = want == got;
+            }
+            if (!ok) {
+                if (mismatches++ < 5) {
+                    fprintf(stderr, "  mismatch '%s' limit %zu: want %zu got %zu\n",
+                            queries[i].text.c_str(), limit, want.size(), got.size());
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+void catchUp(MsgStore& store, MsgSearch& search) {
+    store.scanSince(search.indexedUpTo(), [](void* ctx, const char*, uint32_t id,
+                                             const char* body, size_t len) {
+        static_cast<MsgSearch*>(ctx)->add(id, body, len);
+    }, &search);
+}
+
+double percentile(std::vector<double> v, double p) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    std::string dir = "/tmp/msg_search_bench";
+    std::string idxDir = dir + "/idx";
+    removeDir(dir);
+
+    std::mt19937 rng(1234);
+    std::vector<std::string> vocab = makeVocabulary(20000, rng);
+    Zipf zipf(vocab.size(), 1.05);
+
+    StdioIO io;
+    MsgStore store(io);
+    MsgSearch search(io, aliveFn, &store);
+    check(store.open(dir.c_str()), "store open");
+    check(search.open(idxDir.c_str()), "search open");
+
+    // Build: index each message as it is appended, like the binding
+    Corpus corpus;
+    corpus.deleted.assign(n + 1, false);
+    size_t textBytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        std::string text;
+        size_t words = 3 + rng() % 15;
+        for (size_t w = 0; w < words; w++) {
+            if (w) text += (rng() % 8 == 0) ? ", " : " ";
+            std::string word = vocab[zipf(rng)];
+            if (rng() % 10 == 0) word[0] = (char)toupper(word[0]);
+            text += word;
+        }
+        char key[16];
+        snprintf(key, sizeof(key), "ch:%u", (unsigned)(zipf(rng) % 40));
+        uint32_t id = store.append(key, text.data(), text.size());
+        check(id != 0, "append");
+        search.add(id, text.data(), text.size());
+        if (search.flushDue()) {
+            check(search.flush(), "flush");
+            search.merge();
+        }
+        corpus.docs.push_back({id, tokens(text)});
+        textBytes += text.size();
+    }
+    double buildSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Delete ~2%, as a user clearing messages would
+    for (size_t i = 0; i < n / 50; i++) {
+        const Doc& d = corpus.docs[rng() % corpus.docs.size()];
+        if (corpus.deleted[d.id]) continue;
+        for (size_t k = 0; k < store.conversationCount(); k++) {
+            if (store.remove(store.conversationKey(k), d.id)) break;
+        }
+        corpus.deleted[d.id] = true;
+    }
+
+    std::vector<Query> queries = makeQueries(vocab, zipf, rng, 400);
+    size_t bad = verifyQueries(search, corpus, vocab, queries, 7);
+    check(bad == 0, "results match brute force (pending + segments)");
+
+    // Reopen: pending entries are gone and come back through catch-up
+    MsgSearchStats before;
+    search.getStats(before);
+    search.close();
+    check(search.open(idxDir.c_str()), "reopen");
+    catchUp(store, search);
+    MsgSearchStats after;
+    search.getStats(after);
+    check(after.indexedUpTo == before.indexedUpTo, "catch-up reaches the last id");
+    check(verifyQueries(search, corpus, vocab, queries, 11) == 0, "results match after reopen");
+
+    // Flush and fully merge, then time queries against the settled index
+    check(search.flush(), "final flush");
+    while (search.merge() > 0) {}
+    MsgSearchStats st;
+    search.getStats(st);
+
+    const size_t limit = 20;
+    struct Shape {
+        const char* name;
+        std::vector<double> us;
+        size_t reads = 0, bytes = 0, hits = 0;
+    };
+    std::vector<Shape> shapes;
+    for (const Query& q : queries) {
+        auto it = std::find_if(shapes.begin(), shapes.end(),
+                               [&](const Shape& s) { return strcmp(s.name, q.shape) == 0; });
+        if (it == shapes.end()) {
+            shapes.push_back({q.shape, {}});
+            it = shapes.end() - 1;
+        }
+        IoCounters io0 = g_io;
+        auto q0 = std::chrono::steady_clock::now();
+        std::vector<uint32_t> got = runSearch(search, q.text, limit);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - q0).count();
+        it->us.push_back(us);
+        it->reads += g_io.reads - io0.reads;
+        it->bytes += g_io.readBytes - io0.readBytes;
+        it->hits += got.size();
+    }
+    check(verifyQueries(search, corpus, vocab, queries, 5) == 0, "results match after merges");
+
+    // A segment cut short is dropped on open; catch-up re-adds its messages
+    {
+        std::vector<std::string> idx;
+        DIR* d = opendir(idxDir.c_str());
+        while (dirent* e = readdir(d)) {
+            if (strstr(e->d_name, ".idx")) idx.push_back(e->d_name);
+        }
+        closedir(d);
+        std::sort(idx.begin(), idx.end());
+        search.close();
+        std::string newest = idxDir + "/" + idx.back();
+        struct stat sb;
+        stat(newest.c_str(), &sb);
+        check(truncate(newest.c_str(), sb.st_size - 10) == 0, "truncate");
+        check(search.open(idxDir.c_str()), "open after torn segment");
+        MsgSearchStats torn;
+        search.getStats(torn);
+        check(torn.segments == st.segments - 1, "torn segment discarded");
+        check(access(newest.c_str(), F_OK) != 0, "torn segment files removed");
+        catchUp(store, search);
+        check(verifyQueries(search, corpus, vocab, queries, 13) == 0, "results match after torn segment");
+    }
+
+    printf("corpus: %zu messages, %zu words, %.1f MB text, build %.2f s (%.1f us/message)\n",
+           n, vocab.size(), textBytes / 1048576.0, buildSec, buildSec * 1e6 / n);
+    printf("index:  %u segments, %u terms, %u postings, %.2f MB (%.1f%% of text, %.2f bytes/posting)\n",
+           st.segments, st.terms, st.postings, st.bytes / 1048576.0, 100.0 * st.bytes / textBytes,
+           (double)st.bytes / st.postings);
+    printf("merges during build: %u\n\n", before.merges);
+    printf("%-16s %8s %8s %10s %12s %8s\n", "query (limit 20)", "p50 us", "p99 us",
+           "reads/q", "KB read/q", "hits/q");
+    for (const Shape& s : shapes) {
+        size_t q = s.us.size();
+        printf("%-16s %8.1f %8.1f %10.1f %12.1f %8.1f\n", s.name, percentile(s.us, 0.5),
+               percentile(s.us, 0.99), (double)s.reads / q, s.bytes / 1024.0 / q,
+               (double)s.hits / q);
+    }
+
+    search.close();
+    store.close();
+    removeDir(dir);
+    if (failures) {
+        printf("\n%d check(s) FAILED\n", failures);
+        return 1;
+    }
+    printf("\nall checks passed\n");
+    return 0;
+}
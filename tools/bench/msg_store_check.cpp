@@ -0,0 +1,293 @@
+// Host check for the log-structured message store (src/util/msg_store.cpp).
+//
+// Runs a long random sequence of appends, updates, deletes and
+// conversation drops against a directory of real segment files and an
+// in-memory model, and periodically:
+//
+//   reopen   close and replay the segments; the rebuilt index must match
+//   crash    cut the newest segment file somewhere inside the record just
+//            written (a write interrupted by power loss); after reopening
+//            the store must hold exactly the state before that write,
+//            and keep accepting writes
+//   compact  rewrite live records; contents must not change and the old
+//            segment files must be gone
+//
+// Every check pages through each conversation with fetch() in small
+// pages and compares ids and bodies with the model. Any mismatch exits 1.
+// Prints bytes written per operation and the compaction results.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/msg_store_check
+//         tools/bench/msg_store_check.cpp src/util/msg_store.cpp
+//     /tmp/msg_store_check [operations]
+
+#include "msg_store.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// heap_tags.cpp needs the ESP heap; plain malloc will do here
+void* heapTagMalloc(HeapTag, size_t size) { return malloc(size); }
+void* heapTagPsMalloc(HeapTag, size_t size) { return malloc(size); }
+void heapTagFree(HeapTag, void* ptr) { free(ptr); }
+
+namespace {
+
+class StdioFile : public MsgStoreFile {
+public:
+    explicit StdioFile(FILE* f) : _f(f) {}
+    ~StdioFile() override { fclose(_f); }
+
+    size_t read(uint32_t offset, void* buf, size_t len) override {
+        if (fseek(_f, offset, SEEK_SET) != 0) return 0;
+        return fread(buf, 1, len, _f);
+    }
+    bool append(const void* buf, size_t len) override {
+        fseek(_f, 0, SEEK_END);
+        bool ok = fwrite(buf, 1, len, _f) == len;
+        fflush(_f);
+        return ok;
+    }
+    uint32_t size() override {
+        fseek(_f, 0, SEEK_END);
+        return (uint32_t)ftell(_f);
+    }
+
+private:
+    FILE* _f;
+};
+
+class StdioIO : public MsgStoreIO {
+public:
+    MsgStoreFile* open(const char* path, bool create) override {
+        FILE* f = fopen(path, create ? "w+b" : "r+b");
+        return f ? new StdioFile(f) : nullptr;
+    }
+    bool remove(const char* path) override { return ::remove(path) == 0; }
+    bool mkdir(const char* path) override { return ::mkdir(path, 0755) == 0; }
+    void list(const char* dir, void (*fn)(void*, const char*), void* ctx) override {
+        DIR* d = opendir(dir);
+        if (!d) return;
+        while (dirent* e = readdir(d)) {
+            if (e->d_name[0] != '.') fn(ctx, e->d_name);
+        }
+        closedir(d);
+    }
+};
+
+using Model = std::map<std::string, std::map<uint32_t, std::string>>;
+
+std::vector<std::string> segmentFiles(const std::string& dir) {
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    while (dirent* e = readdir(d)) {
+        if (strstr(e->d_name, ".seg")) names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+off_t fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+struct Page {
+    std::vector<std::pair<uint32_t, std::string>> items;
+};
+
+// Page through every conversation newest to oldest; compare with the model
+size_t verify(MsgStore& store, const Model& model, std::mt19937& rng) {
+    size_t failures = 0;
+    if (store.conversationCount() != model.size()) failures++;
+    for (const auto& [key, msgs] : model) {
+        if (store.count(key.c_str()) != msgs.size()) {
+            failures++;
+            continue;
+        }
+        std::vector<std::pair<uint32_t, std::string>> got;
+        uint32_t before = 0;
+        for (;;) {
+            Page page;
+            bool more = false;
+            size_t n = 1 + rng() % 9;
+            store.fetch(key.c_str(), before, n, [](void* ctx, uint32_t id, const char* body, size_t len) {
+                static_cast<Page*>(ctx)->items.emplace_back(id, std::string(body, len));
+            }, &page, &more);
+            if (page.items.empty() || page.items.size() > n) {
+                failures++;
+                break;
+            }
+            got.insert(got.begin(), page.items.begin(), page.items.end());
+            before = page.items.front().first;
+            if (!more) break;
+        }
+        if (got.size() != msgs.size()) {
+            failures++;
+            continue;
+        }
+        size_t i = 0;
+        for (const auto& [id, body] : msgs) {
+            if (got[i].first != id || got[i].second != body) failures++;
+            i++;
+        }
+    }
+    return failures;
+}
+
+std::string randomBody(std::mt19937& rng) {
+    size_t len = 20 + rng() % 300;
+    std::string s;
+    for (size_t i = 0; i < len; i++) s += (char)(' ' + rng() % 95);
+    return s;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+    char tmpl[] = "/tmp/msg_store_XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = tmpl;
+
+    StdioIO io;
+    MsgStore store(io);
+    Model model;
+    std::mt19937 rng(4242);
+    size_t failures = 0;
+    size_t reopens = 0, crashes = 0, compactions = 0, writes = 0;
+    uint64_t bytesWritten = 0;
+
+    if (!store.open(dir.c_str())) {
+        printf("open failed\n");
+        return 1;
+    }
+
+    const char* keys[] = {"dm:0a1b2c", "dm:99ff00", "ch:#Public", "ch:#Test", "dm:deadbeef"};
+    for (size_t op = 0; op < ops; op++) {
+        auto segsBefore = segmentFiles(dir);
+        std::string lastBefore = segsBefore.empty() ? "" : segsBefore.back();
+        off_t sizeBefore = lastBefore.empty() ? 0 : fileSize(dir + "/" + lastBefore);
+        Model snapshot = model;
+        bool wrote = false;
+
+        uint32_t r = rng() % 100;
+        std::string key = keys[rng() % 5];
+        auto& conv = model[key];
+
+        if (r >= 90) {
+            // Reopen or compact below
+        } else if (r < 65 || conv.empty()) {
+            std::string body = randomBody(rng);
+            uint32_t id = store.append(key.c_str(), body.data(), body.size());
+            if (!id) failures++;
+            conv[id] = body;
+            wrote = true;
+        } else if (r < 80) {
+            auto it = std::next(conv.begin(), rng() % conv.size());
+            std::string body = randomBody(rng);
+            if (!store.update(key.c_str(), it->first, body.data(), body.size())) failures++;
+            it->second = body;
+            wrote = true;
+        } else if (r < 89) {
+            auto it = std::next(conv.begin(), rng() % conv.size());
+            if (!store.remove(key.c_str(), it->first)) failures++;
+            conv.erase(it);
+            wrote = true;
+        } else if (r < 90) {
+            if (!store.drop(key.c_str())) failures++;
+            conv.clear();
+            wrote = true;
+        }
+        if (r >= 90 && r < 94) {
+            store.close();
+            store.open(dir.c_str());
+            reopens++;
+        } else if (r == 94) {
+            if (store.needsCompaction()) {
+                MsgStoreStats before;
+                store.getStats(before);
+                if (!store.compact()) failures++;
+                compactions++;
+                MsgStoreStats after;
+                store.getStats(after);
+                if (after.totalBytes > before.totalBytes) failures++;
+                if (segmentFiles(dir).size() != after.segments) failures++;
+            }
+        }
+        if (conv.empty()) model.erase(key);
+
+        if (wrote) {
+            writes++;
+            auto segsAfter = segmentFiles(dir);
+            std::string last = segsAfter.back();
+            off_t size = fileSize(dir + "/" + last);
+            off_t prev = last == lastBefore ? sizeBefore : 0;
+            bytesWritten += size - prev;
+
+            // Crash: the write made it partway out
+            if (rng() % 100 == 0) {
+                off_t cut = prev + (off_t)(rng() % (uint32_t)(size - prev));
+                if (truncate((dir + "/" + last).c_str(), cut) != 0) failures++;
+                model = snapshot;
+                store.close();
+                store.open(dir.c_str());
+                crashes++;
+                MsgStoreStats st;
+                store.getStats(st);
+                if (st.tornBytes == 0 && cut > prev) failures++;
+            }
+        }
+
+        if (op % 500 == 0 || r >= 90) failures += verify(store, model, rng);
+    }
+
+    store.close();
+    store.open(dir.c_str());
+    failures += verify(store, model, rng);
+
+    MsgStoreStats st;
+    store.getStats(st);
+    printf("%zu operations: %zu writes, %zu reopens, %zu crashes, %zu compactions\n",
+           ops, writes, reopens, crashes, compactions);
+    printf("  %.1f bytes written per write\n", writes ? (double)bytesWritten / writes : 0.0);
+    printf("  final: %u messages in %u conversations, %u segments, %u/%u bytes live\n",
+           st.messages, st.conversations, st.segments, st.liveBytes, st.totalBytes);
+
+    if (store.compact()) {
+        store.close();
+        store.open(dir.c_str());
+        failures += verify(store, model, rng);
+        store.getStats(st);
+        printf("  compacted: %u segments, %u/%u bytes live\n", st.segments, st.liveBytes, st.totalBytes);
+    } else {
+        failures++;
+    }
+
+    store.close();
+    for (const auto& name : segmentFiles(dir)) ::remove((dir + "/" + name).c_str());
+    rmdir(dir.c_str());
+
+    if (failures) {
+        printf("\nFAILED: %zu mismatches\n", failures);
+        return 1;
+    }
+    printf("\nstore matched the model throughout\n");
+    return 0;
+}
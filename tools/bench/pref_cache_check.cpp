@@ -0,0 +1,303 @@
+// Host check for the preference cache (src/util/pref_cache.cpp).
+//
+// Runs a long random sequence of sets, removes, reads, flushes and clears
+// against an in-memory model and a fake NVS namespace that fails some
+// writes on purpose, and checks that:
+//
+//   every get() returns what the model holds
+//   after a flush that succeeded the fake NVS holds exactly the model,
+//   with one entry (of the right type) per key
+//   a cache loaded from the fake NVS holds exactly the model
+//
+// Then replays a settings session (screens reading prefs as they draw, a
+// brightness slider dragged across its range, a few toggles) with the
+// clock advanced by hand, and prints the NVS writes with and without the
+// cache and the cost of a cached read. Any mismatch exits 1.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/pref_cache_check
+//         tools/bench/pref_cache_check.cpp src/util/pref_cache.cpp
+//     /tmp/pref_cache_check [operations]
+
+#include "pref_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+
+// heap_tags.cpp needs the ESP heap; plain malloc will do here
+#include "heap_tags.h"
+void* heapTagMalloc(HeapTag, size_t size) { return malloc(size); }
+void* heapTagPsMalloc(HeapTag, size_t size) { return malloc(size); }
+void heapTagFree(HeapTag, void* ptr) { free(ptr); }
+
+namespace {
+
+struct Stored {
+    PrefType type;
+    int64_t i;
+    float f;
+    std::string bytes;
+
+    bool operator==(const Stored& o) const {
+        if (type != o.type) return false;
+        if (type == PrefType::FLOAT) return memcmp(&f, &o.f, sizeof(f)) == 0;
+        if (type == PrefType::STR || type == PrefType::BLOB) return bytes == o.bytes;
+        return i == o.i;
+    }
+};
+
+Stored fromValue(const PrefValue& v) {
+    Stored s{v.type, v.i, v.f, {}};
+    if (v.data) s.bytes.assign(v.data, v.len);
+    return s;
+}
+
+PrefValue toValue(const Stored& s) {
+    PrefValue v;
+    v.type = s.type;
+    v.i = s.i;
+    v.f = s.f;
+    v.data = s.bytes.data();
+    v.len = s.bytes.size();
+    return v;
+}
+
+// One map per NVS type, like NVS itself: a put of a new type without
+// erasing the old one leaves both behind
+class FakeNvs : public PrefSink {
+public:
+    bool put(const char* key, const PrefValue& v, PrefType stored) override {
+        if (failing()) return false;
+        if (stored != PrefType::NONE && stored != v.type) {
+            if (!erase(key)) return false;
+        }
+        entries[{key, v.type}] = fromValue(v);
+        writes++;
+        return true;
+    }
+
+    bool erase(const char* key) override {
+        if (failing()) return false;
+        bool any = false;
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->first.first == key) {
+                it = entries.erase(it);
+                any = true;
+            } else {
+                ++it;
+            }
+        }
+        if (any) writes++;
+        return true;
+    }
+
+    bool commit() override {
+        commits++;
+        return true;
+    }
+
+    bool failing() {
+        return failRate && rng() % 100 < failRate;
+    }
+
+    std::map<std::pair<std::string, PrefType>, Stored> entries;
+    uint32_t failRate = 0;      // Percent
+    uint32_t writes = 0;
+    uint32_t commits = 0;
+    std::mt19937 rng{7};
+};
+
+int g_failures = 0;
+
+void fail(const char* what, const std::string& key) {
+    if (g_failures++ < 10) fprintf(stderr, "FAIL: %s (%s)\n", what, key.c_str());
+}
+
+void checkCache(PrefCache& cache, const std::map<std::string, Stored>& model, const char* when) {
+    size_t n = 0;
+    cache.forEach([&](const char* key, const PrefValue& v) {
+        n++;
+        auto it = model.find(key);
+        if (it == model.end() || !(it->second == fromValue(v))) fail(when, key);
+    });
+    if (n != model.size()) fail(when, "key count");
+    for (const auto& kv : model) {
+        const PrefValue* v = cache.get(kv.first.c_str());
+        if (!v || !(fromValue(*v) == kv.second)) fail(when, kv.first);
+    }
+}
+
+void checkNvs(const FakeNvs& nvs, const std::map<std::string, Stored>& model) {
+    if (nvs.entries.size() != model.size()) fail("nvs entry count", "");
+    for (const auto& kv : model) {
+        auto it = nvs.entries.find({kv.first, kv.second.type});
+        if (it == nvs.entries.end() || !(it->second == kv.second)) fail("nvs value", kv.first);
+    }
+}
+
+void reload(PrefCache& cache, const FakeNvs& nvs) {
+    for (const auto& kv : nvs.entries) cache.load(kv.first.first.c_str(), toValue(kv.second));
+}
+
+Stored randomValue(std::mt19937& rng) {
+    static const PrefType INTS[] = {PrefType::I8, PrefType::U8, PrefType::I32, PrefType::U64};
+    Stored s{PrefType::NONE, 0, 0, {}};
+    switch (rng() % 4) {
+        case 0:
+            s.type = INTS[rng() % 4];
+            s.i = rng() % 4;
+            break;
+        case 1:
+            s.type = PrefType::FLOAT;
+            s.f = (float)(rng() % 3) / 2;
+            break;
+        case 2:
+            s.type = PrefType::STR;
+            s.bytes.assign(rng() % 3 ? rng() % 12 : rng() % 600, (char)('a' + rng() % 3));
+            break;
+        default:
+            s.type = PrefType::BLOB;
+            s.bytes.assign(rng() % 40, (char)(rng() % 3));
+            break;
+    }
+    return s;
+}
+
+void fuzz(int ops) {
+    std::mt19937 rng(1);
+    PrefCache cache(1500, 10000);
+    FakeNvs nvs;
+    std::map<std::string, Stored> model;
+    uint32_t now = 0;
+    char key[24];
+
+    for (int op = 0; op < ops; op++) {
+        now += rng() % 400;
+        // A few hundred keys, some at the 15-character limit
+        snprintf(key, sizeof(key), rng() % 8 ? "k%u" : "long_key_%06u", (unsigned)(rng() % 300));
+        uint32_t r = rng() % 100;
+        if (r < 45) {
+            Stored s = randomValue(rng);
+            if (!cache.set(key, toValue(s), now)) fail("set", key);
+            model[key] = s;
+        } else if (r < 60) {
+            bool had = model.erase(key) > 0;
+            if (cache.remove(key, now) != had) fail("remove", key);
+        } else if (r < 90) {
+            const PrefValue* v = cache.get(key);
+            auto it = model.find(key);
+            if ((v != nullptr) != (it != model.end())) fail("get presence", key);
+            else if (v && !(fromValue(*v) == it->second)) fail("get value", key);
+        } else if (r < 99) {
+            nvs.failRate = rng() % 3 == 0 ? 20 : 0;
+            bool ok = cache.flush(nvs, now);
+            if (ok) {
+                if (cache.dirty()) fail("dirty after flush", "");
+                checkNvs(nvs, model);
+            }
+        } else if (rng() % 4) {
+            // Settle, then load a second cache from what NVS holds
+            nvs.failRate = 0;
+            if (!cache.flush(nvs, now)) fail("final flush", "");
+            checkNvs(nvs, model);
+            PrefCache fresh(1500, 10000);
+            reload(fresh, nvs);
+            checkCache(fresh, model, "reload");
+        } else {
+            nvs.entries.clear();
+            cache.clear();
+            model.clear();
+        }
+    }
+
+    if (cache.set("sixteen_chars_xx", PrefValue::integer(PrefType::I32, 1), now)) fail("long key accepted", "");
+    std::string big(PrefCache::VALUE_MAX + 1, 'x');
+    if (cache.set("big", PrefValue::string(big.data(), big.size()), now)) fail("oversized value accepted", "");
+
+    nvs.failRate = 0;
+    cache.flush(nvs, now);
+    checkCache(cache, model, "final");
+    checkNvs(nvs, model);
+
+    PrefCacheStats st;
+    cache.getStats(st);
+    printf("fuzz: %d ops, %u keys, %u flushes, %u stored, %u erased, %u injected failures, %zu bytes\n",
+           ops, st.keys, st.flushes, st.stored, st.erased, st.failures, cache.memoryBytes());
+}
+
+// A settings session, one event per simulated 10 ms tick
+void session() {
+    const char* KEYS[] = {"theme", "font_size", "font_family", "kb_repeat", "kb_delay",
+                          "radio_region", "radio_power", "radio_sf", "brightness", "volume",
+                          "sounds", "gps_enabled", "node_name", "map_zoom", "map_style"};
+    const int NKEYS = sizeof(KEYS) / sizeof(KEYS[0]);
+
+    PrefCache cache(1500, 10000);
+    FakeNvs nvs;
+    uint32_t writeThrough = 0;
+    for (int k = 0; k < NKEYS; k++) nvs.put(KEYS[k], PrefValue::integer(PrefType::I32, 1), PrefType::NONE);
+    reload(cache, nvs);
+    nvs.writes = 0;
+
+    std::mt19937 rng(3);
+    uint32_t reads = 0;
+    int brightness = 1;
+    for (uint32_t t = 0; t < 60000; t += 10) {
+        // Every frame the screen reads a few prefs as it draws
+        for (int i = 0; i < 4; i++) {
+            cache.get(KEYS[rng() % NKEYS]);
+            reads++;
+        }
+        // 5-9 s: brightness dragged from 1 to 255 and back, an update
+        // every 40 ms
+        if (t >= 5000 && t < 9000 && t % 40 == 0) {
+            brightness = t < 7000 ? 1 + (t - 5000) / 8 : 255 - (t - 7000) / 8;
+            cache.set("brightness", PrefValue::integer(PrefType::I32, brightness), t);
+            writeThrough++;
+        }
+        // 20-50 s: a toggle flipped or a pref re-saved every 2 s, half
+        // of them with the value already held
+        if (t >= 20000 && t < 50000 && t % 2000 == 0) {
+            int v = (int)(rng() % 2);
+            cache.set(KEYS[rng() % 4], PrefValue::integer(PrefType::I32, v), t);
+            writeThrough++;
+        }
+        if (cache.due(t)) cache.flush(nvs, t);
+    }
+    cache.flush(nvs, 60000);
+
+    PrefCacheStats st;
+    cache.getStats(st);
+    printf("session: %u reads, %u sets (%u unchanged) -> NVS writes %u write-through, %u cached "
+           "(%u commits)\n",
+           reads, writeThrough, st.unchanged, writeThrough, nvs.writes, nvs.commits);
+
+    // Cost of a cached read
+    const int N = 2000000;
+    auto t0 = std::chrono::steady_clock::now();
+    uintptr_t sink = 0;
+    for (int i = 0; i < N; i++) sink += (uintptr_t)cache.get(KEYS[i % NKEYS]);
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+    printf("get: %.1f ns per read (%zu)\n", ns, (size_t)(sink & 1));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int ops = argc > 1 ? atoi(argv[1]) : 200000;
+    fuzz(ops);
+    session();
+    if (g_failures) {
+        fprintf(stderr, "%d failures\n", g_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Host check for AsyncIO's READ_BYTES batching (src/util/read_coalescer.cpp).
+//
+// Writes a scratch file of random bytes, then for many random batches of
+// byte-range reads compares two strategies:
+//
+//   naive      open, seek, read, close per request (the old AsyncIO path)
+//   coalesced  one open per batch, ranges sorted and merged by
+//              planReadSpans(), one seek+read per span, sliced per request
+//
+// Every request's bytes must be identical under both, and every planned
+// span must cover its ranges within the size limit; any mismatch exits 1.
+// Prints the file operations each strategy issued.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/read_coalesce_check
+//         tools/bench/read_coalesce_check.cpp src/util/read_coalescer.cpp
+//     /tmp/read_coalesce_check [batches]
+//
+// Batches mimic a map pan: up to 9 tile reads of 1-12 KB, mostly near one
+// another in the archive, some scattered, some duplicated or past EOF.
+
+#include "read_coalescer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t MAX_GAP = 2048;       // Same limits as AsyncIO
+constexpr uint32_t MAX_SPAN = 64 * 1024;
+constexpr size_t MAX_BATCH = 9;
+constexpr uint32_t FILE_SIZE = 4 * 1024 * 1024;
+
+struct Counts {
+    uint64_t opens = 0;
+    uint64_t reads = 0;     // seek + read commands
+    uint64_t bytes = 0;
+};
+
+// Same clamping as AsyncIO: empty past EOF, truncated at EOF.
+bool clampRange(uint32_t& offset, uint32_t& length) {
+    if (offset >= FILE_SIZE || length == 0) return false;
+    if (offset + length > FILE_SIZE) length = FILE_SIZE - offset;
+    return true;
+}
+
+std::vector<uint8_t> readAt(FILE* f, uint32_t offset, uint32_t length, Counts& c) {
+    std::vector<uint8_t> buf(length);
+    fseek(f, offset, SEEK_SET);
+    size_t got = fread(buf.data(), 1, length, f);
+    buf.resize(got);
+    c.reads++;
+    c.bytes += length;
+    return buf;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t batches = argc > 1 ? (size_t)atol(argv[1]) : 20000;
+
+    char path[] = "/tmp/read_coalesce_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    FILE* out = fdopen(fd, "wb");
+    std::mt19937 rng(777);
+    std::vector<uint8_t> content(FILE_SIZE);
+    for (auto& b : content) b = (uint8_t)rng();
+    fwrite(content.data(), 1, content.size(), out);
+    fclose(out);
+
+    Counts naive, coalesced;
+    size_t requests = 0, failures = 0;
+
+    for (size_t b = 0; b < batches; b++) {
+        size_t n = 1 + rng() % MAX_BATCH;
+        uint32_t base = rng() % FILE_SIZE;
+        std::vector<ReadRange> asked(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t r = rng() % 10;
+            uint32_t len = 1024 + rng() % (11 * 1024);
+            uint32_t off;
+            if (r < 6) off = base + rng() % (48 * 1024);            // Neighbouring tiles
+            else if (r < 8) off = rng() % FILE_SIZE;                 // Scattered
+            else if (r < 9 && i > 0) off = asked[rng() % i].offset;  // Duplicate
+            else off = FILE_SIZE - rng() % 4096 + rng() % 8192;      // Around EOF
+            asked[i] = {off, len};
+        }
+        requests += n;
+
+        // Naive: one open per request.
+        std::vector<std::vector<uint8_t>> expect(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t off = asked[i].offset, len = asked[i].length;
+            if (!clampRange(off, len)) continue;
+            FILE* f = fopen(path, "rb");
+            naive.opens++;
+            expect[i] = readAt(f, off, len, naive);
+            fclose(f);
+        }
+
+        // Coalesced: one open, planned spans.
+        std::vector<ReadRange> ranges;
+        std::vector<size_t> owner;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t off = asked[i].offset, len = asked[i].length;
+            if (!clampRange(off, len)) continue;
+            ranges.push_back({off, len});
+            owner.push_back(i);
+        }
+        std::vector<uint16_t> order(ranges.size());
+        std::vector<ReadSpan> spans(ranges.size());
+        size_t spanCount = planReadSpans(ranges.data(), ranges.size(), order.data(),
+                                         spans.data(), MAX_GAP, MAX_SPAN);
+
+        std::vector<std::vector<uint8_t>> got(n);
+        FILE* f = fopen(path, "rb");
+        coalesced.opens++;
+        size_t covered = 0;
+        uint64_t prevEnd = 0;
+        for (size_t s = 0; s < spanCount; s++) {
+            const ReadSpan& span = spans[s];
+            if (s > 0 && span.offset < prevEnd) failures++;  // Spans must not overlap
+            prevEnd = (uint64_t)span.offset + span.length;
+            if (span.count > 1 && span.length > MAX_SPAN) failures++;
+
+            std::vector<uint8_t> data = readAt(f, span.offset, span.length, coalesced);
+            for (size_t k = span.first; k < (size_t)span.first + span.count; k++) {
+                const ReadRange& r = ranges[order[k]];
+                if (r.offset < span.offset ||
+                    (uint64_t)r.offset + r.length > (uint64_t)span.offset + span.length) {
+                    failures++;
+                    continue;
+                }
+                size_t at = r.offset - span.offset;
+                got[owner[order[k]]].assign(data.begin() + at, data.begin() + at + r.length);
+                covered++;
+            }
+        }
+        fclose(f);
+
+        if (covered != ranges.size()) failures++;
+        for (size_t i = 0; i < n; i++) {
+            if (got[i] != expect[i]) failures++;
+        }
+    }
+    remove(path);
+
+    printf("%zu batches, %zu requests\n\n", batches, requests);
+    printf("  %-10s %10s %10s %12s\n", "", "opens", "reads", "bytes");
+    printf("  %-10s %10llu %10llu %12llu\n", "naive",
+           (unsigned long long)naive.opens, (unsigned long long)naive.reads,
+           (unsigned long long)naive.bytes);
+    printf("  %-10s %10llu %10llu %12llu\n", "coalesced",
+           (unsigned long long)coalesced.opens, (unsigned long long)coalesced.reads,
+           (unsigned long long)coalesced.bytes);
+    printf("\n  saved: %llu opens, %llu reads (%.1f%% of SD commands)\n",
+           (unsigned long long)(naive.opens - coalesced.opens),
+           (unsigned long long)(naive.reads - coalesced.reads),
+           100.0 * ((naive.opens + naive.reads) - (double)(coalesced.opens + coalesced.reads)) /
+               (double)(naive.opens + naive.reads));
+
+    if (failures) {
+        printf("\nFAILED: %zu mismatches\n", failures);
+        return 1;
+    }
+    printf("\nall results identical\n");
+    return 0;
+}
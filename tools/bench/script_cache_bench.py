@@ -0,0 +1,80 @@
+"""
+Host benchmark for the script bytecode cache (src/lua/script_loader.cpp).
+
+Times, for each script given, what a cache miss and a cache hit cost in
+the Lua VM itself:
+
+  * compile   ``load(source)``, the parse a miss pays
+  * undump    ``load(bytecode, name, "b")`` on ``string.dump(chunk)``,
+              with debug info kept, which is what the cache stores
+  * stripped  the same on ``string.dump(chunk, true)``, for comparison
+              with the luac'd embedded scripts
+
+Runs under desktop Lua 5.4 (embedded via lupa). The firmware builds
+Esp32Lua 5.4.7 and lupa bundles a later 5.4 release with the same parser
+and undump format, so the ratio carries over; the absolute times do not
+(x86 against a 240 MHz Xtensa with scripts in PSRAM). Reading and hashing
+the source, which a hit also pays, is not included.
+
+Usage, from the repo root::
+
+    python3 tools/bench/script_cache_bench.py lua/ezui/widgets.lua lua/ezui/markdown.lua
+"""
+
+from __future__ import annotations
+
+import argparse
+from pathlib import Path
+
+import lupa.lua54 as lupa
+
+BENCH = """
+local source, name, rounds = ...
+
+local function median_us(fn)
+    local times = {}
+    for i = 1, rounds do
+        collectgarbage()
+        local t0 = os.clock()
+        fn()
+        times[i] = (os.clock() - t0) * 1e6
+    end
+    table.sort(times)
+    return times[(rounds + 1) // 2]
+end
+
+local chunk = assert(load(source, "@" .. name))
+local full = string.dump(chunk)
+local stripped = string.dump(chunk, true)
+
+return median_us(function() assert(load(source, "@" .. name)) end),
+       median_us(function() assert(load(full, "@" .. name, "b")) end),
+       median_us(function() assert(load(stripped, "@" .. name, "b")) end),
+       #full, #stripped, _VERSION
+"""
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("scripts", nargs="+", type=Path)
+    ap.add_argument("--rounds", type=int, default=200)
+    args = ap.parse_args()
+
+    lua = lupa.LuaRuntime()
+    bench = lua.eval("function(...) " + BENCH + " end")
+    print(f"{'script':<24} {'source':>8} {'compile':>10} {'undump':>10} {'bytecode':>9} "
+          f"{'stripped':>10} {'bytecode':>9} {'ratio':>7}")
+    for path in args.scripts:
+        source = path.read_bytes()
+        compile_us, undump_us, stripped_us, full_len, stripped_len, version = bench(
+            source, path.name, args.rounds)
+        print(f"{path.name:<24} {len(source) / 1024:>6.1f}KB {compile_us:>8.0f}us "
+              f"{undump_us:>8.0f}us {full_len / 1024:>7.1f}KB {stripped_us:>8.0f}us "
+              f"{stripped_len / 1024:>7.1f}KB {compile_us / undump_us:>6.1f}x")
+    print("\nratio: compile / undump, what a cache hit saves over a miss")
+    print(f"{version} (lupa), median of {args.rounds} rounds")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,333 @@
+// Host check for the Lua timer wheel (src/util/timer_wheel.cpp).
+//
+// Drives a TimerWheel and a brute-force model (every live timer in a flat
+// list, each with its 64-bit deadline and a scheduling sequence number) with
+// the same long random sequence of schedules, cancels and advances. The
+// clock starts just short of the uint32_t wrap, so millis() rolls over
+// early in the run, and some delays and advances are long enough to go
+// through the overflow list. The fire callbacks cancel and schedule timers
+// themselves, the way Lua callbacks do. Checks that:
+//
+//   every timer fires at its deadline, in (deadline, scheduling order);
+//   timers sharing a deadline fire first-scheduled first
+//   nothing due is left behind after advance(), and nothing fires early
+//   repeating timers re-arm for now + interval unless their callback
+//   cancelled them
+//   cancel() returns the payload of a live timer and false for one that
+//   already fired or was cancelled, even after its node has been reused
+//   size() matches the model, and nextDeadline() is never later than the
+//   earliest deadline and is exact when that falls in the current 64 ms
+//   slot window
+//
+// Any mismatch exits 1. Prints timer counts and advance() cost.
+//
+// Build and run from the repo root:
+//
+//     g++ -O2 -std=gnu++17 -Isrc/util -o /tmp/timer_wheel_check
+//         tools/bench/timer_wheel_check.cpp src/util/timer_wheel.cpp
+//     /tmp/timer_wheel_check [operations]
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct ModelTimer {
+    TimerWheel::Id id;
+    uint64_t deadline;      // Absolute, never wraps
+    uint32_t interval;
+    int payload;
+    uint64_t seq;           // Scheduling order, renewed on re-arm
+    bool firing;            // In its own callback (repeating timers only)
+};
+
+int g_failures = 0;
+
+void fail(const char* what, long long a = 0, long long b = 0) {
+    if (g_failures++ < 10) fprintf(stderr, "FAIL: %s (%lld, %lld)\n", what, a, b);
+    // A broken wheel can fail on every tick of a long advance
+    if (g_failures > 100) {
+        fprintf(stderr, "too many failures, giving up\n");
+        exit(1);
+    }
+}
+
+class Check {
+public:
+    explicit Check(uint32_t seed) : _rng(seed), _wheel(START) {}
+
+    void run(int ops) {
+        for (int op = 0; op < ops; op++) {
+            uint32_t r = _rng() % 100;
+            if (r < 40) {
+                scheduleRandom(_now, _now + _rng() % 50);
+            } else if (r < 55) {
+                cancelRandom();
+            } else {
+                advanceRandom();
+            }
+            checkState();
+        }
+        // Cancel whatever is left; the wheel must agree it was all live
+        std::vector<TimerWheel::Id> ids;
+        for (const ModelTimer& t : _model) ids.push_back(t.id);
+        for (TimerWheel::Id id : ids) {
+            if (!_wheel.cancel(id)) fail("final cancel", id);
+            erase(id);
+        }
+        checkState();
+
+        int dropped = 0;
+        scheduleRandom(_now, _now);
+        scheduleRandom(_now, _now);
+        _wheel.clear([&](int) { dropped++; });
+        if (dropped != 2 || _wheel.size() != 0) fail("clear", dropped, (long long)_wheel.size());
+        _model.clear();
+    }
+
+    uint64_t fired() const { return _fired; }
+    uint64_t scheduled() const { return _scheduled; }
+    uint64_t staleChecked() const { return _stale; }
+    size_t peak() const { return _peak; }
+    bool wrapped() const { return _now > 0xFFFFFFFFull; }
+
+private:
+    static constexpr uint32_t START = 0xFFFFFFFFu - 200000;
+
+    uint32_t randomDelay() {
+        uint32_t r = _rng() % 100;
+        if (r < 10) return _rng() % 3;                  // Now / next tick
+        if (r < 60) return _rng() % 200;                // Level 0-1
+        if (r < 85) return _rng() % 20000;              // Level 2
+        if (r < 98) return _rng() % 3000000;            // Level 3
+        return (1u << 24) + _rng() % (1u << 24);        // Overflow list
+    }
+
+    // Schedule with the caller's clock at `callerNow` (millis() may be ahead
+    // of the wheel's tick); nothing lands on or before `current`
+    void scheduleRandom(uint64_t current, uint64_t callerNow) {
+        uint32_t delay = randomDelay();
+        uint32_t interval = _rng() % 4 == 0 ? 1 + _rng() % 500 : 0;
+        int payload = _nextPayload++;
+        TimerWheel::Id id = _wheel.schedule((uint32_t)callerNow, delay, interval, payload);
+        if (id == 0) {
+            fail("schedule returned 0");
+            return;
+        }
+        uint64_t deadline = callerNow + delay;
+        if (deadline <= current) deadline = current + 1;
+        for (const ModelTimer& t : _model) {
+            if (t.id == id) fail("id reused while live", id);
+        }
+        _model.push_back({id, deadline, interval, payload, _seq++, false});
+        _scheduled++;
+        _peak = std::max(_peak, _model.size());
+    }
+
+    ModelTimer* find(TimerWheel::Id id) {
+        for (ModelTimer& t : _model) {
+            if (t.id == id) return &t;
+        }
+        return nullptr;
+    }
+
+    void erase(TimerWheel::Id id) {
+        for (size_t i = 0; i < _model.size(); i++) {
+            if (_model[i].id == id) {
+                _dead.push_back(id);
+                if (_dead.size() > 4096) _dead.erase(_dead.begin(), _dead.begin() + 2048);
+                _model[i] = _model.back();
+                _model.pop_back();
+                return;
+            }
+        }
+    }
+
+    void cancelRandom() {
+        if (!_model.empty() && _rng() % 3) {
+            ModelTimer t = _model[_rng() % _model.size()];
+            int payload = -1;
+            if (!_wheel.cancel(t.id, &payload)) fail("cancel of a live timer", t.id);
+            else if (payload != t.payload) fail("cancel payload", payload, t.payload);
+            erase(t.id);
+            // A second cancel must be a no-op
+            if (_wheel.cancel(t.id)) fail("double cancel", t.id);
+            return;
+        }
+        cancelStale();
+    }
+
+    // An id that fired or was cancelled; its node may have been reused
+    void cancelStale() {
+        if (_dead.empty()) return;
+        TimerWheel::Id id = _dead[_rng() % _dead.size()];
+        if (find(id)) return;  // Generation wrapped onto a live timer
+        _stale++;
+        if (_wheel.cancel(id)) fail("stale id cancelled", id);
+    }
+
+    void advanceRandom() {
+        uint32_t r = _rng() % 100;
+        uint64_t step;
+        if (r < 50) step = _rng() % 5;
+        else if (r < 85) step = _rng() % 300;
+        else if (r < 99) step = _rng() % 100000;
+        else step = (1u << 24) + _rng() % (1u << 22);
+        uint64_t now = _now + step;
+
+        _wheel.advance((uint32_t)now, [&](TimerWheel::Id id, int payload, bool repeating) {
+            onFire(id, payload, repeating, now);
+        });
+        _now = now;
+
+        for (const ModelTimer& t : _model) {
+            if (t.deadline <= now) fail("due timer left behind", t.id, (long long)(now - t.deadline));
+        }
+    }
+
+    void onFire(TimerWheel::Id id, int payload, bool repeating, uint64_t now) {
+        // The model's next due timer
+        ModelTimer* expected = nullptr;
+        for (ModelTimer& t : _model) {
+            if (t.firing || t.deadline > now) continue;
+            if (!expected || t.deadline < expected->deadline ||
+                (t.deadline == expected->deadline && t.seq < expected->seq)) {
+                expected = &t;
+            }
+        }
+        if (!expected) {
+            fail("fired with nothing due", id);
+            return;
+        }
+        if (expected->id != id) {
+            ModelTimer* got = find(id);
+            fail("fire order", (long long)expected->deadline,
+                 got ? (long long)got->deadline : -1);
+            return;
+        }
+        if (payload != expected->payload) fail("fire payload", payload, expected->payload);
+        if (repeating != (expected->interval != 0)) fail("repeating flag", id);
+        _fired++;
+
+        uint64_t tick = expected->deadline;
+        uint32_t interval = expected->interval;
+        if (interval == 0) {
+            erase(id);
+            if (_wheel.cancel(id)) fail("one-shot still cancellable in its callback", id);
+        } else {
+            expected->firing = true;
+        }
+
+        // What a Lua callback might do
+        uint32_t r = _rng() % 10;
+        if (r < 2) {
+            scheduleRandom(tick, now);
+        } else if (r < 3 && interval != 0) {
+            if (!_wheel.cancel(id)) fail("cancel self", id);
+            erase(id);
+        } else if (r < 4) {
+            cancelRandom();
+        }
+
+        ModelTimer* self = find(id);
+        if (self) {
+            self->firing = false;
+            self->deadline = now + interval;
+            self->seq = _seq++;
+        }
+    }
+
+    void checkState() {
+        if (_wheel.size() != _model.size()) {
+            fail("size", (long long)_wheel.size(), (long long)_model.size());
+        }
+        uint32_t at;
+        bool any = _wheel.nextDeadline(at);
+        if (any != !_model.empty()) {
+            fail("nextDeadline presence", any, (long long)_model.size());
+            return;
+        }
+        if (!any) return;
+        uint64_t earliest = UINT64_MAX;
+        for (const ModelTimer& t : _model) earliest = std::min(earliest, t.deadline);
+        // As absolute time: the wheel's answer relative to now
+        uint64_t got = _now + (uint32_t)(at - (uint32_t)_now);
+        if (got > earliest) fail("nextDeadline later than a deadline", (long long)(got - _now),
+                                 (long long)(earliest - _now));
+        if ((earliest >> 6) == (_now >> 6) && got != earliest) {
+            fail("nextDeadline not exact in the current window", (long long)(got - _now),
+                 (long long)(earliest - _now));
+        }
+    }
+
+    std::mt19937 _rng;
+    TimerWheel _wheel;
+    uint64_t _now = START;
+    std::vector<ModelTimer> _model;
+    std::vector<TimerWheel::Id> _dead;
+    uint64_t _seq = 0;
+    int _nextPayload = 1;
+    uint64_t _fired = 0;
+    uint64_t _scheduled = 0;
+    uint64_t _stale = 0;
+    size_t _peak = 0;
+};
+
+// Equal deadlines, scheduled from different levels, fire in order
+void checkFifo() {
+    TimerWheel w(1000);
+    std::vector<int> order;
+    // 500 ms out lands on level 1; the rest are scheduled once the wheel
+    // is in the same 64 ms window and go straight to level 0
+    w.schedule(1000, 500, 0, 0);
+    w.advance(1450, [&](TimerWheel::Id, int p, bool) { order.push_back(p); });
+    for (int i = 1; i < 5; i++) w.schedule(1450, 50, 0, i);
+    w.advance(1500, [&](TimerWheel::Id, int p, bool) { order.push_back(p); });
+    for (int i = 0; i < 5; i++) {
+        if (i >= (int)order.size() || order[i] != i) fail("equal deadlines out of order", i);
+    }
+}
+
+// advance() cost with a steady population of interval timers
+void bench() {
+    TimerWheel w(0);
+    std::mt19937 rng(9);
+    for (int i = 0; i < 200; i++) w.schedule(0, rng() % 1000, 16 + rng() % 1000, i);
+    uint64_t fired = 0;
+    const uint32_t FRAMES = 200000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t t = 1; t <= FRAMES; t++) {
+        w.advance(t * 16, [&](TimerWheel::Id, int, bool) { fired++; });
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / FRAMES;
+    printf("advance: %.0f ns per 16 ms frame with 200 interval timers (%llu fired)\n", ns,
+           (unsigned long long)fired);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int ops = argc > 1 ? atoi(argv[1]) : 300000;
+    checkFifo();
+    for (uint32_t seed = 1; seed <= 4; seed++) {
+        Check c(seed);
+        c.run(ops / 4);
+        printf("seed %u: %llu scheduled, %llu fired, %llu stale cancels, peak %zu live%s\n", seed,
+               (unsigned long long)c.scheduled(), (unsigned long long)c.fired(),
+               (unsigned long long)c.staleChecked(), c.peak(), c.wrapped() ? ", wrapped" : "");
+    }
+    bench();
+    if (g_failures) {
+        fprintf(stderr, "%d failures\n", g_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
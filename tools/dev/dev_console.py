@@ -6,6 +6,8 @@ Enable the dev server on the device (Settings -> System -> Dev OTA),
 note the IP and 6-character token shown there, then:
 
     python tools/dev/dev_console.py 192.168.1.42 K3F9-2X --info
+    python tools/dev/dev_console.py 192.168.1.42 K3F9-2X --binlogs
+    python tools/dev/dev_console.py 192.168.1.42 K3F9-2X --trace trace.json
     python tools/dev/dev_console.py 192.168.1.42 K3F9-2X -s screen.png
     python tools/dev/dev_console.py 192.168.1.42 K3F9-2X -e 'return collectgarbage("count")'
     python tools/dev/dev_console.py 192.168.1.42 K3F9-2X -k a
@@ -99,6 +101,37 @@ def cmd_logs(args):
     return 0
 
 
+def cmd_binlogs(args):
+    status, _, data = _request(args.host, args.port, "GET", "/logs.bin",
+                               args.token, timeout=15.0)
+    if status != 200:
+        print(f"error: HTTP {status}: {data!r}", file=sys.stderr)
+        return 1
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    import log_decode
+    try:
+        for rec in log_decode.decode(data):
+            print(log_decode.format_line(*rec))
+    except log_decode.DecodeError as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 1
+    return 0
+
+
+def cmd_trace(args):
+    status, _, data = _request(args.host, args.port, "GET", "/trace.json",
+                               args.token, timeout=30.0)
+    if status != 200:
+        print(f"error: HTTP {status}: {data!r}", file=sys.stderr)
+        return 1
+    with open(args.trace, "wb") as f:
+        f.write(data)
+    events = len(json.loads(data).get("traceEvents", []))
+    print(f"saved {args.trace} ({events} events) -- open in "
+          "https://ui.perfetto.dev or chrome://tracing")
+    return 0
+
+
 def cmd_screenshot(args):
     status, _, data = _request(args.host, args.port, "GET", "/screen.bmp",
                                args.token, timeout=15.0)
@@ -206,6 +239,12 @@ def main():
                    help="GET /info -- partition, heap, wifi, screen")
     g.add_argument("--logs", action="store_true",
                    help="GET /logs -- recent in-memory log lines")
+    g.add_argument("--binlogs", action="store_true",
+                   help="GET /logs.bin -- raw log records with timestamps, "
+                        "levels and cores, decoded locally")
+    g.add_argument("--trace", metavar="OUT",
+                   help="GET /trace.json -- ez.trace timeline as Chrome "
+                        "trace-event JSON (start it with ez.trace.start())")
     g.add_argument("-s", "--screenshot", metavar="OUT",
                    help="capture current frame; saves PNG (if Pillow) or BMP")
     g.add_argument("-e", "--exec", metavar="CODE",
@@ -230,6 +269,10 @@ def main():
             return cmd_info(args)
         if args.logs:
             return cmd_logs(args)
+        if args.binlogs:
+            return cmd_binlogs(args)
+        if args.trace:
+            return cmd_trace(args)
         if args.screenshot:
             return cmd_screenshot(args)
         if args.exec:
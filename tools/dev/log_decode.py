@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+Decode the binary log dump served at /logs.bin.
+
+LOG() on the device records the format string pointer and raw arguments
+instead of formatting (src/util/log_ring.h). /logs.bin sends those records
+along with each format string the first time it is used, and this script
+does the printf formatting host-side:
+
+    python tools/dev/dev_console.py 192.168.1.42 K3F9-2X --binlogs
+    python tools/dev/log_decode.py dump.bin
+    curl -H 'Authorization: Bearer K3F9-2X' http://192.168.1.42:8080/logs.bin \\
+        | python tools/dev/log_decode.py -
+
+Each line comes out as "<seconds since boot> <level><core> <message>",
+e.g. "   12.345678 I1 [Radio] rx seq=4". Stdlib only.
+"""
+
+import re
+import struct
+import sys
+
+MAGIC = b"EZLG"
+VERSION = 1
+
+# LogRecordHeader on the device (32-bit pointers): commit, len, level,
+# core, fmt, timeUs
+HEADER = struct.Struct("<IHBBII")
+
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+# One printf conversion: flags, width, precision, length, conversion
+SPEC = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(?:hh|h|ll|l|L|q|j|z|t)?([diouxXeEfFgGaAcspn%])")
+
+
+class DecodeError(ValueError):
+    pass
+
+
+def _read_args(body):
+    """Split a record body into a list of (tag, value)."""
+    args = []
+    i = 0
+    while i < len(body):
+        tag = body[i]
+        i += 1
+        if tag == 0:
+            break
+        if tag == ord("i"):
+            args.append(("i", struct.unpack_from("<I", body, i)[0]))
+            i += 4
+        elif tag == ord("p"):
+            args.append(("p", struct.unpack_from("<I", body, i)[0]))
+            i += 4
+        elif tag == ord("l"):
+            args.append(("l", struct.unpack_from("<Q", body, i)[0]))
+            i += 8
+        elif tag == ord("d"):
+            args.append(("d", struct.unpack_from("<d", body, i)[0]))
+            i += 8
+        elif tag == ord("s"):
+            n = body[i]
+            args.append(("s", body[i + 1:i + 1 + n].decode("utf-8", errors="replace")))
+            i += 1 + n
+        else:
+            break
+    return args
+
+
+def _signed(tag, v):
+    bits = 64 if tag == "l" else 32
+    return v - (1 << bits) if v >> (bits - 1) else v
+
+
+def format_record(fmt, args):
+    """printf-format `fmt` with decoded args the way logFormat() does."""
+    args = list(args)
+
+    def take():
+        return args.pop(0) if args else (None, None)
+
+    def star(part):
+        if part != "*":
+            return part or ""
+        tag, v = take()
+        return str(_signed(tag, v)) if tag == "i" else "0"
+
+    def repl(m):
+        flags, width, prec, conv = m.groups()
+        if conv == "%":
+            return "%"
+        width = star(width)
+        if prec is not None:
+            prec = "." + star(prec)
+        else:
+            prec = ""
+        tag, v = take()
+        if tag is None:
+            return "<?>"
+        spec = "%" + flags + width + prec
+        try:
+            if conv in "di" and tag in "il":
+                return (spec + "d") % _signed(tag, v)
+            if conv in "ouxX" and tag in "il":
+                return (spec + conv) % v
+            if conv == "c" and tag == "i":
+                return (spec + "c") % (v & 0xFF)
+            if conv in "eEfFgG" and tag == "d":
+                return (spec + conv) % v
+            if conv in "aA" and tag == "d":
+                return v.hex()
+            if conv == "s" and tag == "s":
+                return (spec + "s") % v
+            if conv == "p" and tag in "pi":
+                return "0x%08x" % v
+        except (TypeError, ValueError):
+            pass
+        return "<?>"
+
+    return SPEC.sub(repl, fmt)
+
+
+def decode(data):
+    """Yield (time_us, level, core, message) for each record in a dump."""
+    if data[:4] != MAGIC:
+        raise DecodeError("not a /logs.bin dump (bad magic)")
+    if data[4] != VERSION:
+        raise DecodeError(f"unsupported dump version {data[4]}")
+    fmts = {}
+    i = 5
+    while i < len(data):
+        kind = data[i:i + 1]
+        i += 1
+        if kind == b"F":
+            ptr, n = struct.unpack_from("<IH", data, i)
+            i += 6
+            fmts[ptr] = data[i:i + n].decode("utf-8", errors="replace")
+            i += n
+        elif kind == b"R":
+            if i + HEADER.size > len(data):
+                break
+            _, length, level, core, fmt_ptr, time_us = HEADER.unpack_from(data, i)
+            if length < HEADER.size or i + length > len(data):
+                raise DecodeError(f"truncated record at offset {i}")
+            args = _read_args(data[i + HEADER.size:i + length])
+            i += length
+            fmt = fmts.get(fmt_ptr)
+            if fmt is None:
+                msg = f"<unknown format 0x{fmt_ptr:08x}>"
+            else:
+                msg = format_record(fmt, args)
+            yield time_us, level, core, msg
+        else:
+            raise DecodeError(f"bad entry {kind!r} at offset {i - 1}")
+
+
+def format_line(time_us, level, core, msg):
+    return f"{time_us / 1e6:12.6f} {LEVELS.get(level, '?')}{core} {msg}"
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    path = sys.argv[1]
+    if path == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(path, "rb") as f:
+            data = f.read()
+    try:
+        for rec in decode(data):
+            print(format_line(*rec))
+    except DecodeError as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
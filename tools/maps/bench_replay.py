@@ -0,0 +1,466 @@
+"""
+Host replay benchmark for the on-device map stack.
+
+Runs the real ``lua/services/map_archive.lua`` and
+``lua/ezui/widgets/map_view.lua`` under desktop Lua 5.4 (embedded via
+lupa), with shims standing in for the firmware bindings:
+
+  * ``ez.storage``      — read_bytes / async_read_bytes / file_size against
+                          the host filesystem. async reads yield the calling
+                          coroutine and complete on the next frame, the same
+                          way AsyncIO::update() resumes them on device.
+  * ``ez.compression``  — inflate via Python's zlib (same stream format as
+                          the ROM miniz decoder).
+  * ``ez.buffer``       — new / release / ``#``, holding a Lua string. The
+                          storage and inflate shims accept one as the
+                          optional output argument, like the bindings.
+  * ``ez.display``      — records every call instead of drawing.
+  * ``ez.worker``       — call() fails; the map stack never uses the
+                          worker, but ezui.async hangs post() on it.
+
+A pan/zoom input trace is replayed against a TDMAP archive at a fixed
+33 ms frame cadence (the ezui screen's frame interval), and the harness
+reports tile reads, bytes read and inflated, tile-cache hit rate and
+draw calls per frame.
+
+Trace format, one event per line (``#`` starts a comment):
+
+    <t_ms> <key>
+
+where ``key`` is UP / DOWN / LEFT / RIGHT (a trackball pan step), ``+`` /
+``-`` (zoom, handled the way screens/tools/map.lua does) or ``L`` (toggle
+labels). A ``@ lat lon zoom`` line before the first event sets the start
+view; without it the view starts at the archive's bounds centre.
+
+Usage:
+
+    python bench_replay.py world.tdmap traces/pan_zoom.trace
+    python bench_replay.py world.tdmap traces/pan_zoom.trace --csv frames.csv
+
+Requires ``lupa`` (see requirements.txt).
+"""
+
+import argparse
+import csv
+import sys
+import zlib
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+REPO_ROOT = Path(__file__).resolve().parents[2]
+LUA_ROOT = REPO_ROOT / "lua"
+
+FRAME_MS = 33          # ezui.screen.frame_interval
+VIEW_X, VIEW_Y = 0, 34  # Below status bar + title bar, as in the map screen
+VIEW_W, VIEW_H = 320, 190
+SETTLE_FRAMES = 120     # Upper bound on frames run after the last event
+
+# Everything the widget and archive touch on `ez`, plus the globals the
+# firmware provides (spawn via core/modules.lua). Counters live in _bench
+# and are snapshotted + reset by the harness once per frame.
+LUA_PRELUDE = r"""
+local lua_root, host = ...
+package.path = lua_root .. "/?.lua;" .. lua_root .. "/?/init.lua"
+
+_bench = {
+    now = 0, dirty = true,
+    sync_reads = 0, async_reads = 0, bytes_read = 0,
+    inflates = 0, bytes_inflated = 0,
+    tile_lookups = 0, tile_hits = 0,
+    parent_fallbacks = 0, child_fallbacks = 0,
+    draw = {}, draw_calls = 0, pixels_blitted = 0,
+    io_queue = {},
+}
+local B = _bench
+
+local function count_draw(name, px)
+    B.draw[name] = (B.draw[name] or 0) + 1
+    B.draw_calls = B.draw_calls + 1
+    if px then B.pixels_blitted = B.pixels_blitted + px end
+end
+
+local display = {
+    text_width      = function(s) count_draw("text_width"); return #s * 6 end,
+    get_font_height = function() return 12 end,
+    get_font_width  = function() return 6 end,
+    rgb             = function(r, g, b) return 0 end,
+    draw_indexed_bitmap = function(x, y, w, h)
+        count_draw("draw_indexed_bitmap", w * h)
+    end,
+    draw_indexed_bitmap_scaled = function(x, y, w, h)
+        count_draw("draw_indexed_bitmap_scaled", w * h)
+    end,
+    fill_rect = function(x, y, w, h) count_draw("fill_rect", w * h) end,
+}
+setmetatable(display, { __index = function(t, k)
+    local f = function() count_draw(k) end
+    rawset(t, k, f)
+    return f
+end })
+
+-- ez.buffer stand-in: the bytes live in a Lua string. Enough for what the
+-- map archive does with buffers (read into, inflate into, #, release).
+local Buffer = {}
+Buffer.__index = Buffer
+Buffer.__len = function(b) return #b.bytes end
+function Buffer:release() self.bytes = "" end
+function Buffer:tostring() return self.bytes end
+
+local function is_buffer(v) return getmetatable(v) == Buffer end
+local function bytes_of(v) if is_buffer(v) then return v.bytes end return v end
+
+-- Hand `data` back the way the binding would: as is, or in `out`
+local function into(out, data)
+    if not out or not data then return data end
+    out.bytes = data
+    return out, #data
+end
+
+ez = {
+    display = display,
+    buffer = {
+        new = function(n) return setmetatable({ bytes = string.rep("\0", n or 0) }, Buffer) end,
+        is_buffer = is_buffer,
+    },
+    log = function(msg) host.log(msg) end,
+    system = { millis = function() return B.now end },
+    storage = {
+        get_pref = function(_, default) return default end,
+        set_pref = function() end,
+        file_size = function(path) return host.file_size(path) end,
+        read_bytes = function(path, offset, len, out_buf)
+            B.sync_reads = B.sync_reads + 1
+            local data = host.read(path, offset, len)
+            if data then B.bytes_read = B.bytes_read + #data end
+            return into(out_buf, data)
+        end,
+        async_read_bytes = function(path, offset, len, out_buf)
+            local co, is_main = coroutine.running()
+            assert(co and not is_main, "async_read_bytes outside a coroutine")
+            B.async_reads = B.async_reads + 1
+            B.io_queue[#B.io_queue + 1] = {
+                co = co, path = path, offset = offset, len = len, buf = out_buf,
+            }
+            return coroutine.yield()
+        end,
+    },
+    worker = {
+        call = function() return false, "no worker in the replay harness" end,
+    },
+    compression = {
+        inflate = function(data, max_out, _raw, out_buf)
+            local out = host.inflate(bytes_of(data), max_out)
+            B.inflates = B.inflates + 1
+            if out then B.bytes_inflated = B.bytes_inflated + #out end
+            return into(out_buf, out)
+        end,
+    },
+}
+
+-- core/modules.lua's spawn: create + resume immediately.
+function spawn(fn)
+    local co = coroutine.create(fn)
+    local ok, err = coroutine.resume(co)
+    if not ok then ez.log("[spawn] error: " .. tostring(err)) end
+    return co
+end
+
+-- map_view lazily requires ezui.screen for invalidate(); the real module
+-- drags in focus/async/toast handling we don't need here.
+package.loaded["ezui.screen"] = { invalidate = function() B.dirty = true end }
+
+-- Complete up to `limit` queued async reads (0 = all), as AsyncIO's
+-- result drain does at the top of each frame.
+function _bench_pump_io(limit)
+    local queue = B.io_queue
+    local n = #queue
+    if limit > 0 and limit < n then n = limit end
+    local ready = {}
+    for i = 1, n do ready[i] = table.remove(queue, 1) end
+    for _, req in ipairs(ready) do
+        local data = host.read(req.path, req.offset, req.len)
+        if data then B.bytes_read = B.bytes_read + #data end
+        local ok, err = coroutine.resume(req.co, (into(req.buf, data)))
+        if not ok then ez.log("[io] coroutine error: " .. tostring(err)) end
+    end
+    return #ready
+end
+
+local map_archive = require("services.map_archive")
+require("ezui.widgets.map_view")
+local node = require("ezui.node")
+local handler = node.handler("map_view")
+
+local bench = {}
+
+function bench.open(path, view)
+    local arc, err = map_archive.open(path)
+    if not arc then error(err) end
+    arc.on_tile_loaded = function() B.dirty = true end
+
+    local get_tile = arc.get_tile
+    arc.get_tile = function(self, z, x, y)
+        local data = get_tile(self, z, x, y)
+        B.tile_lookups = B.tile_lookups + 1
+        if data and data ~= "pending" then B.tile_hits = B.tile_hits + 1 end
+        return data
+    end
+    local parent_fb = arc.get_parent_fallback
+    arc.get_parent_fallback = function(self, z, x, y)
+        local r = { parent_fb(self, z, x, y) }
+        if r[1] then B.parent_fallbacks = B.parent_fallbacks + 1 end
+        return table.unpack(r)
+    end
+    local child_fb = arc.get_child_fallback
+    arc.get_child_fallback = function(self, z, x, y)
+        local r = child_fb(self, z, x, y)
+        if r then B.child_fallbacks = B.child_fallbacks + 1 end
+        return r
+    end
+
+    local lat, lon, zoom = view.lat, view.lon, view.zoom
+    local b = arc.header.bounds
+    if not lat and b then
+        lat = (b.north + b.south) / 2
+        lon = (b.east + b.west) / 2
+    end
+    zoom = zoom or arc.header.min_zoom
+    if zoom < arc.header.min_zoom then zoom = arc.header.min_zoom end
+    if zoom > arc.header.max_zoom then zoom = arc.header.max_zoom end
+
+    bench.arc = arc
+    bench.view = {
+        type = "map_view", archive = arc,
+        center_lat = lat or 0, center_lon = lon or 0, zoom = zoom,
+        show_labels = true,
+    }
+    return arc.header.tile_count, arc.header.min_zoom, arc.header.max_zoom
+end
+
+-- Mirrors screens/tools/map.lua:handle_key for zoom/labels; arrows go to
+-- the widget's own on_key like ezui.focus routes them.
+function bench.key(k)
+    local n, arc = bench.view, bench.arc
+    if k == "+" or k == "-" then
+        local z = n.zoom + (k == "+" and 1 or -1)
+        if z < arc.header.min_zoom then z = arc.header.min_zoom end
+        if z > arc.header.max_zoom then z = arc.header.max_zoom end
+        if z ~= n.zoom then
+            arc:invalidate_missing()
+            n.zoom = z
+        end
+    elseif k == "L" then
+        n.show_labels = not (n.show_labels ~= false)
+    else
+        handler.on_key(n, { special = k })
+    end
+    B.dirty = true
+end
+
+function bench.draw(x, y, w, h)
+    B.dirty = false
+    node.draw(bench.view, ez.display, x, y, w, h)
+end
+
+return bench
+"""
+
+FRAME_FIELDS = [
+    "frame", "t_ms", "drawn", "io_completed", "sync_reads", "async_reads",
+    "bytes_read", "inflates", "bytes_inflated", "tile_lookups", "tile_hits",
+    "parent_fallbacks", "child_fallbacks", "draw_calls", "pixels_blitted",
+]
+COUNTERS = FRAME_FIELDS[4:]
+
+
+class HostFS:
+    """Backs ez.storage reads with one host file, whatever path Lua asks for.
+
+    Archives are opened by their device path (/sd/maps/...); mapping every
+    path to the one archive under test keeps traces portable between hosts.
+    """
+
+    def __init__(self, path: Path):
+        self.path = path
+        self._f = open(path, "rb")
+        self.size = path.stat().st_size
+
+    def read(self, _path, offset, length):
+        if offset < 0 or length <= 0 or offset >= self.size:
+            return None
+        self._f.seek(offset)
+        return self._f.read(length)
+
+    def file_size(self, _path):
+        return self.size
+
+    def close(self):
+        self._f.close()
+
+
+def inflate(data: bytes, max_out: int) -> Optional[bytes]:
+    try:
+        d = zlib.decompressobj()
+        out = d.decompress(data, max_out)
+        return out or None
+    except zlib.error:
+        return None
+
+
+def parse_trace(path: Path) -> Tuple[Dict, List[Tuple[int, str]]]:
+    view: Dict = {}
+    events: List[Tuple[int, str]] = []
+    for lineno, raw in enumerate(path.read_text().splitlines(), 1):
+        line = raw.split("#", 1)[0].strip()
+        if not line:
+            continue
+        parts = line.split()
+        if parts[0] == "@":
+            if len(parts) != 4:
+                raise ValueError(f"{path}:{lineno}: expected '@ lat lon zoom'")
+            view = {"lat": float(parts[1]), "lon": float(parts[2]), "zoom": int(parts[3])}
+            continue
+        if len(parts) != 2:
+            raise ValueError(f"{path}:{lineno}: expected '<t_ms> <key>'")
+        key = parts[1].upper() if parts[1].isalpha() else parts[1]
+        if key not in ("UP", "DOWN", "LEFT", "RIGHT", "+", "-", "L"):
+            raise ValueError(f"{path}:{lineno}: unknown key {parts[1]!r}")
+        events.append((int(parts[0]), key))
+    events.sort(key=lambda e: e[0])
+    return view, events
+
+
+def run_replay(archive: Path, trace: Path, io_per_frame: int = 0,
+               quiet: bool = False) -> List[Dict[str, int]]:
+    """Replay `trace` against `archive`; returns one stats dict per frame."""
+    from lupa import lua54
+
+    fs = HostFS(archive)
+    lua = lua54.LuaRuntime(encoding=None)
+
+    class Host:
+        @staticmethod
+        def read(path, offset, length):
+            return fs.read(path, offset, length)
+
+        @staticmethod
+        def file_size(path):
+            return fs.file_size(path)
+
+        @staticmethod
+        def inflate(data, max_out):
+            return inflate(data, max_out)
+
+        @staticmethod
+        def log(msg):
+            if not quiet:
+                print(msg.decode("utf-8", "replace") if isinstance(msg, bytes) else msg,
+                      file=sys.stderr)
+
+    view, events = parse_trace(trace)
+    bench = lua.execute(LUA_PRELUDE, str(LUA_ROOT).encode(), Host)
+    B = lua.globals()._bench
+    pump_io = lua.globals()._bench_pump_io
+
+    lua_view = lua.table_from({k.encode(): v for k, v in view.items()})
+    bench.open(str(archive).encode(), lua_view)
+
+    def snapshot() -> Dict[str, int]:
+        s = {k: int(B[k.encode()]) for k in COUNTERS}
+        for k in COUNTERS:
+            B[k.encode()] = 0
+        return s
+
+    snapshot()  # Drop open()'s header/index/label reads from frame 0
+    frames: List[Dict[str, int]] = []
+    ev = 0
+    t = 0
+    last_event_t = events[-1][0] if events else 0
+    settle_left = SETTLE_FRAMES
+    frame = 0
+    while True:
+        B[b"now"] = t
+        io_done = pump_io(io_per_frame)
+        while ev < len(events) and events[ev][0] <= t:
+            bench.key(events[ev][1].encode())
+            ev += 1
+        drawn = bool(B[b"dirty"])
+        if drawn:
+            bench.draw(VIEW_X, VIEW_Y, VIEW_W, VIEW_H)
+        row = {"frame": frame, "t_ms": t, "drawn": int(drawn), "io_completed": int(io_done)}
+        row.update(snapshot())
+        frames.append(row)
+
+        frame += 1
+        t += FRAME_MS
+        if t > last_event_t:
+            idle = len(B[b"io_queue"]) == 0 and not B[b"dirty"]
+            settle_left -= 1
+            if idle or settle_left <= 0:
+                break
+
+    fs.close()
+    return frames
+
+
+def summarize(frames: List[Dict[str, int]]) -> Dict[str, float]:
+    drawn = [f for f in frames if f["drawn"]]
+    tot = {k: sum(f[k] for f in frames) for k in COUNTERS}
+    calls = sorted(f["draw_calls"] for f in drawn) or [0]
+
+    def pct(p):
+        return calls[min(len(calls) - 1, int(round(p / 100 * (len(calls) - 1))))]
+
+    return {
+        "frames": len(frames),
+        "frames_drawn": len(drawn),
+        "tile_reads": tot["sync_reads"] + tot["async_reads"],
+        "bytes_read": tot["bytes_read"],
+        "tiles_inflated": tot["inflates"],
+        "bytes_inflated": tot["bytes_inflated"],
+        "cache_hit_rate": (tot["tile_hits"] / tot["tile_lookups"]) if tot["tile_lookups"] else 0.0,
+        "parent_fallbacks": tot["parent_fallbacks"],
+        "child_fallbacks": tot["child_fallbacks"],
+        "draw_calls_per_frame_avg": (sum(calls) / len(drawn)) if drawn else 0.0,
+        "draw_calls_per_frame_p95": pct(95),
+        "draw_calls_per_frame_max": calls[-1],
+        "pixels_per_frame_avg": (sum(f["pixels_blitted"] for f in drawn) / len(drawn)) if drawn else 0.0,
+    }
+
+
+def main() -> int:
+    p = argparse.ArgumentParser(description="Replay a pan/zoom trace against a TDMAP archive.")
+    p.add_argument("archive", type=Path, help="TDMAP v6 archive")
+    p.add_argument("trace", type=Path, help="Input trace (see module docstring)")
+    p.add_argument("--csv", type=Path, help="Write per-frame counters to this CSV")
+    p.add_argument("--io-per-frame", type=int, default=0,
+                   help="Async reads completed per frame (0 = all queued; "
+                        "lower values model a slow SD card)")
+    p.add_argument("-q", "--quiet", action="store_true", help="Suppress Lua log output")
+    args = p.parse_args()
+
+    frames = run_replay(args.archive, args.trace, args.io_per_frame, args.quiet)
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            w = csv.DictWriter(f, fieldnames=FRAME_FIELDS)
+            w.writeheader()
+            w.writerows(frames)
+
+    s = summarize(frames)
+    print(f"Replay: {args.trace.name} on {args.archive.name}")
+    print(f"  frames               {s['frames']} ({s['frames_drawn']} drawn)")
+    print(f"  tile reads           {s['tile_reads']}")
+    print(f"  bytes read           {s['bytes_read']:,}")
+    print(f"  tiles inflated       {s['tiles_inflated']}")
+    print(f"  bytes inflated       {s['bytes_inflated']:,}")
+    print(f"  cache hit rate       {s['cache_hit_rate'] * 100:.1f}%")
+    print(f"  fallbacks            {s['parent_fallbacks']} parent, {s['child_fallbacks']} child")
+    print(f"  draw calls / frame   avg {s['draw_calls_per_frame_avg']:.1f}, "
+          f"p95 {s['draw_calls_per_frame_p95']}, max {s['draw_calls_per_frame_max']}")
+    print(f"  pixels / frame       avg {s['pixels_per_frame_avg']:,.0f}")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -18,6 +18,8 @@ Usage:
     python ez_remote.py /dev/ttyACM0 --monitor          # Monitor serial output
     python ez_remote.py /dev/ttyACM0 -e "1+1"           # Execute Lua expression
     python ez_remote.py /dev/ttyACM0 -e "Debug.memory()" # Call debug function
+    python ez_remote.py /dev/ttyACM0 --profile 10       # Sample Lua for 10 s
+    python ez_remote.py /dev/ttyACM0 --trace 5          # Record a 5 s timeline
 """
 
 import serial
@@ -375,6 +377,67 @@ class EzRemote:
 
         return json.loads(data.decode('utf-8'))
 
+    def profile(self, seconds, hz=1000):
+        """
+        Run the on-device sampling profiler for a while.
+
+        Samples are reset first; the profiler is stopped again even if the
+        wait is interrupted.
+
+        Args:
+            seconds: How long to sample
+            hz: Sampling rate
+
+        Returns:
+            Tuple (folded, stats): folded-stack text for flamegraph.pl or
+            speedscope, and the ez.profiler.get_stats() table.
+        """
+        import time
+        ok = self.lua_exec(f"ez.profiler.reset() return ez.profiler.start({int(hz)})")
+        if not ok:
+            raise RuntimeError("Profiler already running or out of PSRAM")
+        try:
+            time.sleep(seconds)
+        finally:
+            self.lua_exec("ez.profiler.stop()")
+        stats = self.lua_exec("ez.profiler.get_stats()")
+        folded = self.lua_exec("ez.profiler.dump()") or ""
+        return folded, stats
+
+    def trace(self, seconds):
+        """
+        Record an ez.trace timeline for a while.
+
+        Events are cleared first; recording is stopped again even if the
+        wait is interrupted. The JSON is pulled in slices that fit a single
+        lua_exec response.
+
+        Args:
+            seconds: How long to record
+
+        Returns:
+            Tuple (json_text, stats): Chrome trace-event JSON for
+            ui.perfetto.dev or chrome://tracing, and ez.trace.get_stats().
+        """
+        import time
+        if not self.lua_exec("ez.trace.clear() return ez.trace.start()"):
+            raise RuntimeError("Tracing compiled out or out of PSRAM")
+        try:
+            time.sleep(seconds)
+        finally:
+            self.lua_exec("ez.trace.stop()")
+        stats = self.lua_exec("ez.trace.get_stats()")
+        total = self.lua_exec("_trace_dump = ez.trace.dump() return #(_trace_dump or '')")
+        parts = []
+        try:
+            # Escaped, a slice stays under the device's 4 KiB result buffer
+            step = 2048
+            for off in range(1, total + 1, step):
+                parts.append(self.lua_exec(f"return _trace_dump:sub({off}, {off + step - 1})"))
+        finally:
+            self.lua_exec("_trace_dump = nil")
+        return "".join(parts), stats
+
 
 def main():
     parser = argparse.ArgumentParser(
@@ -395,6 +458,8 @@ Examples:
   %(prog)s /dev/ttyACM0 -e "1+1"           Execute Lua and print result
   %(prog)s /dev/ttyACM0 -e "Debug.memory()"  Call debug function
   %(prog)s /dev/ttyACM0 -f script.lua      Execute Lua file
+  %(prog)s /dev/ttyACM0 --profile 10       Profile Lua for 10 s -> profile.folded
+  %(prog)s /dev/ttyACM0 --trace 5          Record a 5 s timeline -> trace.json
         """
     )
 
@@ -433,6 +498,16 @@ Examples:
                         help='Poll a Lua expression every second (default: rx count)')
     parser.add_argument('--reload', metavar='FILE', nargs='+',
                         help='Hot-reload Lua file(s) on device (e.g., lua/screens/settings.lua)')
+    parser.add_argument('--profile', metavar='SECONDS', type=float,
+                        help='Sample the Lua VM for SECONDS and save folded stacks')
+    parser.add_argument('--profile-out', metavar='FILE', default='profile.folded',
+                        help='Output file for --profile (default: profile.folded)')
+    parser.add_argument('--profile-hz', metavar='HZ', type=int, default=1000,
+                        help='Sampling rate for --profile (default: 1000)')
+    parser.add_argument('--trace', metavar='SECONDS', type=float,
+                        help='Record an ez.trace timeline for SECONDS and save Chrome trace JSON')
+    parser.add_argument('--trace-out', metavar='FILE', default='trace.json',
+                        help='Output file for --trace (default: trace.json)')
     parser.add_argument('--monitor', action='store_true',
                         help='Monitor serial output (Ctrl+C to stop)')
     parser.add_argument('--raw', action='store_true',
@@ -599,6 +674,36 @@ Examples:
             except KeyboardInterrupt:
                 print("\nStopped.")
 
+        elif args.profile is not None:
+            print(f"Profiling for {args.profile:g} s at {args.profile_hz} Hz...")
+            folded, stats = remote.profile(args.profile, args.profile_hz)
+            with open(args.profile_out, 'w') as f:
+                f.write(folded)
+            print(f"Saved: {args.profile_out} ({stats.get('stacks', 0)} stacks, "
+                  f"{stats.get('frames', 0)} frames)")
+            print(f"  Samples:  {stats.get('samples', 0)} "
+                  f"({stats.get('outside', 0)} outside Lua)")
+            print(f"  Overhead: {stats.get('overhead_pct', 0):.2f}%")
+            dropped = stats.get('dropped_samples', 0) + stats.get('dropped_frames', 0)
+            if dropped:
+                print(f"  Dropped:  {stats.get('dropped_samples', 0)} samples, "
+                      f"{stats.get('dropped_frames', 0)} frames (tables full)")
+            print(f"View with: flamegraph.pl {args.profile_out} > profile.svg, "
+                  "or open in https://www.speedscope.app")
+
+        elif args.trace is not None:
+            print(f"Tracing for {args.trace:g} s...")
+            text, stats = remote.trace(args.trace)
+            with open(args.trace_out, 'w') as f:
+                f.write(text)
+            recorded = stats.get('recorded', 0)
+            capacity = stats.get('capacity', 0)
+            print(f"Saved: {args.trace_out} ({min(recorded, capacity)} events, "
+                  f"{stats.get('threads', 0)} tasks)")
+            if recorded > capacity:
+                print(f"  Ring wrapped: oldest {recorded - capacity} events overwritten")
+            print("View with: https://ui.perfetto.dev or chrome://tracing")
+
         elif args.monitor:
             # Simple serial monitor mode - just read and print serial output
             print("Monitoring serial output (Ctrl+C to stop)...")
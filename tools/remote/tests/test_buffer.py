@@ -0,0 +1,189 @@
+"""
+ez.buffer — PSRAM byte buffers and the binary APIs that take or fill them.
+
+Buffers created here are chunk locals; the collector frees their PSRAM
+blocks, so nothing needs explicit teardown beyond the test directory.
+"""
+
+from __future__ import annotations
+
+import os
+import time
+import zlib
+
+import pytest
+
+TEST_DIR  = "/fs/test_buffer"
+TEST_FILE = "/fs/test_buffer/data.bin"
+
+# An endpoint that echoes the request body back (e.g. https://httpbin.org/post);
+# without one the HTTP body test only checks the request goes out
+ECHO_URL = os.environ.get("EZ_TEST_HTTP_ECHO_URL")
+HTTP_URL = ECHO_URL or os.environ.get("EZ_TEST_HTTP_URL", "http://example.com/")
+
+
+@pytest.fixture
+def test_file(device):
+    device.lua_exec(f"""
+        ez.storage.mkdir('{TEST_DIR}')
+        ez.storage.write_file('{TEST_FILE}', 'abcdefghijklmnopqrstuvwxyz')
+    """)
+    yield TEST_FILE
+    device.lua_exec(f"""
+        ez.storage.remove('{TEST_FILE}')
+        ez.storage.rmdir('{TEST_DIR}')
+    """)
+
+
+def test_namespace(device):
+    assert device.lua_exec("return type(ez.buffer)") == "table"
+    assert device.lua_exec("return ez.buffer.is_buffer(ez.buffer.new(1))") is True
+    assert device.lua_exec("return ez.buffer.is_buffer('x')") is False
+
+
+def test_new_and_access(device):
+    out = device.lua_exec("""
+        local b = ez.buffer.new(4)
+        b:set(1, 65, 66)
+        b:fill(67, 3)
+        return { #b, b:tostring(), b:byte(2), b:tostring(-2) }
+    """)
+    assert out == [4, "ABCC", 66, "CC"]
+
+
+def test_copy_from_string(device):
+    assert device.lua_exec("return ez.buffer.new('hello'):tostring()") == "hello"
+
+
+def test_resize_and_append(device):
+    out = device.lua_exec("""
+        local b = ez.buffer.new('ab')
+        b:append('cd')
+        b:resize(6)
+        local zeros = b:byte(5) + b:byte(6)
+        b:resize(3)
+        return { b:tostring(), zeros }
+    """)
+    assert out == ["abc", 0]
+
+
+def test_slice_is_a_view(device):
+    out = device.lua_exec("""
+        local b = ez.buffer.new('0123456789')
+        local v = b:slice(3, 5)
+        v:set(1, 88)
+        local before = #v
+        b:resize(3)
+        return { b:tostring(), before, #v, v:tostring() }
+    """)
+    # The write shows through; shrinking the owner clamps the view.
+    assert out == ["01X", 3, 1, "X"]
+
+
+def test_view_cannot_resize(device):
+    with pytest.raises(RuntimeError, match="view"):
+        device.lua_exec("ez.buffer.new(4):slice(1, 2):resize(8)")
+
+
+def test_write_grows_owner(device):
+    out = device.lua_exec("""
+        local b = ez.buffer.new(0)
+        local at = b:write(1, 'abc')
+        at = b:write(at, b)
+        return { b:tostring(), at }
+    """)
+    assert out == ["abcabc", 7]
+
+
+def test_release(device):
+    out = device.lua_exec("""
+        local before = ez.buffer.stats().bytes
+        local b = ez.buffer.new(65536)
+        local during = ez.buffer.stats().bytes
+        b:release()
+        return { during - before, ez.buffer.stats().bytes - before }
+    """)
+    assert out[0] >= 65536
+    # Other garbage may be collected meanwhile, so only bound from above
+    assert out[1] <= 0
+
+
+def test_crypto_accepts_buffer(device):
+    out = device.lua_exec("""
+        local s = 'the quick brown fox'
+        return ez.crypto.sha256(ez.buffer.new(s)) == ez.crypto.sha256(s)
+    """)
+    assert out is True
+
+
+def test_inflate_into_buffer(device):
+    raw = b"tile bytes " * 64
+    compressed = zlib.compress(raw, level=9)
+    out = device.lua_exec(f"""
+        local data = ez.buffer.new(ez.crypto.hex_to_bytes('{compressed.hex()}'))
+        local out = ez.buffer.new(0)
+        local r, n = ez.compression.inflate(data, {len(raw)}, false, out)
+        return {{ r == out, n, #out, out:tostring(1, 11) }}
+    """)
+    assert out == [True, len(raw), len(raw), "tile bytes "]
+
+
+def test_read_bytes_into_buffer(device, test_file):
+    out = device.lua_exec(f"""
+        local b = ez.buffer.new(0)
+        local r, n = ez.storage.read_bytes('{test_file}', 2, 5, b)
+        return {{ r == b, n, b:tostring() }}
+    """)
+    assert out == [True, 5, "cdefg"]
+
+
+def _spawn_result(device, body, timeout=2.0):
+    """Run `body` (which sets _G._test_buf_result) in a coroutine and poll."""
+    device.lua_exec(f"""
+        _G._test_buf_result = nil
+        spawn(function() {body} end)
+    """)
+    deadline = time.time() + timeout
+    result = None
+    while time.time() < deadline:
+        result = device.lua_exec("return _G._test_buf_result")
+        if result is not None:
+            break
+        time.sleep(0.1)
+    device.lua_exec("_G._test_buf_result = nil")
+    return result
+
+
+def test_async_read_bytes_into_buffer(device, test_file):
+    result = _spawn_result(device, f"""
+        local b = ez.buffer.new(0)
+        local r = ez.storage.async_read_bytes('{test_file}', 10, 4, b)
+        _G._test_buf_result = r == b and b:tostring() or false
+    """)
+    assert result == "klmn"
+
+
+def test_http_rejects_non_bytes_body(device):
+    # Raised before anything is queued, so no network is needed
+    result = _spawn_result(device, f"""
+        local ok, err = pcall(ez.http.fetch, '{HTTP_URL}', {{ method = 'POST', body = {{}} }})
+        _G._test_buf_result = {{ ok, tostring(err) }}
+    """)
+    assert result[0] is False
+    assert "string or ez.buffer" in result[1]
+
+
+@pytest.mark.network
+def test_http_buffer_body(device):
+    result = _spawn_result(device, f"""
+        local body = ez.buffer.new('buffer-body-1234')
+        local a = ez.http.fetch('{HTTP_URL}', {{ method = 'POST', body = body }})
+        local b = ez.http.post('{HTTP_URL}', body:slice(1, 11), 'text/plain')
+        _G._test_buf_result = {{ a and a.ok or false, a and a.body or '',
+                                 b and b.ok or false, b and b.body or '' }}
+    """, timeout=30.0)
+    if result is None or not (result[0] and result[2]):
+        pytest.skip("HTTP request failed -- likely no network")
+    if ECHO_URL:
+        assert "buffer-body-1234" in result[1]
+        assert "buffer-body" in result[3] and "buffer-body-" not in result[3]
@@ -69,3 +69,63 @@ def test_unsubscribe_unknown_id_returns_false(device):
     """Unsubscribing a never-registered id must not crash and should report failure."""
     out = device.lua_exec("return ez.bus.unsubscribe(999999999)")
     assert out is False or out is None
+
+
+def test_post_returns_true_when_queued(device):
+    assert device.lua_exec("return ez.bus.post('test/no_listener', 'x')") is True
+
+
+def test_wildcard_subscriptions(device):
+    """
+    '+' matches one segment, '#' any remaining segments (including none).
+    Each subscriber records the topics it saw.
+    """
+    setup = """
+        _G._test_bus_wild = { plus = {}, hash = {}, exact = {} }
+        local s = _G._test_bus_wild
+        return {
+            ez.bus.subscribe('test/wild/+/rx', function(t) s.plus[#s.plus + 1] = t end),
+            ez.bus.subscribe('test/wild/#', function(t) s.hash[#s.hash + 1] = t end),
+            ez.bus.subscribe('test/wild/a/rx', function(t) s.exact[#s.exact + 1] = t end),
+        }
+    """
+    ids = device.lua_exec(setup)
+    try:
+        device.lua_exec("""
+            ez.bus.post('test/wild/a/rx', '1')
+            ez.bus.post('test/wild/b/rx', '2')
+            ez.bus.post('test/wild/a/tx', '3')
+            ez.bus.post('test/wild', '4')
+            ez.bus.post('test/other', '5')
+        """)
+        time.sleep(0.3)
+        state = device.lua_exec("return _G._test_bus_wild")
+        assert state["plus"] == ["test/wild/a/rx", "test/wild/b/rx"]
+        assert state["hash"] == [
+            "test/wild/a/rx", "test/wild/b/rx", "test/wild/a/tx", "test/wild",
+        ]
+        assert state["exact"] == ["test/wild/a/rx"]
+        assert device.lua_exec("return ez.bus.has_subscribers('test/wild/z/rx')") is True
+    finally:
+        for sub_id in ids:
+            device.lua_exec(f"ez.bus.unsubscribe({sub_id!r})")
+        device.lua_exec("_G._test_bus_wild = nil")
+
+
+def test_invalid_pattern_raises(device):
+    ok = device.lua_exec(
+        "local ok = pcall(ez.bus.subscribe, 'test/#/x', function() end); return ok"
+    )
+    assert ok is False
+
+
+def test_get_stats_counts_posts(device):
+    before = device.lua_exec("return ez.bus.get_stats()")
+    assert before["capacity"] >= 1
+    device.lua_exec("ez.bus.post('test/stats', 'x')")
+    time.sleep(0.3)
+    after = device.lua_exec("return ez.bus.get_stats()")
+    assert after["posted"] >= before["posted"] + 1
+    assert after["delivered"] >= before["delivered"] + 1
+    assert after["high_water"] >= 1
+    assert isinstance(after["dropped_by_topic"], (dict, list))
@@ -0,0 +1,129 @@
+"""
+ez.messages bindings — the append-only message history store.
+
+Tests use the store the services opened (via services.message_store) and
+a conversation key of their own, ez_test:*, which is cleared before and
+after every test so user history is never touched.
+"""
+
+from __future__ import annotations
+
+import pytest
+
+CONV = "ez_test:messages"
+
+
+@pytest.fixture(autouse=True)
+def messages(device):
+    assert device.lua_exec("return require('services.message_store').open()") is True
+    device.lua_exec(f"ez.messages.clear('{CONV}')")
+    yield device
+    device.lua_exec(f"ez.messages.clear('{CONV}')")
+
+
+def test_namespace(device):
+    stats = device.lua_exec("return ez.messages.get_stats()")
+    assert stats["open"] is True
+    assert stats["dir"] in ("/sd/messages", "/fs/messages")
+
+
+def test_append_and_fetch_pages(device):
+    result = device.lua_exec(f"""
+        local ids = {{}}
+        for i = 1, 25 do
+            ids[i] = ez.messages.append('{CONV}', {{ text = 'm' .. i, n = i }})
+        end
+        local newest, more = ez.messages.fetch('{CONV}', nil, 10)
+        local older, more2 = ez.messages.fetch('{CONV}', newest[1].id, 10)
+        local oldest, more3 = ez.messages.fetch('{CONV}', older[1].id, 10)
+        return {{
+            count = ez.messages.count('{CONV}'),
+            first = newest[1].text, last = newest[#newest].text, more = more,
+            older_first = older[1].n, more2 = more2,
+            oldest_n = #oldest, oldest_first = oldest[1].text, more3 = more3,
+            ids_ascending = ids[1] < ids[25],
+        }}
+    """)
+    assert result["count"] == 25
+    assert result["first"] == "m16" and result["last"] == "m25"
+    assert result["more"] is True
+    assert result["older_first"] == 6 and result["more2"] is True
+    assert result["oldest_n"] == 5 and result["oldest_first"] == "m1"
+    assert result["more3"] is False
+    assert result["ids_ascending"] is True
+
+
+def test_update_and_delete(device):
+    result = device.lua_exec(f"""
+        local a = ez.messages.append('{CONV}', {{ text = 'a', status = 'pending' }})
+        local b = ez.messages.append('{CONV}', {{ text = 'b' }})
+        ez.messages.update('{CONV}', a, {{ text = 'a', status = 'delivered' }})
+        local deleted = ez.messages.delete('{CONV}', b)
+        local unknown = ez.messages.update('{CONV}', b, {{ text = 'b' }})
+        local page = ez.messages.fetch('{CONV}')
+        return {{
+            n = #page, status = page[1].status, id = page[1].id == a,
+            deleted = deleted, unknown = unknown == nil,
+        }}
+    """)
+    assert result == {"n": 1, "status": "delivered", "id": True,
+                      "deleted": True, "unknown": True}
+
+
+def test_clear_removes_conversation(device):
+    result = device.lua_exec(f"""
+        ez.messages.append('{CONV}', {{ text = 'x' }})
+        local listed = ez.messages.conversations()['{CONV}'] ~= nil
+        ez.messages.clear('{CONV}')
+        return {{ listed = listed, after = ez.messages.count('{CONV}'),
+                  gone = ez.messages.conversations()['{CONV}'] == nil }}
+    """)
+    assert result == {"listed": True, "after": 0, "gone": True}
+
+
+def test_reopen_replays_history(device):
+    # Reopening the same directory is a no-op, so bounce through another
+    result = device.lua_exec(f"""
+        local dir = ez.messages.get_stats().dir
+        local id = ez.messages.append('{CONV}', {{ text = 'persist' }})
+        ez.messages.open('/fs/ez_test_messages')
+        local elsewhere = ez.messages.count('{CONV}')
+        ez.messages.open(dir)
+        ez.storage.rmdir('/fs/ez_test_messages')
+        local page = ez.messages.fetch('{CONV}')
+        return {{ elsewhere = elsewhere, text = page[1] and page[1].text,
+                  same_id = page[1] and page[1].id == id }}
+    """)
+    assert result == {"elsewhere": 0, "text": "persist", "same_id": True}
+
+
+def test_search_finds_prefixes_newest_first(device):
+    result = device.lua_exec(f"""
+        local a = ez.messages.append('{CONV}', {{ text = 'Zqxtest antenna tuning' }})
+        local b = ez.messages.append('{CONV}', {{ text = 'zqxtest ANTENNAS arrived' }})
+        local c = ez.messages.append('{CONV}', {{ text = 'zqxtest unrelated' }})
+        local hits = ez.messages.search('ZQXTEST ant', 10)
+        ez.messages.delete('{CONV}', b)
+        local after = ez.messages.search('zqxtest ant', 10)
+        return {{
+            n = #hits, first = hits[1] and hits[1].id == b, second = hits[2] and hits[2].id == a,
+            conv = hits[1] and hits[1].conv, text = hits[2] and hits[2].text,
+            after = #after, after_first = after[1] and after[1].id == a,
+            short = #ez.messages.search('a', 10),
+        }}
+    """)
+    assert result == {"n": 2, "first": True, "second": True, "conv": CONV,
+                      "text": "Zqxtest antenna tuning", "after": 1,
+                      "after_first": True, "short": 0}
+
+
+def test_search_survives_flush(device):
+    result = device.lua_exec(f"""
+        local id = ez.messages.append('{CONV}', {{ text = 'zqxflush persisted' }})
+        ez.messages.compact()
+        local s = ez.messages.get_stats()
+        local hits = ez.messages.search('zqxflush', 5)
+        return {{ pending = s.search_pending, segments = s.search_segments > 0,
+                  found = hits[1] and hits[1].id == id }}
+    """)
+    assert result == {"pending": 0, "segments": True, "found": True}
@@ -0,0 +1,161 @@
+"""
+ez.profiler bindings — sampling profiler and folded-stack export.
+
+Each test leaves the profiler stopped and its tables freed so a failure
+doesn't keep the count hook installed for the rest of the session.
+"""
+
+from __future__ import annotations
+
+import re
+import time
+
+import pytest
+
+
+@pytest.fixture
+def profiler(device):
+    device.lua_exec("ez.profiler.stop(); ez.profiler.reset()")
+    yield device
+    device.lua_exec("ez.profiler.stop(); ez.profiler.reset()")
+
+
+BUSY_LOOP = """
+    local function inner(n)
+        local x = 0
+        for i = 1, n do x = x + (i % 7) end
+        return x
+    end
+    function _G._prof_busy(ms)
+        local t0 = ez.system.millis()
+        while ez.system.millis() - t0 < ms do inner(2000) end
+    end
+    function _G._prof_work(rounds)
+        local t0 = ez.system.micros()
+        for _ = 1, rounds do inner(2000) end
+        return ez.system.micros() - t0
+    end
+"""
+
+
+def test_namespace(device):
+    assert device.lua_exec("return type(ez.profiler)") == "table"
+    assert device.lua_exec("return ez.profiler.is_running()") is False
+
+
+def test_start_stop(profiler):
+    assert profiler.lua_exec("return ez.profiler.start(500)") is True
+    assert profiler.lua_exec("return ez.profiler.is_running()") is True
+    # A second start while running is refused
+    assert profiler.lua_exec("return ez.profiler.start()") is False
+    profiler.lua_exec("ez.profiler.stop()")
+    assert profiler.lua_exec("return ez.profiler.is_running()") is False
+
+
+def test_samples_busy_loop(profiler):
+    profiler.lua_exec(BUSY_LOOP)
+    try:
+        stats = profiler.lua_exec("""
+            ez.profiler.start(1000)
+            _prof_busy(300)
+            ez.profiler.stop()
+            return ez.profiler.get_stats()
+        """)
+    finally:
+        profiler.lua_exec("_G._prof_busy = nil")
+    assert stats["running"] is False
+    assert stats["hz"] == 1000
+    # ~300 ticks of Lua; allow for timer jitter and hook granularity
+    assert stats["samples"] - stats["outside"] >= 150
+    assert stats["stacks"] >= 1 and stats["frames"] >= 2
+    assert stats["dropped_samples"] == 0
+    assert stats["overhead_pct"] < 5
+
+
+def test_overhead_wall_clock(profiler):
+    # The same fixed work with the profiler off and on at 1 kHz; this
+    # includes the count hook, which overhead_pct leaves out. Alternate the
+    # runs and keep the fastest of each to ride out interrupts.
+    profiler.lua_exec(BUSY_LOOP)
+    try:
+        off, on = profiler.lua_exec("""
+            local off, on = math.huge, math.huge
+            for _ = 1, 3 do
+                off = math.min(off, _prof_work(400))
+                ez.profiler.start(1000)
+                on = math.min(on, _prof_work(400))
+                ez.profiler.stop()
+            end
+            return { off, on }
+        """)
+    finally:
+        profiler.lua_exec("_G._prof_busy = nil; _G._prof_work = nil")
+    assert off > 50000, "work too short to time"
+    overhead_pct = 100.0 * (on - off) / off
+    assert overhead_pct < 5, f"{overhead_pct:.1f}% ({off} us off, {on} us on)"
+
+
+def test_samples_task_spawned_before_start(profiler):
+    # A scheduler task that already exists when profiling starts must
+    # show up under its own frames, not as "(outside lua)"
+    profiler.lua_exec(BUSY_LOOP + """
+        _G._prof_stop = false
+        spawn(function()
+            local function early_task()
+                local t0 = ez.system.millis()
+                while ez.system.millis() - t0 < 20 do _prof_work(1) end
+            end
+            while not _G._prof_stop do
+                early_task()
+                defer()
+            end
+        end)
+    """)
+    try:
+        profiler.lua_exec("ez.profiler.start(1000)")
+        time.sleep(0.5)
+        profiler.lua_exec("ez.profiler.stop()")
+        text = profiler.lua_exec("return ez.profiler.dump()")
+    finally:
+        profiler.lua_exec("_G._prof_stop = true")
+        time.sleep(0.1)
+        profiler.lua_exec("_G._prof_busy = nil; _G._prof_work = nil; _G._prof_stop = nil")
+    assert re.search(r"early_task@[^;]+:\d+", text)
+
+
+def test_dump_folded_format(profiler):
+    profiler.lua_exec(BUSY_LOOP)
+    try:
+        text = profiler.lua_exec("""
+            ez.profiler.start(1000)
+            _prof_busy(200)
+            ez.profiler.stop()
+            return ez.profiler.dump()
+        """)
+    finally:
+        profiler.lua_exec("_G._prof_busy = nil")
+    lines = [l for l in text.split("\n") if l]
+    assert lines
+    total = 0
+    for line in lines:
+        m = re.fullmatch(r"(.+) (\d+)", line)
+        assert m, line
+        total += int(m.group(2))
+    stats = profiler.lua_exec("return ez.profiler.get_stats()")
+    assert total == stats["samples"]
+    # The hot loop shows up as a named Lua frame with its definition line
+    assert any(re.search(r"inner@[^;]+:\d+", l) for l in lines)
+
+
+def test_reset_clears(profiler):
+    profiler.lua_exec("""
+        ez.profiler.start(1000)
+        local t0 = ez.system.millis()
+        while ez.system.millis() - t0 < 50 do end
+        ez.profiler.stop()
+    """)
+    assert profiler.lua_exec("return ez.profiler.get_stats().samples") > 0
+    profiler.lua_exec("ez.profiler.reset()")
+    stats = profiler.lua_exec("return ez.profiler.get_stats()")
+    assert stats["samples"] == 0 and stats["stacks"] == 0
+    assert profiler.lua_exec("return ez.profiler.dump()") == ""
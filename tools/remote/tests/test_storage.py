@@ -188,6 +188,57 @@ def test_read_bytes_with_offset(device):
     assert device.lua_exec(code) == "cdefg"
 
 
+def test_read_bytes_reuses_handle_until_write(device):
+    result = device.lua_exec(f"""
+        ez.storage.mkdir('{TEST_DIR}')
+        ez.storage.write_file('{TEST_FILE}', 'abcdefghij')
+        local before = ez.storage.get_cache_stats().handles
+        local a = ez.storage.read_bytes('{TEST_FILE}', 0, 3)
+        local b = ez.storage.read_bytes('{TEST_FILE}', 3, 3)
+        local size = ez.storage.file_size('{TEST_FILE}')
+        local mid = ez.storage.get_cache_stats().handles
+        ez.storage.write_file('{TEST_FILE}', 'XYZ')
+        local c = ez.storage.read_bytes('{TEST_FILE}', 0, 3)
+        local size2 = ez.storage.file_size('{TEST_FILE}')
+        return {{
+            a = a, b = b, c = c, size = size, size2 = size2,
+            avoided = mid.opens_avoided - before.opens_avoided,
+            invalidated = ez.storage.get_cache_stats().handles.invalidations
+                          > mid.invalidations,
+        }}
+    """)
+    assert result == {"a": "abc", "b": "def", "c": "XYZ", "size": 10, "size2": 3,
+                      "avoided": 2, "invalidated": True}
+
+
+def test_sd_block_cache_serves_rereads(device):
+    if not device.lua_exec("return ez.storage.is_sd_available()"):
+        pytest.skip("no SD card")
+    path = "/sd/ez_test_block_cache.bin"
+    # read_file opens the file each time, so the second read reaches the
+    # disk driver instead of FatFs's per-file sector buffer
+    result = device.lua_exec(f"""
+        local body = string.rep('0123456789abcdef', 64)
+        ez.storage.write_file('{path}', body)
+        ez.storage.read_file('{path}')
+        local before = ez.storage.get_cache_stats().blocks
+        local again = ez.storage.read_file('{path}')
+        local mid = ez.storage.get_cache_stats().blocks
+        ez.storage.write_file('{path}', string.rep('x', 1024))
+        local after = ez.storage.read_file('{path}')
+        ez.storage.remove('{path}')
+        return {{
+            enabled = before.enabled, same = again == body, after = after:sub(1, 4),
+            hits = mid.hits > before.hits,
+            written = ez.storage.get_cache_stats().blocks.written > mid.written,
+        }}
+    """)
+    if not result["enabled"]:
+        pytest.skip("block cache not installed")
+    assert result == {"enabled": True, "same": True, "after": "xxxx",
+                      "hits": True, "written": True}
+
+
 def test_read_bytes_rejects_invalid_args(device):
     out = device.lua_exec(f"return ez.storage.read_bytes('{TEST_FILE}', -1, 10)")
     assert isinstance(out, list) and out[0] is None
@@ -262,6 +313,78 @@ def test_async_read_bytes_round_trip(device):
     assert result == "asynctest", f"async_read_bytes returned {result!r}"
 
 
+def test_async_stats_reports_lanes(device):
+    """File reads are accounted to the interactive lane."""
+    before = device.lua_exec("return async_stats()")
+    assert set(before) >= {"interactive", "crypto", "bulk"}
+    device.lua_exec(f"""
+        ez.storage.mkdir('{TEST_DIR}')
+        ez.storage.write_file('{TEST_FILE}', 'lanes')
+        spawn(function() ez.storage.async_read_bytes('{TEST_FILE}', 0, 5) end)
+    """)
+    import time as _time
+    _time.sleep(0.3)
+    after = device.lua_exec("return async_stats()")
+    lane = after["interactive"]
+    assert lane["completed"] >= before["interactive"]["completed"] + 1
+    assert lane["depth"] >= 0 and lane["max_depth"] >= 1
+    assert lane["wait_max_us"] >= 0 and lane["run_max_us"] >= 0
+
+
+def test_async_read_bytes_batch_matches_file(device):
+    """Concurrent reads of one file may be coalesced into one batch; each
+    coroutine must still get exactly its own range."""
+    before = device.lua_exec("return async_stats().coalesce")
+    device.lua_exec(f"""
+        ez.storage.mkdir('{TEST_DIR}')
+        local parts = {{}}
+        for i = 0, 255 do parts[#parts + 1] = string.char(i) end
+        ez.storage.write_file('{TEST_FILE}', table.concat(parts))
+        _G._test_batch = {{}}
+        local ranges = {{ {{200, 40}}, {{0, 16}}, {{16, 16}}, {{8, 32}}, {{250, 20}} }}
+        for i, r in ipairs(ranges) do
+            spawn(function()
+                _G._test_batch[i] = ez.storage.async_read_bytes('{TEST_FILE}', r[1], r[2])
+            end)
+        end
+    """)
+    import time as _time
+    _time.sleep(0.5)
+    got = device.lua_exec("""
+        local out = {}
+        for i = 1, 5 do
+            local d = _G._test_batch[i]
+            out[i] = d and {d:byte(1), #d} or false
+        end
+        _G._test_batch = nil
+        return out
+    """)
+    # (first byte, length) per request; the last one is clamped at EOF.
+    assert got == [[200, 40], [0, 16], [16, 16], [8, 32], [250, 6]]
+    after = device.lua_exec("return async_stats().coalesce")
+    assert after["requests"] >= before["requests"]
+    assert after["opens_saved"] >= 0 and after["reads_saved"] >= 0
+
+
+def test_async_cancel_drops_result(device):
+    """A cancelled request never resumes its coroutine."""
+    cancelled = device.lua_exec(f"""
+        ez.storage.mkdir('{TEST_DIR}')
+        ez.storage.write_file('{TEST_FILE}', 'cancelme')
+        _G._test_async_result = nil
+        local co = spawn(function()
+            _G._test_async_result = ez.storage.async_read_bytes('{TEST_FILE}', 0, 8)
+        end)
+        return async_cancel(co)
+    """)
+    assert cancelled == 1
+    import time as _time
+    _time.sleep(0.5)
+    assert device.lua_exec("return _G._test_async_result") is None
+    stats = device.lua_exec("return async_stats()")
+    assert stats["interactive"]["cancelled"] >= 1
+
+
 # ---------------------------------------------------------------------------
 # Prefs
 # ---------------------------------------------------------------------------
@@ -308,6 +431,46 @@ def test_list_prefs_includes_set_key(device):
     assert any(PREF_KEY in s for s in flat)
 
 
+def test_pref_writes_are_batched(device):
+    # A burst of sets is one pending change; a set of the value already
+    # held is not a change at all. flush_prefs writes it and leaves
+    # nothing pending.
+    code = f"""
+        ez.storage.set_pref('{PREF_KEY}', 0)
+        ez.storage.flush_prefs()
+        local before = ez.storage.get_cache_stats().prefs
+        for i = 1, 20 do ez.storage.set_pref('{PREF_KEY}', i) end
+        ez.storage.set_pref('{PREF_KEY}', 20)
+        local pending = ez.storage.get_cache_stats().prefs
+        local ok = ez.storage.flush_prefs()
+        local after = ez.storage.get_cache_stats().prefs
+        ez.storage.remove_pref('{PREF_KEY}')
+        return {{
+            dirty = pending.dirty,
+            unchanged = pending.unchanged - before.unchanged,
+            ok = ok,
+            stored = after.stored - before.stored,
+            left = after.dirty,
+        }}
+    """
+    out = device.lua_exec(code)
+    assert out["dirty"] >= 1
+    assert out["unchanged"] == 1
+    assert out["ok"] is True
+    assert out["stored"] == 1
+    assert out["left"] == 0
+
+
+def test_float_pref_round_trip(device):
+    code = f"""
+        ez.storage.set_pref('{PREF_KEY}', 1.5)
+        local v = ez.storage.get_pref('{PREF_KEY}')
+        ez.storage.remove_pref('{PREF_KEY}')
+        return v
+    """
+    assert device.lua_exec(code) == 1.5
+
+
 def test_clear_prefs_is_callable():
     """clear_prefs would wipe user settings; we deliberately don't invoke
     it. The function table registration is exercised by test_namespace."""
@@ -337,6 +500,82 @@ def test_json_decode_rejects_garbage(device):
     assert out is None or (isinstance(out, list) and out[0] is None)
 
 
+def test_json_decode_error_has_offset(device):
+    out = device.lua_exec("return ez.storage.json_decode('[1, 2,]')")
+    assert out[0] is None
+    assert "at byte 6" in out[1]
+
+
+def test_json_types_round_trip(device):
+    out = device.lua_exec("""
+        local enc = ez.storage.json_encode({ i = 3, f = 3.0, s = 'a"\\n', e = {} })
+        local dec = ez.storage.json_decode(enc)
+        return { math.type(dec.i), math.type(dec.f), dec.s, next(dec.e) == nil }
+    """)
+    assert out == ["integer", "float", 'a"\\n', True]
+
+
+def test_json_cyclic_table_fails(device):
+    out = device.lua_exec("""
+        local t = {}; t.self = t
+        return ez.storage.json_encode(t)
+    """)
+    assert out[0] is None
+
+
+def test_json_write_file_large(device):
+    """json_write_file streams; the result is well past the old 16 KB
+    async_json_read cap and must still come back intact."""
+    device.lua_exec(f"ez.storage.mkdir('{TEST_DIR}')")
+    path = f"{TEST_DIR}/big.json"
+    out = device.lua_exec(f"""
+        local msgs = {{}}
+        for i = 1, 2000 do
+            msgs[i] = {{ text = 'message number ' .. i, timestamp = 1700000000 + i }}
+        end
+        local ok = ez.storage.json_write_file('{path}', {{ msgs = msgs }})
+        local size = ez.storage.file_size('{path}')
+        local back = ez.storage.json_decode(ez.storage.read_file('{path}'))
+        return {{ ok, size, #back.msgs, back.msgs[2000].text }}
+    """)
+    assert out[0] is True
+    assert out[1] > 16384
+    assert out[2:] == [2000, "message number 2000"]
+
+    device.lua_exec(f"""
+        _G._test_json_result = nil
+        spawn(function()
+            local t = async_json_read('{path}')
+            _G._test_json_result = t and #t.msgs or false
+        end)
+    """)
+    import time as _time
+    deadline = _time.time() + 3.0
+    result = None
+    while _time.time() < deadline:
+        result = device.lua_exec("return _G._test_json_result")
+        if result is not None:
+            break
+        _time.sleep(0.1)
+    device.lua_exec("_G._test_json_result = nil")
+    assert result == 2000
+
+
+def test_json_write_file_failure_keeps_old_file(device):
+    """A failed encode goes to <path>.tmp, which is dropped; the file that
+    was there before stays intact."""
+    device.lua_exec(f"ez.storage.mkdir('{TEST_DIR}')")
+    path = f"{TEST_DIR}/keep.json"
+    out = device.lua_exec(f"""
+        assert(ez.storage.json_write_file('{path}', {{ v = 1 }}))
+        local t = {{}}; t.self = t
+        local ok, err = ez.storage.json_write_file('{path}', t)
+        local back = ez.storage.json_decode(ez.storage.read_file('{path}'))
+        return {{ ok == nil, type(err), back.v, ez.storage.exists('{path}.tmp') }}
+    """)
+    assert out == [True, "string", 1, False]
+
+
 # ---------------------------------------------------------------------------
 # Embedded scripts
 # ---------------------------------------------------------------------------
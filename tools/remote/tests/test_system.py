@@ -142,6 +142,54 @@ def test_get_lua_memory(device):
     assert isinstance(n, (int, float)) and n > 0
 
 
+def test_heap_stats_shape(device):
+    h = device.lua_exec("return ez.system.get_heap_stats()")
+    for tag in ("display", "async", "audio", "http", "mesh", "storage"):
+        t = h[tag]
+        for key in ("live", "peak", "allocs", "frees", "failures"):
+            assert isinstance(t[key], int), (tag, key)
+        assert t["peak"] >= t["live"] >= 0
+        assert t["allocs"] >= t["frees"]
+    assert h["lua"]["live"] > 0
+    assert h["worker"]["limit"] > 0
+    assert h["free_heap"] > 0 and h["free_psram"] >= 0
+    # The framebuffer is a display allocation for the life of the device
+    assert h["display"]["live"] >= 320 * 240 * 2
+
+
+def test_heap_stats_track_sprites(device):
+    before, during, after = device.lua_exec("""
+        local function live() return ez.system.get_heap_stats().display.live end
+        local a = live()
+        local s = ez.display.create_sprite(100, 100)
+        local b = live()
+        s:destroy()
+        return { a, b, live() }
+    """)
+    assert during - before >= 100 * 100 * 2
+    assert after == before
+
+
+def test_log_stats_shape(device):
+    s = device.lua_exec("return ez.system.get_log_stats()")
+    for key in ("records", "bytes", "lost_bytes", "dropped", "pending"):
+        assert isinstance(s[key], int) and s[key] >= 0, key
+    assert s["records"] > 0 and s["bytes"] >= s["records"] * 16
+
+
+def test_log_records_are_formatted(device):
+    before, after = device.lua_exec("""
+        local a = ez.system.get_log_stats().records
+        for i = 1, 10 do ez.log("log ring test " .. i) end
+        return { a, ez.system.get_log_stats().records }
+    """)
+    assert after - before >= 10
+    # The printer task catches up within a few idle periods
+    time.sleep(0.2)
+    s = device.lua_exec("return ez.system.get_log_stats()")
+    assert s["pending"] < 1024
+
+
 def test_is_low_memory(device):
     assert isinstance(device.lua_exec("return ez.system.is_low_memory()"), bool)
 
@@ -152,6 +200,41 @@ def test_gc_runs_without_error(device):
     assert isinstance(n, int)
 
 
+# ---------------------------------------------------------------------------
+# Frame timing
+# ---------------------------------------------------------------------------
+
+
+def test_frame_stats_shape(device):
+    time.sleep(0.5)  # Let some frames land in the window
+    s = device.lua_exec("return ez.system.get_frame_stats()")
+    assert s["frames"] > 0 and s["window"] > 0
+    assert s["fps"] > 0
+    f = s["frame"]
+    assert 0 < f["p50"] <= f["p95"] <= f["p99"] <= f["max"]
+    for name in ("remote", "timers", "bus", "lua", "input", "logic",
+                 "render", "flush", "gc", "idle", "other"):
+        p = s["phases"][name]
+        assert p["count"] == f["count"]
+        assert p["p50"] <= p["p95"] <= p["p99"] <= p["max"]
+        assert p["max"] <= f["max"]
+    assert s["busy"]["max"] <= f["max"]
+
+
+def test_frame_stats_reset(device):
+    device.lua_exec("ez.system.get_frame_stats(true)")
+    s = device.lua_exec("return ez.system.get_frame_stats()")
+    # Only frames since the reset (a handful at most)
+    assert s["window"] < 64
+
+
+def test_frame_mark_rejects_unknown_phase(device):
+    with pytest.raises(RuntimeError):
+        device.lua_exec('ez.system.frame_mark("bogus")')
+    # Outside main_loop a valid mark is ignored, not an error
+    device.lua_exec('ez.system.frame_mark("render")')
+
+
 # ---------------------------------------------------------------------------
 # Hardware identity
 # ---------------------------------------------------------------------------
@@ -288,11 +371,421 @@ def test_set_interval_fires_repeatedly_then_cancel(device):
         device.lua_exec("_G._test_interval_count = nil")
 
 
+def test_timers_fire_in_deadline_order(device):
+    """Timers fire by deadline, and equal deadlines keep scheduling order."""
+    code = """
+        _G._test_timer_order = {}
+        local function mark(tag)
+            return function() table.insert(_G._test_timer_order, tag) end
+        end
+        ez.system.set_timer(120, mark("c"))
+        ez.system.set_timer(40, mark("a1"))
+        ez.system.set_timer(40, mark("a2"))
+        ez.system.set_timer(80, mark("b"))
+    """
+    device.lua_exec(code)
+    try:
+        time.sleep(0.4)
+        order = device.lua_exec("return table.concat(_G._test_timer_order, ',')")
+        assert order == "a1,a2,b,c"
+    finally:
+        device.lua_exec("_G._test_timer_order = nil")
+
+
+def test_more_than_sixteen_timers(device):
+    """The timer pool grows on demand; the old fixed 16-slot limit is gone."""
+    code = """
+        _G._test_many_timers = 0
+        for i = 1, 64 do
+            ez.system.set_timer(20 + i, function()
+                _G._test_many_timers = _G._test_many_timers + 1
+            end)
+        end
+    """
+    device.lua_exec(code)
+    try:
+        time.sleep(0.4)
+        assert device.lua_exec("return _G._test_many_timers") == 64
+    finally:
+        device.lua_exec("_G._test_many_timers = nil")
+
+
+def test_cancel_timer_before_and_after_fire(device):
+    """Cancelling a pending timer stops it; cancelling a fired one is a no-op."""
+    code = """
+        _G._test_cancel = { kept = false, cancelled = false }
+        local keep = ez.system.set_timer(30, function() _G._test_cancel.kept = true end)
+        local drop = ez.system.set_timer(60, function() _G._test_cancel.cancelled = true end)
+        ez.system.cancel_timer(drop)
+        return keep
+    """
+    keep_id = device.lua_exec(code)
+    try:
+        time.sleep(0.25)
+        device.lua_exec(f"ez.system.cancel_timer({keep_id})")
+        state = device.lua_exec(
+            "return tostring(_G._test_cancel.kept) .. ',' .. tostring(_G._test_cancel.cancelled)")
+        assert state == "true,false"
+    finally:
+        device.lua_exec("_G._test_cancel = nil")
+
+
+def test_interval_can_cancel_itself(device):
+    code = """
+        _G._test_self_cancel = 0
+        local id
+        id = ez.system.set_interval(20, function()
+            _G._test_self_cancel = _G._test_self_cancel + 1
+            if _G._test_self_cancel == 3 then ez.system.cancel_timer(id) end
+        end)
+    """
+    device.lua_exec(code)
+    try:
+        time.sleep(0.4)
+        assert device.lua_exec("return _G._test_self_cancel") == 3
+    finally:
+        device.lua_exec("_G._test_self_cancel = nil")
+
+
+def test_get_next_timer(device):
+    code = """
+        local id = ez.system.set_timer(5000, function() end)
+        local wait = ez.system.get_next_timer()
+        ez.system.cancel_timer(id)
+        return wait
+    """
+    wait = device.lua_exec(code)
+    assert isinstance(wait, int) and 0 <= wait <= 5000
+
+
 def test_cancel_unknown_timer_is_safe(device):
     """cancel_timer with a never-registered id must not crash."""
     device.lua_exec("ez.system.cancel_timer(999999)")
 
 
+
+def test_load_embedded_compiles_from_flash(device):
+    code = """
+        local chunk = ez.system.load_embedded("$core/modules.lua")
+        local missing, err = ez.system.load_embedded("$no/such/module.lua")
+        return { type(chunk), missing == nil, err }
+    """
+    kind, missing, err = device.lua_exec(code)
+    assert kind == "function"
+    assert missing is True
+    assert "not embedded" in err
+
+
+def test_script_stats_cover_boot(device):
+    stats = device.lua_exec("return ez.system.get_script_stats()")
+    boot = stats["boot"]
+    assert stats["embedded"] > 0
+    assert boot["modules"] > 0 and boot["boot_us"] > 0
+    assert boot["lookups"] >= boot["modules"]
+    # Perfect-hash lookups should be a rounding error next to loading
+    assert boot["lookup_us"] < boot["load_us"]
+    assert stats["lookups"] >= boot["lookups"]
+
+
+CACHE_SCRIPT = "/fs/test_system/cached.lua"
+
+
+def test_script_bytecode_cache(device):
+    code = f"""
+        local path = '{CACHE_SCRIPT}'
+        ez.storage.mkdir('/fs/test_system')
+        local function src(v)
+            local t = {{}}
+            for i = 1, 200 do t[i] = 'local v' .. i .. ' = ' .. i end
+            return table.concat(t, '\\n') .. '\\nreturn ' .. v
+        end
+        local function run()
+            local c0 = ez.system.get_script_stats().cache
+            local chunk = assert(ez.system.load_file(path))
+            local c1 = ez.system.get_script_stats().cache
+            return chunk(), c1.hits - c0.hits, c1.misses - c0.misses
+        end
+        local out = {{}}
+        ez.storage.write_file(path, src(1))
+        out.first = {{ run() }}
+        out.second = {{ run() }}
+        -- Same size, different content: must not be served from the cache
+        ez.storage.write_file(path, src(2))
+        out.edited = {{ run() }}
+        out.missing = ez.system.load_file('/fs/test_system/nope.lua') == nil
+        ez.storage.remove(path)
+        return out
+    """
+    out = device.lua_exec(code)
+    assert out["first"] == [1, 0, 1]
+    assert out["second"] == [1, 1, 0]
+    assert out["edited"] == [2, 0, 1]
+    assert out["missing"] is True
+
+
+def test_load_module_reads_off_thread(device):
+    """load_module reads the source and its cached bytecode on the AsyncIO
+    worker, so the task yields for it; the entry the worker writes back
+    after the miss serves the next load."""
+    yielded = device.lua_exec(f"""
+        ez.storage.mkdir('/fs/test_system')
+        ez.storage.write_file('{CACHE_SCRIPT}', 'return 5')
+        ez.system.clear_script_cache()
+        _G._test_load = nil
+        local loaded_first = false
+        spawn(function()
+            local c0 = ez.system.get_script_stats().cache
+            local first = load_module('{CACHE_SCRIPT}', true)
+            loaded_first = true
+            local function written()
+                local c = ez.system.get_script_stats().cache
+                return c.stores + c.store_errors > c0.stores + c0.store_errors
+            end
+            while not written() do wait_ms(10) end
+            local second = load_module('{CACHE_SCRIPT}', true)
+            local c1 = ez.system.get_script_stats().cache
+            _G._test_load = {{ first, second, c1.misses - c0.misses, c1.hits - c0.hits,
+                               c1.stores - c0.stores }}
+        end)
+        return not loaded_first
+    """)
+    try:
+        out = _poll(device, "_G._test_load")
+        assert yielded is True
+        assert out == [5, 5, 1, 1, 1]
+    finally:
+        device.lua_exec(f"_G._test_load = nil; ez.storage.remove('{CACHE_SCRIPT}')")
+
+
+def test_script_cache_stats_shape(device):
+    cache = device.lua_exec("return ez.system.get_script_stats().cache")
+    for key in ("hits", "misses", "stale", "stores", "store_errors",
+                "hit_us", "miss_us", "store_us", "hit_bytes", "miss_bytes"):
+        assert key in cache
+
+
+def test_micros_and_alloc_count_advance(device):
+    code = """
+        local t0, a0 = ez.system.micros(), ez.system.get_alloc_count()
+        local t = {}
+        for i = 1, 50 do t[i] = { i } end
+        return { ez.system.micros() - t0, ez.system.get_alloc_count() - a0 }
+    """
+    us, allocs = device.lua_exec(code)
+    assert us >= 0
+    assert allocs >= 50
+
+
+def test_boot_trace_report(device):
+    code = """
+        local r = module_trace.report()
+        local marks = {}
+        for _, m in ipairs(r.marks) do marks[m.name] = m.us end
+        local top = r.entries[1]
+        return { r.modules, marks.desktop, marks.boot, top.name, top.self_us <= top.us,
+                 type(r.eager) }
+    """
+    modules, desktop_us, boot_us, top_name, self_le_total, eager_type = device.lua_exec(code)
+    assert modules > 0
+    assert 0 < desktop_us <= boot_us
+    assert isinstance(top_name, str)
+    assert self_le_total is True
+    assert eager_type == "boolean"
+
+
+def test_lazy_require_loads_on_first_access(device):
+    code = """
+        package.preload["_test_lazy"] = function()
+            _G._test_lazy_loads = (_G._test_lazy_loads or 0) + 1
+            return { value = 42 }
+        end
+        local proxy = lazy_require("_test_lazy", function(m) m.inited = true end)
+        local before = _G._test_lazy_loads
+        local value = proxy.value
+        local again = require("_test_lazy").value
+        return { before == nil, value, again, proxy.inited, _G._test_lazy_loads }
+    """
+    try:
+        not_loaded, value, again, inited, loads = device.lua_exec(code)
+        assert not_loaded is True
+        assert value == 42 and again == 42
+        assert inited is True
+        assert loads == 1
+    finally:
+        device.lua_exec(
+            'package.loaded["_test_lazy"] = nil; package.preload["_test_lazy"] = nil; '
+            "_G._test_lazy_loads = nil")
+
+
+def test_lazy_require_keeps_load_error(device):
+    """A failed load raises with the traceback from where it failed, and
+    later accesses through the proxy report that error again."""
+    code = """
+        package.preload["_test_lazy_bad"] = function() error("boom") end
+        local proxy = lazy_require("_test_lazy_bad")
+        local ok1, e1 = pcall(function() return proxy.value end)
+        local ok2, e2 = pcall(function() return proxy.value end)
+        return { ok1, ok2, e1:find("boom", 1, true) ~= nil,
+                 e1:find("stack traceback", 1, true) ~= nil,
+                 e2:find("lazy module _test_lazy_bad failed to load", 1, true) ~= nil,
+                 e2:find("boom", 1, true) ~= nil }
+    """
+    try:
+        assert device.lua_exec(code) == [False, False, True, True, True, True]
+    finally:
+        device.lua_exec(
+            'package.loaded["_test_lazy_bad"] = nil; package.preload["_test_lazy_bad"] = nil')
+
+
+def test_lazy_require_eager_loads_at_once(device):
+    code = """
+        package.preload["_test_eager"] = function() return { value = 7 } end
+        local saved = module_trace.eager
+        module_trace.eager = true
+        local ok, m = pcall(lazy_require, "_test_eager", function(m) m.inited = true end)
+        module_trace.eager = saved
+        if not ok then error(m) end
+        return { rawget(m, "value"), rawget(m, "inited"), package.loaded["_test_eager"] == m }
+    """
+    try:
+        value, inited, same = device.lua_exec(code)
+        assert value == 7 and inited is True
+        assert same is True
+    finally:
+        device.lua_exec(
+            'package.loaded["_test_eager"] = nil; package.preload["_test_eager"] = nil')
+
+# ---------------------------------------------------------------------------
+# Coroutine scheduler (spawn / defer / wait_ms)
+# ---------------------------------------------------------------------------
+
+
+def _poll(device, expr, timeout=2.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        value = device.lua_exec(f"return {expr}")
+        if value is not None:
+            return value
+        time.sleep(0.05)
+    return None
+
+
+def test_scheduler_stats_shape(device):
+    s = device.lua_exec("return ez.system.get_scheduler_stats()")
+    for key in ("tasks", "ready", "parked", "sleeping", "spawned", "resumes",
+                "errors", "cancelled", "stale_wakes", "budget_hits", "max_ready"):
+        assert isinstance(s[key], int) and s[key] >= 0, key
+
+
+def test_nested_spawn_with_async_io(device):
+    """Spawning from inside a spawned coroutine used to fail with "cannot
+    resume dead coroutine"; every level must now finish with its own data."""
+    device.lua_exec("""
+        ez.storage.write_file('/fs/_test_sched.txt', 'nested')
+        _G._test_nested = {}
+        spawn(function()
+            local a = async_read('/fs/_test_sched.txt')
+            spawn(function()
+                local b = ez.storage.async_read_bytes('/fs/_test_sched.txt', 0, 3)
+                spawn(function()
+                    defer()
+                    _G._test_nested.c = 'deep'
+                end)
+                _G._test_nested.b = b
+            end)
+            defer()
+            _G._test_nested.a = a
+        end)
+    """)
+    try:
+        assert _poll(device, "_G._test_nested.c") == "deep"
+        assert _poll(device, "_G._test_nested.a") == "nested"
+        assert _poll(device, "_G._test_nested.b") == "nes"
+    finally:
+        device.lua_exec("_G._test_nested = nil; ez.storage.remove('/fs/_test_sched.txt')")
+
+
+def test_spawn_passes_arguments_and_returns_thread(device):
+    code = """
+        _G._test_args = nil
+        local co = spawn(function(a, b) _G._test_args = a + b end, 2, 3)
+        return { type(co), coroutine.status(co), _G._test_args }
+    """
+    try:
+        assert device.lua_exec(code) == ["thread", "dead", 5]
+    finally:
+        device.lua_exec("_G._test_args = nil")
+
+
+def test_wait_ms_sleeps_without_blocking(device):
+    code = """
+        _G._test_slept = nil
+        local t0 = ez.system.millis()
+        spawn(function()
+            wait_ms(120)
+            _G._test_slept = ez.system.millis() - t0
+        end)
+        return ez.system.millis() - t0
+    """
+    try:
+        returned_after = device.lua_exec(code)
+        assert returned_after < 50
+        slept = _poll(device, "_G._test_slept")
+        assert slept is not None and slept >= 120
+    finally:
+        device.lua_exec("_G._test_slept = nil")
+
+
+def test_bare_yield_resumes_next_frame(device):
+    code = """
+        _G._test_yields = 0
+        spawn(function()
+            for _ = 1, 3 do
+                coroutine.yield()
+                _G._test_yields = _G._test_yields + 1
+            end
+            _G._test_yields_done = true
+        end)
+        return _G._test_yields
+    """
+    try:
+        assert device.lua_exec(code) == 0
+        assert _poll(device, "_G._test_yields_done") is True
+        assert device.lua_exec("return _G._test_yields") == 3
+    finally:
+        device.lua_exec("_G._test_yields = nil; _G._test_yields_done = nil")
+
+
+def test_cancel_cascades_to_children(device):
+    before = device.lua_exec("return ez.system.get_scheduler_stats().cancelled")
+    device.lua_exec("""
+        _G._test_child_ran = nil
+        _G._test_parent = spawn(function()
+            spawn(function()
+                wait_ms(150)
+                _G._test_child_ran = true
+            end)
+            wait_ms(150)
+            _G._test_child_ran = true
+        end)
+        async_cancel(_G._test_parent)
+    """)
+    try:
+        time.sleep(0.5)
+        assert device.lua_exec("return _G._test_child_ran") is None
+        after = device.lua_exec("return ez.system.get_scheduler_stats().cancelled")
+        assert after >= before + 2
+    finally:
+        device.lua_exec("_G._test_child_ran = nil; _G._test_parent = nil")
+
+
+def test_wait_outside_coroutine_errors(device):
+    with pytest.raises(RuntimeError):
+        device.lua_exec("wait_ms(1)")
+    with pytest.raises(RuntimeError):
+        device.lua_exec("defer()")
+
+
 # ---------------------------------------------------------------------------
 # Bindings deliberately not exercised
 # ---------------------------------------------------------------------------
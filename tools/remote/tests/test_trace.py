@@ -0,0 +1,68 @@
+"""
+ez.trace bindings — timeline spans and Chrome trace-event JSON export.
+
+Each test leaves recording stopped and the ring cleared so firmware spans
+don't keep accumulating for the rest of the session.
+"""
+
+from __future__ import annotations
+
+import json
+
+import pytest
+
+
+@pytest.fixture
+def trace(device):
+    device.lua_exec("ez.trace.stop(); ez.trace.clear()")
+    yield device
+    device.lua_exec("ez.trace.stop(); ez.trace.clear()")
+
+
+def test_namespace(device):
+    assert device.lua_exec("return type(ez.trace)") == "table"
+    stats = device.lua_exec("return ez.trace.get_stats()")
+    assert stats["capacity"] >= 1024
+    assert stats["capacity"] & (stats["capacity"] - 1) == 0
+
+
+def test_lua_spans_recorded(trace):
+    found = trace.lua_exec("""
+        ez.trace.start()
+        ez.trace.begin("t_outer")
+        ez.trace.begin("t_inner")
+        ez.trace.instant("t_mark")
+        ez.trace.finish()
+        ez.trace.finish()
+        ez.trace.stop()
+        local s = ez.trace.dump()
+        return {
+            outer = s:find('"ph":"B"[^}]*"name":"t_outer"') ~= nil,
+            inner = s:find('"ph":"B"[^}]*"name":"t_inner"') ~= nil,
+            mark = s:find('"ph":"i"[^}]*"name":"t_mark"') ~= nil,
+            ends = select(2, s:gsub('"ph":"E"', '')),
+        }
+    """)
+    assert found["outer"] and found["inner"] and found["mark"]
+    assert found["ends"] >= 2
+
+
+def test_stopped_records_nothing(trace):
+    n = trace.lua_exec("""
+        ez.trace.begin("t_off")
+        ez.trace.finish()
+        return ez.trace.get_stats().recorded
+    """)
+    assert n == 0
+
+
+def test_frame_timeline(trace):
+    text, stats = trace.trace(0.5)
+    assert stats["recorded"] > 0 and stats["threads"] >= 1
+    doc = json.loads(text)
+    events = doc["traceEvents"]
+    names = {e.get("name") for e in events if e["ph"] == "B"}
+    # Every main-loop iteration is a frame span with its phases inside
+    assert "frame" in names and "lua" in names
+    meta = [e for e in events if e["ph"] == "M"]
+    assert any(e["args"]["name"] == "loopTask" for e in meta)
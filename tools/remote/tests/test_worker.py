@@ -0,0 +1,220 @@
+"""
+ez.worker — the sandboxed second Lua state on Core 0.
+
+A small module is written to LittleFS once for the whole file; the worker
+loads it on the first call and keeps it (and its upvalues) for the rest
+of the session. Each call runs in a spawned coroutine and parks its
+results in _G._test_worker, which the tests poll.
+"""
+
+from __future__ import annotations
+
+import time
+
+import pytest
+
+TEST_DIR = "/fs/test_worker"
+MODULE   = "/fs/test_worker/mod.lua"
+
+MODULE_SRC = r"""
+local M = {}
+local calls = 0
+function M.echo(...) return ... end
+function M.count() calls = calls + 1; return calls end
+function M.sum(n) local s = 0 for i = 1, n do s = s + i end return s end
+function M.fail(msg) error(msg) end
+function M.hog() return #string.rep("x", 4 * 1024 * 1024) end
+function M.set_global(v) shared_from_worker = v; return shared_from_worker end
+function M.probe()
+    return {
+        main_global = type(_test_worker_probe),
+        io = type(io), os = type(os), require = type(require),
+        dofile = type(dofile), spawn = type(spawn),
+        display = type(ez.display), read_file = type(ez.storage.read_file),
+        json = type(ez.storage.json_decode), log = type(ez.log),
+    }
+end
+return M
+"""
+
+
+@pytest.fixture(scope="module", autouse=True)
+def worker_module(device):
+    device.lua_exec(f"ez.storage.mkdir('{TEST_DIR}')")
+    device.lua_exec(f"return ez.storage.write_file('{MODULE}', [==[{MODULE_SRC}]==])")
+    yield MODULE
+    device.lua_exec(f"""
+        ez.storage.remove('{MODULE}')
+        ez.storage.rmdir('{TEST_DIR}')
+        _G._test_worker = nil
+        _G._test_worker_probe = nil
+    """)
+
+
+def _run(device, body, timeout=5.0):
+    """Run `body` (which sets _G._test_worker) in a coroutine and poll."""
+    device.lua_exec(f"""
+        _G._test_worker = nil
+        local MOD = '{MODULE}'
+        spawn(function() {body} end)
+    """)
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        value = device.lua_exec("return _G._test_worker")
+        if value is not None:
+            return value
+        time.sleep(0.05)
+    raise AssertionError("worker call did not complete")
+
+
+def test_namespace(device):
+    assert device.lua_exec("return type(ez.worker.call)") == "function"
+    assert device.lua_exec("return type(ez.worker.post)") == "function"
+
+
+def test_call_returns_results(device):
+    out = _run(device, "_G._test_worker = { ez.worker.call(MOD, 'sum', 100) }")
+    assert out == [True, 5050]
+
+
+def test_nested_tables_round_trip(device):
+    out = _run(device, r"""
+        local function same(a, b)
+            if type(a) ~= type(b) then return false end
+            if type(a) ~= 'table' then
+                return a == b and (type(a) ~= 'number' or math.type(a) == math.type(b))
+            end
+            for k, v in pairs(a) do if not same(v, b[k]) then return false end end
+            for k in pairs(b) do if a[k] == nil then return false end end
+            return true
+        end
+        local sent = {
+            name = 'root',
+            list = { 1, 2.5, 'three', true, false, -7 },
+            nested = { a = { b = { c = { d = 'deep', e = { 1, { 2, { 3 } } } } } } },
+            [10] = 'ten', [2.5] = 'float key', [true] = 'bool key',
+            bin = 'a\0b\255',
+            empty = {},
+        }
+        local ok, back, second = ez.worker.call(MOD, 'echo', sent, 'two')
+        _G._test_worker = {
+            ok, same(sent, back), back ~= sent, second,
+            math.type(back.list[1]), math.type(back.list[2]),
+        }
+    """)
+    assert out == [True, True, True, "two", "integer", "float"]
+
+
+def test_refuses_what_cannot_cross(device):
+    out = _run(device, """
+        local deep = {}
+        local t = deep
+        for i = 1, 40 do t.next = {}; t = t.next end
+        local cyclic = {}
+        cyclic.self = cyclic
+        local r = {}
+        r[1] = pcall(ez.worker.call, MOD, 'echo', function() end)
+        r[2] = pcall(ez.worker.call, MOD, 'echo', deep)
+        r[3] = pcall(ez.worker.call, MOD, 'echo', cyclic)
+        r[4] = select(2, ez.worker.call(MOD, 'sum', 3))
+        _G._test_worker = r
+    """)
+    assert out == [False, False, False, 6]
+
+
+def test_worker_is_isolated(device):
+    out = _run(device, """
+        _G._test_worker_probe = 1
+        local ok, probe = ez.worker.call(MOD, 'probe')
+        local _, v = ez.worker.call(MOD, 'set_global', 42)
+        _G._test_worker = { ok, probe, v, type(shared_from_worker) }
+    """)
+    ok, probe, value, main_view = out
+    assert ok is True
+    # Nothing from the main state, no file or hardware access
+    for key in ("main_global", "io", "os", "require", "dofile", "spawn",
+                "display", "read_file"):
+        assert probe[key] == "nil", key
+    assert probe["json"] == "function" and probe["log"] == "function"
+    # Worker globals stay in the worker
+    assert value == 42 and main_view == "nil"
+
+
+def test_module_state_persists_between_calls(device):
+    out = _run(device, """
+        local _, a = ez.worker.call(MOD, 'count')
+        local _, b = ez.worker.call(MOD, 'count')
+        _G._test_worker = { b - a }
+    """)
+    assert out == [1]
+
+
+def test_errors_come_back_as_false(device):
+    out = _run(device, """
+        local ok, err = ez.worker.call(MOD, 'fail', 'boom')
+        local ok2, err2 = ez.worker.call(MOD, 'missing')
+        _G._test_worker = { ok, err, ok2, err2, select(2, ez.worker.call(MOD, 'sum', 4)) }
+    """)
+    ok, err, ok2, err2, after = out
+    assert ok is False and "boom" in err
+    assert ok2 is False and "no function" in err2
+    assert after == 10
+
+
+def test_missing_module_raises(device):
+    out = _run(device, """
+        _G._test_worker = { pcall(ez.worker.call, '/fs/test_worker/none.lua', 'x') }
+    """)
+    assert out[0] is False and "not found" in out[1]
+
+
+def test_heap_limit_is_enforced(device):
+    out = _run(device, """
+        local ok, err = ez.worker.call(MOD, 'hog')
+        local s = ez.worker.stats()
+        _G._test_worker = { ok, err, select(2, ez.worker.call(MOD, 'sum', 5)),
+                            s.mem_peak <= s.mem_limit }
+    """, timeout=10.0)
+    ok, err, after, within = out
+    assert ok is False and "memory" in err
+    assert after == 15
+    assert within is True
+
+
+def test_oversized_argument_fails_without_reboot(device):
+    # Unpacking a 3 MB string in the worker's 2 MB heap runs out of
+    # memory; the job must fail, not panic the worker state
+    out = _run(device, """
+        local ok, err = ez.worker.call(MOD, 'echo', string.rep("x", 3 * 1024 * 1024))
+        _G._test_worker = { ok, err, select(2, ez.worker.call(MOD, 'sum', 6)) }
+    """, timeout=15.0)
+    ok, err, after = out
+    assert ok is False and err == "not enough memory"
+    assert after == 21
+
+
+def test_post_returns_promise(device):
+    device.lua_exec(f"""
+        _G._test_worker = nil
+        ez.worker.post('{MODULE}', 'sum', 10):and_then(function(v) _G._test_worker = v end)
+    """)
+    deadline = time.time() + 5.0
+    while time.time() < deadline:
+        if device.lua_exec("return _G._test_worker") == 55:
+            break
+        time.sleep(0.05)
+    assert device.lua_exec("return _G._test_worker") == 55
+
+
+def test_call_outside_coroutine_errors(device):
+    with pytest.raises(RuntimeError):
+        device.lua_exec(f"ez.worker.call('{MODULE}', 'sum', 1)")
+
+
+def test_stats(device):
+    s = device.lua_exec("return ez.worker.stats()")
+    assert s["running"] is True
+    assert s["completed"] >= 1 and s["posted"] >= s["completed"]
+    for key in ("errors", "rejected", "timeouts", "stale", "queued", "busy_us",
+                "mem_used", "mem_peak", "mem_limit", "modules"):
+        assert isinstance(s[key], int), key